@@ -21,9 +21,13 @@
  * Author: David Lutterkort <dlutter@redhat.com>
  */
 
+#include <errno.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #if HAVE_VIRDOMAINLXCENTERSECURITYLABEL
 #include <libvirt/libvirt-lxc.h>
 #endif
@@ -38,13 +42,28 @@
 #include "interface.h"
 #include "domain.h"
 #include "stream.h"
+#include "admin.h"
+#include "balloon.h"
+#include "vcpu.h"
+#include "metadata.h"
 
 static VALUE c_libvirt_version;
 
 VALUE m_libvirt;
 
+static int event_impl_registered;
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+static int native_event_loop_registered;
+static volatile int native_event_loop_running;
+/* the loop thread, while it has not been joined */
+static pthread_t native_event_loop_thread;
+static int native_event_loop_started;
+/* the timeout Libvirt::native_event_loop_stop wakes the loop with, or -1 */
+static int native_event_loop_wakeup = -1;
+#endif
+
 /* define additional errors here */
-static VALUE e_ConnectionError;         /* ConnectionError - error during connection establishment */
+VALUE e_ConnectionError;                /* ConnectionError - error during connection establishment */
 VALUE e_DefinitionError;
 VALUE e_RetrieveError;
 VALUE e_Error;
@@ -100,11 +119,13 @@ static VALUE libvirt_open(int argc, VALUE *argv, VALUE RUBY_LIBVIRT_UNUSED(m))
 
     rb_scan_args(argc, argv, "01", &uri);
 
-    conn = virConnectOpen(ruby_libvirt_get_cstring_or_null(uri));
+    conn = RUBY_LIBVIRT_CALL(virConnectOpen,
+                             ruby_libvirt_get_cstring_or_null(uri));
     ruby_libvirt_raise_error_if(conn == NULL, e_ConnectionError,
                                 "virConnectOpen", NULL);
 
-    return ruby_libvirt_connect_new(conn);
+    return ruby_libvirt_connect_open(conn, ruby_libvirt_get_cstring_or_null(uri),
+                                     0, 0, 0);
 }
 
 /*
@@ -122,12 +143,14 @@ static VALUE libvirt_open_read_only(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "01", &uri);
 
-    conn = virConnectOpenReadOnly(ruby_libvirt_get_cstring_or_null(uri));
+    conn = RUBY_LIBVIRT_CALL(virConnectOpenReadOnly,
+                             ruby_libvirt_get_cstring_or_null(uri));
 
     ruby_libvirt_raise_error_if(conn == NULL, e_ConnectionError,
                                 "virConnectOpenReadOnly", NULL);
 
-    return ruby_libvirt_connect_new(conn);
+    return ruby_libvirt_connect_open(conn, ruby_libvirt_get_cstring_or_null(uri),
+                                     1, 0, 0);
 }
 
 #if HAVE_VIRCONNECTOPENAUTH
@@ -260,7 +283,8 @@ static VALUE libvirt_open_auth(int argc, VALUE *argv,
     ruby_libvirt_raise_error_if(conn == NULL, e_ConnectionError,
                                 "virConnectOpenAuth", NULL);
 
-    return ruby_libvirt_connect_new(conn);
+    return ruby_libvirt_connect_open(conn, ruby_libvirt_get_cstring_or_null(uri),
+                                     0, 1, ruby_libvirt_value_to_uint(flags));
 }
 #endif
 
@@ -638,6 +662,22 @@ static VALUE libvirt_conn_event_register_impl(int argc, VALUE *argv,
     set_event_func_or_null(update_timeout);
     set_event_func_or_null(remove_timeout);
 
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+    if (native_event_loop_running || native_event_loop_started) {
+        rb_raise(rb_eArgError,
+                 "the native event loop is running; call Libvirt::native_event_loop_stop first");
+    }
+    /* this replaces the default implementation, which has to be registered
+     * again if the native loop is started later */
+    native_event_loop_registered = 0;
+#endif
+    ruby_libvirt_keep_gvl = !(NIL_P(add_handle) && NIL_P(update_handle) &&
+                              NIL_P(remove_handle) && NIL_P(add_timeout) &&
+                              NIL_P(update_timeout) && NIL_P(remove_timeout));
+    /* passing nothing but nils unregisters the implementation, which must
+     * not stop the native event loop from being started afterwards */
+    event_impl_registered = ruby_libvirt_keep_gvl;
+
     /* virEventRegisterImpl returns void, so no error checking here */
     virEventRegisterImpl(add_handle_temp, update_handle_temp,
                          remove_handle_temp, add_timeout_temp,
@@ -647,6 +687,166 @@ static VALUE libvirt_conn_event_register_impl(int argc, VALUE *argv,
 }
 #endif
 
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+
+static void *native_event_loop(void *RUBY_LIBVIRT_UNUSED(arg))
+{
+    while (native_event_loop_running) {
+        if (virEventRunDefaultImpl() < 0) {
+            virResetLastError();
+        }
+    }
+
+    return NULL;
+}
+
+static void native_event_loop_atfork_child(void)
+{
+    /* the loop thread does not survive fork(); let the child start another */
+    native_event_loop_running = 0;
+    native_event_loop_started = 0;
+}
+
+static void native_event_loop_wakeup_cb(int RUBY_LIBVIRT_UNUSED(timer),
+                                        void *RUBY_LIBVIRT_UNUSED(opaque))
+{
+}
+
+static void *native_event_loop_join(void *RUBY_LIBVIRT_UNUSED(arg))
+{
+    pthread_join(native_event_loop_thread, NULL);
+    return NULL;
+}
+
+/*
+ * Wait for a loop thread told to stop to exit and drop the timeout that
+ * woke it.  The join is done without the GVL, since the thread may be in a
+ * callback that needs it.
+ */
+static void native_event_loop_reap(void)
+{
+    if (native_event_loop_started) {
+        ruby_libvirt_without_gvl(native_event_loop_join, NULL);
+        native_event_loop_started = 0;
+    }
+    if (native_event_loop_wakeup >= 0) {
+        virEventRemoveTimeout(native_event_loop_wakeup);
+        native_event_loop_wakeup = -1;
+    }
+}
+
+/*
+ * call-seq:
+ *   Libvirt::native_event_loop_start -> nil
+ *
+ * Call virEventRegisterDefaultImpl[http://www.libvirt.org/html/libvirt-libvirt-event.html#virEventRegisterDefaultImpl]
+ * and run virEventRunDefaultImpl in a native background thread.  This gives
+ * libvirt a working event loop without the application having to provide
+ * one through Libvirt::event_register_impl, so keepalives are sent and
+ * answered (and dead connections detected) even while Ruby is blocked in
+ * a long libvirt call.  It must be called before opening the connections
+ * that are to be monitored; calling it again, including in a forked child,
+ * just makes sure the thread is running.  Libvirt::native_event_loop_stop
+ * stops the thread again.
+ */
+static VALUE libvirt_native_event_loop_start(VALUE RUBY_LIBVIRT_UNUSED(m))
+{
+    int r;
+
+    if (native_event_loop_running) {
+        return Qnil;
+    }
+    /* finish a stop that was interrupted */
+    native_event_loop_reap();
+    if (event_impl_registered) {
+        rb_raise(rb_eArgError,
+                 "an event implementation has already been registered with Libvirt::event_register_impl");
+    }
+
+    if (!native_event_loop_registered) {
+        ruby_libvirt_raise_error_if(virEventRegisterDefaultImpl() < 0,
+                                    e_Error, "virEventRegisterDefaultImpl",
+                                    NULL);
+        native_event_loop_registered = 1;
+    }
+
+    native_event_loop_running = 1;
+    r = pthread_create(&native_event_loop_thread, NULL, native_event_loop,
+                       NULL);
+    if (r != 0) {
+        native_event_loop_running = 0;
+        errno = r;
+        rb_sys_fail("pthread_create");
+    }
+    native_event_loop_started = 1;
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   Libvirt::native_event_loop_stop -> nil
+ *
+ * Stop the thread started by Libvirt::native_event_loop_start and wait for
+ * it to exit, waking virEventRunDefaultImpl up with a timeout that does
+ * nothing.  Connections opened while the loop ran no longer get their
+ * keepalives answered, so they should be closed first.  Afterwards the
+ * loop can be started again, or an event implementation registered with
+ * Libvirt::event_register_impl instead.  Does nothing if the loop is not
+ * running.
+ */
+static VALUE libvirt_native_event_loop_stop(VALUE RUBY_LIBVIRT_UNUSED(m))
+{
+    if (native_event_loop_running) {
+        native_event_loop_running = 0;
+        native_event_loop_wakeup = virEventAddTimeout(0,
+                                                      native_event_loop_wakeup_cb,
+                                                      NULL, NULL);
+        ruby_libvirt_raise_error_if(native_event_loop_wakeup < 0, e_Error,
+                                    "virEventAddTimeout", NULL);
+    }
+    native_event_loop_reap();
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   Libvirt::native_event_loop_running? -> [True|False]
+ *
+ * Return +true+ if the thread started by Libvirt::native_event_loop_start is
+ * running in this process.
+ */
+static VALUE libvirt_native_event_loop_running_p(VALUE RUBY_LIBVIRT_UNUSED(m))
+{
+    return native_event_loop_running ? Qtrue : Qfalse;
+}
+#endif
+
+/* Return non-zero if the native event loop thread is running. */
+int ruby_libvirt_native_event_loop_running(void)
+{
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+    return native_event_loop_running;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Return non-zero if some event implementation, native or Ruby, has been
+ * registered with libvirt in this process.
+ */
+int ruby_libvirt_event_impl_registered(void)
+{
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+    if (native_event_loop_running) {
+        return 1;
+    }
+#endif
+    return event_impl_registered;
+}
+
 #if HAVE_VIRDOMAINLXCENTERSECURITYLABEL
 /*
  * call-seq:
@@ -690,8 +890,8 @@ static VALUE libvirt_domain_lxc_enter_security_label(int argc, VALUE *argv,
     memcpy(lab.label, labstr, strlen(labstr));
     lab.enforcing = NUM2INT(rb_iv_get(label, "@enforcing"));
 
-    ret = virDomainLxcEnterSecurityLabel(&mod, &lab, &oldlab,
-                                         ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainLxcEnterSecurityLabel, &mod, &lab,
+                            &oldlab, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainLxcEnterSecurityLabel", NULL);
 
@@ -1010,6 +1210,16 @@ void Init__libvirt(void)
                               libvirt_event_invoke_timeout_callback, 2);
 #endif
 
+#if HAVE_VIREVENTREGISTERDEFAULTIMPL && HAVE_PTHREAD_H
+    pthread_atfork(NULL, NULL, native_event_loop_atfork_child);
+    rb_define_module_function(m_libvirt, "native_event_loop_start",
+                              libvirt_native_event_loop_start, 0);
+    rb_define_module_function(m_libvirt, "native_event_loop_stop",
+                              libvirt_native_event_loop_stop, 0);
+    rb_define_module_function(m_libvirt, "native_event_loop_running?",
+                              libvirt_native_event_loop_running_p, 0);
+#endif
+
 #if HAVE_VIRDOMAINLXCENTERSECURITYLABEL
     rb_define_method(m_libvirt, "lxc_enter_security_label",
                      libvirt_domain_lxc_enter_security_label, -1);
@@ -1024,6 +1234,10 @@ void Init__libvirt(void)
     ruby_libvirt_interface_init();
     ruby_libvirt_domain_init();
     ruby_libvirt_stream_init();
+    ruby_libvirt_admin_init();
+    ruby_libvirt_balloon_init();
+    ruby_libvirt_vcpu_init();
+    ruby_libvirt_metadata_init();
 
     virSetErrorFunc(NULL, rubyLibvirtErrorFunc);
 
@@ -0,0 +1,825 @@
+/*
+ * admin.c: virAdm methods for tuning the libvirt daemon itself
+ *
+ * Copyright (C) 2013-2016 Chris Lalancette <clalancette@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#if HAVE_VIRADMCONNECTOPEN
+#include <libvirt/libvirt-admin.h>
+#endif
+#include "common.h"
+#include "admin.h"
+
+#if HAVE_VIRADMCONNECTOPEN
+static VALUE m_admin;
+static VALUE c_admin_connect;
+static VALUE c_admin_server;
+static VALUE c_admin_client;
+
+/*
+ * Admin objects are owned by an admin connection, not a Libvirt::Connect,
+ * so they cannot use ruby_libvirt_connect_get().  libvirt-admin reports its
+ * errors through the same thread-local last error as libvirt itself, which
+ * is what ruby_libvirt_raise_error_if() falls back to without a connection.
+ */
+
+static void admin_connect_free(void *c)
+{
+    if (c != NULL) {
+        virAdmConnectClose((virAdmConnectPtr)c);
+    }
+}
+
+static virAdmConnectPtr admin_connect_get(VALUE c)
+{
+    virAdmConnectPtr conn;
+
+    if (rb_obj_is_instance_of(c, c_admin_connect) != Qtrue) {
+        c = rb_iv_get(c, "@connection");
+    }
+    Data_Get_Struct(c, virAdmConnect, conn);
+    if (!conn) {
+        rb_raise(rb_eArgError, "Admin connection has been closed");
+    }
+    return conn;
+}
+
+/*
+ * call-seq:
+ *   Libvirt::Admin::open(uri=nil, flags=0) -> Libvirt::Admin::Connect
+ *
+ * Call virAdmConnectOpen[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectOpen]
+ * to open an administration connection to a libvirt daemon.  If uri is nil
+ * the default daemon for the current user (libvirtd:///system for root,
+ * libvirtd:///session otherwise) is used.
+ */
+static VALUE libvirt_admin_open(int argc, VALUE *argv,
+                                VALUE RUBY_LIBVIRT_UNUSED(m))
+{
+    VALUE uri, flags;
+    virAdmConnectPtr conn;
+
+    rb_scan_args(argc, argv, "02", &uri, &flags);
+
+    conn = RUBY_LIBVIRT_CALL(virAdmConnectOpen,
+                             ruby_libvirt_get_cstring_or_null(uri),
+                             ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(conn == NULL, e_ConnectionError,
+                                "virAdmConnectOpen", NULL);
+
+    return Data_Wrap_Struct(c_admin_connect, NULL, admin_connect_free, conn);
+}
+
+/*
+ * call-seq:
+ *   adm.close -> nil
+ *
+ * Call virAdmConnectClose[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectClose]
+ * to close the administration connection.
+ */
+static VALUE libvirt_admin_connect_close(VALUE c)
+{
+    virAdmConnectPtr conn;
+
+    Data_Get_Struct(c, virAdmConnect, conn);
+    if (conn) {
+        RUBY_LIBVIRT_CALL(virAdmConnectClose, conn);
+        DATA_PTR(c) = NULL;
+    }
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   adm.closed? -> [True|False]
+ *
+ * Return +true+ if the administration connection is closed, +false+ if it
+ * is open.
+ */
+static VALUE libvirt_admin_connect_closed_p(VALUE c)
+{
+    virAdmConnectPtr conn;
+
+    Data_Get_Struct(c, virAdmConnect, conn);
+    return (conn == NULL) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   adm.alive? -> [True|False]
+ *
+ * Call virAdmConnectIsAlive[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectIsAlive]
+ * to determine if the administration connection is alive.
+ */
+static VALUE libvirt_admin_connect_alive_p(VALUE c)
+{
+    int r;
+
+    r = RUBY_LIBVIRT_CALL(virAdmConnectIsAlive, admin_connect_get(c));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmConnectIsAlive", NULL);
+
+    return r ? Qtrue : Qfalse;
+}
+
+#if HAVE_VIRADMCONNECTGETURI
+/*
+ * call-seq:
+ *   adm.uri -> String
+ *
+ * Call virAdmConnectGetURI[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectGetURI]
+ * to retrieve the canonical URI of the daemon this connection is talking to.
+ */
+static VALUE libvirt_admin_connect_uri(VALUE c)
+{
+    char *uri;
+    VALUE result;
+    int exception = 0;
+
+    uri = RUBY_LIBVIRT_CALL(virAdmConnectGetURI, admin_connect_get(c));
+    ruby_libvirt_raise_error_if(uri == NULL, e_RetrieveError,
+                                "virAdmConnectGetURI", NULL);
+
+    result = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&uri, &exception);
+    free(uri);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+#if HAVE_VIRADMCONNECTGETLIBVERSION
+/*
+ * call-seq:
+ *   adm.lib_version -> Fixnum
+ *
+ * Call virAdmConnectGetLibVersion[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectGetLibVersion]
+ * to retrieve the version of libvirt the daemon is running, in the same
+ * form as Libvirt::Connect#libversion.
+ */
+static VALUE libvirt_admin_connect_lib_version(VALUE c)
+{
+    unsigned long long version;
+    int r;
+
+    r = RUBY_LIBVIRT_CALL(virAdmConnectGetLibVersion, admin_connect_get(c),
+                          &version);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmConnectGetLibVersion", NULL);
+
+    return ULL2NUM(version);
+}
+#endif
+
+#if HAVE_VIRADMCONNECTLISTSERVERS
+static void admin_server_free(void *s)
+{
+    ruby_libvirt_free_struct(AdmServer, s);
+}
+
+static virAdmServerPtr admin_server_get(VALUE s)
+{
+    ruby_libvirt_get_struct(AdmServer, s);
+}
+
+static VALUE admin_server_new(virAdmServerPtr s, VALUE conn)
+{
+    return ruby_libvirt_new_class(c_admin_server, s, conn, admin_server_free);
+}
+
+/*
+ * call-seq:
+ *   adm.list_servers(flags=0) -> list
+ *
+ * Call virAdmConnectListServers[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectListServers]
+ * to retrieve a list of the servers (such as "libvirtd" and "admin") that
+ * the daemon runs.
+ */
+static VALUE libvirt_admin_connect_list_servers(int argc, VALUE *argv, VALUE c)
+{
+    VALUE flags, result;
+    virAdmServerPtr *servers;
+    struct ruby_libvirt_ary_push_arg arg;
+    int i, r, exception = 0;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmConnectListServers, admin_connect_get(c),
+                          &servers, ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmConnectListServers", NULL);
+
+    result = rb_protect(ruby_libvirt_ary_new2_wrap, (VALUE)&r, &exception);
+    for (i = 0; !exception && i < r; i++) {
+        arg.arr = result;
+        arg.value = admin_server_new(servers[i], c);
+        servers[i] = NULL;
+        rb_protect(ruby_libvirt_ary_push_wrap, (VALUE)&arg, &exception);
+    }
+    for (; i < r; i++) {
+        virAdmServerFree(servers[i]);
+    }
+    free(servers);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+#if HAVE_VIRADMCONNECTLOOKUPSERVER
+/*
+ * call-seq:
+ *   adm.lookup_server(name, flags=0) -> Libvirt::Admin::Server
+ *
+ * Call virAdmConnectLookupServer[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmConnectLookupServer]
+ * to retrieve the server called name.
+ */
+static VALUE libvirt_admin_connect_lookup_server(int argc, VALUE *argv,
+                                                 VALUE c)
+{
+    VALUE name, flags;
+    virAdmServerPtr srv;
+
+    rb_scan_args(argc, argv, "11", &name, &flags);
+
+    srv = RUBY_LIBVIRT_CALL(virAdmConnectLookupServer, admin_connect_get(c),
+                            StringValueCStr(name),
+                            ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(srv == NULL, e_RetrieveError,
+                                "virAdmConnectLookupServer", NULL);
+
+    return admin_server_new(srv, c);
+}
+#endif
+
+/*
+ * call-seq:
+ *   server.name -> String
+ *
+ * Call virAdmServerGetName[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerGetName]
+ * to retrieve the name of the server.
+ */
+static VALUE libvirt_admin_server_name(VALUE s)
+{
+    const char *name;
+
+    name = virAdmServerGetName(admin_server_get(s));
+    ruby_libvirt_raise_error_if(name == NULL, e_RetrieveError,
+                                "virAdmServerGetName", NULL);
+
+    return rb_str_new2(name);
+}
+
+/*
+ * call-seq:
+ *   server.free -> nil
+ *
+ * Call virAdmServerFree[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerFree]
+ * to free this server object.  After this call the server object is no
+ * longer valid.
+ */
+static VALUE libvirt_admin_server_free(VALUE s)
+{
+    virAdmServerPtr srv;
+
+    Data_Get_Struct(s, virAdmServer, srv);
+    if (srv != NULL) {
+        ruby_libvirt_raise_error_if(virAdmServerFree(srv) < 0, e_Error,
+                                    "virAdmServerFree", NULL);
+        DATA_PTR(s) = NULL;
+    }
+
+    return Qnil;
+}
+
+struct admin_params_arg {
+    virTypedParameterPtr params;
+    int nparams;
+    VALUE result;
+};
+
+static VALUE admin_params_to_hash(VALUE in)
+{
+    struct admin_params_arg *args = (struct admin_params_arg *)in;
+    int i;
+
+    for (i = 0; i < args->nparams; i++) {
+        ruby_libvirt_typed_params_to_hash(args->params, i, args->result);
+    }
+
+    return args->result;
+}
+
+/* The virAdm getters allocate the parameter list themselves; turn it into
+ * a Hash and free it, also if building the Hash raises.
+ */
+static VALUE admin_params_result(virTypedParameterPtr params, int nparams)
+{
+    struct admin_params_arg args;
+    int exception = 0;
+
+    args.params = params;
+    args.nparams = nparams;
+    args.result = rb_hash_new();
+    rb_protect(admin_params_to_hash, (VALUE)&args, &exception);
+    virTypedParamsFree(params, nparams);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return args.result;
+}
+
+#if HAVE_VIRADMSERVERSETTHREADPOOLPARAMETERS || HAVE_VIRADMSERVERSETCLIENTLIMITS
+/* Fill PARAMS, which has room for NUM_ALLOWED entries, from the Hash (or
+ * [Hash, flags] Array) IN.  Returns the number of entries filled in.
+ */
+static int admin_params_from_hash(VALUE in, unsigned int *flags,
+                                  struct ruby_libvirt_typed_param *allowed,
+                                  unsigned int num_allowed,
+                                  virTypedParameterPtr params)
+{
+    struct ruby_libvirt_parameter_assign_args args;
+    VALUE hash, rflags;
+
+    ruby_libvirt_assign_hash_and_flags(in, &hash, &rflags);
+    Check_Type(hash, T_HASH);
+    *flags = ruby_libvirt_value_to_uint(rflags);
+
+    memset(params, 0, sizeof(virTypedParameter) * num_allowed);
+    args.allowed = allowed;
+    args.num_allowed = num_allowed;
+    args.params = params;
+    args.i = 0;
+    rb_hash_foreach(hash, ruby_libvirt_typed_parameter_assign, (VALUE)&args);
+
+    return args.i;
+}
+#endif
+
+#if HAVE_VIRADMSERVERGETTHREADPOOLPARAMETERS
+/*
+ * call-seq:
+ *   server.thread_pool_parameters(flags=0) -> Hash
+ *
+ * Call virAdmServerGetThreadPoolParameters[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerGetThreadPoolParameters]
+ * to retrieve the sizing and current occupancy of the server's worker pool.
+ * The keys are the Libvirt::Admin::THREADPOOL_* constants.
+ */
+static VALUE libvirt_admin_server_thread_pool_parameters(int argc, VALUE *argv,
+                                                         VALUE s)
+{
+    VALUE flags;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0, r;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmServerGetThreadPoolParameters,
+                          admin_server_get(s), &params, &nparams,
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmServerGetThreadPoolParameters", NULL);
+
+    return admin_params_result(params, nparams);
+}
+
+#if HAVE_VIRADMSERVERSETTHREADPOOLPARAMETERS
+static struct ruby_libvirt_typed_param threadpool_allowed[] = {
+    {VIR_THREADPOOL_WORKERS_MIN, VIR_TYPED_PARAM_UINT},
+    {VIR_THREADPOOL_WORKERS_MAX, VIR_TYPED_PARAM_UINT},
+    {VIR_THREADPOOL_WORKERS_PRIORITY, VIR_TYPED_PARAM_UINT},
+};
+
+/*
+ * call-seq:
+ *   server.thread_pool_parameters = Hash,flags=0
+ *
+ * Call virAdmServerSetThreadPoolParameters[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerSetThreadPoolParameters]
+ * to resize the server's worker pool.  Only THREADPOOL_WORKERS_MIN,
+ * THREADPOOL_WORKERS_MAX and THREADPOOL_WORKERS_PRIORITY can be set.
+ */
+static VALUE libvirt_admin_server_thread_pool_parameters_equal(VALUE s,
+                                                               VALUE in)
+{
+    virTypedParameter params[ARRAY_SIZE(threadpool_allowed)];
+    unsigned int flags;
+    int nparams, r;
+
+    nparams = admin_params_from_hash(in, &flags, threadpool_allowed,
+                                     ARRAY_SIZE(threadpool_allowed), params);
+
+    r = RUBY_LIBVIRT_CALL(virAdmServerSetThreadPoolParameters,
+                          admin_server_get(s), params, nparams, flags);
+    ruby_libvirt_raise_error_if(r < 0, e_Error,
+                                "virAdmServerSetThreadPoolParameters", NULL);
+
+    return Qnil;
+}
+#endif
+#endif
+
+#if HAVE_VIRADMSERVERGETCLIENTLIMITS
+/*
+ * call-seq:
+ *   server.client_limits(flags=0) -> Hash
+ *
+ * Call virAdmServerGetClientLimits[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerGetClientLimits]
+ * to retrieve the server's client limits and how many clients are currently
+ * connected.  The keys are the Libvirt::Admin::SERVER_CLIENTS_* constants.
+ */
+static VALUE libvirt_admin_server_client_limits(int argc, VALUE *argv,
+                                                VALUE s)
+{
+    VALUE flags;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0, r;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmServerGetClientLimits, admin_server_get(s),
+                          &params, &nparams,
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmServerGetClientLimits", NULL);
+
+    return admin_params_result(params, nparams);
+}
+
+#if HAVE_VIRADMSERVERSETCLIENTLIMITS
+static struct ruby_libvirt_typed_param client_limits_allowed[] = {
+    {VIR_SERVER_CLIENTS_MAX, VIR_TYPED_PARAM_UINT},
+    {VIR_SERVER_CLIENTS_UNAUTH_MAX, VIR_TYPED_PARAM_UINT},
+};
+
+/*
+ * call-seq:
+ *   server.client_limits = Hash,flags=0
+ *
+ * Call virAdmServerSetClientLimits[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerSetClientLimits]
+ * to change the server's client limits.  Only SERVER_CLIENTS_MAX and
+ * SERVER_CLIENTS_UNAUTH_MAX can be set.
+ */
+static VALUE libvirt_admin_server_client_limits_equal(VALUE s, VALUE in)
+{
+    virTypedParameter params[ARRAY_SIZE(client_limits_allowed)];
+    unsigned int flags;
+    int nparams, r;
+
+    nparams = admin_params_from_hash(in, &flags, client_limits_allowed,
+                                     ARRAY_SIZE(client_limits_allowed),
+                                     params);
+
+    r = RUBY_LIBVIRT_CALL(virAdmServerSetClientLimits, admin_server_get(s),
+                          params, nparams, flags);
+    ruby_libvirt_raise_error_if(r < 0, e_Error, "virAdmServerSetClientLimits",
+                                NULL);
+
+    return Qnil;
+}
+#endif
+#endif
+
+#if HAVE_VIRADMSERVERLISTCLIENTS
+static void admin_client_free(void *c)
+{
+    ruby_libvirt_free_struct(AdmClient, c);
+}
+
+static virAdmClientPtr admin_client_get(VALUE c)
+{
+    ruby_libvirt_get_struct(AdmClient, c);
+}
+
+static VALUE admin_client_new(virAdmClientPtr c, VALUE conn)
+{
+    return ruby_libvirt_new_class(c_admin_client, c, conn, admin_client_free);
+}
+
+/*
+ * call-seq:
+ *   server.list_clients(flags=0) -> list
+ *
+ * Call virAdmServerListClients[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerListClients]
+ * to retrieve a list of the clients currently connected to the server.
+ */
+static VALUE libvirt_admin_server_list_clients(int argc, VALUE *argv, VALUE s)
+{
+    VALUE flags, result, conn;
+    virAdmClientPtr *clients;
+    struct ruby_libvirt_ary_push_arg arg;
+    int i, r, exception = 0;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmServerListClients, admin_server_get(s),
+                          &clients, ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmServerListClients", NULL);
+
+    conn = rb_iv_get(s, "@connection");
+    result = rb_protect(ruby_libvirt_ary_new2_wrap, (VALUE)&r, &exception);
+    for (i = 0; !exception && i < r; i++) {
+        arg.arr = result;
+        arg.value = admin_client_new(clients[i], conn);
+        clients[i] = NULL;
+        rb_protect(ruby_libvirt_ary_push_wrap, (VALUE)&arg, &exception);
+    }
+    for (; i < r; i++) {
+        virAdmClientFree(clients[i]);
+    }
+    free(clients);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   server.lookup_client(id, flags=0) -> Libvirt::Admin::Client
+ *
+ * Call virAdmServerLookupClient[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmServerLookupClient]
+ * to retrieve the client with the given id.
+ */
+static VALUE libvirt_admin_server_lookup_client(int argc, VALUE *argv,
+                                                VALUE s)
+{
+    VALUE id, flags;
+    virAdmClientPtr client;
+
+    rb_scan_args(argc, argv, "11", &id, &flags);
+
+    client = RUBY_LIBVIRT_CALL(virAdmServerLookupClient, admin_server_get(s),
+                               NUM2ULL(id), ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(client == NULL, e_RetrieveError,
+                                "virAdmServerLookupClient", NULL);
+
+    return admin_client_new(client, rb_iv_get(s, "@connection"));
+}
+
+/*
+ * call-seq:
+ *   client.id -> Fixnum
+ *
+ * Call virAdmClientGetID[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientGetID]
+ * to retrieve the server-unique id of the client.
+ */
+static VALUE libvirt_admin_client_id(VALUE c)
+{
+    return ULL2NUM(virAdmClientGetID(admin_client_get(c)));
+}
+
+/*
+ * call-seq:
+ *   client.timestamp -> Fixnum
+ *
+ * Call virAdmClientGetTimestamp[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientGetTimestamp]
+ * to retrieve the time, in seconds since the epoch, at which the client
+ * connected.
+ */
+static VALUE libvirt_admin_client_timestamp(VALUE c)
+{
+    long long ts;
+
+    ts = RUBY_LIBVIRT_CALL(virAdmClientGetTimestamp, admin_client_get(c));
+    ruby_libvirt_raise_error_if(ts < 0, e_RetrieveError,
+                                "virAdmClientGetTimestamp", NULL);
+
+    return LL2NUM(ts);
+}
+
+/*
+ * call-seq:
+ *   client.transport -> Fixnum
+ *
+ * Call virAdmClientGetTransport[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientGetTransport]
+ * to retrieve how the client is connected, one of the
+ * Libvirt::Admin::Client::TRANSPORT_* constants.
+ */
+static VALUE libvirt_admin_client_transport(VALUE c)
+{
+    int r;
+
+    r = RUBY_LIBVIRT_CALL(virAdmClientGetTransport, admin_client_get(c));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virAdmClientGetTransport", NULL);
+
+    return INT2NUM(r);
+}
+
+#if HAVE_VIRADMCLIENTGETINFO
+/*
+ * call-seq:
+ *   client.info(flags=0) -> Hash
+ *
+ * Call virAdmClientGetInfo[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientGetInfo]
+ * to retrieve identity information about the client, such as its socket
+ * address, whether it is read-only and, for UNIX sockets, its user and
+ * process.
+ */
+static VALUE libvirt_admin_client_info(int argc, VALUE *argv, VALUE c)
+{
+    VALUE flags;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0, r;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmClientGetInfo, admin_client_get(c), &params,
+                          &nparams, ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virAdmClientGetInfo",
+                                NULL);
+
+    return admin_params_result(params, nparams);
+}
+#endif
+
+#if HAVE_VIRADMCLIENTCLOSE
+/*
+ * call-seq:
+ *   client.close(flags=0) -> nil
+ *
+ * Call virAdmClientClose[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientClose]
+ * to forcefully disconnect the client from the server.
+ */
+static VALUE libvirt_admin_client_close(int argc, VALUE *argv, VALUE c)
+{
+    VALUE flags;
+    int r;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virAdmClientClose, admin_client_get(c),
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_Error, "virAdmClientClose", NULL);
+
+    return Qnil;
+}
+#endif
+
+/*
+ * call-seq:
+ *   client.free -> nil
+ *
+ * Call virAdmClientFree[http://www.libvirt.org/html/libvirt-libvirt-admin.html#virAdmClientFree]
+ * to free this client object.  This does not disconnect the client.
+ */
+static VALUE libvirt_admin_client_free(VALUE c)
+{
+    virAdmClientPtr client;
+
+    Data_Get_Struct(c, virAdmClient, client);
+    if (client != NULL) {
+        ruby_libvirt_raise_error_if(virAdmClientFree(client) < 0, e_Error,
+                                    "virAdmClientFree", NULL);
+        DATA_PTR(c) = NULL;
+    }
+
+    return Qnil;
+}
+#endif
+#endif
+
+#endif
+
+/*
+ * Module Libvirt::Admin
+ */
+void ruby_libvirt_admin_init(void)
+{
+#if HAVE_VIRADMCONNECTOPEN
+    m_admin = rb_define_module_under(m_libvirt, "Admin");
+    rb_define_module_function(m_admin, "open", libvirt_admin_open, -1);
+
+#if HAVE_VIRADMSERVERGETTHREADPOOLPARAMETERS
+    rb_define_const(m_admin, "THREADPOOL_WORKERS_MIN",
+                    rb_str_new2(VIR_THREADPOOL_WORKERS_MIN));
+    rb_define_const(m_admin, "THREADPOOL_WORKERS_MAX",
+                    rb_str_new2(VIR_THREADPOOL_WORKERS_MAX));
+    rb_define_const(m_admin, "THREADPOOL_WORKERS_PRIORITY",
+                    rb_str_new2(VIR_THREADPOOL_WORKERS_PRIORITY));
+    rb_define_const(m_admin, "THREADPOOL_WORKERS_FREE",
+                    rb_str_new2(VIR_THREADPOOL_WORKERS_FREE));
+    rb_define_const(m_admin, "THREADPOOL_WORKERS_CURRENT",
+                    rb_str_new2(VIR_THREADPOOL_WORKERS_CURRENT));
+    rb_define_const(m_admin, "THREADPOOL_JOB_QUEUE_DEPTH",
+                    rb_str_new2(VIR_THREADPOOL_JOB_QUEUE_DEPTH));
+#endif
+#if HAVE_VIRADMSERVERGETCLIENTLIMITS
+    rb_define_const(m_admin, "SERVER_CLIENTS_MAX",
+                    rb_str_new2(VIR_SERVER_CLIENTS_MAX));
+    rb_define_const(m_admin, "SERVER_CLIENTS_CURRENT",
+                    rb_str_new2(VIR_SERVER_CLIENTS_CURRENT));
+    rb_define_const(m_admin, "SERVER_CLIENTS_UNAUTH_MAX",
+                    rb_str_new2(VIR_SERVER_CLIENTS_UNAUTH_MAX));
+    rb_define_const(m_admin, "SERVER_CLIENTS_UNAUTH_CURRENT",
+                    rb_str_new2(VIR_SERVER_CLIENTS_UNAUTH_CURRENT));
+#endif
+
+    /*
+     * Class Libvirt::Admin::Connect
+     */
+    c_admin_connect = rb_define_class_under(m_admin, "Connect", rb_cObject);
+    rb_define_method(c_admin_connect, "close", libvirt_admin_connect_close, 0);
+    rb_define_method(c_admin_connect, "closed?",
+                     libvirt_admin_connect_closed_p, 0);
+    rb_define_method(c_admin_connect, "alive?", libvirt_admin_connect_alive_p,
+                     0);
+#if HAVE_VIRADMCONNECTGETURI
+    rb_define_method(c_admin_connect, "uri", libvirt_admin_connect_uri, 0);
+#endif
+#if HAVE_VIRADMCONNECTGETLIBVERSION
+    rb_define_method(c_admin_connect, "lib_version",
+                     libvirt_admin_connect_lib_version, 0);
+#endif
+#if HAVE_VIRADMCONNECTLISTSERVERS
+    rb_define_method(c_admin_connect, "list_servers",
+                     libvirt_admin_connect_list_servers, -1);
+#if HAVE_VIRADMCONNECTLOOKUPSERVER
+    rb_define_method(c_admin_connect, "lookup_server",
+                     libvirt_admin_connect_lookup_server, -1);
+#endif
+
+    /*
+     * Class Libvirt::Admin::Server
+     */
+    c_admin_server = rb_define_class_under(m_admin, "Server", rb_cObject);
+    rb_define_attr(c_admin_server, "connection", 1, 0);
+    rb_define_method(c_admin_server, "name", libvirt_admin_server_name, 0);
+    rb_define_method(c_admin_server, "free", libvirt_admin_server_free, 0);
+#if HAVE_VIRADMSERVERGETTHREADPOOLPARAMETERS
+    rb_define_method(c_admin_server, "thread_pool_parameters",
+                     libvirt_admin_server_thread_pool_parameters, -1);
+#if HAVE_VIRADMSERVERSETTHREADPOOLPARAMETERS
+    rb_define_method(c_admin_server, "thread_pool_parameters=",
+                     libvirt_admin_server_thread_pool_parameters_equal, 1);
+#endif
+#endif
+#if HAVE_VIRADMSERVERGETCLIENTLIMITS
+    rb_define_method(c_admin_server, "client_limits",
+                     libvirt_admin_server_client_limits, -1);
+#if HAVE_VIRADMSERVERSETCLIENTLIMITS
+    rb_define_method(c_admin_server, "client_limits=",
+                     libvirt_admin_server_client_limits_equal, 1);
+#endif
+#endif
+
+#if HAVE_VIRADMSERVERLISTCLIENTS
+    rb_define_method(c_admin_server, "list_clients",
+                     libvirt_admin_server_list_clients, -1);
+    rb_define_method(c_admin_server, "lookup_client",
+                     libvirt_admin_server_lookup_client, -1);
+
+    /*
+     * Class Libvirt::Admin::Client
+     */
+    c_admin_client = rb_define_class_under(m_admin, "Client", rb_cObject);
+    rb_define_const(c_admin_client, "TRANSPORT_UNIX",
+                    INT2NUM(VIR_CLIENT_TRANS_UNIX));
+    rb_define_const(c_admin_client, "TRANSPORT_TCP",
+                    INT2NUM(VIR_CLIENT_TRANS_TCP));
+    rb_define_const(c_admin_client, "TRANSPORT_TLS",
+                    INT2NUM(VIR_CLIENT_TRANS_TLS));
+    rb_define_attr(c_admin_client, "connection", 1, 0);
+    rb_define_method(c_admin_client, "id", libvirt_admin_client_id, 0);
+    rb_define_method(c_admin_client, "timestamp",
+                     libvirt_admin_client_timestamp, 0);
+    rb_define_method(c_admin_client, "transport",
+                     libvirt_admin_client_transport, 0);
+#if HAVE_VIRADMCLIENTGETINFO
+    rb_define_method(c_admin_client, "info", libvirt_admin_client_info, -1);
+#endif
+#if HAVE_VIRADMCLIENTCLOSE
+    rb_define_method(c_admin_client, "close", libvirt_admin_client_close, -1);
+#endif
+    rb_define_method(c_admin_client, "free", libvirt_admin_client_free, 0);
+#endif
+#endif
+#endif
+}
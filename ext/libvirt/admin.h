@@ -0,0 +1,6 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+void ruby_libvirt_admin_init(void);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * balloon.c: a native memory balloon controller
+ *
+ * Copyright (C) 2013-2016 Chris Lalancette <clalancette@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#include "common.h"
+#include "connect.h"
+#include "controller.h"
+#include "balloon.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_BALLOON && HAVE_PTHREAD_H
+static VALUE c_balloon_controller;
+
+/*
+ * A Libvirt::BalloonController is a native controller (see controller.c)
+ * whose cycle fetches the balloon stats of all running domains with one
+ * virConnectGetAllDomainStats call and resizes the balloons that fall
+ * outside the policy, in parallel.
+ */
+struct balloon_policy {
+    int min_free;
+    int max_free;
+    unsigned long long max_reclaim_rate;
+};
+
+struct balloon_controller {
+    struct ruby_libvirt_controller base;
+    struct balloon_policy policy;
+
+    unsigned long long grown;
+    unsigned long long shrunk;
+};
+
+struct balloon_adjustment {
+    struct balloon_controller *ctl;
+    virDomainPtr dom;
+    unsigned long long current;
+    unsigned long long target;
+};
+
+/*
+ * Work out the balloon size that brings the guest's free memory back to
+ * the middle of the [min_free, max_free] band, or return CURRENT if the
+ * guest is inside the band.  Growing is immediate; shrinking is limited to
+ * max_reclaim_rate KiB per second, over cycles INTERVAL seconds apart.
+ */
+static unsigned long long balloon_target(struct balloon_policy *policy,
+                                         double interval,
+                                         unsigned long long current,
+                                         unsigned long long maximum,
+                                         unsigned long long available,
+                                         unsigned long long unused)
+{
+    unsigned long long used, target, step;
+    double free_pct;
+    int mid;
+
+    if (available == 0 || unused > available) {
+        return current;
+    }
+
+    free_pct = 100.0 * unused / available;
+    if (free_pct >= policy->min_free && free_pct <= policy->max_free) {
+        return current;
+    }
+
+    used = available - unused;
+    mid = (policy->min_free + policy->max_free) / 2;
+    target = used * 100 / (100 - mid);
+
+    if (target > current) {
+        if (maximum != 0 && target > maximum) {
+            target = maximum;
+        }
+    }
+    else if (policy->max_reclaim_rate != 0) {
+        step = policy->max_reclaim_rate * interval;
+        if (current - target > step) {
+            target = current - step;
+        }
+    }
+
+    /* not worth a call for less than 1% of the guest */
+    if ((target > current ? target - current : current - target) <
+        current / 100) {
+        return current;
+    }
+
+    return target;
+}
+
+static void balloon_apply(void *opaque, int i)
+{
+    struct balloon_adjustment *adj = (struct balloon_adjustment *)opaque + i;
+    struct balloon_controller *ctl = adj->ctl;
+    char *msg;
+    int r;
+
+    if (ruby_libvirt_controller_acquire(&ctl->base) < 0) {
+        return;
+    }
+    r = virDomainSetMemoryFlags(adj->dom, adj->target,
+                                VIR_DOMAIN_AFFECT_LIVE);
+    ruby_libvirt_controller_release(&ctl->base);
+
+    if (r < 0) {
+        msg = ruby_libvirt_controller_take_error();
+        ruby_libvirt_controller_failed(&ctl->base, msg);
+        free(msg);
+        return;
+    }
+
+    pthread_mutex_lock(&ctl->base.lock);
+    if (adj->target > adj->current) {
+        ctl->grown++;
+    }
+    else {
+        ctl->shrunk++;
+    }
+    pthread_mutex_unlock(&ctl->base.lock);
+}
+
+static unsigned long long balloon_field(virDomainStatsRecordPtr record,
+                                        const char *name)
+{
+    int i;
+
+    for (i = 0; i < record->nparams; i++) {
+        if (strcmp(record->params[i].field, name) == 0 &&
+            record->params[i].type == VIR_TYPED_PARAM_ULLONG) {
+            return record->params[i].value.ul;
+        }
+    }
+
+    return 0;
+}
+
+static void balloon_cycle(struct ruby_libvirt_controller *base)
+{
+    struct balloon_controller *ctl = (struct balloon_controller *)base;
+    virDomainStatsRecordPtr *records;
+    struct balloon_adjustment *adj;
+    struct balloon_policy policy;
+    unsigned long long current, target;
+    int n, i, nadj = 0;
+
+    pthread_mutex_lock(&base->lock);
+    policy = ctl->policy;
+    pthread_mutex_unlock(&base->lock);
+
+    n = ruby_libvirt_controller_fetch(base, VIR_DOMAIN_STATS_BALLOON,
+                                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE,
+                                      &records, NULL);
+    if (n < 0) {
+        return;
+    }
+
+    adj = calloc(n + 1, sizeof(struct balloon_adjustment));
+    if (adj == NULL) {
+        virDomainStatsRecordListFree(records);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        current = balloon_field(records[i], "balloon.current");
+        target = balloon_target(&policy, base->interval, current,
+                                balloon_field(records[i], "balloon.maximum"),
+                                balloon_field(records[i], "balloon.available"),
+                                balloon_field(records[i], "balloon.unused"));
+        if (target != current) {
+            adj[nadj].ctl = ctl;
+            adj[nadj].dom = records[i]->dom;
+            adj[nadj].current = current;
+            adj[nadj].target = target;
+            nadj++;
+        }
+    }
+
+    ruby_libvirt_parallel_for_native(nadj, base->concurrency, balloon_apply,
+                                     adj);
+
+    free(adj);
+    virDomainStatsRecordListFree(records);
+}
+
+static void balloon_policy_hash(struct ruby_libvirt_controller *base,
+                                VALUE result)
+{
+    struct balloon_controller *ctl = (struct balloon_controller *)base;
+    struct balloon_policy policy;
+
+    pthread_mutex_lock(&base->lock);
+    policy = ctl->policy;
+    pthread_mutex_unlock(&base->lock);
+
+    rb_hash_aset(result, rb_str_new2("min_free_percent"),
+                 INT2NUM(policy.min_free));
+    rb_hash_aset(result, rb_str_new2("max_free_percent"),
+                 INT2NUM(policy.max_free));
+    rb_hash_aset(result, rb_str_new2("max_reclaim_rate"),
+                 ULL2NUM(policy.max_reclaim_rate));
+}
+
+static void balloon_stats_hash(struct ruby_libvirt_controller *base,
+                               VALUE result)
+{
+    struct balloon_controller *ctl = (struct balloon_controller *)base;
+    unsigned long long grown, shrunk;
+
+    pthread_mutex_lock(&base->lock);
+    grown = ctl->grown;
+    shrunk = ctl->shrunk;
+    pthread_mutex_unlock(&base->lock);
+
+    rb_hash_aset(result, rb_str_new2("grown"), ULL2NUM(grown));
+    rb_hash_aset(result, rb_str_new2("shrunk"), ULL2NUM(shrunk));
+}
+
+static const struct ruby_libvirt_controller_ops balloon_ops = {
+    "balloon controller",
+    balloon_cycle,
+    NULL,
+    balloon_policy_hash,
+    balloon_stats_hash,
+    NULL,
+};
+
+static void balloon_policy_set(struct balloon_policy *policy, VALUE min_free,
+                               VALUE max_free, VALUE max_reclaim_rate)
+{
+    policy->min_free = NIL_P(min_free) ? 20 : NUM2INT(min_free);
+    policy->max_free = NIL_P(max_free) ? 40 : NUM2INT(max_free);
+    policy->max_reclaim_rate = ruby_libvirt_value_to_ulonglong(max_reclaim_rate);
+
+    if (policy->min_free < 0 || policy->max_free >= 100 ||
+        policy->min_free >= policy->max_free) {
+        rb_raise(rb_eArgError,
+                 "free memory percentages must satisfy 0 <= min < max < 100");
+    }
+}
+
+/*
+ * call-seq:
+ *   Libvirt::BalloonController.new(conn, min_free_percent=20, max_free_percent=40, max_reclaim_rate=0, interval=1.0, concurrency=0) -> Libvirt::BalloonController
+ *
+ * Create a controller that keeps the free memory of every running domain on
+ * conn between min_free_percent and max_free_percent of the memory the
+ * guest can see.  Once started, it fetches the balloon stats of all running
+ * domains every interval seconds with a single call to
+ * virConnectGetAllDomainStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectGetAllDomainStats],
+ * and moves the balloon of each domain outside that band back to the
+ * middle of it with virDomainSetMemoryFlags[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetMemoryFlags],
+ * on up to concurrency native threads (a default if 0).  A domain is never
+ * grown past its maximum memory, and if max_reclaim_rate is not 0 memory is
+ * taken back from a domain at no more than that many KiB per second.  The
+ * guests must report balloon stats (see dom.memory_stats_period=).  The
+ * controller runs without the GVL, so it keeps reacting while Ruby is busy
+ * or collecting garbage; its calls go through the connection's governor.
+ * ctl.set_domains limits it to some of the domains.
+ *
+ * Besides the common "cycles", "domains", "failed", "last_cycle_time" and
+ * "last_error", ctl.stats has "grown" and "shrunk" (successful balloon
+ * adjustments in each direction); ctl.policy has "min_free_percent",
+ * "max_free_percent" and "max_reclaim_rate" besides "interval" and
+ * "concurrency".
+ */
+static VALUE libvirt_balloon_controller_s_new(int argc, VALUE *argv,
+                                              VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    VALUE c, min_free, max_free, max_reclaim_rate, interval, concurrency;
+    struct balloon_controller *ctl;
+    struct balloon_policy policy;
+
+    rb_scan_args(argc, argv, "15", &c, &min_free, &max_free,
+                 &max_reclaim_rate, &interval, &concurrency);
+
+    balloon_policy_set(&policy, min_free, max_free, max_reclaim_rate);
+
+    ctl = ruby_libvirt_controller_alloc(c, sizeof(struct balloon_controller),
+                                        &balloon_ops, interval, 1.0,
+                                        concurrency);
+    ctl->policy = policy;
+
+    return ruby_libvirt_controller_new(c_balloon_controller, ctl, c);
+}
+
+/*
+ * call-seq:
+ *   ctl.set_policy(min_free_percent, max_free_percent, max_reclaim_rate=0) -> nil
+ *
+ * Change the free memory band and reclaim rate limit.  A running controller
+ * picks up the change at its next cycle.
+ */
+static VALUE libvirt_balloon_controller_set_policy(int argc, VALUE *argv,
+                                                   VALUE b)
+{
+    struct balloon_controller *ctl = ruby_libvirt_controller_get(b);
+    VALUE min_free, max_free, max_reclaim_rate;
+    struct balloon_policy policy;
+
+    rb_scan_args(argc, argv, "21", &min_free, &max_free, &max_reclaim_rate);
+
+    balloon_policy_set(&policy, min_free, max_free, max_reclaim_rate);
+
+    pthread_mutex_lock(&ctl->base.lock);
+    ctl->policy = policy;
+    pthread_mutex_unlock(&ctl->base.lock);
+
+    return Qnil;
+}
+#endif
+
+/*
+ * Class Libvirt::BalloonController
+ */
+void ruby_libvirt_balloon_init(void)
+{
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_BALLOON && HAVE_PTHREAD_H
+    c_balloon_controller = rb_define_class_under(m_libvirt,
+                                                 "BalloonController",
+                                                 rb_cObject);
+    ruby_libvirt_controller_define_methods(c_balloon_controller);
+
+    rb_define_singleton_method(c_balloon_controller, "new",
+                               libvirt_balloon_controller_s_new, -1);
+    rb_define_method(c_balloon_controller, "set_policy",
+                     libvirt_balloon_controller_set_policy, -1);
+#endif
+}
@@ -0,0 +1,6 @@
+#ifndef BALLOON_H
+#define BALLOON_H
+
+void ruby_libvirt_balloon_init(void);
+
+#endif
@@ -23,10 +23,19 @@
 #define _GNU_SOURCE 1
 #endif
 #include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
 #include <ruby.h>
 #include <st.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
+#include "extconf.h"
+#if HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "common.h"
 #include "connect.h"
 
@@ -93,27 +102,15 @@ VALUE ruby_libvirt_str_new2_and_ary_store_wrap(VALUE arg)
     return Qnil;
 }
 
-void ruby_libvirt_raise_error_if(const int condition, VALUE error,
-                                 const char *method, virConnectPtr conn)
+VALUE ruby_libvirt_error_new(VALUE error, const char *method,
+                             virErrorPtr err)
 {
     VALUE ruby_errinfo;
-    virErrorPtr err;
     char *msg;
     int rc;
     struct rb_exc_new2_arg arg;
     int exception = 0;
 
-    if (!condition) {
-        return;
-    }
-
-    if (conn == NULL) {
-        err = virGetLastError();
-    }
-    else {
-        err = virConnGetLastError(conn);
-    }
-
     if (err != NULL && err->message != NULL) {
         rc = asprintf(&msg, "Call to %s failed: %s", method, err->message);
     }
@@ -148,9 +145,514 @@ void ruby_libvirt_raise_error_if(const int condition, VALUE error,
         }
     }
 
-    rb_exc_raise(ruby_errinfo);
+    return ruby_errinfo;
+}
+
+void ruby_libvirt_raise_error_if(const int condition, VALUE error,
+                                 const char *method, virConnectPtr conn)
+{
+    virErrorPtr err;
+
+    if (!condition) {
+        return;
+    }
+
+    if (conn == NULL) {
+        err = virGetLastError();
+    }
+    else {
+        err = virConnGetLastError(conn);
+    }
+
+    rb_exc_raise(ruby_libvirt_error_new(error, method, err));
+};
+
+struct parallel_arg {
+    int n;
+    int next;
+    void (*fn)(void *opaque, int i);
+    void *opaque;
+    int concurrency;
+#if HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
 };
 
+static int parallel_next(struct parallel_arg *p)
+{
+    int i = -1;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&p->lock);
+#endif
+    if (p->next < p->n) {
+        i = p->next++;
+    }
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&p->lock);
+#endif
+
+    return i;
+}
+
+static void *parallel_worker(void *arg)
+{
+    struct parallel_arg *p = (struct parallel_arg *)arg;
+    int i;
+
+    while ((i = parallel_next(p)) >= 0) {
+        p->fn(p->opaque, i);
+    }
+
+    return NULL;
+}
+
+static void *parallel_run(void *arg)
+{
+#if HAVE_PTHREAD_H
+    struct parallel_arg *p = (struct parallel_arg *)arg;
+    pthread_t *threads;
+    int nthreads = 0, i;
+
+    /* the calling thread is one of the workers */
+    threads = malloc(sizeof(pthread_t) * (p->concurrency - 1));
+    if (threads != NULL) {
+        for (i = 0; i < p->concurrency - 1; i++) {
+            if (pthread_create(&threads[i], NULL, parallel_worker, p) != 0) {
+                break;
+            }
+            nthreads++;
+        }
+    }
+
+    parallel_worker(p);
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    return NULL;
+#else
+    return parallel_worker(arg);
+#endif
+}
+
+/* Set while event callbacks written in Ruby are registered with libvirt
+ * (Libvirt::event_register_impl).  libvirt may then call back into Ruby from
+ * almost any call, so calls are made with the GVL held and on the calling
+ * thread only.
+ */
+int ruby_libvirt_keep_gvl;
+
+/* Ruby callbacks registered with libvirt are run by whichever thread runs
+ * the event loop.  The native loop started by
+ * Libvirt::native_event_loop_start runs on a thread Ruby knows nothing
+ * about, so callbacks into Ruby cannot be registered while it is in use.
+ */
+void ruby_libvirt_check_ruby_callbacks(void)
+{
+    if (ruby_libvirt_native_event_loop_running()) {
+        rb_raise(rb_eArgError,
+                 "Ruby callbacks need an event loop registered with Libvirt::event_register_impl, not the native event loop");
+    }
+}
+
+static VALUE check_ints(VALUE RUBY_LIBVIRT_UNUSED(arg))
+{
+    rb_thread_check_ints();
+    return Qnil;
+}
+
+/* Act on whatever interrupted the calling thread (Thread#raise, Thread#kill,
+ * Timeout, a signal handler).  Returns the state of the exception that
+ * raised, for rb_jump_tag() once the caller has cleaned up, or 0 if there
+ * was none.  Must be called with the GVL.
+ */
+int ruby_libvirt_check_ints(void)
+{
+    int exception = 0;
+
+    rb_protect(check_ints, Qnil, &exception);
+    return exception;
+}
+
+struct without_gvl_arg {
+    void *(*fn)(void *);
+    void *arg;
+    void *ret;
+    int ran;
+};
+
+static void *without_gvl_run(void *arg)
+{
+    struct without_gvl_arg *w = (struct without_gvl_arg *)arg;
+
+    w->ret = w->fn(w->arg);
+    w->ran = 1;
+    return NULL;
+}
+
+static int without_gvl_protect(void *(*fn)(void *), void *arg,
+                               void (*ubf)(void *), void *ubf_arg,
+                               void **ret)
+{
+#if HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    struct without_gvl_arg w;
+    int exception;
+
+    if (!ruby_libvirt_keep_gvl) {
+        w.fn = fn;
+        w.arg = arg;
+        w.ret = NULL;
+        w.ran = 0;
+        for (;;) {
+            /* unlike rb_thread_call_without_gvl, this never raises, so the
+             * caller gets to clean up first */
+            rb_thread_call_without_gvl2(without_gvl_run, &w, ubf, ubf_arg);
+            if (w.ran) {
+                *ret = w.ret;
+                return 0;
+            }
+            exception = ruby_libvirt_check_ints();
+            if (exception) {
+                return exception;
+            }
+        }
+    }
+#elif HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (!ruby_libvirt_keep_gvl) {
+        *ret = rb_thread_call_without_gvl(fn, arg, ubf, ubf_arg);
+        return 0;
+    }
+#endif
+    *ret = fn(arg);
+    return 0;
+}
+
+/* Call FN(ARG) with the GVL released (where the Ruby in use allows it), for
+ * a single long-running libvirt call or sequence of calls.  The same rules
+ * as for ruby_libvirt_parallel_for() apply to FN.  An interrupt (Thread#kill,
+ * Timeout, Ctrl-C) that arrives first is raised here without calling FN;
+ * one that arrives while FN runs breaks it out of blocking system calls,
+ * and Ruby acts on it as soon as FN has returned.
+ */
+void *ruby_libvirt_without_gvl(void *(*fn)(void *), void *arg)
+{
+    void *ret;
+    int exception;
+
+    exception = without_gvl_protect(fn, arg, RUBY_UBF_IO, NULL, &ret);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return ret;
+}
+
+/* As ruby_libvirt_without_gvl(), for an FN whose waiting UBF(UBF_ARG) cuts
+ * short when Ruby wants to interrupt the calling thread; FN must then
+ * return early, and its caller call ruby_libvirt_check_ints().  Returns 0
+ * once FN has run, or the state of the exception raised by an interrupt
+ * that came before FN could start, in which case FN was not called.
+ */
+int ruby_libvirt_without_gvl_cancellable(void *(*fn)(void *), void *arg,
+                                         void (*ubf)(void *), void *ubf_arg)
+{
+    void *ret;
+
+    return without_gvl_protect(fn, arg, ubf, ubf_arg, &ret);
+}
+
+struct call_admit {
+    struct ruby_libvirt_governor *gov;
+    volatile int cancel;
+    int admitted;
+};
+
+static void *call_admit_wait(void *arg)
+{
+    struct call_admit *a = (struct call_admit *)arg;
+
+    a->admitted = ruby_libvirt_governor_acquire(a->gov,
+                                                RUBY_LIBVIRT_LANE_NORMAL,
+                                                &a->cancel) == 0;
+    return NULL;
+}
+
+static void call_admit_interrupt(void *arg)
+{
+    struct call_admit *a = (struct call_admit *)arg;
+
+    ruby_libvirt_governor_cancel(a->gov, &a->cancel);
+}
+
+/* Make the libvirt call FN(ARG) on connection CONN (NULL if it is not made
+ * on one) for RUBY_LIBVIRT_CALL: as ruby_libvirt_without_gvl() does, once
+ * the connection's governor, if it has one, has admitted it in the normal
+ * lane.  The wait for the governor can be interrupted like any other.
+ * Must be called with the GVL.
+ */
+void *ruby_libvirt_call_without_gvl(virConnectPtr conn,
+                                    void *(*fn)(void *), void *arg)
+{
+    struct call_admit a;
+    void *ret = NULL;
+    int exception;
+
+    if (ruby_libvirt_keep_gvl) {
+        return fn(arg);
+    }
+
+    a.gov = ruby_libvirt_governor_for(conn);
+    if (a.gov == NULL) {
+        return ruby_libvirt_without_gvl(fn, arg);
+    }
+
+    a.admitted = 0;
+    do {
+        a.cancel = 0;
+        exception = without_gvl_protect(call_admit_wait, &a,
+                                        call_admit_interrupt, &a, &ret);
+        if (exception == 0 && !a.admitted) {
+            exception = ruby_libvirt_check_ints();
+        }
+    } while (exception == 0 && !a.admitted);
+
+    if (exception == 0) {
+        exception = without_gvl_protect(fn, arg, RUBY_UBF_IO, NULL, &ret);
+        ruby_libvirt_governor_release(a.gov);
+    }
+    ruby_libvirt_governor_unref(a.gov);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return ret;
+}
+
+/* Return a monotonic timestamp in seconds, for timing libvirt calls.  Safe
+ * to call without the GVL.
+ */
+double ruby_libvirt_monotonic_time(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+}
+
+static int parallel_for_cancellable(int n, int concurrency,
+                                    void (*fn)(void *opaque, int i),
+                                    void *opaque, void (*ubf)(void *),
+                                    void *ubf_arg)
+{
+    struct parallel_arg p;
+    int exception;
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    if (concurrency <= 0) {
+        concurrency = RUBY_LIBVIRT_DEFAULT_CONCURRENCY;
+    }
+    if (ruby_libvirt_keep_gvl) {
+        concurrency = 1;
+    }
+    if (concurrency > n) {
+        concurrency = n;
+    }
+
+    p.n = n;
+    p.next = 0;
+    p.fn = fn;
+    p.opaque = opaque;
+    p.concurrency = concurrency;
+#if HAVE_PTHREAD_H
+    pthread_mutex_init(&p.lock, NULL);
+#endif
+
+    exception = ruby_libvirt_without_gvl_cancellable(parallel_run, &p, ubf,
+                                                     ubf_arg);
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_destroy(&p.lock);
+#endif
+
+    return exception;
+}
+
+/* Call FN(OPAQUE, i) for every i in [0, N), spread over at most CONCURRENCY
+ * native threads (RUBY_LIBVIRT_DEFAULT_CONCURRENCY if CONCURRENCY <= 0).
+ * The GVL is released for the duration, so FN must not touch any Ruby
+ * objects; libvirt errors should be saved with virCopyLastError() and turned
+ * into exceptions with ruby_libvirt_error_new() once this returns.  Returns
+ * 0, or the state of the exception raised by an interrupt that came before
+ * any call was made, which the caller should pass to rb_jump_tag() after
+ * cleaning up.
+ */
+int ruby_libvirt_parallel_for(int n, int concurrency,
+                              void (*fn)(void *opaque, int i), void *opaque)
+{
+    return parallel_for_cancellable(n, concurrency, fn, opaque, RUBY_UBF_IO,
+                                    NULL);
+}
+
+/* As ruby_libvirt_parallel_for(), for callers that run on a native thread
+ * of their own and so neither hold nor can release the GVL.
+ */
+void ruby_libvirt_parallel_for_native(int n, int concurrency,
+                                      void (*fn)(void *opaque, int i),
+                                      void *opaque)
+{
+    struct parallel_arg p;
+
+    if (n <= 0) {
+        return;
+    }
+
+    if (concurrency <= 0) {
+        concurrency = RUBY_LIBVIRT_DEFAULT_CONCURRENCY;
+    }
+    if (concurrency > n) {
+        concurrency = n;
+    }
+
+    p.n = n;
+    p.next = 0;
+    p.fn = fn;
+    p.opaque = opaque;
+    p.concurrency = concurrency;
+#if HAVE_PTHREAD_H
+    pthread_mutex_init(&p.lock, NULL);
+#endif
+
+    parallel_run(&p);
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_destroy(&p.lock);
+#endif
+}
+
+struct parallel_governed_arg {
+    struct ruby_libvirt_governor *gov;
+    int lane;
+    volatile int cancel;
+    void (*fn)(void *opaque, int i);
+    void *opaque;
+    /* the indices to run this round, and which of all N have run */
+    int *todo;
+    char *done;
+};
+
+static void parallel_governed(void *opaque, int k)
+{
+    struct parallel_governed_arg *g = opaque;
+    int i = g->todo[k];
+
+    /* once interrupted, the rest are left for the next round, if any */
+    if (ruby_libvirt_governor_acquire(g->gov, g->lane, &g->cancel) < 0) {
+        return;
+    }
+    g->fn(g->opaque, i);
+    ruby_libvirt_governor_release(g->gov);
+    g->done[i] = 1;
+}
+
+static void parallel_governed_interrupt(void *opaque)
+{
+    struct parallel_governed_arg *g = opaque;
+
+    ruby_libvirt_governor_cancel(g->gov, &g->cancel);
+}
+
+static VALUE parallel_memerror(VALUE RUBY_LIBVIRT_UNUSED(arg))
+{
+    rb_memerror();
+    return Qnil;
+}
+
+/* As ruby_libvirt_parallel_for(), but each call to FN is one libvirt call
+ * (or a short sequence of them) on the connection of C, so it is admitted
+ * through that connection's governor, if one is set, in priority LANE.
+ * Inside a conn.throttle block on C the calls are made one at a time in
+ * the block's slot instead, since with max_in_flight=1 no other slot
+ * would ever come free.  Waiting for the governor can be interrupted: the
+ * calls not yet admitted are then not made and the state of the exception
+ * raised is returned, as for ruby_libvirt_parallel_for(); if the interrupt
+ * did not raise (a signal handler ran, say), they are waited for again.
+ * Must be called with the GVL.
+ */
+int ruby_libvirt_parallel_for_conn(VALUE c, int lane, int n, int concurrency,
+                                   void (*fn)(void *opaque, int i),
+                                   void *opaque)
+{
+    struct parallel_governed_arg g;
+    int i, ntodo, exception = 0;
+
+    if (ruby_libvirt_governor_held(c)) {
+        return ruby_libvirt_parallel_for(n, 1, fn, opaque);
+    }
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    g.gov = ruby_libvirt_governor_get(c);
+    if (g.gov == NULL) {
+        return ruby_libvirt_parallel_for(n, concurrency, fn, opaque);
+    }
+    g.lane = lane;
+    g.fn = fn;
+    g.opaque = opaque;
+    g.todo = malloc(sizeof(int) * n);
+    g.done = calloc(n, sizeof(char));
+    if (g.todo == NULL || g.done == NULL) {
+        rb_protect(parallel_memerror, Qnil, &exception);
+        goto out;
+    }
+
+    for (;;) {
+        ntodo = 0;
+        for (i = 0; i < n; i++) {
+            if (!g.done[i]) {
+                g.todo[ntodo++] = i;
+            }
+        }
+        if (ntodo == 0) {
+            break;
+        }
+
+        g.cancel = 0;
+        exception = parallel_for_cancellable(ntodo, concurrency,
+                                             parallel_governed, &g,
+                                             parallel_governed_interrupt, &g);
+        if (exception == 0 && g.cancel) {
+            exception = ruby_libvirt_check_ints();
+        }
+        if (exception) {
+            break;
+        }
+    }
+
+out:
+    free(g.todo);
+    free(g.done);
+    ruby_libvirt_governor_unref(g.gov);
+
+    return exception;
+}
+
 char *ruby_libvirt_get_cstring_or_null(VALUE arg)
 {
     if (TYPE(arg) == T_NIL) {
@@ -357,22 +859,22 @@ int ruby_libvirt_typed_parameter_assign(VALUE key, VALUE val, VALUE in)
             args->params[args->i].type = args->allowed[i].type;
             switch (args->params[args->i].type) {
             case VIR_TYPED_PARAM_INT:
-                args->params[i].value.i = NUM2INT(val);
+                args->params[args->i].value.i = NUM2INT(val);
                 break;
             case VIR_TYPED_PARAM_UINT:
-                args->params[i].value.ui = NUM2UINT(val);
+                args->params[args->i].value.ui = NUM2UINT(val);
                 break;
             case VIR_TYPED_PARAM_LLONG:
-                args->params[i].value.l = NUM2LL(val);
+                args->params[args->i].value.l = NUM2LL(val);
                 break;
             case VIR_TYPED_PARAM_ULLONG:
                 args->params[args->i].value.ul = NUM2ULL(val);
                 break;
             case VIR_TYPED_PARAM_DOUBLE:
-                args->params[i].value.d = NUM2DBL(val);
+                args->params[args->i].value.d = NUM2DBL(val);
                 break;
             case VIR_TYPED_PARAM_BOOLEAN:
-                args->params[i].value.b = (val == Qtrue) ? 1 : 0;
+                args->params[args->i].value.b = (val == Qtrue) ? 1 : 0;
                 break;
             case VIR_TYPED_PARAM_STRING:
                 args->params[args->i].value.s = StringValueCStr(val);
@@ -476,11 +978,12 @@ int ruby_libvirt_get_maxcpus(virConnectPtr conn)
     virNodeInfo nodeinfo;
 
 #if HAVE_VIRNODEGETCPUMAP
-    maxcpu = virNodeGetCPUMap(conn, NULL, NULL, 0);
+    maxcpu = RUBY_LIBVIRT_CALL(virNodeGetCPUMap, conn, NULL, NULL, 0);
 #endif
     if (maxcpu < 0) {
         /* fall back to nodeinfo */
-        ruby_libvirt_raise_error_if(virNodeGetInfo(conn, &nodeinfo) < 0,
+        ruby_libvirt_raise_error_if(RUBY_LIBVIRT_CALL(virNodeGetInfo, conn,
+                                                      &nodeinfo) < 0,
                                     e_RetrieveError, "virNodeGetInfo", conn);
 
         maxcpu = VIR_NODEINFO_MAXCPUS(nodeinfo);
@@ -488,3 +991,77 @@ int ruby_libvirt_get_maxcpus(virConnectPtr conn)
 
     return maxcpu;
 }
+
+/*
+ * CPU maps are handed to Ruby as a single Integer with bit N set for
+ * physical CPU N, which stays small however many CPUs the host has and can
+ * be tested with Integer#[].  Going through a hex string keeps this working
+ * on every Ruby, with no per-CPU objects.
+ */
+VALUE ruby_libvirt_cpumap_to_bitmap(const unsigned char *cpumap, int maplen)
+{
+    static const char digits[] = "0123456789abcdef";
+    char *hex;
+    int i;
+
+    if (maplen <= 0) {
+        return INT2NUM(0);
+    }
+
+    hex = alloca(maplen * 2 + 1);
+    for (i = 0; i < maplen; i++) {
+        hex[(maplen - 1 - i) * 2] = digits[cpumap[i] >> 4];
+        hex[(maplen - 1 - i) * 2 + 1] = digits[cpumap[i] & 0xf];
+    }
+    hex[maplen * 2] = '\0';
+
+    return rb_cstr2inum(hex, 16);
+}
+
+/*
+ * Fill CPUMAP, MAPLEN bytes long, from either an Array of physical CPU
+ * numbers or an Integer bitmap as returned by ruby_libvirt_cpumap_to_bitmap.
+ */
+void ruby_libvirt_bitmap_to_cpumap(VALUE in, unsigned char *cpumap,
+                                   int maplen)
+{
+    VALUE hex;
+    unsigned int cpu;
+    long i, len, nibble;
+    char c;
+
+    MEMZERO(cpumap, unsigned char, maplen);
+
+    if (TYPE(in) == T_ARRAY) {
+        for (i = 0; i < RARRAY_LEN(in); i++) {
+            cpu = NUM2UINT(rb_ary_entry(in, i));
+            if (cpu >= (unsigned int)maplen * 8) {
+                rb_raise(rb_eArgError, "CPU %u is out of range", cpu);
+            }
+            VIR_USE_CPU(cpumap, cpu);
+        }
+        return;
+    }
+
+    if (TYPE(in) != T_FIXNUM && TYPE(in) != T_BIGNUM) {
+        rb_raise(rb_eTypeError,
+                 "wrong argument type (expected Array or Integer)");
+    }
+    if (RTEST(rb_funcall(in, rb_intern("<"), 1, INT2NUM(0)))) {
+        rb_raise(rb_eArgError, "CPU bitmap must not be negative");
+    }
+
+    hex = rb_funcall(in, rb_intern("to_s"), 1, INT2NUM(16));
+    len = RSTRING_LEN(hex);
+    for (i = 0; i < len; i++) {
+        c = RSTRING_PTR(hex)[len - 1 - i];
+        nibble = (c >= 'a') ? c - 'a' + 10 : c - '0';
+        if (nibble == 0) {
+            continue;
+        }
+        if (i / 2 >= maplen) {
+            rb_raise(rb_eArgError, "CPU bitmap has CPUs out of range");
+        }
+        cpumap[i / 2] |= nibble << ((i % 2) * 4);
+    }
+}
@@ -28,6 +28,51 @@ VALUE ruby_libvirt_new_class(VALUE klass, void *ptr, VALUE conn,
 
 void ruby_libvirt_raise_error_if(const int condition, VALUE error,
                                  const char *method, virConnectPtr conn);
+VALUE ruby_libvirt_error_new(VALUE error, const char *method,
+                             virErrorPtr err);
+
+#define RUBY_LIBVIRT_DEFAULT_CONCURRENCY 8
+
+/* priority lanes for ruby_libvirt_parallel_for_conn, most urgent first */
+enum {
+    RUBY_LIBVIRT_LANE_HIGH,
+    RUBY_LIBVIRT_LANE_NORMAL,
+    RUBY_LIBVIRT_LANE_LOW,
+    RUBY_LIBVIRT_NLANES,
+};
+
+int ruby_libvirt_parallel_for(int n, int concurrency,
+                              void (*fn)(void *opaque, int i), void *opaque);
+int ruby_libvirt_parallel_for_conn(VALUE c, int lane, int n, int concurrency,
+                                   void (*fn)(void *opaque, int i),
+                                   void *opaque);
+void ruby_libvirt_parallel_for_native(int n, int concurrency,
+                                      void (*fn)(void *opaque, int i),
+                                      void *opaque);
+void *ruby_libvirt_without_gvl(void *(*fn)(void *), void *arg);
+int ruby_libvirt_without_gvl_cancellable(void *(*fn)(void *), void *arg,
+                                         void (*ubf)(void *), void *ubf_arg);
+int ruby_libvirt_check_ints(void);
+void *ruby_libvirt_call_without_gvl(virConnectPtr conn,
+                                    void *(*fn)(void *), void *arg);
+double ruby_libvirt_monotonic_time(void);
+int ruby_libvirt_event_impl_registered(void);
+int ruby_libvirt_native_event_loop_running(void);
+extern int ruby_libvirt_keep_gvl;
+void ruby_libvirt_check_ruby_callbacks(void);
+
+/* Call libvirt function FUNC through the wrapper generated for it in
+ * nogvl.h, which waits for the governor of the connection it is made on
+ * and then releases the GVL while libvirt waits on the daemon (see
+ * ruby_libvirt_call_without_gvl()), or directly if the wrappers could not
+ * be generated at build time.
+ */
+#if HAVE_NOGVL_H
+#include "nogvl.h"
+#define RUBY_LIBVIRT_CALL(func, args...) ruby_libvirt_nogvl_##func(args)
+#else
+#define RUBY_LIBVIRT_CALL(func, args...) func(args)
+#endif
 
 /*
  * Code generating macros.
@@ -46,7 +91,7 @@ void ruby_libvirt_raise_error_if(const int condition, VALUE error,
         VALUE result;                                                    \
         int exception;                                                   \
                                                                          \
-        str = func(args);                                                \
+        str = RUBY_LIBVIRT_CALL(func, args);                             \
         ruby_libvirt_raise_error_if(str == NULL, e_Error, # func, conn); \
         if (dealloc) {                                                   \
             result = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&str, &exception); \
@@ -83,7 +128,7 @@ void ruby_libvirt_raise_error_if(const int condition, VALUE error,
 #define ruby_libvirt_generate_call_nil(func, conn, args...)               \
     do {                                                                  \
         int _r_##func;                                                    \
-        _r_##func = func(args);                                           \
+        _r_##func = RUBY_LIBVIRT_CALL(func, args);                        \
         ruby_libvirt_raise_error_if(_r_##func < 0, e_Error, #func, conn); \
         return Qnil;                                                      \
     } while(0)
@@ -94,7 +139,7 @@ void ruby_libvirt_raise_error_if(const int condition, VALUE error,
 #define ruby_libvirt_generate_call_truefalse(func, conn, args...)         \
     do {                                                                  \
         int _r_##func;                                                    \
-        _r_##func = func(args);                                           \
+        _r_##func = RUBY_LIBVIRT_CALL(func, args);                        \
         ruby_libvirt_raise_error_if(_r_##func < 0, e_Error, #func, conn); \
         return _r_##func ? Qtrue : Qfalse;                                \
     } while(0)
@@ -106,7 +151,7 @@ void ruby_libvirt_raise_error_if(const int condition, VALUE error,
 #define ruby_libvirt_generate_call_int(func, conn, args...)             \
     do {                                                                \
         int _r_##func;                                                  \
-        _r_##func = func(args);                                         \
+        _r_##func = RUBY_LIBVIRT_CALL(func, args);                      \
         ruby_libvirt_raise_error_if(_r_##func < 0, e_RetrieveError, #func, conn); \
         return INT2NUM(_r_##func);                                      \
     } while(0)
@@ -168,6 +213,7 @@ extern VALUE e_RetrieveError;
 extern VALUE e_Error;
 extern VALUE e_DefinitionError;
 extern VALUE e_NoSupportError;
+extern VALUE e_ConnectionError;
 
 extern VALUE m_libvirt;
 
@@ -222,6 +268,9 @@ VALUE ruby_libvirt_set_typed_parameters(VALUE d, VALUE input,
                                                               void *opaque));
 
 int ruby_libvirt_get_maxcpus(virConnectPtr conn);
+VALUE ruby_libvirt_cpumap_to_bitmap(const unsigned char *cpumap, int maplen);
+void ruby_libvirt_bitmap_to_cpumap(VALUE in, unsigned char *cpumap,
+                                   int maplen);
 
 void ruby_libvirt_typed_params_to_hash(void *voidparams, int i, VALUE hash);
 void ruby_libvirt_assign_hash_and_flags(VALUE in, VALUE *hash, VALUE *flags);
@@ -19,6 +19,9 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #if HAVE_VIRDOMAINQEMUATTACH
@@ -27,13 +30,23 @@
 #include <libvirt/virterror.h>
 #include "extconf.h"
 #include "common.h"
+#include "connect.h"
 #include "domain.h"
+#include "metadata.h"
 #include "network.h"
 #include "interface.h"
 #include "nodedevice.h"
 #include "nwfilter.h"
 #include "secret.h"
+#include "storage.h"
 #include "stream.h"
+#include "xml.h"
+#if HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 /*
  * Generate a call to a virConnectNumOf... function. C is the Ruby VALUE
@@ -71,2492 +84,5043 @@
     } while(0)
 
 static VALUE c_connect;
+/* hidden instance variable set by ruby_libvirt_connect_stamp() */
+static ID id_reopens;
 VALUE c_node_security_model;
 static VALUE c_node_info;
 
-static void connect_close(void *c)
-{
-    int r;
+/*
+ * A Libvirt::Connect wraps this rather than the bare virConnectPtr so that
+ * connections inherited across fork() can be told apart from ones opened in
+ * the current process.  The generation counter is bumped in the child by a
+ * pthread_atfork handler; a connection from an older generation shares its
+ * socket with the parent, so it is never closed here (that would tear down
+ * the parent's session) and is instead reopened from the remembered URI the
+ * first time the child uses it.
+ */
+struct connect_health;
+struct connect_autoextend;
 
-    if (!c) {
-        return;
-    }
-    r = virConnectClose((virConnectPtr) c);
-    ruby_libvirt_raise_error_if(r < 0, rb_eSystemCallError, "virConnectClose",
-                                c);
-}
+struct ruby_libvirt_connect {
+    virConnectPtr conn;
+    unsigned long generation;
+    /* how many times conn has been replaced by connect_reopen() */
+    unsigned long reopens;
+    int reopened;
+    int reopenable;
+    int open_type;
+    char *uri;
+    unsigned int flags;
+    struct connect_health *health;
+    struct connect_autoextend *autoextend;
+    struct ruby_libvirt_governor *governor;
+};
 
-VALUE ruby_libvirt_connect_new(virConnectPtr c)
-{
-    return Data_Wrap_Struct(c_connect, NULL, connect_close, c);
-}
+enum {
+    CONNECT_OPEN,
+    CONNECT_OPEN_READ_ONLY,
+    CONNECT_OPEN_AUTH,
+};
 
-VALUE ruby_libvirt_conn_attr(VALUE c)
+static volatile unsigned long connect_generation;
+
+#if HAVE_PTHREAD_H
+static void connect_atfork_child(void)
 {
-    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
-        c = rb_iv_get(c, "@connection");
-    }
-    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
-        rb_raise(rb_eArgError, "Expected Connection object");
-    }
-    return c;
+    connect_generation++;
 }
+#endif
 
-virConnectPtr ruby_libvirt_connect_get(VALUE c)
+static int connect_stale(struct ruby_libvirt_connect *data)
 {
-    c = ruby_libvirt_conn_attr(c);
-    ruby_libvirt_get_struct(Connect, c);
+    return data->conn != NULL && data->generation != connect_generation;
 }
 
+enum {
+    CONNECT_HEALTH_UNKNOWN,
+    CONNECT_HEALTH_ALIVE,
+    CONNECT_HEALTH_DEAD,
+};
+
+#if HAVE_VIRCONNECTREGISTERCLOSECALLBACK && HAVE_PTHREAD_H
 /*
- * call-seq:
- *   conn.close -> nil
- *
- * Call virConnectClose[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectClose]
- * to close the connection.
+ * Liveness state for conn.monitor_liveness.  The close callback fires on
+ * whatever thread runs the event loop, so the state is shared between the
+ * Connect (one reference) and libvirt's callback registration (the other)
+ * and protected by its own lock.
  */
-static VALUE libvirt_connect_close(VALUE c)
+struct connect_health {
+    pthread_mutex_t lock;
+    int refs;
+    int state;
+    int reason;
+    struct timeval since;
+    int interval;
+    unsigned int count;
+};
+
+static void connect_health_unref(struct connect_health *health)
 {
-    virConnectPtr conn;
+    int refs;
 
-    Data_Get_Struct(c, virConnect, conn);
-    if (conn) {
-        connect_close(conn);
-        DATA_PTR(c) = NULL;
+    pthread_mutex_lock(&health->lock);
+    refs = --health->refs;
+    pthread_mutex_unlock(&health->lock);
+
+    if (refs == 0) {
+        pthread_mutex_destroy(&health->lock);
+        free(health);
     }
-    return Qnil;
 }
 
-/*
- * call-seq:
- *   conn.closed? -> [True|False]
- *
- * Return +true+ if the connection is closed, +false+ if it is open.
- */
-static VALUE libvirt_connect_closed_p(VALUE c)
+static void connect_health_closed(virConnectPtr RUBY_LIBVIRT_UNUSED(conn),
+                                  int reason, void *opaque)
 {
-    virConnectPtr conn;
+    struct connect_health *health = opaque;
 
-    Data_Get_Struct(c, virConnect, conn);
-    return (conn == NULL) ? Qtrue : Qfalse;
+    pthread_mutex_lock(&health->lock);
+    health->state = CONNECT_HEALTH_DEAD;
+    health->reason = reason;
+    gettimeofday(&health->since, NULL);
+    pthread_mutex_unlock(&health->lock);
 }
 
-/*
- * call-seq:
- *   conn.type -> String
- *
- * Call virConnectGetType[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetType]
- * to retrieve the type of hypervisor for this connection.
- */
-static VALUE libvirt_connect_type(VALUE c)
+static void connect_health_free(void *opaque)
 {
-    ruby_libvirt_generate_call_string(virConnectGetType,
-                                      ruby_libvirt_connect_get(c), 0,
-                                      ruby_libvirt_connect_get(c));
+    connect_health_unref(opaque);
 }
 
-/*
- * call-seq:
- *   conn.version -> Fixnum
- *
- * Call virConnectGetVersion[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetVersion]
- * to retrieve the version of the hypervisor for this connection.
- */
-static VALUE libvirt_connect_version(VALUE c)
+static void connect_health_release(struct ruby_libvirt_connect *data)
 {
-    int r;
-    unsigned long v;
-
-    r = virConnectGetVersion(ruby_libvirt_connect_get(c), &v);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virConnectGetVersion",
-                                ruby_libvirt_connect_get(c));
-
-    return ULONG2NUM(v);
+    if (!data->health) {
+        return;
+    }
+    /* unregistering drops libvirt's reference through connect_health_free;
+     * an inherited connection keeps its registration, and so its reference,
+     * forever */
+    if (data->conn && !connect_stale(data)) {
+        virConnectUnregisterCloseCallback(data->conn, connect_health_closed);
+    }
+    connect_health_unref(data->health);
+    data->health = NULL;
 }
-
-#if HAVE_VIRCONNECTGETLIBVERSION
-/*
- * call-seq:
- *   conn.libversion -> Fixnum
- *
- * Call virConnectGetLibVersion[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetLibVersion]
- * to retrieve the version of the libvirt library for this connection.
- */
-static VALUE libvirt_connect_libversion(VALUE c)
+#else
+static void connect_health_release(struct ruby_libvirt_connect *RUBY_LIBVIRT_UNUSED(data))
 {
-    int r;
-    unsigned long v;
-
-    r = virConnectGetLibVersion(ruby_libvirt_connect_get(c), &v);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
-                                "virConnectGetLibVersion",
-                                ruby_libvirt_connect_get(c));
-
-    return ULONG2NUM(v);
 }
 #endif
 
+#if HAVE_VIRDOMAINSETBLOCKTHRESHOLD && HAVE_PTHREAD_H
 /*
- * call-seq:
- *   conn.hostname -> String
- *
- * Call virConnectGetHostname[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetHostname]
- * to retrieve the hostname of the hypervisor for this connection.
+ * Rules for conn.block_auto_extend.  Like the liveness state above, the
+ * table is shared between the Connect and libvirt's event registration,
+ * since the BLOCK_THRESHOLD callback runs on the event loop thread, and it
+ * never calls into Ruby so that it works with the native event loop too.
  */
-static VALUE libvirt_connect_hostname(VALUE c)
+struct autoextend_rule {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *dev;
+    unsigned long long headroom;
+    unsigned long long increment;
+    unsigned long long max_size;
+};
+
+struct connect_autoextend {
+    pthread_mutex_t lock;
+    int refs;
+    int callback_id;
+    struct autoextend_rule *rules;
+    int nrules;
+    unsigned long long extended;
+    unsigned long long failed;
+    unsigned long long at_limit;
+    char *last_error;
+};
+
+static void connect_autoextend_unref(struct connect_autoextend *ae)
 {
-    ruby_libvirt_generate_call_string(virConnectGetHostname,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c));
+    int refs, i;
+
+    pthread_mutex_lock(&ae->lock);
+    refs = --ae->refs;
+    pthread_mutex_unlock(&ae->lock);
+
+    if (refs == 0) {
+        for (i = 0; i < ae->nrules; i++) {
+            free(ae->rules[i].dev);
+        }
+        free(ae->rules);
+        free(ae->last_error);
+        pthread_mutex_destroy(&ae->lock);
+        free(ae);
+    }
 }
 
-/*
- * call-seq:
- *   conn.uri -> String
- *
- * Call virConnectGetURI[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetURI]
- * to retrieve the canonical URI for this connection.
- */
-static VALUE libvirt_connect_uri(VALUE c)
+static void connect_autoextend_free(void *opaque)
 {
-    ruby_libvirt_generate_call_string(virConnectGetURI,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c));
+    connect_autoextend_unref(opaque);
 }
 
-/*
- * call-seq:
- *   conn.max_vcpus(type=nil) -> Fixnum
- *
- * Call virConnectGetMaxVcpus[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetMaxVcpus]
- * to retrieve the maximum number of virtual cpus supported by the hypervisor
- * for this connection.
- */
-static VALUE libvirt_connect_max_vcpus(int argc, VALUE *argv, VALUE c)
+/* Return the index of the rule for UUID and DEV, or -1; lock held */
+static int autoextend_find(struct connect_autoextend *ae,
+                           const unsigned char *uuid, const char *dev)
 {
-    VALUE type;
+    int i;
 
-    rb_scan_args(argc, argv, "01", &type);
+    for (i = 0; i < ae->nrules; i++) {
+        if (memcmp(ae->rules[i].uuid, uuid, VIR_UUID_BUFLEN) == 0 &&
+            strcmp(ae->rules[i].dev, dev) == 0) {
+            return i;
+        }
+    }
 
-    ruby_libvirt_generate_call_int(virConnectGetMaxVcpus,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_get_cstring_or_null(type));
+    return -1;
 }
 
 /*
- * call-seq:
- *   conn.node_info -> Libvirt::Connect::Nodeinfo
- *
- * Call virNodeGetInfo[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetInfo]
- * to retrieve information about the node for this connection.
+ * Record a failed extension and stop watching the disk, since its
+ * threshold is not armed again.  MSG, if given, is used instead of the
+ * last libvirt error.  Lock not held.
  */
-static VALUE libvirt_connect_node_info(VALUE c)
+static void autoextend_failed(struct connect_autoextend *ae,
+                              const unsigned char *uuid, const char *dev,
+                              const char *func, char *msg)
 {
-    int r;
-    virNodeInfo nodeinfo;
-    VALUE result;
+    virErrorPtr err = virGetLastError();
+    int i;
 
-    r = virNodeGetInfo(ruby_libvirt_connect_get(c), &nodeinfo);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeGetInfo",
-                                ruby_libvirt_connect_get(c));
+    if (msg == NULL) {
+        if (err != NULL && err->message != NULL) {
+            msg = strdup(err->message);
+        }
+        else {
+            msg = strdup(func);
+        }
+    }
+    virResetLastError();
 
-    result = rb_class_new_instance(0, NULL, c_node_info);
-    rb_iv_set(result, "@model", rb_str_new2(nodeinfo.model));
-    rb_iv_set(result, "@memory", ULONG2NUM(nodeinfo.memory));
-    rb_iv_set(result, "@cpus", UINT2NUM(nodeinfo.cpus));
-    rb_iv_set(result, "@mhz", UINT2NUM(nodeinfo.mhz));
-    rb_iv_set(result, "@nodes", UINT2NUM(nodeinfo.nodes));
-    rb_iv_set(result, "@sockets", UINT2NUM(nodeinfo.sockets));
-    rb_iv_set(result, "@cores", UINT2NUM(nodeinfo.cores));
-    rb_iv_set(result, "@threads", UINT2NUM(nodeinfo.threads));
+    pthread_mutex_lock(&ae->lock);
+    i = autoextend_find(ae, uuid, dev);
+    if (i >= 0) {
+        free(ae->rules[i].dev);
+        ae->rules[i] = ae->rules[--ae->nrules];
+    }
+    ae->failed++;
+    free(ae->last_error);
+    ae->last_error = msg;
+    pthread_mutex_unlock(&ae->lock);
+}
 
-    return result;
+struct autoextend_work {
+    struct connect_autoextend *ae;
+    virDomainPtr dom;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char *dev;
+    char *path;
+};
+
+static void autoextend_work_free(struct autoextend_work *w)
+{
+    connect_autoextend_unref(w->ae);
+    virDomainFree(w->dom);
+    free(w->dev);
+    free(w->path);
+    free(w);
 }
 
 /*
- * call-seq:
- *   conn.node_free_memory -> Fixnum
- *
- * Call virNodeGetFreeMemory[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetFreeMemory]
- * to retrieve the amount of free memory available on the host for this
- * connection.
+ * Grow the block storage volume under the disk that crossed its threshold
+ * (the thin LV or block device under a qcow2 image) by the rule's
+ * increment and arm the threshold again below the new size.  Only the
+ * storage is grown, never the image or the guest-visible disk, so a disk
+ * whose source is not a block volume in a libvirt storage pool fails.
  */
-static VALUE libvirt_connect_node_free_memory(VALUE c)
+static void *autoextend_worker(void *opaque)
 {
-    unsigned long long freemem;
+    struct autoextend_work *w = opaque;
+    struct connect_autoextend *ae = w->ae;
+    struct autoextend_rule rule;
+    virDomainBlockInfo info;
+    virStorageVolInfo vinfo;
+    virStorageVolPtr vol;
+    unsigned long long size;
+    char *msg;
+    int i, r;
+
+    pthread_mutex_lock(&ae->lock);
+    i = autoextend_find(ae, w->uuid, w->dev);
+    if (i >= 0) {
+        rule = ae->rules[i];
+    }
+    pthread_mutex_unlock(&ae->lock);
+    if (i < 0) {
+        /* cancelled in the meantime */
+        goto cleanup;
+    }
 
-    freemem = virNodeGetFreeMemory(ruby_libvirt_connect_get(c));
+    if (virDomainGetBlockInfo(w->dom, w->dev, &info, 0) < 0) {
+        autoextend_failed(ae, w->uuid, w->dev, "virDomainGetBlockInfo", NULL);
+        goto cleanup;
+    }
 
-    ruby_libvirt_raise_error_if(freemem == 0, e_RetrieveError,
-                                "virNodeGetFreeMemory",
-                                ruby_libvirt_connect_get(c));
+    size = info.physical + rule.increment;
+    if (rule.max_size != 0 && size > rule.max_size) {
+        size = rule.max_size;
+    }
+    if (size <= info.physical) {
+        pthread_mutex_lock(&ae->lock);
+        ae->at_limit++;
+        pthread_mutex_unlock(&ae->lock);
+        goto cleanup;
+    }
 
-    return ULL2NUM(freemem);
+    vol = virStorageVolLookupByPath(virDomainGetConnect(w->dom), w->path);
+    if (vol == NULL) {
+        autoextend_failed(ae, w->uuid, w->dev, "virStorageVolLookupByPath",
+                          NULL);
+        goto cleanup;
+    }
+    r = virStorageVolGetInfo(vol, &vinfo);
+    if (r == 0 && vinfo.type != VIR_STORAGE_VOL_BLOCK) {
+        virStorageVolFree(vol);
+        msg = malloc(strlen(w->path) + 40);
+        if (msg != NULL) {
+            sprintf(msg, "%s is not a block storage volume", w->path);
+        }
+        autoextend_failed(ae, w->uuid, w->dev, "virStorageVolGetInfo", msg);
+        goto cleanup;
+    }
+    if (r == 0) {
+        r = virStorageVolResize(vol, size, 0);
+    }
+    virStorageVolFree(vol);
+    if (r < 0) {
+        autoextend_failed(ae, w->uuid, w->dev, "virStorageVolResize", NULL);
+        goto cleanup;
+    }
+
+    if (virDomainSetBlockThreshold(w->dom, w->dev,
+                                   size > rule.headroom ? size - rule.headroom : 1,
+                                   0) < 0) {
+        autoextend_failed(ae, w->uuid, w->dev, "virDomainSetBlockThreshold",
+                          NULL);
+        goto cleanup;
+    }
+
+    pthread_mutex_lock(&ae->lock);
+    ae->extended++;
+    pthread_mutex_unlock(&ae->lock);
+
+cleanup:
+    autoextend_work_free(w);
+    return NULL;
 }
 
 /*
- * call-seq:
- *   conn.node_cells_free_memory(startCell=0, maxCells=#nodeCells) -> list
- *
- * Call virNodeGetCellsFreeMemory[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCellsFreeMemory]
- * to retrieve the amount of free memory in each NUMA cell on the host for
- * this connection.
+ * The BLOCK_THRESHOLD handler.  Growing a volume takes several blocking
+ * calls, which must not hold up keepalives and other events on the event
+ * loop thread, so the work is handed to a worker thread of its own.
  */
-static VALUE libvirt_connect_node_cells_free_memory(int argc, VALUE *argv,
-                                                    VALUE c)
+static int autoextend_threshold_callback(virConnectPtr RUBY_LIBVIRT_UNUSED(conn),
+                                         virDomainPtr dom, const char *dev,
+                                         const char *path,
+                                         unsigned long long RUBY_LIBVIRT_UNUSED(threshold),
+                                         unsigned long long RUBY_LIBVIRT_UNUSED(excess),
+                                         void *opaque)
 {
+    struct connect_autoextend *ae = opaque;
+    struct autoextend_work *w;
+    pthread_attr_t attr;
+    pthread_t thread;
     int i, r;
-    VALUE cells, start, max;
-    unsigned long long *freeMems;
-    virNodeInfo nodeinfo;
-    unsigned int startCell, maxCells;
-
-    rb_scan_args(argc, argv, "02", &start, &max);
 
-    if (NIL_P(start)) {
-        startCell = 0;
+    w = calloc(1, sizeof(struct autoextend_work));
+    if (w == NULL) {
+        return 0;
     }
-    else {
-        startCell = NUM2UINT(start);
+    if (virDomainGetUUID(dom, w->uuid) < 0) {
+        virResetLastError();
+        free(w);
+        return 0;
     }
 
-    if (NIL_P(max)) {
-        r = virNodeGetInfo(ruby_libvirt_connect_get(c), &nodeinfo);
-        ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeGetInfo",
-                                    ruby_libvirt_connect_get(c));
-        maxCells = nodeinfo.nodes;
+    /* rules are kept by target name where the domain XML gives one, and
+     * otherwise (say for a volume disk) by the path they were set up with */
+    pthread_mutex_lock(&ae->lock);
+    i = autoextend_find(ae, w->uuid, dev);
+    if (i < 0 && path != NULL) {
+        i = autoextend_find(ae, w->uuid, path);
     }
-    else {
-        maxCells = NUM2UINT(max);
+    if (i >= 0) {
+        ae->refs++;
+        w->dev = strdup(ae->rules[i].dev);
+    }
+    pthread_mutex_unlock(&ae->lock);
+    if (i < 0) {
+        free(w);
+        return 0;
     }
 
-    freeMems = alloca(sizeof(unsigned long long) * maxCells);
-
-    r = virNodeGetCellsFreeMemory(ruby_libvirt_connect_get(c), freeMems,
-                                  startCell, maxCells);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
-                                "virNodeGetCellsFreeMemory",
-                                ruby_libvirt_connect_get(c));
+    w->ae = ae;
+    w->dom = dom;
+    virDomainRef(dom);
+    w->path = path != NULL ? strdup(path) : NULL;
+    if (w->dev == NULL || w->path == NULL) {
+        autoextend_failed(ae, w->uuid, w->dev != NULL ? w->dev : dev,
+                          "virDomainSetBlockThreshold",
+                          strdup(path != NULL ? "out of memory" :
+                                 "no source path given for disk"));
+        autoextend_work_free(w);
+        return 0;
+    }
 
-    cells = rb_ary_new2(r);
-    for (i = 0; i < r; i++) {
-        rb_ary_store(cells, i, ULL2NUM(freeMems[i]));
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    r = pthread_create(&thread, &attr, autoextend_worker, w);
+    pthread_attr_destroy(&attr);
+    if (r != 0) {
+        autoextend_failed(ae, w->uuid, w->dev, "pthread_create",
+                          strdup("could not start autoextend worker"));
+        autoextend_work_free(w);
     }
 
-    return cells;
+    return 0;
 }
 
-#if HAVE_VIRNODEGETSECURITYMODEL
-/*
- * call-seq:
- *   conn.node_security_model -> Libvirt::Connect::NodeSecurityModel
- *
- * Call virNodeGetSecurityModel[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetSecurityModel]
- * to retrieve the security model in use on the host for this connection.
- */
-static VALUE libvirt_connect_node_security_model(VALUE c)
+static void connect_autoextend_release(struct ruby_libvirt_connect *data)
 {
-    virSecurityModel secmodel;
-    int r;
-    VALUE result;
-
-    r = virNodeGetSecurityModel(ruby_libvirt_connect_get(c), &secmodel);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
-                                "virNodeGetSecurityModel",
-                                ruby_libvirt_connect_get(c));
-
-    result = rb_class_new_instance(0, NULL, c_node_security_model);
-    rb_iv_set(result, "@model", rb_str_new2(secmodel.model));
-    rb_iv_set(result, "@doi", rb_str_new2(secmodel.doi));
-
-    return result;
+    if (!data->autoextend) {
+        return;
+    }
+    if (data->conn && !connect_stale(data)) {
+        virConnectDomainEventDeregisterAny(data->conn,
+                                           data->autoextend->callback_id);
+    }
+    connect_autoextend_unref(data->autoextend);
+    data->autoextend = NULL;
 }
-#endif
-
-#if HAVE_VIRCONNECTISENCRYPTED
-/*
- * call-seq:
- *   conn.encrypted? -> [True|False]
- *
- * Call virConnectIsEncrypted[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsEncrypted]
- * to determine if the connection is encrypted.
- */
-static VALUE libvirt_connect_encrypted_p(VALUE c)
+#else
+static void connect_autoextend_release(struct ruby_libvirt_connect *RUBY_LIBVIRT_UNUSED(data))
 {
-    ruby_libvirt_generate_call_truefalse(virConnectIsEncrypted,
-                                         ruby_libvirt_connect_get(c),
-                                         ruby_libvirt_connect_get(c));
 }
 #endif
 
-#if HAVE_VIRCONNECTISSECURE
-/*
- * call-seq:
- *   conn.secure? -> [True|False]
- *
- * Call virConnectIsSecure[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsSecure]
- * to determine if the connection is secure.
- */
-static VALUE libvirt_connect_secure_p(VALUE c)
+static void connect_close(struct ruby_libvirt_connect *data)
 {
-    ruby_libvirt_generate_call_truefalse(virConnectIsSecure,
-                                         ruby_libvirt_connect_get(c),
-                                         ruby_libvirt_connect_get(c));
+    int r;
+
+    connect_health_release(data);
+    connect_autoextend_release(data);
+    if (!data->conn) {
+        return;
+    }
+    if (connect_stale(data)) {
+        /* the parent still owns this socket; just drop our reference to it */
+        data->conn = NULL;
+        return;
+    }
+    r = virConnectClose(data->conn);
+    ruby_libvirt_raise_error_if(r < 0, rb_eSystemCallError, "virConnectClose",
+                                data->conn);
+    data->conn = NULL;
 }
-#endif
 
-/*
- * call-seq:
- *   conn.capabilities -> String
- *
- * Call virConnectGetCapabilities[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetCapabilities]
- * to retrieve the capabilities XML for this connection.
+#if HAVE_PTHREAD_H
+/* The connections that have a governor, so that calls made through
+ * RUBY_LIBVIRT_CALL can find it from the virConnectPtr they are made on.
+ * Only touched with the GVL held.
  */
-static VALUE libvirt_connect_capabilities(VALUE c)
+static struct ruby_libvirt_connect **connect_governed;
+static int connect_ngoverned;
+
+static void connect_governed_add(struct ruby_libvirt_connect *data)
 {
-    ruby_libvirt_generate_call_string(virConnectGetCapabilities,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c));
+    struct ruby_libvirt_connect **list;
+
+    list = realloc(connect_governed,
+                   (connect_ngoverned + 1) * sizeof(*connect_governed));
+    if (list == NULL) {
+        rb_memerror();
+    }
+    list[connect_ngoverned++] = data;
+    connect_governed = list;
 }
 
-#if HAVE_VIRCONNECTCOMPARECPU
-/*
- * call-seq:
- *   conn.compare_cpu(xml, flags=0) -> compareflag
- *
- * Call virConnectCompareCPU[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectCompareCPU]
- * to compare the host CPU with the XML contained in xml.  Returns one of
- * Libvirt::CPU_COMPARE_ERROR, Libvirt::CPU_COMPARE_INCOMPATIBLE,
- * Libvirt::CPU_COMPARE_IDENTICAL, or Libvirt::CPU_COMPARE_SUPERSET.
- */
-static VALUE libvirt_connect_compare_cpu(int argc, VALUE *argv, VALUE c)
+static void connect_governed_remove(struct ruby_libvirt_connect *data)
 {
-    VALUE xml, flags;
-
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    int i;
 
-    ruby_libvirt_generate_call_int(virConnectCompareCPU,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   StringValueCStr(xml),
-                                   ruby_libvirt_value_to_uint(flags));
+    for (i = 0; i < connect_ngoverned; i++) {
+        if (connect_governed[i] == data) {
+            connect_governed[i] = connect_governed[--connect_ngoverned];
+            return;
+        }
+    }
 }
 #endif
 
-
-#if HAVE_VIRCONNECTBASELINECPU
-/*
- * call-seq:
- *   conn.baseline_cpu([xml, xml2, ...], flags=0) -> XML
- *
- * Call virConnectBaselineCPU[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectBaselineCPU]
- * to compare the most feature-rich CPU which is compatible with all
- * given host CPUs.
- */
-static VALUE libvirt_connect_baseline_cpu(int argc, VALUE *argv, VALUE c)
+static void connect_free(void *d)
 {
-    VALUE xmlcpus, flags, retval, entry;
-    char *r;
-    unsigned int ncpus;
-    const char **xmllist;
-    int exception = 0;
-    unsigned int i;
+    struct ruby_libvirt_connect *data = d;
 
-    rb_scan_args(argc, argv, "11", &xmlcpus, &flags);
+    connect_close(data);
+    if (data->governor) {
+#if HAVE_PTHREAD_H
+        connect_governed_remove(data);
+#endif
+        ruby_libvirt_governor_unref(data->governor);
+    }
+    free(data->uri);
+    xfree(data);
+}
 
-    Check_Type(xmlcpus, T_ARRAY);
+static VALUE connect_wrap(virConnectPtr c, int reopenable, int open_type,
+                          const char *uri, unsigned int flags)
+{
+    struct ruby_libvirt_connect *data;
+    VALUE result;
 
-    if (RARRAY_LEN(xmlcpus) < 1) {
-        rb_raise(rb_eArgError,
-                 "wrong number of cpu arguments (%ld for 1 or more)",
-                 RARRAY_LEN(xmlcpus));
+    result = Data_Make_Struct(c_connect, struct ruby_libvirt_connect, NULL,
+                              connect_free, data);
+    if (uri != NULL) {
+        data->uri = strdup(uri);
+        if (data->uri == NULL) {
+            virConnectClose(c);
+            rb_memerror();
+        }
     }
+    data->conn = c;
+    data->generation = connect_generation;
+    data->reopenable = reopenable;
+    data->open_type = open_type;
+    data->flags = flags;
 
-    ncpus = RARRAY_LEN(xmlcpus);
-    xmllist = alloca(sizeof(const char *) * ncpus);
+    return result;
+}
 
-    for (i = 0; i < ncpus; i++) {
-        entry = rb_ary_entry(xmlcpus, i);
-        xmllist[i] = StringValueCStr(entry);
-    }
+VALUE ruby_libvirt_connect_new(virConnectPtr c)
+{
+    /* no URI is known for these (e.g. connections handed to event
+     * callbacks), so they cannot be reopened after a fork */
+    return connect_wrap(c, 0, CONNECT_OPEN, NULL, 0);
+}
 
-    r = virConnectBaselineCPU(ruby_libvirt_connect_get(c), xmllist, ncpus,
-                              ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(r == NULL, e_RetrieveError,
-                                "virConnectBaselineCPU",
-                                ruby_libvirt_connect_get(c));
+VALUE ruby_libvirt_connect_open(virConnectPtr c, const char *uri,
+                                int read_only, int auth, unsigned int flags)
+{
+    int open_type = CONNECT_OPEN;
 
-    retval = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&r, &exception);
-    free(r);
-    if (exception) {
-        rb_jump_tag(exception);
+    if (auth) {
+        open_type = CONNECT_OPEN_AUTH;
+    }
+    else if (read_only) {
+        open_type = CONNECT_OPEN_READ_ONLY;
     }
 
-    return retval;
+    return connect_wrap(c, 1, open_type, uri, flags);
 }
-#endif
 
-#if HAVE_VIRCONNECTDOMAINEVENTREGISTERANY || HAVE_VIRCONNECTDOMAINEVENTREGISTER
-static int domain_event_lifecycle_callback(virConnectPtr conn,
-                                           virDomainPtr dom, int event,
-                                           int detail, void *opaque)
+static struct ruby_libvirt_connect *connect_data(VALUE c)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
+    struct ruby_libvirt_connect *data;
 
-    Check_Type(passthrough, T_ARRAY);
+    Data_Get_Struct(c, struct ruby_libvirt_connect, data);
+    return data;
+}
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
+#if HAVE_PTHREAD_H
+/*
+ * Per-connection governor for calls made from native worker threads.  At
+ * most max_in_flight calls run at once, each call takes a token from a
+ * bucket refilled at rate per second (holding at most burst), and a waiter
+ * only proceeds while nobody in a more urgent lane is waiting, except that
+ * anyone who has waited GOVERNOR_AGING seconds is treated as urgent so
+ * that a busy high-priority user cannot starve the others completely.
+ */
+#define GOVERNOR_AGING 1.0
+
+struct ruby_libvirt_governor {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    int max_in_flight;
+    double rate;
+    double burst;
+    double tokens;
+    double refilled;
+    int in_flight;
+    int waiting[RUBY_LIBVIRT_NLANES];
+    unsigned long long acquired[RUBY_LIBVIRT_NLANES];
+    double wait_total[RUBY_LIBVIRT_NLANES];
+    double wait_max[RUBY_LIBVIRT_NLANES];
+};
+
+void ruby_libvirt_governor_unref(struct ruby_libvirt_governor *gov)
+{
+    int refs;
+
+    pthread_mutex_lock(&gov->lock);
+    refs = --gov->refs;
+    pthread_mutex_unlock(&gov->lock);
+
+    if (refs == 0) {
+        pthread_cond_destroy(&gov->cond);
+        pthread_mutex_destroy(&gov->lock);
+        free(gov);
     }
+}
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+/* Return C's governor with an extra reference, or NULL if none is set. */
+struct ruby_libvirt_governor *ruby_libvirt_governor_get(VALUE c)
+{
+    struct ruby_libvirt_governor *gov;
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 5, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(event),
-                   INT2NUM(detail), cb_opaque);
+    gov = connect_data(ruby_libvirt_conn_attr(c))->governor;
+    if (gov != NULL) {
+        pthread_mutex_lock(&gov->lock);
+        gov->refs++;
+        pthread_mutex_unlock(&gov->lock);
     }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 5, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(event),
-                   INT2NUM(detail), cb_opaque);
+
+    return gov;
+}
+
+static void governor_refill(struct ruby_libvirt_governor *gov, double now)
+{
+    if (gov->rate <= 0) {
+        return;
     }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event lifecycle callback (expected Symbol or Proc)");
+    gov->tokens += (now - gov->refilled) * gov->rate;
+    if (gov->tokens > gov->burst) {
+        gov->tokens = gov->burst;
     }
+    gov->refilled = now;
+}
 
-    return 0;
+static void governor_timedwait(struct ruby_libvirt_governor *gov,
+                               double seconds)
+{
+    struct timespec ts;
+    struct timeval tv;
+    double deadline;
+
+    gettimeofday(&tv, NULL);
+    deadline = tv.tv_sec + tv.tv_usec / 1e6 + seconds;
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+    pthread_cond_timedwait(&gov->cond, &gov->lock, &ts);
 }
-#endif
 
-#if HAVE_VIRCONNECTDOMAINEVENTREGISTERANY
-static int domain_event_reboot_callback(virConnectPtr conn, virDomainPtr dom,
-                                        void *opaque)
+/*
+ * Wait for permission to make one call in LANE.  Safe to call without the
+ * GVL.  If CANCEL is non-NULL and becomes non-zero while waiting (see
+ * ruby_libvirt_governor_cancel), give up and return -1; otherwise return 0,
+ * after which ruby_libvirt_governor_release must be called once the call
+ * is done.
+ */
+int ruby_libvirt_governor_acquire(struct ruby_libvirt_governor *gov,
+                                  int lane, volatile int *cancel)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
+    double start, now, wait;
+    int i, blocked;
+
+    start = ruby_libvirt_monotonic_time();
+
+    pthread_mutex_lock(&gov->lock);
+    gov->waiting[lane]++;
+    for (;;) {
+        if (cancel != NULL && *cancel) {
+            gov->waiting[lane]--;
+            pthread_cond_broadcast(&gov->cond);
+            pthread_mutex_unlock(&gov->lock);
+            return -1;
+        }
 
-    Check_Type(passthrough, T_ARRAY);
+        now = ruby_libvirt_monotonic_time();
+        blocked = 0;
+        if (now - start < GOVERNOR_AGING) {
+            for (i = 0; i < lane; i++) {
+                if (gov->waiting[i] > 0) {
+                    blocked = 1;
+                }
+            }
+        }
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
+        if (!blocked && (gov->max_in_flight <= 0 ||
+                         gov->in_flight < gov->max_in_flight)) {
+            governor_refill(gov, now);
+            if (gov->rate <= 0 || gov->tokens >= 1.0) {
+                break;
+            }
+            wait = (1.0 - gov->tokens) / gov->rate;
+        }
+        else {
+            wait = GOVERNOR_AGING;
+        }
+        if (wait > GOVERNOR_AGING) {
+            wait = GOVERNOR_AGING;
+        }
+        governor_timedwait(gov, wait);
     }
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
-
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 3, newc,
-                   ruby_libvirt_domain_new(dom, newc), cb_opaque);
-    }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 3, newc,
-                   ruby_libvirt_domain_new(dom, newc), cb_opaque);
+    if (gov->rate > 0) {
+        gov->tokens -= 1.0;
     }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event reboot callback (expected Symbol or Proc)");
+    gov->waiting[lane]--;
+    gov->in_flight++;
+    wait = now - start;
+    gov->acquired[lane]++;
+    gov->wait_total[lane] += wait;
+    if (wait > gov->wait_max[lane]) {
+        gov->wait_max[lane] = wait;
     }
+    /* a lane that was holding others back may just have emptied */
+    pthread_cond_broadcast(&gov->cond);
+    pthread_mutex_unlock(&gov->lock);
 
     return 0;
 }
 
-static int domain_event_rtc_callback(virConnectPtr conn, virDomainPtr dom,
-                                     long long utc_offset, void *opaque)
+void ruby_libvirt_governor_release(struct ruby_libvirt_governor *gov)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
+    pthread_mutex_lock(&gov->lock);
+    gov->in_flight--;
+    pthread_cond_broadcast(&gov->cond);
+    pthread_mutex_unlock(&gov->lock);
+}
 
-    Check_Type(passthrough, T_ARRAY);
+/* Wake up anyone waiting in ruby_libvirt_governor_acquire so that they
+ * notice their cancel flag. */
+void ruby_libvirt_governor_cancel(struct ruby_libvirt_governor *gov,
+                                  volatile int *cancel)
+{
+    pthread_mutex_lock(&gov->lock);
+    *cancel = 1;
+    pthread_cond_broadcast(&gov->cond);
+    pthread_mutex_unlock(&gov->lock);
+}
+#else
+struct ruby_libvirt_governor *ruby_libvirt_governor_get(VALUE RUBY_LIBVIRT_UNUSED(c))
+{
+    return NULL;
+}
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
-    }
+void ruby_libvirt_governor_unref(struct ruby_libvirt_governor *RUBY_LIBVIRT_UNUSED(gov))
+{
+}
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+int ruby_libvirt_governor_acquire(struct ruby_libvirt_governor *RUBY_LIBVIRT_UNUSED(gov),
+                                  int RUBY_LIBVIRT_UNUSED(lane),
+                                  volatile int *RUBY_LIBVIRT_UNUSED(cancel))
+{
+    return 0;
+}
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 4, newc,
-                   ruby_libvirt_domain_new(dom, newc), LL2NUM(utc_offset),
-                   cb_opaque);
-    }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 4, newc,
-                   ruby_libvirt_domain_new(dom, newc), LL2NUM(utc_offset),
-                   cb_opaque);
-    }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event rtc callback (expected Symbol or Proc)");
-    }
+void ruby_libvirt_governor_release(struct ruby_libvirt_governor *RUBY_LIBVIRT_UNUSED(gov))
+{
+}
+
+void ruby_libvirt_governor_cancel(struct ruby_libvirt_governor *RUBY_LIBVIRT_UNUSED(gov),
+                                  volatile int *cancel)
+{
+    *cancel = 1;
+}
 
+int ruby_libvirt_governor_held(VALUE RUBY_LIBVIRT_UNUSED(c))
+{
     return 0;
 }
 
-static int domain_event_watchdog_callback(virConnectPtr conn, virDomainPtr dom,
-                                          int action, void *opaque)
+struct ruby_libvirt_governor *ruby_libvirt_governor_for(virConnectPtr RUBY_LIBVIRT_UNUSED(p))
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
+    return NULL;
+}
+#endif
 
-    Check_Type(passthrough, T_ARRAY);
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
-    }
-
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+static void connect_reopen(VALUE c, struct ruby_libvirt_connect *data)
+{
+    virConnectPtr conn = NULL;
+    const char *func = "virConnectOpen";
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 4, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(action),
-                   cb_opaque);
-    }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 4, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(action),
-                   cb_opaque);
+    if (!data->reopenable) {
+        rb_raise(e_ConnectionError,
+                 "connection was inherited across fork and cannot be reopened");
     }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event watchdog callback (expected Symbol or Proc)");
+
+    switch (data->open_type) {
+    case CONNECT_OPEN_READ_ONLY:
+        func = "virConnectOpenReadOnly";
+        conn = RUBY_LIBVIRT_CALL(virConnectOpenReadOnly, data->uri);
+        break;
+#if HAVE_VIRCONNECTOPENAUTH
+    case CONNECT_OPEN_AUTH:
+        func = "virConnectOpenAuth";
+        conn = virConnectOpenAuth(data->uri, virConnectAuthPtrDefault,
+                                  data->flags);
+        break;
+#endif
+    default:
+        conn = RUBY_LIBVIRT_CALL(virConnectOpen, data->uri);
+        break;
     }
+    ruby_libvirt_raise_error_if(conn == NULL, e_ConnectionError, func, NULL);
 
-    return 0;
+    connect_health_release(data);
+    connect_autoextend_release(data);
+
+    /* the inherited virConnectPtr is deliberately leaked; objects still
+     * referring to it may be freed safely since its refcount never drops to
+     * zero in this process */
+    data->conn = conn;
+    data->generation = connect_generation;
+    data->reopens++;
+    data->reopened = 1;
+
+    /* the new connection may well be to a different host */
+    rb_iv_set(c, "@capabilities_model", Qnil);
 }
 
-static int domain_event_io_error_callback(virConnectPtr conn, virDomainPtr dom,
-                                          const char *src_path,
-                                          const char *dev_alias,
-                                          int action,
-                                          void *opaque)
+VALUE ruby_libvirt_conn_attr(VALUE c)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
+    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
+        c = rb_iv_get(c, "@connection");
+    }
+    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
+        rb_raise(rb_eArgError, "Expected Connection object");
+    }
+    return c;
+}
 
-    Check_Type(passthrough, T_ARRAY);
+virConnectPtr ruby_libvirt_connect_get(VALUE c)
+{
+    struct ruby_libvirt_connect *data;
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
+    c = ruby_libvirt_conn_attr(c);
+    data = connect_data(c);
+    if (!data->conn) {
+        rb_raise(rb_eArgError, "Connect has been freed");
+    }
+    if (connect_stale(data)) {
+        connect_reopen(c, data);
     }
+    return data->conn;
+}
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+/*
+ * Return the connection that objects belonging to OBJ's Connect should now
+ * be using, or NULL if they can keep using the handle they already have.
+ * This is only non-NULL once the Connect has been reopened, after a fork or
+ * by conn.reopen, so the common case costs nothing beyond the instance
+ * variable lookup.
+ */
+virConnectPtr ruby_libvirt_connect_reopened(VALUE obj)
+{
+    struct ruby_libvirt_connect *data;
+    VALUE c;
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 6, newc,
-                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(src_path),
-                   rb_str_new2(dev_alias), INT2NUM(action), cb_opaque);
+    c = rb_iv_get(obj, "@connection");
+    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
+        return NULL;
     }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 6, newc,
-                   ruby_libvirt_domain_new(dom, newc),
-                   rb_str_new2(src_path), rb_str_new2(dev_alias),
-                   INT2NUM(action), cb_opaque);
+    data = connect_data(c);
+    if (!data->conn) {
+        return NULL;
     }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event IO error callback (expected Symbol or Proc)");
+    if (connect_stale(data)) {
+        connect_reopen(c, data);
     }
-
-    return 0;
+    return data->reopened ? data->conn : NULL;
 }
 
-static int domain_event_io_error_reason_callback(virConnectPtr conn,
-                                                 virDomainPtr dom,
-                                                 const char *src_path,
-                                                 const char *dev_alias,
-                                                 int action,
-                                                 const char *reason,
-                                                 void *opaque)
+/*
+ * Node devices, nwfilters, nwfilter bindings and streams have no
+ * vir*GetConnect(), so instead they remember how many times their Connect
+ * had been reopened when they were made, and
+ * ruby_libvirt_connect_reopened_since() stands in for comparing
+ * connections.
+ */
+void ruby_libvirt_connect_stamp(VALUE obj)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc;
-
-    Check_Type(passthrough, T_ARRAY);
+    VALUE c;
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
+    c = rb_iv_get(obj, "@connection");
+    if (rb_obj_is_instance_of(c, c_connect) != Qtrue) {
+        return;
     }
+    rb_ivar_set(obj, id_reopens, ULONG2NUM(connect_data(c)->reopens));
+}
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+/*
+ * Like ruby_libvirt_connect_reopened(), but NULL as well if OBJ was stamped
+ * after the reopen.  Callers that re-resolve OBJ stamp it again afterwards.
+ */
+virConnectPtr ruby_libvirt_connect_reopened_since(VALUE obj)
+{
+    virConnectPtr conn;
+    VALUE reopens;
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 7, newc,
-                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(src_path),
-                   rb_str_new2(dev_alias), INT2NUM(action),
-                   rb_str_new2(reason), cb_opaque);
-    }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 7, newc,
-                   ruby_libvirt_domain_new(dom, newc),
-                   rb_str_new2(src_path), rb_str_new2(dev_alias),
-                   INT2NUM(action), rb_str_new2(reason), cb_opaque);
+    conn = ruby_libvirt_connect_reopened(obj);
+    if (conn == NULL) {
+        return NULL;
     }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event IO error reason callback (expected Symbol or Proc)");
+    reopens = rb_attr_get(obj, id_reopens);
+    if (!NIL_P(reopens) && NUM2ULONG(reopens) ==
+        connect_data(rb_iv_get(obj, "@connection"))->reopens) {
+        return NULL;
     }
+    return conn;
+}
 
-    return 0;
+/*
+ * call-seq:
+ *   conn.close -> nil
+ *
+ * Call virConnectClose[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectClose]
+ * to close the connection.  A connection inherited from a parent process
+ * is only forgotten, never closed, so the parent's session is unaffected.
+ */
+static VALUE libvirt_connect_close(VALUE c)
+{
+    connect_close(connect_data(c));
+    rb_iv_set(c, "@capabilities_model", Qnil);
+    return Qnil;
 }
 
-static int domain_event_graphics_callback(virConnectPtr conn, virDomainPtr dom,
-                                          int phase,
-                                          virDomainEventGraphicsAddressPtr local,
-                                          virDomainEventGraphicsAddressPtr remote,
-                                          const char *authScheme,
-                                          virDomainEventGraphicsSubjectPtr subject,
-                                          void *opaque)
+/*
+ * call-seq:
+ *   conn.closed? -> [True|False]
+ *
+ * Return +true+ if the connection is closed, +false+ if it is open.
+ */
+static VALUE libvirt_connect_closed_p(VALUE c)
 {
-    VALUE passthrough = (VALUE)opaque;
-    VALUE cb, cb_opaque, newc, local_hash, remote_hash, subject_array, pair;
-    int i;
+    return (connect_data(c)->conn == NULL) ? Qtrue : Qfalse;
+}
 
-    Check_Type(passthrough, T_ARRAY);
+/*
+ * call-seq:
+ *   conn.stale? -> [True|False]
+ *
+ * Return +true+ if this connection was opened before the process forked
+ * and has not yet been used in this process.  Stale connections are
+ * transparently reopened from their original URI on first use, and the
+ * objects obtained from them are looked up again by UUID, name or key, so
+ * preforked workers can keep the objects they inherited.  Streams cannot
+ * be looked up again and raise Libvirt::ConnectionError instead.
+ * Connections opened with Libvirt::open_auth are reopened with the default
+ * authentication callback.
+ */
+static VALUE libvirt_connect_stale_p(VALUE c)
+{
+    return connect_stale(connect_data(c)) ? Qtrue : Qfalse;
+}
 
-    if (RARRAY_LEN(passthrough) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(passthrough));
+/*
+ * call-seq:
+ *   conn.reopen -> nil
+ *
+ * Open this connection again from its original URI, as is done for a stale
+ * connection after a fork, typically once the server has gone away
+ * (conn.alive? is +false+, or conn.health reports HEALTH_DEAD).  The old
+ * connection is closed, and objects obtained from this one are looked up
+ * again on first use, except for streams, which raise
+ * Libvirt::ConnectionError.  conn.monitor_liveness and
+ * conn.block_auto_extend have to be set up again afterwards.
+ */
+static VALUE libvirt_connect_reopen(VALUE c)
+{
+    struct ruby_libvirt_connect *data;
+    virConnectPtr old;
+
+    data = connect_data(c);
+    if (!data->conn) {
+        rb_raise(rb_eArgError, "Connect has been freed");
+    }
+    if (connect_stale(data)) {
+        connect_reopen(c, data);
+        return Qnil;
+    }
+    if (!data->reopenable) {
+        rb_raise(e_ConnectionError,
+                 "connection was not opened from a URI and cannot be reopened");
     }
 
-    cb = rb_ary_entry(passthrough, 0);
-    cb_opaque = rb_ary_entry(passthrough, 1);
+    old = data->conn;
+    connect_reopen(c, data);
+    /* objects that have not been looked up again still hold references to
+     * the old connection, so this only frees it once they are gone */
+    virConnectClose(old);
 
-    local_hash = rb_hash_new();
-    rb_hash_aset(local_hash, rb_str_new2("family"), INT2NUM(local->family));
-    rb_hash_aset(local_hash, rb_str_new2("node"), rb_str_new2(local->node));
-    rb_hash_aset(local_hash, rb_str_new2("service"),
-                 rb_str_new2(local->service));
+    return Qnil;
+}
 
-    remote_hash = rb_hash_new();
-    rb_hash_aset(remote_hash, rb_str_new2("family"), INT2NUM(remote->family));
-    rb_hash_aset(remote_hash, rb_str_new2("node"), rb_str_new2(remote->node));
-    rb_hash_aset(remote_hash, rb_str_new2("service"),
-                 rb_str_new2(remote->service));
+/*
+ * call-seq:
+ *   conn.type -> String
+ *
+ * Call virConnectGetType[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetType]
+ * to retrieve the type of hypervisor for this connection.
+ */
+static VALUE libvirt_connect_type(VALUE c)
+{
+    ruby_libvirt_generate_call_string(virConnectGetType,
+                                      ruby_libvirt_connect_get(c), 0,
+                                      ruby_libvirt_connect_get(c));
+}
 
-    subject_array = rb_ary_new();
-    for (i = 0; i < subject->nidentity; i++) {
-        pair = rb_ary_new();
-        rb_ary_store(pair, 0, rb_str_new2(subject->identities[i].type));
-        rb_ary_store(pair, 1, rb_str_new2(subject->identities[i].name));
+/*
+ * call-seq:
+ *   conn.version -> Fixnum
+ *
+ * Call virConnectGetVersion[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetVersion]
+ * to retrieve the version of the hypervisor for this connection.
+ */
+static VALUE libvirt_connect_version(VALUE c)
+{
+    int r;
+    unsigned long v;
 
-        rb_ary_store(subject_array, i, pair);
-    }
+    r = RUBY_LIBVIRT_CALL(virConnectGetVersion, ruby_libvirt_connect_get(c),
+                          &v);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virConnectGetVersion",
+                                ruby_libvirt_connect_get(c));
 
-    newc = ruby_libvirt_connect_new(conn);
-    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
-        rb_funcall(rb_class_of(cb), rb_to_id(cb), 8, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(phase),
-                   local_hash, remote_hash, rb_str_new2(authScheme),
-                   subject_array, cb_opaque);
-    }
-    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
-        rb_funcall(cb, rb_intern("call"), 8, newc,
-                   ruby_libvirt_domain_new(dom, newc), INT2NUM(phase),
-                   local_hash, remote_hash, rb_str_new2(authScheme),
-                   subject_array, cb_opaque);
-    }
-    else {
-        rb_raise(rb_eTypeError,
-                 "wrong domain event graphics callback (expected Symbol or Proc)");
-    }
+    return ULONG2NUM(v);
+}
 
-    return 0;
+#if HAVE_VIRCONNECTGETLIBVERSION
+/*
+ * call-seq:
+ *   conn.libversion -> Fixnum
+ *
+ * Call virConnectGetLibVersion[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetLibVersion]
+ * to retrieve the version of the libvirt library for this connection.
+ */
+static VALUE libvirt_connect_libversion(VALUE c)
+{
+    int r;
+    unsigned long v;
+
+    r = RUBY_LIBVIRT_CALL(virConnectGetLibVersion, ruby_libvirt_connect_get(c),
+                          &v);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virConnectGetLibVersion",
+                                ruby_libvirt_connect_get(c));
+
+    return ULONG2NUM(v);
+}
+#endif
+
+/*
+ * call-seq:
+ *   conn.hostname -> String
+ *
+ * Call virConnectGetHostname[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetHostname]
+ * to retrieve the hostname of the hypervisor for this connection.
+ */
+static VALUE libvirt_connect_hostname(VALUE c)
+{
+    ruby_libvirt_generate_call_string(virConnectGetHostname,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c));
+}
+
+/*
+ * call-seq:
+ *   conn.uri -> String
+ *
+ * Call virConnectGetURI[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetURI]
+ * to retrieve the canonical URI for this connection.
+ */
+static VALUE libvirt_connect_uri(VALUE c)
+{
+    ruby_libvirt_generate_call_string(virConnectGetURI,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c));
+}
+
+/*
+ * call-seq:
+ *   conn.max_vcpus(type=nil) -> Fixnum
+ *
+ * Call virConnectGetMaxVcpus[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetMaxVcpus]
+ * to retrieve the maximum number of virtual cpus supported by the hypervisor
+ * for this connection.
+ */
+static VALUE libvirt_connect_max_vcpus(int argc, VALUE *argv, VALUE c)
+{
+    VALUE type;
+
+    rb_scan_args(argc, argv, "01", &type);
+
+    ruby_libvirt_generate_call_int(virConnectGetMaxVcpus,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_get_cstring_or_null(type));
+}
+
+/*
+ * call-seq:
+ *   conn.node_info -> Libvirt::Connect::Nodeinfo
+ *
+ * Call virNodeGetInfo[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetInfo]
+ * to retrieve information about the node for this connection.
+ */
+static VALUE libvirt_connect_node_info(VALUE c)
+{
+    int r;
+    virNodeInfo nodeinfo;
+    VALUE result;
+
+    r = RUBY_LIBVIRT_CALL(virNodeGetInfo, ruby_libvirt_connect_get(c),
+                          &nodeinfo);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeGetInfo",
+                                ruby_libvirt_connect_get(c));
+
+    result = rb_class_new_instance(0, NULL, c_node_info);
+    rb_iv_set(result, "@model", rb_str_new2(nodeinfo.model));
+    rb_iv_set(result, "@memory", ULONG2NUM(nodeinfo.memory));
+    rb_iv_set(result, "@cpus", UINT2NUM(nodeinfo.cpus));
+    rb_iv_set(result, "@mhz", UINT2NUM(nodeinfo.mhz));
+    rb_iv_set(result, "@nodes", UINT2NUM(nodeinfo.nodes));
+    rb_iv_set(result, "@sockets", UINT2NUM(nodeinfo.sockets));
+    rb_iv_set(result, "@cores", UINT2NUM(nodeinfo.cores));
+    rb_iv_set(result, "@threads", UINT2NUM(nodeinfo.threads));
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   conn.node_free_memory -> Fixnum
+ *
+ * Call virNodeGetFreeMemory[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetFreeMemory]
+ * to retrieve the amount of free memory available on the host for this
+ * connection.
+ */
+static VALUE libvirt_connect_node_free_memory(VALUE c)
+{
+    unsigned long long freemem;
+
+    freemem = RUBY_LIBVIRT_CALL(virNodeGetFreeMemory,
+                                ruby_libvirt_connect_get(c));
+
+    ruby_libvirt_raise_error_if(freemem == 0, e_RetrieveError,
+                                "virNodeGetFreeMemory",
+                                ruby_libvirt_connect_get(c));
+
+    return ULL2NUM(freemem);
+}
+
+/*
+ * call-seq:
+ *   conn.node_cells_free_memory(startCell=0, maxCells=#nodeCells) -> list
+ *
+ * Call virNodeGetCellsFreeMemory[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCellsFreeMemory]
+ * to retrieve the amount of free memory in each NUMA cell on the host for
+ * this connection.
+ */
+static VALUE libvirt_connect_node_cells_free_memory(int argc, VALUE *argv,
+                                                    VALUE c)
+{
+    int i, r;
+    VALUE cells, start, max;
+    unsigned long long *freeMems;
+    virNodeInfo nodeinfo;
+    unsigned int startCell, maxCells;
+
+    rb_scan_args(argc, argv, "02", &start, &max);
+
+    if (NIL_P(start)) {
+        startCell = 0;
+    }
+    else {
+        startCell = NUM2UINT(start);
+    }
+
+    if (NIL_P(max)) {
+        r = RUBY_LIBVIRT_CALL(virNodeGetInfo, ruby_libvirt_connect_get(c),
+                              &nodeinfo);
+        ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeGetInfo",
+                                    ruby_libvirt_connect_get(c));
+        maxCells = nodeinfo.nodes;
+    }
+    else {
+        maxCells = NUM2UINT(max);
+    }
+
+    freeMems = alloca(sizeof(unsigned long long) * maxCells);
+
+    r = RUBY_LIBVIRT_CALL(virNodeGetCellsFreeMemory,
+                          ruby_libvirt_connect_get(c), freeMems, startCell,
+                          maxCells);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virNodeGetCellsFreeMemory",
+                                ruby_libvirt_connect_get(c));
+
+    cells = rb_ary_new2(r);
+    for (i = 0; i < r; i++) {
+        rb_ary_store(cells, i, ULL2NUM(freeMems[i]));
+    }
+
+    return cells;
+}
+
+#if HAVE_VIRNODEGETSECURITYMODEL
+/*
+ * call-seq:
+ *   conn.node_security_model -> Libvirt::Connect::NodeSecurityModel
+ *
+ * Call virNodeGetSecurityModel[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetSecurityModel]
+ * to retrieve the security model in use on the host for this connection.
+ */
+static VALUE libvirt_connect_node_security_model(VALUE c)
+{
+    virSecurityModel secmodel;
+    int r;
+    VALUE result;
+
+    r = RUBY_LIBVIRT_CALL(virNodeGetSecurityModel, ruby_libvirt_connect_get(c),
+                          &secmodel);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virNodeGetSecurityModel",
+                                ruby_libvirt_connect_get(c));
+
+    result = rb_class_new_instance(0, NULL, c_node_security_model);
+    rb_iv_set(result, "@model", rb_str_new2(secmodel.model));
+    rb_iv_set(result, "@doi", rb_str_new2(secmodel.doi));
+
+    return result;
+}
+#endif
+
+#if HAVE_VIRCONNECTISENCRYPTED
+/*
+ * call-seq:
+ *   conn.encrypted? -> [True|False]
+ *
+ * Call virConnectIsEncrypted[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsEncrypted]
+ * to determine if the connection is encrypted.
+ */
+static VALUE libvirt_connect_encrypted_p(VALUE c)
+{
+    ruby_libvirt_generate_call_truefalse(virConnectIsEncrypted,
+                                         ruby_libvirt_connect_get(c),
+                                         ruby_libvirt_connect_get(c));
+}
+#endif
+
+#if HAVE_VIRCONNECTISSECURE
+/*
+ * call-seq:
+ *   conn.secure? -> [True|False]
+ *
+ * Call virConnectIsSecure[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsSecure]
+ * to determine if the connection is secure.
+ */
+static VALUE libvirt_connect_secure_p(VALUE c)
+{
+    ruby_libvirt_generate_call_truefalse(virConnectIsSecure,
+                                         ruby_libvirt_connect_get(c),
+                                         ruby_libvirt_connect_get(c));
+}
+#endif
+
+/*
+ * call-seq:
+ *   conn.capabilities -> String
+ *
+ * Call virConnectGetCapabilities[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetCapabilities]
+ * to retrieve the capabilities XML for this connection.
+ */
+static VALUE libvirt_connect_capabilities(VALUE c)
+{
+    ruby_libvirt_generate_call_string(virConnectGetCapabilities,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c));
+}
+
+#if HAVE_LIBXML_PARSER_H
+/* Collect the children of PARENT called CHILD into an array, using either the
+ * attribute ATTR or the text content of each child.  If CHILD is NULL, the
+ * element names of all of the children are collected instead.
+ */
+static VALUE caps_names(xmlNodePtr parent, const char *child, const char *attr)
+{
+    VALUE result;
+    xmlNodePtr cur;
+
+    result = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(parent, cur, child) {
+        if (child == NULL) {
+            rb_ary_push(result, rb_str_new2((const char *)cur->name));
+        }
+        else if (attr == NULL) {
+            rb_ary_push(result, ruby_libvirt_xml_content(cur));
+        }
+        else {
+            rb_ary_push(result, ruby_libvirt_xml_prop(cur, attr));
+        }
+    }
+
+    return result;
+}
+
+static VALUE caps_pages(xmlNodePtr parent)
+{
+    VALUE result, page;
+    xmlNodePtr cur;
+
+    result = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(parent, cur, "pages") {
+        page = rb_hash_new();
+        rb_hash_aset(page, rb_str_new2("unit"),
+                     ruby_libvirt_xml_prop(cur, "unit"));
+        rb_hash_aset(page, rb_str_new2("size"),
+                     ruby_libvirt_xml_prop_num(cur, "size"));
+        if (cur->children != NULL) {
+            rb_hash_aset(page, rb_str_new2("count"),
+                         ruby_libvirt_xml_content_num(cur));
+        }
+        rb_ary_push(result, page);
+    }
+
+    return result;
+}
+
+static VALUE caps_host_cpu(xmlNodePtr node)
+{
+    VALUE result, topology;
+    xmlNodePtr topo;
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("arch"),
+                 ruby_libvirt_xml_child_content(node, "arch"));
+    rb_hash_aset(result, rb_str_new2("model"),
+                 ruby_libvirt_xml_child_content(node, "model"));
+    rb_hash_aset(result, rb_str_new2("vendor"),
+                 ruby_libvirt_xml_child_content(node, "vendor"));
+
+    topo = ruby_libvirt_xml_child(node, "topology");
+    if (topo != NULL) {
+        topology = rb_hash_new();
+        rb_hash_aset(topology, rb_str_new2("sockets"),
+                     ruby_libvirt_xml_prop_num(topo, "sockets"));
+        rb_hash_aset(topology, rb_str_new2("dies"),
+                     ruby_libvirt_xml_prop_num(topo, "dies"));
+        rb_hash_aset(topology, rb_str_new2("cores"),
+                     ruby_libvirt_xml_prop_num(topo, "cores"));
+        rb_hash_aset(topology, rb_str_new2("threads"),
+                     ruby_libvirt_xml_prop_num(topo, "threads"));
+        rb_hash_aset(result, rb_str_new2("topology"), topology);
+    }
+    rb_hash_aset(result, rb_str_new2("features"),
+                 caps_names(node, "feature", "name"));
+    rb_hash_aset(result, rb_str_new2("pages"), caps_pages(node));
+
+    return result;
+}
+
+static VALUE caps_cells(xmlNodePtr node)
+{
+    VALUE result, cell, cpus, cpu, distances;
+    xmlNodePtr cells, cur, child, memory;
+
+    result = rb_ary_new();
+    cells = ruby_libvirt_xml_child(node, "cells");
+    ruby_libvirt_xml_foreach_child(cells, cur, "cell") {
+        cell = rb_hash_new();
+        rb_hash_aset(cell, rb_str_new2("id"),
+                     ruby_libvirt_xml_prop_num(cur, "id"));
+        memory = ruby_libvirt_xml_child(cur, "memory");
+        rb_hash_aset(cell, rb_str_new2("memory"),
+                     ruby_libvirt_xml_content_num(memory));
+        rb_hash_aset(cell, rb_str_new2("memory_unit"),
+                     ruby_libvirt_xml_prop(memory, "unit"));
+        rb_hash_aset(cell, rb_str_new2("pages"), caps_pages(cur));
+
+        distances = rb_hash_new();
+        ruby_libvirt_xml_foreach_child(ruby_libvirt_xml_child(cur, "distances"),
+                                       child, "sibling") {
+            rb_hash_aset(distances, ruby_libvirt_xml_prop_num(child, "id"),
+                         ruby_libvirt_xml_prop_num(child, "value"));
+        }
+        rb_hash_aset(cell, rb_str_new2("distances"), distances);
+
+        cpus = rb_ary_new();
+        ruby_libvirt_xml_foreach_child(ruby_libvirt_xml_child(cur, "cpus"),
+                                       child, "cpu") {
+            cpu = rb_hash_new();
+            rb_hash_aset(cpu, rb_str_new2("id"),
+                         ruby_libvirt_xml_prop_num(child, "id"));
+            rb_hash_aset(cpu, rb_str_new2("socket_id"),
+                         ruby_libvirt_xml_prop_num(child, "socket_id"));
+            rb_hash_aset(cpu, rb_str_new2("die_id"),
+                         ruby_libvirt_xml_prop_num(child, "die_id"));
+            rb_hash_aset(cpu, rb_str_new2("core_id"),
+                         ruby_libvirt_xml_prop_num(child, "core_id"));
+            rb_hash_aset(cpu, rb_str_new2("siblings"),
+                         ruby_libvirt_xml_prop(child, "siblings"));
+            rb_ary_push(cpus, cpu);
+        }
+        rb_hash_aset(cell, rb_str_new2("cpus"), cpus);
+
+        rb_ary_push(result, cell);
+    }
+
+    return result;
+}
+
+static VALUE caps_caches(xmlNodePtr node)
+{
+    VALUE result, bank;
+    xmlNodePtr cur;
+
+    result = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(node, cur, "bank") {
+        bank = rb_hash_new();
+        rb_hash_aset(bank, rb_str_new2("id"),
+                     ruby_libvirt_xml_prop_num(cur, "id"));
+        rb_hash_aset(bank, rb_str_new2("level"),
+                     ruby_libvirt_xml_prop_num(cur, "level"));
+        rb_hash_aset(bank, rb_str_new2("type"),
+                     ruby_libvirt_xml_prop(cur, "type"));
+        rb_hash_aset(bank, rb_str_new2("size"),
+                     ruby_libvirt_xml_prop_num(cur, "size"));
+        rb_hash_aset(bank, rb_str_new2("unit"),
+                     ruby_libvirt_xml_prop(cur, "unit"));
+        rb_hash_aset(bank, rb_str_new2("cpus"),
+                     ruby_libvirt_xml_prop(cur, "cpus"));
+        rb_ary_push(result, bank);
+    }
+
+    return result;
+}
+
+static VALUE caps_host(xmlNodePtr node)
+{
+    VALUE result, secmodels, secmodel;
+    xmlNodePtr cur, child;
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("uuid"),
+                 ruby_libvirt_xml_child_content(node, "uuid"));
+    rb_hash_aset(result, rb_str_new2("cpu"),
+                 caps_host_cpu(ruby_libvirt_xml_child(node, "cpu")));
+    rb_hash_aset(result, rb_str_new2("power_management"),
+                 caps_names(ruby_libvirt_xml_child(node, "power_management"),
+                            NULL, NULL));
+    child = ruby_libvirt_xml_child(node, "iommu");
+    rb_hash_aset(result, rb_str_new2("iommu"),
+                 ruby_libvirt_xml_prop(child, "support"));
+    child = ruby_libvirt_xml_child(ruby_libvirt_xml_child(node, "migration_features"),
+                                   "uri_transports");
+    rb_hash_aset(result, rb_str_new2("migration_transports"),
+                 caps_names(child, "uri_transport", NULL));
+    rb_hash_aset(result, rb_str_new2("cells"),
+                 caps_cells(ruby_libvirt_xml_child(node, "topology")));
+    rb_hash_aset(result, rb_str_new2("caches"),
+                 caps_caches(ruby_libvirt_xml_child(node, "cache")));
+
+    secmodels = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(node, cur, "secmodel") {
+        secmodel = rb_hash_new();
+        rb_hash_aset(secmodel, rb_str_new2("model"),
+                     ruby_libvirt_xml_child_content(cur, "model"));
+        rb_hash_aset(secmodel, rb_str_new2("doi"),
+                     ruby_libvirt_xml_child_content(cur, "doi"));
+        rb_ary_push(secmodels, secmodel);
+    }
+    rb_hash_aset(result, rb_str_new2("secmodels"), secmodels);
+
+    return result;
+}
+
+static VALUE caps_machines(xmlNodePtr node)
+{
+    VALUE result, machine;
+    xmlNodePtr cur;
+
+    result = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(node, cur, "machine") {
+        machine = rb_hash_new();
+        rb_hash_aset(machine, rb_str_new2("name"),
+                     ruby_libvirt_xml_content(cur));
+        rb_hash_aset(machine, rb_str_new2("canonical"),
+                     ruby_libvirt_xml_prop(cur, "canonical"));
+        rb_hash_aset(machine, rb_str_new2("max_cpus"),
+                     ruby_libvirt_xml_prop_num(cur, "maxCpus"));
+        rb_ary_push(result, machine);
+    }
+
+    return result;
+}
+
+static VALUE caps_guest(xmlNodePtr node)
+{
+    VALUE result, domains, domain;
+    xmlNodePtr arch, cur;
+
+    arch = ruby_libvirt_xml_child(node, "arch");
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("os_type"),
+                 ruby_libvirt_xml_child_content(node, "os_type"));
+    rb_hash_aset(result, rb_str_new2("arch"),
+                 ruby_libvirt_xml_prop(arch, "name"));
+    rb_hash_aset(result, rb_str_new2("wordsize"),
+                 ruby_libvirt_xml_content_num(ruby_libvirt_xml_child(arch,
+                                                                     "wordsize")));
+    rb_hash_aset(result, rb_str_new2("emulator"),
+                 ruby_libvirt_xml_child_content(arch, "emulator"));
+    rb_hash_aset(result, rb_str_new2("machines"), caps_machines(arch));
+
+    domains = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(arch, cur, "domain") {
+        domain = rb_hash_new();
+        rb_hash_aset(domain, rb_str_new2("type"),
+                     ruby_libvirt_xml_prop(cur, "type"));
+        rb_hash_aset(domain, rb_str_new2("emulator"),
+                     ruby_libvirt_xml_child_content(cur, "emulator"));
+        rb_hash_aset(domain, rb_str_new2("machines"), caps_machines(cur));
+        rb_ary_push(domains, domain);
+    }
+    rb_hash_aset(result, rb_str_new2("domains"), domains);
+
+    rb_hash_aset(result, rb_str_new2("features"),
+                 caps_names(ruby_libvirt_xml_child(node, "features"), NULL,
+                            NULL));
+
+    return result;
+}
+
+static VALUE caps_model_wrap(VALUE arg)
+{
+    xmlNodePtr root = (xmlNodePtr)arg;
+    xmlNodePtr cur;
+    VALUE result, guests;
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("host"),
+                 caps_host(ruby_libvirt_xml_child(root, "host")));
+
+    guests = rb_ary_new();
+    ruby_libvirt_xml_foreach_child(root, cur, "guest") {
+        rb_ary_push(guests, caps_guest(cur));
+    }
+    rb_hash_aset(result, rb_str_new2("guests"), guests);
+
+    return ruby_libvirt_deep_freeze(result);
+}
+
+/*
+ * call-seq:
+ *   conn.capabilities_model(refresh=false) -> Hash
+ *
+ * Call virConnectGetCapabilities[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetCapabilities]
+ * and parse the capabilities XML into a frozen Hash describing the host
+ * ("cpu", NUMA "cells", "caches", ...) and the "guests" (arches, domain
+ * types and machine types) it supports.  The result is cached on the
+ * connection until it is closed; pass refresh=true to re-read it.
+ */
+static VALUE libvirt_connect_capabilities_model(int argc, VALUE *argv, VALUE c)
+{
+    VALUE refresh, result;
+    char *caps;
+    xmlDocPtr doc;
+    int exception = 0;
+
+    rb_scan_args(argc, argv, "01", &refresh);
+
+    result = rb_iv_get(c, "@capabilities_model");
+    if (!NIL_P(result) && !RTEST(refresh)) {
+        return result;
+    }
+
+    caps = RUBY_LIBVIRT_CALL(virConnectGetCapabilities,
+                             ruby_libvirt_connect_get(c));
+    ruby_libvirt_raise_error_if(caps == NULL, e_RetrieveError,
+                                "virConnectGetCapabilities",
+                                ruby_libvirt_connect_get(c));
+
+    doc = ruby_libvirt_xml_parse(caps);
+    free(caps);
+    if (doc == NULL) {
+        rb_raise(e_RetrieveError, "Failed to parse capabilities XML");
+    }
+
+    result = rb_protect(caps_model_wrap, (VALUE)xmlDocGetRootElement(doc),
+                        &exception);
+    xmlFreeDoc(doc);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    rb_iv_set(c, "@capabilities_model", result);
+
+    return result;
+}
+#endif
+
+#if HAVE_VIRCONNECTCOMPARECPU
+/*
+ * call-seq:
+ *   conn.compare_cpu(xml, flags=0) -> compareflag
+ *
+ * Call virConnectCompareCPU[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectCompareCPU]
+ * to compare the host CPU with the XML contained in xml.  Returns one of
+ * Libvirt::CPU_COMPARE_ERROR, Libvirt::CPU_COMPARE_INCOMPATIBLE,
+ * Libvirt::CPU_COMPARE_IDENTICAL, or Libvirt::CPU_COMPARE_SUPERSET.
+ */
+static VALUE libvirt_connect_compare_cpu(int argc, VALUE *argv, VALUE c)
+{
+    VALUE xml, flags;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    ruby_libvirt_generate_call_int(virConnectCompareCPU,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   StringValueCStr(xml),
+                                   ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+
+#if HAVE_VIRCONNECTBASELINECPU
+/*
+ * call-seq:
+ *   conn.baseline_cpu([xml, xml2, ...], flags=0) -> XML
+ *
+ * Call virConnectBaselineCPU[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectBaselineCPU]
+ * to compare the most feature-rich CPU which is compatible with all
+ * given host CPUs.
+ */
+static VALUE libvirt_connect_baseline_cpu(int argc, VALUE *argv, VALUE c)
+{
+    VALUE xmlcpus, flags, retval, entry;
+    char *r;
+    unsigned int ncpus;
+    const char **xmllist;
+    int exception = 0;
+    unsigned int i;
+
+    rb_scan_args(argc, argv, "11", &xmlcpus, &flags);
+
+    Check_Type(xmlcpus, T_ARRAY);
+
+    if (RARRAY_LEN(xmlcpus) < 1) {
+        rb_raise(rb_eArgError,
+                 "wrong number of cpu arguments (%ld for 1 or more)",
+                 RARRAY_LEN(xmlcpus));
+    }
+
+    ncpus = RARRAY_LEN(xmlcpus);
+    xmllist = alloca(sizeof(const char *) * ncpus);
+
+    for (i = 0; i < ncpus; i++) {
+        entry = rb_ary_entry(xmlcpus, i);
+        xmllist[i] = StringValueCStr(entry);
+    }
+
+    r = RUBY_LIBVIRT_CALL(virConnectBaselineCPU, ruby_libvirt_connect_get(c),
+                          xmllist, ncpus, ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r == NULL, e_RetrieveError,
+                                "virConnectBaselineCPU",
+                                ruby_libvirt_connect_get(c));
+
+    retval = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&r, &exception);
+    free(r);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return retval;
+}
+#endif
+
+#if HAVE_VIRCONNECTDOMAINEVENTREGISTERANY || HAVE_VIRCONNECTDOMAINEVENTREGISTER
+static int domain_event_lifecycle_callback(virConnectPtr conn,
+                                           virDomainPtr dom, int event,
+                                           int detail, void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 5, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(event),
+                   INT2NUM(detail), cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 5, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(event),
+                   INT2NUM(detail), cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event lifecycle callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+#endif
+
+#if HAVE_VIRCONNECTDOMAINEVENTREGISTERANY
+static int domain_event_reboot_callback(virConnectPtr conn, virDomainPtr dom,
+                                        void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 3, newc,
+                   ruby_libvirt_domain_new(dom, newc), cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 3, newc,
+                   ruby_libvirt_domain_new(dom, newc), cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event reboot callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+static int domain_event_rtc_callback(virConnectPtr conn, virDomainPtr dom,
+                                     long long utc_offset, void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 4, newc,
+                   ruby_libvirt_domain_new(dom, newc), LL2NUM(utc_offset),
+                   cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 4, newc,
+                   ruby_libvirt_domain_new(dom, newc), LL2NUM(utc_offset),
+                   cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event rtc callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+static int domain_event_watchdog_callback(virConnectPtr conn, virDomainPtr dom,
+                                          int action, void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 4, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(action),
+                   cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 4, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(action),
+                   cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event watchdog callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+static int domain_event_io_error_callback(virConnectPtr conn, virDomainPtr dom,
+                                          const char *src_path,
+                                          const char *dev_alias,
+                                          int action,
+                                          void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 6, newc,
+                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(src_path),
+                   rb_str_new2(dev_alias), INT2NUM(action), cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 6, newc,
+                   ruby_libvirt_domain_new(dom, newc),
+                   rb_str_new2(src_path), rb_str_new2(dev_alias),
+                   INT2NUM(action), cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event IO error callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+static int domain_event_io_error_reason_callback(virConnectPtr conn,
+                                                 virDomainPtr dom,
+                                                 const char *src_path,
+                                                 const char *dev_alias,
+                                                 int action,
+                                                 const char *reason,
+                                                 void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 7, newc,
+                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(src_path),
+                   rb_str_new2(dev_alias), INT2NUM(action),
+                   rb_str_new2(reason), cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 7, newc,
+                   ruby_libvirt_domain_new(dom, newc),
+                   rb_str_new2(src_path), rb_str_new2(dev_alias),
+                   INT2NUM(action), rb_str_new2(reason), cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event IO error reason callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+static int domain_event_graphics_callback(virConnectPtr conn, virDomainPtr dom,
+                                          int phase,
+                                          virDomainEventGraphicsAddressPtr local,
+                                          virDomainEventGraphicsAddressPtr remote,
+                                          const char *authScheme,
+                                          virDomainEventGraphicsSubjectPtr subject,
+                                          void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc, local_hash, remote_hash, subject_array, pair;
+    int i;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    local_hash = rb_hash_new();
+    rb_hash_aset(local_hash, rb_str_new2("family"), INT2NUM(local->family));
+    rb_hash_aset(local_hash, rb_str_new2("node"), rb_str_new2(local->node));
+    rb_hash_aset(local_hash, rb_str_new2("service"),
+                 rb_str_new2(local->service));
+
+    remote_hash = rb_hash_new();
+    rb_hash_aset(remote_hash, rb_str_new2("family"), INT2NUM(remote->family));
+    rb_hash_aset(remote_hash, rb_str_new2("node"), rb_str_new2(remote->node));
+    rb_hash_aset(remote_hash, rb_str_new2("service"),
+                 rb_str_new2(remote->service));
+
+    subject_array = rb_ary_new();
+    for (i = 0; i < subject->nidentity; i++) {
+        pair = rb_ary_new();
+        rb_ary_store(pair, 0, rb_str_new2(subject->identities[i].type));
+        rb_ary_store(pair, 1, rb_str_new2(subject->identities[i].name));
+
+        rb_ary_store(subject_array, i, pair);
+    }
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 8, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(phase),
+                   local_hash, remote_hash, rb_str_new2(authScheme),
+                   subject_array, cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 8, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(phase),
+                   local_hash, remote_hash, rb_str_new2(authScheme),
+                   subject_array, cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event graphics callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD
+static int domain_event_block_threshold_callback(virConnectPtr conn,
+                                                 virDomainPtr dom,
+                                                 const char *dev,
+                                                 const char *path,
+                                                 unsigned long long threshold,
+                                                 unsigned long long excess,
+                                                 void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 7, newc,
+                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(dev),
+                   path ? rb_str_new2(path) : Qnil, ULL2NUM(threshold),
+                   ULL2NUM(excess), cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 7, newc,
+                   ruby_libvirt_domain_new(dom, newc), rb_str_new2(dev),
+                   path ? rb_str_new2(path) : Qnil, ULL2NUM(threshold),
+                   ULL2NUM(excess), cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event block threshold callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+#endif
+
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_METADATA_CHANGE
+static int domain_event_metadata_change_callback(virConnectPtr conn,
+                                                 virDomainPtr dom, int type,
+                                                 const char *nsuri,
+                                                 void *opaque)
+{
+    VALUE passthrough = (VALUE)opaque;
+    VALUE cb, cb_opaque, newc;
+
+    Check_Type(passthrough, T_ARRAY);
+
+    if (RARRAY_LEN(passthrough) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(passthrough));
+    }
+
+    cb = rb_ary_entry(passthrough, 0);
+    cb_opaque = rb_ary_entry(passthrough, 1);
+
+    newc = ruby_libvirt_connect_new(conn);
+    if (strcmp(rb_obj_classname(cb), "Symbol") == 0) {
+        rb_funcall(rb_class_of(cb), rb_to_id(cb), 5, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(type),
+                   nsuri ? rb_str_new2(nsuri) : Qnil, cb_opaque);
+    }
+    else if (strcmp(rb_obj_classname(cb), "Proc") == 0) {
+        rb_funcall(cb, rb_intern("call"), 5, newc,
+                   ruby_libvirt_domain_new(dom, newc), INT2NUM(type),
+                   nsuri ? rb_str_new2(nsuri) : Qnil, cb_opaque);
+    }
+    else {
+        rb_raise(rb_eTypeError,
+                 "wrong domain event metadata change callback (expected Symbol or Proc)");
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * call-seq:
+ *   conn.domain_event_register_any(eventID, callback, dom=nil, opaque=nil) -> Fixnum
+ *
+ * Call virConnectDomainEventRegisterAny[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventRegisterAny]
+ * to register callback for eventID with libvirt.  The eventID must be one of
+ * the Libvirt::Connect::DOMAIN_EVENT_ID_* constants.  The callback can either
+ * be a Symbol (that is the name of a method to callback) or a Proc.  Note that
+ * the callback must accept different numbers of arguments depending on the
+ * eventID passed in.  The arguments are as follows:
+ *
+ * - DOMAIN_EVENT_ID_LIFECYCLE: Libvirt::Connect, Libvirt::Domain, event, detail, opaque
+ * - DOMAIN_EVENT_ID_REBOOT: Libvirt::Connect, Libvirt::Domain, opaque
+ * - DOMAIN_EVENT_ID_RTC_CHANGE: Libvirt::Connect, Libvirt::Domain, utc_offset, opaque
+ * - DOMAIN_EVENT_ID_WATCHDOG: Libvirt::Connect, Libvirt::Domain, action, opaque
+ * - DOMAIN_EVENT_ID_IO_ERROR: Libvirt::Connect, Libvirt::Domain, src_path, dev_alias, action, opaque
+ * - DOMAIN_EVENT_ID_IO_ERROR_REASON: Libvirt::Connect, Libvirt::Domain, src_path, dev_alias, action, reason, opaque
+ * - DOMAIN_EVENT_ID_GRAPHICS: Libvirt::Connect, Libvirt::Domain, phase, local, remote, auth_scheme, subject, opaque
+ * - DOMAIN_EVENT_ID_BLOCK_THRESHOLD: Libvirt::Connect, Libvirt::Domain, dev, path, threshold, excess, opaque
+ * - DOMAIN_EVENT_ID_METADATA_CHANGE: Libvirt::Connect, Libvirt::Domain, type, nsuri, opaque
+
+ * If dom is a valid Libvirt::Domain object, then only events from that
+ * domain will be seen.  The opaque parameter can be any valid ruby type, and
+ * will be passed into callback as "opaque".  This method returns a
+ * libvirt-specific handle, which must be used by the application to
+ * deregister the callback later (see domain_event_deregister_any).
+ */
+static VALUE libvirt_connect_domain_event_register_any(int argc, VALUE *argv,
+                                                       VALUE c)
+{
+    VALUE eventID, cb, dom, opaque, passthrough;
+    virDomainPtr domain;
+    virConnectDomainEventGenericCallback internalcb = NULL;
+
+    rb_scan_args(argc, argv, "22", &eventID, &cb, &dom, &opaque);
+
+    if (!ruby_libvirt_is_symbol_or_proc(cb)) {
+        rb_raise(rb_eTypeError,
+                 "wrong argument type (expected Symbol or Proc)");
+    }
+
+    if (NIL_P(dom)) {
+        domain = NULL;
+    }
+    else {
+        domain = ruby_libvirt_domain_get(dom);
+    }
+
+    switch(NUM2INT(eventID)) {
+    case VIR_DOMAIN_EVENT_ID_LIFECYCLE:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_lifecycle_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_REBOOT:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_reboot_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_RTC_CHANGE:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_rtc_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_WATCHDOG:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_watchdog_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_IO_ERROR:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_io_error_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_IO_ERROR_REASON:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_io_error_reason_callback);
+        break;
+    case VIR_DOMAIN_EVENT_ID_GRAPHICS:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_graphics_callback);
+        break;
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD
+    case VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_block_threshold_callback);
+        break;
+#endif
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_METADATA_CHANGE
+    case VIR_DOMAIN_EVENT_ID_METADATA_CHANGE:
+        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_metadata_change_callback);
+        break;
+#endif
+    default:
+        rb_raise(rb_eArgError, "invalid eventID argument %d",
+                 NUM2INT(eventID));
+        break;
+    }
+
+    ruby_libvirt_check_ruby_callbacks();
+
+    passthrough = rb_ary_new();
+    rb_ary_store(passthrough, 0, cb);
+    rb_ary_store(passthrough, 1, opaque);
+
+    ruby_libvirt_generate_call_int(virConnectDomainEventRegisterAny,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c), domain,
+                                   NUM2INT(eventID), internalcb,
+                                   (void *)passthrough, NULL);
+}
+
+/*
+ * call-seq:
+ *   conn.domain_event_deregister_any(callbackID) -> nil
+ *
+ * Call virConnectDomainEventDeregisterAny[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventDeregisterAny]
+ * to deregister a callback from libvirt.  The callbackID must be a
+ * libvirt-specific handle returned by domain_event_register_any.
+ */
+static VALUE libvirt_connect_domain_event_deregister_any(VALUE c,
+                                                         VALUE callbackID)
+{
+    ruby_libvirt_generate_call_nil(virConnectDomainEventDeregisterAny,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   NUM2INT(callbackID));
+}
+#endif
+
+#if HAVE_VIRCONNECTDOMAINEVENTREGISTER
+/*
+ * this is a bit of silliness.  Because libvirt internals track the address
+ * of the function pointer, trying to use domain_event_lifecycle_callback
+ * for both register and register_any would mean that we could only register
+ * one or the other for lifecycle callbacks.  Instead we do a simple wrapper
+ * so that the addresses are different
+ */
+static int domain_event_callback(virConnectPtr conn,
+                                 virDomainPtr dom, int event,
+                                 int detail, void *opaque)
+{
+    return domain_event_lifecycle_callback(conn, dom, event, detail, opaque);
+}
+/*
+ * call-seq:
+ *   conn.domain_event_register(callback, opaque=nil) -> nil
+ *
+ * Call virConnectDomainEventRegister[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventRegister]
+ * to register callback for domain lifecycle events with libvirt.  The
+ * callback can either be a Symbol (that is the name of a method to callback)
+ * or a Proc.  The callback must accept 5 parameters: Libvirt::Connect,
+ * Libvirt::Domain, event, detail, opaque.  The opaque parameter to
+ * domain_event_register can be any valid ruby type, and will be passed into
+ * callback as "opaque".  This method is deprecated in favor of
+ * domain_event_register_any.
+ */
+static VALUE libvirt_connect_domain_event_register(int argc, VALUE *argv,
+                                                   VALUE c)
+{
+    VALUE cb, opaque, passthrough;
+
+    rb_scan_args(argc, argv, "11", &cb, &opaque);
+
+    if (!ruby_libvirt_is_symbol_or_proc(cb)) {
+        rb_raise(rb_eTypeError,
+                 "wrong argument type (expected Symbol or Proc)");
+    }
+
+    ruby_libvirt_check_ruby_callbacks();
+
+    passthrough = rb_ary_new();
+    rb_ary_store(passthrough, 0, cb);
+    rb_ary_store(passthrough, 1, opaque);
+
+    ruby_libvirt_generate_call_nil(virConnectDomainEventRegister,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   domain_event_callback, (void *)passthrough,
+                                   NULL);
+}
+
+/*
+ * call-seq:
+ *   conn.domain_event_deregister(callback) -> nil
+ *
+ * Call virConnectDomainEventDeregister[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventDeregister]
+ * to deregister the event callback from libvirt.  This method is deprecated
+ * in favor of domain_event_deregister_any (though they cannot be mixed; if
+ * the callback was registered with domain_event_register, it must be
+ * deregistered with domain_event_deregister).
+ */
+static VALUE libvirt_connect_domain_event_deregister(VALUE c)
+{
+    ruby_libvirt_generate_call_nil(virConnectDomainEventDeregister,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   domain_event_callback);
+}
+#endif
+
+/*
+ * call-seq:
+ *   conn.num_of_domains -> Fixnum
+ *
+ * Call virConnectNumOfDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectNumOfDomains]
+ * to retrieve the number of active domains on this connection.
+ */
+static VALUE libvirt_connect_num_of_domains(VALUE c)
+{
+    gen_conn_num_of(c, Domains);
+}
+
+/*
+ * call-seq:
+ *   conn.list_domains -> list
+ *
+ * Call virConnectListDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListDomains]
+ * to retrieve a list of active domain IDs on this connection.
+ */
+static VALUE libvirt_connect_list_domains(VALUE c)
+{
+    int i, r, num, *ids;
+    VALUE result;
+
+    num = RUBY_LIBVIRT_CALL(virConnectNumOfDomains,
+                            ruby_libvirt_connect_get(c));
+    ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
+                                "virConnectNumOfDomains",
+                                ruby_libvirt_connect_get(c));
+
+    result = rb_ary_new2(num);
+
+    if (num == 0) {
+        return result;
+    }
+
+    ids = alloca(sizeof(int) * num);
+    r = RUBY_LIBVIRT_CALL(virConnectListDomains, ruby_libvirt_connect_get(c),
+                          ids, num);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virConnectListDomains",
+                                ruby_libvirt_connect_get(c));
+
+    for (i = 0; i < num; i++) {
+        rb_ary_store(result, i, INT2NUM(ids[i]));
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   conn.num_of_defined_domains -> Fixnum
+ *
+ * Call virConnectNumOfDefinedDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectNumOfDefinedDomains]
+ * to retrieve the number of inactive domains on this connection.
+ */
+static VALUE libvirt_connect_num_of_defined_domains(VALUE c)
+{
+    gen_conn_num_of(c, DefinedDomains);
+}
+
+/*
+ * call-seq:
+ *   conn.list_defined_domains -> list
+ *
+ * Call virConnectListDefinedDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListDefinedDomains]
+ * to retrieve a list of inactive domain names on this connection.
+ */
+static VALUE libvirt_connect_list_defined_domains(VALUE c)
+{
+    gen_conn_list_names(c, DefinedDomains);
+}
+
+/*
+ * call-seq:
+ *   conn.create_domain_linux(xml, flags=0) -> Libvirt::Domain
+ *
+ * Call virDomainCreateLinux[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainCreateLinux]
+ * to start a transient domain from the given XML.  Deprecated; use
+ * conn.create_domain_xml instead.
+ */
+static VALUE libvirt_connect_create_linux(int argc, VALUE *argv, VALUE c)
+{
+    virDomainPtr dom;
+    VALUE flags, xml;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    dom = RUBY_LIBVIRT_CALL(virDomainCreateLinux, ruby_libvirt_connect_get(c),
+                            StringValueCStr(xml),
+                            ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(dom == NULL, e_Error, "virDomainCreateLinux",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+
+#if HAVE_VIRDOMAINCREATEXML
+/*
+ * call-seq:
+ *   conn.create_domain_xml(xml, flags=0) -> Libvirt::Domain
+ *
+ * Call virDomainCreateXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainCreateXML]
+ * to start a transient domain from the given XML.
+ */
+static VALUE libvirt_connect_create_domain_xml(int argc, VALUE *argv, VALUE c)
+{
+    virDomainPtr dom;
+    VALUE flags, xml;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    dom = RUBY_LIBVIRT_CALL(virDomainCreateXML, ruby_libvirt_connect_get(c),
+                            StringValueCStr(xml),
+                            ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(dom == NULL, e_Error, "virDomainCreateXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+#endif
+
+/*
+ * call-seq:
+ *   conn.lookup_domain_by_name(name) -> Libvirt::Domain
+ *
+ * Call virDomainLookupByName[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByName]
+ * to retrieve a domain object for name.
+ */
+static VALUE libvirt_connect_lookup_domain_by_name(VALUE c, VALUE name)
+{
+    virDomainPtr dom;
+
+    dom = RUBY_LIBVIRT_CALL(virDomainLookupByName, ruby_libvirt_connect_get(c),
+                            StringValueCStr(name));
+    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
+                                "virDomainLookupByName",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+
+/*
+ * call-seq:
+ *   conn.lookup_domain_by_id(id) -> Libvirt::Domain
+ *
+ * Call virDomainLookupByID[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByID]
+ * to retrieve a domain object for id.
+ */
+static VALUE libvirt_connect_lookup_domain_by_id(VALUE c, VALUE id)
+{
+    virDomainPtr dom;
+
+    dom = RUBY_LIBVIRT_CALL(virDomainLookupByID, ruby_libvirt_connect_get(c),
+                            NUM2INT(id));
+    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
+                                "virDomainLookupByID",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+
+/*
+ * call-seq:
+ *   conn.lookup_domain_by_uuid(uuid) -> Libvirt::Domain
+ *
+ * Call virDomainLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByUUIDString]
+ * to retrieve a domain object for uuid.
+ */
+static VALUE libvirt_connect_lookup_domain_by_uuid(VALUE c, VALUE uuid)
+{
+    virDomainPtr dom;
+
+    dom = RUBY_LIBVIRT_CALL(virDomainLookupByUUIDString,
+                            ruby_libvirt_connect_get(c),
+                            StringValueCStr(uuid));
+    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
+                                "virDomainLookupByUUID",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+
+/*
+ * call-seq:
+ *   conn.define_domain_xml(xml, flags=0) -> Libvirt::Domain
+ *
+ * Call virDomainDefineXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainDefineXML]
+ * to define a permanent domain on this connection.
+ */
+static VALUE libvirt_connect_define_domain_xml(int argc, VALUE *argv, VALUE c)
+{
+    virDomainPtr dom;
+    VALUE xml;
+    VALUE flags;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+#if HAVE_VIRDOMAINDEFINEXMLFLAGS
+    dom = RUBY_LIBVIRT_CALL(virDomainDefineXMLFlags,
+                            ruby_libvirt_connect_get(c), StringValueCStr(xml),
+                            ruby_libvirt_value_to_uint(flags));
+#else
+    if (ruby_libvirt_value_to_uint(flags) != 0) {
+        rb_raise(e_NoSupportError, "Non-zero flags not supported");
+    }
+    dom = RUBY_LIBVIRT_CALL(virDomainDefineXML, ruby_libvirt_connect_get(c),
+                            StringValueCStr(xml));
+#endif
+
+    ruby_libvirt_raise_error_if(dom == NULL, e_DefinitionError,
+                                "virDomainDefineXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_domain_new(dom, c);
+}
+
+#if HAVE_VIRCONNECTDOMAINXMLFROMNATIVE
+/*
+ * call-seq:
+ *   conn.domain_xml_from_native(nativeFormat, xml, flags=0) -> String
+ *
+ * Call virConnectDomainXMLFromNative[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainXMLFromNative]
+ * to convert a native hypervisor domain representation to libvirt XML.
+ */
+static VALUE libvirt_connect_domain_xml_from_native(int argc, VALUE *argv,
+                                                    VALUE c)
+{
+    VALUE nativeFormat, xml, flags;
+
+    rb_scan_args(argc, argv, "21", &nativeFormat, &xml, &flags);
+
+    ruby_libvirt_generate_call_string(virConnectDomainXMLFromNative,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c),
+                                      StringValueCStr(nativeFormat),
+                                      StringValueCStr(xml),
+                                      ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_VIRCONNECTDOMAINXMLTONATIVE
+/*
+ * call-seq:
+ *   conn.domain_xml_to_native(nativeFormat, xml, flags=0) -> String
+ *
+ * Call virConnectDomainXMLToNative[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainXMLToNative]
+ * to convert libvirt XML to a native domain hypervisor representation.
+ */
+static VALUE libvirt_connect_domain_xml_to_native(int argc, VALUE *argv,
+                                                  VALUE c)
+{
+    VALUE nativeFormat, xml, flags;
+
+    rb_scan_args(argc, argv, "21", &nativeFormat, &xml, &flags);
+
+    ruby_libvirt_generate_call_string(virConnectDomainXMLToNative,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c),
+                                      StringValueCStr(nativeFormat),
+                                      StringValueCStr(xml),
+                                      ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_TYPE_VIRINTERFACEPTR
+/*
+ * call-seq:
+ *   conn.num_of_interfaces -> Fixnum
+ *
+ * Call virConnectNumOfInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectNumOfInterfaces]
+ * to retrieve the number of active interfaces on this connection.
+ */
+static VALUE libvirt_connect_num_of_interfaces(VALUE c)
+{
+    gen_conn_num_of(c, Interfaces);
+}
+
+/*
+ * call-seq:
+ *   conn.list_interfaces -> list
+ *
+ * Call virConnectListInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListInterfaces]
+ * to retrieve a list of active interface names on this connection.
+ */
+static VALUE libvirt_connect_list_interfaces(VALUE c)
+{
+    gen_conn_list_names(c, Interfaces);
+}
+
+/*
+ * call-seq:
+ *   conn.num_of_defined_interfaces -> Fixnum
+ *
+ * Call virConnectNumOfDefinedInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectNumOfDefinedInterfaces]
+ * to retrieve the number of inactive interfaces on this connection.
+ */
+static VALUE libvirt_connect_num_of_defined_interfaces(VALUE c)
+{
+    gen_conn_num_of(c, DefinedInterfaces);
 }
 
 /*
  * call-seq:
- *   conn.domain_event_register_any(eventID, callback, dom=nil, opaque=nil) -> Fixnum
- *
- * Call virConnectDomainEventRegisterAny[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventRegisterAny]
- * to register callback for eventID with libvirt.  The eventID must be one of
- * the Libvirt::Connect::DOMAIN_EVENT_ID_* constants.  The callback can either
- * be a Symbol (that is the name of a method to callback) or a Proc.  Note that
- * the callback must accept different numbers of arguments depending on the
- * eventID passed in.  The arguments are as follows:
+ *   conn.list_defined_interfaces -> list
  *
- * - DOMAIN_EVENT_ID_LIFECYCLE: Libvirt::Connect, Libvirt::Domain, event, detail, opaque
- * - DOMAIN_EVENT_ID_REBOOT: Libvirt::Connect, Libvirt::Domain, opaque
- * - DOMAIN_EVENT_ID_RTC_CHANGE: Libvirt::Connect, Libvirt::Domain, utc_offset, opaque
- * - DOMAIN_EVENT_ID_WATCHDOG: Libvirt::Connect, Libvirt::Domain, action, opaque
- * - DOMAIN_EVENT_ID_IO_ERROR: Libvirt::Connect, Libvirt::Domain, src_path, dev_alias, action, opaque
- * - DOMAIN_EVENT_ID_IO_ERROR_REASON: Libvirt::Connect, Libvirt::Domain, src_path, dev_alias, action, reason, opaque
- * - DOMAIN_EVENT_ID_GRAPHICS: Libvirt::Connect, Libvirt::Domain, phase, local, remote, auth_scheme, subject, opaque
-
- * If dom is a valid Libvirt::Domain object, then only events from that
- * domain will be seen.  The opaque parameter can be any valid ruby type, and
- * will be passed into callback as "opaque".  This method returns a
- * libvirt-specific handle, which must be used by the application to
- * deregister the callback later (see domain_event_deregister_any).
+ * Call virConnectListDefinedInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListDefinedInterfaces]
+ * to retrieve a list of inactive interface names on this connection.
  */
-static VALUE libvirt_connect_domain_event_register_any(int argc, VALUE *argv,
-                                                       VALUE c)
+static VALUE libvirt_connect_list_defined_interfaces(VALUE c)
 {
-    VALUE eventID, cb, dom, opaque, passthrough;
-    virDomainPtr domain;
-    virConnectDomainEventGenericCallback internalcb = NULL;
+    gen_conn_list_names(c, DefinedInterfaces);
+}
 
-    rb_scan_args(argc, argv, "22", &eventID, &cb, &dom, &opaque);
+/*
+ * call-seq:
+ *   conn.lookup_interface_by_name(name) -> Libvirt::Interface
+ *
+ * Call virInterfaceLookupByName[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceLookupByName]
+ * to retrieve an interface object by name.
+ */
+static VALUE libvirt_connect_lookup_interface_by_name(VALUE c, VALUE name)
+{
+    virInterfacePtr iface;
 
-    if (!ruby_libvirt_is_symbol_or_proc(cb)) {
-        rb_raise(rb_eTypeError,
-                 "wrong argument type (expected Symbol or Proc)");
-    }
+    iface = RUBY_LIBVIRT_CALL(virInterfaceLookupByName,
+                              ruby_libvirt_connect_get(c),
+                              StringValueCStr(name));
+    ruby_libvirt_raise_error_if(iface == NULL, e_RetrieveError,
+                                "virInterfaceLookupByName",
+                                ruby_libvirt_connect_get(c));
 
-    if (NIL_P(dom)) {
-        domain = NULL;
-    }
-    else {
-        domain = ruby_libvirt_domain_get(dom);
-    }
+    return ruby_libvirt_interface_new(iface, c);
+}
 
-    switch(NUM2INT(eventID)) {
-    case VIR_DOMAIN_EVENT_ID_LIFECYCLE:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_lifecycle_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_REBOOT:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_reboot_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_RTC_CHANGE:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_rtc_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_WATCHDOG:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_watchdog_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_IO_ERROR:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_io_error_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_IO_ERROR_REASON:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_io_error_reason_callback);
-        break;
-    case VIR_DOMAIN_EVENT_ID_GRAPHICS:
-        internalcb = VIR_DOMAIN_EVENT_CALLBACK(domain_event_graphics_callback);
-        break;
-    default:
-        rb_raise(rb_eArgError, "invalid eventID argument %d",
-                 NUM2INT(eventID));
-        break;
-    }
+/*
+ * call-seq:
+ *   conn.lookup_interface_by_mac(mac) -> Libvirt::Interface
+ *
+ * Call virInterfaceLookupByMACString[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceLookupByMACString]
+ * to retrieve an interface object by MAC address.
+ */
+static VALUE libvirt_connect_lookup_interface_by_mac(VALUE c, VALUE mac)
+{
+    virInterfacePtr iface;
 
-    passthrough = rb_ary_new();
-    rb_ary_store(passthrough, 0, cb);
-    rb_ary_store(passthrough, 1, opaque);
+    iface = RUBY_LIBVIRT_CALL(virInterfaceLookupByMACString,
+                              ruby_libvirt_connect_get(c),
+                              StringValueCStr(mac));
+    ruby_libvirt_raise_error_if(iface == NULL, e_RetrieveError,
+                                "virInterfaceLookupByMACString",
+                                ruby_libvirt_connect_get(c));
 
-    ruby_libvirt_generate_call_int(virConnectDomainEventRegisterAny,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c), domain,
-                                   NUM2INT(eventID), internalcb,
-                                   (void *)passthrough, NULL);
+    return ruby_libvirt_interface_new(iface, c);
 }
 
 /*
  * call-seq:
- *   conn.domain_event_deregister_any(callbackID) -> nil
+ *   conn.define_interface_xml(xml, flags=0) -> Libvirt::Interface
  *
- * Call virConnectDomainEventDeregisterAny[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventDeregisterAny]
- * to deregister a callback from libvirt.  The callbackID must be a
- * libvirt-specific handle returned by domain_event_register_any.
+ * Call virInterfaceDefineXML[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceDefineXML]
+ * to define a new interface from xml.
  */
-static VALUE libvirt_connect_domain_event_deregister_any(VALUE c,
-                                                         VALUE callbackID)
+static VALUE libvirt_connect_define_interface_xml(int argc, VALUE *argv,
+                                                  VALUE c)
 {
-    ruby_libvirt_generate_call_nil(virConnectDomainEventDeregisterAny,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   NUM2INT(callbackID));
+    virInterfacePtr iface;
+    VALUE xml, flags;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    iface = RUBY_LIBVIRT_CALL(virInterfaceDefineXML,
+                              ruby_libvirt_connect_get(c),
+                              StringValueCStr(xml),
+                              ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(iface == NULL, e_DefinitionError,
+                                "virInterfaceDefineXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_interface_new(iface, c);
 }
 #endif
 
-#if HAVE_VIRCONNECTDOMAINEVENTREGISTER
 /*
- * this is a bit of silliness.  Because libvirt internals track the address
- * of the function pointer, trying to use domain_event_lifecycle_callback
- * for both register and register_any would mean that we could only register
- * one or the other for lifecycle callbacks.  Instead we do a simple wrapper
- * so that the addresses are different
+ * call-seq:
+ *   conn.num_of_networks -> Fixnum
+ *
+ * Call virConnectNumOfNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectNumOfNetworks]
+ * to retrieve the number of active networks on this connection.
  */
-static int domain_event_callback(virConnectPtr conn,
-                                 virDomainPtr dom, int event,
-                                 int detail, void *opaque)
+static VALUE libvirt_connect_num_of_networks(VALUE c)
 {
-    return domain_event_lifecycle_callback(conn, dom, event, detail, opaque);
+    gen_conn_num_of(c, Networks);
 }
+
 /*
  * call-seq:
- *   conn.domain_event_register(callback, opaque=nil) -> nil
+ *   conn.list_networks -> list
  *
- * Call virConnectDomainEventRegister[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventRegister]
- * to register callback for domain lifecycle events with libvirt.  The
- * callback can either be a Symbol (that is the name of a method to callback)
- * or a Proc.  The callback must accept 5 parameters: Libvirt::Connect,
- * Libvirt::Domain, event, detail, opaque.  The opaque parameter to
- * domain_event_register can be any valid ruby type, and will be passed into
- * callback as "opaque".  This method is deprecated in favor of
- * domain_event_register_any.
+ * Call virConnectListNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListNetworks]
+ * to retrieve a list of active network names on this connection.
  */
-static VALUE libvirt_connect_domain_event_register(int argc, VALUE *argv,
-                                                   VALUE c)
+static VALUE libvirt_connect_list_networks(VALUE c)
 {
-    VALUE cb, opaque, passthrough;
-
-    rb_scan_args(argc, argv, "11", &cb, &opaque);
-
-    if (!ruby_libvirt_is_symbol_or_proc(cb)) {
-        rb_raise(rb_eTypeError,
-                 "wrong argument type (expected Symbol or Proc)");
-    }
-
-    passthrough = rb_ary_new();
-    rb_ary_store(passthrough, 0, cb);
-    rb_ary_store(passthrough, 1, opaque);
-
-    ruby_libvirt_generate_call_nil(virConnectDomainEventRegister,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   domain_event_callback, (void *)passthrough,
-                                   NULL);
+    gen_conn_list_names(c, Networks);
 }
 
 /*
  * call-seq:
- *   conn.domain_event_deregister(callback) -> nil
+ *   conn.num_of_defined_networks -> Fixnum
  *
- * Call virConnectDomainEventDeregister[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainEventDeregister]
- * to deregister the event callback from libvirt.  This method is deprecated
- * in favor of domain_event_deregister_any (though they cannot be mixed; if
- * the callback was registered with domain_event_register, it must be
- * deregistered with domain_event_deregister).
+ * Call virConnectNumOfDefinedNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectNumOfDefinedNetworks]
+ * to retrieve the number of inactive networks on this connection.
  */
-static VALUE libvirt_connect_domain_event_deregister(VALUE c)
+static VALUE libvirt_connect_num_of_defined_networks(VALUE c)
 {
-    ruby_libvirt_generate_call_nil(virConnectDomainEventDeregister,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   domain_event_callback);
+    gen_conn_num_of(c, DefinedNetworks);
 }
-#endif
 
 /*
  * call-seq:
- *   conn.num_of_domains -> Fixnum
+ *   conn.list_of_defined_networks -> list
  *
- * Call virConnectNumOfDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectNumOfDomains]
- * to retrieve the number of active domains on this connection.
+ * Call virConnectListDefinedNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListDefinedNetworks]
+ * to retrieve a list of inactive network names on this connection.
  */
-static VALUE libvirt_connect_num_of_domains(VALUE c)
+static VALUE libvirt_connect_list_defined_networks(VALUE c)
 {
-    gen_conn_num_of(c, Domains);
+    gen_conn_list_names(c, DefinedNetworks);
 }
 
 /*
  * call-seq:
- *   conn.list_domains -> list
+ *   conn.lookup_network_by_name(name) -> Libvirt::Network
  *
- * Call virConnectListDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListDomains]
- * to retrieve a list of active domain IDs on this connection.
+ * Call virNetworkLookupByName[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkLookupByName]
+ * to retrieve a network object by name.
  */
-static VALUE libvirt_connect_list_domains(VALUE c)
+static VALUE libvirt_connect_lookup_network_by_name(VALUE c, VALUE name)
 {
-    int i, r, num, *ids;
-    VALUE result;
+    virNetworkPtr netw;
 
-    num = virConnectNumOfDomains(ruby_libvirt_connect_get(c));
-    ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
-                                "virConnectNumOfDomains",
+    netw = RUBY_LIBVIRT_CALL(virNetworkLookupByName,
+                             ruby_libvirt_connect_get(c),
+                             StringValueCStr(name));
+    ruby_libvirt_raise_error_if(netw == NULL, e_RetrieveError,
+                                "virNetworkLookupByName",
                                 ruby_libvirt_connect_get(c));
 
-    result = rb_ary_new2(num);
+    return ruby_libvirt_network_new(netw, c);
+}
 
-    if (num == 0) {
-        return result;
-    }
+/*
+ * call-seq:
+ *   conn.lookup_network_by_uuid(uuid) -> Libvirt::Network
+ *
+ * Call virNetworkLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkLookupByUUIDString]
+ * to retrieve a network object by UUID.
+ */
+static VALUE libvirt_connect_lookup_network_by_uuid(VALUE c, VALUE uuid)
+{
+    virNetworkPtr netw;
 
-    ids = alloca(sizeof(int) * num);
-    r = virConnectListDomains(ruby_libvirt_connect_get(c), ids, num);
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
-                                "virConnectListDomains",
+    netw = RUBY_LIBVIRT_CALL(virNetworkLookupByUUIDString,
+                             ruby_libvirt_connect_get(c),
+                             StringValueCStr(uuid));
+    ruby_libvirt_raise_error_if(netw == NULL, e_RetrieveError,
+                                "virNetworkLookupByUUID",
                                 ruby_libvirt_connect_get(c));
 
-    for (i = 0; i < num; i++) {
-        rb_ary_store(result, i, INT2NUM(ids[i]));
-    }
-
-    return result;
+    return ruby_libvirt_network_new(netw, c);
 }
 
 /*
  * call-seq:
- *   conn.num_of_defined_domains -> Fixnum
+ *   conn.create_network_xml(xml) -> Libvirt::Network
  *
- * Call virConnectNumOfDefinedDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectNumOfDefinedDomains]
- * to retrieve the number of inactive domains on this connection.
+ * Call virNetworkCreateXML[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkCreateXML]
+ * to start a new transient network from xml.
  */
-static VALUE libvirt_connect_num_of_defined_domains(VALUE c)
+static VALUE libvirt_connect_create_network_xml(VALUE c, VALUE xml)
 {
-    gen_conn_num_of(c, DefinedDomains);
+    virNetworkPtr netw;
+
+    netw = RUBY_LIBVIRT_CALL(virNetworkCreateXML, ruby_libvirt_connect_get(c),
+                             StringValueCStr(xml));
+    ruby_libvirt_raise_error_if(netw == NULL, e_Error, "virNetworkCreateXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_network_new(netw, c);
 }
 
 /*
  * call-seq:
- *   conn.list_defined_domains -> list
+ *   conn.define_network_xml(xml) -> Libvirt::Network
  *
- * Call virConnectListDefinedDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListDefinedDomains]
- * to retrieve a list of inactive domain names on this connection.
+ * Call virNetworkDefineXML[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkDefineXML]
+ * to define a new permanent network from xml.
  */
-static VALUE libvirt_connect_list_defined_domains(VALUE c)
+static VALUE libvirt_connect_define_network_xml(VALUE c, VALUE xml)
 {
-    gen_conn_list_names(c, DefinedDomains);
+    virNetworkPtr netw;
+
+    netw = RUBY_LIBVIRT_CALL(virNetworkDefineXML, ruby_libvirt_connect_get(c),
+                             StringValueCStr(xml));
+    ruby_libvirt_raise_error_if(netw == NULL, e_DefinitionError,
+                                "virNetworkDefineXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_network_new(netw, c);
 }
 
+#if HAVE_TYPE_VIRNODEDEVICEPTR
+
 /*
  * call-seq:
- *   conn.create_domain_linux(xml, flags=0) -> Libvirt::Domain
+ *   conn.num_of_nodedevices(cap=nil, flags=0) -> Fixnum
  *
- * Call virDomainCreateLinux[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainCreateLinux]
- * to start a transient domain from the given XML.  Deprecated; use
- * conn.create_domain_xml instead.
+ * Call virNodeNumOfDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeNumOfDevices]
+ * to retrieve the number of node devices on this connection.
  */
-static VALUE libvirt_connect_create_linux(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_num_of_nodedevices(int argc, VALUE *argv, VALUE c)
 {
-    virDomainPtr dom;
-    VALUE flags, xml;
+    int result;
+    VALUE cap, flags;
 
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    rb_scan_args(argc, argv, "02", &cap, &flags);
 
-    dom = virDomainCreateLinux(ruby_libvirt_connect_get(c),
-                               StringValueCStr(xml),
+    result = RUBY_LIBVIRT_CALL(virNodeNumOfDevices,
+                               ruby_libvirt_connect_get(c),
+                               ruby_libvirt_get_cstring_or_null(cap),
                                ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(dom == NULL, e_Error, "virDomainCreateLinux",
+    ruby_libvirt_raise_error_if(result < 0, e_RetrieveError,
+                                "virNodeNumOfDevices",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_domain_new(dom, c);
+    return INT2NUM(result);
 }
 
-#if HAVE_VIRDOMAINCREATEXML
 /*
  * call-seq:
- *   conn.create_domain_xml(xml, flags=0) -> Libvirt::Domain
+ *   conn.list_nodedevices(cap=nil, flags=0) -> list
  *
- * Call virDomainCreateXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainCreateXML]
- * to start a transient domain from the given XML.
+ * Call virNodeListDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeListDevices]
+ * to retrieve a list of node device names on this connection.
  */
-static VALUE libvirt_connect_create_domain_xml(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_list_nodedevices(int argc, VALUE *argv, VALUE c)
 {
-    virDomainPtr dom;
-    VALUE flags, xml;
+    int r, num;
+    VALUE cap, flags;
+    char *capstr;
+    char **names;
 
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    rb_scan_args(argc, argv, "02", &cap, &flags);
 
-    dom = virDomainCreateXML(ruby_libvirt_connect_get(c), StringValueCStr(xml),
-                             ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(dom == NULL, e_Error, "virDomainCreateXML",
+    if (TYPE(flags) != T_NIL && TYPE(flags) != T_FIXNUM) {
+        rb_raise(rb_eTypeError,
+                 "wrong argument type (expected Number)");
+    }
+
+    capstr = ruby_libvirt_get_cstring_or_null(cap);
+
+    num = RUBY_LIBVIRT_CALL(virNodeNumOfDevices, ruby_libvirt_connect_get(c),
+                            capstr, 0);
+    ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
+                                "virNodeNumOfDevices",
                                 ruby_libvirt_connect_get(c));
+    if (num == 0) {
+        /* if num is 0, don't call virNodeListDevices function */
+        return rb_ary_new2(num);
+    }
 
-    return ruby_libvirt_domain_new(dom, c);
+    names = alloca(sizeof(char *) * num);
+    r = RUBY_LIBVIRT_CALL(virNodeListDevices, ruby_libvirt_connect_get(c),
+                          capstr, names, num,
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeListDevices",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_generate_list(r, names);
 }
-#endif
 
 /*
  * call-seq:
- *   conn.lookup_domain_by_name(name) -> Libvirt::Domain
+ *   conn.lookup_nodedevice_by_name(name) -> Libvirt::NodeDevice
  *
- * Call virDomainLookupByName[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByName]
- * to retrieve a domain object for name.
+ * Call virNodeDeviceLookupByName[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceLookupByName]
+ * to retrieve a nodedevice object by name.
  */
-static VALUE libvirt_connect_lookup_domain_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_lookup_nodedevice_by_name(VALUE c, VALUE name)
 {
-    virDomainPtr dom;
+    virNodeDevicePtr nodedev;
 
-    dom = virDomainLookupByName(ruby_libvirt_connect_get(c),
+    nodedev = RUBY_LIBVIRT_CALL(virNodeDeviceLookupByName,
+                                ruby_libvirt_connect_get(c),
                                 StringValueCStr(name));
-    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
-                                "virDomainLookupByName",
+    ruby_libvirt_raise_error_if(nodedev == NULL, e_RetrieveError,
+                                "virNodeDeviceLookupByName",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_domain_new(dom, c);
+    return ruby_libvirt_nodedevice_new(nodedev, c);
+
 }
 
 /*
  * call-seq:
- *   conn.lookup_domain_by_id(id) -> Libvirt::Domain
+ *   conn.detach_node_devices(devices, driver=nil, concurrency=0, flags=0) -> Array
  *
- * Call virDomainLookupByID[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByID]
- * to retrieve a domain object for id.
+ * Detach each of devices, given as Libvirt::NodeDevice objects or node device
+ * names, from the host so that they can be assigned to guests.  Names are
+ * looked up with virNodeDeviceLookupByName[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceLookupByName]
+ * and the devices detached with virNodeDeviceDetachFlags[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceDetachFlags]
+ * on up to concurrency native threads at once (a default if 0), without
+ * holding the GVL.  Returns an Array with a Hash for each device, in order,
+ * holding the device "name", the Libvirt::Error that occurred for it (or nil)
+ * under "error" and the seconds the device took under "time".
  */
-static VALUE libvirt_connect_lookup_domain_by_id(VALUE c, VALUE id)
+static VALUE libvirt_connect_detach_node_devices(int argc, VALUE *argv,
+                                                 VALUE c)
 {
-    virDomainPtr dom;
+    VALUE devices, driver = RUBY_Qnil, concurrency = RUBY_Qnil;
+    VALUE flags = RUBY_Qnil;
 
-    dom = virDomainLookupByID(ruby_libvirt_connect_get(c), NUM2INT(id));
-    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
-                                "virDomainLookupByID",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "13", &devices, &driver, &concurrency, &flags);
 
-    return ruby_libvirt_domain_new(dom, c);
+    return ruby_libvirt_nodedevice_bulk(c, devices, 0, driver,
+                                        ruby_libvirt_value_to_uint(flags),
+                                        ruby_libvirt_value_to_int(concurrency));
 }
 
 /*
  * call-seq:
- *   conn.lookup_domain_by_uuid(uuid) -> Libvirt::Domain
+ *   conn.reattach_node_devices(devices, concurrency=0) -> Array
  *
- * Call virDomainLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainLookupByUUIDString]
- * to retrieve a domain object for uuid.
+ * Reattach each of devices, given as Libvirt::NodeDevice objects or node
+ * device names, to the host with virNodeDeviceReAttach[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceReAttach].
+ * This works like conn.detach_node_devices and returns the same kind of
+ * results.
  */
-static VALUE libvirt_connect_lookup_domain_by_uuid(VALUE c, VALUE uuid)
+static VALUE libvirt_connect_reattach_node_devices(int argc, VALUE *argv,
+                                                   VALUE c)
 {
-    virDomainPtr dom;
+    VALUE devices, concurrency = RUBY_Qnil;
 
-    dom = virDomainLookupByUUIDString(ruby_libvirt_connect_get(c),
-                                      StringValueCStr(uuid));
-    ruby_libvirt_raise_error_if(dom == NULL, e_RetrieveError,
-                                "virDomainLookupByUUID",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "11", &devices, &concurrency);
 
-    return ruby_libvirt_domain_new(dom, c);
+    return ruby_libvirt_nodedevice_bulk(c, devices, 1, RUBY_Qnil, 0,
+                                        ruby_libvirt_value_to_int(concurrency));
 }
 
+#if HAVE_VIRNODEDEVICECREATEXML
 /*
  * call-seq:
- *   conn.define_domain_xml(xml, flags=0) -> Libvirt::Domain
+ *   conn.create_nodedevice_xml(xml, flags=0) -> Libvirt::NodeDevice
  *
- * Call virDomainDefineXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainDefineXML]
- * to define a permanent domain on this connection.
+ * Call virNodeDeviceCreateXML[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceCreateXML]
+ * to create a new node device from xml.
  */
-static VALUE libvirt_connect_define_domain_xml(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_create_nodedevice_xml(int argc, VALUE *argv,
+                                                   VALUE c)
 {
-    virDomainPtr dom;
-    VALUE xml;
-    VALUE flags;
+    virNodeDevicePtr nodedev;
+    VALUE xml, flags;
 
     rb_scan_args(argc, argv, "11", &xml, &flags);
 
-#if HAVE_VIRDOMAINDEFINEXMLFLAGS
-    dom = virDomainDefineXMLFlags(ruby_libvirt_connect_get(c),
-                                  StringValueCStr(xml),
-                                  ruby_libvirt_value_to_uint(flags));
-#else
-    if (ruby_libvirt_value_to_uint(flags) != 0) {
-        rb_raise(e_NoSupportError, "Non-zero flags not supported");
-    }
-    dom = virDomainDefineXML(ruby_libvirt_connect_get(c), StringValueCStr(xml));
+    nodedev = RUBY_LIBVIRT_CALL(virNodeDeviceCreateXML,
+                                ruby_libvirt_connect_get(c),
+                                StringValueCStr(xml),
+                                ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(nodedev == NULL, e_Error,
+                                "virNodeDeviceCreateXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_nodedevice_new(nodedev, c);
+}
+#endif
 #endif
 
-    ruby_libvirt_raise_error_if(dom == NULL, e_DefinitionError,
-                                "virDomainDefineXML",
-                                ruby_libvirt_connect_get(c));
+#if HAVE_TYPE_VIRNWFILTERPTR
 
-    return ruby_libvirt_domain_new(dom, c);
+/*
+ * call-seq:
+ *   conn.num_of_nwfilters -> Fixnum
+ *
+ * Call virConnectNumOfNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectNumOfNWFilters]
+ * to retrieve the number of network filters on this connection.
+ */
+static VALUE libvirt_connect_num_of_nwfilters(VALUE c)
+{
+    gen_conn_num_of(c, NWFilters);
 }
 
-#if HAVE_VIRCONNECTDOMAINXMLFROMNATIVE
 /*
  * call-seq:
- *   conn.domain_xml_from_native(nativeFormat, xml, flags=0) -> String
+ *   conn.list_nwfilters -> list
  *
- * Call virConnectDomainXMLFromNative[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainXMLFromNative]
- * to convert a native hypervisor domain representation to libvirt XML.
+ * Call virConnectListNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectListNWFilters]
+ * to retrieve a list of network filter names on this connection.
  */
-static VALUE libvirt_connect_domain_xml_from_native(int argc, VALUE *argv,
-                                                    VALUE c)
+static VALUE libvirt_connect_list_nwfilters(VALUE c)
 {
-    VALUE nativeFormat, xml, flags;
+    gen_conn_list_names(c, NWFilters);
+}
 
-    rb_scan_args(argc, argv, "21", &nativeFormat, &xml, &flags);
+/*
+ * call-seq:
+ *   conn.lookup_nwfilter_by_name(name) -> Libvirt::NWFilter
+ *
+ * Call virNWFilterLookupByName[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterLookupByName]
+ * to retrieve a network filter object by name.
+ */
+static VALUE libvirt_connect_lookup_nwfilter_by_name(VALUE c, VALUE name)
+{
+    virNWFilterPtr nwfilter;
 
-    ruby_libvirt_generate_call_string(virConnectDomainXMLFromNative,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c),
-                                      StringValueCStr(nativeFormat),
-                                      StringValueCStr(xml),
-                                      ruby_libvirt_value_to_uint(flags));
+    nwfilter = RUBY_LIBVIRT_CALL(virNWFilterLookupByName,
+                                 ruby_libvirt_connect_get(c),
+                                 StringValueCStr(name));
+    ruby_libvirt_raise_error_if(nwfilter == NULL, e_RetrieveError,
+                                "virNWFilterLookupByName",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_nwfilter_new(nwfilter, c);
 }
-#endif
 
-#if HAVE_VIRCONNECTDOMAINXMLTONATIVE
 /*
  * call-seq:
- *   conn.domain_xml_to_native(nativeFormat, xml, flags=0) -> String
+ *   conn.lookup_nwfilter_by_uuid(uuid) -> Libvirt::NWFilter
  *
- * Call virConnectDomainXMLToNative[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectDomainXMLToNative]
- * to convert libvirt XML to a native domain hypervisor representation.
+ * Call virNWFilterLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterLookupByUUIDString]
+ * to retrieve a network filter object by UUID.
  */
-static VALUE libvirt_connect_domain_xml_to_native(int argc, VALUE *argv,
-                                                  VALUE c)
+static VALUE libvirt_connect_lookup_nwfilter_by_uuid(VALUE c, VALUE uuid)
 {
-    VALUE nativeFormat, xml, flags;
+    virNWFilterPtr nwfilter;
 
-    rb_scan_args(argc, argv, "21", &nativeFormat, &xml, &flags);
+    nwfilter = RUBY_LIBVIRT_CALL(virNWFilterLookupByUUIDString,
+                                 ruby_libvirt_connect_get(c),
+                                 StringValueCStr(uuid));
+    ruby_libvirt_raise_error_if(nwfilter == NULL, e_RetrieveError,
+                                "virNWFilterLookupByUUIDString",
+                                ruby_libvirt_connect_get(c));
 
-    ruby_libvirt_generate_call_string(virConnectDomainXMLToNative,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c),
-                                      StringValueCStr(nativeFormat),
-                                      StringValueCStr(xml),
-                                      ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_nwfilter_new(nwfilter, c);
 }
-#endif
 
-#if HAVE_TYPE_VIRINTERFACEPTR
 /*
  * call-seq:
- *   conn.num_of_interfaces -> Fixnum
+ *   conn.define_nwfilter_xml(xml) -> Libvirt::NWFilter
  *
- * Call virConnectNumOfInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectNumOfInterfaces]
- * to retrieve the number of active interfaces on this connection.
+ * Call virNWFilterDefineXML[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterDefineXML]
+ * to define a new network filter from xml.
  */
-static VALUE libvirt_connect_num_of_interfaces(VALUE c)
+static VALUE libvirt_connect_define_nwfilter_xml(VALUE c, VALUE xml)
 {
-    gen_conn_num_of(c, Interfaces);
+    virNWFilterPtr nwfilter;
+
+    nwfilter = RUBY_LIBVIRT_CALL(virNWFilterDefineXML,
+                                 ruby_libvirt_connect_get(c),
+                                 StringValueCStr(xml));
+    ruby_libvirt_raise_error_if(nwfilter == NULL, e_DefinitionError,
+                                "virNWFilterDefineXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_nwfilter_new(nwfilter, c);
 }
+#endif
+
+#if HAVE_TYPE_VIRSECRETPTR
 
 /*
  * call-seq:
- *   conn.list_interfaces -> list
+ *   conn.num_of_secrets -> Fixnum
  *
- * Call virConnectListInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListInterfaces]
- * to retrieve a list of active interface names on this connection.
+ * Call virConnectNumOfSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectNumOfSecrets]
+ * to retrieve the number of secrets on this connection.
  */
-static VALUE libvirt_connect_list_interfaces(VALUE c)
+static VALUE libvirt_connect_num_of_secrets(VALUE c)
 {
-    gen_conn_list_names(c, Interfaces);
+    gen_conn_num_of(c, Secrets);
 }
 
 /*
  * call-seq:
- *   conn.num_of_defined_interfaces -> Fixnum
+ *   conn.list_secrets -> list
  *
- * Call virConnectNumOfDefinedInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectNumOfDefinedInterfaces]
- * to retrieve the number of inactive interfaces on this connection.
+ * Call virConnectListSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectListSecrets]
+ * to retrieve a list of secret UUIDs on this connection.
  */
-static VALUE libvirt_connect_num_of_defined_interfaces(VALUE c)
+static VALUE libvirt_connect_list_secrets(VALUE c)
 {
-    gen_conn_num_of(c, DefinedInterfaces);
+    gen_conn_list_names(c, Secrets);
 }
 
 /*
  * call-seq:
- *   conn.list_defined_interfaces -> list
+ *   conn.lookup_secret_by_uuid(uuid) -> Libvirt::Secret
  *
- * Call virConnectListDefinedInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListDefinedInterfaces]
- * to retrieve a list of inactive interface names on this connection.
+ * Call virSecretLookupByUUID[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUUID]
+ * to retrieve a network object from uuid.
  */
-static VALUE libvirt_connect_list_defined_interfaces(VALUE c)
+static VALUE libvirt_connect_lookup_secret_by_uuid(VALUE c, VALUE uuid)
 {
-    gen_conn_list_names(c, DefinedInterfaces);
+    virSecretPtr secret;
+
+    secret = RUBY_LIBVIRT_CALL(virSecretLookupByUUIDString,
+                               ruby_libvirt_connect_get(c),
+                               StringValueCStr(uuid));
+    ruby_libvirt_raise_error_if(secret == NULL, e_RetrieveError,
+                                "virSecretLookupByUUID",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_secret_new(secret, c);
 }
 
 /*
  * call-seq:
- *   conn.lookup_interface_by_name(name) -> Libvirt::Interface
+ *   conn.lookup_secret_by_usage(usagetype, usageID) -> Libvirt::Secret
  *
- * Call virInterfaceLookupByName[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceLookupByName]
- * to retrieve an interface object by name.
+ * Call virSecretLookupByUsage[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUsage]
+ * to retrieve a secret by usagetype.
  */
-static VALUE libvirt_connect_lookup_interface_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_lookup_secret_by_usage(VALUE c, VALUE usagetype,
+                                                    VALUE usageID)
 {
-    virInterfacePtr iface;
+    virSecretPtr secret;
 
-    iface = virInterfaceLookupByName(ruby_libvirt_connect_get(c),
-                                     StringValueCStr(name));
-    ruby_libvirt_raise_error_if(iface == NULL, e_RetrieveError,
-                                "virInterfaceLookupByName",
+    secret = RUBY_LIBVIRT_CALL(virSecretLookupByUsage,
+                               ruby_libvirt_connect_get(c),
+                               NUM2UINT(usagetype), StringValueCStr(usageID));
+    ruby_libvirt_raise_error_if(secret == NULL, e_RetrieveError,
+                                "virSecretLookupByUsage",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_interface_new(iface, c);
+    return ruby_libvirt_secret_new(secret, c);
 }
 
 /*
  * call-seq:
- *   conn.lookup_interface_by_mac(mac) -> Libvirt::Interface
+ *   conn.secret_values(keys, concurrency=0) -> Array
  *
- * Call virInterfaceLookupByMACString[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceLookupByMACString]
- * to retrieve an interface object by MAC address.
+ * Fetch the values of many secrets at once.  Each entry of keys is either a
+ * UUID String or a [usagetype, usageID] pair; the secrets are looked up with
+ * virSecretLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUUIDString]
+ * or virSecretLookupByUsage[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUsage]
+ * and read with virSecretGetValue[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretGetValue]
+ * on up to concurrency native threads at once (a default if 0).
+ *
+ * Returns an Array with a Hash per key, containing the "key", the secret's
+ * "uuid", the "value" as a Libvirt::Secret::Value (or nil) and the
+ * Libvirt::RetrieveError if it could not be fetched (or nil).  The values
+ * are held in locked native memory that is zeroed when they are cleared or
+ * garbage collected, and are not copied into Ruby Strings unless asked to.
  */
-static VALUE libvirt_connect_lookup_interface_by_mac(VALUE c, VALUE mac)
+static VALUE libvirt_connect_secret_values(int argc, VALUE *argv, VALUE c)
 {
-    virInterfacePtr iface;
+    VALUE keys = RUBY_Qnil, concurrency = RUBY_Qnil;
 
-    iface = virInterfaceLookupByMACString(ruby_libvirt_connect_get(c),
-                                          StringValueCStr(mac));
-    ruby_libvirt_raise_error_if(iface == NULL, e_RetrieveError,
-                                "virInterfaceLookupByMACString",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "11", &keys, &concurrency);
 
-    return ruby_libvirt_interface_new(iface, c);
+    return ruby_libvirt_secret_values(c, keys,
+                                      ruby_libvirt_value_to_int(concurrency));
 }
 
 /*
  * call-seq:
- *   conn.define_interface_xml(xml, flags=0) -> Libvirt::Interface
+ *   conn.define_secret_xml(xml, flags=0) -> Libvirt::Secret
  *
- * Call virInterfaceDefineXML[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceDefineXML]
- * to define a new interface from xml.
+ * Call virSecretDefineXML[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretDefineXML]
+ * to define a new secret from xml.
  */
-static VALUE libvirt_connect_define_interface_xml(int argc, VALUE *argv,
-                                                  VALUE c)
+static VALUE libvirt_connect_define_secret_xml(int argc, VALUE *argv, VALUE c)
 {
-    virInterfacePtr iface;
+    virSecretPtr secret;
     VALUE xml, flags;
 
     rb_scan_args(argc, argv, "11", &xml, &flags);
 
-    iface = virInterfaceDefineXML(ruby_libvirt_connect_get(c),
-                                  StringValueCStr(xml),
-                                  ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(iface == NULL, e_DefinitionError,
-                                "virInterfaceDefineXML",
+    secret = RUBY_LIBVIRT_CALL(virSecretDefineXML, ruby_libvirt_connect_get(c),
+                               StringValueCStr(xml),
+                               ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(secret == NULL, e_DefinitionError,
+                                "virSecretDefineXML",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_interface_new(iface, c);
+    return ruby_libvirt_secret_new(secret, c);
 }
 #endif
 
-/*
- * call-seq:
- *   conn.num_of_networks -> Fixnum
- *
- * Call virConnectNumOfNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectNumOfNetworks]
- * to retrieve the number of active networks on this connection.
- */
-static VALUE libvirt_connect_num_of_networks(VALUE c)
-{
-    gen_conn_num_of(c, Networks);
-}
+#if HAVE_TYPE_VIRSTORAGEPOOLPTR
+
+VALUE pool_new(virStoragePoolPtr n, VALUE conn);
 
 /*
  * call-seq:
- *   conn.list_networks -> list
+ *   conn.list_storage_pools -> list
  *
- * Call virConnectListNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListNetworks]
- * to retrieve a list of active network names on this connection.
+ * Call virConnectListStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListStoragePools]
+ * to retrieve a list of active storage pool names on this connection.
  */
-static VALUE libvirt_connect_list_networks(VALUE c)
+static VALUE libvirt_connect_list_storage_pools(VALUE c)
 {
-    gen_conn_list_names(c, Networks);
+    gen_conn_list_names(c, StoragePools);
 }
 
 /*
  * call-seq:
- *   conn.num_of_defined_networks -> Fixnum
+ *   conn.num_of_storage_pools -> Fixnum
  *
- * Call virConnectNumOfDefinedNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectNumOfDefinedNetworks]
- * to retrieve the number of inactive networks on this connection.
+ * Call virConnectNumOfStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectNumOfStoragePools]
+ * to retrieve the number of active storage pools on this connection.
  */
-static VALUE libvirt_connect_num_of_defined_networks(VALUE c)
+static VALUE libvirt_connect_num_of_storage_pools(VALUE c)
 {
-    gen_conn_num_of(c, DefinedNetworks);
+    gen_conn_num_of(c, StoragePools);
 }
 
 /*
  * call-seq:
- *   conn.list_of_defined_networks -> list
+ *   conn.list_defined_storage_pools -> list
  *
- * Call virConnectListDefinedNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListDefinedNetworks]
- * to retrieve a list of inactive network names on this connection.
+ * Call virConnectListDefinedStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListDefinedStoragePools]
+ * to retrieve a list of inactive storage pool names on this connection.
  */
-static VALUE libvirt_connect_list_defined_networks(VALUE c)
+static VALUE libvirt_connect_list_defined_storage_pools(VALUE c)
 {
-    gen_conn_list_names(c, DefinedNetworks);
+    gen_conn_list_names(c, DefinedStoragePools);
 }
 
 /*
  * call-seq:
- *   conn.lookup_network_by_name(name) -> Libvirt::Network
+ *   conn.num_of_defined_storage_pools -> Fixnum
  *
- * Call virNetworkLookupByName[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkLookupByName]
- * to retrieve a network object by name.
+ * Call virConnectNumOfDefinedStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectNumOfDefinedStoragePools]
+ * to retrieve the number of inactive storage pools on this connection.
  */
-static VALUE libvirt_connect_lookup_network_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_num_of_defined_storage_pools(VALUE c)
 {
-    virNetworkPtr netw;
-
-    netw = virNetworkLookupByName(ruby_libvirt_connect_get(c),
-                                  StringValueCStr(name));
-    ruby_libvirt_raise_error_if(netw == NULL, e_RetrieveError,
-                                "virNetworkLookupByName",
-                                ruby_libvirt_connect_get(c));
-
-    return ruby_libvirt_network_new(netw, c);
+    gen_conn_num_of(c, DefinedStoragePools);
 }
 
 /*
  * call-seq:
- *   conn.lookup_network_by_uuid(uuid) -> Libvirt::Network
+ *   conn.lookup_storage_pool_by_name(name) -> Libvirt::StoragePool
  *
- * Call virNetworkLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkLookupByUUIDString]
- * to retrieve a network object by UUID.
+ * Call virStoragePoolLookupByName[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolLookupByName]
+ * to retrieve a storage pool object by name.
  */
-static VALUE libvirt_connect_lookup_network_by_uuid(VALUE c, VALUE uuid)
+static VALUE libvirt_connect_lookup_pool_by_name(VALUE c, VALUE name)
 {
-    virNetworkPtr netw;
+    virStoragePoolPtr pool;
 
-    netw = virNetworkLookupByUUIDString(ruby_libvirt_connect_get(c),
-                                        StringValueCStr(uuid));
-    ruby_libvirt_raise_error_if(netw == NULL, e_RetrieveError,
-                                "virNetworkLookupByUUID",
+    pool = RUBY_LIBVIRT_CALL(virStoragePoolLookupByName,
+                             ruby_libvirt_connect_get(c),
+                             StringValueCStr(name));
+    ruby_libvirt_raise_error_if(pool == NULL, e_RetrieveError,
+                                "virStoragePoolLookupByName",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_network_new(netw, c);
+    return pool_new(pool, c);
 }
 
 /*
  * call-seq:
- *   conn.create_network_xml(xml) -> Libvirt::Network
+ *   conn.lookup_storage_pool_by_uuid(uuid) -> Libvirt::StoragePool
  *
- * Call virNetworkCreateXML[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkCreateXML]
- * to start a new transient network from xml.
+ * Call virStoragePoolLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolLookupByUUIDString]
+ * to retrieve a storage pool object by uuid.
  */
-static VALUE libvirt_connect_create_network_xml(VALUE c, VALUE xml)
+static VALUE libvirt_connect_lookup_pool_by_uuid(VALUE c, VALUE uuid)
 {
-    virNetworkPtr netw;
+    virStoragePoolPtr pool;
 
-    netw = virNetworkCreateXML(ruby_libvirt_connect_get(c),
-                               StringValueCStr(xml));
-    ruby_libvirt_raise_error_if(netw == NULL, e_Error, "virNetworkCreateXML",
+    pool = RUBY_LIBVIRT_CALL(virStoragePoolLookupByUUIDString,
+                             ruby_libvirt_connect_get(c),
+                             StringValueCStr(uuid));
+    ruby_libvirt_raise_error_if(pool == NULL, e_RetrieveError,
+                                "virStoragePoolLookupByUUID",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_network_new(netw, c);
+    return pool_new(pool, c);
 }
 
 /*
  * call-seq:
- *   conn.define_network_xml(xml) -> Libvirt::Network
+ *   conn.create_storage_pool_xml(xml, flags=0) -> Libvirt::StoragePool
  *
- * Call virNetworkDefineXML[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkDefineXML]
- * to define a new permanent network from xml.
+ * Call virStoragePoolCreateXML[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolCreateXML]
+ * to start a new transient storage pool from xml.
  */
-static VALUE libvirt_connect_define_network_xml(VALUE c, VALUE xml)
+static VALUE libvirt_connect_create_pool_xml(int argc, VALUE *argv, VALUE c)
 {
-    virNetworkPtr netw;
+    virStoragePoolPtr pool;
+    VALUE xml, flags;
 
-    netw = virNetworkDefineXML(ruby_libvirt_connect_get(c),
-                               StringValueCStr(xml));
-    ruby_libvirt_raise_error_if(netw == NULL, e_DefinitionError,
-                                "virNetworkDefineXML",
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    pool = RUBY_LIBVIRT_CALL(virStoragePoolCreateXML,
+                             ruby_libvirt_connect_get(c), StringValueCStr(xml),
+                             ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(pool == NULL, e_Error,
+                                "virStoragePoolCreateXML",
                                 ruby_libvirt_connect_get(c));
 
-    return ruby_libvirt_network_new(netw, c);
+    return pool_new(pool, c);
 }
 
-#if HAVE_TYPE_VIRNODEDEVICEPTR
-
 /*
  * call-seq:
- *   conn.num_of_nodedevices(cap=nil, flags=0) -> Fixnum
+ *   conn.define_storage_pool_xml(xml, flags=0) -> Libvirt::StoragePool
  *
- * Call virNodeNumOfDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeNumOfDevices]
- * to retrieve the number of node devices on this connection.
+ * Call virStoragePoolDefineXML[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolDefineXML]
+ * to define a permanent storage pool from xml.
  */
-static VALUE libvirt_connect_num_of_nodedevices(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_define_pool_xml(int argc, VALUE *argv, VALUE c)
 {
-    int result;
-    VALUE cap, flags;
+    virStoragePoolPtr pool;
+    VALUE xml, flags;
 
-    rb_scan_args(argc, argv, "02", &cap, &flags);
+    rb_scan_args(argc, argv, "11", &xml, &flags);
 
-    result = virNodeNumOfDevices(ruby_libvirt_connect_get(c),
-                                 ruby_libvirt_get_cstring_or_null(cap),
-                                 ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(result < 0, e_RetrieveError,
-                                "virNodeNumOfDevices",
+    pool = RUBY_LIBVIRT_CALL(virStoragePoolDefineXML,
+                             ruby_libvirt_connect_get(c), StringValueCStr(xml),
+                             ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(pool == NULL, e_DefinitionError,
+                                "virStoragePoolDefineXML",
                                 ruby_libvirt_connect_get(c));
 
-    return INT2NUM(result);
+    return pool_new(pool, c);
 }
 
 /*
  * call-seq:
- *   conn.list_nodedevices(cap=nil, flags=0) -> list
+ *   conn.discover_storage_pool_sources(type, srcSpec=nil, flags=0) -> String
  *
- * Call virNodeListDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeListDevices]
- * to retrieve a list of node device names on this connection.
+ * Call virConnectFindStoragePoolSources[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectFindStoragePoolSources]
+ * to find the storage pool sources corresponding to type.
  */
-static VALUE libvirt_connect_list_nodedevices(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_find_storage_pool_sources(int argc, VALUE *argv,
+                                                       VALUE c)
 {
-    int r, num;
-    VALUE cap, flags;
-    char *capstr;
-    char **names;
-
-    rb_scan_args(argc, argv, "02", &cap, &flags);
-
-    if (TYPE(flags) != T_NIL && TYPE(flags) != T_FIXNUM) {
-        rb_raise(rb_eTypeError,
-                 "wrong argument type (expected Number)");
-    }
-
-    capstr = ruby_libvirt_get_cstring_or_null(cap);
-
-    num = virNodeNumOfDevices(ruby_libvirt_connect_get(c), capstr, 0);
-    ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
-                                "virNodeNumOfDevices",
-                                ruby_libvirt_connect_get(c));
-    if (num == 0) {
-        /* if num is 0, don't call virNodeListDevices function */
-        return rb_ary_new2(num);
-    }
-
-    names = alloca(sizeof(char *) * num);
-    r = virNodeListDevices(ruby_libvirt_connect_get(c), capstr, names, num,
-                           ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNodeListDevices",
-                                ruby_libvirt_connect_get(c));
+    VALUE type, srcSpec, flags;
 
-    return ruby_libvirt_generate_list(r, names);
+    rb_scan_args(argc, argv, "12", &type, &srcSpec, &flags);
+
+    ruby_libvirt_generate_call_string(virConnectFindStoragePoolSources,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c),
+                                      StringValueCStr(type),
+                                      ruby_libvirt_get_cstring_or_null(srcSpec),
+                                      ruby_libvirt_value_to_uint(flags));
 }
+#endif
 
+#if HAVE_VIRCONNECTGETSYSINFO
 /*
  * call-seq:
- *   conn.lookup_nodedevice_by_name(name) -> Libvirt::NodeDevice
+ *   conn.sys_info(flags=0) -> String
  *
- * Call virNodeDeviceLookupByName[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceLookupByName]
- * to retrieve a nodedevice object by name.
+ * Call virConnectGetSysinfo[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetSysinfo]
+ * to get machine-specific information about the hypervisor.  This may include
+ * data such as the host UUID, the BIOS version, etc.
  */
-static VALUE libvirt_connect_lookup_nodedevice_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_sys_info(int argc, VALUE *argv, VALUE c)
 {
-    virNodeDevicePtr nodedev;
-
-    nodedev = virNodeDeviceLookupByName(ruby_libvirt_connect_get(c),
-                                        StringValueCStr(name));
-    ruby_libvirt_raise_error_if(nodedev == NULL, e_RetrieveError,
-                                "virNodeDeviceLookupByName",
-                                ruby_libvirt_connect_get(c));
+    VALUE flags;
 
-    return ruby_libvirt_nodedevice_new(nodedev, c);
+    rb_scan_args(argc, argv, "01", &flags);
 
+    ruby_libvirt_generate_call_string(virConnectGetSysinfo,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c),
+                                      ruby_libvirt_value_to_uint(flags));
 }
+#endif
+
+#if HAVE_TYPE_VIRSTREAMPTR
 
-#if HAVE_VIRNODEDEVICECREATEXML
 /*
  * call-seq:
- *   conn.create_nodedevice_xml(xml, flags=0) -> Libvirt::NodeDevice
+ *   conn.stream(flags=0) -> Libvirt::Stream
  *
- * Call virNodeDeviceCreateXML[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceCreateXML]
- * to create a new node device from xml.
+ * Call virStreamNew[http://www.libvirt.org/html/libvirt-libvirt-stream.html#virStreamNew]
+ * to create a new stream.
  */
-static VALUE libvirt_connect_create_nodedevice_xml(int argc, VALUE *argv,
-                                                   VALUE c)
+static VALUE libvirt_connect_stream(int argc, VALUE *argv, VALUE c)
 {
-    virNodeDevicePtr nodedev;
-    VALUE xml, flags;
+    VALUE flags;
+    virStreamPtr stream;
 
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    rb_scan_args(argc, argv, "01", &flags);
 
-    nodedev = virNodeDeviceCreateXML(ruby_libvirt_connect_get(c),
-                                     StringValueCStr(xml),
-                                     ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(nodedev == NULL, e_Error,
-                                "virNodeDeviceCreateXML",
-                                ruby_libvirt_connect_get(c));
+    stream = virStreamNew(ruby_libvirt_connect_get(c),
+                          ruby_libvirt_value_to_uint(flags));
 
-    return ruby_libvirt_nodedevice_new(nodedev, c);
+    ruby_libvirt_raise_error_if(stream == NULL, e_RetrieveError,
+                                "virStreamNew", ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_stream_new(stream, c);
 }
 #endif
-#endif
-
-#if HAVE_TYPE_VIRNWFILTERPTR
 
+#if HAVE_VIRINTERFACECHANGEBEGIN
 /*
  * call-seq:
- *   conn.num_of_nwfilters -> Fixnum
+ *   conn.interface_change_begin(flags=0) -> nil
  *
- * Call virConnectNumOfNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectNumOfNWFilters]
- * to retrieve the number of network filters on this connection.
+ * Call virInterfaceChangeBegin[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeBegin]
+ * to create a restore point for interface changes.  Once changes have been
+ * made, conn.interface_change_commit can be used to commit the result or
+ * conn.interface_change_rollback can be used to rollback to this restore point.
  */
-static VALUE libvirt_connect_num_of_nwfilters(VALUE c)
+static VALUE libvirt_connect_interface_change_begin(int argc, VALUE *argv,
+                                                    VALUE c)
 {
-    gen_conn_num_of(c, NWFilters);
+    VALUE flags;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    ruby_libvirt_generate_call_nil(virInterfaceChangeBegin,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_value_to_uint(flags));
 }
 
 /*
  * call-seq:
- *   conn.list_nwfilters -> list
+ *   conn.interface_change_commit(flags=0) -> nil
  *
- * Call virConnectListNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectListNWFilters]
- * to retrieve a list of network filter names on this connection.
+ * Call virInterfaceChangeCommit[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeCommit]
+ * to commit the interface changes since the last conn.interface_change_begin.
  */
-static VALUE libvirt_connect_list_nwfilters(VALUE c)
+static VALUE libvirt_connect_interface_change_commit(int argc, VALUE *argv,
+                                                     VALUE c)
 {
-    gen_conn_list_names(c, NWFilters);
+    VALUE flags;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    ruby_libvirt_generate_call_nil(virInterfaceChangeCommit,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_value_to_uint(flags));
 }
 
 /*
  * call-seq:
- *   conn.lookup_nwfilter_by_name(name) -> Libvirt::NWFilter
+ *   conn.interface_change_rollback(flags=0) -> nil
  *
- * Call virNWFilterLookupByName[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterLookupByName]
- * to retrieve a network filter object by name.
+ * Call virInterfaceChangeRollback[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeRollback]
+ * to rollback to the restore point saved by conn.interface_change_begin.
  */
-static VALUE libvirt_connect_lookup_nwfilter_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_interface_change_rollback(int argc, VALUE *argv,
+                                                       VALUE c)
 {
-    virNWFilterPtr nwfilter;
+    VALUE flags;
 
-    nwfilter = virNWFilterLookupByName(ruby_libvirt_connect_get(c),
-                                       StringValueCStr(name));
-    ruby_libvirt_raise_error_if(nwfilter == NULL, e_RetrieveError,
-                                "virNWFilterLookupByName",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "01", &flags);
 
-    return ruby_libvirt_nwfilter_new(nwfilter, c);
+    ruby_libvirt_generate_call_nil(virInterfaceChangeRollback,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_value_to_uint(flags));
 }
 
 /*
  * call-seq:
- *   conn.lookup_nwfilter_by_uuid(uuid) -> Libvirt::NWFilter
+ *   conn.interface_transaction(flags=0) {|tx| block } -> Hash
  *
- * Call virNWFilterLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterLookupByUUIDString]
- * to retrieve a network filter object by UUID.
+ * Yield a Libvirt::Interface::Transaction to the block, on which define,
+ * create, destroy and undefine operations can be queued.  Once the block
+ * returns, the operations are run in order, without the GVL, between
+ * virInterfaceChangeBegin[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeBegin]
+ * (which is passed flags) and virInterfaceChangeCommit[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeCommit].
+ * The first failure stops the run and restores the interfaces with
+ * virInterfaceChangeRollback[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeRollback].
+ * Nothing is run if the block raises.  With a governor set (see
+ * conn.set_governor) every call of the transaction waits for its own slot;
+ * if the calling thread is interrupted (Timeout, Thread#raise) while
+ * waiting, the transaction is rolled back before the exception propagates.
+ *
+ * Returns a Hash with "committed" (true or false), the index of the
+ * operation that "failed" (the number of operations if the commit failed)
+ * and its "error", "rolled_back" and "rollback_error", the "times" of the
+ * individual operations and the "time" of the whole transaction.
  */
-static VALUE libvirt_connect_lookup_nwfilter_by_uuid(VALUE c, VALUE uuid)
+static VALUE libvirt_connect_interface_transaction(int argc, VALUE *argv,
+                                                   VALUE c)
 {
-    virNWFilterPtr nwfilter;
+    VALUE flags = RUBY_Qnil;
 
-    nwfilter = virNWFilterLookupByUUIDString(ruby_libvirt_connect_get(c),
-                                             StringValueCStr(uuid));
-    ruby_libvirt_raise_error_if(nwfilter == NULL, e_RetrieveError,
-                                "virNWFilterLookupByUUIDString",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "01", &flags);
 
-    return ruby_libvirt_nwfilter_new(nwfilter, c);
+    return ruby_libvirt_interface_transaction(c,
+                                              ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_VIRNODEGETCPUSTATS
+static void cpu_stats_set(void *voidparams, int i, VALUE result)
+{
+    virNodeCPUStatsPtr params = (virNodeCPUStatsPtr)voidparams;
+
+    rb_hash_aset(result, rb_str_new2(params[i].field),
+                 ULL2NUM(params[i].value));
+}
+
+static const char *cpu_stats_nparams(VALUE d, unsigned int flags, void *opaque,
+                                     int *nparams)
+{
+    int intparam = *((int *)opaque);
+
+    if (RUBY_LIBVIRT_CALL(virNodeGetCPUStats, ruby_libvirt_connect_get(d),
+                          intparam, NULL, nparams, flags) < 0) {
+        return "virNodeGetCPUStats";
+    }
+
+    return NULL;
+}
+
+static const char *cpu_stats_get(VALUE d, unsigned int flags, void *voidparams,
+                                 int *nparams, void *opaque)
+{
+    int intparam = *((int *)opaque);
+    virNodeCPUStatsPtr params = (virNodeCPUStatsPtr)voidparams;
+
+    if (RUBY_LIBVIRT_CALL(virNodeGetCPUStats, ruby_libvirt_connect_get(d),
+                          intparam, params, nparams, flags) < 0) {
+        return "virNodeGetCPUStats";
+    }
+
+    return NULL;
 }
 
 /*
  * call-seq:
- *   conn.define_nwfilter_xml(xml) -> Libvirt::NWFilter
+ *   conn.node_cpu_stats(cpuNum=-1, flags=0) -> Hash
  *
- * Call virNWFilterDefineXML[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterDefineXML]
- * to define a new network filter from xml.
+ * Call virNodeGetCPUStats[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCPUStats]
+ * to retrieve cpu statistics from the virtualization host.
  */
-static VALUE libvirt_connect_define_nwfilter_xml(VALUE c, VALUE xml)
+static VALUE libvirt_connect_node_cpu_stats(int argc, VALUE *argv, VALUE c)
 {
-    virNWFilterPtr nwfilter;
+    VALUE intparam, flags;
+    int tmp;
 
-    nwfilter = virNWFilterDefineXML(ruby_libvirt_connect_get(c),
-                                    StringValueCStr(xml));
-    ruby_libvirt_raise_error_if(nwfilter == NULL, e_DefinitionError,
-                                "virNWFilterDefineXML",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "02", &intparam, &flags);
 
-    return ruby_libvirt_nwfilter_new(nwfilter, c);
+    if (NIL_P(intparam)) {
+        tmp = -1;
+    }
+    else {
+        tmp = ruby_libvirt_value_to_int(intparam);
+    }
+
+    return ruby_libvirt_get_parameters(c, ruby_libvirt_value_to_uint(flags),
+                                       (void *)&tmp, sizeof(virNodeCPUStats),
+                                       cpu_stats_nparams, cpu_stats_get,
+                                       cpu_stats_set);
 }
 #endif
 
-#if HAVE_TYPE_VIRSECRETPTR
+#if HAVE_VIRNODEGETMEMORYSTATS
+static void memory_stats_set(void *voidparams, int i, VALUE result)
+{
+    virNodeMemoryStatsPtr params = (virNodeMemoryStatsPtr)voidparams;
 
-/*
- * call-seq:
- *   conn.num_of_secrets -> Fixnum
- *
- * Call virConnectNumOfSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectNumOfSecrets]
- * to retrieve the number of secrets on this connection.
- */
-static VALUE libvirt_connect_num_of_secrets(VALUE c)
+    rb_hash_aset(result, rb_str_new2(params[i].field),
+                 ULL2NUM(params[i].value));
+}
+
+static const char *memory_stats_nparams(VALUE d, unsigned int flags,
+                                        void *opaque, int *nparams)
 {
-    gen_conn_num_of(c, Secrets);
+    int intparam = *((int *)opaque);
+
+    if (RUBY_LIBVIRT_CALL(virNodeGetMemoryStats, ruby_libvirt_connect_get(d),
+                          intparam, NULL, nparams, flags) < 0) {
+        return "virNodeGetMemoryStats";
+    }
+
+    return NULL;
+}
+
+static const char *memory_stats_get(VALUE d, unsigned int flags,
+                                    void *voidparams, int *nparams,
+                                    void *opaque)
+{
+    int intparam = *((int *)opaque);
+    virNodeMemoryStatsPtr params = (virNodeMemoryStatsPtr)voidparams;
+
+    if (RUBY_LIBVIRT_CALL(virNodeGetMemoryStats, ruby_libvirt_connect_get(d),
+                          intparam, params, nparams, flags) < 0) {
+        return "virNodeGetMemoryStats";
+    }
+
+    return NULL;
 }
 
 /*
  * call-seq:
- *   conn.list_secrets -> list
+ *   conn.node_memory_stats(cellNum=-1, flags=0) -> Hash
  *
- * Call virConnectListSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectListSecrets]
- * to retrieve a list of secret UUIDs on this connection.
+ * Call virNodeGetMemoryStats[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetMemoryStats]
+ * to retrieve memory statistics from the virtualization host.
  */
-static VALUE libvirt_connect_list_secrets(VALUE c)
+static VALUE libvirt_connect_node_memory_stats(int argc, VALUE *argv, VALUE c)
 {
-    gen_conn_list_names(c, Secrets);
+    VALUE intparam, flags;
+    int tmp;
+
+    rb_scan_args(argc, argv, "02", &intparam, &flags);
+
+    if (NIL_P(intparam)) {
+        tmp = -1;
+    }
+    else {
+        tmp = ruby_libvirt_value_to_int(intparam);
+    }
+
+    return ruby_libvirt_get_parameters(c, ruby_libvirt_value_to_uint(flags),
+                                       (void *)&tmp, sizeof(virNodeMemoryStats),
+                                       memory_stats_nparams, memory_stats_get,
+                                       memory_stats_set);
 }
+#endif
 
+#if HAVE_VIRDOMAINSAVEIMAGEGETXMLDESC
 /*
  * call-seq:
- *   conn.lookup_secret_by_uuid(uuid) -> Libvirt::Secret
+ *   conn.save_image_xml_desc(filename, flags=0) -> String
  *
- * Call virSecretLookupByUUID[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUUID]
- * to retrieve a network object from uuid.
+ * Call virDomainSaveImageGetXMLDesc[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveImageGetXMLDesc]
+ * to get the XML corresponding to a save file.
  */
-static VALUE libvirt_connect_lookup_secret_by_uuid(VALUE c, VALUE uuid)
+static VALUE libvirt_connect_save_image_xml_desc(int argc, VALUE *argv, VALUE c)
 {
-    virSecretPtr secret;
+    VALUE filename, flags;
 
-    secret = virSecretLookupByUUIDString(ruby_libvirt_connect_get(c),
-                                         StringValueCStr(uuid));
-    ruby_libvirt_raise_error_if(secret == NULL, e_RetrieveError,
-                                "virSecretLookupByUUID",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "11", &filename, &flags);
 
-    return ruby_libvirt_secret_new(secret, c);
+    ruby_libvirt_generate_call_string(virDomainSaveImageGetXMLDesc,
+                                      ruby_libvirt_connect_get(c), 1,
+                                      ruby_libvirt_connect_get(c),
+                                      StringValueCStr(filename),
+                                      ruby_libvirt_value_to_uint(flags));
 }
 
 /*
  * call-seq:
- *   conn.lookup_secret_by_usage(usagetype, usageID) -> Libvirt::Secret
+ *   conn.define_save_image_xml(filename, newxml, flags=0) -> nil
  *
- * Call virSecretLookupByUsage[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretLookupByUsage]
- * to retrieve a secret by usagetype.
+ * Call virDomainSaveImageDefineXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveImageDefineXML]
+ * to define new XML for a saved image.
  */
-static VALUE libvirt_connect_lookup_secret_by_usage(VALUE c, VALUE usagetype,
-                                                    VALUE usageID)
+static VALUE libvirt_connect_define_save_image_xml(int argc, VALUE *argv,
+                                                   VALUE c)
 {
-    virSecretPtr secret;
+    VALUE filename, newxml, flags;
 
-    secret = virSecretLookupByUsage(ruby_libvirt_connect_get(c),
-                                    NUM2UINT(usagetype),
-                                    StringValueCStr(usageID));
-    ruby_libvirt_raise_error_if(secret == NULL, e_RetrieveError,
-                                "virSecretLookupByUsage",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "21", &filename, &newxml, &flags);
 
-    return ruby_libvirt_secret_new(secret, c);
+    ruby_libvirt_generate_call_nil(virDomainSaveImageDefineXML,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   StringValueCStr(filename),
+                                   StringValueCStr(newxml),
+                                   ruby_libvirt_value_to_uint(flags));
 }
+#endif
 
+#if HAVE_VIRNODESUSPENDFORDURATION
 /*
  * call-seq:
- *   conn.define_secret_xml(xml, flags=0) -> Libvirt::Secret
+ *   conn.node_suspend_for_duration(target, duration, flags=0) -> nil
  *
- * Call virSecretDefineXML[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virSecretDefineXML]
- * to define a new secret from xml.
+ * Call virNodeSuspendForDuration[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeSuspendForDuration]
+ * to suspend the hypervisor for the specified duration.
  */
-static VALUE libvirt_connect_define_secret_xml(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_node_suspend_for_duration(int argc, VALUE *argv,
+                                                       VALUE c)
 {
-    virSecretPtr secret;
-    VALUE xml, flags;
-
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    VALUE target, duration, flags;
 
-    secret = virSecretDefineXML(ruby_libvirt_connect_get(c),
-                                StringValueCStr(xml),
-                                ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(secret == NULL, e_DefinitionError,
-                                "virSecretDefineXML",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "21", &target, &duration, &flags);
 
-    return ruby_libvirt_secret_new(secret, c);
+    ruby_libvirt_generate_call_nil(virNodeSuspendForDuration,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   NUM2UINT(target), NUM2ULL(duration),
+                                   ruby_libvirt_value_to_uint(flags));
 }
 #endif
 
-#if HAVE_TYPE_VIRSTORAGEPOOLPTR
+#if HAVE_VIRNODEGETMEMORYPARAMETERS
+static const char *node_memory_nparams(VALUE d, unsigned int flags,
+                                       void *RUBY_LIBVIRT_UNUSED(opaque),
+                                       int *nparams)
+{
+    if (RUBY_LIBVIRT_CALL(virNodeGetMemoryParameters,
+                          ruby_libvirt_connect_get(d), NULL, nparams,
+                          flags) < 0) {
+        return "virNodeGetMemoryParameters";
+    }
 
-VALUE pool_new(virStoragePoolPtr n, VALUE conn);
+    return NULL;
+}
 
-/*
- * call-seq:
- *   conn.list_storage_pools -> list
- *
- * Call virConnectListStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListStoragePools]
- * to retrieve a list of active storage pool names on this connection.
- */
-static VALUE libvirt_connect_list_storage_pools(VALUE c)
+static const char *node_memory_get(VALUE d, unsigned int flags,
+                                   void *voidparams, int *nparams,
+                                   void *RUBY_LIBVIRT_UNUSED(opaque))
 {
-    gen_conn_list_names(c, StoragePools);
+    virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
+
+    if (RUBY_LIBVIRT_CALL(virNodeGetMemoryParameters,
+                          ruby_libvirt_connect_get(d), params, nparams,
+                          flags) < 0) {
+        return "virNodeGetMemoryParameters";
+    }
+    return NULL;
+}
+
+static const char *node_memory_set(VALUE d, unsigned int flags,
+                                   virTypedParameterPtr params, int nparams,
+                                   void *RUBY_LIBVIRT_UNUSED(opaque))
+{
+    if (RUBY_LIBVIRT_CALL(virNodeSetMemoryParameters,
+                          ruby_libvirt_connect_get(d), params, nparams,
+                          flags) < 0) {
+        return "virNodeSetMemoryParameters";
+    }
+    return NULL;
 }
 
 /*
  * call-seq:
- *   conn.num_of_storage_pools -> Fixnum
+ *   conn.node_memory_parameters(flags=0) -> Hash
  *
- * Call virConnectNumOfStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectNumOfStoragePools]
- * to retrieve the number of active storage pools on this connection.
+ * Call virNodeGetMemoryParameters[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetMemoryParameters]
+ * to get information about memory on the host node.
  */
-static VALUE libvirt_connect_num_of_storage_pools(VALUE c)
+static VALUE libvirt_connect_node_memory_parameters(int argc, VALUE *argv,
+                                                    VALUE c)
 {
-    gen_conn_num_of(c, StoragePools);
+    VALUE flags;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    return ruby_libvirt_get_typed_parameters(c,
+                                             ruby_libvirt_value_to_uint(flags),
+                                             NULL, node_memory_nparams,
+                                             node_memory_get);
 }
 
+static struct ruby_libvirt_typed_param memory_allowed[] = {
+    {VIR_NODE_MEMORY_SHARED_PAGES_TO_SCAN, VIR_TYPED_PARAM_UINT},
+    {VIR_NODE_MEMORY_SHARED_SLEEP_MILLISECS, VIR_TYPED_PARAM_UINT},
+    {VIR_NODE_MEMORY_SHARED_PAGES_SHARED, VIR_TYPED_PARAM_ULLONG},
+    {VIR_NODE_MEMORY_SHARED_PAGES_SHARING, VIR_TYPED_PARAM_ULLONG},
+    {VIR_NODE_MEMORY_SHARED_PAGES_UNSHARED, VIR_TYPED_PARAM_ULLONG},
+    {VIR_NODE_MEMORY_SHARED_PAGES_VOLATILE, VIR_TYPED_PARAM_ULLONG},
+    {VIR_NODE_MEMORY_SHARED_FULL_SCANS, VIR_TYPED_PARAM_ULLONG},
+#if HAVE_CONST_VIR_NODE_MEMORY_SHARED_MERGE_ACROSS_NODES
+    {VIR_NODE_MEMORY_SHARED_MERGE_ACROSS_NODES, VIR_TYPED_PARAM_UINT},
+#endif
+};
+
 /*
  * call-seq:
- *   conn.list_defined_storage_pools -> list
+ *   conn.node_memory_parameters = Hash,flags=0
  *
- * Call virConnectListDefinedStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListDefinedStoragePools]
- * to retrieve a list of inactive storage pool names on this connection.
+ * Call virNodeSetMemoryParameters[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeSetMemoryParameters]
+ * to set the memory parameters for this host node.
  */
-static VALUE libvirt_connect_list_defined_storage_pools(VALUE c)
+static VALUE libvirt_connect_node_memory_parameters_equal(VALUE c, VALUE input)
 {
-    gen_conn_list_names(c, DefinedStoragePools);
+    VALUE hash, flags;
+
+    ruby_libvirt_assign_hash_and_flags(input, &hash, &flags);
+
+    return ruby_libvirt_set_typed_parameters(c, hash, NUM2UINT(flags), NULL,
+                                             memory_allowed,
+                                             ARRAY_SIZE(memory_allowed),
+                                             node_memory_set);
+}
+#endif
+
+#if HAVE_VIRNODEGETCPUMAP
+struct cpu_map_field_to_value {
+    VALUE result;
+    int cpu;
+    int used;
+};
+
+static VALUE cpu_map_field_to_value(VALUE input)
+{
+    struct cpu_map_field_to_value *ftv = (struct cpu_map_field_to_value *)input;
+    char cpuname[10];
+
+    snprintf(cpuname, sizeof(cpuname), "%d", ftv->cpu);
+    rb_hash_aset(ftv->result, rb_str_new2(cpuname), ftv->used ? Qtrue : Qfalse);
+
+    return Qnil;
 }
 
 /*
  * call-seq:
- *   conn.num_of_defined_storage_pools -> Fixnum
+ *   conn.node_cpu_map -> Hash
  *
- * Call virConnectNumOfDefinedStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectNumOfDefinedStoragePools]
- * to retrieve the number of inactive storage pools on this connection.
+ * Call virNodeGetCPUMap[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCPUMap]
+ * to get a map of online host CPUs.
  */
-static VALUE libvirt_connect_num_of_defined_storage_pools(VALUE c)
+static VALUE libvirt_connect_node_cpu_map(int argc, VALUE *argv, VALUE c)
 {
-    gen_conn_num_of(c, DefinedStoragePools);
+    VALUE flags, result;
+    unsigned char *map;
+    unsigned int online;
+    int ret, i, exception = 0;
+    struct cpu_map_field_to_value ftv;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    ret = RUBY_LIBVIRT_CALL(virNodeGetCPUMap, ruby_libvirt_connect_get(c),
+                            &map, &online, ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError, "virNodeGetCPUMap",
+                                ruby_libvirt_connect_get(c));
+
+    result = rb_hash_new();
+
+    for (i = 0; i < ret; i++) {
+        ftv.result = result;
+        ftv.cpu = i;
+        ftv.used = VIR_CPU_USED(map, i);
+        rb_protect(cpu_map_field_to_value, (VALUE)&ftv, &exception);
+        if (exception) {
+            free(map);
+            rb_jump_tag(exception);
+        }
+    }
+
+    free(map);
+
+    return result;
 }
+#endif
 
+#if HAVE_VIRCONNECTSETKEEPALIVE
 /*
  * call-seq:
- *   conn.lookup_storage_pool_by_name(name) -> Libvirt::StoragePool
+ *   conn.set_keepalive(interval, count) -> Fixnum
  *
- * Call virStoragePoolLookupByName[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolLookupByName]
- * to retrieve a storage pool object by name.
+ * Call virConnectSetKeepAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectSetKeepAlive]
+ * to start sending keepalive messages.  Deprecated; use conn.keepalive=
+ * instead.
  */
-static VALUE libvirt_connect_lookup_pool_by_name(VALUE c, VALUE name)
+static VALUE libvirt_connect_set_keepalive(VALUE c, VALUE interval, VALUE count)
 {
-    virStoragePoolPtr pool;
-
-    pool = virStoragePoolLookupByName(ruby_libvirt_connect_get(c),
-                                      StringValueCStr(name));
-    ruby_libvirt_raise_error_if(pool == NULL, e_RetrieveError,
-                                "virStoragePoolLookupByName",
-                                ruby_libvirt_connect_get(c));
-
-    return pool_new(pool, c);
+    ruby_libvirt_generate_call_int(virConnectSetKeepAlive,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   NUM2INT(interval), NUM2UINT(count));
 }
 
 /*
  * call-seq:
- *   conn.lookup_storage_pool_by_uuid(uuid) -> Libvirt::StoragePool
+ *   conn.keepalive = interval,count
  *
- * Call virStoragePoolLookupByUUIDString[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolLookupByUUIDString]
- * to retrieve a storage pool object by uuid.
+ * Call virConnectSetKeepAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectSetKeepAlive]
+ * to start sending keepalive messages.
  */
-static VALUE libvirt_connect_lookup_pool_by_uuid(VALUE c, VALUE uuid)
+static VALUE libvirt_connect_keepalive_equal(VALUE c, VALUE in)
 {
-    virStoragePoolPtr pool;
+    VALUE interval, count;
 
-    pool = virStoragePoolLookupByUUIDString(ruby_libvirt_connect_get(c),
-                                            StringValueCStr(uuid));
-    ruby_libvirt_raise_error_if(pool == NULL, e_RetrieveError,
-                                "virStoragePoolLookupByUUID",
-                                ruby_libvirt_connect_get(c));
+    Check_Type(in, T_ARRAY);
+
+    if (RARRAY_LEN(in) != 2) {
+        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
+                 RARRAY_LEN(in));
+    }
 
-    return pool_new(pool, c);
+    interval = rb_ary_entry(in, 0);
+    count = rb_ary_entry(in, 1);
+
+    ruby_libvirt_generate_call_int(virConnectSetKeepAlive,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c),
+                                   NUM2INT(interval), NUM2UINT(count));
 }
+#endif
 
+#if HAVE_VIRCONNECTLISTALLDOMAINS
 /*
  * call-seq:
- *   conn.create_storage_pool_xml(xml, flags=0) -> Libvirt::StoragePool
+ *   conn.list_all_domains(flags=0) -> Array
  *
- * Call virStoragePoolCreateXML[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolCreateXML]
- * to start a new transient storage pool from xml.
+ * Call virConnectListAllDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListAllDomains]
+ * to get an array of domain objects for all domains.
  */
-static VALUE libvirt_connect_create_pool_xml(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_list_all_domains(int argc, VALUE *argv, VALUE c)
 {
-    virStoragePoolPtr pool;
-    VALUE xml, flags;
-
-    rb_scan_args(argc, argv, "11", &xml, &flags);
-
-    pool = virStoragePoolCreateXML(ruby_libvirt_connect_get(c),
-                                   StringValueCStr(xml),
-                                   ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(pool == NULL, e_Error,
-                                "virStoragePoolCreateXML",
-                                ruby_libvirt_connect_get(c));
-
-    return pool_new(pool, c);
+    ruby_libvirt_generate_call_list_all(virDomainPtr, argc, argv,
+                                        virConnectListAllDomains,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_domain_new, virDomainFree);
 }
+#endif
 
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_PERF
 /*
  * call-seq:
- *   conn.define_storage_pool_xml(xml, flags=0) -> Libvirt::StoragePool
+ *   conn.domain_perf_stats(domains=nil, flags=0) -> Hash
  *
- * Call virStoragePoolDefineXML[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolDefineXML]
- * to define a permanent storage pool from xml.
+ * Call virConnectGetAllDomainStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectGetAllDomainStats]
+ * (or virDomainListGetStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainListGetStats]
+ * if an array of Libvirt::Domain is given) to read the hardware perf event
+ * counters of many domains with one call.  Returns a Hash from domain name
+ * to a Hash of counters such as "cmt", "mbmt", "mbml", "cpu_cycles" and
+ * "instructions"; only counters enabled with dom.perf_events= appear.
+ * flags is a combination of the GET_ALL_DOMAINS_STATS_* constants.
  */
-static VALUE libvirt_connect_define_pool_xml(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_domain_perf_stats(int argc, VALUE *argv, VALUE c)
 {
-    virStoragePoolPtr pool;
-    VALUE xml, flags;
-
-    rb_scan_args(argc, argv, "11", &xml, &flags);
+    VALUE domains, flags;
 
-    pool = virStoragePoolDefineXML(ruby_libvirt_connect_get(c),
-                                   StringValueCStr(xml),
-                                   ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(pool == NULL, e_DefinitionError,
-                                "virStoragePoolDefineXML",
-                                ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "02", &domains, &flags);
 
-    return pool_new(pool, c);
+    return ruby_libvirt_domain_stats(c, domains, VIR_DOMAIN_STATS_PERF,
+                                     ruby_libvirt_value_to_uint(flags),
+                                     "perf.");
 }
+#endif
 
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_BALLOON
 /*
  * call-seq:
- *   conn.discover_storage_pool_sources(type, srcSpec=nil, flags=0) -> String
+ *   conn.domain_memory_stats(domains=nil, flags=0) -> Hash
  *
- * Call virConnectFindStoragePoolSources[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectFindStoragePoolSources]
- * to find the storage pool sources corresponding to type.
+ * Call virConnectGetAllDomainStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectGetAllDomainStats]
+ * (or virDomainListGetStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainListGetStats]
+ * if an array of Libvirt::Domain is given) to read the memory statistics of
+ * many domains with one call.  Returns a Hash from domain name to a Hash
+ * with the same keys as dom.memory_stats_hash, plus "maximum" (the
+ * domain's maximum memory).  flags is a combination of the
+ * GET_ALL_DOMAINS_STATS_* constants.
  */
-static VALUE libvirt_connect_find_storage_pool_sources(int argc, VALUE *argv,
-                                                       VALUE c)
+static VALUE libvirt_connect_domain_memory_stats(int argc, VALUE *argv,
+                                                 VALUE c)
 {
-    VALUE type, srcSpec, flags;
+    VALUE domains, flags;
 
-    rb_scan_args(argc, argv, "12", &type, &srcSpec, &flags);
+    rb_scan_args(argc, argv, "02", &domains, &flags);
 
-    ruby_libvirt_generate_call_string(virConnectFindStoragePoolSources,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c),
-                                      StringValueCStr(type),
-                                      ruby_libvirt_get_cstring_or_null(srcSpec),
-                                      ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_domain_stats(c, domains, VIR_DOMAIN_STATS_BALLOON,
+                                     ruby_libvirt_value_to_uint(flags),
+                                     "balloon.");
 }
 #endif
 
-#if HAVE_VIRCONNECTGETSYSINFO
+#if HAVE_VIRDOMAINGETMETADATA && HAVE_VIRCONNECTLISTALLDOMAINS && HAVE_LIBXML_PARSER_H
 /*
  * call-seq:
- *   conn.sys_info(flags=0) -> String
+ *   conn.domain_metadata(type, uri=nil, keys=nil, domains=nil, concurrency=0, flags=0) -> Hash
  *
- * Call virConnectGetSysinfo[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectGetSysinfo]
- * to get machine-specific information about the hypervisor.  This may include
- * data such as the host UUID, the BIOS version, etc.
+ * Call virDomainGetMetadata[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainGetMetadata]
+ * for every domain in domains (an Array of Libvirt::Domain, or nil for all
+ * domains on this connection) on up to concurrency worker threads (a
+ * default if 0).  Returns a Hash from domain name to its metadata of type
+ * (one of the Libvirt::Domain::METADATA_* constants) and namespace uri, or
+ * to nil if the domain has none.  For METADATA_ELEMENT, keys can be an
+ * Array of names to pick out of the metadata natively; the value is then a
+ * Hash from each key to the attribute of the metadata element of that
+ * name or, failing that, the text of its child element of that name (nil
+ * if neither exists).  The first failure is raised once all the domains
+ * have been tried.
  */
-static VALUE libvirt_connect_sys_info(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_domain_metadata(int argc, VALUE *argv, VALUE c)
 {
-    VALUE flags;
+    VALUE type, uri, keys, domains, concurrency, flags;
 
-    rb_scan_args(argc, argv, "01", &flags);
+    rb_scan_args(argc, argv, "15", &type, &uri, &keys, &domains,
+                 &concurrency, &flags);
 
-    ruby_libvirt_generate_call_string(virConnectGetSysinfo,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c),
-                                      ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_metadata_get_bulk(c, NUM2INT(type), uri, keys,
+                                          domains,
+                                          ruby_libvirt_value_to_int(concurrency),
+                                          ruby_libvirt_value_to_uint(flags));
 }
 #endif
 
-#if HAVE_TYPE_VIRSTREAMPTR
-
+#if HAVE_VIRDOMAINSETMETADATA
 /*
  * call-seq:
- *   conn.stream(flags=0) -> Libvirt::Stream
+ *   conn.set_domain_metadata(changes, type, key=nil, uri=nil, concurrency=0, flags=0) -> Array
  *
- * Call virStreamNew[http://www.libvirt.org/html/libvirt-libvirt-stream.html#virStreamNew]
- * to create a new stream.
+ * Call virDomainSetMetadata[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetMetadata]
+ * for every Libvirt::Domain key of the changes Hash, setting its metadata
+ * of type to the value (a String, or nil to remove the metadata), on up to
+ * concurrency worker threads (a default if 0).  The type, key, uri and
+ * flags are as for dom.metadata=.  Returns an Array with a Hash per domain
+ * of "name", "error" (a Libvirt::Error, or nil on success) and "time" (the
+ * seconds the call took).
  */
-static VALUE libvirt_connect_stream(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_set_domain_metadata(int argc, VALUE *argv,
+                                                 VALUE c)
 {
-    VALUE flags;
-    virStreamPtr stream;
-
-    rb_scan_args(argc, argv, "01", &flags);
-
-    stream = virStreamNew(ruby_libvirt_connect_get(c),
-                          ruby_libvirt_value_to_uint(flags));
+    VALUE changes, type, key, uri, concurrency, flags;
 
-    ruby_libvirt_raise_error_if(stream == NULL, e_RetrieveError,
-                                "virStreamNew", ruby_libvirt_connect_get(c));
+    rb_scan_args(argc, argv, "24", &changes, &type, &key, &uri, &concurrency,
+                 &flags);
 
-    return ruby_libvirt_stream_new(stream, c);
+    return ruby_libvirt_metadata_set_bulk(c, changes, NUM2INT(type), key, uri,
+                                          ruby_libvirt_value_to_int(concurrency),
+                                          ruby_libvirt_value_to_uint(flags));
 }
 #endif
 
-#if HAVE_VIRINTERFACECHANGEBEGIN
+#if HAVE_VIRDOMAINMANAGEDSAVE && HAVE_VIRCONNECTLISTALLDOMAINS
 /*
  * call-seq:
- *   conn.interface_change_begin(flags=0) -> nil
+ *   conn.managed_save_domains(domains=nil, params=nil, concurrency=0, flags=0) -> Array
  *
- * Call virInterfaceChangeBegin[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeBegin]
- * to create a restore point for interface changes.  Once changes have been
- * made, conn.interface_change_commit can be used to commit the result or
- * conn.interface_change_rollback can be used to rollback to this restore point.
+ * Managed-save each of domains (an Array of Libvirt::Domain, or nil for
+ * every running persistent domain) with virDomainManagedSave[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainManagedSave],
+ * or with virDomainSaveParams[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveParams]
+ * if params, a Hash as for dom.save_params, is not empty.  Since params
+ * applies to every domain, SAVE_PARAM_FILE and SAVE_PARAM_DXML raise
+ * ArgumentError.  Up to concurrency domains (a default if 0) are saved at
+ * once on native threads without holding the GVL.  This only limits how many
+ * saves run together, each writing SAVE_PARAM_PARALLEL_CHANNELS streams;
+ * libvirt has no way to cap the bytes per second a save writes.  Returns an
+ * Array with a Hash for each domain holding its "name", the Libvirt::Error
+ * that occurred for it (or nil) under "error" and the seconds it took under
+ * "time".
  */
-static VALUE libvirt_connect_interface_change_begin(int argc, VALUE *argv,
-                                                    VALUE c)
+static VALUE libvirt_connect_managed_save_domains(int argc, VALUE *argv,
+                                                  VALUE c)
 {
-    VALUE flags;
+    VALUE domains, params, concurrency, flags;
 
-    rb_scan_args(argc, argv, "01", &flags);
+    rb_scan_args(argc, argv, "04", &domains, &params, &concurrency, &flags);
 
-    ruby_libvirt_generate_call_nil(virInterfaceChangeBegin,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_domain_managed_save_bulk(c, domains, 0, params,
+                                                 ruby_libvirt_value_to_uint(flags),
+                                                 ruby_libvirt_value_to_int(concurrency));
 }
 
 /*
  * call-seq:
- *   conn.interface_change_commit(flags=0) -> nil
+ *   conn.managed_restore_domains(domains=nil, concurrency=0, flags=0) -> Array
  *
- * Call virInterfaceChangeCommit[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeCommit]
- * to commit the interface changes since the last conn.interface_change_begin.
+ * Start each of domains (an Array of Libvirt::Domain, or nil for every
+ * inactive domain with a managed save image) with virDomainCreateWithFlags[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainCreateWithFlags],
+ * which restores them from their managed save images.  This works like
+ * conn.managed_save_domains and returns the same kind of results.
  */
-static VALUE libvirt_connect_interface_change_commit(int argc, VALUE *argv,
+static VALUE libvirt_connect_managed_restore_domains(int argc, VALUE *argv,
                                                      VALUE c)
 {
-    VALUE flags;
+    VALUE domains, concurrency, flags;
 
-    rb_scan_args(argc, argv, "01", &flags);
+    rb_scan_args(argc, argv, "03", &domains, &concurrency, &flags);
 
-    ruby_libvirt_generate_call_nil(virInterfaceChangeCommit,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_domain_managed_save_bulk(c, domains, 1, Qnil,
+                                                 ruby_libvirt_value_to_uint(flags),
+                                                 ruby_libvirt_value_to_int(concurrency));
 }
+#endif
 
+#if HAVE_VIRCONNECTLISTALLNETWORKS
 /*
  * call-seq:
- *   conn.interface_change_rollback(flags=0) -> nil
+ *   conn.list_all_networks(flags=0) -> Array
  *
- * Call virInterfaceChangeRollback[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceChangeRollback]
- * to rollback to the restore point saved by conn.interface_change_begin.
+ * Call virConnectListAllNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListAllNetworks]
+ * to get an array of network objects for all networks.
  */
-static VALUE libvirt_connect_interface_change_rollback(int argc, VALUE *argv,
-                                                       VALUE c)
+static VALUE libvirt_connect_list_all_networks(int argc, VALUE *argv, VALUE c)
 {
-    VALUE flags;
-
-    rb_scan_args(argc, argv, "01", &flags);
-
-    ruby_libvirt_generate_call_nil(virInterfaceChangeRollback,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_generate_call_list_all(virNetworkPtr, argc, argv,
+                                        virConnectListAllNetworks,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_network_new,
+                                        virNetworkFree);
 }
 #endif
 
-#if HAVE_VIRNODEGETCPUSTATS
-static void cpu_stats_set(void *voidparams, int i, VALUE result)
-{
-    virNodeCPUStatsPtr params = (virNodeCPUStatsPtr)voidparams;
-
-    rb_hash_aset(result, rb_str_new2(params[i].field),
-                 ULL2NUM(params[i].value));
-}
-
-static const char *cpu_stats_nparams(VALUE d, unsigned int flags, void *opaque,
-                                     int *nparams)
-{
-    int intparam = *((int *)opaque);
-
-    if (virNodeGetCPUStats(ruby_libvirt_connect_get(d), intparam, NULL,
-                           nparams, flags) < 0) {
-        return "virNodeGetCPUStats";
-    }
-
-    return NULL;
-}
-
-static const char *cpu_stats_get(VALUE d, unsigned int flags, void *voidparams,
-                                 int *nparams, void *opaque)
-{
-    int intparam = *((int *)opaque);
-    virNodeCPUStatsPtr params = (virNodeCPUStatsPtr)voidparams;
-
-    if (virNodeGetCPUStats(ruby_libvirt_connect_get(d), intparam, params,
-                           nparams, flags) < 0) {
-        return "virNodeGetCPUStats";
-    }
-
-    return NULL;
-}
-
+#if HAVE_VIRNETWORKGETDHCPLEASES
 /*
  * call-seq:
- *   conn.node_cpu_stats(cpuNum=-1, flags=0) -> Hash
+ *   conn.dhcp_lease_index(concurrency=0) -> Libvirt::Network::LeaseIndex
  *
- * Call virNodeGetCPUStats[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCPUStats]
- * to retrieve cpu statistics from the virtualization host.
+ * Build an index of the DHCP leases of all active networks on this
+ * connection.  The leases of the individual networks are retrieved with
+ * virNetworkGetDHCPLeases[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkGetDHCPLeases]
+ * on up to concurrency native threads at once (a default if 0), and can then
+ * be looked up by MAC address, IP address or hostname without further calls
+ * into libvirt.  See Libvirt::Network::LeaseIndex#refresh for keeping the
+ * index up to date.
  */
-static VALUE libvirt_connect_node_cpu_stats(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_dhcp_lease_index(int argc, VALUE *argv, VALUE c)
 {
-    VALUE intparam, flags;
-    int tmp;
+    VALUE concurrency = RUBY_Qnil;
 
-    rb_scan_args(argc, argv, "02", &intparam, &flags);
-
-    if (NIL_P(intparam)) {
-        tmp = -1;
-    }
-    else {
-        tmp = ruby_libvirt_value_to_int(intparam);
-    }
+    rb_scan_args(argc, argv, "01", &concurrency);
 
-    return ruby_libvirt_get_parameters(c, ruby_libvirt_value_to_uint(flags),
-                                       (void *)&tmp, sizeof(virNodeCPUStats),
-                                       cpu_stats_nparams, cpu_stats_get,
-                                       cpu_stats_set);
+    return ruby_libvirt_network_lease_index_new(c,
+                                                ruby_libvirt_value_to_int(concurrency));
 }
 #endif
 
-#if HAVE_VIRNODEGETMEMORYSTATS
-static void memory_stats_set(void *voidparams, int i, VALUE result)
+#if HAVE_VIRCONNECTLISTALLINTERFACES
+/*
+ * call-seq:
+ *   conn.list_all_interfaces(flags=0) -> Array
+ *
+ * Call virConnectListAllInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListAllInterfaces]
+ * to get an array of interface objects for all interfaces.
+ */
+static VALUE libvirt_connect_list_all_interfaces(int argc, VALUE *argv, VALUE c)
 {
-    virNodeMemoryStatsPtr params = (virNodeMemoryStatsPtr)voidparams;
-
-    rb_hash_aset(result, rb_str_new2(params[i].field),
-                 ULL2NUM(params[i].value));
+    ruby_libvirt_generate_call_list_all(virInterfacePtr, argc, argv,
+                                        virConnectListAllInterfaces,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_interface_new,
+                                        virInterfaceFree);
 }
+#endif
 
-static const char *memory_stats_nparams(VALUE d, unsigned int flags,
-                                        void *opaque, int *nparams)
+#if HAVE_VIRCONNECTLISTALLSECRETS
+/*
+ * call-seq:
+ *   conn.list_all_secrets(flags=0) -> Array
+ *
+ * Call virConnectListAllSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectListAllSecrets]
+ * to get an array of secret objects for all secrets.
+ */
+static VALUE libvirt_connect_list_all_secrets(int argc, VALUE *argv, VALUE c)
 {
-    int intparam = *((int *)opaque);
-
-    if (virNodeGetMemoryStats(ruby_libvirt_connect_get(d), intparam, NULL,
-                              nparams, flags) < 0) {
-        return "virNodeGetMemoryStats";
-    }
-
-    return NULL;
+    ruby_libvirt_generate_call_list_all(virSecretPtr, argc, argv,
+                                        virConnectListAllSecrets,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_secret_new, virSecretFree);
 }
+#endif
 
-static const char *memory_stats_get(VALUE d, unsigned int flags,
-                                    void *voidparams, int *nparams,
-                                    void *opaque)
+#if HAVE_VIRCONNECTLISTALLNODEDEVICES
+/*
+ * call-seq:
+ *   conn.list_all_nodedevices(flags=0) -> Array
+ *
+ * Call virConnectListAllNodeDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virConnectListAllNodeDevices]
+ * to get an array of nodedevice objects for all nodedevices.
+ */
+static VALUE libvirt_connect_list_all_nodedevices(int argc, VALUE *argv,
+                                                  VALUE c)
 {
-    int intparam = *((int *)opaque);
-    virNodeMemoryStatsPtr params = (virNodeMemoryStatsPtr)voidparams;
-
-    if (virNodeGetMemoryStats(ruby_libvirt_connect_get(d), intparam, params,
-                           nparams, flags) < 0) {
-        return "virNodeGetMemoryStats";
-    }
-
-    return NULL;
+    ruby_libvirt_generate_call_list_all(virNodeDevicePtr, argc, argv,
+                                        virConnectListAllNodeDevices,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_nodedevice_new,
+                                        virNodeDeviceFree);
 }
+#endif
 
+#if HAVE_VIRCONNECTLISTALLNODEDEVICES && HAVE_LIBXML_PARSER_H
 /*
  * call-seq:
- *   conn.node_memory_stats(cellNum=-1, flags=0) -> Hash
+ *   conn.nodedevice_inventory(flags=0, concurrency=0) -> Hash
  *
- * Call virNodeGetMemoryStats[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetMemoryStats]
- * to retrieve memory statistics from the virtualization host.
+ * Collect the commonly needed details of all node devices matching flags (a
+ * combination of the Libvirt::Connect::LIST_NODE_DEVICES_CAP_* constants,
+ * as for conn.list_all_nodedevices).  The XML description of every device
+ * is fetched with virNodeDeviceGetXMLDesc[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virNodeDeviceGetXMLDesc]
+ * and parsed on up to concurrency native threads at once (a default if 0).
+ *
+ * The result is a table of columns: a Hash mapping "name", "parent",
+ * "caps", "driver", "pci_address", "vendor_id", "vendor", "product_id",
+ * "product", "numa_node", "iommu_group" and "error" to Arrays with one entry
+ * per device.  Fields that do not apply to a device are nil; "error" holds
+ * the Libvirt::RetrieveError for devices whose XML could not be retrieved
+ * or parsed, whose other fields are then all nil.
  */
-static VALUE libvirt_connect_node_memory_stats(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_nodedevice_inventory(int argc, VALUE *argv,
+                                                  VALUE c)
 {
-    VALUE intparam, flags;
-    int tmp;
+    VALUE flags = RUBY_Qnil, concurrency = RUBY_Qnil;
 
-    rb_scan_args(argc, argv, "02", &intparam, &flags);
+    rb_scan_args(argc, argv, "02", &flags, &concurrency);
 
-    if (NIL_P(intparam)) {
-        tmp = -1;
-    }
-    else {
-        tmp = ruby_libvirt_value_to_int(intparam);
-    }
+    return ruby_libvirt_nodedevice_inventory(c,
+                                             ruby_libvirt_value_to_uint(flags),
+                                             ruby_libvirt_value_to_int(concurrency));
+}
+#endif
 
-    return ruby_libvirt_get_parameters(c, ruby_libvirt_value_to_uint(flags),
-                                       (void *)&tmp, sizeof(virNodeMemoryStats),
-                                       memory_stats_nparams, memory_stats_get,
-                                       memory_stats_set);
+#if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS
+/*
+ * call-seq:
+ *   conn.list_all_storage_pools(flags=0) -> Array
+ *
+ * Call virConnectListAllStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListAllStoragePools]
+ * to get an array of storage pool objects for all storage pools.
+ */
+static VALUE libvirt_connect_list_all_storage_pools(int argc, VALUE *argv,
+                                                    VALUE c)
+{
+    ruby_libvirt_generate_call_list_all(virStoragePoolPtr, argc, argv,
+                                        virConnectListAllStoragePools,
+                                        ruby_libvirt_connect_get(c), c,
+                                        pool_new, virStoragePoolFree);
 }
 #endif
 
-#if HAVE_VIRDOMAINSAVEIMAGEGETXMLDESC
+#if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS && HAVE_VIRSTORAGEPOOLLISTALLVOLUMES
 /*
  * call-seq:
- *   conn.save_image_xml_desc(filename, flags=0) -> String
+ *   conn.storage_capacity_report(include_volumes=false, flags=0, concurrency=0) -> Hash
  *
- * Call virDomainSaveImageGetXMLDesc[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveImageGetXMLDesc]
- * to get the XML corresponding to a save file.
+ * Collect the capacity figures of all storage pools matching flags (a
+ * combination of the Libvirt::Connect::LIST_STORAGE_POOLS_* constants, as
+ * for conn.list_all_storage_pools).  The info of every pool, and with
+ * include_volumes of every volume in the running pools, is fetched with
+ * virStoragePoolGetInfo[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStoragePoolGetInfo]
+ * and virStorageVolGetInfo[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolGetInfo]
+ * on up to concurrency native threads at once (a default if 0).
+ *
+ * The result is a table of columns: a Hash mapping "name", "state",
+ * "capacity", "allocation", "available", "utilization" (allocation divided
+ * by capacity) and "error" to Arrays with one entry per pool.  With
+ * include_volumes there are also "volumes" (the number of volumes),
+ * "volume_capacity", "volume_allocation" and "overcommit" (the summed volume
+ * capacity divided by the pool capacity) columns.  "totals" maps to a Hash
+ * of the same figures summed over all pools.
  */
-static VALUE libvirt_connect_save_image_xml_desc(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_storage_capacity_report(int argc, VALUE *argv,
+                                                     VALUE c)
 {
-    VALUE filename, flags;
+    VALUE include_volumes = RUBY_Qnil, flags = RUBY_Qnil;
+    VALUE concurrency = RUBY_Qnil;
 
-    rb_scan_args(argc, argv, "11", &filename, &flags);
+    rb_scan_args(argc, argv, "03", &include_volumes, &flags, &concurrency);
 
-    ruby_libvirt_generate_call_string(virDomainSaveImageGetXMLDesc,
-                                      ruby_libvirt_connect_get(c), 1,
-                                      ruby_libvirt_connect_get(c),
-                                      StringValueCStr(filename),
-                                      ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_storage_capacity_report(c, RTEST(include_volumes),
+                                                ruby_libvirt_value_to_uint(flags),
+                                                ruby_libvirt_value_to_int(concurrency));
 }
+#endif
 
+#if HAVE_VIRCONNECTLISTALLNWFILTERS
 /*
  * call-seq:
- *   conn.define_save_image_xml(filename, newxml, flags=0) -> nil
+ *   conn.list_all_nwfilters(flags=0) -> Array
  *
- * Call virDomainSaveImageDefineXML[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveImageDefineXML]
- * to define new XML for a saved image.
+ * Call virConnectListAllNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectListAllNWFilters]
+ * to get an array of nwfilters for all nwfilter objects.
  */
-static VALUE libvirt_connect_define_save_image_xml(int argc, VALUE *argv,
-                                                   VALUE c)
+static VALUE libvirt_connect_list_all_nwfilters(int argc, VALUE *argv, VALUE c)
 {
-    VALUE filename, newxml, flags;
-
-    rb_scan_args(argc, argv, "21", &filename, &newxml, &flags);
-
-    ruby_libvirt_generate_call_nil(virDomainSaveImageDefineXML,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   StringValueCStr(filename),
-                                   StringValueCStr(newxml),
-                                   ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_generate_call_list_all(virNWFilterPtr, argc, argv,
+                                        virConnectListAllNWFilters,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_nwfilter_new,
+                                        virNWFilterFree);
 }
 #endif
 
-#if HAVE_VIRNODESUSPENDFORDURATION
+#if HAVE_TYPE_VIRNWFILTERPTR && HAVE_LIBXML_PARSER_H
 /*
  * call-seq:
- *   conn.node_suspend_for_duration(target, duration, flags=0) -> nil
+ *   conn.sync_nwfilters(xmls, concurrency=0) -> Hash
  *
- * Call virNodeSuspendForDuration[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeSuspendForDuration]
- * to suspend the hypervisor for the specified duration.
+ * Bring the network filters on this connection in line with the filter
+ * definitions in the xmls Array.  Every definition is compared, on up to
+ * concurrency native threads at once (a default if 0), against the XML of
+ * the existing filter of the same name, ignoring whitespace, attribute order
+ * and the UUID; only new and changed filters are then defined, in order,
+ * with virNWFilterDefineXML[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterDefineXML].
+ *
+ * Returns a Hash with the names of the "created", "updated" and "unchanged"
+ * filters, and "errors" mapping the name (or index, if it has none) of each
+ * filter that could not be defined to its Libvirt::DefinitionError.
  */
-static VALUE libvirt_connect_node_suspend_for_duration(int argc, VALUE *argv,
-                                                       VALUE c)
+static VALUE libvirt_connect_sync_nwfilters(int argc, VALUE *argv, VALUE c)
 {
-    VALUE target, duration, flags;
+    VALUE xmls = RUBY_Qnil, concurrency = RUBY_Qnil;
 
-    rb_scan_args(argc, argv, "21", &target, &duration, &flags);
+    rb_scan_args(argc, argv, "11", &xmls, &concurrency);
 
-    ruby_libvirt_generate_call_nil(virNodeSuspendForDuration,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   NUM2UINT(target), NUM2ULL(duration),
-                                   ruby_libvirt_value_to_uint(flags));
+    return ruby_libvirt_nwfilter_sync(c, xmls,
+                                      ruby_libvirt_value_to_int(concurrency));
 }
 #endif
 
-#if HAVE_VIRNODEGETMEMORYPARAMETERS
-static const char *node_memory_nparams(VALUE d, unsigned int flags,
-                                       void *RUBY_LIBVIRT_UNUSED(opaque),
-                                       int *nparams)
+#if HAVE_VIRCONNECTLISTALLNWFILTERBINDINGS
+/*
+ * call-seq:
+ *   conn.list_all_nwfilter_bindings(flags=0) -> Array
+ *
+ * Call virConnectListAllNWFilterBindings[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectListAllNWFilterBindings]
+ * to get an array of all network filter bindings.
+ */
+static VALUE libvirt_connect_list_all_nwfilter_bindings(int argc, VALUE *argv,
+                                                        VALUE c)
 {
-    if (virNodeGetMemoryParameters(ruby_libvirt_connect_get(d), NULL, nparams,
-                                   flags) < 0) {
-        return "virNodeGetMemoryParameters";
-    }
-
-    return NULL;
+    ruby_libvirt_generate_call_list_all(virNWFilterBindingPtr, argc, argv,
+                                        virConnectListAllNWFilterBindings,
+                                        ruby_libvirt_connect_get(c), c,
+                                        ruby_libvirt_nwfilter_binding_new,
+                                        virNWFilterBindingFree);
 }
 
-static const char *node_memory_get(VALUE d, unsigned int flags,
-                                   void *voidparams, int *nparams,
-                                   void *RUBY_LIBVIRT_UNUSED(opaque))
+/*
+ * call-seq:
+ *   conn.lookup_nwfilter_binding_by_port_dev(portdev) -> Libvirt::NWFilterBinding
+ *
+ * Call virNWFilterBindingLookupByPortDev[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingLookupByPortDev]
+ * to retrieve the network filter binding for the port device portdev.
+ */
+static VALUE libvirt_connect_lookup_nwfilter_binding_by_port_dev(VALUE c,
+                                                                 VALUE portdev)
 {
-    virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
+    virNWFilterBindingPtr binding;
 
-    if (virNodeGetMemoryParameters(ruby_libvirt_connect_get(d), params, nparams,
-                                   flags) < 0) {
-        return "virNodeGetMemoryParameters";
-    }
-    return NULL;
-}
+    binding = RUBY_LIBVIRT_CALL(virNWFilterBindingLookupByPortDev,
+                                ruby_libvirt_connect_get(c),
+                                StringValueCStr(portdev));
+    ruby_libvirt_raise_error_if(binding == NULL, e_RetrieveError,
+                                "virNWFilterBindingLookupByPortDev",
+                                ruby_libvirt_connect_get(c));
 
-static const char *node_memory_set(VALUE d, unsigned int flags,
-                                   virTypedParameterPtr params, int nparams,
-                                   void *RUBY_LIBVIRT_UNUSED(opaque))
-{
-    if (virNodeSetMemoryParameters(ruby_libvirt_connect_get(d), params, nparams,
-                                   flags) < 0) {
-        return "virNodeSetMemoryParameters";
-    }
-    return NULL;
+    return ruby_libvirt_nwfilter_binding_new(binding, c);
 }
 
 /*
  * call-seq:
- *   conn.node_memory_parameters(flags=0) -> Hash
+ *   conn.create_nwfilter_binding_xml(xml, flags=0) -> Libvirt::NWFilterBinding
  *
- * Call virNodeGetMemoryParameters[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetMemoryParameters]
- * to get information about memory on the host node.
+ * Call virNWFilterBindingCreateXML[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingCreateXML]
+ * to create a network filter binding from xml.
  */
-static VALUE libvirt_connect_node_memory_parameters(int argc, VALUE *argv,
-                                                    VALUE c)
+static VALUE libvirt_connect_create_nwfilter_binding_xml(int argc, VALUE *argv,
+                                                         VALUE c)
 {
-    VALUE flags;
+    VALUE xml, flags = RUBY_Qnil;
+    virNWFilterBindingPtr binding;
 
-    rb_scan_args(argc, argv, "01", &flags);
+    rb_scan_args(argc, argv, "11", &xml, &flags);
 
-    return ruby_libvirt_get_typed_parameters(c,
-                                             ruby_libvirt_value_to_uint(flags),
-                                             NULL, node_memory_nparams,
-                                             node_memory_get);
+    binding = RUBY_LIBVIRT_CALL(virNWFilterBindingCreateXML,
+                                ruby_libvirt_connect_get(c),
+                                StringValueCStr(xml),
+                                ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(binding == NULL, e_Error,
+                                "virNWFilterBindingCreateXML",
+                                ruby_libvirt_connect_get(c));
+
+    return ruby_libvirt_nwfilter_binding_new(binding, c);
 }
+#endif
 
-static struct ruby_libvirt_typed_param memory_allowed[] = {
-    {VIR_NODE_MEMORY_SHARED_PAGES_TO_SCAN, VIR_TYPED_PARAM_UINT},
-    {VIR_NODE_MEMORY_SHARED_SLEEP_MILLISECS, VIR_TYPED_PARAM_UINT},
-    {VIR_NODE_MEMORY_SHARED_PAGES_SHARED, VIR_TYPED_PARAM_ULLONG},
-    {VIR_NODE_MEMORY_SHARED_PAGES_SHARING, VIR_TYPED_PARAM_ULLONG},
-    {VIR_NODE_MEMORY_SHARED_PAGES_UNSHARED, VIR_TYPED_PARAM_ULLONG},
-    {VIR_NODE_MEMORY_SHARED_PAGES_VOLATILE, VIR_TYPED_PARAM_ULLONG},
-    {VIR_NODE_MEMORY_SHARED_FULL_SCANS, VIR_TYPED_PARAM_ULLONG},
-#if HAVE_CONST_VIR_NODE_MEMORY_SHARED_MERGE_ACROSS_NODES
-    {VIR_NODE_MEMORY_SHARED_MERGE_ACROSS_NODES, VIR_TYPED_PARAM_UINT},
+#if HAVE_VIRCONNECTISALIVE
+/*
+ * call-seq:
+ *   conn.alive? -> [True|False]
+ *
+ * Call virConnectIsAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsAlive]
+ * to determine if the connection is alive.
+ */
+static VALUE libvirt_connect_alive_p(VALUE c)
+{
+    ruby_libvirt_generate_call_truefalse(virConnectIsAlive,
+                                         ruby_libvirt_connect_get(c),
+                                         ruby_libvirt_connect_get(c));
+}
 #endif
-};
 
+#if HAVE_VIRCONNECTREGISTERCLOSECALLBACK && HAVE_PTHREAD_H
 /*
  * call-seq:
- *   conn.node_memory_parameters = Hash,flags=0
+ *   conn.monitor_liveness(interval=5, count=3) -> nil
  *
- * Call virNodeSetMemoryParameters[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeSetMemoryParameters]
- * to set the memory parameters for this host node.
+ * Call virConnectSetKeepAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectSetKeepAlive]
+ * and virConnectRegisterCloseCallback[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectRegisterCloseCallback]
+ * to have libvirt probe the connection every interval seconds and close it
+ * once count probes in a row go unanswered.  Calls still waiting on the
+ * dead connection then fail instead of hanging until TCP gives up, and
+ * conn.health reports the connection as dead.  This needs an event loop;
+ * Libvirt::native_event_loop_start provides one that does not depend on
+ * the application, and must be called before the connection is opened.
  */
-static VALUE libvirt_connect_node_memory_parameters_equal(VALUE c, VALUE input)
+static VALUE libvirt_connect_monitor_liveness(int argc, VALUE *argv, VALUE c)
 {
-    VALUE hash, flags;
+    VALUE interval = RUBY_Qnil, count = RUBY_Qnil;
+    struct ruby_libvirt_connect *data;
+    struct connect_health *health;
+    virConnectPtr conn;
+    int r, ninterval;
+    unsigned int ncount;
 
-    ruby_libvirt_assign_hash_and_flags(input, &hash, &flags);
+    rb_scan_args(argc, argv, "02", &interval, &count);
 
-    return ruby_libvirt_set_typed_parameters(c, hash, NUM2UINT(flags), NULL,
-                                             memory_allowed,
-                                             ARRAY_SIZE(memory_allowed),
-                                             node_memory_set);
+    ninterval = NIL_P(interval) ? 5 : NUM2INT(interval);
+    ncount = NIL_P(count) ? 3 : NUM2UINT(count);
+
+    if (!ruby_libvirt_event_impl_registered()) {
+        rb_raise(rb_eArgError,
+                 "no event loop; call Libvirt::native_event_loop_start before opening the connection");
+    }
+
+    conn = ruby_libvirt_connect_get(c);
+    data = connect_data(c);
+
+    if (data->health == NULL) {
+        health = calloc(1, sizeof(struct connect_health));
+        if (health == NULL) {
+            rb_memerror();
+        }
+        pthread_mutex_init(&health->lock, NULL);
+        health->refs = 2;
+        gettimeofday(&health->since, NULL);
+
+        r = virConnectRegisterCloseCallback(conn, connect_health_closed,
+                                            health, connect_health_free);
+        if (r < 0) {
+            pthread_mutex_destroy(&health->lock);
+            free(health);
+            ruby_libvirt_raise_error_if(1, e_Error,
+                                        "virConnectRegisterCloseCallback",
+                                        conn);
+        }
+        data->health = health;
+    }
+    health = data->health;
+
+    r = RUBY_LIBVIRT_CALL(virConnectSetKeepAlive, conn, ninterval, ncount);
+    ruby_libvirt_raise_error_if(r < 0, e_Error, "virConnectSetKeepAlive",
+                                conn);
+
+    pthread_mutex_lock(&health->lock);
+    health->interval = NIL_P(interval) ? 5 : NUM2INT(interval);
+    health->count = NIL_P(count) ? 3 : NUM2UINT(count);
+    if (health->state == CONNECT_HEALTH_UNKNOWN) {
+        /* r == 1 means the server does not support keepalives; the close
+         * callback still catches EOF and errors, so that is not fatal */
+        health->state = CONNECT_HEALTH_ALIVE;
+        gettimeofday(&health->since, NULL);
+    }
+    pthread_mutex_unlock(&health->lock);
+
+    return Qnil;
 }
 #endif
 
-#if HAVE_VIRNODEGETCPUMAP
-struct cpu_map_field_to_value {
-    VALUE result;
-    int cpu;
-    int used;
-};
-
-static VALUE cpu_map_field_to_value(VALUE input)
+#if HAVE_PTHREAD_H
+/*
+ * call-seq:
+ *   conn.set_governor(max_in_flight=0, rate=0, burst=0) -> nil
+ *
+ * Limit the calls this library makes concurrently on this connection, from
+ * its native worker threads (the bulk and parallel methods, and
+ * conn.throttle blocks) as well as from the ordinary methods of the
+ * connection and of the objects on it: at most max_in_flight at once, and
+ * no more than rate per second on average with bursts of up to burst
+ * (which defaults to rate).  Zero means no limit.  This keeps a single
+ * process from exceeding libvirtd's max_client_requests.  Waiting callers
+ * are admitted by lane (see conn.throttle); bulk reads use
+ * Libvirt::Connect::LANE_LOW, and bulk changes and ordinary calls
+ * LANE_NORMAL.  Waiting for the governor can be interrupted like any
+ * other blocking call.
+ */
+static VALUE libvirt_connect_set_governor(int argc, VALUE *argv, VALUE c)
 {
-    struct cpu_map_field_to_value *ftv = (struct cpu_map_field_to_value *)input;
-    char cpuname[10];
+    VALUE max_in_flight = RUBY_Qnil, rate = RUBY_Qnil, burst = RUBY_Qnil;
+    struct ruby_libvirt_connect *data;
+    struct ruby_libvirt_governor *gov;
+    int nmax;
+    double nrate, nburst;
+
+    rb_scan_args(argc, argv, "03", &max_in_flight, &rate, &burst);
+
+    nmax = ruby_libvirt_value_to_int(max_in_flight);
+    nrate = NIL_P(rate) ? 0 : NUM2DBL(rate);
+    nburst = NIL_P(burst) ? 0 : NUM2DBL(burst);
+    if (nmax < 0 || nrate < 0 || nburst < 0) {
+        rb_raise(rb_eArgError, "governor limits must not be negative");
+    }
+    if (nburst < 1) {
+        nburst = nrate < 1 ? 1 : nrate;
+    }
 
-    snprintf(cpuname, sizeof(cpuname), "%d", ftv->cpu);
-    rb_hash_aset(ftv->result, rb_str_new2(cpuname), ftv->used ? Qtrue : Qfalse);
+    data = connect_data(ruby_libvirt_conn_attr(c));
+    if (data->governor == NULL) {
+        gov = calloc(1, sizeof(struct ruby_libvirt_governor));
+        if (gov == NULL) {
+            rb_memerror();
+        }
+        pthread_mutex_init(&gov->lock, NULL);
+        pthread_cond_init(&gov->cond, NULL);
+        gov->refs = 1;
+        data->governor = gov;
+        connect_governed_add(data);
+    }
+    gov = data->governor;
+
+    pthread_mutex_lock(&gov->lock);
+    gov->max_in_flight = nmax;
+    gov->rate = nrate;
+    gov->burst = nburst;
+    gov->tokens = nburst;
+    gov->refilled = ruby_libvirt_monotonic_time();
+    pthread_cond_broadcast(&gov->cond);
+    pthread_mutex_unlock(&gov->lock);
 
     return Qnil;
 }
 
 /*
  * call-seq:
- *   conn.node_cpu_map -> Hash
+ *   conn.governor_stats -> Hash
  *
- * Call virNodeGetCPUMap[http://www.libvirt.org/html/libvirt-libvirt-host.html#virNodeGetCPUMap]
- * to get a map of online host CPUs.
+ * Return the limits set with conn.set_governor together with "in_flight"
+ * (calls currently admitted), "tokens" (left in the bucket) and "lanes",
+ * an Array indexed by lane of Hashes with "waiting" (queue depth),
+ * "acquired" (calls admitted so far), "wait_time" (total seconds spent
+ * waiting) and "max_wait".  Returns nil if no governor is set.
  */
-static VALUE libvirt_connect_node_cpu_map(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_governor_stats(VALUE c)
 {
-    VALUE flags, result;
-    unsigned char *map;
-    unsigned int online;
-    int ret, i, exception = 0;
-    struct cpu_map_field_to_value ftv;
+    struct ruby_libvirt_governor *gov, snap;
+    VALUE result, lanes, lane;
+    int i;
 
-    rb_scan_args(argc, argv, "01", &flags);
+    gov = connect_data(ruby_libvirt_conn_attr(c))->governor;
+    if (gov == NULL) {
+        return Qnil;
+    }
 
-    ret = virNodeGetCPUMap(ruby_libvirt_connect_get(c), &map, &online,
-                           ruby_libvirt_value_to_uint(flags));
-    ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError, "virNodeGetCPUMap",
-                                ruby_libvirt_connect_get(c));
+    pthread_mutex_lock(&gov->lock);
+    governor_refill(gov, ruby_libvirt_monotonic_time());
+    snap.max_in_flight = gov->max_in_flight;
+    snap.rate = gov->rate;
+    snap.burst = gov->burst;
+    snap.tokens = gov->tokens;
+    snap.in_flight = gov->in_flight;
+    memcpy(snap.waiting, gov->waiting, sizeof(snap.waiting));
+    memcpy(snap.acquired, gov->acquired, sizeof(snap.acquired));
+    memcpy(snap.wait_total, gov->wait_total, sizeof(snap.wait_total));
+    memcpy(snap.wait_max, gov->wait_max, sizeof(snap.wait_max));
+    pthread_mutex_unlock(&gov->lock);
 
     result = rb_hash_new();
-
-    for (i = 0; i < ret; i++) {
-        ftv.result = result;
-        ftv.cpu = i;
-        ftv.used = VIR_CPU_USED(map, i);
-        rb_protect(cpu_map_field_to_value, (VALUE)&ftv, &exception);
-        if (exception) {
-            free(map);
-            rb_jump_tag(exception);
-        }
+    rb_hash_aset(result, rb_str_new2("max_in_flight"),
+                 INT2NUM(snap.max_in_flight));
+    rb_hash_aset(result, rb_str_new2("rate"), rb_float_new(snap.rate));
+    rb_hash_aset(result, rb_str_new2("burst"), rb_float_new(snap.burst));
+    rb_hash_aset(result, rb_str_new2("in_flight"), INT2NUM(snap.in_flight));
+    rb_hash_aset(result, rb_str_new2("tokens"),
+                 snap.rate > 0 ? rb_float_new(snap.tokens) : Qnil);
+
+    lanes = rb_ary_new2(RUBY_LIBVIRT_NLANES);
+    for (i = 0; i < RUBY_LIBVIRT_NLANES; i++) {
+        lane = rb_hash_new();
+        rb_hash_aset(lane, rb_str_new2("waiting"), INT2NUM(snap.waiting[i]));
+        rb_hash_aset(lane, rb_str_new2("acquired"),
+                     ULL2NUM(snap.acquired[i]));
+        rb_hash_aset(lane, rb_str_new2("wait_time"),
+                     rb_float_new(snap.wait_total[i]));
+        rb_hash_aset(lane, rb_str_new2("max_wait"),
+                     rb_float_new(snap.wait_max[i]));
+        rb_ary_store(lanes, i, lane);
     }
+    rb_hash_aset(result, rb_str_new2("lanes"), lanes);
 
-    free(map);
+    return result;
+}
+
+struct connect_throttle_arg {
+    struct ruby_libvirt_governor *gov;
+    int lane;
+    volatile int cancel;
+    int acquired;
+};
+
+static void *connect_throttle_wait(void *arg)
+{
+    struct connect_throttle_arg *t = arg;
+
+    t->acquired = ruby_libvirt_governor_acquire(t->gov, t->lane,
+                                                &t->cancel) == 0;
+    return NULL;
+}
+
+static void connect_throttle_interrupt(void *arg)
+{
+    struct connect_throttle_arg *t = arg;
+
+    ruby_libvirt_governor_cancel(t->gov, &t->cancel);
+}
+
+/* The connections whose governor slot the current thread holds inside a
+ * conn.throttle block, innermost last. */
+static VALUE connect_throttle_held(int create)
+{
+    VALUE held;
+
+    held = rb_thread_local_aref(rb_thread_current(),
+                                rb_intern("libvirt_throttle"));
+    if (NIL_P(held) && create) {
+        held = rb_ary_new();
+        rb_thread_local_aset(rb_thread_current(),
+                             rb_intern("libvirt_throttle"), held);
+    }
 
-    return result;
+    return held;
 }
-#endif
 
-#if HAVE_VIRCONNECTSETKEEPALIVE
 /*
- * call-seq:
- *   conn.set_keepalive(interval, count) -> Fixnum
- *
- * Call virConnectSetKeepAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectSetKeepAlive]
- * to start sending keepalive messages.  Deprecated; use conn.keepalive=
- * instead.
+ * Return non-zero if the calling Ruby thread is inside a conn.throttle
+ * block on the connection of C.  Calls made on its behalf must then run
+ * within that slot rather than wait for another one, which may never come
+ * free.  Must be called with the GVL.
  */
-static VALUE libvirt_connect_set_keepalive(VALUE c, VALUE interval, VALUE count)
+int ruby_libvirt_governor_held(VALUE c)
 {
-    ruby_libvirt_generate_call_int(virConnectSetKeepAlive,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   NUM2INT(interval), NUM2UINT(count));
+    VALUE held;
+
+    held = connect_throttle_held(0);
+    return !NIL_P(held) &&
+        RTEST(rb_ary_includes(held, ruby_libvirt_conn_attr(c)));
 }
 
 /*
- * call-seq:
- *   conn.keepalive = interval,count
- *
- * Call virConnectSetKeepAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectSetKeepAlive]
- * to start sending keepalive messages.
+ * Return, with an extra reference, the governor of the connection whose
+ * virConnectPtr is P, or NULL if it has none, if P is NULL, or if the
+ * calling Ruby thread already holds a slot on it in a conn.throttle block.
+ * Must be called with the GVL.
  */
-static VALUE libvirt_connect_keepalive_equal(VALUE c, VALUE in)
+struct ruby_libvirt_governor *ruby_libvirt_governor_for(virConnectPtr p)
 {
-    VALUE interval, count;
+    struct ruby_libvirt_connect *data = NULL;
+    VALUE held;
+    long j;
+    int i;
 
-    Check_Type(in, T_ARRAY);
+    if (p == NULL) {
+        return NULL;
+    }
 
-    if (RARRAY_LEN(in) != 2) {
-        rb_raise(rb_eArgError, "wrong number of arguments (%ld for 2)",
-                 RARRAY_LEN(in));
+    for (i = 0; i < connect_ngoverned; i++) {
+        if (connect_governed[i]->conn == p) {
+            data = connect_governed[i];
+            break;
+        }
+    }
+    if (data == NULL) {
+        return NULL;
     }
 
-    interval = rb_ary_entry(in, 0);
-    count = rb_ary_entry(in, 1);
+    held = connect_throttle_held(0);
+    if (!NIL_P(held)) {
+        for (j = 0; j < RARRAY_LEN(held); j++) {
+            if (connect_data(rb_ary_entry(held, j))->conn == p) {
+                return NULL;
+            }
+        }
+    }
 
-    ruby_libvirt_generate_call_int(virConnectSetKeepAlive,
-                                   ruby_libvirt_connect_get(c),
-                                   ruby_libvirt_connect_get(c),
-                                   NUM2INT(interval), NUM2UINT(count));
+    pthread_mutex_lock(&data->governor->lock);
+    data->governor->refs++;
+    pthread_mutex_unlock(&data->governor->lock);
+
+    return data->governor;
 }
-#endif
 
-#if HAVE_VIRCONNECTLISTALLDOMAINS
-/*
- * call-seq:
- *   conn.list_all_domains(flags=0) -> Array
- *
- * Call virConnectListAllDomains[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectListAllDomains]
- * to get an array of domain objects for all domains.
- */
-static VALUE libvirt_connect_list_all_domains(int argc, VALUE *argv, VALUE c)
+static VALUE connect_throttle_release(VALUE arg)
 {
-    ruby_libvirt_generate_call_list_all(virDomainPtr, argc, argv,
-                                        virConnectListAllDomains,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_domain_new, virDomainFree);
+    struct connect_throttle_arg *t = (struct connect_throttle_arg *)arg;
+
+    rb_ary_pop(connect_throttle_held(0));
+    ruby_libvirt_governor_release(t->gov);
+    ruby_libvirt_governor_unref(t->gov);
+    return Qnil;
 }
-#endif
 
-#if HAVE_VIRCONNECTLISTALLNETWORKS
 /*
  * call-seq:
- *   conn.list_all_networks(flags=0) -> Array
+ *   conn.throttle(lane=Libvirt::Connect::LANE_NORMAL) { ... } -> result of block
  *
- * Call virConnectListAllNetworks[http://www.libvirt.org/html/libvirt-libvirt-network.html#virConnectListAllNetworks]
- * to get an array of network objects for all networks.
+ * Wait, without holding the GVL, until this connection's governor admits
+ * one more call in the given lane (Libvirt::Connect::LANE_HIGH,
+ * LANE_NORMAL or LANE_LOW), then run the block and return its value.  The
+ * block counts as a single in-flight call for its whole duration, so
+ * threads sharing a connection can put lifecycle operations ahead of
+ * stats collection.  Bulk calls on this connection made from inside the
+ * block run their calls one at a time within the block's slot rather than
+ * wait for slots of their own, and a nested conn.throttle on the same
+ * connection just runs its block.  Without a governor the block is run
+ * straight away.
  */
-static VALUE libvirt_connect_list_all_networks(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_throttle(int argc, VALUE *argv, VALUE c)
 {
-    ruby_libvirt_generate_call_list_all(virNetworkPtr, argc, argv,
-                                        virConnectListAllNetworks,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_network_new,
-                                        virNetworkFree);
+    VALUE lane = RUBY_Qnil;
+    struct connect_throttle_arg t;
+    int exception;
+
+    rb_scan_args(argc, argv, "01", &lane);
+
+    memset((void *)&t, 0, sizeof(t));
+    t.lane = NIL_P(lane) ? RUBY_LIBVIRT_LANE_NORMAL : NUM2INT(lane);
+    if (t.lane < 0 || t.lane >= RUBY_LIBVIRT_NLANES) {
+        rb_raise(rb_eArgError, "invalid lane %d", t.lane);
+    }
+    rb_need_block();
+
+    if (ruby_libvirt_governor_held(c)) {
+        return rb_yield(Qnil);
+    }
+
+    t.gov = ruby_libvirt_governor_get(c);
+    if (t.gov == NULL) {
+        return rb_yield(Qnil);
+    }
+
+    while (!t.acquired) {
+        t.cancel = 0;
+        exception = ruby_libvirt_without_gvl_cancellable(connect_throttle_wait,
+                                                         &t,
+                                                         connect_throttle_interrupt,
+                                                         &t);
+        if (exception == 0 && !t.acquired) {
+            /* interrupted; let Ruby raise or run signal handlers, then
+             * go back to waiting */
+            exception = ruby_libvirt_check_ints();
+        }
+        if (exception) {
+            ruby_libvirt_governor_unref(t.gov);
+            rb_jump_tag(exception);
+        }
+    }
+
+    rb_ary_push(connect_throttle_held(1), ruby_libvirt_conn_attr(c));
+
+    return rb_ensure(rb_yield, Qnil, connect_throttle_release, (VALUE)&t);
 }
 #endif
 
-#if HAVE_VIRCONNECTLISTALLINTERFACES
 /*
  * call-seq:
- *   conn.list_all_interfaces(flags=0) -> Array
+ *   conn.health -> Hash
  *
- * Call virConnectListAllInterfaces[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virConnectListAllInterfaces]
- * to get an array of interface objects for all interfaces.
+ * Return the liveness state recorded for this connection without making
+ * any call to the server.  The Hash has the keys "state" (one of
+ * Libvirt::Connect::HEALTH_UNKNOWN, HEALTH_ALIVE or HEALTH_DEAD), "reason"
+ * (a Libvirt::Connect::CLOSE_REASON_* constant once the connection has
+ * died, otherwise nil), "since" (the Time of the last state change),
+ * "interval" and "count" (the keepalive settings, or nil if
+ * conn.monitor_liveness has not been called) and "event_loop" (whether an
+ * event loop is available to drive keepalives).  State stays
+ * HEALTH_UNKNOWN until conn.monitor_liveness is called.
  */
-static VALUE libvirt_connect_list_all_interfaces(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_health(VALUE c)
 {
-    ruby_libvirt_generate_call_list_all(virInterfacePtr, argc, argv,
-                                        virConnectListAllInterfaces,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_interface_new,
-                                        virInterfaceFree);
-}
+    struct ruby_libvirt_connect *data;
+    VALUE result;
+    int state = CONNECT_HEALTH_UNKNOWN;
+    VALUE reason = Qnil, since = Qnil, interval = Qnil, count = Qnil;
+
+    data = connect_data(ruby_libvirt_conn_attr(c));
+
+#if HAVE_VIRCONNECTREGISTERCLOSECALLBACK && HAVE_PTHREAD_H
+    if (data->health && !connect_stale(data)) {
+        struct connect_health *health = data->health;
+        struct timeval tv;
+        int r;
+
+        pthread_mutex_lock(&health->lock);
+        state = health->state;
+        r = health->reason;
+        tv = health->since;
+        interval = INT2NUM(health->interval);
+        count = UINT2NUM(health->count);
+        pthread_mutex_unlock(&health->lock);
+
+        if (state == CONNECT_HEALTH_DEAD) {
+            reason = INT2NUM(r);
+        }
+        since = rb_time_new(tv.tv_sec, tv.tv_usec);
+    }
 #endif
+    if (data->conn == NULL) {
+        state = CONNECT_HEALTH_DEAD;
+        reason = Qnil;
+    }
 
-#if HAVE_VIRCONNECTLISTALLSECRETS
-/*
- * call-seq:
- *   conn.list_all_secrets(flags=0) -> Array
- *
- * Call virConnectListAllSecrets[http://www.libvirt.org/html/libvirt-libvirt-secret.html#virConnectListAllSecrets]
- * to get an array of secret objects for all secrets.
- */
-static VALUE libvirt_connect_list_all_secrets(int argc, VALUE *argv, VALUE c)
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("state"), INT2NUM(state));
+    rb_hash_aset(result, rb_str_new2("reason"), reason);
+    rb_hash_aset(result, rb_str_new2("since"), since);
+    rb_hash_aset(result, rb_str_new2("interval"), interval);
+    rb_hash_aset(result, rb_str_new2("count"), count);
+    rb_hash_aset(result, rb_str_new2("event_loop"),
+                 ruby_libvirt_event_impl_registered() ? Qtrue : Qfalse);
+
+    return result;
+}
+
+#if HAVE_VIRDOMAINSETBLOCKTHRESHOLD && HAVE_PTHREAD_H
+static struct connect_autoextend *connect_autoextend_get(VALUE c)
 {
-    ruby_libvirt_generate_call_list_all(virSecretPtr, argc, argv,
-                                        virConnectListAllSecrets,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_secret_new, virSecretFree);
+    struct ruby_libvirt_connect *data;
+    struct connect_autoextend *ae;
+    virConnectPtr conn;
+
+    conn = ruby_libvirt_connect_get(c);
+    data = connect_data(ruby_libvirt_conn_attr(c));
+    if (data->autoextend != NULL) {
+        return data->autoextend;
+    }
+
+    ae = calloc(1, sizeof(struct connect_autoextend));
+    if (ae == NULL) {
+        rb_memerror();
+    }
+    pthread_mutex_init(&ae->lock, NULL);
+    ae->refs = 2;
+
+    ae->callback_id = virConnectDomainEventRegisterAny(conn, NULL,
+                                                       VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD,
+                                                       VIR_DOMAIN_EVENT_CALLBACK(autoextend_threshold_callback),
+                                                       ae,
+                                                       connect_autoextend_free);
+    if (ae->callback_id < 0) {
+        pthread_mutex_destroy(&ae->lock);
+        free(ae);
+        ruby_libvirt_raise_error_if(1, e_Error,
+                                    "virConnectDomainEventRegisterAny", conn);
+    }
+    data->autoextend = ae;
+
+    return ae;
 }
-#endif
 
-#if HAVE_VIRCONNECTLISTALLNODEDEVICES
+#if HAVE_LIBXML_PARSER_H
 /*
- * call-seq:
- *   conn.list_all_nodedevices(flags=0) -> Array
- *
- * Call virConnectListAllNodeDevices[http://www.libvirt.org/html/libvirt-libvirt-nodedev.html#virConnectListAllNodeDevices]
- * to get an array of nodedevice objects for all nodedevices.
+ * Return 1 if DISK (a target name or source path) of the domain described
+ * by XML is a block device or a storage pool volume, 0 if it is some other
+ * kind of disk and -1 if there is no such disk.  Unless it returns -1,
+ * NAME is set to the disk's target name, which is what BLOCK_THRESHOLD
+ * events report, or to NULL if out of memory; the caller frees it.
  */
-static VALUE libvirt_connect_list_all_nodedevices(int argc, VALUE *argv,
-                                                  VALUE c)
+static int autoextend_disk_is_block(const char *xml, const char *disk,
+                                    char **name)
 {
-    ruby_libvirt_generate_call_list_all(virNodeDevicePtr, argc, argv,
-                                        virConnectListAllNodeDevices,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_nodedevice_new,
-                                        virNodeDeviceFree);
+    xmlDocPtr doc;
+    xmlNodePtr cur, target, source;
+    char *type, *dev, *file, *bdev;
+    int found = -1;
+
+    doc = ruby_libvirt_xml_parse(xml);
+    if (doc == NULL) {
+        return -1;
+    }
+
+    ruby_libvirt_xml_foreach_child(ruby_libvirt_xml_child(xmlDocGetRootElement(doc),
+                                                          "devices"),
+                                   cur, "disk") {
+        target = ruby_libvirt_xml_child(cur, "target");
+        source = ruby_libvirt_xml_child(cur, "source");
+        dev = ruby_libvirt_xml_prop_cstr(target, "dev");
+        file = ruby_libvirt_xml_prop_cstr(source, "file");
+        bdev = ruby_libvirt_xml_prop_cstr(source, "dev");
+        if ((dev != NULL && strcmp(dev, disk) == 0) ||
+            (file != NULL && strcmp(file, disk) == 0) ||
+            (bdev != NULL && strcmp(bdev, disk) == 0)) {
+            type = ruby_libvirt_xml_prop_cstr(cur, "type");
+            found = type != NULL && (strcmp(type, "block") == 0 ||
+                                     strcmp(type, "volume") == 0);
+            free(type);
+            *name = dev;
+            dev = NULL;
+        }
+        free(dev);
+        free(file);
+        free(bdev);
+        if (found >= 0) {
+            break;
+        }
+    }
+    xmlFreeDoc(doc);
+
+    return found;
 }
 #endif
 
-#if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS
 /*
  * call-seq:
- *   conn.list_all_storage_pools(flags=0) -> Array
+ *   conn.block_auto_extend(dom, disk, headroom, increment, max_size=0) -> nil
  *
- * Call virConnectListAllStoragePools[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virConnectListAllStoragePools]
- * to get an array of storage pool objects for all storage pools.
+ * Have disk of dom grown automatically before the guest runs out of space,
+ * instead of polling dom.blockinfo.  This arms a threshold with
+ * virDomainSetBlockThreshold[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetBlockThreshold]
+ * headroom bytes below the current physical size of disk.  When the guest
+ * writes past it, a native DOMAIN_EVENT_ID_BLOCK_THRESHOLD handler grows the
+ * block storage volume backing disk (typically a thin LV under a qcow2
+ * image) by increment bytes with virStorageVolResize, up to max_size if
+ * that is not 0, and arms the threshold again.  disk may be the target name
+ * ("vda") or, if the bindings were built with libxml2, the source path of
+ * the disk.  Only disks on a block device or logical volume in a libvirt
+ * storage pool can be extended;
+ * ArgumentError is raised for a file-backed disk.  The resize runs on a
+ * worker thread, not in the handler, and no Ruby code runs in either, so
+ * this works with Libvirt::native_event_loop_start as well as with an
+ * event loop registered with Libvirt::event_register_impl; one of them must
+ * be running.  Calling this again for the same disk replaces its settings.
  */
-static VALUE libvirt_connect_list_all_storage_pools(int argc, VALUE *argv,
-                                                    VALUE c)
+static VALUE libvirt_connect_block_auto_extend(int argc, VALUE *argv, VALUE c)
 {
-    ruby_libvirt_generate_call_list_all(virStoragePoolPtr, argc, argv,
-                                        virConnectListAllStoragePools,
-                                        ruby_libvirt_connect_get(c), c,
-                                        pool_new, virStoragePoolFree);
-}
+    VALUE dom, disk, headroom, increment, max_size;
+    struct connect_autoextend *ae;
+    struct autoextend_rule rule;
+    virDomainBlockInfo info;
+    virDomainPtr domain;
+#if HAVE_LIBXML_PARSER_H
+    char *xml;
 #endif
+    int i, r;
+
+    rb_scan_args(argc, argv, "41", &dom, &disk, &headroom, &increment,
+                 &max_size);
+
+    domain = ruby_libvirt_domain_get(dom);
+    memset(&rule, 0, sizeof(rule));
+    rule.headroom = NUM2ULL(headroom);
+    rule.increment = NUM2ULL(increment);
+    rule.max_size = NIL_P(max_size) ? 0 : NUM2ULL(max_size);
+    if (rule.increment == 0) {
+        rb_raise(rb_eArgError, "increment must be greater than 0");
+    }
+
+    if (!ruby_libvirt_event_impl_registered()) {
+        rb_raise(rb_eArgError,
+                 "no event loop; call Libvirt::native_event_loop_start before opening the connection");
+    }
+
+    r = virDomainGetUUID(domain, rule.uuid);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetUUID",
+                                ruby_libvirt_connect_get(c));
+    r = RUBY_LIBVIRT_CALL(virDomainGetBlockInfo, domain, StringValueCStr(disk),
+                          &info, 0);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virDomainGetBlockInfo",
+                                ruby_libvirt_connect_get(c));
+    if (rule.headroom >= info.physical) {
+        rb_raise(rb_eArgError, "headroom must be smaller than the size of %s",
+                 StringValueCStr(disk));
+    }
+
+    ae = connect_autoextend_get(c);
+
+#if HAVE_LIBXML_PARSER_H
+    xml = RUBY_LIBVIRT_CALL(virDomainGetXMLDesc, domain, 0);
+    ruby_libvirt_raise_error_if(xml == NULL, e_RetrieveError,
+                                "virDomainGetXMLDesc",
+                                ruby_libvirt_connect_get(c));
+    r = autoextend_disk_is_block(xml, StringValueCStr(disk), &rule.dev);
+    free(xml);
+    if (r == 0) {
+        free(rule.dev);
+        rb_raise(rb_eArgError,
+                 "%s is not backed by a block device or logical volume",
+                 StringValueCStr(disk));
+    }
+    if (r > 0 && rule.dev == NULL) {
+        rb_memerror();
+    }
+#endif
+
+    /* rules are kept by target name, since that is what the threshold
+     * event reports even if disk was given as a path */
+    if (rule.dev == NULL) {
+        rule.dev = strdup(StringValueCStr(disk));
+        if (rule.dev == NULL) {
+            rb_memerror();
+        }
+    }
+
+    pthread_mutex_lock(&ae->lock);
+    i = autoextend_find(ae, rule.uuid, rule.dev);
+    if (i >= 0) {
+        free(ae->rules[i].dev);
+        ae->rules[i] = rule;
+    }
+    else {
+        struct autoextend_rule *rules;
+
+        rules = realloc(ae->rules, sizeof(rule) * (ae->nrules + 1));
+        if (rules == NULL) {
+            pthread_mutex_unlock(&ae->lock);
+            free(rule.dev);
+            rb_memerror();
+        }
+        ae->rules = rules;
+        ae->rules[ae->nrules++] = rule;
+    }
+    pthread_mutex_unlock(&ae->lock);
+
+    r = RUBY_LIBVIRT_CALL(virDomainSetBlockThreshold, domain,
+                          StringValueCStr(disk), info.physical - rule.headroom,
+                          0);
+    ruby_libvirt_raise_error_if(r < 0, e_Error, "virDomainSetBlockThreshold",
+                                ruby_libvirt_connect_get(c));
+
+    return Qnil;
+}
 
-#if HAVE_VIRCONNECTLISTALLNWFILTERS
 /*
  * call-seq:
- *   conn.list_all_nwfilters(flags=0) -> Array
+ *   conn.block_auto_extend_cancel(dom, disk) -> [True|False]
  *
- * Call virConnectListAllNWFilters[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virConnectListAllNWFilters]
- * to get an array of nwfilters for all nwfilter objects.
+ * Stop growing disk of dom automatically and clear its threshold.  As for
+ * conn.block_auto_extend, disk may be the target name or the source path.
+ * Returns +false+ if conn.block_auto_extend was not in effect for disk.
  */
-static VALUE libvirt_connect_list_all_nwfilters(int argc, VALUE *argv, VALUE c)
+static VALUE libvirt_connect_block_auto_extend_cancel(VALUE c, VALUE dom,
+                                                      VALUE disk)
 {
-    ruby_libvirt_generate_call_list_all(virNWFilterPtr, argc, argv,
-                                        virConnectListAllNWFilters,
-                                        ruby_libvirt_connect_get(c), c,
-                                        ruby_libvirt_nwfilter_new,
-                                        virNWFilterFree);
-}
+    struct ruby_libvirt_connect *data;
+    struct connect_autoextend *ae;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    virDomainPtr domain;
+    char *dev = NULL;
+#if HAVE_LIBXML_PARSER_H
+    char *xml;
 #endif
+    int i, r;
+
+    domain = ruby_libvirt_domain_get(dom);
+    data = connect_data(ruby_libvirt_conn_attr(c));
+    ae = data->autoextend;
+    if (ae == NULL) {
+        return Qfalse;
+    }
+
+    r = virDomainGetUUID(domain, uuid);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetUUID",
+                                ruby_libvirt_connect_get(c));
+
+#if HAVE_LIBXML_PARSER_H
+    xml = RUBY_LIBVIRT_CALL(virDomainGetXMLDesc, domain, 0);
+    ruby_libvirt_raise_error_if(xml == NULL, e_RetrieveError,
+                                "virDomainGetXMLDesc",
+                                ruby_libvirt_connect_get(c));
+    r = autoextend_disk_is_block(xml, StringValueCStr(disk), &dev);
+    free(xml);
+    if (r >= 0 && dev == NULL) {
+        rb_memerror();
+    }
+#endif
+
+    pthread_mutex_lock(&ae->lock);
+    i = autoextend_find(ae, uuid, dev != NULL ? dev : StringValueCStr(disk));
+    if (i >= 0) {
+        free(ae->rules[i].dev);
+        ae->rules[i] = ae->rules[--ae->nrules];
+    }
+    pthread_mutex_unlock(&ae->lock);
+    free(dev);
+    if (i < 0) {
+        return Qfalse;
+    }
+
+    r = RUBY_LIBVIRT_CALL(virDomainSetBlockThreshold, domain,
+                          StringValueCStr(disk), 0, 0);
+    ruby_libvirt_raise_error_if(r < 0, e_Error, "virDomainSetBlockThreshold",
+                                ruby_libvirt_connect_get(c));
+
+    return Qtrue;
+}
 
-#if HAVE_VIRCONNECTISALIVE
 /*
  * call-seq:
- *   conn.alive? -> [True|False]
+ *   conn.block_auto_extend_stats -> Hash
  *
- * Call virConnectIsAlive[http://www.libvirt.org/html/libvirt-libvirt-host.html#virConnectIsAlive]
- * to determine if the connection is alive.
+ * Return what the conn.block_auto_extend handler has done so far: "disks"
+ * (the number of disks being watched), "extended" (successful extensions),
+ * "at_limit" (thresholds crossed by disks already at their max_size),
+ * "failed" (extensions that failed, after which that disk is no longer
+ * watched until conn.block_auto_extend is called for it again) and
+ * "last_error" (the libvirt error message of the latest failure, or nil).
  */
-static VALUE libvirt_connect_alive_p(VALUE c)
+static VALUE libvirt_connect_block_auto_extend_stats(VALUE c)
 {
-    ruby_libvirt_generate_call_truefalse(virConnectIsAlive,
-                                         ruby_libvirt_connect_get(c),
-                                         ruby_libvirt_connect_get(c));
+    struct ruby_libvirt_connect *data;
+    struct connect_autoextend *ae;
+    unsigned long long extended = 0, failed = 0, at_limit = 0;
+    int nrules = 0;
+    VALUE result, last_error = Qnil;
+
+    data = connect_data(ruby_libvirt_conn_attr(c));
+    ae = data->autoextend;
+    if (ae != NULL) {
+        pthread_mutex_lock(&ae->lock);
+        nrules = ae->nrules;
+        extended = ae->extended;
+        failed = ae->failed;
+        at_limit = ae->at_limit;
+        if (ae->last_error != NULL) {
+            last_error = rb_str_new2(ae->last_error);
+        }
+        pthread_mutex_unlock(&ae->lock);
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("disks"), INT2NUM(nrules));
+    rb_hash_aset(result, rb_str_new2("extended"), ULL2NUM(extended));
+    rb_hash_aset(result, rb_str_new2("at_limit"), ULL2NUM(at_limit));
+    rb_hash_aset(result, rb_str_new2("failed"), ULL2NUM(failed));
+    rb_hash_aset(result, rb_str_new2("last_error"), last_error);
+
+    return result;
 }
 #endif
 
@@ -2595,10 +5159,10 @@ static VALUE libvirt_connect_create_domain_xml_with_files(int argc, VALUE *argv,
         rb_raise(rb_eTypeError, "wrong argument type (expected Array)");
     }
 
-    dom = virDomainCreateXMLWithFiles(ruby_libvirt_connect_get(c),
-                                      ruby_libvirt_get_cstring_or_null(xml),
-                                      numfiles, files,
-                                      ruby_libvirt_value_to_uint(flags));
+    dom = RUBY_LIBVIRT_CALL(virDomainCreateXMLWithFiles,
+                            ruby_libvirt_connect_get(c),
+                            ruby_libvirt_get_cstring_or_null(xml), numfiles,
+                            files, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(dom == NULL, e_Error,
                                 "virDomainCreateXMLWithFiles",
                                 ruby_libvirt_connect_get(c));
@@ -2622,8 +5186,8 @@ static VALUE libvirt_connect_qemu_attach(int argc, VALUE *argv, VALUE c)
 
     rb_scan_args(argc, argv, "11", &pid, &flags);
 
-    dom = virDomainQemuAttach(ruby_libvirt_connect_get(c), NUM2UINT(pid),
-                              ruby_libvirt_value_to_uint(flags));
+    dom = RUBY_LIBVIRT_CALL(virDomainQemuAttach, ruby_libvirt_connect_get(c),
+                            NUM2UINT(pid), ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(dom == NULL, e_Error, "virDomainQemuAttach",
                                 ruby_libvirt_connect_get(c));
 
@@ -2649,9 +5213,10 @@ static VALUE libvirt_connect_cpu_model_names(int argc, VALUE *argv, VALUE c)
 
     rb_scan_args(argc, argv, "11", &arch, &flags);
 
-    elems = virConnectGetCPUModelNames(ruby_libvirt_connect_get(c),
-                                       StringValueCStr(arch), &models,
-                                       ruby_libvirt_value_to_uint(flags));
+    elems = RUBY_LIBVIRT_CALL(virConnectGetCPUModelNames,
+                              ruby_libvirt_connect_get(c),
+                              StringValueCStr(arch), &models,
+                              ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(elems < 0, e_RetrieveError,
                                 "virConnectGetCPUModelNames",
                                 ruby_libvirt_connect_get(c));
@@ -2743,9 +5308,9 @@ static VALUE libvirt_connect_node_alloc_pages(int argc, VALUE *argv, VALUE c)
         cell_count = NUM2UINT(tmp);
     }
 
-    ret = virNodeAllocPages(ruby_libvirt_connect_get(c), arraylen, page_sizes,
-                            page_counts, start_cell, cell_count,
-                            ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virNodeAllocPages, ruby_libvirt_connect_get(c),
+                            arraylen, page_sizes, page_counts, start_cell,
+                            cell_count, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_Error,
                                 "virNodeAllocPages",
                                 ruby_libvirt_connect_get(c));
@@ -2812,9 +5377,9 @@ static VALUE libvirt_connect_node_free_pages(int argc, VALUE *argv, VALUE c)
 
     counts = alloca(npages * cellCount * sizeof(long long));
 
-    ret = virNodeGetFreePages(ruby_libvirt_connect_get(c), npages, pages,
-                              startCell, cellCount, counts,
-                              ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virNodeGetFreePages, ruby_libvirt_connect_get(c),
+                            npages, pages, startCell, cellCount, counts,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_Error, "virNodeGetFreePages",
                                 ruby_libvirt_connect_get(c));
 
@@ -2833,6 +5398,11 @@ static VALUE libvirt_connect_node_free_pages(int argc, VALUE *argv, VALUE c)
 void ruby_libvirt_connect_init(void)
 {
     c_connect = rb_define_class_under(m_libvirt, "Connect", rb_cObject);
+    id_reopens = rb_intern("reopens");
+
+#if HAVE_PTHREAD_H
+    pthread_atfork(NULL, NULL, connect_atfork_child);
+#endif
 
     /*
      * Class Libvirt::Connect::Nodeinfo
@@ -2858,6 +5428,8 @@ void ruby_libvirt_connect_init(void)
 
     rb_define_method(c_connect, "close", libvirt_connect_close, 0);
     rb_define_method(c_connect, "closed?", libvirt_connect_closed_p, 0);
+    rb_define_method(c_connect, "stale?", libvirt_connect_stale_p, 0);
+    rb_define_method(c_connect, "reopen", libvirt_connect_reopen, 0);
     rb_define_method(c_connect, "type", libvirt_connect_type, 0);
     rb_define_method(c_connect, "version", libvirt_connect_version, 0);
 #if HAVE_VIRCONNECTGETLIBVERSION
@@ -2886,6 +5458,10 @@ void ruby_libvirt_connect_init(void)
 #endif
     rb_define_method(c_connect, "capabilities", libvirt_connect_capabilities,
                      0);
+#if HAVE_LIBXML_PARSER_H
+    rb_define_method(c_connect, "capabilities_model",
+                     libvirt_connect_capabilities_model, -1);
+#endif
 
 #if HAVE_VIRCONNECTCOMPARECPU
     rb_define_const(c_connect, "CPU_COMPARE_ERROR",
@@ -3044,6 +5620,14 @@ void ruby_libvirt_connect_init(void)
     rb_define_const(c_connect, "DOMAIN_EVENT_ID_CONTROL_ERROR",
                     INT2NUM(VIR_DOMAIN_EVENT_ID_CONTROL_ERROR));
 #endif
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD
+    rb_define_const(c_connect, "DOMAIN_EVENT_ID_BLOCK_THRESHOLD",
+                    INT2NUM(VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_EVENT_ID_METADATA_CHANGE
+    rb_define_const(c_connect, "DOMAIN_EVENT_ID_METADATA_CHANGE",
+                    INT2NUM(VIR_DOMAIN_EVENT_ID_METADATA_CHANGE));
+#endif
 #if HAVE_CONST_VIR_DOMAIN_EVENT_SHUTDOWN
     rb_define_const(c_connect, "DOMAIN_EVENT_SHUTDOWN",
                     INT2NUM(VIR_DOMAIN_EVENT_SHUTDOWN));
@@ -3192,6 +5776,10 @@ void ruby_libvirt_connect_init(void)
                      libvirt_connect_list_nodedevices, -1);
     rb_define_method(c_connect, "lookup_nodedevice_by_name",
                      libvirt_connect_lookup_nodedevice_by_name, 1);
+    rb_define_method(c_connect, "detach_node_devices",
+                     libvirt_connect_detach_node_devices, -1);
+    rb_define_method(c_connect, "reattach_node_devices",
+                     libvirt_connect_reattach_node_devices, -1);
 #if HAVE_VIRNODEDEVICECREATEXML
     rb_define_method(c_connect, "create_nodedevice_xml",
                      libvirt_connect_create_nodedevice_xml, -1);
@@ -3222,6 +5810,8 @@ void ruby_libvirt_connect_init(void)
                      libvirt_connect_lookup_secret_by_uuid, 1);
     rb_define_method(c_connect, "lookup_secret_by_usage",
                      libvirt_connect_lookup_secret_by_usage, 2);
+    rb_define_method(c_connect, "secret_values",
+                     libvirt_connect_secret_values, -1);
     rb_define_method(c_connect, "define_secret_xml",
                      libvirt_connect_define_secret_xml, -1);
 #endif
@@ -3262,6 +5852,8 @@ void ruby_libvirt_connect_init(void)
                      libvirt_connect_interface_change_commit, -1);
     rb_define_method(c_connect, "interface_change_rollback",
                      libvirt_connect_interface_change_rollback, -1);
+    rb_define_method(c_connect, "interface_transaction",
+                     libvirt_connect_interface_transaction, -1);
 #endif
 
 #if HAVE_VIRNODEGETCPUSTATS
@@ -3352,6 +5944,42 @@ void ruby_libvirt_connect_init(void)
     rb_define_method(c_connect, "list_all_domains",
                      libvirt_connect_list_all_domains, -1);
 #endif
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_ACTIVE",
+                    INT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE));
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_INACTIVE",
+                    INT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE));
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_RUNNING",
+                    INT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_RUNNING));
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_PAUSED",
+                    INT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_PAUSED));
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_SHUTOFF",
+                    INT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF));
+    rb_define_const(c_connect, "GET_ALL_DOMAINS_STATS_ENFORCE_STATS",
+                    UINT2NUM(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS));
+#endif
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_PERF
+    rb_define_method(c_connect, "domain_perf_stats",
+                     libvirt_connect_domain_perf_stats, -1);
+#endif
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_BALLOON
+    rb_define_method(c_connect, "domain_memory_stats",
+                     libvirt_connect_domain_memory_stats, -1);
+#endif
+#if HAVE_VIRDOMAINGETMETADATA && HAVE_VIRCONNECTLISTALLDOMAINS && HAVE_LIBXML_PARSER_H
+    rb_define_method(c_connect, "domain_metadata",
+                     libvirt_connect_domain_metadata, -1);
+#endif
+#if HAVE_VIRDOMAINSETMETADATA
+    rb_define_method(c_connect, "set_domain_metadata",
+                     libvirt_connect_set_domain_metadata, -1);
+#endif
+#if HAVE_VIRDOMAINMANAGEDSAVE && HAVE_VIRCONNECTLISTALLDOMAINS
+    rb_define_method(c_connect, "managed_save_domains",
+                     libvirt_connect_managed_save_domains, -1);
+    rb_define_method(c_connect, "managed_restore_domains",
+                     libvirt_connect_managed_restore_domains, -1);
+#endif
 #if HAVE_VIRCONNECTLISTALLNETWORKS
     rb_define_const(c_connect, "LIST_NETWORKS_ACTIVE",
                     INT2NUM(VIR_CONNECT_LIST_NETWORKS_ACTIVE));
@@ -3368,6 +5996,10 @@ void ruby_libvirt_connect_init(void)
     rb_define_method(c_connect, "list_all_networks",
                      libvirt_connect_list_all_networks, -1);
 #endif
+#if HAVE_VIRNETWORKGETDHCPLEASES
+    rb_define_method(c_connect, "dhcp_lease_index",
+                     libvirt_connect_dhcp_lease_index, -1);
+#endif
 #if HAVE_VIRCONNECTLISTALLINTERFACES
     rb_define_const(c_connect, "LIST_INTERFACES_INACTIVE",
                     INT2NUM(VIR_CONNECT_LIST_INTERFACES_INACTIVE));
@@ -3420,6 +6052,10 @@ void ruby_libvirt_connect_init(void)
     rb_define_method(c_connect, "list_all_nodedevices",
                      libvirt_connect_list_all_nodedevices, -1);
 #endif
+#if HAVE_VIRCONNECTLISTALLNODEDEVICES && HAVE_LIBXML_PARSER_H
+    rb_define_method(c_connect, "nodedevice_inventory",
+                     libvirt_connect_nodedevice_inventory, -1);
+#endif
 #if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS
     rb_define_const(c_connect, "LIST_STORAGE_POOLS_INACTIVE",
                     INT2NUM(VIR_CONNECT_LIST_STORAGE_POOLS_INACTIVE));
@@ -3464,13 +6100,67 @@ void ruby_libvirt_connect_init(void)
     rb_define_const(c_connect, "LIST_STORAGE_POOLS_ZFS",
                     INT2NUM(VIR_CONNECT_LIST_STORAGE_POOLS_ZFS));
 #endif
+#if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS && HAVE_VIRSTORAGEPOOLLISTALLVOLUMES
+    rb_define_method(c_connect, "storage_capacity_report",
+                     libvirt_connect_storage_capacity_report, -1);
+#endif
 #if HAVE_VIRCONNECTLISTALLNWFILTERS
     rb_define_method(c_connect, "list_all_nwfilters",
                      libvirt_connect_list_all_nwfilters, -1);
 #endif
+#if HAVE_TYPE_VIRNWFILTERPTR && HAVE_LIBXML_PARSER_H
+    rb_define_method(c_connect, "sync_nwfilters",
+                     libvirt_connect_sync_nwfilters, -1);
+#endif
+#if HAVE_VIRCONNECTLISTALLNWFILTERBINDINGS
+    rb_define_method(c_connect, "list_all_nwfilter_bindings",
+                     libvirt_connect_list_all_nwfilter_bindings, -1);
+    rb_define_method(c_connect, "lookup_nwfilter_binding_by_port_dev",
+                     libvirt_connect_lookup_nwfilter_binding_by_port_dev, 1);
+    rb_define_method(c_connect, "create_nwfilter_binding_xml",
+                     libvirt_connect_create_nwfilter_binding_xml, -1);
+#endif
 #if HAVE_VIRCONNECTISALIVE
     rb_define_method(c_connect, "alive?", libvirt_connect_alive_p, 0);
 #endif
+
+    rb_define_const(c_connect, "HEALTH_UNKNOWN",
+                    INT2NUM(CONNECT_HEALTH_UNKNOWN));
+    rb_define_const(c_connect, "HEALTH_ALIVE", INT2NUM(CONNECT_HEALTH_ALIVE));
+    rb_define_const(c_connect, "HEALTH_DEAD", INT2NUM(CONNECT_HEALTH_DEAD));
+    rb_define_method(c_connect, "health", libvirt_connect_health, 0);
+
+    rb_define_const(c_connect, "LANE_HIGH", INT2NUM(RUBY_LIBVIRT_LANE_HIGH));
+    rb_define_const(c_connect, "LANE_NORMAL",
+                    INT2NUM(RUBY_LIBVIRT_LANE_NORMAL));
+    rb_define_const(c_connect, "LANE_LOW", INT2NUM(RUBY_LIBVIRT_LANE_LOW));
+#if HAVE_PTHREAD_H
+    rb_define_method(c_connect, "set_governor", libvirt_connect_set_governor,
+                     -1);
+    rb_define_method(c_connect, "governor_stats",
+                     libvirt_connect_governor_stats, 0);
+    rb_define_method(c_connect, "throttle", libvirt_connect_throttle, -1);
+#endif
+#if HAVE_VIRCONNECTREGISTERCLOSECALLBACK && HAVE_PTHREAD_H
+    rb_define_const(c_connect, "CLOSE_REASON_ERROR",
+                    INT2NUM(VIR_CONNECT_CLOSE_REASON_ERROR));
+    rb_define_const(c_connect, "CLOSE_REASON_EOF",
+                    INT2NUM(VIR_CONNECT_CLOSE_REASON_EOF));
+    rb_define_const(c_connect, "CLOSE_REASON_KEEPALIVE",
+                    INT2NUM(VIR_CONNECT_CLOSE_REASON_KEEPALIVE));
+    rb_define_const(c_connect, "CLOSE_REASON_CLIENT",
+                    INT2NUM(VIR_CONNECT_CLOSE_REASON_CLIENT));
+    rb_define_method(c_connect, "monitor_liveness",
+                     libvirt_connect_monitor_liveness, -1);
+#endif
+#if HAVE_VIRDOMAINSETBLOCKTHRESHOLD && HAVE_PTHREAD_H
+    rb_define_method(c_connect, "block_auto_extend",
+                     libvirt_connect_block_auto_extend, -1);
+    rb_define_method(c_connect, "block_auto_extend_cancel",
+                     libvirt_connect_block_auto_extend_cancel, 2);
+    rb_define_method(c_connect, "block_auto_extend_stats",
+                     libvirt_connect_block_auto_extend_stats, 0);
+#endif
 #if HAVE_VIRDOMAINCREATEXMLWITHFILES
     rb_define_method(c_connect, "create_domain_xml_with_files",
                      libvirt_connect_create_domain_xml_with_files, -1);
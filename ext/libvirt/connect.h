@@ -4,9 +4,25 @@
 void ruby_libvirt_connect_init(void);
 
 VALUE ruby_libvirt_connect_new(virConnectPtr p);
+VALUE ruby_libvirt_connect_open(virConnectPtr p, const char *uri,
+                                int read_only, int auth, unsigned int flags);
 virConnectPtr ruby_libvirt_connect_get(VALUE s);
+virConnectPtr ruby_libvirt_connect_reopened(VALUE obj);
+void ruby_libvirt_connect_stamp(VALUE obj);
+virConnectPtr ruby_libvirt_connect_reopened_since(VALUE obj);
 VALUE ruby_libvirt_conn_attr(VALUE s);
 
+struct ruby_libvirt_governor;
+struct ruby_libvirt_governor *ruby_libvirt_governor_get(VALUE c);
+void ruby_libvirt_governor_unref(struct ruby_libvirt_governor *gov);
+int ruby_libvirt_governor_acquire(struct ruby_libvirt_governor *gov,
+                                  int lane, volatile int *cancel);
+void ruby_libvirt_governor_release(struct ruby_libvirt_governor *gov);
+int ruby_libvirt_governor_held(VALUE c);
+struct ruby_libvirt_governor *ruby_libvirt_governor_for(virConnectPtr p);
+void ruby_libvirt_governor_cancel(struct ruby_libvirt_governor *gov,
+                                  volatile int *cancel);
+
 extern VALUE c_node_security_model;
 
 #endif
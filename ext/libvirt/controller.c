@@ -0,0 +1,574 @@
+/*
+ * controller.c: the thread and lifecycle shared by the native controllers
+ *
+ * Copyright (C) 2013-2016 Chris Lalancette <clalancette@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#include "common.h"
+#include "connect.h"
+#include "domain.h"
+#include "controller.h"
+
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_PTHREAD_H
+
+/*
+ * A native controller runs its own thread, which every interval calls the
+ * controller's cycle without ever taking the GVL.  Ruby only changes the
+ * policy and reads the counters, under the controller's lock.  The
+ * controller is shared between the Ruby object and the thread, and freed
+ * by whichever lets go last.
+ */
+
+static void controller_filter_free(virDomainPtr *filter)
+{
+    int i;
+
+    if (filter == NULL) {
+        return;
+    }
+    for (i = 0; filter[i] != NULL; i++) {
+        virDomainFree(filter[i]);
+    }
+    free(filter);
+}
+
+/* Return a referenced copy of the controller's domain filter (or NULL);
+ * the caller must hold ctl->lock and free the copy with
+ * controller_filter_free.
+ */
+static virDomainPtr *controller_filter_copy(struct ruby_libvirt_controller *ctl)
+{
+    virDomainPtr *copy;
+    int i, n;
+
+    if (ctl->filter == NULL) {
+        return NULL;
+    }
+    for (n = 0; ctl->filter[n] != NULL; n++) {
+    }
+    copy = calloc(n + 1, sizeof(virDomainPtr));
+    if (copy == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        virDomainRef(ctl->filter[i]);
+        copy[i] = ctl->filter[i];
+    }
+
+    return copy;
+}
+
+static void controller_unref(struct ruby_libvirt_controller *ctl)
+{
+    int refs;
+
+    pthread_mutex_lock(&ctl->lock);
+    refs = --ctl->refs;
+    pthread_mutex_unlock(&ctl->lock);
+
+    if (refs == 0) {
+        if (ctl->ops->free != NULL) {
+            ctl->ops->free(ctl);
+        }
+        controller_filter_free(ctl->filter);
+        if (ctl->gov != NULL) {
+            ruby_libvirt_governor_unref(ctl->gov);
+        }
+        virConnectClose(ctl->conn);
+        free(ctl->last_error);
+        pthread_cond_destroy(&ctl->cond);
+        pthread_mutex_destroy(&ctl->lock);
+        free(ctl);
+    }
+}
+
+static void controller_stopping(struct ruby_libvirt_controller *ctl)
+{
+    pthread_mutex_lock(&ctl->lock);
+    ctl->stopping = 1;
+    pthread_cond_broadcast(&ctl->cond);
+    pthread_mutex_unlock(&ctl->lock);
+    if (ctl->gov != NULL) {
+        ruby_libvirt_governor_cancel(ctl->gov, &ctl->stopping);
+    }
+}
+
+static void controller_free(void *c)
+{
+    struct ruby_libvirt_controller *ctl = c;
+
+    controller_stopping(ctl);
+    controller_unref(ctl);
+}
+
+static void *controller_thread(void *arg)
+{
+    struct ruby_libvirt_controller *ctl = arg;
+    struct timeval now;
+    struct timespec until;
+    double start, wake;
+
+    pthread_mutex_lock(&ctl->lock);
+    while (!ctl->stopping) {
+        pthread_mutex_unlock(&ctl->lock);
+
+        start = ruby_libvirt_monotonic_time();
+        ctl->ops->cycle(ctl);
+
+        pthread_mutex_lock(&ctl->lock);
+        ctl->cycles++;
+        ctl->last_cycle_time = ruby_libvirt_monotonic_time() - start;
+
+        gettimeofday(&now, NULL);
+        wake = now.tv_sec + now.tv_usec / 1e6 + ctl->interval -
+            ctl->last_cycle_time;
+        until.tv_sec = (time_t)wake;
+        until.tv_nsec = (long)((wake - until.tv_sec) * 1e9);
+        while (!ctl->stopping &&
+               pthread_cond_timedwait(&ctl->cond, &ctl->lock,
+                                      &until) != ETIMEDOUT) {
+        }
+    }
+    ctl->running = 0;
+    pthread_cond_broadcast(&ctl->cond);
+    pthread_mutex_unlock(&ctl->lock);
+
+    controller_unref(ctl);
+
+    return NULL;
+}
+
+/* Allocate a controller of SIZE bytes (at least a struct
+ * ruby_libvirt_controller) for the connection C, running every INTERVAL
+ * seconds (DEF_INTERVAL if nil) on up to CONCURRENCY threads.  The rest of
+ * the structure is zeroed.
+ */
+void *ruby_libvirt_controller_alloc(VALUE c, size_t size,
+                                    const struct ruby_libvirt_controller_ops *ops,
+                                    VALUE interval, double def_interval,
+                                    VALUE concurrency)
+{
+    struct ruby_libvirt_controller *ctl;
+    virConnectPtr conn;
+    double secs;
+    int threads;
+
+    /* raises for a non-Connection, so do it before allocating anything */
+    conn = ruby_libvirt_connect_get(c);
+    secs = NIL_P(interval) ? def_interval : NUM2DBL(interval);
+    threads = ruby_libvirt_value_to_int(concurrency);
+    if (secs <= 0) {
+        rb_raise(rb_eArgError, "interval must be greater than 0");
+    }
+
+    ctl = calloc(1, size);
+    if (ctl == NULL) {
+        rb_memerror();
+    }
+    pthread_mutex_init(&ctl->lock, NULL);
+    pthread_cond_init(&ctl->cond, NULL);
+    ctl->refs = 1;
+    ctl->ops = ops;
+    ctl->interval = secs;
+    ctl->concurrency = threads;
+    ctl->conn = conn;
+    virConnectRef(ctl->conn);
+
+    return ctl;
+}
+
+VALUE ruby_libvirt_controller_new(VALUE klass, void *ctl, VALUE c)
+{
+    return ruby_libvirt_new_class(klass, ctl, ruby_libvirt_conn_attr(c),
+                                  controller_free);
+}
+
+void *ruby_libvirt_controller_get(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl;
+
+    Data_Get_Struct(v, struct ruby_libvirt_controller, ctl);
+
+    return ctl;
+}
+
+/* Take a slot of the connection's governor for one call from the
+ * controller thread.  Returns -1 if the controller is stopped meanwhile.
+ */
+int ruby_libvirt_controller_acquire(struct ruby_libvirt_controller *ctl)
+{
+    if (ctl->gov == NULL) {
+        return 0;
+    }
+    return ruby_libvirt_governor_acquire(ctl->gov, RUBY_LIBVIRT_LANE_HIGH,
+                                         &ctl->stopping);
+}
+
+void ruby_libvirt_controller_release(struct ruby_libvirt_controller *ctl)
+{
+    if (ctl->gov != NULL) {
+        ruby_libvirt_governor_release(ctl->gov);
+    }
+}
+
+/* Return a copy of this thread's libvirt error message, or NULL, and reset
+ * the error.  The caller must free the result.
+ */
+char *ruby_libvirt_controller_take_error(void)
+{
+    virErrorPtr err = virGetLastError();
+    char *msg = NULL;
+
+    if (err != NULL && err->message != NULL) {
+        msg = strdup(err->message);
+    }
+    virResetLastError();
+
+    return msg;
+}
+
+/* Count a failure, keeping MSG (if not NULL) as the latest error. */
+void ruby_libvirt_controller_failed(struct ruby_libvirt_controller *ctl,
+                                    const char *msg)
+{
+    pthread_mutex_lock(&ctl->lock);
+    ctl->failed++;
+    if (msg != NULL) {
+        free(ctl->last_error);
+        ctl->last_error = strdup(msg);
+    }
+    pthread_mutex_unlock(&ctl->lock);
+}
+
+/* Fetch the STATS of the domains selected by FLAGS (and by ctl.set_domains)
+ * through the governor, setting *STAMP (if not NULL) to the monotonic time
+ * of the fetch.  Returns the number of records, or -1 after counting the
+ * failure; a stopped controller also gets -1.
+ */
+int ruby_libvirt_controller_fetch(struct ruby_libvirt_controller *ctl,
+                                  unsigned int stats, unsigned int flags,
+                                  virDomainStatsRecordPtr **records,
+                                  double *stamp)
+{
+    virDomainPtr *filter;
+    char *msg;
+    int n, nomem;
+
+    *records = NULL;
+    pthread_mutex_lock(&ctl->lock);
+    filter = controller_filter_copy(ctl);
+    nomem = ctl->filter != NULL && filter == NULL;
+    pthread_mutex_unlock(&ctl->lock);
+    if (nomem) {
+        /* out of memory; try again next cycle rather than control every
+         * domain */
+        return -1;
+    }
+
+    if (ruby_libvirt_controller_acquire(ctl) < 0) {
+        controller_filter_free(filter);
+        return -1;
+    }
+    if (filter != NULL) {
+        n = virDomainListGetStats(filter, stats, records, flags);
+    }
+    else {
+        n = virConnectGetAllDomainStats(ctl->conn, stats, records, flags);
+    }
+    if (stamp != NULL) {
+        *stamp = ruby_libvirt_monotonic_time();
+    }
+    ruby_libvirt_controller_release(ctl);
+    controller_filter_free(filter);
+
+    if (n < 0) {
+        msg = ruby_libvirt_controller_take_error();
+        ruby_libvirt_controller_failed(ctl, msg);
+        free(msg);
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctl->lock);
+    ctl->domains = n;
+    pthread_mutex_unlock(&ctl->lock);
+
+    return n;
+}
+
+/*
+ * call-seq:
+ *   ctl.start -> nil
+ *
+ * Start the controller thread.  This cannot be combined with an event loop
+ * written in Ruby (Libvirt::event_register_impl), since libvirt would then
+ * call into Ruby from the controller thread; Libvirt::native_event_loop_start
+ * is fine.
+ */
+static VALUE libvirt_controller_start(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+    pthread_t thread;
+    pthread_attr_t attr;
+    int r;
+
+    if (ruby_libvirt_keep_gvl) {
+        rb_raise(rb_eArgError, "a %s cannot run alongside Ruby event callbacks",
+                 ctl->ops->name);
+    }
+
+    pthread_mutex_lock(&ctl->lock);
+    if (ctl->running) {
+        pthread_mutex_unlock(&ctl->lock);
+        rb_raise(rb_eArgError, "the %s is already running", ctl->ops->name);
+    }
+    pthread_mutex_unlock(&ctl->lock);
+
+    if (ctl->gov == NULL) {
+        ctl->gov = ruby_libvirt_governor_get(v);
+    }
+
+    pthread_mutex_lock(&ctl->lock);
+    ctl->stopping = 0;
+    ctl->running = 1;
+    /* the thread's reference */
+    ctl->refs++;
+    pthread_mutex_unlock(&ctl->lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    r = pthread_create(&thread, &attr, controller_thread, ctl);
+    pthread_attr_destroy(&attr);
+    if (r != 0) {
+        pthread_mutex_lock(&ctl->lock);
+        ctl->running = 0;
+        ctl->refs--;
+        pthread_mutex_unlock(&ctl->lock);
+        errno = r;
+        rb_sys_fail("pthread_create");
+    }
+
+    return Qnil;
+}
+
+static void *controller_wait_stopped(void *arg)
+{
+    struct ruby_libvirt_controller *ctl = arg;
+
+    pthread_mutex_lock(&ctl->lock);
+    while (ctl->running) {
+        pthread_cond_wait(&ctl->cond, &ctl->lock);
+    }
+    pthread_mutex_unlock(&ctl->lock);
+
+    return NULL;
+}
+
+/*
+ * call-seq:
+ *   ctl.stop -> nil
+ *
+ * Stop the controller thread, waiting for the changes of the current cycle
+ * to finish.  The controller can be started again afterwards.
+ */
+static VALUE libvirt_controller_stop(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+
+    controller_stopping(ctl);
+
+    ruby_libvirt_without_gvl(controller_wait_stopped, ctl);
+
+    if (ctl->ops->stopped != NULL) {
+        pthread_mutex_lock(&ctl->lock);
+        ctl->ops->stopped(ctl);
+        pthread_mutex_unlock(&ctl->lock);
+    }
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   ctl.running? -> [True|False]
+ *
+ * Return +true+ if the controller thread is running.
+ */
+static VALUE libvirt_controller_running_p(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+    int running;
+
+    pthread_mutex_lock(&ctl->lock);
+    running = ctl->running;
+    pthread_mutex_unlock(&ctl->lock);
+
+    return running ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   ctl.policy -> Hash
+ *
+ * Return the controller's current settings.  Besides those of the
+ * controller itself, the Hash has the keys "interval" and "concurrency".
+ */
+static VALUE libvirt_controller_policy(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+    VALUE result;
+
+    result = rb_hash_new();
+    ctl->ops->policy(ctl, result);
+    rb_hash_aset(result, rb_str_new2("interval"), rb_float_new(ctl->interval));
+    rb_hash_aset(result, rb_str_new2("concurrency"),
+                 INT2NUM(ctl->concurrency));
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   ctl.stats -> Hash
+ *
+ * Return what the controller has done since it was created.  Besides the
+ * counters of the controller itself, the Hash has the keys "cycles"
+ * (completed polling cycles), "domains" (domains seen in the last cycle),
+ * "failed" (failed stats fetches and changes), "last_cycle_time" (seconds
+ * the last cycle took, including its changes) and "last_error" (the
+ * libvirt error message of the latest failure, or nil).
+ */
+static VALUE libvirt_controller_stats(VALUE v)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+    unsigned long long cycles, failed;
+    double last_cycle_time;
+    char *last_error = NULL;
+    int domains, exception = 0;
+    VALUE result, msg;
+
+    pthread_mutex_lock(&ctl->lock);
+    cycles = ctl->cycles;
+    failed = ctl->failed;
+    domains = ctl->domains;
+    last_cycle_time = ctl->last_cycle_time;
+    if (ctl->last_error != NULL) {
+        last_error = strdup(ctl->last_error);
+    }
+    pthread_mutex_unlock(&ctl->lock);
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("cycles"), ULL2NUM(cycles));
+    rb_hash_aset(result, rb_str_new2("domains"), INT2NUM(domains));
+    rb_hash_aset(result, rb_str_new2("failed"), ULL2NUM(failed));
+    rb_hash_aset(result, rb_str_new2("last_cycle_time"),
+                 rb_float_new(last_cycle_time));
+    rb_hash_aset(result, rb_str_new2("last_error"), Qnil);
+    if (last_error != NULL) {
+        msg = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&last_error,
+                         &exception);
+        free(last_error);
+        if (exception) {
+            rb_jump_tag(exception);
+        }
+        rb_hash_aset(result, rb_str_new2("last_error"), msg);
+    }
+    ctl->ops->stats(ctl, result);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   ctl.set_domains(domains) -> nil
+ *
+ * Only control domains, an Array of Libvirt::Domain on the controller's
+ * connection, from the next cycle on; their stats are then fetched with
+ * virDomainListGetStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainListGetStats].
+ * With nil, the controller goes back to every domain on the connection.
+ * ctl.domains returns the current setting.
+ */
+static VALUE libvirt_controller_set_domains(VALUE v, VALUE domains)
+{
+    struct ruby_libvirt_controller *ctl = ruby_libvirt_controller_get(v);
+    virDomainPtr *filter = NULL, dom;
+    int i;
+
+    if (!NIL_P(domains)) {
+        Check_Type(domains, T_ARRAY);
+        if (RARRAY_LEN(domains) == 0) {
+            rb_raise(rb_eArgError,
+                     "no domains given; use nil to control every domain");
+        }
+        for (i = 0; i < RARRAY_LEN(domains); i++) {
+            if (rb_obj_is_kind_of(rb_ary_entry(domains, i),
+                                  c_domain) != Qtrue) {
+                rb_raise(rb_eTypeError,
+                         "wrong argument type (expected Libvirt::Domain)");
+            }
+            dom = ruby_libvirt_domain_get(rb_ary_entry(domains, i));
+            if (virDomainGetConnect(dom) != ctl->conn) {
+                rb_raise(rb_eArgError,
+                         "domains must belong to the controller's connection");
+            }
+        }
+
+        /* nothing below can raise, so the references cannot leak */
+        filter = calloc(RARRAY_LEN(domains) + 1, sizeof(virDomainPtr));
+        if (filter == NULL) {
+            rb_memerror();
+        }
+        for (i = 0; i < RARRAY_LEN(domains); i++) {
+            filter[i] = ruby_libvirt_domain_get(rb_ary_entry(domains, i));
+            virDomainRef(filter[i]);
+        }
+        domains = rb_obj_freeze(rb_ary_dup(domains));
+    }
+
+    pthread_mutex_lock(&ctl->lock);
+    controller_filter_free(ctl->filter);
+    ctl->filter = filter;
+    pthread_mutex_unlock(&ctl->lock);
+
+    rb_iv_set(v, "@domains", domains);
+
+    return Qnil;
+}
+
+/* Define the methods every native controller class has. */
+void ruby_libvirt_controller_define_methods(VALUE klass)
+{
+    rb_undef_alloc_func(klass);
+
+    rb_define_attr(klass, "connection", 1, 0);
+    rb_define_attr(klass, "domains", 1, 0);
+
+    rb_define_method(klass, "start", libvirt_controller_start, 0);
+    rb_define_method(klass, "stop", libvirt_controller_stop, 0);
+    rb_define_method(klass, "running?", libvirt_controller_running_p, 0);
+    rb_define_method(klass, "policy", libvirt_controller_policy, 0);
+    rb_define_method(klass, "stats", libvirt_controller_stats, 0);
+    rb_define_method(klass, "set_domains", libvirt_controller_set_domains, 1);
+}
+#endif
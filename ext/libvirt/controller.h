@@ -0,0 +1,75 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_PTHREAD_H
+#include <pthread.h>
+
+struct ruby_libvirt_controller;
+
+/* What a native controller (Libvirt::BalloonController,
+ * Libvirt::VcpuController) adds to the shared thread and lifecycle.
+ */
+struct ruby_libvirt_controller_ops {
+    /* "balloon controller", for error messages */
+    const char *name;
+    /* one polling cycle, on the controller thread without the lock */
+    void (*cycle)(struct ruby_libvirt_controller *ctl);
+    /* called with the lock held once ctl.stop has seen the thread exit;
+     * may be NULL */
+    void (*stopped)(struct ruby_libvirt_controller *ctl);
+    /* add the controller's own keys to the ctl.policy and ctl.stats
+     * Hashes; called without the lock */
+    void (*policy)(struct ruby_libvirt_controller *ctl, VALUE result);
+    void (*stats)(struct ruby_libvirt_controller *ctl, VALUE result);
+    /* free what the controller added, once the last reference is gone;
+     * may be NULL */
+    void (*free)(struct ruby_libvirt_controller *ctl);
+};
+
+/* The part of a native controller that is shared between the Ruby object
+ * and its thread.  Concrete controllers embed it as their first member.
+ * Everything but conn, interval, concurrency and ops is protected by
+ * lock.
+ */
+struct ruby_libvirt_controller {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    int running;
+    volatile int stopping;
+
+    const struct ruby_libvirt_controller_ops *ops;
+    virConnectPtr conn;
+    struct ruby_libvirt_governor *gov;
+    double interval;
+    int concurrency;
+    /* NULL-terminated, or NULL to control every domain */
+    virDomainPtr *filter;
+
+    unsigned long long cycles;
+    unsigned long long failed;
+    int domains;
+    double last_cycle_time;
+    char *last_error;
+};
+
+void *ruby_libvirt_controller_alloc(VALUE c, size_t size,
+                                    const struct ruby_libvirt_controller_ops *ops,
+                                    VALUE interval, double def_interval,
+                                    VALUE concurrency);
+VALUE ruby_libvirt_controller_new(VALUE klass, void *ctl, VALUE c);
+void *ruby_libvirt_controller_get(VALUE v);
+void ruby_libvirt_controller_define_methods(VALUE klass);
+
+int ruby_libvirt_controller_acquire(struct ruby_libvirt_controller *ctl);
+void ruby_libvirt_controller_release(struct ruby_libvirt_controller *ctl);
+char *ruby_libvirt_controller_take_error(void);
+void ruby_libvirt_controller_failed(struct ruby_libvirt_controller *ctl,
+                                    const char *msg);
+int ruby_libvirt_controller_fetch(struct ruby_libvirt_controller *ctl,
+                                  unsigned int stats, unsigned int flags,
+                                  virDomainStatsRecordPtr **records,
+                                  double *stamp);
+#endif
+
+#endif
@@ -65,7 +65,7 @@ typedef virTypedParameter *virTypedParameterPtr;
 
 #endif
 
-static VALUE c_domain;
+VALUE c_domain;
 static VALUE c_domain_info;
 static VALUE c_domain_ifinfo;
 VALUE c_domain_security_label;
@@ -83,6 +83,9 @@ static VALUE c_domain_snapshot;
 static VALUE c_domain_job_info;
 #endif
 static VALUE c_domain_vcpuinfo;
+#if HAVE_VIRDOMAINGETIOTHREADINFO
+static VALUE c_domain_iothreadinfo;
+#endif
 #if HAVE_VIRDOMAINGETCONTROLINFO
 static VALUE c_domain_control_info;
 #endif
@@ -102,7 +105,30 @@ VALUE ruby_libvirt_domain_new(virDomainPtr d, VALUE conn)
 
 virDomainPtr ruby_libvirt_domain_get(VALUE d)
 {
-    ruby_libvirt_get_struct(Domain, d);
+    virDomainPtr dom, newdom;
+    virConnectPtr conn;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    Data_Get_Struct(d, virDomain, dom);
+    if (!dom) {
+        rb_raise(rb_eArgError, "Domain has been freed");
+    }
+
+    /* after a fork the handle may still point at the inherited connection;
+     * look the domain up again by UUID on the reopened one */
+    conn = ruby_libvirt_connect_reopened(d);
+    if (conn != NULL && virDomainGetConnect(dom) != conn) {
+        ruby_libvirt_raise_error_if(virDomainGetUUID(dom, uuid) < 0,
+                                    e_RetrieveError, "virDomainGetUUID", conn);
+        newdom = RUBY_LIBVIRT_CALL(virDomainLookupByUUID, conn, uuid);
+        ruby_libvirt_raise_error_if(newdom == NULL, e_RetrieveError,
+                                    "virDomainLookupByUUID", conn);
+        DATA_PTR(d) = newdom;
+        virDomainFree(dom);
+        dom = newdom;
+    }
+
+    return dom;
 }
 
 static void domain_input_to_fixnum_and_flags(VALUE in, VALUE *hash, VALUE *flags)
@@ -141,12 +167,12 @@ static VALUE libvirt_domain_migrate(int argc, VALUE *argv, VALUE d)
     rb_scan_args(argc, argv, "14", &dconn, &flags, &dname, &uri,
                  &bandwidth);
 
-    ddom = virDomainMigrate(ruby_libvirt_domain_get(d),
-                            ruby_libvirt_connect_get(dconn),
-                            ruby_libvirt_value_to_ulong(flags),
-                            ruby_libvirt_get_cstring_or_null(dname),
-                            ruby_libvirt_get_cstring_or_null(uri),
-                            ruby_libvirt_value_to_ulong(bandwidth));
+    ddom = RUBY_LIBVIRT_CALL(virDomainMigrate, ruby_libvirt_domain_get(d),
+                             ruby_libvirt_connect_get(dconn),
+                             ruby_libvirt_value_to_ulong(flags),
+                             ruby_libvirt_get_cstring_or_null(dname),
+                             ruby_libvirt_get_cstring_or_null(uri),
+                             ruby_libvirt_value_to_ulong(bandwidth));
 
     ruby_libvirt_raise_error_if(ddom == NULL, e_Error, "virDomainMigrate",
                                 ruby_libvirt_connect_get(d));
@@ -239,7 +265,7 @@ static VALUE libvirt_domain_migrate2(int argc, VALUE *argv, VALUE d)
     rb_scan_args(argc, argv, "15", &dconn, &dxml, &flags, &dname, &uri,
                  &bandwidth);
 
-    ddom = virDomainMigrate2(ruby_libvirt_domain_get(d),
+    ddom = RUBY_LIBVIRT_CALL(virDomainMigrate2, ruby_libvirt_domain_get(d),
                              ruby_libvirt_connect_get(dconn),
                              ruby_libvirt_get_cstring_or_null(dxml),
                              ruby_libvirt_value_to_ulong(flags),
@@ -522,6 +548,67 @@ static VALUE libvirt_domain_managed_save_remove(int argc, VALUE *argv, VALUE d)
 }
 #endif
 
+#if HAVE_VIRDOMAINSAVEPARAMS
+static struct ruby_libvirt_typed_param save_allowed[] = {
+    {VIR_DOMAIN_SAVE_PARAM_FILE, VIR_TYPED_PARAM_STRING},
+    {VIR_DOMAIN_SAVE_PARAM_DXML, VIR_TYPED_PARAM_STRING},
+#if HAVE_CONST_VIR_DOMAIN_SAVE_PARAM_IMAGE_FORMAT
+    {VIR_DOMAIN_SAVE_PARAM_IMAGE_FORMAT, VIR_TYPED_PARAM_STRING},
+#endif
+#if HAVE_CONST_VIR_DOMAIN_SAVE_PARAM_PARALLEL_CHANNELS
+    {VIR_DOMAIN_SAVE_PARAM_PARALLEL_CHANNELS, VIR_TYPED_PARAM_INT},
+#endif
+};
+
+/* Fill PARAMS, which must have room for ARRAY_SIZE(save_allowed) entries,
+ * from the Hash IN and return how many were set.  String values point into
+ * the Ruby strings in IN, so IN must be kept alive while PARAMS is used.
+ */
+static int domain_save_params_from_hash(VALUE in, virTypedParameterPtr params)
+{
+    struct ruby_libvirt_parameter_assign_args args;
+
+    Check_Type(in, T_HASH);
+
+    memset(params, 0, sizeof(virTypedParameter) * ARRAY_SIZE(save_allowed));
+    args.allowed = save_allowed;
+    args.num_allowed = ARRAY_SIZE(save_allowed);
+    args.params = params;
+    args.i = 0;
+    rb_hash_foreach(in, ruby_libvirt_typed_parameter_assign, (VALUE)&args);
+
+    return args.i;
+}
+
+/*
+ * call-seq:
+ *   dom.save_params(params, flags=0) -> nil
+ *
+ * Call virDomainSaveParams[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSaveParams]
+ * to save the domain state as described by the params Hash, whose keys are
+ * the Libvirt::Domain::SAVE_PARAM_* constants.  SAVE_PARAM_IMAGE_FORMAT
+ * selects a (possibly compressed) image format, and with the
+ * Libvirt::Domain::SAVE_PARALLEL flag SAVE_PARAM_PARALLEL_CHANNELS sets how
+ * many channels write the memory in parallel.  Without SAVE_PARAM_FILE this
+ * is a managed save.
+ */
+static VALUE libvirt_domain_save_params(int argc, VALUE *argv, VALUE d)
+{
+    VALUE in, flags;
+    virTypedParameter params[ARRAY_SIZE(save_allowed)];
+    int nparams;
+
+    rb_scan_args(argc, argv, "11", &in, &flags);
+
+    nparams = domain_save_params_from_hash(in, params);
+
+    ruby_libvirt_generate_call_nil(virDomainSaveParams,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d), params,
+                                   nparams, ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
 /*
  * call-seq:
  *   dom.core_dump(filename, flags=0) -> nil
@@ -558,6 +645,35 @@ static VALUE libvirt_domain_s_restore(VALUE RUBY_LIBVIRT_UNUSED(klass), VALUE c,
                                    StringValueCStr(from));
 }
 
+#if HAVE_VIRDOMAINRESTOREPARAMS
+/*
+ * call-seq:
+ *   Libvirt::Domain::restore_params(conn, params, flags=0) -> nil
+ *
+ * Call virDomainRestoreParams[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainRestoreParams]
+ * to restore a domain from the image named by SAVE_PARAM_FILE in the params
+ * Hash.  SAVE_PARAM_PARALLEL_CHANNELS, with the
+ * Libvirt::Domain::SAVE_PARALLEL flag, reads an image written by
+ * dom.save_params with the same number of channels.
+ */
+static VALUE libvirt_domain_s_restore_params(int argc, VALUE *argv,
+                                             VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    VALUE c, in, flags;
+    virTypedParameter params[ARRAY_SIZE(save_allowed)];
+    int nparams;
+
+    rb_scan_args(argc, argv, "21", &c, &in, &flags);
+
+    nparams = domain_save_params_from_hash(in, params);
+
+    ruby_libvirt_generate_call_nil(virDomainRestoreParams,
+                                   ruby_libvirt_connect_get(c),
+                                   ruby_libvirt_connect_get(c), params,
+                                   nparams, ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
 /*
  * call-seq:
  *   dom.info -> Libvirt::Domain::Info
@@ -571,7 +687,7 @@ static VALUE libvirt_domain_info(VALUE d)
     int r;
     VALUE result;
 
-    r = virDomainGetInfo(ruby_libvirt_domain_get(d), &info);
+    r = RUBY_LIBVIRT_CALL(virDomainGetInfo, ruby_libvirt_domain_get(d), &info);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetInfo",
                                 ruby_libvirt_connect_get(d));
 
@@ -599,7 +715,8 @@ static VALUE libvirt_domain_security_label(VALUE d)
     int r;
     VALUE result;
 
-    r = virDomainGetSecurityLabel(ruby_libvirt_domain_get(d), &seclabel);
+    r = RUBY_LIBVIRT_CALL(virDomainGetSecurityLabel,
+                          ruby_libvirt_domain_get(d), &seclabel);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainGetSecurityLabel",
                                 ruby_libvirt_connect_get(d));
@@ -625,8 +742,8 @@ static VALUE libvirt_domain_block_stats(VALUE d, VALUE path)
     int r;
     VALUE result;
 
-    r = virDomainBlockStats(ruby_libvirt_domain_get(d), StringValueCStr(path),
-                            &stats, sizeof(stats));
+    r = RUBY_LIBVIRT_CALL(virDomainBlockStats, ruby_libvirt_domain_get(d),
+                          StringValueCStr(path), &stats, sizeof(stats));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainBlockStats",
                                 ruby_libvirt_connect_get(d));
 
@@ -650,14 +767,15 @@ static VALUE libvirt_domain_block_stats(VALUE d, VALUE path)
  */
 static VALUE libvirt_domain_memory_stats(int argc, VALUE *argv, VALUE d)
 {
-    virDomainMemoryStatStruct stats[6];
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
     int i, r;
     VALUE result, flags, tmp;
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    r = virDomainMemoryStats(ruby_libvirt_domain_get(d), stats, 6,
-                             ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainMemoryStats, ruby_libvirt_domain_get(d),
+                          stats, VIR_DOMAIN_MEMORY_STAT_NR,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainMemoryStats",
                                 ruby_libvirt_connect_get(d));
 
@@ -682,6 +800,84 @@ static VALUE libvirt_domain_memory_stats(int argc, VALUE *argv, VALUE d)
 
     return result;
 }
+
+/* the keys match the "balloon." fields of virConnectGetAllDomainStats */
+static const struct {
+    int tag;
+    const char *name;
+} domain_memory_stat_names[] = {
+    { VIR_DOMAIN_MEMORY_STAT_SWAP_IN, "swap_in" },
+    { VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, "swap_out" },
+    { VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, "major_fault" },
+    { VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, "minor_fault" },
+    { VIR_DOMAIN_MEMORY_STAT_UNUSED, "unused" },
+    { VIR_DOMAIN_MEMORY_STAT_AVAILABLE, "available" },
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON
+    { VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON, "current" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_RSS
+    { VIR_DOMAIN_MEMORY_STAT_RSS, "rss" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_USABLE
+    { VIR_DOMAIN_MEMORY_STAT_USABLE, "usable" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE
+    { VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, "last-update" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_DISK_CACHES
+    { VIR_DOMAIN_MEMORY_STAT_DISK_CACHES, "disk_caches" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGALLOC
+    { VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGALLOC, "hugetlb_pgalloc" },
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL
+    { VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL, "hugetlb_pgfail" },
+#endif
+};
+
+/*
+ * call-seq:
+ *   dom.memory_stats_hash(flags=0) -> Hash
+ *
+ * Call virDomainMemoryStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainMemoryStats]
+ * to retrieve every memory statistic the domain reports, as a Hash from
+ * the stat name to its value.  The names are those of the "balloon." stats
+ * of conn.domain_memory_stats, so "current" is the balloon size
+ * (MemoryStats::ACTUAL_BALLOON); other possible keys are "swap_in",
+ * "swap_out", "major_fault", "minor_fault", "unused", "available", "rss",
+ * "usable", "last-update", "disk_caches", "hugetlb_pgalloc" and
+ * "hugetlb_pgfail".  Sizes are in KiB.  A stat unknown to these bindings
+ * is keyed by its numeric tag.
+ */
+static VALUE libvirt_domain_memory_stats_hash(int argc, VALUE *argv, VALUE d)
+{
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    int i, j, r;
+    VALUE result, flags, key;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virDomainMemoryStats, ruby_libvirt_domain_get(d),
+                          stats, VIR_DOMAIN_MEMORY_STAT_NR,
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainMemoryStats",
+                                ruby_libvirt_connect_get(d));
+
+    result = rb_hash_new();
+    for (i = 0; i < r; i++) {
+        key = INT2NUM(stats[i].tag);
+        for (j = 0; j < (int)(sizeof(domain_memory_stat_names) /
+                              sizeof(domain_memory_stat_names[0])); j++) {
+            if (domain_memory_stat_names[j].tag == stats[i].tag) {
+                key = rb_str_new2(domain_memory_stat_names[j].name);
+                break;
+            }
+        }
+        rb_hash_aset(result, key, ULL2NUM(stats[i].val));
+    }
+
+    return result;
+}
 #endif
 
 #if HAVE_TYPE_VIRDOMAINBLOCKINFOPTR
@@ -700,8 +896,9 @@ static VALUE libvirt_domain_block_info(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "11", &path, &flags);
 
-    r = virDomainGetBlockInfo(ruby_libvirt_domain_get(d), StringValueCStr(path),
-                              &info, ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainGetBlockInfo, ruby_libvirt_domain_get(d),
+                          StringValueCStr(path), &info,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainGetBlockInfo",
                                 ruby_libvirt_connect_get(d));
@@ -735,9 +932,10 @@ static VALUE libvirt_domain_block_peek(int argc, VALUE *argv, VALUE d)
 
     buffer = alloca(sizeof(char) * NUM2UINT(size));
 
-    r = virDomainBlockPeek(ruby_libvirt_domain_get(d), StringValueCStr(path),
-                           NUM2ULL(offset), NUM2UINT(size), buffer,
-                           ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainBlockPeek, ruby_libvirt_domain_get(d),
+                          StringValueCStr(path), NUM2ULL(offset),
+                          NUM2UINT(size), buffer,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainBlockPeek",
                                 ruby_libvirt_connect_get(d));
 
@@ -769,8 +967,9 @@ static VALUE libvirt_domain_memory_peek(int argc, VALUE *argv, VALUE d)
 
     buffer = alloca(sizeof(char) * NUM2UINT(size));
 
-    r = virDomainMemoryPeek(ruby_libvirt_domain_get(d), NUM2ULL(start),
-                            NUM2UINT(size), buffer, NUM2UINT(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainMemoryPeek, ruby_libvirt_domain_get(d),
+                          NUM2ULL(start), NUM2UINT(size), buffer,
+                          NUM2UINT(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainMemoryPeek",
                                 ruby_libvirt_connect_get(d));
 
@@ -793,7 +992,8 @@ static VALUE libvirt_domain_vcpus(VALUE d)
     VALUE result, vcpuinfo, p2vcpumap;
     unsigned short i;
 
-    r = virDomainGetInfo(ruby_libvirt_domain_get(d), &dominfo);
+    r = RUBY_LIBVIRT_CALL(virDomainGetInfo, ruby_libvirt_domain_get(d),
+                          &dominfo);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetInfo",
                                 ruby_libvirt_connect_get(d));
 
@@ -805,8 +1005,8 @@ static VALUE libvirt_domain_vcpus(VALUE d)
 
     cpumap = alloca(sizeof(unsigned char) * cpumaplen);
 
-    r = virDomainGetVcpus(ruby_libvirt_domain_get(d), cpuinfo,
-                          dominfo.nrVirtCpu, cpumap, cpumaplen);
+    r = RUBY_LIBVIRT_CALL(virDomainGetVcpus, ruby_libvirt_domain_get(d),
+                          cpuinfo, dominfo.nrVirtCpu, cpumap, cpumaplen);
     if (r < 0) {
 #if HAVE_VIRDOMAINGETVCPUPININFO
         /* if the domain is not shutoff, then this is an error */
@@ -817,9 +1017,9 @@ static VALUE libvirt_domain_vcpus(VALUE d)
         /* otherwise, we can try to call virDomainGetVcpuPinInfo to get the
          * information instead
          */
-        r = virDomainGetVcpuPinInfo(ruby_libvirt_domain_get(d),
-                                    dominfo.nrVirtCpu, cpumap, cpumaplen,
-                                    VIR_DOMAIN_AFFECT_CONFIG);
+        r = RUBY_LIBVIRT_CALL(virDomainGetVcpuPinInfo,
+                              ruby_libvirt_domain_get(d), dominfo.nrVirtCpu,
+                              cpumap, cpumaplen, VIR_DOMAIN_AFFECT_CONFIG);
         ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                     "virDomainGetVcpuPinInfo",
                                     ruby_libvirt_connect_get(d));
@@ -907,8 +1107,9 @@ static VALUE libvirt_domain_if_stats(VALUE d, VALUE sif)
     VALUE result = Qnil;
 
     if (ifname) {
-        r = virDomainInterfaceStats(ruby_libvirt_domain_get(d), ifname, &ifinfo,
-                                    sizeof(virDomainInterfaceStatsStruct));
+        r = RUBY_LIBVIRT_CALL(virDomainInterfaceStats,
+                              ruby_libvirt_domain_get(d), ifname, &ifinfo,
+                              sizeof(virDomainInterfaceStatsStruct));
         ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                     "virDomainInterfaceStats",
                                     ruby_libvirt_connect_get(d));
@@ -1007,7 +1208,8 @@ static VALUE libvirt_domain_max_memory(VALUE d)
 {
     unsigned long max_memory;
 
-    max_memory = virDomainGetMaxMemory(ruby_libvirt_domain_get(d));
+    max_memory = RUBY_LIBVIRT_CALL(virDomainGetMaxMemory,
+                                   ruby_libvirt_domain_get(d));
     ruby_libvirt_raise_error_if(max_memory == 0, e_RetrieveError,
                                 "virDomainGetMaxMemory",
                                 ruby_libvirt_connect_get(d));
@@ -1027,8 +1229,8 @@ static VALUE libvirt_domain_max_memory_equal(VALUE d, VALUE max_memory)
 {
     int r;
 
-    r = virDomainSetMaxMemory(ruby_libvirt_domain_get(d),
-                              NUM2ULONG(max_memory));
+    r = RUBY_LIBVIRT_CALL(virDomainSetMaxMemory, ruby_libvirt_domain_get(d),
+                          NUM2ULONG(max_memory));
     ruby_libvirt_raise_error_if(r < 0, e_DefinitionError,
                                 "virDomainSetMaxMemory",
                                 ruby_libvirt_connect_get(d));
@@ -1053,13 +1255,15 @@ static VALUE libvirt_domain_memory_equal(VALUE d, VALUE in)
     domain_input_to_fixnum_and_flags(in, &memory, &flags);
 
 #if HAVE_VIRDOMAINSETMEMORYFLAGS
-    r = virDomainSetMemoryFlags(ruby_libvirt_domain_get(d), NUM2ULONG(memory),
-                                ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainSetMemoryFlags, ruby_libvirt_domain_get(d),
+                          NUM2ULONG(memory),
+                          ruby_libvirt_value_to_uint(flags));
 #else
     if (ruby_libvirt_value_to_uint(flags) != 0) {
         rb_raise(e_NoSupportError, "Non-zero flags not supported");
     }
-    r = virDomainSetMemory(ruby_libvirt_domain_get(d), NUM2ULONG(memory));
+    r = RUBY_LIBVIRT_CALL(virDomainSetMemory, ruby_libvirt_domain_get(d),
+                          NUM2ULONG(memory));
 #endif
 
     ruby_libvirt_raise_error_if(r < 0, e_DefinitionError, "virDomainSetMemory",
@@ -1307,7 +1511,8 @@ static VALUE libvirt_domain_autostart(VALUE d)
 {
     int r, autostart;
 
-    r = virDomainGetAutostart(ruby_libvirt_domain_get(d), &autostart);
+    r = RUBY_LIBVIRT_CALL(virDomainGetAutostart, ruby_libvirt_domain_get(d),
+                          &autostart);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainAutostart",
                                 ruby_libvirt_connect_get(d));
 
@@ -1448,7 +1653,34 @@ static VALUE domain_snapshot_new(virDomainSnapshotPtr d, VALUE domain)
 
 static virDomainSnapshotPtr domain_snapshot_get(VALUE d)
 {
-    ruby_libvirt_get_struct(DomainSnapshot, d);
+    virDomainSnapshotPtr snap, newsnap;
+    virConnectPtr conn;
+    virDomainPtr dom;
+    const char *name;
+
+    Data_Get_Struct(d, virDomainSnapshot, snap);
+    if (!snap) {
+        rb_raise(rb_eArgError, "DomainSnapshot has been freed");
+    }
+
+    /* after a fork, look the snapshot up again by name in the domain,
+     * which re-resolves itself on the reopened connection */
+    conn = ruby_libvirt_connect_reopened(d);
+    if (conn != NULL && virDomainSnapshotGetConnect(snap) != conn) {
+        name = virDomainSnapshotGetName(snap);
+        ruby_libvirt_raise_error_if(name == NULL, e_RetrieveError,
+                                    "virDomainSnapshotGetName", conn);
+        dom = ruby_libvirt_domain_get(rb_iv_get(d, "@domain"));
+        newsnap = RUBY_LIBVIRT_CALL(virDomainSnapshotLookupByName, dom, name,
+                                    0);
+        ruby_libvirt_raise_error_if(newsnap == NULL, e_RetrieveError,
+                                    "virDomainSnapshotLookupByName", conn);
+        DATA_PTR(d) = newsnap;
+        virDomainSnapshotFree(snap);
+        snap = newsnap;
+    }
+
+    return snap;
 }
 
 /*
@@ -1465,9 +1697,10 @@ static VALUE libvirt_domain_snapshot_create_xml(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "11", &xmlDesc, &flags);
 
-    ret = virDomainSnapshotCreateXML(ruby_libvirt_domain_get(d),
-                                     StringValueCStr(xmlDesc),
-                                     ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainSnapshotCreateXML,
+                            ruby_libvirt_domain_get(d),
+                            StringValueCStr(xmlDesc),
+                            ruby_libvirt_value_to_uint(flags));
 
     ruby_libvirt_raise_error_if(ret == NULL, e_Error,
                                 "virDomainSnapshotCreateXML",
@@ -1515,7 +1748,8 @@ static VALUE libvirt_domain_list_snapshots(int argc, VALUE *argv, VALUE d)
                  "wrong argument type (expected Number)");
     }
 
-    num = virDomainSnapshotNum(ruby_libvirt_domain_get(d), 0);
+    num = RUBY_LIBVIRT_CALL(virDomainSnapshotNum, ruby_libvirt_domain_get(d),
+                            0);
     ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
                                 "virDomainSnapshotNum",
                                 ruby_libvirt_connect_get(d));
@@ -1526,8 +1760,9 @@ static VALUE libvirt_domain_list_snapshots(int argc, VALUE *argv, VALUE d)
 
     names = alloca(sizeof(char *) * num);
 
-    r = virDomainSnapshotListNames(ruby_libvirt_domain_get(d), names, num,
-                                   ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainSnapshotListNames,
+                          ruby_libvirt_domain_get(d), names, num,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainSnapshotListNames",
                                 ruby_libvirt_connect_get(d));
@@ -1550,9 +1785,9 @@ static VALUE libvirt_domain_lookup_snapshot_by_name(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "11", &name, &flags);
 
-    snap = virDomainSnapshotLookupByName(ruby_libvirt_domain_get(d),
-                                         StringValueCStr(name),
-                                         ruby_libvirt_value_to_uint(flags));
+    snap = RUBY_LIBVIRT_CALL(virDomainSnapshotLookupByName,
+                             ruby_libvirt_domain_get(d), StringValueCStr(name),
+                             ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(snap == NULL, e_RetrieveError,
                                 "virDomainSnapshotLookupByName",
                                 ruby_libvirt_connect_get(d));
@@ -1613,8 +1848,9 @@ static VALUE libvirt_domain_current_snapshot(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    snap = virDomainSnapshotCurrent(ruby_libvirt_domain_get(d),
-                                    ruby_libvirt_value_to_uint(flags));
+    snap = RUBY_LIBVIRT_CALL(virDomainSnapshotCurrent,
+                             ruby_libvirt_domain_get(d),
+                             ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(snap == NULL, e_RetrieveError,
                                 "virDomainSnapshotCurrent",
                                 ruby_libvirt_connect_get(d));
@@ -1706,7 +1942,8 @@ static VALUE libvirt_domain_job_info(VALUE d)
     virDomainJobInfo info;
     VALUE result;
 
-    r = virDomainGetJobInfo(ruby_libvirt_domain_get(d), &info);
+    r = RUBY_LIBVIRT_CALL(virDomainGetJobInfo, ruby_libvirt_domain_get(d),
+                          &info);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetJobInfo",
                                 ruby_libvirt_connect_get(d));
 
@@ -1776,7 +2013,8 @@ static VALUE libvirt_domain_scheduler_type(VALUE d)
     VALUE result;
     struct create_sched_type_args args;
 
-    type = virDomainGetSchedulerType(ruby_libvirt_domain_get(d), &nparams);
+    type = RUBY_LIBVIRT_CALL(virDomainGetSchedulerType,
+                             ruby_libvirt_domain_get(d), &nparams);
 
     ruby_libvirt_raise_error_if(type == NULL, e_RetrieveError,
                                 "virDomainGetSchedulerType",
@@ -1813,7 +2051,7 @@ static VALUE libvirt_domain_qemu_monitor_command(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "11", &cmd, &flags);
 
-    type = virConnectGetType(ruby_libvirt_connect_get(d));
+    type = RUBY_LIBVIRT_CALL(virConnectGetType, ruby_libvirt_connect_get(d));
     ruby_libvirt_raise_error_if(type == NULL, e_Error, "virConnectGetType",
                                 ruby_libvirt_connect_get(d));
     /* The type != NULL check is actually redundant, since if type was NULL
@@ -1826,9 +2064,9 @@ static VALUE libvirt_domain_qemu_monitor_command(int argc, VALUE *argv, VALUE d)
                  type);
     }
 
-    r = virDomainQemuMonitorCommand(ruby_libvirt_domain_get(d),
-                                    StringValueCStr(cmd), &result,
-                                    ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainQemuMonitorCommand,
+                          ruby_libvirt_domain_get(d), StringValueCStr(cmd),
+                          &result, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainQemuMonitorCommand",
                                 ruby_libvirt_connect_get(d));
@@ -1866,7 +2104,8 @@ static const char *scheduler_nparams(VALUE d,
 {
     char *type;
 
-    type = virDomainGetSchedulerType(ruby_libvirt_domain_get(d), nparams);
+    type = RUBY_LIBVIRT_CALL(virDomainGetSchedulerType,
+                             ruby_libvirt_domain_get(d), nparams);
     if (type == NULL) {
         return "virDomainGetSchedulerType";
     }
@@ -1883,17 +2122,18 @@ static const char *scheduler_get(VALUE d, unsigned int flags, void *voidparams,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
 
 #ifdef HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainGetSchedulerParametersFlags(ruby_libvirt_domain_get(d), params,
-                                             nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetSchedulerParametersFlags,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
         return "virDomainGetSchedulerParameters";
     }
 #else
     if (flags != 0) {
         rb_raise(e_NoSupportError, "Non-zero flags not supported");
     }
-    if (virDomainGetSchedulerParameters(ruby_libvirt_domain_get(d),
-                                        (virSchedParameterPtr)params,
-                                        nparams) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetSchedulerParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virSchedParameterPtr)params, nparams) < 0) {
         return "virDomainGetSchedulerParameters";
     }
 #endif
@@ -1906,17 +2146,18 @@ static const char *scheduler_set(VALUE d, unsigned int flags,
                                  void *RUBY_LIBVIRT_UNUSED(opaque))
 {
 #if HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainSetSchedulerParametersFlags(ruby_libvirt_domain_get(d), params,
-                                             nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetSchedulerParametersFlags,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
         return "virDomainSetSchedulerParameters";
     }
 #else
     if (flags != 0) {
         rb_raise(e_NoSupportError, "Non-zero flags not supported");
     }
-    if (virDomainSetSchedulerParameters(ruby_libvirt_domain_get(d),
-                                        (virSchedParameterPtr)params,
-                                        nparams) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetSchedulerParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virSchedParameterPtr)params, nparams) < 0) {
         return "virDomainSetSchedulerParameters";
     }
 #endif
@@ -1987,8 +2228,9 @@ static const char *memory_nparams(VALUE d, unsigned int flags,
                                   void *RUBY_LIBVIRT_UNUSED(opaque),
                                   int *nparams)
 {
-    if (virDomainGetMemoryParameters(ruby_libvirt_domain_get(d), NULL, nparams,
-                                     flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetMemoryParameters,
+                          ruby_libvirt_domain_get(d), NULL, nparams,
+                          flags) < 0) {
         return "virDomainGetMemoryParameters";
     }
 
@@ -2001,12 +2243,13 @@ static const char *memory_get(VALUE d, unsigned int flags, void *voidparams,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
 
 #ifdef HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainGetMemoryParameters(ruby_libvirt_domain_get(d), params,
-                                     nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetMemoryParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
 #else
-    if (virDomainGetMemoryParameters(ruby_libvirt_domain_get(d),
-                                     (virMemoryParameterPtr)params, nparams,
-                                     flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetMemoryParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virMemoryParameterPtr)params, nparams, flags) < 0) {
 #endif
         return "virDomainGetMemoryParameters";
     }
@@ -2019,12 +2262,13 @@ static const char *memory_set(VALUE d, unsigned int flags,
                               void *RUBY_LIBVIRT_UNUSED(opaque))
 {
 #ifdef HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainSetMemoryParameters(ruby_libvirt_domain_get(d), params,
-                                     nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetMemoryParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
 #else
-    if (virDomainSetMemoryParameters(ruby_libvirt_domain_get(d),
-                                     (virMemoryParameterPtr)params, nparams,
-                                     flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetMemoryParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virMemoryParameterPtr)params, nparams, flags) < 0) {
 #endif
         return "virDomainSetMemoryParameters";
     }
@@ -2084,8 +2328,9 @@ static const char *blkio_nparams(VALUE d, unsigned int flags,
                                  void *RUBY_LIBVIRT_UNUSED(opaque),
                                  int *nparams)
 {
-    if (virDomainGetBlkioParameters(ruby_libvirt_domain_get(d), NULL, nparams,
-                                    flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetBlkioParameters,
+                          ruby_libvirt_domain_get(d), NULL, nparams,
+                          flags) < 0) {
         return "virDomainGetBlkioParameters";
     }
 
@@ -2098,12 +2343,13 @@ static const char *blkio_get(VALUE d, unsigned int flags, void *voidparams,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
 
 #ifdef HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainGetBlkioParameters(ruby_libvirt_domain_get(d), params, nparams,
-                                    flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetBlkioParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
 #else
-    if (virDomainGetBlkioParameters(ruby_libvirt_domain_get(d),
-                                    (virBlkioParameterPtr)params, nparams,
-                                    flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetBlkioParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virBlkioParameterPtr)params, nparams, flags) < 0) {
 #endif
         return "virDomainGetBlkioParameters";
     }
@@ -2116,12 +2362,13 @@ static const char *blkio_set(VALUE d, unsigned int flags,
                              void *RUBY_LIBVIRT_UNUSED(opaque))
 {
 #ifdef HAVE_TYPE_VIRTYPEDPARAMETERPTR
-    if (virDomainSetBlkioParameters(ruby_libvirt_domain_get(d), params, nparams,
-                                    flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetBlkioParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
 #else
-    if (virDomainSetBlkioParameters(ruby_libvirt_domain_get(d),
-                                    (virBlkioParameterPtr)params, nparams,
-                                    flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetBlkioParameters,
+                          ruby_libvirt_domain_get(d),
+                          (virBlkioParameterPtr)params, nparams, flags) < 0) {
 #endif
         return "virDomainSetBlkioParameters";
     }
@@ -2189,7 +2436,8 @@ static VALUE libvirt_domain_state(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    retval = virDomainGetState(ruby_libvirt_domain_get(d), &state, &reason,
+    retval = RUBY_LIBVIRT_CALL(virDomainGetState, ruby_libvirt_domain_get(d),
+                               &state, &reason,
                                ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(retval < 0, e_Error, "virDomainGetState",
                                 ruby_libvirt_connect_get(d));
@@ -2286,8 +2534,8 @@ static VALUE libvirt_domain_control_info(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    r = virDomainGetControlInfo(ruby_libvirt_domain_get(d), &info,
-                                ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainGetControlInfo, ruby_libvirt_domain_get(d),
+                          &info, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainGetControlInfo",
                                 ruby_libvirt_connect_get(d));
@@ -2347,8 +2595,9 @@ static VALUE libvirt_domain_migrate_max_speed(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    r = virDomainMigrateGetMaxSpeed(ruby_libvirt_domain_get(d), &bandwidth,
-                                    ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainMigrateGetMaxSpeed,
+                          ruby_libvirt_domain_get(d), &bandwidth,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainMigrateGetMaxSpeed",
                                 ruby_libvirt_connect_get(d));
@@ -2546,8 +2795,9 @@ static VALUE libvirt_domain_snapshot_list_children_names(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    num_children = virDomainSnapshotNumChildren(domain_snapshot_get(s),
-                                                ruby_libvirt_value_to_uint(flags));
+    num_children = RUBY_LIBVIRT_CALL(virDomainSnapshotNumChildren,
+                                     domain_snapshot_get(s),
+                                     ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(num_children < 0, e_RetrieveError,
                                 "virDomainSnapshotNumChildren",
                                 ruby_libvirt_connect_get(s));
@@ -2560,9 +2810,9 @@ static VALUE libvirt_domain_snapshot_list_children_names(int argc, VALUE *argv,
 
     children = alloca(num_children * sizeof(char *));
 
-    ret = virDomainSnapshotListChildrenNames(domain_snapshot_get(s), children,
-                                             num_children,
-                                             ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainSnapshotListChildrenNames,
+                            domain_snapshot_get(s), children, num_children,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainSnapshotListChildrenNames",
                                 ruby_libvirt_connect_get(s));
@@ -2628,8 +2878,9 @@ static VALUE libvirt_domain_snapshot_parent(int argc, VALUE *argv, VALUE s)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    snap = virDomainSnapshotGetParent(domain_snapshot_get(s),
-                                      ruby_libvirt_value_to_uint(flags));
+    snap = RUBY_LIBVIRT_CALL(virDomainSnapshotGetParent,
+                             domain_snapshot_get(s),
+                             ruby_libvirt_value_to_uint(flags));
     if (snap == NULL) {
         /* snap may be NULL if there is a root, in which case we want to return
          * nil
@@ -2887,6 +3138,30 @@ static VALUE libvirt_domain_block_resize(int argc, VALUE *argv, VALUE d)
 }
 #endif
 
+#if HAVE_VIRDOMAINSETBLOCKTHRESHOLD
+/*
+ * call-seq:
+ *   dom.set_block_threshold(disk, threshold, flags=0) -> nil
+ *
+ * Call virDomainSetBlockThreshold[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetBlockThreshold]
+ * to have libvirt raise a Libvirt::Connect::DOMAIN_EVENT_ID_BLOCK_THRESHOLD
+ * event once the guest writes past threshold bytes of disk.  The event
+ * fires once; a threshold of 0 clears it.
+ */
+static VALUE libvirt_domain_set_block_threshold(int argc, VALUE *argv, VALUE d)
+{
+    VALUE disk, threshold, flags;
+
+    rb_scan_args(argc, argv, "21", &disk, &threshold, &flags);
+
+    ruby_libvirt_generate_call_nil(virDomainSetBlockThreshold,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d),
+                                   StringValueCStr(disk), NUM2ULL(threshold),
+                                   ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
 #if HAVE_VIRDOMAINPMSUSPENDFORDURATION
 /*
  * call-seq:
@@ -2927,9 +3202,9 @@ static VALUE libvirt_domain_migrate_compression_cache(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    ret = virDomainMigrateGetCompressionCache(ruby_libvirt_domain_get(d),
-                                              &cachesize,
-                                              ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainMigrateGetCompressionCache,
+                            ruby_libvirt_domain_get(d), &cachesize,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainMigrateGetCompressionCache",
                                 ruby_libvirt_connect_get(d));
@@ -3027,9 +3302,9 @@ static VALUE libvirt_domain_emulator_pin_info(int argc, VALUE *argv, VALUE d)
 
     cpumap = alloca(sizeof(unsigned char) * cpumaplen);
 
-    ret = virDomainGetEmulatorPinInfo(ruby_libvirt_domain_get(d), cpumap,
-                                      cpumaplen,
-                                      ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainGetEmulatorPinInfo,
+                            ruby_libvirt_domain_get(d), cpumap, cpumaplen,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainGetEmulatorPinInfo",
                                 ruby_libvirt_connect_get(d));
@@ -3085,6 +3360,203 @@ static VALUE libvirt_domain_pin_emulator(int argc, VALUE *argv, VALUE d)
 }
 #endif
 
+#if HAVE_VIRDOMAINGETIOTHREADINFO
+struct iothread_info_arg {
+    virDomainIOThreadInfoPtr *info;
+    int ninfo;
+};
+
+static VALUE iothread_info_to_array(VALUE in)
+{
+    struct iothread_info_arg *args = (struct iothread_info_arg *)in;
+    VALUE result, tmp;
+    int i;
+
+    result = rb_ary_new2(args->ninfo);
+    for (i = 0; i < args->ninfo; i++) {
+        tmp = rb_class_new_instance(0, NULL, c_domain_iothreadinfo);
+        rb_iv_set(tmp, "@id", UINT2NUM(args->info[i]->iothread_id));
+        rb_iv_set(tmp, "@cpumap",
+                  ruby_libvirt_cpumap_to_bitmap(args->info[i]->cpumap,
+                                                args->info[i]->cpumaplen));
+        rb_ary_push(result, tmp);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   dom.iothread_info(flags=0) -> [ Libvirt::Domain::IOThreadInfo ]
+ *
+ * Call virDomainGetIOThreadInfo[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainGetIOThreadInfo]
+ * to retrieve the IOThreads of this domain.  The cpumap of each is an Integer
+ * with bit N set if the IOThread may run on physical CPU N.
+ */
+static VALUE libvirt_domain_iothread_info(int argc, VALUE *argv, VALUE d)
+{
+    VALUE flags, result;
+    struct iothread_info_arg args;
+    int i, exception = 0;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    args.ninfo = RUBY_LIBVIRT_CALL(virDomainGetIOThreadInfo,
+                                   ruby_libvirt_domain_get(d), &args.info,
+                                   ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(args.ninfo < 0, e_RetrieveError,
+                                "virDomainGetIOThreadInfo",
+                                ruby_libvirt_connect_get(d));
+
+    result = rb_protect(iothread_info_to_array, (VALUE)&args, &exception);
+
+    for (i = 0; i < args.ninfo; i++) {
+        virDomainIOThreadInfoFree(args.info[i]);
+    }
+    free(args.info);
+
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+#if HAVE_VIRDOMAINPINIOTHREAD
+/*
+ * call-seq:
+ *   dom.pin_iothread(iothread_id, cpus, flags=0) -> nil
+ *
+ * Call virDomainPinIOThread[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainPinIOThread]
+ * to pin an IOThread to a set of physical processors.  The cpus may be an
+ * array of Fixnums naming the physical processors, or an Integer bitmap as
+ * returned in Libvirt::Domain::IOThreadInfo#cpumap.
+ */
+static VALUE libvirt_domain_pin_iothread(int argc, VALUE *argv, VALUE d)
+{
+    VALUE iothread_id, cpus, flags;
+    int cpumaplen, maxcpus;
+    unsigned char *cpumap;
+
+    rb_scan_args(argc, argv, "21", &iothread_id, &cpus, &flags);
+
+    maxcpus = ruby_libvirt_get_maxcpus(ruby_libvirt_connect_get(d));
+
+    cpumaplen = VIR_CPU_MAPLEN(maxcpus);
+
+    cpumap = alloca(sizeof(unsigned char) * cpumaplen);
+    ruby_libvirt_bitmap_to_cpumap(cpus, cpumap, cpumaplen);
+
+    ruby_libvirt_generate_call_nil(virDomainPinIOThread,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d),
+                                   NUM2UINT(iothread_id), cpumap, cpumaplen,
+                                   ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_VIRDOMAINADDIOTHREAD
+/*
+ * call-seq:
+ *   dom.add_iothread(iothread_id, flags=0) -> nil
+ *
+ * Call virDomainAddIOThread[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainAddIOThread]
+ * to add an IOThread with the given id to the domain.
+ */
+static VALUE libvirt_domain_add_iothread(int argc, VALUE *argv, VALUE d)
+{
+    VALUE iothread_id, flags;
+
+    rb_scan_args(argc, argv, "11", &iothread_id, &flags);
+
+    ruby_libvirt_generate_call_nil(virDomainAddIOThread,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d),
+                                   NUM2UINT(iothread_id),
+                                   ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_VIRDOMAINDELIOTHREAD
+/*
+ * call-seq:
+ *   dom.del_iothread(iothread_id, flags=0) -> nil
+ *
+ * Call virDomainDelIOThread[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainDelIOThread]
+ * to remove the IOThread with the given id from the domain.
+ */
+static VALUE libvirt_domain_del_iothread(int argc, VALUE *argv, VALUE d)
+{
+    VALUE iothread_id, flags;
+
+    rb_scan_args(argc, argv, "11", &iothread_id, &flags);
+
+    ruby_libvirt_generate_call_nil(virDomainDelIOThread,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d),
+                                   NUM2UINT(iothread_id),
+                                   ruby_libvirt_value_to_uint(flags));
+}
+#endif
+
+#if HAVE_VIRDOMAINSETIOTHREADPARAMS
+static struct ruby_libvirt_typed_param iothread_allowed[] = {
+    {VIR_DOMAIN_IOTHREAD_POLL_MAX_NS, VIR_TYPED_PARAM_ULLONG},
+    {VIR_DOMAIN_IOTHREAD_POLL_GROW, VIR_TYPED_PARAM_UINT},
+    {VIR_DOMAIN_IOTHREAD_POLL_SHRINK, VIR_TYPED_PARAM_UINT},
+#if HAVE_CONST_VIR_DOMAIN_IOTHREAD_AIO_MAX_BATCH
+    {VIR_DOMAIN_IOTHREAD_AIO_MAX_BATCH, VIR_TYPED_PARAM_ULLONG},
+#endif
+#if HAVE_CONST_VIR_DOMAIN_IOTHREAD_THREAD_POOL_MIN
+    {VIR_DOMAIN_IOTHREAD_THREAD_POOL_MIN, VIR_TYPED_PARAM_INT},
+    {VIR_DOMAIN_IOTHREAD_THREAD_POOL_MAX, VIR_TYPED_PARAM_INT},
+#endif
+};
+
+static const char *iothread_set(VALUE d, unsigned int flags,
+                                virTypedParameterPtr params, int nparams,
+                                void *opaque)
+{
+    unsigned int iothread_id = *((unsigned int *)opaque);
+
+    if (RUBY_LIBVIRT_CALL(virDomainSetIOThreadParams,
+                          ruby_libvirt_domain_get(d), iothread_id, params,
+                          nparams, flags) < 0) {
+        return "virDomainSetIOThreadParams";
+    }
+
+    return NULL;
+}
+
+/*
+ * call-seq:
+ *   dom.set_iothread_params(iothread_id, Hash, flags=0) -> nil
+ *
+ * Call virDomainSetIOThreadParams[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetIOThreadParams]
+ * to tune the polling of an IOThread of a running domain.  The keys are
+ * "poll_max_ns", "poll_grow" and "poll_shrink" (and, where libvirt knows
+ * them, "aio_max_batch", "thread_pool_min" and "thread_pool_max").  If an
+ * empty hash is given, no changes are made (and no error is raised).
+ */
+static VALUE libvirt_domain_set_iothread_params(int argc, VALUE *argv,
+                                                VALUE d)
+{
+    VALUE iothread_id, hash, flags;
+    unsigned int id;
+
+    rb_scan_args(argc, argv, "21", &iothread_id, &hash, &flags);
+
+    id = NUM2UINT(iothread_id);
+
+    return ruby_libvirt_set_typed_parameters(d, hash,
+                                             ruby_libvirt_value_to_uint(flags),
+                                             &id, iothread_allowed,
+                                             ARRAY_SIZE(iothread_allowed),
+                                             iothread_set);
+}
+#endif
+
 #if HAVE_VIRDOMAINGETSECURITYLABELLIST
 /*
  * call-seq:
@@ -3099,7 +3571,8 @@ static VALUE libvirt_domain_security_label_list(VALUE d)
     int r, i;
     VALUE result, tmp;
 
-    r = virDomainGetSecurityLabelList(ruby_libvirt_domain_get(d), &seclabels);
+    r = RUBY_LIBVIRT_CALL(virDomainGetSecurityLabelList,
+                          ruby_libvirt_domain_get(d), &seclabels);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainGetSecurityLabel",
                                 ruby_libvirt_connect_get(d));
@@ -3118,7 +3591,7 @@ static VALUE libvirt_domain_security_label_list(VALUE d)
 }
 #endif
 
-#if HAVE_VIRDOMAINGETJOBSTATS
+#if HAVE_VIRDOMAINGETJOBSTATS || HAVE_VIRDOMAINGETPERFEVENTS
 struct params_to_hash_arg {
     virTypedParameterPtr params;
     int nparams;
@@ -3134,8 +3607,11 @@ static VALUE params_to_hash(VALUE in)
         ruby_libvirt_typed_params_to_hash(args->params, i, args->result);
     }
 
-    return Qnil;
+    return args->result;
 }
+#endif
+
+#if HAVE_VIRDOMAINGETJOBSTATS
 
 /*
  * call-seq:
@@ -3156,8 +3632,9 @@ static VALUE libvirt_domain_job_stats(int argc, VALUE *argv, VALUE d)
 
     result = rb_hash_new();
 
-    r = virDomainGetJobStats(ruby_libvirt_domain_get(d), &type, &params,
-                             &nparams, ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainGetJobStats, ruby_libvirt_domain_get(d),
+                          &type, &params, &nparams,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetJobStats",
                                 ruby_libvirt_connect_get(d));
 
@@ -3189,15 +3666,435 @@ static VALUE libvirt_domain_job_stats(int argc, VALUE *argv, VALUE d)
 }
 #endif
 
+#if HAVE_VIRDOMAINGETPERFEVENTS
+/*
+ * call-seq:
+ *   dom.perf_events(flags=0) -> Hash
+ *
+ * Call virDomainGetPerfEvents[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainGetPerfEvents]
+ * to retrieve which hardware perf events (such as "cmt", "mbmt", "mbml",
+ * "cpu_cycles", "instructions" or "cache_misses") are enabled for this
+ * domain.  The values are +true+ or +false+.
+ */
+static VALUE libvirt_domain_perf_events(int argc, VALUE *argv, VALUE d)
+{
+    VALUE flags;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0, r, exception = 0;
+    struct params_to_hash_arg args;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    r = RUBY_LIBVIRT_CALL(virDomainGetPerfEvents, ruby_libvirt_domain_get(d),
+                          &params, &nparams,
+                          ruby_libvirt_value_to_uint(flags));
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
+                                "virDomainGetPerfEvents",
+                                ruby_libvirt_connect_get(d));
+
+    args.params = params;
+    args.nparams = nparams;
+    args.result = rb_hash_new();
+    rb_protect(params_to_hash, (VALUE)&args, &exception);
+    virTypedParamsFree(params, nparams);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return args.result;
+}
+#endif
+
+#if HAVE_VIRDOMAINSETPERFEVENTS
+struct perf_event_assign_arg {
+    virTypedParameterPtr params;
+    int i;
+};
+
+/* every perf event is a boolean, so any name libvirt knows is accepted */
+static int perf_event_assign(VALUE key, VALUE val, VALUE in)
+{
+    struct perf_event_assign_arg *args = (struct perf_event_assign_arg *)in;
+    virTypedParameterPtr param = &args->params[args->i];
+
+    param->type = VIR_TYPED_PARAM_BOOLEAN;
+    param->value.b = (val == Qtrue) ? 1 : 0;
+    param->field[VIR_TYPED_PARAM_FIELD_LENGTH - 1] = '\0';
+    strncpy(param->field, StringValueCStr(key),
+            VIR_TYPED_PARAM_FIELD_LENGTH - 1);
+    args->i++;
+
+    return ST_CONTINUE;
+}
+
+/*
+ * call-seq:
+ *   dom.perf_events = Hash,flags=0
+ *
+ * Call virDomainSetPerfEvents[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetPerfEvents]
+ * to enable (+true+) or disable (+false+) hardware perf events for this
+ * domain.  The keys are the same as those returned by dom.perf_events.  If
+ * an empty hash is given, no changes are made (and no error is raised).
+ */
+static VALUE libvirt_domain_perf_events_equal(VALUE d, VALUE in)
+{
+    VALUE hash, flags;
+    struct perf_event_assign_arg args;
+    unsigned int nflags;
+
+    ruby_libvirt_assign_hash_and_flags(in, &hash, &flags);
+    Check_Type(hash, T_HASH);
+    nflags = NUM2UINT(flags);
+
+    if (RHASH_SIZE(hash) == 0) {
+        return Qnil;
+    }
+
+    args.params = alloca(sizeof(virTypedParameter) * RHASH_SIZE(hash));
+    args.i = 0;
+    rb_hash_foreach(hash, perf_event_assign, (VALUE)&args);
+
+    ruby_libvirt_generate_call_nil(virDomainSetPerfEvents,
+                                   ruby_libvirt_connect_get(d),
+                                   ruby_libvirt_domain_get(d), args.params,
+                                   args.i, nflags);
+}
+#endif
+
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS
+struct domain_stats_arg {
+    virDomainStatsRecordPtr *records;
+    int nrecords;
+    const char *prefix;
+};
+
+static VALUE domain_stats_to_hash(VALUE in)
+{
+    struct domain_stats_arg *args = (struct domain_stats_arg *)in;
+    virDomainStatsRecordPtr record;
+    virTypedParameter param;
+    size_t prefixlen = strlen(args->prefix);
+    VALUE result, stats;
+    int i, j;
+
+    result = rb_hash_new();
+    for (i = 0; i < args->nrecords; i++) {
+        record = args->records[i];
+        stats = rb_hash_new();
+        for (j = 0; j < record->nparams; j++) {
+            if (strncmp(record->params[j].field, args->prefix,
+                        prefixlen) != 0) {
+                continue;
+            }
+            param = record->params[j];
+            memmove(param.field, param.field + prefixlen,
+                    strlen(param.field + prefixlen) + 1);
+            ruby_libvirt_typed_params_to_hash(&param, 0, stats);
+        }
+        rb_hash_aset(result, rb_str_new2(virDomainGetName(record->dom)),
+                     stats);
+    }
+
+    return result;
+}
+
+/*
+ * Fetch the STATS groups (VIR_DOMAIN_STATS_*) of DOMAINS, an Array of
+ * Libvirt::Domain or nil for every domain on C, with a single call.  The
+ * result maps each domain's name to a Hash of its fields that start with
+ * PREFIX, with the prefix removed.
+ */
+VALUE ruby_libvirt_domain_stats(VALUE c, VALUE domains, unsigned int stats,
+                                unsigned int flags, const char *prefix)
+{
+    struct domain_stats_arg args;
+    virDomainPtr *doms;
+    VALUE result, dom;
+    int i, exception = 0;
+
+    args.prefix = prefix;
+
+    if (NIL_P(domains)) {
+        args.nrecords = RUBY_LIBVIRT_CALL(virConnectGetAllDomainStats,
+                                          ruby_libvirt_connect_get(c), stats,
+                                          &args.records, flags);
+        ruby_libvirt_raise_error_if(args.nrecords < 0, e_RetrieveError,
+                                    "virConnectGetAllDomainStats",
+                                    ruby_libvirt_connect_get(c));
+    }
+    else {
+        Check_Type(domains, T_ARRAY);
+        doms = alloca(sizeof(virDomainPtr) * (RARRAY_LEN(domains) + 1));
+        for (i = 0; i < RARRAY_LEN(domains); i++) {
+            dom = rb_ary_entry(domains, i);
+            if (rb_obj_is_kind_of(dom, c_domain) != Qtrue) {
+                rb_raise(rb_eTypeError,
+                         "wrong argument type (expected Libvirt::Domain)");
+            }
+            doms[i] = ruby_libvirt_domain_get(dom);
+        }
+        doms[i] = NULL;
+
+        args.nrecords = RUBY_LIBVIRT_CALL(virDomainListGetStats, doms, stats,
+                                          &args.records, flags);
+        ruby_libvirt_raise_error_if(args.nrecords < 0, e_RetrieveError,
+                                    "virDomainListGetStats",
+                                    ruby_libvirt_connect_get(c));
+    }
+
+    result = rb_protect(domain_stats_to_hash, (VALUE)&args, &exception);
+    virDomainStatsRecordListFree(args.records);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+#if HAVE_VIRDOMAINMANAGEDSAVE && HAVE_VIRCONNECTLISTALLDOMAINS
+struct domain_bulk_job {
+    virDomainPtr dom;
+    const char *failed;
+    virError error;
+    double time;
+};
+
+struct domain_bulk {
+    VALUE domains;
+    struct domain_bulk_job *jobs;
+    int njobs;
+    int restore;
+    virTypedParameterPtr params;
+    int nparams;
+    unsigned int flags;
+};
+
+static void domain_bulk_free(struct domain_bulk *b)
+{
+    int i;
+
+    for (i = 0; i < b->njobs; i++) {
+        if (b->jobs[i].dom != NULL) {
+            virDomainFree(b->jobs[i].dom);
+        }
+        if (b->jobs[i].failed != NULL) {
+            virResetError(&b->jobs[i].error);
+        }
+    }
+    free(b->jobs);
+    for (i = 0; i < b->nparams; i++) {
+        if (b->params[i].type == VIR_TYPED_PARAM_STRING) {
+            free(b->params[i].value.s);
+        }
+    }
+}
+
+static VALUE domain_bulk_parse(VALUE arg)
+{
+    struct domain_bulk *b = (struct domain_bulk *)arg;
+    VALUE entry;
+    int i;
+
+    for (i = 0; i < b->njobs; i++) {
+        entry = rb_ary_entry(b->domains, i);
+        if (rb_obj_is_kind_of(entry, c_domain) != Qtrue) {
+            rb_raise(rb_eTypeError,
+                     "wrong argument type (expected Libvirt::Domain)");
+        }
+        b->jobs[i].dom = ruby_libvirt_domain_get(entry);
+        virDomainRef(b->jobs[i].dom);
+    }
+
+    return Qnil;
+}
+
+static void domain_bulk_run(void *opaque, int i)
+{
+    struct domain_bulk *b = (struct domain_bulk *)opaque;
+    struct domain_bulk_job *job = &b->jobs[i];
+    double start;
+    int r;
+
+    start = ruby_libvirt_monotonic_time();
+
+    if (b->restore) {
+        r = virDomainCreateWithFlags(job->dom, b->flags);
+        job->failed = "virDomainCreateWithFlags";
+    }
+#if HAVE_VIRDOMAINSAVEPARAMS
+    else if (b->nparams > 0) {
+        r = virDomainSaveParams(job->dom, b->params, b->nparams, b->flags);
+        job->failed = "virDomainSaveParams";
+    }
+#endif
+    else {
+        r = virDomainManagedSave(job->dom, b->flags);
+        job->failed = "virDomainManagedSave";
+    }
+    if (r == 0) {
+        job->failed = NULL;
+    }
+    else {
+        virCopyLastError(&job->error);
+        virResetLastError();
+    }
+
+    job->time = ruby_libvirt_monotonic_time() - start;
+}
+
+static VALUE domain_bulk_result(VALUE arg)
+{
+    struct domain_bulk *b = (struct domain_bulk *)arg;
+    struct domain_bulk_job *job;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(b->njobs);
+    for (i = 0; i < b->njobs; i++) {
+        job = &b->jobs[i];
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("name"),
+                     rb_str_new2(virDomainGetName(job->dom)));
+        rb_hash_aset(hash, rb_str_new2("error"), job->failed == NULL ? Qnil :
+                     ruby_libvirt_error_new(e_Error, job->failed,
+                                            &job->error));
+        rb_hash_aset(hash, rb_str_new2("time"), rb_float_new(job->time));
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/*
+ * Managed-save (or, if RESTORE, start again from their managed save images)
+ * all of DOMAINS, an Array of Libvirt::Domain or nil for every domain on C
+ * that the operation applies to, on up to CONCURRENCY worker threads.  A
+ * non-empty PARAMS Hash (save only, and without SAVE_PARAM_FILE or
+ * SAVE_PARAM_DXML) is passed to virDomainSaveParams for every domain.
+ * Returns an Array with a result Hash per domain.
+ */
+VALUE ruby_libvirt_domain_managed_save_bulk(VALUE c, VALUE domains,
+                                            int restore, VALUE params,
+                                            unsigned int flags,
+                                            int concurrency)
+{
+    struct domain_bulk b;
+    virDomainPtr *doms;
+    VALUE result;
+    int n, i, exception = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.restore = restore;
+    b.flags = flags;
+
+    if (!NIL_P(params)) {
+        Check_Type(params, T_HASH);
+    }
+    if (!NIL_P(params) && RHASH_SIZE(params) > 0) {
+#if HAVE_VIRDOMAINSAVEPARAMS
+        b.params = alloca(sizeof(virTypedParameter) *
+                          ARRAY_SIZE(save_allowed));
+        b.nparams = domain_save_params_from_hash(params, b.params);
+        /* one file or XML for every domain would have them overwrite each
+         * other's images or take on each other's configuration */
+        for (i = 0; i < b.nparams; i++) {
+            if (strcmp(b.params[i].field, VIR_DOMAIN_SAVE_PARAM_FILE) == 0 ||
+                strcmp(b.params[i].field, VIR_DOMAIN_SAVE_PARAM_DXML) == 0) {
+                rb_raise(rb_eArgError,
+                         "%s cannot be applied to several domains at once",
+                         b.params[i].field);
+            }
+        }
+        /* the workers run without the GVL, so they get their own copies */
+        for (i = 0; i < b.nparams; i++) {
+            if (b.params[i].type == VIR_TYPED_PARAM_STRING) {
+                b.params[i].value.s = strdup(b.params[i].value.s);
+                if (b.params[i].value.s == NULL) {
+                    b.nparams = i;
+                    domain_bulk_free(&b);
+                    rb_memerror();
+                }
+            }
+        }
+#else
+        rb_raise(e_NoSupportError, "Non-empty params not supported");
+#endif
+    }
+
+    if (NIL_P(domains)) {
+        n = virConnectListAllDomains(ruby_libvirt_connect_get(c), &doms,
+                                     restore ?
+                                     VIR_CONNECT_LIST_DOMAINS_INACTIVE |
+                                     VIR_CONNECT_LIST_DOMAINS_MANAGEDSAVE :
+                                     VIR_CONNECT_LIST_DOMAINS_ACTIVE |
+                                     VIR_CONNECT_LIST_DOMAINS_PERSISTENT);
+        if (n < 0) {
+            domain_bulk_free(&b);
+        }
+        ruby_libvirt_raise_error_if(n < 0, e_RetrieveError,
+                                    "virConnectListAllDomains",
+                                    ruby_libvirt_connect_get(c));
+        b.jobs = calloc(n + 1, sizeof(struct domain_bulk_job));
+        if (b.jobs == NULL) {
+            for (i = 0; i < n; i++) {
+                virDomainFree(doms[i]);
+            }
+            free(doms);
+            domain_bulk_free(&b);
+            rb_memerror();
+        }
+        b.njobs = n;
+        for (i = 0; i < n; i++) {
+            b.jobs[i].dom = doms[i];
+        }
+        free(doms);
+    }
+    else {
+        Check_Type(domains, T_ARRAY);
+        b.domains = domains;
+        b.jobs = calloc(RARRAY_LEN(domains) + 1,
+                        sizeof(struct domain_bulk_job));
+        if (b.jobs == NULL) {
+            domain_bulk_free(&b);
+            rb_memerror();
+        }
+        b.njobs = RARRAY_LEN(domains);
+
+        rb_protect(domain_bulk_parse, (VALUE)&b, &exception);
+        if (exception) {
+            domain_bulk_free(&b);
+            rb_jump_tag(exception);
+        }
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_NORMAL,
+                                               b.njobs, concurrency,
+                                               domain_bulk_run, &b);
+    if (exception) {
+        domain_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(domain_bulk_result, (VALUE)&b, &exception);
+    domain_bulk_free(&b);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
 #if HAVE_VIRDOMAINGETBLOCKIOTUNE
 static const char *iotune_nparams(VALUE d, unsigned int flags, void *opaque,
                                   int *nparams)
 {
     VALUE disk = (VALUE)opaque;
 
-    if (virDomainGetBlockIoTune(ruby_libvirt_domain_get(d),
-                                ruby_libvirt_get_cstring_or_null(disk), NULL,
-                                nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetBlockIoTune, ruby_libvirt_domain_get(d),
+                          ruby_libvirt_get_cstring_or_null(disk), NULL,
+                          nparams, flags) < 0) {
         return "virDomainGetBlockIoTune";
     }
 
@@ -3210,9 +4107,9 @@ static const char *iotune_get(VALUE d, unsigned int flags, void *voidparams,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
     VALUE disk = (VALUE)opaque;
 
-    if (virDomainGetBlockIoTune(ruby_libvirt_domain_get(d),
-                                ruby_libvirt_get_cstring_or_null(disk), params,
-                                nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetBlockIoTune, ruby_libvirt_domain_get(d),
+                          ruby_libvirt_get_cstring_or_null(disk), params,
+                          nparams, flags) < 0) {
         return "virDomainGetBlockIoTune";
     }
     return NULL;
@@ -3224,9 +4121,8 @@ static const char *iotune_set(VALUE d, unsigned int flags,
 {
     VALUE disk = (VALUE)opaque;
 
-    if (virDomainSetBlockIoTune(ruby_libvirt_domain_get(d),
-                                StringValueCStr(disk), params, nparams,
-                                flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetBlockIoTune, ruby_libvirt_domain_get(d),
+                          StringValueCStr(disk), params, nparams, flags) < 0) {
         return "virDomainSetBlockIoTune";
     }
 
@@ -3415,9 +4311,9 @@ static VALUE libvirt_domain_block_job_info(int argc, VALUE *argv, VALUE d)
 
     memset(&info, 0, sizeof(virDomainBlockJobInfo));
 
-    r = virDomainGetBlockJobInfo(ruby_libvirt_domain_get(d),
-                                 StringValueCStr(disk), &info,
-                                 ruby_libvirt_value_to_uint(flags));
+    r = RUBY_LIBVIRT_CALL(virDomainGetBlockJobInfo, ruby_libvirt_domain_get(d),
+                          StringValueCStr(disk), &info,
+                          ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virDomainGetBlockJobInfo",
                                 ruby_libvirt_connect_get(d));
@@ -3460,9 +4356,9 @@ static const char *interface_nparams(VALUE d, unsigned int flags, void *opaque,
 {
     VALUE device = (VALUE)opaque;
 
-    if (virDomainGetInterfaceParameters(ruby_libvirt_domain_get(d),
-                                        StringValueCStr(device), NULL, nparams,
-                                        flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetInterfaceParameters,
+                          ruby_libvirt_domain_get(d), StringValueCStr(device),
+                          NULL, nparams, flags) < 0) {
         return "virDomainGetInterfaceParameters";
     }
 
@@ -3475,9 +4371,10 @@ static const char *interface_get(VALUE d, unsigned int flags, void *voidparams,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
     VALUE interface = (VALUE)opaque;
 
-    if (virDomainGetInterfaceParameters(ruby_libvirt_domain_get(d),
-                                        StringValueCStr(interface), params,
-                                        nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetInterfaceParameters,
+                          ruby_libvirt_domain_get(d),
+                          StringValueCStr(interface), params, nparams,
+                          flags) < 0) {
         return "virDomainGetInterfaceParameters";
     }
     return NULL;
@@ -3489,9 +4386,9 @@ static const char *interface_set(VALUE d, unsigned int flags,
 {
     VALUE device = (VALUE)opaque;
 
-    if (virDomainSetInterfaceParameters(ruby_libvirt_domain_get(d),
-                                        StringValueCStr(device), params,
-                                        nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetInterfaceParameters,
+                          ruby_libvirt_domain_get(d), StringValueCStr(device),
+                          params, nparams, flags) < 0) {
         return "virDomainSetIntefaceParameters";
     }
 
@@ -3572,9 +4469,8 @@ static const char *block_stats_nparams(VALUE d, unsigned int flags,
 {
     VALUE disk = (VALUE)opaque;
 
-    if (virDomainBlockStatsFlags(ruby_libvirt_domain_get(d),
-                                 StringValueCStr(disk), NULL, nparams,
-                                 flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainBlockStatsFlags, ruby_libvirt_domain_get(d),
+                          StringValueCStr(disk), NULL, nparams, flags) < 0) {
         return "virDomainBlockStatsFlags";
     }
 
@@ -3587,9 +4483,8 @@ static const char *block_stats_get(VALUE d, unsigned int flags,
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
     VALUE disk = (VALUE)opaque;
 
-    if (virDomainBlockStatsFlags(ruby_libvirt_domain_get(d),
-                                 StringValueCStr(disk), params, nparams,
-                                 flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainBlockStatsFlags, ruby_libvirt_domain_get(d),
+                          StringValueCStr(disk), params, nparams, flags) < 0) {
         return "virDomainBlockStatsFlags";
     }
     return NULL;
@@ -3624,8 +4519,9 @@ static const char *numa_nparams(VALUE d, unsigned int flags,
                                 void *RUBY_LIBVIRT_UNUSED(opaque),
                                 int *nparams)
 {
-    if (virDomainGetNumaParameters(ruby_libvirt_domain_get(d), NULL, nparams,
-                                   flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetNumaParameters,
+                          ruby_libvirt_domain_get(d), NULL, nparams,
+                          flags) < 0) {
         return "virDomainGetNumaParameters";
     }
 
@@ -3637,8 +4533,9 @@ static const char *numa_get(VALUE d, unsigned int flags, void *voidparams,
 {
     virTypedParameterPtr params = (virTypedParameterPtr)voidparams;
 
-    if (virDomainGetNumaParameters(ruby_libvirt_domain_get(d), params, nparams,
-                                   flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainGetNumaParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
         return "virDomainGetNumaParameters";
     }
     return NULL;
@@ -3648,8 +4545,9 @@ static const char *numa_set(VALUE d, unsigned int flags,
                             virTypedParameterPtr params, int nparams,
                             void *RUBY_LIBVIRT_UNUSED(opaque))
 {
-    if (virDomainSetNumaParameters(ruby_libvirt_domain_get(d), params,
-                                   nparams, flags) < 0) {
+    if (RUBY_LIBVIRT_CALL(virDomainSetNumaParameters,
+                          ruby_libvirt_domain_get(d), params, nparams,
+                          flags) < 0) {
         return "virDomainSetNumaParameters";
     }
 
@@ -3721,8 +4619,9 @@ static VALUE libvirt_domain_lxc_open_namespace(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    ret = virDomainLxcOpenNamespace(ruby_libvirt_domain_get(d),
-                                    &fdlist, ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainLxcOpenNamespace,
+                            ruby_libvirt_domain_get(d), &fdlist,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainLxcOpenNamespace",
                                 ruby_libvirt_connect_get(d));
@@ -3775,10 +4674,11 @@ static VALUE libvirt_domain_qemu_agent_command(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "12", &command, &timeout, &flags);
 
-    ret = virDomainQemuAgentCommand(ruby_libvirt_domain_get(d),
-                                    StringValueCStr(command),
-                                    ruby_libvirt_value_to_int(timeout),
-                                    ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainQemuAgentCommand,
+                            ruby_libvirt_domain_get(d),
+                            StringValueCStr(command),
+                            ruby_libvirt_value_to_int(timeout),
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret == NULL, e_RetrieveError,
                                 "virDomainQemuAgentCommand",
                                 ruby_libvirt_connect_get(d));
@@ -3823,10 +4723,10 @@ static VALUE libvirt_domain_lxc_enter_namespace(int argc, VALUE *argv, VALUE d)
         fdlist[i] = NUM2INT(rb_ary_entry(fds, i));
     }
 
-    ret = virDomainLxcEnterNamespace(ruby_libvirt_domain_get(d),
-                                     RARRAY_LEN(fds), fdlist, &noldfdlist,
-                                     &oldfdlist,
-                                     ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainLxcEnterNamespace,
+                            ruby_libvirt_domain_get(d), RARRAY_LEN(fds),
+                            fdlist, &noldfdlist, &oldfdlist,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                 "virDomainLxcEnterNamespace",
                                 ruby_libvirt_connect_get(d));
@@ -3905,7 +4805,7 @@ static VALUE libvirt_domain_migrate3(int argc, VALUE *argv, VALUE d)
                         (VALUE)&args);
     }
 
-    ddom = virDomainMigrate3(ruby_libvirt_domain_get(d),
+    ddom = RUBY_LIBVIRT_CALL(virDomainMigrate3, ruby_libvirt_domain_get(d),
                              ruby_libvirt_connect_get(dconn), args.params,
                              args.i, ruby_libvirt_value_to_uint(flags));
 
@@ -3991,18 +4891,20 @@ static VALUE libvirt_domain_cpu_stats(int argc, VALUE *argv, VALUE d)
     }
 
     if (NUM2INT(start_cpu) == -1) {
-        nparams = virDomainGetCPUStats(ruby_libvirt_domain_get(d), NULL, 0,
-                                       NUM2INT(start_cpu), NUM2UINT(numcpus),
-                                       NUM2UINT(flags));
+        nparams = RUBY_LIBVIRT_CALL(virDomainGetCPUStats,
+                                    ruby_libvirt_domain_get(d), NULL, 0,
+                                    NUM2INT(start_cpu), NUM2UINT(numcpus),
+                                    NUM2UINT(flags));
         ruby_libvirt_raise_error_if(nparams < 0, e_RetrieveError,
                                     "virDomainGetCPUStats",
                                     ruby_libvirt_connect_get(d));
 
         params = alloca(nparams * sizeof(virTypedParameter));
 
-        ret = virDomainGetCPUStats(ruby_libvirt_domain_get(d), params, nparams,
-                                   NUM2INT(start_cpu), NUM2UINT(numcpus),
-                                   NUM2UINT(flags));
+        ret = RUBY_LIBVIRT_CALL(virDomainGetCPUStats,
+                                ruby_libvirt_domain_get(d), params, nparams,
+                                NUM2INT(start_cpu), NUM2UINT(numcpus),
+                                NUM2UINT(flags));
         ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                     "virDomainGetCPUStats",
                                     ruby_libvirt_connect_get(d));
@@ -4016,17 +4918,19 @@ static VALUE libvirt_domain_cpu_stats(int argc, VALUE *argv, VALUE d)
         rb_hash_aset(result, rb_str_new2("all"), tmp);
     }
     else {
-        nparams = virDomainGetCPUStats(ruby_libvirt_domain_get(d), NULL, 0, 0,
-                                       1, NUM2UINT(flags));
+        nparams = RUBY_LIBVIRT_CALL(virDomainGetCPUStats,
+                                    ruby_libvirt_domain_get(d), NULL, 0, 0, 1,
+                                    NUM2UINT(flags));
         ruby_libvirt_raise_error_if(nparams < 0, e_RetrieveError,
                                     "virDomainGetCPUStats",
                                     ruby_libvirt_connect_get(d));
 
         params = alloca(nparams * NUM2UINT(numcpus) * sizeof(virTypedParameter));
 
-        ret = virDomainGetCPUStats(ruby_libvirt_domain_get(d), params, nparams,
-                                   NUM2INT(start_cpu), NUM2UINT(numcpus),
-                                   NUM2UINT(flags));
+        ret = RUBY_LIBVIRT_CALL(virDomainGetCPUStats,
+                                ruby_libvirt_domain_get(d), params, nparams,
+                                NUM2INT(start_cpu), NUM2UINT(numcpus),
+                                NUM2UINT(flags));
         ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError,
                                     "virDomainGetCPUStats",
                                     ruby_libvirt_connect_get(d));
@@ -4066,8 +4970,9 @@ static VALUE libvirt_domain_get_time(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    ret = virDomainGetTime(ruby_libvirt_domain_get(d), &seconds, &nseconds,
-                           ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainGetTime, ruby_libvirt_domain_get(d),
+                            &seconds, &nseconds,
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_Error, "virDomainGetTime",
                                 ruby_libvirt_connect_get(d));
 
@@ -4259,8 +5164,8 @@ static VALUE libvirt_domain_fs_info(int argc, VALUE *argv, VALUE d)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    ret = virDomainGetFSInfo(ruby_libvirt_domain_get(d), &info,
-                             ruby_libvirt_value_to_uint(flags));
+    ret = RUBY_LIBVIRT_CALL(virDomainGetFSInfo, ruby_libvirt_domain_get(d),
+                            &info, ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(ret < 0, e_Error, "virDomainGetFSInfo",
                                 ruby_libvirt_connect_get(d));
 
@@ -4530,6 +5435,24 @@ void ruby_libvirt_domain_init(void)
 #if HAVE_CONST_VIR_DOMAIN_SAVE_PAUSED
     rb_define_const(c_domain, "SAVE_PAUSED", INT2NUM(VIR_DOMAIN_SAVE_PAUSED));
 #endif
+#if HAVE_CONST_VIR_DOMAIN_SAVE_PARALLEL
+    rb_define_const(c_domain, "SAVE_PARALLEL",
+                    INT2NUM(VIR_DOMAIN_SAVE_PARALLEL));
+#endif
+#if HAVE_VIRDOMAINSAVEPARAMS
+    rb_define_const(c_domain, "SAVE_PARAM_FILE",
+                    rb_str_new2(VIR_DOMAIN_SAVE_PARAM_FILE));
+    rb_define_const(c_domain, "SAVE_PARAM_DXML",
+                    rb_str_new2(VIR_DOMAIN_SAVE_PARAM_DXML));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_SAVE_PARAM_IMAGE_FORMAT
+    rb_define_const(c_domain, "SAVE_PARAM_IMAGE_FORMAT",
+                    rb_str_new2(VIR_DOMAIN_SAVE_PARAM_IMAGE_FORMAT));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_SAVE_PARAM_PARALLEL_CHANNELS
+    rb_define_const(c_domain, "SAVE_PARAM_PARALLEL_CHANNELS",
+                    rb_str_new2(VIR_DOMAIN_SAVE_PARAM_PARALLEL_CHANNELS));
+#endif
 
 #if HAVE_CONST_VIR_DOMAIN_UNDEFINE_MANAGED_SAVE
     rb_define_const(c_domain, "UNDEFINE_MANAGED_SAVE",
@@ -4610,6 +5533,13 @@ void ruby_libvirt_domain_init(void)
     rb_define_method(c_domain, "save", libvirt_domain_save, -1);
     rb_define_singleton_method(c_domain, "restore", libvirt_domain_s_restore,
                                2);
+#if HAVE_VIRDOMAINSAVEPARAMS
+    rb_define_method(c_domain, "save_params", libvirt_domain_save_params, -1);
+#endif
+#if HAVE_VIRDOMAINRESTOREPARAMS
+    rb_define_singleton_method(c_domain, "restore_params",
+                               libvirt_domain_s_restore_params, -1);
+#endif
     rb_define_method(c_domain, "core_dump", libvirt_domain_core_dump, -1);
     rb_define_method(c_domain, "info", libvirt_domain_info, 0);
     rb_define_method(c_domain, "ifinfo", libvirt_domain_if_stats, 1);
@@ -4678,6 +5608,8 @@ void ruby_libvirt_domain_init(void)
     rb_define_method(c_domain, "block_stats", libvirt_domain_block_stats, 1);
 #if HAVE_TYPE_VIRDOMAINMEMORYSTATPTR
     rb_define_method(c_domain, "memory_stats", libvirt_domain_memory_stats, -1);
+    rb_define_method(c_domain, "memory_stats_hash",
+                     libvirt_domain_memory_stats_hash, -1);
 #endif
 #if HAVE_VIRDOMAINBLOCKPEEK
     rb_define_method(c_domain, "block_peek", libvirt_domain_block_peek, -1);
@@ -4793,10 +5725,30 @@ void ruby_libvirt_domain_init(void)
     rb_define_const(c_domain_memory_stats, "ACTUAL_BALLOON",
                     INT2NUM(VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON));
 #endif
-#if HAVE_CONST_VIR_DOMAIN_MEMORY_STATE_RSS
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_RSS
     rb_define_const(c_domain_memory_stats, "RSS",
                     INT2NUM(VIR_DOMAIN_MEMORY_STAT_RSS));
 #endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_USABLE
+    rb_define_const(c_domain_memory_stats, "USABLE",
+                    INT2NUM(VIR_DOMAIN_MEMORY_STAT_USABLE));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE
+    rb_define_const(c_domain_memory_stats, "LAST_UPDATE",
+                    INT2NUM(VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_DISK_CACHES
+    rb_define_const(c_domain_memory_stats, "DISK_CACHES",
+                    INT2NUM(VIR_DOMAIN_MEMORY_STAT_DISK_CACHES));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGALLOC
+    rb_define_const(c_domain_memory_stats, "HUGETLB_PGALLOC",
+                    INT2NUM(VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGALLOC));
+#endif
+#if HAVE_CONST_VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL
+    rb_define_const(c_domain_memory_stats, "HUGETLB_PGFAIL",
+                    INT2NUM(VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL));
+#endif
 #endif
 
 #if HAVE_TYPE_VIRDOMAINBLOCKINFOPTR
@@ -5605,6 +6557,10 @@ void ruby_libvirt_domain_init(void)
 #if HAVE_VIRDOMAINBLOCKRESIZE
     rb_define_method(c_domain, "block_resize", libvirt_domain_block_resize, -1);
 #endif
+#if HAVE_VIRDOMAINSETBLOCKTHRESHOLD
+    rb_define_method(c_domain, "set_block_threshold",
+                     libvirt_domain_set_block_threshold, -1);
+#endif
 #if HAVE_CONST_VIR_DOMAIN_BLOCK_RESIZE_BYTES
     rb_define_const(c_domain, "BLOCK_RESIZE_BYTES",
                     INT2NUM(VIR_DOMAIN_BLOCK_RESIZE_BYTES));
@@ -5649,6 +6605,31 @@ void ruby_libvirt_domain_init(void)
 #if HAVE_VIRDOMAINPINEMULATOR
     rb_define_method(c_domain, "pin_emulator", libvirt_domain_pin_emulator, -1);
 #endif
+#if HAVE_VIRDOMAINGETIOTHREADINFO
+    /*
+     * Class Libvirt::Domain::IOThreadInfo
+     */
+    c_domain_iothreadinfo = rb_define_class_under(c_domain, "IOThreadInfo",
+                                                  rb_cObject);
+    rb_define_attr(c_domain_iothreadinfo, "id", 1, 0);
+    rb_define_attr(c_domain_iothreadinfo, "cpumap", 1, 0);
+
+    rb_define_method(c_domain, "iothread_info", libvirt_domain_iothread_info,
+                     -1);
+#endif
+#if HAVE_VIRDOMAINPINIOTHREAD
+    rb_define_method(c_domain, "pin_iothread", libvirt_domain_pin_iothread, -1);
+#endif
+#if HAVE_VIRDOMAINADDIOTHREAD
+    rb_define_method(c_domain, "add_iothread", libvirt_domain_add_iothread, -1);
+#endif
+#if HAVE_VIRDOMAINDELIOTHREAD
+    rb_define_method(c_domain, "del_iothread", libvirt_domain_del_iothread, -1);
+#endif
+#if HAVE_VIRDOMAINSETIOTHREADPARAMS
+    rb_define_method(c_domain, "set_iothread_params",
+                     libvirt_domain_set_iothread_params, -1);
+#endif
 #if HAVE_VIRDOMAINGETSECURITYLABELLIST
     rb_define_method(c_domain, "security_label_list",
                      libvirt_domain_security_label_list, 0);
@@ -5696,6 +6677,13 @@ void ruby_libvirt_domain_init(void)
 #if HAVE_VIRDOMAINGETJOBSTATS
     rb_define_method(c_domain, "job_stats", libvirt_domain_job_stats, -1);
 #endif
+#if HAVE_VIRDOMAINGETPERFEVENTS
+    rb_define_method(c_domain, "perf_events", libvirt_domain_perf_events, -1);
+#endif
+#if HAVE_VIRDOMAINSETPERFEVENTS
+    rb_define_method(c_domain, "perf_events=",
+                     libvirt_domain_perf_events_equal, 1);
+#endif
 #if HAVE_VIRDOMAINGETBLOCKIOTUNE
     rb_define_method(c_domain, "block_iotune",
                      libvirt_domain_block_iotune, -1);
@@ -5,7 +5,14 @@ void ruby_libvirt_domain_init(void);
 
 VALUE ruby_libvirt_domain_new(virDomainPtr d, VALUE conn);
 virDomainPtr ruby_libvirt_domain_get(VALUE s);
+VALUE ruby_libvirt_domain_stats(VALUE c, VALUE domains, unsigned int stats,
+                                unsigned int flags, const char *prefix);
+VALUE ruby_libvirt_domain_managed_save_bulk(VALUE c, VALUE domains,
+                                            int restore, VALUE params,
+                                            unsigned int flags,
+                                            int concurrency);
 
+extern VALUE c_domain;
 extern VALUE c_domain_security_label;
 
 #endif
@@ -89,6 +89,7 @@ libvirt_types = [ 'virNetworkPtr',
                   'virStreamPtr',
                   'virTypedParameterPtr',
                   'virDomainBlockJobInfoPtr',
+                  'virNWFilterBindingPtr',
                 ]
 
 libvirt_funcs = [ 'virStorageVolWipe',
@@ -225,6 +226,21 @@ libvirt_funcs = [ 'virStorageVolWipe',
                   'virDomainDefineXMLFlags',
                   'virDomainRename',
                   'virDomainSetUserPassword',
+                  'virConnectNetworkEventRegisterAny',
+                  'virConnectListAllNWFilterBindings',
+                  'virEventRegisterDefaultImpl',
+                  'virConnectRegisterCloseCallback',
+                  'virDomainGetIOThreadInfo',
+                  'virDomainPinIOThread',
+                  'virDomainAddIOThread',
+                  'virDomainDelIOThread',
+                  'virDomainSetIOThreadParams',
+                  'virDomainSetBlockThreshold',
+                  'virDomainSaveParams',
+                  'virDomainRestoreParams',
+                  'virDomainGetPerfEvents',
+                  'virDomainSetPerfEvents',
+                  'virConnectGetAllDomainStats',
                 ]
 
 libvirt_qemu_funcs = [ 'virDomainQemuMonitorCommand',
@@ -269,6 +285,8 @@ libvirt_consts = [ 'VIR_MIGRATE_LIVE',
                    'VIR_DOMAIN_AFFECT_CURRENT',
                    'VIR_DOMAIN_MEM_CURRENT',
                    'VIR_DOMAIN_EVENT_ID_CONTROL_ERROR',
+                   'VIR_DOMAIN_EVENT_ID_BLOCK_THRESHOLD',
+                   'VIR_DOMAIN_EVENT_ID_METADATA_CHANGE',
                    'VIR_DOMAIN_PAUSED_SHUTTING_DOWN',
                    'VIR_DOMAIN_START_AUTODESTROY',
                    'VIR_DOMAIN_START_BYPASS_CACHE',
@@ -279,6 +297,9 @@ libvirt_consts = [ 'VIR_MIGRATE_LIVE',
                    'VIR_DOMAIN_SAVE_BYPASS_CACHE',
                    'VIR_DOMAIN_SAVE_RUNNING',
                    'VIR_DOMAIN_SAVE_PAUSED',
+                   'VIR_DOMAIN_SAVE_PARALLEL',
+                   'VIR_DOMAIN_SAVE_PARAM_IMAGE_FORMAT',
+                   'VIR_DOMAIN_SAVE_PARAM_PARALLEL_CHANNELS',
                    'VIR_NETWORK_UPDATE_COMMAND_NONE',
                    'VIR_NETWORK_UPDATE_COMMAND_MODIFY',
                    'VIR_NETWORK_UPDATE_COMMAND_DELETE',
@@ -343,6 +364,11 @@ libvirt_consts = [ 'VIR_MIGRATE_LIVE',
                    'VIR_STORAGE_VOL_WIPE_ALG_RANDOM',
                    'VIR_DOMAIN_BLOCK_RESIZE_BYTES',
                    'VIR_DOMAIN_MEMORY_STAT_RSS',
+                   'VIR_DOMAIN_MEMORY_STAT_USABLE',
+                   'VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE',
+                   'VIR_DOMAIN_MEMORY_STAT_DISK_CACHES',
+                   'VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGALLOC',
+                   'VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL',
                    'VIR_MIGRATE_UNSAFE',
                    'VIR_MIGRATE_OFFLINE',
                    'VIR_MIGRATE_COMPRESSED',
@@ -441,6 +467,11 @@ libvirt_consts = [ 'VIR_MIGRATE_LIVE',
                    'VIR_DOMAIN_DEFINE_VALIDATE',
                    'VIR_DOMAIN_PASSWORD_ENCRYPTED',
                    'VIR_DOMAIN_TIME_SYNC',
+                   'VIR_DOMAIN_IOTHREAD_AIO_MAX_BATCH',
+                   'VIR_DOMAIN_IOTHREAD_THREAD_POOL_MIN',
+                   'VIR_DOMAIN_STATS_PERF',
+                   'VIR_DOMAIN_STATS_BALLOON',
+                   'VIR_DOMAIN_STATS_VCPU',
                  ]
 
 virterror_consts = [
@@ -477,8 +508,24 @@ virterror_consts = [
                     'VIR_MIGRATE_RDMA_PIN_ALL',
                     'VIR_DOMAIN_SHUTDOWN_PARAVIRT',
                     'VIR_DOMAIN_REBOOT_PARAVIRT',
+                    'VIR_ERR_NO_DOMAIN_METADATA',
                    ]
 
+libvirt_admin_funcs = [
+                        'virAdmConnectOpen',
+                        'virAdmConnectGetURI',
+                        'virAdmConnectGetLibVersion',
+                        'virAdmConnectListServers',
+                        'virAdmConnectLookupServer',
+                        'virAdmServerGetThreadPoolParameters',
+                        'virAdmServerSetThreadPoolParameters',
+                        'virAdmServerListClients',
+                        'virAdmServerGetClientLimits',
+                        'virAdmServerSetClientLimits',
+                        'virAdmClientGetInfo',
+                        'virAdmClientClose',
+                       ]
+
 libvirt_qemu_consts = [
                        'VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK',
                        'VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT',
@@ -491,16 +538,52 @@ libvirt_types.each { |t| have_type(t, "libvirt/libvirt.h") }
 libvirt_funcs.each { |f| have_func(f, "libvirt/libvirt.h") }
 libvirt_consts.each { |c| have_const(c, ["libvirt/libvirt.h"]) }
 virterror_consts.each { |c| have_const(c, ["libvirt/virterror.h"]) }
+libvirt_apis = ['libvirt']
 if find_header("libvirt/libvirt-qemu.h")
+  libvirt_apis << 'libvirt-qemu'
   have_library("virt-qemu", "virDomainQemuMonitorCommand")
   libvirt_qemu_funcs.each { |f| have_func(f, "libvirt/libvirt-qemu.h") }
   libvirt_qemu_consts.each { |c| have_const(c, ["libvirt/libvirt-qemu.h"]) }
 end
 
 if find_header("libvirt/libvirt-lxc.h")
+  libvirt_apis << 'libvirt-lxc'
   have_library("virt-lxc", "virDomainLxcOpenNamespace")
   libvirt_lxc_funcs.each{ |f| have_func(f, "libvirt/libvirt-lxc.h") }
 end
 
+if find_header("libvirt/libvirt-admin.h")
+  libvirt_apis << 'libvirt-admin'
+  have_library("virt-admin", "virAdmConnectOpen")
+  libvirt_admin_funcs.each { |f| have_func(f, "libvirt/libvirt-admin.h") }
+end
+
+# libxml2 is used to parse the XML documents returned by libvirt into native
+# structures.  It is always available where libvirt is, but it is optional
+# here; the methods that need it are simply not defined without it.
+if pkg_config("libxml-2.0")
+  have_header("libxml/parser.h")
+end
+
+# Calls that fan out over many objects run on native worker threads with the
+# GVL released.  Without these they simply run one after the other.
+have_header("ruby/thread.h")
+nogvl = have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_thread_call_without_gvl2", "ruby/thread.h")
+have_header("pthread.h")
+
+# Ordinary calls go through wrappers generated from libvirt's own API
+# descriptions (see generator.rb) that release the GVL for the duration of
+# the call.  Without the descriptions the calls are made directly.
+require File.expand_path('../generator', __FILE__)
+if nogvl && checking_for("libvirt API descriptions to generate nogvl.h") {
+     RubyLibvirtGenerator.generate(libvirt_apis, "nogvl.h")
+   }
+  $defs.push("-DHAVE_NOGVL_H")
+end
+
+# Secret values fetched in bulk are kept in locked, non-dumpable pages.
+have_header("sys/mman.h")
+
 create_header
 create_makefile(extension_name)
@@ -0,0 +1,164 @@
+# generator.rb: generate C call wrappers from libvirt's API descriptions
+#
+# Copyright (C) 2016 Chris Lalancette <clalancette@gmail.com>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+#
+# For every public function in libvirt-api.xml (and in the API descriptions
+# of libvirt-qemu, libvirt-lxc and libvirt-admin, where those are used) this
+# writes a wrapper
+#
+#   RET ruby_libvirt_nogvl_FUNC(ARGS...)
+#
+# that makes the call with the GVL released, once the governor of the
+# connection it is made on has admitted it (via
+# ruby_libvirt_call_without_gvl).  The code generating macros in common.h and
+# the hand-written methods call through these wrappers with
+# RUBY_LIBVIRT_CALL, so every method, and every libvirt function added in
+# the future, gets the same treatment.  Since the XML describes the very
+# libvirt being compiled against, every function in it is known to exist.
+
+require 'rexml/document'
+
+module RubyLibvirtGenerator
+  # Functions that must keep the GVL: they are purely local and cheap, or
+  # they may call back into Ruby (authentication, stream handlers).
+  KEEP_GVL = [ /Free$/, /Ref$/, /Error/, /^virEvent/, /^virTypedParam/,
+               /^virInitialize$/, /^virGetVersion$/, /^virSetErrorFunc$/,
+               /GetConnect$/, /GetName$/, /GetUUID(String)?$/, /GetID$/,
+               /^virConnectOpenAuth$/, /^virStream(Sparse)?(Send|Recv)All$/,
+               /^virStreamEvent/, /^virConnectAuthPtrDefault$/ ]
+
+  # The libraries to generate wrappers for: the pkg-config module describing
+  # each, and the header declaring its functions.
+  APIS = [ ['libvirt', 'libvirt/libvirt.h'],
+           ['libvirt-qemu', 'libvirt/libvirt-qemu.h'],
+           ['libvirt-lxc', 'libvirt/libvirt-lxc.h'],
+           ['libvirt-admin', 'libvirt/libvirt-admin.h'] ]
+
+  # Return the path of the API description of pkg-config module MOD, or nil
+  # if it is not installed.  Older libvirts only name the main one in their
+  # .pc files; the others are installed alongside it.
+  def self.api_xml(mod = 'libvirt')
+    var = mod.tr('-', '_') + '_api'
+    path = `pkg-config --variable=#{var} #{mod} 2>/dev/null`.strip
+    if path.empty? && mod != 'libvirt'
+      main = api_xml
+      path = File.join(File.dirname(main), "#{mod}-api.xml") unless main.nil?
+    end
+    path.empty? || !File.exist?(path) ? nil : path
+  end
+
+  def self.functions(xml)
+    doc = REXML::Document.new(File.read(xml))
+    result = []
+    doc.elements.each('api/symbols/function') do |f|
+      name = f.attributes['name']
+      ret = f.elements['return'].attributes['type']
+      args = []
+      f.elements.each('arg') { |a| args << a.attributes['type'] }
+      args = [] if args == ['void']
+      if KEEP_GVL.any? { |re| re =~ name } ||
+          args.any? { |t| t.include?('...') || t.include?('va_list') }
+        result << [name, nil, nil]
+      else
+        result << [name, ret, args]
+      end
+    end
+    result.sort
+  end
+
+  # the argument structs are filled in member by member, so their members
+  # cannot be const themselves (pointers to const are fine)
+  def self.field(type)
+    type = type.sub(/\s*\bconst\s*$/, '')
+    type.include?('*') ? type : type.sub(/^const\s+/, '')
+  end
+
+  # Functions that keep the GVL are still called through RUBY_LIBVIRT_CALL,
+  # so they get a wrapper name too; it is simply the function itself.
+  def self.passthrough(name)
+    "#define ruby_libvirt_nogvl_#{name} #{name}\n\n"
+  end
+
+  # The connection a call is made on, for its governor: the first argument
+  # if that is a connection or an object with a GetConnect function in
+  # NAMES, or none.
+  def self.conn(args, names)
+    return 'NULL' if args.empty?
+    return 'a0' if args[0] == 'virConnectPtr'
+    obj = args[0][/^vir(\w+)Ptr$/, 1]
+    return 'NULL' if obj.nil? || !names.include?("vir#{obj}GetConnect")
+    "vir#{obj}GetConnect(a0)"
+  end
+
+  def self.wrapper(name, ret, args, names)
+    params = args.each_with_index.map { |t, i| "#{t} a#{i}" }
+    params = ['void'] if params.empty?
+    fields = args.each_with_index.map { |t, i| "    #{field(t)} a#{i};\n" }.join
+    fields << "    #{field(ret)} ret;\n" unless ret == 'void'
+    fields = "    int unused;\n" if fields.empty?
+    call = "#{name}(#{(0...args.length).map { |i| "a->a#{i}" }.join(', ')})"
+    call = "a->ret = #{call}" unless ret == 'void'
+    assign = (0...args.length).map { |i| "    a.a#{i} = a#{i};\n" }.join
+
+    <<EOF
+struct ruby_libvirt_nogvl_#{name}_args {
+#{fields}};
+static void *ruby_libvirt_nogvl_#{name}_run(void *arg)
+{
+    struct ruby_libvirt_nogvl_#{name}_args *a = arg;
+    #{call};
+    return NULL;
+}
+static inline #{ret} ruby_libvirt_nogvl_#{name}(#{params.join(', ')})
+{
+    struct ruby_libvirt_nogvl_#{name}_args a;
+#{assign}    ruby_libvirt_call_without_gvl(#{conn(args, names)},
+                                  ruby_libvirt_nogvl_#{name}_run, &a);
+#{ret == 'void' ? '' : "    return a.ret;\n"}}
+
+EOF
+  end
+
+  # Write the wrappers for the functions of the libraries in MODS (pkg-config
+  # module names from APIS) to OUT.  Returns false, writing nothing, if the
+  # API description of any of them is missing, since their hand-written
+  # callers would then have no wrapper to call.
+  def self.generate(mods, out)
+    apis = APIS.select { |mod, header| mods.include?(mod) }
+    xmls = apis.map { |mod, header| api_xml(mod) }
+    return false if xmls.empty? || xmls.include?(nil)
+    funcs = xmls.map { |xml| functions(xml) }
+    return false if funcs.any?(&:empty?)
+    names = funcs.flatten(1).map(&:first)
+
+    File.open(out, 'w') do |f|
+      f.write(<<EOF)
+/* Generated by generator.rb from #{xmls.map { |x| File.basename(x) }.join(', ')}; do not edit. */
+#ifndef NOGVL_H
+#define NOGVL_H
+
+EOF
+      apis.each { |mod, header| f.write("#include <#{header}>\n") }
+      f.write("\n")
+      funcs.flatten(1).sort.each do |name, ret, args|
+        f.write(ret.nil? ? passthrough(name) : wrapper(name, ret, args, names))
+      end
+      f.write("#endif\n")
+    end
+    true
+  end
+end
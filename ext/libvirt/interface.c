@@ -19,12 +19,15 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "interface.h"
 
 #if HAVE_TYPE_VIRINTERFACEPTR
 static VALUE c_interface;
@@ -36,7 +39,31 @@ static void interface_free(void *i)
 
 static virInterfacePtr interface_get(VALUE i)
 {
-    ruby_libvirt_get_struct(Interface, i);
+    virInterfacePtr iface, newiface;
+    virConnectPtr conn;
+    const char *name;
+
+    Data_Get_Struct(i, virInterface, iface);
+    if (!iface) {
+        rb_raise(rb_eArgError, "Interface has been freed");
+    }
+
+    /* after a fork, look the interface up again by name on the reopened
+     * connection */
+    conn = ruby_libvirt_connect_reopened(i);
+    if (conn != NULL && virInterfaceGetConnect(iface) != conn) {
+        name = virInterfaceGetName(iface);
+        ruby_libvirt_raise_error_if(name == NULL, e_RetrieveError,
+                                    "virInterfaceGetName", conn);
+        newiface = RUBY_LIBVIRT_CALL(virInterfaceLookupByName, conn, name);
+        ruby_libvirt_raise_error_if(newiface == NULL, e_RetrieveError,
+                                    "virInterfaceLookupByName", conn);
+        DATA_PTR(i) = newiface;
+        virInterfaceFree(iface);
+        iface = newiface;
+    }
+
+    return iface;
 }
 
 VALUE ruby_libvirt_interface_new(virInterfacePtr i, VALUE conn)
@@ -170,6 +197,444 @@ static VALUE libvirt_interface_free(VALUE i)
 {
     ruby_libvirt_generate_call_free(Interface, i);
 }
+
+#if HAVE_VIRINTERFACECHANGEBEGIN
+/*
+ * Class Libvirt::Interface::Transaction
+ *
+ * The operations queued on a transaction inside conn.interface_transaction
+ * are only run once the block returns, all in one go without the GVL and
+ * between virInterfaceChangeBegin() and virInterfaceChangeCommit().  Each
+ * of those calls waits for a slot from the connection's governor of its
+ * own, so a long transaction does not hold one slot throughout.
+ */
+static VALUE c_interface_transaction;
+
+enum {
+    INTERFACE_TX_DEFINE,
+    INTERFACE_TX_CREATE,
+    INTERFACE_TX_DESTROY,
+    INTERFACE_TX_UNDEFINE,
+};
+
+struct interface_tx_op {
+    int op;
+    /* the XML to define, or the name of the interface */
+    char *arg;
+    unsigned int flags;
+    double time;
+};
+
+struct interface_tx {
+    virConnectPtr conn;
+    unsigned int flags;
+    struct interface_tx_op *ops;
+    int nops;
+    int size;
+    int closed;
+
+    /* the connection's governor, which admits each step on its own */
+    struct ruby_libvirt_governor *gov;
+    volatile int cancel;
+    int interrupted;
+    /* the step to run next: -1 for virInterfaceChangeBegin, an operation,
+     * or nops for virInterfaceChangeCommit */
+    int step;
+    double start;
+
+    /* index of the operation that failed, nops if the commit did */
+    int failed_op;
+    const char *failed;
+    virError error;
+    int rolled_back;
+    const char *rollback_failed;
+    virError rollback_error;
+    double time;
+};
+
+static void interface_tx_free(void *d)
+{
+    struct interface_tx *tx = (struct interface_tx *)d;
+    int i;
+
+    for (i = 0; i < tx->nops; i++) {
+        free(tx->ops[i].arg);
+    }
+    free(tx->ops);
+    if (tx->failed != NULL) {
+        virResetError(&tx->error);
+    }
+    if (tx->rollback_failed != NULL) {
+        virResetError(&tx->rollback_error);
+    }
+    xfree(tx);
+}
+
+static struct interface_tx *interface_tx_get(VALUE t)
+{
+    struct interface_tx *tx;
+
+    Data_Get_Struct(t, struct interface_tx, tx);
+    if (tx->closed) {
+        rb_raise(rb_eArgError,
+                 "interface transaction can only be used inside its block");
+    }
+
+    return tx;
+}
+
+static VALUE interface_tx_queue(VALUE t, int op, VALUE arg, VALUE flags)
+{
+    struct interface_tx *tx = interface_tx_get(t);
+    struct interface_tx_op *ops;
+    unsigned int f;
+    char *a;
+
+    a = StringValueCStr(arg);
+    f = ruby_libvirt_value_to_uint(flags);
+
+    if (tx->nops == tx->size) {
+        ops = realloc(tx->ops, sizeof(struct interface_tx_op) *
+                      (tx->size ? tx->size * 2 : 8));
+        if (ops == NULL) {
+            rb_memerror();
+        }
+        tx->ops = ops;
+        tx->size = tx->size ? tx->size * 2 : 8;
+    }
+
+    tx->ops[tx->nops].arg = strdup(a);
+    if (tx->ops[tx->nops].arg == NULL) {
+        rb_memerror();
+    }
+    tx->ops[tx->nops].op = op;
+    tx->ops[tx->nops].flags = f;
+    tx->ops[tx->nops].time = 0;
+    tx->nops++;
+
+    return t;
+}
+
+/*
+ * call-seq:
+ *   tx.define(xml, flags=0) -> Libvirt::Interface::Transaction
+ *
+ * Queue a call to virInterfaceDefineXML[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceDefineXML]
+ * to define an interface from xml.
+ */
+static VALUE libvirt_interface_tx_define(int argc, VALUE *argv, VALUE t)
+{
+    VALUE xml, flags = RUBY_Qnil;
+
+    rb_scan_args(argc, argv, "11", &xml, &flags);
+
+    return interface_tx_queue(t, INTERFACE_TX_DEFINE, xml, flags);
+}
+
+/*
+ * call-seq:
+ *   tx.create(name, flags=0) -> Libvirt::Interface::Transaction
+ *
+ * Queue a call to virInterfaceCreate[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceCreate]
+ * to bring up the interface called name.
+ */
+static VALUE libvirt_interface_tx_create(int argc, VALUE *argv, VALUE t)
+{
+    VALUE name, flags = RUBY_Qnil;
+
+    rb_scan_args(argc, argv, "11", &name, &flags);
+
+    return interface_tx_queue(t, INTERFACE_TX_CREATE, name, flags);
+}
+
+/*
+ * call-seq:
+ *   tx.destroy(name, flags=0) -> Libvirt::Interface::Transaction
+ *
+ * Queue a call to virInterfaceDestroy[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceDestroy]
+ * to bring down the interface called name.
+ */
+static VALUE libvirt_interface_tx_destroy(int argc, VALUE *argv, VALUE t)
+{
+    VALUE name, flags = RUBY_Qnil;
+
+    rb_scan_args(argc, argv, "11", &name, &flags);
+
+    return interface_tx_queue(t, INTERFACE_TX_DESTROY, name, flags);
+}
+
+/*
+ * call-seq:
+ *   tx.undefine(name) -> Libvirt::Interface::Transaction
+ *
+ * Queue a call to virInterfaceUndefine[http://www.libvirt.org/html/libvirt-libvirt-interface.html#virInterfaceUndefine]
+ * to undefine the interface called name.
+ */
+static VALUE libvirt_interface_tx_undefine(VALUE t, VALUE name)
+{
+    return interface_tx_queue(t, INTERFACE_TX_UNDEFINE, name, Qnil);
+}
+
+/*
+ * call-seq:
+ *   tx.size -> Fixnum
+ *
+ * Return the number of operations queued so far.
+ */
+static VALUE libvirt_interface_tx_size(VALUE t)
+{
+    return INT2NUM(interface_tx_get(t)->nops);
+}
+
+static int interface_tx_run_op(struct interface_tx *tx,
+                               struct interface_tx_op *op)
+{
+    virInterfacePtr iface;
+    int ret = -1;
+
+    if (op->op == INTERFACE_TX_DEFINE) {
+        iface = virInterfaceDefineXML(tx->conn, op->arg, op->flags);
+        tx->failed = "virInterfaceDefineXML";
+        if (iface != NULL) {
+            virInterfaceFree(iface);
+            ret = 0;
+        }
+        return ret;
+    }
+
+    iface = virInterfaceLookupByName(tx->conn, op->arg);
+    if (iface == NULL) {
+        tx->failed = "virInterfaceLookupByName";
+        return -1;
+    }
+
+    switch (op->op) {
+    case INTERFACE_TX_CREATE:
+        ret = virInterfaceCreate(iface, op->flags);
+        tx->failed = "virInterfaceCreate";
+        break;
+    case INTERFACE_TX_DESTROY:
+        ret = virInterfaceDestroy(iface, op->flags);
+        tx->failed = "virInterfaceDestroy";
+        break;
+    case INTERFACE_TX_UNDEFINE:
+        ret = virInterfaceUndefine(iface);
+        tx->failed = "virInterfaceUndefine";
+        break;
+    }
+    virInterfaceFree(iface);
+
+    return ret;
+}
+
+/* Wait for the connection's governor, if there is one, to admit the next
+ * step.  Returns -1 if the calling thread was interrupted instead.
+ */
+static int interface_tx_admit(struct interface_tx *tx)
+{
+    if (tx->gov != NULL &&
+        ruby_libvirt_governor_acquire(tx->gov, RUBY_LIBVIRT_LANE_NORMAL,
+                                      &tx->cancel) < 0) {
+        tx->interrupted = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void interface_tx_admitted(struct interface_tx *tx)
+{
+    if (tx->gov != NULL) {
+        ruby_libvirt_governor_release(tx->gov);
+    }
+}
+
+static void interface_tx_interrupt(void *arg)
+{
+    struct interface_tx *tx = (struct interface_tx *)arg;
+
+    if (tx->gov != NULL) {
+        ruby_libvirt_governor_cancel(tx->gov, &tx->cancel);
+    }
+}
+
+static void interface_tx_rollback(struct interface_tx *tx)
+{
+    if (virInterfaceChangeRollback(tx->conn, 0) < 0) {
+        tx->rollback_failed = "virInterfaceChangeRollback";
+        virCopyLastError(&tx->rollback_error);
+        virResetLastError();
+    }
+    else {
+        tx->rolled_back = 1;
+    }
+}
+
+/* Run the transaction from tx->step on.  If waiting for the governor is
+ * interrupted this returns with tx->interrupted set and the transaction
+ * still open, to be picked up again at the same step or abandoned.
+ */
+static void *interface_tx_run(void *arg)
+{
+    struct interface_tx *tx = (struct interface_tx *)arg;
+    double opstart;
+    int r;
+
+    if (tx->step < 0) {
+        if (interface_tx_admit(tx) < 0) {
+            return NULL;
+        }
+        r = virInterfaceChangeBegin(tx->conn, tx->flags);
+        interface_tx_admitted(tx);
+        if (r < 0) {
+            tx->failed = "virInterfaceChangeBegin";
+            tx->failed_op = -1;
+            goto error;
+        }
+        tx->step = 0;
+    }
+
+    for (; tx->step < tx->nops; tx->step++) {
+        if (interface_tx_admit(tx) < 0) {
+            return NULL;
+        }
+        opstart = ruby_libvirt_monotonic_time();
+        r = interface_tx_run_op(tx, &tx->ops[tx->step]);
+        interface_tx_admitted(tx);
+        if (r < 0) {
+            tx->failed_op = tx->step;
+            goto rollback;
+        }
+        tx->ops[tx->step].time = ruby_libvirt_monotonic_time() - opstart;
+    }
+
+    if (interface_tx_admit(tx) < 0) {
+        return NULL;
+    }
+    r = virInterfaceChangeCommit(tx->conn, 0);
+    interface_tx_admitted(tx);
+    if (r < 0) {
+        tx->failed = "virInterfaceChangeCommit";
+        tx->failed_op = tx->nops;
+        goto rollback;
+    }
+
+    tx->failed = NULL;
+    tx->time = ruby_libvirt_monotonic_time() - tx->start;
+    return NULL;
+
+rollback:
+    virCopyLastError(&tx->error);
+    virResetLastError();
+    /* undoing the transaction does not wait for the governor */
+    interface_tx_rollback(tx);
+    tx->time = ruby_libvirt_monotonic_time() - tx->start;
+    return NULL;
+
+error:
+    virCopyLastError(&tx->error);
+    virResetLastError();
+    tx->time = ruby_libvirt_monotonic_time() - tx->start;
+    return NULL;
+}
+
+static void *interface_tx_abandon(void *arg)
+{
+    interface_tx_rollback((struct interface_tx *)arg);
+    return NULL;
+}
+
+static VALUE interface_tx_close(VALUE t)
+{
+    struct interface_tx *tx;
+
+    Data_Get_Struct(t, struct interface_tx, tx);
+    tx->closed = 1;
+
+    return Qnil;
+}
+
+/* Yield a new Libvirt::Interface::Transaction to the block, then run the
+ * operations queued on it as a single interface change.  Nothing is run if
+ * the block raises.
+ */
+VALUE ruby_libvirt_interface_transaction(VALUE c, unsigned int flags)
+{
+    struct interface_tx *tx;
+    VALUE t, result, times;
+    int i, exception;
+
+    rb_need_block();
+
+    t = Data_Make_Struct(c_interface_transaction, struct interface_tx, NULL,
+                         interface_tx_free, tx);
+    tx->conn = ruby_libvirt_connect_get(c);
+    tx->flags = flags;
+    rb_iv_set(t, "@connection", c);
+
+    rb_ensure(rb_yield, t, interface_tx_close, t);
+
+    if (!ruby_libvirt_governor_held(c)) {
+        tx->gov = ruby_libvirt_governor_get(c);
+    }
+    tx->step = -1;
+    tx->start = ruby_libvirt_monotonic_time();
+    do {
+        tx->cancel = 0;
+        tx->interrupted = 0;
+        exception = ruby_libvirt_without_gvl_cancellable(interface_tx_run, tx,
+                                                         interface_tx_interrupt,
+                                                         tx);
+        if (exception == 0 && tx->interrupted) {
+            /* let Ruby raise or run signal handlers, then carry on */
+            exception = ruby_libvirt_check_ints();
+        }
+    } while (exception == 0 && tx->interrupted);
+    if (tx->gov != NULL) {
+        ruby_libvirt_governor_unref(tx->gov);
+        tx->gov = NULL;
+    }
+    if (exception) {
+        if (tx->step >= 0) {
+            ruby_libvirt_without_gvl(interface_tx_abandon, tx);
+        }
+        rb_jump_tag(exception);
+    }
+
+    if (tx->failed != NULL && tx->failed_op < 0) {
+        /* nothing was changed */
+        VALUE error = ruby_libvirt_error_new(e_Error, tx->failed, &tx->error);
+        RB_GC_GUARD(t);
+        rb_exc_raise(error);
+    }
+
+    times = rb_ary_new2(tx->nops);
+    for (i = 0; i < tx->nops; i++) {
+        rb_ary_store(times, i, rb_float_new(tx->ops[i].time));
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("committed"),
+                 tx->failed == NULL ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new2("failed"),
+                 tx->failed != NULL ? INT2NUM(tx->failed_op) : Qnil);
+    rb_hash_aset(result, rb_str_new2("error"), tx->failed != NULL ?
+                 ruby_libvirt_error_new(e_Error, tx->failed,
+                                        &tx->error) : Qnil);
+    rb_hash_aset(result, rb_str_new2("rolled_back"),
+                 tx->rolled_back ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new2("rollback_error"),
+                 tx->rollback_failed != NULL ?
+                 ruby_libvirt_error_new(e_Error, tx->rollback_failed,
+                                        &tx->rollback_error) : Qnil);
+    rb_hash_aset(result, rb_str_new2("times"), times);
+    rb_hash_aset(result, rb_str_new2("time"), rb_float_new(tx->time));
+
+    RB_GC_GUARD(t);
+
+    return result;
+}
+#endif
 #endif
 
 /*
@@ -196,5 +661,22 @@ void ruby_libvirt_interface_init(void)
 #if HAVE_VIRINTERFACEISACTIVE
     rb_define_method(c_interface, "active?", libvirt_interface_active_p, 0);
 #endif
+
+#if HAVE_VIRINTERFACECHANGEBEGIN
+    c_interface_transaction = rb_define_class_under(c_interface, "Transaction",
+                                                    rb_cObject);
+    rb_undef_alloc_func(c_interface_transaction);
+    rb_define_attr(c_interface_transaction, "connection", 1, 0);
+    rb_define_method(c_interface_transaction, "define",
+                     libvirt_interface_tx_define, -1);
+    rb_define_method(c_interface_transaction, "create",
+                     libvirt_interface_tx_create, -1);
+    rb_define_method(c_interface_transaction, "destroy",
+                     libvirt_interface_tx_destroy, -1);
+    rb_define_method(c_interface_transaction, "undefine",
+                     libvirt_interface_tx_undefine, 1);
+    rb_define_method(c_interface_transaction, "size",
+                     libvirt_interface_tx_size, 0);
+#endif
 #endif
 }
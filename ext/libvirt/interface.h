@@ -4,5 +4,6 @@
 void ruby_libvirt_interface_init(void);
 
 VALUE ruby_libvirt_interface_new(virInterfacePtr i, VALUE conn);
+VALUE ruby_libvirt_interface_transaction(VALUE c, unsigned int flags);
 
 #endif
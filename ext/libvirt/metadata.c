@@ -0,0 +1,1690 @@
+/*
+ * metadata.c: bulk domain metadata and the metadata index
+ *
+ * Copyright (C) 2013-2016 Chris Lalancette <clalancette@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#include "common.h"
+#include "connect.h"
+#include "domain.h"
+#include "metadata.h"
+#include "xml.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if HAVE_VIRDOMAINGETMETADATA && HAVE_VIRCONNECTLISTALLDOMAINS && HAVE_LIBXML_PARSER_H
+/*
+ * Fetching the metadata of many domains.  Each domain is one job; the jobs
+ * run on worker threads without the GVL, and, if keys were given, parse
+ * the metadata element there too, so Ruby only ever sees the results.
+ */
+struct metadata_job {
+    virDomainPtr dom;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char *xml;
+    char **values;
+    int missing;
+    const char *failed;
+    virError error;
+};
+
+struct metadata_fetch {
+    VALUE domains;
+    VALUE rkeys;
+    struct metadata_job *jobs;
+    int njobs;
+    int type;
+    const char *uri;
+    char **keys;
+    int nkeys;
+    unsigned int flags;
+    VALUE exception;
+};
+
+static void metadata_values_free(char **values, int nkeys)
+{
+    int i;
+
+    if (values == NULL) {
+        return;
+    }
+    for (i = 0; i < nkeys; i++) {
+        free(values[i]);
+    }
+    free(values);
+}
+
+static void metadata_keys_free(char **keys, int nkeys)
+{
+    metadata_values_free(keys, nkeys);
+}
+
+static void metadata_fetch_free(struct metadata_fetch *f)
+{
+    int i;
+
+    for (i = 0; i < f->njobs; i++) {
+        if (f->jobs[i].dom != NULL) {
+            virDomainFree(f->jobs[i].dom);
+        }
+        free(f->jobs[i].xml);
+        metadata_values_free(f->jobs[i].values, f->nkeys);
+        if (f->jobs[i].failed != NULL) {
+            virResetError(&f->jobs[i].error);
+        }
+    }
+    free(f->jobs);
+    f->jobs = NULL;
+    f->njobs = 0;
+}
+
+/*
+ * Pick the value of each of KEYS out of the metadata element XML: an
+ * attribute of the element or, failing that, the text of a child element
+ * of that name.  Returns a malloc'ed array of NKEYS strings (NULL where
+ * the key is absent), or NULL if XML cannot be parsed.
+ */
+static char **metadata_values(const char *xml, char **keys, int nkeys)
+{
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    char **values;
+    int i;
+
+    doc = ruby_libvirt_xml_parse(xml);
+    if (doc == NULL) {
+        return NULL;
+    }
+    values = calloc(nkeys + 1, sizeof(char *));
+    if (values != NULL) {
+        root = xmlDocGetRootElement(doc);
+        for (i = 0; i < nkeys; i++) {
+            values[i] = ruby_libvirt_xml_prop_cstr(root, keys[i]);
+            if (values[i] == NULL) {
+                values[i] = ruby_libvirt_xml_child_content_cstr(root,
+                                                                keys[i]);
+            }
+        }
+    }
+    xmlFreeDoc(doc);
+
+    return values;
+}
+
+/* Return non-zero if the last libvirt error just means that the domain has
+ * no such metadata (or has gone away since it was listed). */
+static int metadata_error_is_missing(void)
+{
+    virErrorPtr err = virGetLastError();
+
+    if (err == NULL) {
+        return 0;
+    }
+#if HAVE_CONST_VIR_ERR_NO_DOMAIN_METADATA
+    if (err->code == VIR_ERR_NO_DOMAIN_METADATA) {
+        return 1;
+    }
+#endif
+    return err->code == VIR_ERR_NO_DOMAIN;
+}
+
+static void metadata_fetch_run(void *opaque, int i)
+{
+    struct metadata_fetch *f = (struct metadata_fetch *)opaque;
+    struct metadata_job *job = &f->jobs[i];
+    char *xml;
+
+    virDomainGetUUIDString(job->dom, job->uuid);
+
+    xml = virDomainGetMetadata(job->dom, f->type, f->uri, f->flags);
+    if (xml == NULL) {
+        if (metadata_error_is_missing()) {
+            job->missing = 1;
+        }
+        else {
+            job->failed = "virDomainGetMetadata";
+            virCopyLastError(&job->error);
+        }
+        virResetLastError();
+        return;
+    }
+
+    if (f->nkeys > 0) {
+        job->values = metadata_values(xml, f->keys, f->nkeys);
+        free(xml);
+        if (job->values == NULL) {
+            job->missing = 1;
+        }
+    }
+    else {
+        job->xml = xml;
+    }
+}
+
+static VALUE metadata_fetch_parse(VALUE arg)
+{
+    struct metadata_fetch *f = (struct metadata_fetch *)arg;
+    VALUE entry;
+    int i;
+
+    for (i = 0; i < f->nkeys; i++) {
+        f->keys[i] = strdup(StringValueCStr(RARRAY_PTR(f->rkeys)[i]));
+        if (f->keys[i] == NULL) {
+            rb_memerror();
+        }
+    }
+
+    for (i = 0; !NIL_P(f->domains) && i < f->njobs; i++) {
+        entry = rb_ary_entry(f->domains, i);
+        if (rb_obj_is_kind_of(entry, c_domain) != Qtrue) {
+            rb_raise(rb_eTypeError,
+                     "wrong argument type (expected Libvirt::Domain)");
+        }
+        f->jobs[i].dom = ruby_libvirt_domain_get(entry);
+        virDomainRef(f->jobs[i].dom);
+    }
+
+    return Qnil;
+}
+
+/*
+ * Fetch the metadata of DOMAINS (an Array of Libvirt::Domain, or nil for
+ * every domain on C) into F, which the caller has filled in with the type,
+ * uri, flags and an Array of key names (or nil), on up to CONCURRENCY
+ * worker threads.  On return the caller owns F's keys and jobs.
+ */
+static void metadata_fetch(VALUE c, VALUE domains, VALUE keys,
+                           struct metadata_fetch *f, int concurrency)
+{
+    virDomainPtr *doms;
+    int n, i, exception = 0;
+
+    if (!NIL_P(keys)) {
+        Check_Type(keys, T_ARRAY);
+        if (f->type != VIR_DOMAIN_METADATA_ELEMENT) {
+            rb_raise(rb_eArgError,
+                     "keys can only be picked out of METADATA_ELEMENT metadata");
+        }
+        f->rkeys = keys;
+        f->nkeys = RARRAY_LEN(keys);
+    }
+    if (!NIL_P(domains)) {
+        Check_Type(domains, T_ARRAY);
+    }
+
+    f->keys = calloc(f->nkeys + 1, sizeof(char *));
+    if (f->keys == NULL) {
+        rb_memerror();
+    }
+
+    f->domains = domains;
+    if (NIL_P(domains)) {
+        n = virConnectListAllDomains(ruby_libvirt_connect_get(c), &doms, 0);
+        if (n < 0) {
+            metadata_keys_free(f->keys, f->nkeys);
+        }
+        ruby_libvirt_raise_error_if(n < 0, e_RetrieveError,
+                                    "virConnectListAllDomains",
+                                    ruby_libvirt_connect_get(c));
+        f->jobs = calloc(n + 1, sizeof(struct metadata_job));
+        if (f->jobs == NULL) {
+            for (i = 0; i < n; i++) {
+                virDomainFree(doms[i]);
+            }
+            free(doms);
+            metadata_keys_free(f->keys, f->nkeys);
+            rb_memerror();
+        }
+        f->njobs = n;
+        for (i = 0; i < n; i++) {
+            f->jobs[i].dom = doms[i];
+        }
+        free(doms);
+    }
+    else {
+        f->jobs = calloc(RARRAY_LEN(domains) + 1, sizeof(struct metadata_job));
+        if (f->jobs == NULL) {
+            metadata_keys_free(f->keys, f->nkeys);
+            rb_memerror();
+        }
+        f->njobs = RARRAY_LEN(domains);
+    }
+
+    rb_protect(metadata_fetch_parse, (VALUE)f, &exception);
+    if (exception) {
+        metadata_fetch_free(f);
+        metadata_keys_free(f->keys, f->nkeys);
+        rb_jump_tag(exception);
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_NORMAL,
+                                               f->njobs, concurrency,
+                                               metadata_fetch_run, f);
+    if (exception) {
+        metadata_fetch_free(f);
+        metadata_keys_free(f->keys, f->nkeys);
+        rb_jump_tag(exception);
+    }
+}
+
+static VALUE metadata_values_to_hash(char **keys, char **values, int nkeys)
+{
+    VALUE hash;
+    int i;
+
+    hash = rb_hash_new();
+    for (i = 0; i < nkeys; i++) {
+        rb_hash_aset(hash, rb_str_new2(keys[i]),
+                     values[i] ? rb_str_new2(values[i]) : Qnil);
+    }
+
+    return hash;
+}
+
+static VALUE metadata_fetch_result(VALUE arg)
+{
+    struct metadata_fetch *f = (struct metadata_fetch *)arg;
+    struct metadata_job *job;
+    VALUE result, value;
+    int i;
+
+    result = rb_hash_new();
+    for (i = 0; i < f->njobs; i++) {
+        job = &f->jobs[i];
+        if (job->failed != NULL) {
+            if (NIL_P(f->exception)) {
+                f->exception = ruby_libvirt_error_new(e_RetrieveError,
+                                                      job->failed,
+                                                      &job->error);
+            }
+            continue;
+        }
+        if (job->missing) {
+            value = Qnil;
+        }
+        else if (f->nkeys > 0) {
+            value = metadata_values_to_hash(f->keys, job->values, f->nkeys);
+        }
+        else {
+            value = rb_str_new2(job->xml);
+        }
+        rb_hash_aset(result, rb_str_new2(virDomainGetName(job->dom)), value);
+    }
+
+    return result;
+}
+
+/*
+ * Return the metadata of TYPE (and namespace URI) of DOMAINS, an Array of
+ * Libvirt::Domain or nil for every domain on C, fetched on up to
+ * CONCURRENCY worker threads, as a Hash from domain name to the metadata
+ * (nil if the domain has none).  With an Array of KEYS the value is a Hash
+ * of those keys instead of the XML.  The first failure, if any, is raised
+ * once all the domains have been tried.
+ */
+VALUE ruby_libvirt_metadata_get_bulk(VALUE c, int type, VALUE uri,
+                                     VALUE keys, VALUE domains,
+                                     int concurrency, unsigned int flags)
+{
+    struct metadata_fetch f;
+    VALUE result;
+    char *nsuri = NULL;
+    int exception = 0;
+
+    memset(&f, 0, sizeof(f));
+    f.type = type;
+    f.flags = flags;
+    f.exception = Qnil;
+
+    /* the workers run without the GVL, so they get their own copy */
+    if (!NIL_P(uri)) {
+        nsuri = strdup(StringValueCStr(uri));
+        if (nsuri == NULL) {
+            rb_memerror();
+        }
+    }
+    f.uri = nsuri;
+
+    metadata_fetch(c, domains, keys, &f, concurrency);
+
+    result = rb_protect(metadata_fetch_result, (VALUE)&f, &exception);
+    metadata_fetch_free(&f);
+    metadata_keys_free(f.keys, f.nkeys);
+    free(nsuri);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+    if (!NIL_P(f.exception)) {
+        rb_exc_raise(f.exception);
+    }
+
+    return result;
+}
+
+#if HAVE_PTHREAD_H && HAVE_CONST_VIR_DOMAIN_EVENT_ID_METADATA_CHANGE
+static VALUE c_metadata_index;
+
+/*
+ * A Libvirt::MetadataIndex maps each (key, value) pair found in one
+ * namespace of METADATA_ELEMENT metadata to the domains that carry it.  The
+ * domains live in a slot array; the postings (key, value -> slots) live in
+ * a chained hash table, which also maps each domain's UUID (key -1) to its
+ * slot.  Native METADATA_CHANGE and LIFECYCLE handlers update the index
+ * from the event loop thread, so everything below is protected by the
+ * index lock.  The index is shared between the Ruby object and the two
+ * event registrations, and freed by whichever lets go last.
+ */
+#define METADATA_INDEX_UUID_KEY -1
+
+struct metadata_posting {
+    struct metadata_posting *next;
+    int key;
+    char *value;
+    int *slots;
+    int nslots;
+    int capacity;
+};
+
+struct metadata_entry {
+    int used;
+    int seen;
+    unsigned long long stamp;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char *name;
+    char **values;
+};
+
+/* a domain that an event removed while a refresh was running */
+struct metadata_tombstone {
+    unsigned long long stamp;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+};
+
+struct metadata_index {
+    pthread_mutex_t lock;
+    int refs;
+    virConnectPtr conn;
+    char *uri;
+    char **keys;
+    int nkeys;
+    int change_id;
+    int lifecycle_id;
+    int closed;
+
+    struct metadata_entry *entries;
+    int nentries;
+    int nused;
+    struct metadata_posting **buckets;
+    int nbuckets;
+    int npostings;
+
+    int refreshing;
+    struct metadata_tombstone *tombstones;
+    int ntombstones;
+    int tombstone_capacity;
+
+    unsigned long long updates;
+    char *last_error;
+};
+
+static unsigned int metadata_hash(int key, const char *value)
+{
+    unsigned int h = 2166136261U ^ (unsigned int)key;
+
+    while (*value) {
+        h = (h ^ (unsigned char)*value++) * 16777619U;
+    }
+
+    return h;
+}
+
+static void metadata_index_rehash(struct metadata_index *idx)
+{
+    struct metadata_posting **buckets, *p, *next;
+    int i, nbuckets = idx->nbuckets * 2;
+    unsigned int h;
+
+    buckets = calloc(nbuckets, sizeof(struct metadata_posting *));
+    if (buckets == NULL) {
+        /* keep working with longer chains */
+        return;
+    }
+    for (i = 0; i < idx->nbuckets; i++) {
+        for (p = idx->buckets[i]; p != NULL; p = next) {
+            next = p->next;
+            h = metadata_hash(p->key, p->value) % nbuckets;
+            p->next = buckets[h];
+            buckets[h] = p;
+        }
+    }
+    free(idx->buckets);
+    idx->buckets = buckets;
+    idx->nbuckets = nbuckets;
+}
+
+static struct metadata_posting *metadata_posting_find(struct metadata_index *idx,
+                                                      int key,
+                                                      const char *value,
+                                                      int create)
+{
+    struct metadata_posting *p;
+    unsigned int h;
+
+    h = metadata_hash(key, value) % idx->nbuckets;
+    for (p = idx->buckets[h]; p != NULL; p = p->next) {
+        if (p->key == key && strcmp(p->value, value) == 0) {
+            return p;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(struct metadata_posting));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->value = strdup(value);
+    if (p->value == NULL) {
+        free(p);
+        return NULL;
+    }
+    p->key = key;
+    p->next = idx->buckets[h];
+    idx->buckets[h] = p;
+    idx->npostings++;
+    if (idx->npostings > idx->nbuckets * 2) {
+        metadata_index_rehash(idx);
+    }
+
+    return p;
+}
+
+static void metadata_posting_add(struct metadata_index *idx, int key,
+                                 const char *value, int slot)
+{
+    struct metadata_posting *p;
+    int *tmp;
+
+    p = metadata_posting_find(idx, key, value, 1);
+    if (p == NULL) {
+        return;
+    }
+    if (p->nslots == p->capacity) {
+        tmp = realloc(p->slots, (p->capacity * 2 + 4) * sizeof(int));
+        if (tmp == NULL) {
+            return;
+        }
+        p->slots = tmp;
+        p->capacity = p->capacity * 2 + 4;
+    }
+    p->slots[p->nslots++] = slot;
+}
+
+static void metadata_posting_remove(struct metadata_index *idx, int key,
+                                    const char *value, int slot)
+{
+    struct metadata_posting *p, **prev;
+    unsigned int h;
+    int i;
+
+    h = metadata_hash(key, value) % idx->nbuckets;
+    for (prev = &idx->buckets[h]; (p = *prev) != NULL; prev = &p->next) {
+        if (p->key == key && strcmp(p->value, value) == 0) {
+            break;
+        }
+    }
+    if (p == NULL) {
+        return;
+    }
+
+    for (i = 0; i < p->nslots; i++) {
+        if (p->slots[i] == slot) {
+            p->slots[i] = p->slots[--p->nslots];
+            break;
+        }
+    }
+    if (p->nslots == 0) {
+        *prev = p->next;
+        free(p->slots);
+        free(p->value);
+        free(p);
+        idx->npostings--;
+    }
+}
+
+static int metadata_index_slot(struct metadata_index *idx, const char *uuid)
+{
+    struct metadata_posting *p;
+
+    p = metadata_posting_find(idx, METADATA_INDEX_UUID_KEY, uuid, 0);
+
+    return (p != NULL && p->nslots > 0) ? p->slots[0] : -1;
+}
+
+static void metadata_index_unlink(struct metadata_index *idx, int slot)
+{
+    struct metadata_entry *entry = &idx->entries[slot];
+    int i;
+
+    for (i = 0; i < idx->nkeys; i++) {
+        if (entry->values[i] != NULL) {
+            metadata_posting_remove(idx, i, entry->values[i], slot);
+        }
+    }
+    metadata_posting_remove(idx, METADATA_INDEX_UUID_KEY, entry->uuid, slot);
+    free(entry->name);
+    metadata_values_free(entry->values, idx->nkeys);
+    memset(entry, 0, sizeof(struct metadata_entry));
+    idx->nused--;
+}
+
+/* Forget the domain with UUID. */
+static void metadata_index_remove(struct metadata_index *idx,
+                                  const char *uuid)
+{
+    int slot = metadata_index_slot(idx, uuid);
+
+    if (slot >= 0) {
+        metadata_index_unlink(idx, slot);
+    }
+}
+
+/*
+ * Forget the domain with UUID because an event said so.  While a refresh
+ * is running, also leave a tombstone, so that the refresh's older view of
+ * the domain is not loaded back into the index.
+ */
+static void metadata_index_forget(struct metadata_index *idx,
+                                  const char *uuid)
+{
+    struct metadata_tombstone *tmp;
+
+    metadata_index_remove(idx, uuid);
+    idx->updates++;
+
+    if (idx->refreshing == 0) {
+        return;
+    }
+    if (idx->ntombstones == idx->tombstone_capacity) {
+        tmp = realloc(idx->tombstones, (idx->tombstone_capacity * 2 + 4) *
+                      sizeof(struct metadata_tombstone));
+        if (tmp == NULL) {
+            return;
+        }
+        idx->tombstones = tmp;
+        idx->tombstone_capacity = idx->tombstone_capacity * 2 + 4;
+    }
+    idx->tombstones[idx->ntombstones].stamp = idx->updates;
+    memcpy(idx->tombstones[idx->ntombstones].uuid, uuid,
+           VIR_UUID_STRING_BUFLEN);
+    idx->ntombstones++;
+}
+
+/* Return non-zero if an event removed the domain with UUID after START. */
+static int metadata_index_buried(struct metadata_index *idx, const char *uuid,
+                                 unsigned long long start)
+{
+    int i;
+
+    for (i = 0; i < idx->ntombstones; i++) {
+        if (idx->tombstones[i].stamp > start &&
+            strcmp(idx->tombstones[i].uuid, uuid) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Record that the domain with UUID and NAME has VALUES (one per key, NULL
+ * where absent), replacing what was known about it.  Takes ownership of
+ * NAME and VALUES.
+ */
+static void metadata_index_set(struct metadata_index *idx, const char *uuid,
+                               char *name, char **values)
+{
+    struct metadata_entry *entry, *tmp;
+    int slot, i, any = 0;
+
+    metadata_index_remove(idx, uuid);
+
+    for (i = 0; i < idx->nkeys; i++) {
+        any |= values[i] != NULL;
+    }
+    if (!any) {
+        free(name);
+        metadata_values_free(values, idx->nkeys);
+        return;
+    }
+
+    for (slot = 0; slot < idx->nentries; slot++) {
+        if (!idx->entries[slot].used) {
+            break;
+        }
+    }
+    if (slot == idx->nentries) {
+        tmp = realloc(idx->entries, (idx->nentries * 2 + 16) *
+                      sizeof(struct metadata_entry));
+        if (tmp == NULL) {
+            free(name);
+            metadata_values_free(values, idx->nkeys);
+            return;
+        }
+        idx->entries = tmp;
+        memset(&idx->entries[idx->nentries], 0,
+               (idx->nentries + 16) * sizeof(struct metadata_entry));
+        idx->nentries = idx->nentries * 2 + 16;
+    }
+
+    entry = &idx->entries[slot];
+    entry->used = 1;
+    entry->seen = 1;
+    entry->stamp = ++idx->updates;
+    memcpy(entry->uuid, uuid, VIR_UUID_STRING_BUFLEN);
+    entry->name = name;
+    entry->values = values;
+    idx->nused++;
+
+    metadata_posting_add(idx, METADATA_INDEX_UUID_KEY, uuid, slot);
+    for (i = 0; i < idx->nkeys; i++) {
+        if (values[i] != NULL) {
+            metadata_posting_add(idx, i, values[i], slot);
+        }
+    }
+}
+
+static void metadata_index_error(struct metadata_index *idx)
+{
+    virErrorPtr err = virGetLastError();
+    char *msg = NULL;
+
+    if (err != NULL && err->message != NULL) {
+        msg = strdup(err->message);
+    }
+    virResetLastError();
+
+    if (msg != NULL) {
+        pthread_mutex_lock(&idx->lock);
+        free(idx->last_error);
+        idx->last_error = msg;
+        pthread_mutex_unlock(&idx->lock);
+    }
+}
+
+/* Re-read the metadata of DOM into the index; runs on the event loop. */
+static void metadata_index_update(struct metadata_index *idx,
+                                  virDomainPtr dom)
+{
+    char uuid[VIR_UUID_STRING_BUFLEN];
+    char *xml, *name, **values = NULL;
+
+    if (virDomainGetUUIDString(dom, uuid) < 0) {
+        metadata_index_error(idx);
+        return;
+    }
+
+    xml = virDomainGetMetadata(dom, VIR_DOMAIN_METADATA_ELEMENT, idx->uri, 0);
+    if (xml == NULL) {
+        if (!metadata_error_is_missing()) {
+            metadata_index_error(idx);
+            return;
+        }
+        virResetLastError();
+    }
+    else {
+        values = metadata_values(xml, idx->keys, idx->nkeys);
+        free(xml);
+    }
+
+    pthread_mutex_lock(&idx->lock);
+    if (values == NULL) {
+        metadata_index_forget(idx, uuid);
+    }
+    else {
+        name = strdup(virDomainGetName(dom));
+        if (name != NULL) {
+            metadata_index_set(idx, uuid, name, values);
+        }
+        else {
+            metadata_values_free(values, idx->nkeys);
+        }
+    }
+    pthread_mutex_unlock(&idx->lock);
+}
+
+static void metadata_index_unref(void *opaque)
+{
+    struct metadata_index *idx = opaque;
+    struct metadata_posting *p, *next;
+    int refs, i;
+
+    pthread_mutex_lock(&idx->lock);
+    refs = --idx->refs;
+    pthread_mutex_unlock(&idx->lock);
+
+    if (refs > 0) {
+        return;
+    }
+
+    for (i = 0; i < idx->nentries; i++) {
+        if (idx->entries[i].used) {
+            free(idx->entries[i].name);
+            metadata_values_free(idx->entries[i].values, idx->nkeys);
+        }
+    }
+    free(idx->entries);
+    for (i = 0; i < idx->nbuckets; i++) {
+        for (p = idx->buckets[i]; p != NULL; p = next) {
+            next = p->next;
+            free(p->slots);
+            free(p->value);
+            free(p);
+        }
+    }
+    free(idx->buckets);
+    free(idx->tombstones);
+    metadata_keys_free(idx->keys, idx->nkeys);
+    free(idx->uri);
+    free(idx->last_error);
+    virConnectClose(idx->conn);
+    pthread_mutex_destroy(&idx->lock);
+    free(idx);
+}
+
+static int metadata_index_change_callback(virConnectPtr RUBY_LIBVIRT_UNUSED(conn),
+                                          virDomainPtr dom, int type,
+                                          const char *nsuri, void *opaque)
+{
+    struct metadata_index *idx = opaque;
+
+    if (type == VIR_DOMAIN_METADATA_ELEMENT && nsuri != NULL &&
+        strcmp(nsuri, idx->uri) == 0) {
+        metadata_index_update(idx, dom);
+    }
+
+    return 0;
+}
+
+static int metadata_index_lifecycle_callback(virConnectPtr RUBY_LIBVIRT_UNUSED(conn),
+                                             virDomainPtr dom, int event,
+                                             int RUBY_LIBVIRT_UNUSED(detail),
+                                             void *opaque)
+{
+    struct metadata_index *idx = opaque;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+
+    switch (event) {
+    case VIR_DOMAIN_EVENT_DEFINED:
+    case VIR_DOMAIN_EVENT_STARTED:
+        metadata_index_update(idx, dom);
+        break;
+    case VIR_DOMAIN_EVENT_STOPPED:
+        /* a transient domain is gone once it stops */
+        if (virDomainIsPersistent(dom) == 1) {
+            break;
+        }
+        virResetLastError();
+        /* fall through */
+    case VIR_DOMAIN_EVENT_UNDEFINED:
+        if (virDomainGetUUIDString(dom, uuid) == 0) {
+            pthread_mutex_lock(&idx->lock);
+            metadata_index_forget(idx, uuid);
+            pthread_mutex_unlock(&idx->lock);
+        }
+        break;
+    }
+
+    return 0;
+}
+
+static void metadata_index_deregister(struct metadata_index *idx)
+{
+    if (idx->change_id >= 0) {
+        virConnectDomainEventDeregisterAny(idx->conn, idx->change_id);
+        idx->change_id = -1;
+    }
+    if (idx->lifecycle_id >= 0) {
+        virConnectDomainEventDeregisterAny(idx->conn, idx->lifecycle_id);
+        idx->lifecycle_id = -1;
+    }
+    virResetLastError();
+}
+
+static void metadata_index_release(void *opaque)
+{
+    struct metadata_index *idx = opaque;
+
+    metadata_index_deregister(idx);
+    metadata_index_unref(idx);
+}
+
+static struct metadata_index *metadata_index_get(VALUE i)
+{
+    struct metadata_index *idx;
+
+    Data_Get_Struct(i, struct metadata_index, idx);
+
+    return idx;
+}
+
+/* the caller must hold idx->lock */
+static void metadata_index_refresh_done(struct metadata_index *idx)
+{
+    if (--idx->refreshing == 0) {
+        idx->ntombstones = 0;
+    }
+}
+
+/*
+ * Load the results of a bulk fetch into the index, and end the refresh.
+ * Domains that an event updated after the fetch started (stamp > START)
+ * keep the event's view, and domains that an event removed since then
+ * stay out; domains that could not be read keep their old entry.
+ */
+static void metadata_index_load(struct metadata_index *idx,
+                                struct metadata_fetch *f,
+                                unsigned long long start)
+{
+    struct metadata_job *job;
+    char *name;
+    int i, slot;
+
+    pthread_mutex_lock(&idx->lock);
+    for (i = 0; i < idx->nentries; i++) {
+        idx->entries[i].seen = idx->entries[i].stamp > start;
+    }
+    for (i = 0; i < f->njobs; i++) {
+        job = &f->jobs[i];
+        slot = metadata_index_slot(idx, job->uuid);
+        if (slot >= 0 && (job->failed != NULL ||
+                          idx->entries[slot].stamp > start)) {
+            idx->entries[slot].seen = 1;
+            continue;
+        }
+        if (job->failed != NULL || job->missing ||
+            metadata_index_buried(idx, job->uuid, start)) {
+            continue;
+        }
+        name = strdup(virDomainGetName(job->dom));
+        if (name == NULL) {
+            continue;
+        }
+        metadata_index_set(idx, job->uuid, name, job->values);
+        job->values = NULL;
+    }
+    for (i = 0; i < idx->nentries; i++) {
+        if (idx->entries[i].used && !idx->entries[i].seen) {
+            metadata_index_unlink(idx, i);
+        }
+    }
+    metadata_index_refresh_done(idx);
+    pthread_mutex_unlock(&idx->lock);
+}
+
+struct metadata_refresh_arg {
+    VALUE c;
+    VALUE keys;
+    struct metadata_fetch *f;
+    int concurrency;
+};
+
+static VALUE metadata_index_refresh_fetch(VALUE arg)
+{
+    struct metadata_refresh_arg *r = (struct metadata_refresh_arg *)arg;
+
+    metadata_fetch(r->c, Qnil, r->keys, r->f, r->concurrency);
+
+    return Qnil;
+}
+
+static void metadata_index_refresh(VALUE i, struct metadata_index *idx,
+                                   int concurrency)
+{
+    struct metadata_fetch f;
+    struct metadata_refresh_arg arg;
+    unsigned long long start;
+    VALUE keys;
+    int j, exception = 0;
+
+    keys = rb_ary_new2(idx->nkeys);
+    for (j = 0; j < idx->nkeys; j++) {
+        rb_ary_store(keys, j, rb_str_new2(idx->keys[j]));
+    }
+
+    memset(&f, 0, sizeof(f));
+    f.type = VIR_DOMAIN_METADATA_ELEMENT;
+    f.uri = idx->uri;
+    f.exception = Qnil;
+
+    arg.c = rb_iv_get(i, "@connection");
+    arg.keys = keys;
+    arg.f = &f;
+    arg.concurrency = concurrency;
+
+    pthread_mutex_lock(&idx->lock);
+    start = idx->updates;
+    idx->refreshing++;
+    pthread_mutex_unlock(&idx->lock);
+
+    rb_protect(metadata_index_refresh_fetch, (VALUE)&arg, &exception);
+    if (exception) {
+        pthread_mutex_lock(&idx->lock);
+        metadata_index_refresh_done(idx);
+        pthread_mutex_unlock(&idx->lock);
+        rb_jump_tag(exception);
+    }
+
+    metadata_index_load(idx, &f, start);
+    for (j = 0; j < f.njobs; j++) {
+        if (f.jobs[j].failed != NULL) {
+            pthread_mutex_lock(&idx->lock);
+            free(idx->last_error);
+            idx->last_error = f.jobs[j].error.message ?
+                strdup(f.jobs[j].error.message) : NULL;
+            pthread_mutex_unlock(&idx->lock);
+            break;
+        }
+    }
+
+    metadata_fetch_free(&f);
+    metadata_keys_free(f.keys, f.nkeys);
+}
+
+/*
+ * call-seq:
+ *   Libvirt::MetadataIndex.new(conn, uri, keys, concurrency=0) -> Libvirt::MetadataIndex
+ *
+ * Build an index of the METADATA_ELEMENT metadata in namespace uri of every
+ * domain on conn, for answering questions like "which domains belong to
+ * tenant X" without fetching any metadata.  keys is an Array of the names
+ * to index; each is looked up as an attribute of the metadata element or,
+ * failing that, as a child element, so both
+ * <tt><tags tenant="x"/></tt> and <tt><tags><tenant>x</tenant></tags></tt>
+ * index "tenant" => "x".  The metadata is fetched on up to concurrency
+ * worker threads (a default if 0) and parsed natively.  Afterwards the index
+ * is kept up to date by native DOMAIN_EVENT_ID_METADATA_CHANGE and
+ * DOMAIN_EVENT_ID_LIFECYCLE handlers, which need an event loop
+ * (Libvirt::native_event_loop_start or Libvirt::event_register_impl) to be
+ * registered before the index is created.  Without one, libvirt refuses the
+ * handlers and the index only changes when idx.refresh is called;
+ * idx.stats["events"] tells the two modes apart.
+ */
+static VALUE libvirt_metadata_index_s_new(int argc, VALUE *argv,
+                                          VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    VALUE c, uri, keys, concurrency, result;
+    struct metadata_index *idx;
+    virConnectPtr conn;
+    int j;
+
+    rb_scan_args(argc, argv, "31", &c, &uri, &keys, &concurrency);
+
+    conn = ruby_libvirt_connect_get(c);
+    StringValueCStr(uri);
+    Check_Type(keys, T_ARRAY);
+    if (RARRAY_LEN(keys) == 0) {
+        rb_raise(rb_eArgError, "at least one key must be indexed");
+    }
+    for (j = 0; j < RARRAY_LEN(keys); j++) {
+        StringValueCStr(RARRAY_PTR(keys)[j]);
+    }
+
+    idx = calloc(1, sizeof(struct metadata_index));
+    if (idx == NULL) {
+        rb_memerror();
+    }
+    pthread_mutex_init(&idx->lock, NULL);
+    idx->refs = 1;
+    idx->change_id = -1;
+    idx->lifecycle_id = -1;
+    idx->conn = conn;
+    virConnectRef(conn);
+    idx->nbuckets = 64;
+    idx->buckets = calloc(idx->nbuckets, sizeof(struct metadata_posting *));
+    idx->uri = strdup(StringValueCStr(uri));
+    idx->nkeys = RARRAY_LEN(keys);
+    idx->keys = calloc(idx->nkeys + 1, sizeof(char *));
+    if (idx->buckets == NULL || idx->uri == NULL || idx->keys == NULL) {
+        metadata_index_unref(idx);
+        rb_memerror();
+    }
+    for (j = 0; j < idx->nkeys; j++) {
+        idx->keys[j] = strdup(StringValueCStr(RARRAY_PTR(keys)[j]));
+        if (idx->keys[j] == NULL) {
+            metadata_index_unref(idx);
+            rb_memerror();
+        }
+    }
+
+    result = ruby_libvirt_new_class(c_metadata_index, idx,
+                                    ruby_libvirt_conn_attr(c),
+                                    metadata_index_release);
+
+    /* register first, so that no change made during the initial fetch is
+     * missed */
+    pthread_mutex_lock(&idx->lock);
+    idx->refs += 2;
+    pthread_mutex_unlock(&idx->lock);
+    idx->change_id = virConnectDomainEventRegisterAny(conn, NULL,
+                                                      VIR_DOMAIN_EVENT_ID_METADATA_CHANGE,
+                                                      VIR_DOMAIN_EVENT_CALLBACK(metadata_index_change_callback),
+                                                      idx,
+                                                      metadata_index_unref);
+    if (idx->change_id < 0) {
+        pthread_mutex_lock(&idx->lock);
+        idx->refs -= 2;
+        pthread_mutex_unlock(&idx->lock);
+    }
+    else {
+        idx->lifecycle_id = virConnectDomainEventRegisterAny(conn, NULL,
+                                                             VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                             VIR_DOMAIN_EVENT_CALLBACK(metadata_index_lifecycle_callback),
+                                                             idx,
+                                                             metadata_index_unref);
+        if (idx->lifecycle_id < 0) {
+            pthread_mutex_lock(&idx->lock);
+            idx->refs--;
+            pthread_mutex_unlock(&idx->lock);
+            /* without lifecycle events undefined domains would never leave
+             * the index, so follow both or neither */
+            metadata_index_deregister(idx);
+        }
+    }
+    /* libvirt refuses the registrations when no event loop is registered;
+     * the index then only changes on idx.refresh */
+    virResetLastError();
+
+    metadata_index_refresh(result, idx, ruby_libvirt_value_to_int(concurrency));
+
+    return result;
+}
+
+static struct metadata_index *metadata_index_open(VALUE i)
+{
+    struct metadata_index *idx = metadata_index_get(i);
+
+    if (idx->closed) {
+        rb_raise(e_Error, "metadata index has been closed");
+    }
+
+    return idx;
+}
+
+static int metadata_index_key(struct metadata_index *idx, VALUE key)
+{
+    const char *name = StringValueCStr(key);
+    int i;
+
+    for (i = 0; i < idx->nkeys; i++) {
+        if (strcmp(idx->keys[i], name) == 0) {
+            return i;
+        }
+    }
+
+    rb_raise(rb_eArgError, "key %s is not indexed", name);
+}
+
+/* names of the domains in SLOTS, copied under the lock so that building
+ * the Ruby Array needs no lock */
+static char **metadata_index_names(struct metadata_index *idx, int *slots,
+                                   int nslots)
+{
+    char **names;
+    int i;
+
+    names = calloc(nslots + 1, sizeof(char *));
+    if (names == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nslots; i++) {
+        names[i] = strdup(idx->entries[slots[i]].name);
+    }
+
+    return names;
+}
+
+static VALUE metadata_names_to_array(VALUE arg)
+{
+    char **names = (char **)arg;
+    VALUE result;
+    int i;
+
+    result = rb_ary_new();
+    for (i = 0; names[i] != NULL; i++) {
+        rb_ary_push(result, rb_str_new2(names[i]));
+    }
+
+    return result;
+}
+
+static void metadata_names_free(char **names)
+{
+    int i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+/*
+ * call-seq:
+ *   idx.lookup(key, value) -> Array
+ *
+ * Return the names of the domains whose metadata has value for key.
+ */
+static VALUE libvirt_metadata_index_lookup(VALUE i, VALUE key, VALUE value)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    struct metadata_posting *p;
+    char **names = NULL;
+    const char *v;
+    int k, exception = 0;
+    VALUE result;
+
+    k = metadata_index_key(idx, key);
+    v = StringValueCStr(value);
+
+    pthread_mutex_lock(&idx->lock);
+    p = metadata_posting_find(idx, k, v, 0);
+    names = metadata_index_names(idx, p ? p->slots : NULL, p ? p->nslots : 0);
+    pthread_mutex_unlock(&idx->lock);
+
+    if (names == NULL) {
+        rb_memerror();
+    }
+    result = rb_protect(metadata_names_to_array, (VALUE)names, &exception);
+    metadata_names_free(names);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+struct metadata_values_arg {
+    char **values;
+    char ***names;
+    int nvalues;
+};
+
+static VALUE metadata_values_to_result(VALUE in)
+{
+    struct metadata_values_arg *arg = (struct metadata_values_arg *)in;
+    VALUE result;
+    int i;
+
+    result = rb_hash_new();
+    for (i = 0; i < arg->nvalues; i++) {
+        rb_hash_aset(result, rb_str_new2(arg->values[i]),
+                     metadata_names_to_array((VALUE)arg->names[i]));
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   idx.values(key) -> Hash
+ *
+ * Return a Hash from each value of key found in the index to the names of
+ * the domains that have it.
+ */
+static VALUE libvirt_metadata_index_values(VALUE i, VALUE key)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    struct metadata_values_arg arg;
+    struct metadata_posting *p;
+    int k, b, n = 0, exception = 0;
+    VALUE result;
+
+    k = metadata_index_key(idx, key);
+
+    pthread_mutex_lock(&idx->lock);
+    arg.values = calloc(idx->npostings + 1, sizeof(char *));
+    arg.names = calloc(idx->npostings + 1, sizeof(char **));
+    if (arg.values != NULL && arg.names != NULL) {
+        for (b = 0; b < idx->nbuckets; b++) {
+            for (p = idx->buckets[b]; p != NULL; p = p->next) {
+                if (p->key != k) {
+                    continue;
+                }
+                arg.values[n] = strdup(p->value);
+                arg.names[n] = metadata_index_names(idx, p->slots, p->nslots);
+                if (arg.values[n] == NULL || arg.names[n] == NULL) {
+                    free(arg.values[n]);
+                    if (arg.names[n] != NULL) {
+                        metadata_names_free(arg.names[n]);
+                    }
+                    continue;
+                }
+                n++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&idx->lock);
+
+    if (arg.values == NULL || arg.names == NULL) {
+        free(arg.values);
+        free(arg.names);
+        rb_memerror();
+    }
+
+    arg.nvalues = n;
+    result = rb_protect(metadata_values_to_result, (VALUE)&arg, &exception);
+    for (b = 0; b < n; b++) {
+        free(arg.values[b]);
+        metadata_names_free(arg.names[b]);
+    }
+    free(arg.values);
+    free(arg.names);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+struct metadata_tags_arg {
+    char **keys;
+    char **values;
+    int nkeys;
+};
+
+static VALUE metadata_tags_to_hash(VALUE in)
+{
+    struct metadata_tags_arg *arg = (struct metadata_tags_arg *)in;
+
+    return metadata_values_to_hash(arg->keys, arg->values, arg->nkeys);
+}
+
+/*
+ * call-seq:
+ *   idx.tags(name) -> Hash
+ *
+ * Return the indexed keys of the domain called name, as a Hash from key to
+ * value (nil where the domain's metadata lacks the key), or nil if the
+ * domain is not in the index.
+ */
+static VALUE libvirt_metadata_index_tags(VALUE i, VALUE name)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    struct metadata_tags_arg arg;
+    const char *n = StringValueCStr(name);
+    int s, k, found = 0, exception = 0;
+    VALUE result;
+
+    arg.keys = idx->keys;
+    arg.nkeys = idx->nkeys;
+    arg.values = calloc(idx->nkeys + 1, sizeof(char *));
+    if (arg.values == NULL) {
+        rb_memerror();
+    }
+
+    pthread_mutex_lock(&idx->lock);
+    for (s = 0; s < idx->nentries; s++) {
+        if (idx->entries[s].used && strcmp(idx->entries[s].name, n) == 0) {
+            found = 1;
+            for (k = 0; k < idx->nkeys; k++) {
+                if (idx->entries[s].values[k] != NULL) {
+                    arg.values[k] = strdup(idx->entries[s].values[k]);
+                }
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&idx->lock);
+
+    result = Qnil;
+    if (found) {
+        result = rb_protect(metadata_tags_to_hash, (VALUE)&arg, &exception);
+    }
+    metadata_values_free(arg.values, idx->nkeys);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   idx.size -> Fixnum
+ *
+ * Return the number of domains in the index, that is those whose metadata
+ * has at least one of the indexed keys.
+ */
+static VALUE libvirt_metadata_index_size(VALUE i)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    int n;
+
+    pthread_mutex_lock(&idx->lock);
+    n = idx->nused;
+    pthread_mutex_unlock(&idx->lock);
+
+    return INT2NUM(n);
+}
+
+/*
+ * call-seq:
+ *   idx.refresh(concurrency=0) -> nil
+ *
+ * Fetch the metadata of every domain again and bring the index up to date,
+ * for use when no event loop is running or events may have been lost (for
+ * instance across a reconnect).
+ */
+static VALUE libvirt_metadata_index_refresh(int argc, VALUE *argv, VALUE i)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    VALUE concurrency;
+
+    rb_scan_args(argc, argv, "01", &concurrency);
+
+    metadata_index_refresh(i, idx, ruby_libvirt_value_to_int(concurrency));
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   idx.stats -> Hash
+ *
+ * Return "domains" (the size of the index), "values" (the number of
+ * distinct key/value pairs), "updates" (changes applied since the index was
+ * built, from events and refreshes), "events" (+true+ if events keep the
+ * index up to date, +false+ if only idx.refresh does) and "last_error" (the
+ * libvirt error message of the latest failed metadata fetch, or nil).
+ */
+static VALUE libvirt_metadata_index_stats(VALUE i)
+{
+    struct metadata_index *idx = metadata_index_open(i);
+    unsigned long long updates;
+    char *last_error = NULL;
+    int domains, values, exception = 0;
+    VALUE result, msg;
+
+    pthread_mutex_lock(&idx->lock);
+    domains = idx->nused;
+    /* the UUID postings are not values */
+    values = idx->npostings - idx->nused;
+    updates = idx->updates;
+    if (idx->last_error != NULL) {
+        last_error = strdup(idx->last_error);
+    }
+    pthread_mutex_unlock(&idx->lock);
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("domains"), INT2NUM(domains));
+    rb_hash_aset(result, rb_str_new2("values"), INT2NUM(values));
+    rb_hash_aset(result, rb_str_new2("updates"), ULL2NUM(updates));
+    rb_hash_aset(result, rb_str_new2("events"),
+                 idx->change_id >= 0 ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new2("last_error"), Qnil);
+    if (last_error != NULL) {
+        msg = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&last_error,
+                         &exception);
+        free(last_error);
+        if (exception) {
+            rb_jump_tag(exception);
+        }
+        rb_hash_aset(result, rb_str_new2("last_error"), msg);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   idx.close -> nil
+ *
+ * Stop following metadata changes.  The index cannot be used afterwards.
+ */
+static VALUE libvirt_metadata_index_close(VALUE i)
+{
+    struct metadata_index *idx = metadata_index_get(i);
+
+    metadata_index_deregister(idx);
+    idx->closed = 1;
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   idx.closed? -> [True|False]
+ *
+ * Return +true+ if the index has been closed.
+ */
+static VALUE libvirt_metadata_index_closed_p(VALUE i)
+{
+    return metadata_index_get(i)->closed ? Qtrue : Qfalse;
+}
+#endif
+#endif
+
+#if HAVE_VIRDOMAINSETMETADATA
+struct metadata_set_job {
+    virDomainPtr dom;
+    char *metadata;
+    const char *failed;
+    virError error;
+    double time;
+};
+
+struct metadata_set {
+    VALUE changes;
+    VALUE rkey;
+    VALUE ruri;
+    struct metadata_set_job *jobs;
+    int njobs;
+    int type;
+    char *key;
+    char *uri;
+    unsigned int flags;
+};
+
+static void metadata_set_free(struct metadata_set *s)
+{
+    int i;
+
+    for (i = 0; i < s->njobs; i++) {
+        if (s->jobs[i].dom != NULL) {
+            virDomainFree(s->jobs[i].dom);
+        }
+        free(s->jobs[i].metadata);
+        if (s->jobs[i].failed != NULL) {
+            virResetError(&s->jobs[i].error);
+        }
+    }
+    free(s->jobs);
+    free(s->key);
+    free(s->uri);
+}
+
+static int metadata_set_parse_entry(VALUE dom, VALUE metadata, VALUE in)
+{
+    struct metadata_set *s = (struct metadata_set *)in;
+    struct metadata_set_job *job = &s->jobs[s->njobs];
+
+    if (rb_obj_is_kind_of(dom, c_domain) != Qtrue) {
+        rb_raise(rb_eTypeError,
+                 "wrong argument type (expected Libvirt::Domain)");
+    }
+    if (!NIL_P(metadata)) {
+        job->metadata = strdup(StringValueCStr(metadata));
+        if (job->metadata == NULL) {
+            rb_memerror();
+        }
+    }
+    job->dom = ruby_libvirt_domain_get(dom);
+    virDomainRef(job->dom);
+    s->njobs++;
+
+    return ST_CONTINUE;
+}
+
+static VALUE metadata_set_parse(VALUE arg)
+{
+    struct metadata_set *s = (struct metadata_set *)arg;
+
+    /* the workers run without the GVL, so they get their own copies */
+    if (!NIL_P(s->rkey) &&
+        (s->key = strdup(StringValueCStr(s->rkey))) == NULL) {
+        rb_memerror();
+    }
+    if (!NIL_P(s->ruri) &&
+        (s->uri = strdup(StringValueCStr(s->ruri))) == NULL) {
+        rb_memerror();
+    }
+
+    rb_hash_foreach(s->changes, metadata_set_parse_entry, arg);
+
+    return Qnil;
+}
+
+static void metadata_set_run(void *opaque, int i)
+{
+    struct metadata_set *s = (struct metadata_set *)opaque;
+    struct metadata_set_job *job = &s->jobs[i];
+    double start;
+
+    start = ruby_libvirt_monotonic_time();
+    if (virDomainSetMetadata(job->dom, s->type, job->metadata, s->key, s->uri,
+                             s->flags) < 0) {
+        job->failed = "virDomainSetMetadata";
+        virCopyLastError(&job->error);
+        virResetLastError();
+    }
+    job->time = ruby_libvirt_monotonic_time() - start;
+}
+
+static VALUE metadata_set_result(VALUE arg)
+{
+    struct metadata_set *s = (struct metadata_set *)arg;
+    struct metadata_set_job *job;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(s->njobs);
+    for (i = 0; i < s->njobs; i++) {
+        job = &s->jobs[i];
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("name"),
+                     rb_str_new2(virDomainGetName(job->dom)));
+        rb_hash_aset(hash, rb_str_new2("error"), job->failed == NULL ? Qnil :
+                     ruby_libvirt_error_new(e_Error, job->failed,
+                                            &job->error));
+        rb_hash_aset(hash, rb_str_new2("time"), rb_float_new(job->time));
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/*
+ * Set the metadata of TYPE of every Libvirt::Domain key of the CHANGES Hash
+ * to its value (a String, or nil to remove it), with KEY and URI as for
+ * dom.metadata=, on up to CONCURRENCY worker threads of C.  Returns an
+ * Array with a result Hash per domain.
+ */
+VALUE ruby_libvirt_metadata_set_bulk(VALUE c, VALUE changes, int type,
+                                     VALUE key, VALUE uri, int concurrency,
+                                     unsigned int flags)
+{
+    struct metadata_set s;
+    VALUE result;
+    int exception = 0;
+
+    Check_Type(changes, T_HASH);
+
+    memset(&s, 0, sizeof(s));
+    s.changes = changes;
+    s.type = type;
+    s.rkey = key;
+    s.ruri = uri;
+    s.flags = flags;
+    s.jobs = calloc(RHASH_SIZE(changes) + 1, sizeof(struct metadata_set_job));
+    if (s.jobs == NULL) {
+        rb_memerror();
+    }
+
+    rb_protect(metadata_set_parse, (VALUE)&s, &exception);
+    if (exception) {
+        metadata_set_free(&s);
+        rb_jump_tag(exception);
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_NORMAL,
+                                               s.njobs, concurrency,
+                                               metadata_set_run, &s);
+    if (exception) {
+        metadata_set_free(&s);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(metadata_set_result, (VALUE)&s, &exception);
+    metadata_set_free(&s);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+/*
+ * Class Libvirt::MetadataIndex
+ */
+void ruby_libvirt_metadata_init(void)
+{
+#if HAVE_VIRDOMAINGETMETADATA && HAVE_VIRCONNECTLISTALLDOMAINS && HAVE_LIBXML_PARSER_H && HAVE_PTHREAD_H && HAVE_CONST_VIR_DOMAIN_EVENT_ID_METADATA_CHANGE
+    c_metadata_index = rb_define_class_under(m_libvirt, "MetadataIndex",
+                                             rb_cObject);
+    rb_undef_alloc_func(c_metadata_index);
+
+    rb_define_attr(c_metadata_index, "connection", 1, 0);
+
+    rb_define_singleton_method(c_metadata_index, "new",
+                               libvirt_metadata_index_s_new, -1);
+    rb_define_method(c_metadata_index, "lookup",
+                     libvirt_metadata_index_lookup, 2);
+    rb_define_method(c_metadata_index, "values",
+                     libvirt_metadata_index_values, 1);
+    rb_define_method(c_metadata_index, "tags", libvirt_metadata_index_tags,
+                     1);
+    rb_define_method(c_metadata_index, "size", libvirt_metadata_index_size,
+                     0);
+    rb_define_method(c_metadata_index, "refresh",
+                     libvirt_metadata_index_refresh, -1);
+    rb_define_method(c_metadata_index, "stats",
+                     libvirt_metadata_index_stats, 0);
+    rb_define_method(c_metadata_index, "close",
+                     libvirt_metadata_index_close, 0);
+    rb_define_method(c_metadata_index, "closed?",
+                     libvirt_metadata_index_closed_p, 0);
+#endif
+}
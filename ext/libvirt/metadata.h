@@ -0,0 +1,13 @@
+#ifndef METADATA_H
+#define METADATA_H
+
+void ruby_libvirt_metadata_init(void);
+
+VALUE ruby_libvirt_metadata_get_bulk(VALUE c, int type, VALUE uri,
+                                     VALUE keys, VALUE domains,
+                                     int concurrency, unsigned int flags);
+VALUE ruby_libvirt_metadata_set_bulk(VALUE c, VALUE changes, int type,
+                                     VALUE key, VALUE uri, int concurrency,
+                                     unsigned int flags);
+
+#endif
@@ -19,12 +19,21 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
 #include <ruby.h>
+#include <st.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "xml.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #if HAVE_TYPE_VIRNETWORKPTR
 static VALUE c_network;
@@ -36,7 +45,28 @@ static void network_free(void *d)
 
 static virNetworkPtr network_get(VALUE n)
 {
-    ruby_libvirt_get_struct(Network, n);
+    virNetworkPtr net, newnet;
+    virConnectPtr conn;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    Data_Get_Struct(n, virNetwork, net);
+    if (!net) {
+        rb_raise(rb_eArgError, "Network has been freed");
+    }
+
+    conn = ruby_libvirt_connect_reopened(n);
+    if (conn != NULL && virNetworkGetConnect(net) != conn) {
+        ruby_libvirt_raise_error_if(virNetworkGetUUID(net, uuid) < 0,
+                                    e_RetrieveError, "virNetworkGetUUID", conn);
+        newnet = RUBY_LIBVIRT_CALL(virNetworkLookupByUUID, conn, uuid);
+        ruby_libvirt_raise_error_if(newnet == NULL, e_RetrieveError,
+                                    "virNetworkLookupByUUID", conn);
+        DATA_PTR(n) = newnet;
+        virNetworkFree(net);
+        net = newnet;
+    }
+
+    return net;
 }
 
 VALUE ruby_libvirt_network_new(virNetworkPtr n, VALUE conn)
@@ -89,6 +119,544 @@ static VALUE libvirt_network_update(VALUE n, VALUE command, VALUE section,
                                    NUM2UINT(section), NUM2INT(index),
                                    StringValuePtr(xml), NUM2UINT(flags));
 }
+
+/*
+ * A batch of updates is run in waves: a run of consecutive updates with the
+ * same command and section is issued concurrently, and each wave finishes
+ * before the next one starts, so that e.g. a delete followed by an add of
+ * the same entry still happens in that order.
+ */
+struct network_update {
+    unsigned int command;
+    unsigned int section;
+    int index;
+    char *xml;
+    unsigned int flags;
+    int failed;
+    virError error;
+    int undo_failed;
+    virError undo_error;
+    /* for a delete that may be rolled back: the full element that was
+     * deleted, its position among its siblings and the siblings that
+     * followed it, as found in the network XML just before the delete */
+    char *orig_xml;
+    int orig_pos;
+    char **after;
+    int nafter;
+};
+
+struct network_update_batch {
+    virNetworkPtr net;
+    VALUE input;
+    struct network_update *updates;
+    int nupdates;
+    /* the first update of the wave being run, and the one after its last */
+    int start;
+    int end;
+    /* the updates to undo, most recent first */
+    int *undo;
+};
+
+static void network_update_batch_free(struct network_update_batch *b)
+{
+    int i, j;
+
+    for (i = 0; i < b->nupdates; i++) {
+        free(b->updates[i].xml);
+        free(b->updates[i].orig_xml);
+        for (j = 0; j < b->updates[i].nafter; j++) {
+            free(b->updates[i].after[j]);
+        }
+        free(b->updates[i].after);
+        if (b->updates[i].failed) {
+            virResetError(&b->updates[i].error);
+        }
+        if (b->updates[i].undo_failed) {
+            virResetError(&b->updates[i].undo_error);
+        }
+    }
+    free(b->updates);
+    free(b->undo);
+}
+
+static VALUE network_update_batch_parse(VALUE arg)
+{
+    struct network_update_batch *b = (struct network_update_batch *)arg;
+    struct network_update *u;
+    VALUE entry, xml;
+    int i;
+
+    for (i = 0; i < b->nupdates; i++) {
+        entry = rb_ary_entry(b->input, i);
+        Check_Type(entry, T_ARRAY);
+        if (RARRAY_LEN(entry) != 4 && RARRAY_LEN(entry) != 5) {
+            rb_raise(rb_eArgError,
+                     "wrong number of elements in update %d (%ld for 4 or 5)",
+                     i, RARRAY_LEN(entry));
+        }
+
+        u = &b->updates[i];
+        u->command = NUM2UINT(rb_ary_entry(entry, 0));
+        u->section = NUM2UINT(rb_ary_entry(entry, 1));
+        u->index = NUM2INT(rb_ary_entry(entry, 2));
+        u->flags = ruby_libvirt_value_to_uint(rb_ary_entry(entry, 4));
+        /* the worker threads must not touch the Ruby string */
+        xml = rb_ary_entry(entry, 3);
+        u->xml = strdup(StringValueCStr(xml));
+        if (u->xml == NULL) {
+            rb_memerror();
+        }
+    }
+
+    return Qnil;
+}
+
+static void network_update_apply(void *opaque, int i)
+{
+    struct network_update_batch *b = (struct network_update_batch *)opaque;
+    struct network_update *u = &b->updates[b->start + i];
+
+    if (virNetworkUpdate(b->net, u->command, u->section, u->index, u->xml,
+                         u->flags) < 0) {
+        virCopyLastError(&u->error);
+        virResetLastError();
+        u->failed = 1;
+    }
+}
+
+#if HAVE_LIBXML_PARSER_H
+#define NETWORK_UPDATE_MAX_PARENTS 16
+
+/* Find the elements that hold the entries of SECTION in the network XML
+ * rooted at ROOT, returning how many were stored in PARENTS.  For the DHCP
+ * sections INDEX picks the <ip> element, or all of them if negative.
+ */
+static int network_update_section_parents(xmlNodePtr root,
+                                          unsigned int section, int index,
+                                          xmlNodePtr *parents)
+{
+    xmlNodePtr cur, dhcp;
+    int n = 0, nparents = 0;
+
+    switch (section) {
+    case VIR_NETWORK_SECTION_IP:
+    case VIR_NETWORK_SECTION_PORTGROUP:
+        parents[nparents++] = root;
+        break;
+    case VIR_NETWORK_SECTION_FORWARD_INTERFACE:
+    case VIR_NETWORK_SECTION_FORWARD_PF:
+        parents[nparents] = ruby_libvirt_xml_child(root, "forward");
+        nparents += parents[nparents] != NULL;
+        break;
+    case VIR_NETWORK_SECTION_DNS_HOST:
+    case VIR_NETWORK_SECTION_DNS_TXT:
+    case VIR_NETWORK_SECTION_DNS_SRV:
+        parents[nparents] = ruby_libvirt_xml_child(root, "dns");
+        nparents += parents[nparents] != NULL;
+        break;
+    case VIR_NETWORK_SECTION_IP_DHCP_HOST:
+    case VIR_NETWORK_SECTION_IP_DHCP_RANGE:
+        ruby_libvirt_xml_foreach_child(root, cur, "ip") {
+            if ((index < 0 || n == index) &&
+                nparents < NETWORK_UPDATE_MAX_PARENTS) {
+                dhcp = ruby_libvirt_xml_child(cur, "dhcp");
+                if (dhcp != NULL) {
+                    parents[nparents++] = dhcp;
+                }
+            }
+            n++;
+        }
+        break;
+    }
+
+    return nparents;
+}
+
+/* Whether NODE is the entry that the (possibly partial) entry WANT names,
+ * that is whether it has the same name and all of WANT's attributes.
+ */
+static int network_update_matches(xmlNodePtr node, xmlNodePtr want)
+{
+    xmlAttrPtr attr;
+    xmlChar *mine, *theirs;
+    int match;
+
+    if (!xmlStrEqual(node->name, want->name) || want->properties == NULL) {
+        return 0;
+    }
+
+    for (attr = want->properties; attr != NULL; attr = attr->next) {
+        theirs = xmlGetProp(want, attr->name);
+        mine = xmlGetProp(node, attr->name);
+        match = mine != NULL && theirs != NULL && xmlStrEqual(mine, theirs);
+        xmlFree(mine);
+        xmlFree(theirs);
+        if (!match) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static char *network_update_dump(xmlDocPtr doc, xmlNodePtr node)
+{
+    xmlBufferPtr buf;
+    char *xml = NULL;
+
+    buf = xmlBufferCreate();
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (xmlNodeDump(buf, doc, node, 0, 0) >= 0) {
+        xml = strdup((const char *)xmlBufferContent(buf));
+    }
+    xmlBufferFree(buf);
+
+    return xml;
+}
+
+/* Record the full entry that the delete U is about to remove from the
+ * network XML DOC, where it sits and what follows it, so that rolling the
+ * delete back restores the entry as it was rather than the caller's
+ * (possibly partial) description of it.
+ */
+static void network_update_capture_one(xmlDocPtr doc,
+                                       struct network_update *u)
+{
+    xmlNodePtr parents[NETWORK_UPDATE_MAX_PARENTS], want, cur, found = NULL;
+    xmlDocPtr wantdoc;
+    int nparents, pos = 0, i;
+
+    wantdoc = ruby_libvirt_xml_parse(u->xml);
+    if (wantdoc == NULL) {
+        return;
+    }
+    want = xmlDocGetRootElement(wantdoc);
+
+    nparents = network_update_section_parents(xmlDocGetRootElement(doc),
+                                              u->section, u->index, parents);
+    for (i = 0; i < nparents && found == NULL; i++) {
+        pos = 0;
+        ruby_libvirt_xml_foreach_child(parents[i], cur, (const char *)want->name) {
+            if (network_update_matches(cur, want)) {
+                found = cur;
+                break;
+            }
+            pos++;
+        }
+    }
+    xmlFreeDoc(wantdoc);
+    if (found == NULL) {
+        return;
+    }
+
+    u->orig_xml = network_update_dump(doc, found);
+    if (u->orig_xml == NULL) {
+        return;
+    }
+    u->orig_pos = pos;
+
+    for (cur = found->next; cur != NULL; cur = cur->next) {
+        if (ruby_libvirt_xml_is(cur, (const char *)found->name)) {
+            u->nafter++;
+        }
+    }
+    u->after = calloc(u->nafter + 1, sizeof(char *));
+    if (u->after == NULL) {
+        u->nafter = 0;
+        return;
+    }
+    i = 0;
+    for (cur = found->next; cur != NULL; cur = cur->next) {
+        if (ruby_libvirt_xml_is(cur, (const char *)found->name)) {
+            u->after[i] = network_update_dump(doc, cur);
+            if (u->after[i] == NULL) {
+                break;
+            }
+            i++;
+        }
+    }
+    u->nafter = i;
+}
+
+static xmlDocPtr network_update_fetch(virNetworkPtr net, unsigned int flags)
+{
+    xmlDocPtr doc;
+    char *xml;
+
+    xml = virNetworkGetXMLDesc(net, flags);
+    if (xml == NULL) {
+        virResetLastError();
+        return NULL;
+    }
+    doc = ruby_libvirt_xml_parse(xml);
+    free(xml);
+
+    return doc;
+}
+
+/* Capture the entries that the wave of deletes starting at b->start is
+ * about to remove, from the live or persistent XML as each delete targets.
+ */
+static void network_update_capture(void *opaque, int RUBY_LIBVIRT_UNUSED(i))
+{
+    struct network_update_batch *b = (struct network_update_batch *)opaque;
+    struct network_update *u;
+    xmlDocPtr live = NULL, config = NULL, *doc;
+    int j;
+
+    for (j = b->start; j < b->end; j++) {
+        u = &b->updates[j];
+        if ((u->flags & VIR_NETWORK_UPDATE_AFFECT_CONFIG) &&
+            !(u->flags & VIR_NETWORK_UPDATE_AFFECT_LIVE)) {
+            doc = &config;
+            if (*doc == NULL) {
+                *doc = network_update_fetch(b->net, VIR_NETWORK_XML_INACTIVE);
+            }
+        }
+        else {
+            doc = &live;
+            if (*doc == NULL) {
+                *doc = network_update_fetch(b->net, 0);
+            }
+        }
+        if (*doc != NULL) {
+            network_update_capture_one(*doc, u);
+        }
+    }
+
+    if (live != NULL) {
+        xmlFreeDoc(live);
+    }
+    if (config != NULL) {
+        xmlFreeDoc(config);
+    }
+}
+#endif
+
+static int network_update_undo_one(struct network_update_batch *b,
+                                   struct network_update *u,
+                                   unsigned int command, const char *xml)
+{
+    if (virNetworkUpdate(b->net, command, u->section, u->index, xml,
+                         u->flags) < 0) {
+        if (!u->undo_failed) {
+            virCopyLastError(&u->undo_error);
+            u->undo_failed = 1;
+        }
+        virResetLastError();
+        return -1;
+    }
+
+    return 0;
+}
+
+static void network_update_revert(void *opaque, int i)
+{
+    struct network_update_batch *b = (struct network_update_batch *)opaque;
+    struct network_update *u = &b->updates[b->undo[i]];
+    int j;
+
+    if (u->command == VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST ||
+        u->command == VIR_NETWORK_UPDATE_COMMAND_ADD_LAST) {
+        network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_DELETE,
+                                u->xml);
+        return;
+    }
+    if (u->command != VIR_NETWORK_UPDATE_COMMAND_DELETE) {
+        return;
+    }
+
+    if (u->orig_xml == NULL) {
+        /* the deleted entry could not be found beforehand */
+        network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+                                u->xml);
+        return;
+    }
+
+    if (u->orig_pos == 0 && u->nafter > 0) {
+        network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_ADD_FIRST,
+                                u->orig_xml);
+        return;
+    }
+
+    /* libvirt can only add at either end, so put the entry back last and
+     * move the entries that used to follow it back behind it */
+    if (network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+                                u->orig_xml) < 0) {
+        return;
+    }
+    for (j = 0; j < u->nafter; j++) {
+        if (network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_DELETE,
+                                    u->after[j]) == 0) {
+            network_update_undo_one(b, u, VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+                                    u->after[j]);
+        }
+    }
+}
+
+static VALUE network_update_batch_result(VALUE arg)
+{
+    struct network_update_batch *b = (struct network_update_batch *)arg;
+    VALUE result, errors, undo_errors;
+    int i;
+
+    errors = rb_hash_new();
+    undo_errors = rb_hash_new();
+    for (i = 0; i < b->nupdates; i++) {
+        if (b->updates[i].failed) {
+            rb_hash_aset(errors, INT2NUM(i),
+                         ruby_libvirt_error_new(e_Error, "virNetworkUpdate",
+                                                &b->updates[i].error));
+        }
+        if (b->updates[i].undo_failed) {
+            rb_hash_aset(undo_errors, INT2NUM(i),
+                         ruby_libvirt_error_new(e_Error, "virNetworkUpdate",
+                                                &b->updates[i].undo_error));
+        }
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("errors"), errors);
+    rb_hash_aset(result, rb_str_new2("rolled_back"),
+                 b->undo != NULL ? Qtrue : Qfalse);
+    rb_hash_aset(result, rb_str_new2("rollback_errors"), undo_errors);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   net.update_batch(updates, rollback=false, concurrency=0) -> Hash
+ *
+ * Call virNetworkUpdate[http://www.libvirt.org/html/libvirt-libvirt-network.html#virNetworkUpdate]
+ * for each of updates, an Array of [command, section, index, xml, flags]
+ * Arrays (flags is optional).  Consecutive updates with the same command and
+ * section are issued on up to concurrency native threads at once (a default
+ * if 0), so the order in which they are applied relative to each other is
+ * unspecified; pass a concurrency of 1 to apply them strictly in order.
+ *
+ * Failures do not stop the batch.  The result is a Hash whose "errors" key
+ * maps the position of each failed update to its Libvirt::Error.  If
+ * rollback is true and any update failed, the updates that succeeded are
+ * undone in reverse order, "rolled_back" is set to true and any failures
+ * while undoing them are reported under "rollback_errors".  Only adds and
+ * deletes can be undone, so rollback cannot be combined with modify
+ * commands.  A deleted entry is restored from the network XML as it was
+ * just before the delete, at its original position, so the xml of a delete
+ * only needs to identify the entry.  If the connection has a governor and
+ * the calling thread is interrupted (Timeout, Thread#raise) while waiting
+ * for it, the batch stops there and nothing is rolled back.
+ */
+static VALUE libvirt_network_update_batch(int argc, VALUE *argv, VALUE n)
+{
+    VALUE updates, rollback = RUBY_Qnil, concurrency = RUBY_Qnil, result;
+    struct network_update_batch b;
+    int exception = 0, nconcurrency, end, nundo, i;
+
+    rb_scan_args(argc, argv, "12", &updates, &rollback, &concurrency);
+
+    Check_Type(updates, T_ARRAY);
+    nconcurrency = ruby_libvirt_value_to_int(concurrency);
+
+    memset(&b, 0, sizeof(b));
+    b.net = network_get(n);
+    b.input = updates;
+    b.nupdates = RARRAY_LEN(updates);
+    b.updates = calloc(b.nupdates + 1, sizeof(struct network_update));
+    if (b.updates == NULL) {
+        rb_memerror();
+    }
+
+    rb_protect(network_update_batch_parse, (VALUE)&b, &exception);
+    if (exception) {
+        network_update_batch_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    if (RTEST(rollback)) {
+        for (i = 0; i < b.nupdates; i++) {
+            if (b.updates[i].command == VIR_NETWORK_UPDATE_COMMAND_MODIFY) {
+                network_update_batch_free(&b);
+                rb_raise(rb_eArgError,
+                         "modify updates cannot be rolled back (update %d)",
+                         i);
+            }
+        }
+    }
+
+    for (b.start = 0; b.start < b.nupdates; b.start = end) {
+        for (end = b.start + 1; end < b.nupdates; end++) {
+            if (b.updates[end].command != b.updates[b.start].command ||
+                b.updates[end].section != b.updates[b.start].section) {
+                break;
+            }
+        }
+        b.end = end;
+#if HAVE_LIBXML_PARSER_H
+        if (RTEST(rollback) &&
+            b.updates[b.start].command == VIR_NETWORK_UPDATE_COMMAND_DELETE) {
+            exception = ruby_libvirt_parallel_for_conn(n,
+                                                       RUBY_LIBVIRT_LANE_NORMAL,
+                                                       1, 1,
+                                                       network_update_capture,
+                                                       &b);
+        }
+#endif
+        if (exception == 0) {
+            exception = ruby_libvirt_parallel_for_conn(n,
+                                                       RUBY_LIBVIRT_LANE_NORMAL,
+                                                       end - b.start,
+                                                       nconcurrency,
+                                                       network_update_apply,
+                                                       &b);
+        }
+        if (exception) {
+            network_update_batch_free(&b);
+            rb_jump_tag(exception);
+        }
+    }
+
+    if (RTEST(rollback)) {
+        nundo = 0;
+        for (i = 0; i < b.nupdates; i++) {
+            if (b.updates[i].failed) {
+                break;
+            }
+        }
+        if (i < b.nupdates) {
+            b.undo = calloc(b.nupdates, sizeof(int));
+            if (b.undo == NULL) {
+                network_update_batch_free(&b);
+                rb_memerror();
+            }
+            for (i = b.nupdates - 1; i >= 0; i--) {
+                if (!b.updates[i].failed) {
+                    b.undo[nundo++] = i;
+                }
+            }
+            /* undoing has to happen strictly in reverse order */
+            exception = ruby_libvirt_parallel_for_conn(n,
+                                                       RUBY_LIBVIRT_LANE_NORMAL,
+                                                       nundo, 1,
+                                                       network_update_revert,
+                                                       &b);
+            if (exception) {
+                network_update_batch_free(&b);
+                rb_jump_tag(exception);
+            }
+        }
+    }
+
+    result = rb_protect(network_update_batch_result, (VALUE)&b, &exception);
+    network_update_batch_free(&b);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
 #endif
 
 /*
@@ -176,7 +744,7 @@ static VALUE libvirt_network_autostart(VALUE n)
 {
     int r, autostart;
 
-    r = virNetworkGetAutostart(network_get(n), &autostart);
+    r = RUBY_LIBVIRT_CALL(virNetworkGetAutostart, network_get(n), &autostart);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virNetworkAutostart",
                                 ruby_libvirt_connect_get(n));
 
@@ -252,41 +820,44 @@ struct leases_arg {
     int nleases;
 };
 
+static VALUE lease_new(virNetworkDHCPLeasePtr lease)
+{
+    VALUE hash;
+
+    hash = rb_hash_new();
+    rb_hash_aset(hash, rb_str_new2("iface"), rb_str_new2(lease->iface));
+    rb_hash_aset(hash, rb_str_new2("expirytime"), LL2NUM(lease->expirytime));
+    rb_hash_aset(hash, rb_str_new2("type"), INT2NUM(lease->type));
+    if (lease->mac) {
+        rb_hash_aset(hash, rb_str_new2("mac"), rb_str_new2(lease->mac));
+    }
+    if (lease->iaid) {
+        rb_hash_aset(hash, rb_str_new2("iaid"), rb_str_new2(lease->iaid));
+    }
+    rb_hash_aset(hash, rb_str_new2("ipaddr"), rb_str_new2(lease->ipaddr));
+    rb_hash_aset(hash, rb_str_new2("prefix"), UINT2NUM(lease->prefix));
+    if (lease->hostname) {
+        rb_hash_aset(hash, rb_str_new2("hostname"),
+                     rb_str_new2(lease->hostname));
+    }
+    if (lease->clientid) {
+        rb_hash_aset(hash, rb_str_new2("clientid"),
+                     rb_str_new2(lease->clientid));
+    }
+
+    return hash;
+}
+
 static VALUE leases_wrap(VALUE arg)
 {
     struct leases_arg *e = (struct leases_arg *)arg;
-    VALUE result, hash;
-    virNetworkDHCPLeasePtr lease;
+    VALUE result;
     int i;
 
     result = rb_ary_new2(e->nleases);
 
     for (i = 0; i < e->nleases; i++) {
-        lease = e->leases[i];
-
-        hash = rb_hash_new();
-        rb_hash_aset(hash, rb_str_new2("iface"), rb_str_new2(lease->iface));
-        rb_hash_aset(hash, rb_str_new2("expirytime"),
-                     LL2NUM(lease->expirytime));
-        rb_hash_aset(hash, rb_str_new2("type"), INT2NUM(lease->type));
-        if (lease->mac) {
-            rb_hash_aset(hash, rb_str_new2("mac"), rb_str_new2(lease->mac));
-        }
-        if (lease->iaid) {
-            rb_hash_aset(hash, rb_str_new2("iaid"), rb_str_new2(lease->iaid));
-        }
-        rb_hash_aset(hash, rb_str_new2("ipaddr"), rb_str_new2(lease->ipaddr));
-        rb_hash_aset(hash, rb_str_new2("prefix"), UINT2NUM(lease->prefix));
-        if (lease->hostname) {
-            rb_hash_aset(hash, rb_str_new2("hostname"),
-                         rb_str_new2(lease->hostname));
-        }
-        if (lease->clientid) {
-            rb_hash_aset(hash, rb_str_new2("clientid"),
-                         rb_str_new2(lease->clientid));
-        }
-
-        rb_ary_store(result, i, hash);
+        rb_ary_store(result, i, lease_new(e->leases[i]));
     }
 
     return result;
@@ -308,10 +879,9 @@ static VALUE libvirt_network_get_dhcp_leases(int argc, VALUE *argv, VALUE n)
 
     rb_scan_args(argc, argv, "02", &mac, &flags);
 
-    nleases = virNetworkGetDHCPLeases(network_get(n),
-                                      ruby_libvirt_get_cstring_or_null(mac),
-                                      &leases,
-                                      ruby_libvirt_value_to_uint(flags));
+    nleases = RUBY_LIBVIRT_CALL(virNetworkGetDHCPLeases, network_get(n),
+                                ruby_libvirt_get_cstring_or_null(mac), &leases,
+                                ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(nleases < 0, e_Error, "virNetworkGetDHCPLeases",
                                 ruby_libvirt_connect_get(n));
 
@@ -330,6 +900,822 @@ static VALUE libvirt_network_get_dhcp_leases(int argc, VALUE *argv, VALUE n)
 
     return result;
 }
+
+/*
+ * The lease index keeps the raw leases of every active network in native
+ * memory.  The MAC, IP and hostname indexes map a key to the first entry
+ * with that key; further entries with the same key are chained through the
+ * entries themselves.  Network lifecycle events only mark networks dirty, so
+ * a refresh refetches just the networks that changed.
+ */
+struct lease_network {
+    char *name;
+    virNetworkPtr net;
+    virNetworkDHCPLeasePtr *leases;
+    int nleases;
+    int dirty;
+    int reuse;
+    int failed;
+    virError error;
+};
+
+struct lease_entry {
+    virNetworkDHCPLeasePtr lease;
+    struct lease_network *network;
+    struct lease_entry *next_mac;
+    struct lease_entry *next_ip;
+    struct lease_entry *next_hostname;
+};
+
+struct lease_index {
+    virConnectPtr conn;
+    int concurrency;
+    int callback_id;
+    int relist;
+    /* refreshes in progress, and whether the index was freed meanwhile;
+     * both are only touched with the GVL held */
+    int refreshing;
+    int dispose_pending;
+
+    struct lease_network *nets;
+    int nnets;
+
+    struct lease_entry *entries;
+    int nentries;
+    st_table *by_mac;
+    st_table *by_ip;
+    st_table *by_hostname;
+
+#if HAVE_PTHREAD_H
+    /* protects nets, nnets, relist and the dirty flags against the event
+     * callback, which may run on the event loop thread */
+    pthread_mutex_t lock;
+#endif
+};
+
+static VALUE c_lease_index;
+
+#if HAVE_PTHREAD_H
+#define lease_index_lock(idx) pthread_mutex_lock(&(idx)->lock)
+#define lease_index_unlock(idx) pthread_mutex_unlock(&(idx)->lock)
+#else
+#define lease_index_lock(idx)
+#define lease_index_unlock(idx)
+#endif
+
+#define lease_entry_next(entry, offset)                                 \
+    (*(struct lease_entry **)((char *)(entry) + (offset)))
+
+static int lease_expired(virNetworkDHCPLeasePtr lease, time_t now)
+{
+    /* an expiry time of 0 means the lease never expires */
+    return lease->expirytime > 0 && lease->expirytime <= now;
+}
+
+static void lease_network_clear(struct lease_network *ln)
+{
+    int i;
+
+    for (i = 0; i < ln->nleases; i++) {
+        virNetworkDHCPLeaseFree(ln->leases[i]);
+    }
+    free(ln->leases);
+    ln->leases = NULL;
+    ln->nleases = 0;
+    if (ln->failed) {
+        virResetError(&ln->error);
+        ln->failed = 0;
+    }
+}
+
+static void lease_networks_free(struct lease_network *nets, int nnets)
+{
+    int i;
+
+    for (i = 0; i < nnets; i++) {
+        lease_network_clear(&nets[i]);
+        if (nets[i].net != NULL) {
+            virNetworkFree(nets[i].net);
+        }
+        free(nets[i].name);
+    }
+    free(nets);
+}
+
+static struct lease_network *lease_network_find(struct lease_network *nets,
+                                                int nnets, const char *name)
+{
+    int i;
+
+    for (i = 0; i < nnets; i++) {
+        if (strcmp(nets[i].name, name) == 0) {
+            return &nets[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void lease_index_clear(struct lease_index *idx)
+{
+    if (idx->by_mac != NULL) {
+        st_free_table(idx->by_mac);
+        idx->by_mac = NULL;
+    }
+    if (idx->by_ip != NULL) {
+        st_free_table(idx->by_ip);
+        idx->by_ip = NULL;
+    }
+    if (idx->by_hostname != NULL) {
+        st_free_table(idx->by_hostname);
+        idx->by_hostname = NULL;
+    }
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->nentries = 0;
+}
+
+static void lease_index_chain(st_table *table, const char *key,
+                              struct lease_entry *entry,
+                              struct lease_entry **next)
+{
+    st_data_t head;
+
+    if (key == NULL) {
+        return;
+    }
+
+    if (st_lookup(table, (st_data_t)key, &head)) {
+        *next = (struct lease_entry *)head;
+    }
+    st_insert(table, (st_data_t)key, (st_data_t)entry);
+}
+
+static void lease_index_rebuild(struct lease_index *idx)
+{
+    struct lease_entry *entries, *entry;
+    int total = 0, i, j;
+
+    for (i = 0; i < idx->nnets; i++) {
+        total += idx->nets[i].nleases;
+    }
+
+    entries = calloc(total > 0 ? total : 1, sizeof(struct lease_entry));
+    if (entries == NULL) {
+        rb_memerror();
+    }
+
+    lease_index_clear(idx);
+    idx->entries = entries;
+    idx->nentries = total;
+    idx->by_mac = st_init_strtable();
+    idx->by_ip = st_init_strtable();
+    idx->by_hostname = st_init_strtable();
+
+    entry = entries;
+    for (i = 0; i < idx->nnets; i++) {
+        for (j = 0; j < idx->nets[i].nleases; j++) {
+            entry->lease = idx->nets[i].leases[j];
+            entry->network = &idx->nets[i];
+            lease_index_chain(idx->by_mac, entry->lease->mac, entry,
+                              &entry->next_mac);
+            lease_index_chain(idx->by_ip, entry->lease->ipaddr, entry,
+                              &entry->next_ip);
+            lease_index_chain(idx->by_hostname, entry->lease->hostname, entry,
+                              &entry->next_hostname);
+            entry++;
+        }
+    }
+}
+
+#if HAVE_VIRCONNECTNETWORKEVENTREGISTERANY
+static int lease_index_event(virConnectPtr RUBY_LIBVIRT_UNUSED(conn),
+                             virNetworkPtr net, int event,
+                             int RUBY_LIBVIRT_UNUSED(detail), void *opaque)
+{
+    struct lease_index *idx = (struct lease_index *)opaque;
+    struct lease_network *ln;
+
+    lease_index_lock(idx);
+    ln = lease_network_find(idx->nets, idx->nnets, virNetworkGetName(net));
+    if (ln != NULL) {
+        ln->dirty = 1;
+    }
+    if (event == VIR_NETWORK_EVENT_STARTED ||
+        event == VIR_NETWORK_EVENT_STOPPED) {
+        idx->relist = 1;
+    }
+    lease_index_unlock(idx);
+
+    return 0;
+}
+#endif
+
+static void lease_index_release(void *opaque)
+{
+    struct lease_index *idx = (struct lease_index *)opaque;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_destroy(&idx->lock);
+#endif
+    free(idx);
+}
+
+static void lease_index_dispose(struct lease_index *idx)
+{
+    struct lease_network *nets;
+    int nnets;
+
+    lease_index_clear(idx);
+
+    lease_index_lock(idx);
+    nets = idx->nets;
+    nnets = idx->nnets;
+    idx->nets = NULL;
+    idx->nnets = 0;
+    lease_index_unlock(idx);
+    lease_networks_free(nets, nnets);
+
+#if HAVE_VIRCONNECTNETWORKEVENTREGISTERANY
+    /* the callback owns the index once registered; it is released by the
+     * free callback after deregistration */
+    if (idx->callback_id >= 0 &&
+        virConnectNetworkEventDeregisterAny(idx->conn, idx->callback_id) == 0) {
+        virConnectClose(idx->conn);
+        return;
+    }
+#endif
+
+    virConnectClose(idx->conn);
+    lease_index_release(idx);
+}
+
+/* Dispose of the index now, or once the refreshes that are still running
+ * with the GVL released have finished with it.
+ */
+static void lease_index_dispose_when_idle(struct lease_index *idx)
+{
+    if (idx->refreshing > 0) {
+        idx->dispose_pending = 1;
+    }
+    else {
+        lease_index_dispose(idx);
+    }
+}
+
+static void lease_index_free(void *i)
+{
+    if (i != NULL) {
+        lease_index_dispose_when_idle((struct lease_index *)i);
+    }
+}
+
+static struct lease_index *lease_index_get(VALUE i)
+{
+    struct lease_index *idx;
+
+    Data_Get_Struct(i, struct lease_index, idx);
+    if (!idx) {
+        rb_raise(rb_eArgError, "LeaseIndex has been freed");
+    }
+
+    return idx;
+}
+
+static void lease_index_fetch(void *opaque, int i)
+{
+    struct lease_network **todo = (struct lease_network **)opaque;
+    struct lease_network *ln = todo[i];
+
+    ln->nleases = virNetworkGetDHCPLeases(ln->net, NULL, &ln->leases, 0);
+    if (ln->nleases < 0) {
+        virCopyLastError(&ln->error);
+        virResetLastError();
+        ln->failed = 1;
+        ln->leases = NULL;
+        ln->nleases = 0;
+    }
+}
+
+/* Build the new set of networks from either a fresh listing or the current
+ * networks.  Networks that are clean are marked for reuse; everything else
+ * ends up in TODO to be refetched.  Returns the number of networks, or -1 if
+ * out of memory, in which case the listed networks still belong to the
+ * caller.
+ */
+static int lease_index_plan(struct lease_index *idx, int relist,
+                            virNetworkPtr *listed, int nlisted, int full,
+                            struct lease_network **nets_out,
+                            struct lease_network ***todo_out, int *ntodo)
+{
+    struct lease_network *nets, *old, **todo;
+    int n, i;
+
+    lease_index_lock(idx);
+
+    n = relist ? nlisted : idx->nnets;
+    nets = calloc(n + 1, sizeof(struct lease_network));
+    todo = calloc(n + 1, sizeof(struct lease_network *));
+    if (nets == NULL || todo == NULL) {
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        nets[i].name = strdup(relist ? virNetworkGetName(listed[i]) :
+                              idx->nets[i].name);
+        if (nets[i].name == NULL) {
+            goto error;
+        }
+    }
+
+    *ntodo = 0;
+    for (i = 0; i < n; i++) {
+        if (relist) {
+            nets[i].net = listed[i];
+        }
+        else {
+            nets[i].net = idx->nets[i].net;
+            virNetworkRef(nets[i].net);
+        }
+
+        old = lease_network_find(idx->nets, idx->nnets, nets[i].name);
+        if (old != NULL && !full && !old->dirty) {
+            nets[i].reuse = 1;
+        }
+        else {
+            if (old != NULL) {
+                old->dirty = 0;
+            }
+            todo[(*ntodo)++] = &nets[i];
+        }
+    }
+
+    lease_index_unlock(idx);
+
+    *nets_out = nets;
+    *todo_out = todo;
+    return n;
+
+error:
+    lease_index_unlock(idx);
+    if (nets != NULL) {
+        for (i = 0; i < n; i++) {
+            free(nets[i].name);
+        }
+    }
+    free(nets);
+    free(todo);
+    return -1;
+}
+
+/* Swap the new networks in, taking over the leases of the networks that were
+ * reused and carrying over any dirty marks that arrived during the fetch.
+ */
+static void lease_index_commit(struct lease_index *idx,
+                               struct lease_network *nets, int nnets)
+{
+    struct lease_network *oldnets, *old;
+    int noldnets, i;
+
+    lease_index_lock(idx);
+
+    for (i = 0; i < nnets; i++) {
+        old = lease_network_find(idx->nets, idx->nnets, nets[i].name);
+        if (old == NULL) {
+            if (nets[i].reuse) {
+                nets[i].dirty = 1;
+            }
+            continue;
+        }
+        if (nets[i].reuse) {
+            nets[i].leases = old->leases;
+            nets[i].nleases = old->nleases;
+            nets[i].failed = old->failed;
+            nets[i].error = old->error;
+            old->leases = NULL;
+            old->nleases = 0;
+            old->failed = 0;
+        }
+        nets[i].dirty = old->dirty;
+        nets[i].reuse = 0;
+    }
+
+    oldnets = idx->nets;
+    noldnets = idx->nnets;
+    idx->nets = nets;
+    idx->nnets = nnets;
+
+    lease_index_unlock(idx);
+
+    /* the old entries point into the old networks, so drop them first */
+    lease_index_clear(idx);
+    lease_networks_free(oldnets, noldnets);
+    lease_index_rebuild(idx);
+}
+
+static int lease_index_refresh(struct lease_index *idx, int full)
+{
+    virNetworkPtr *listed = NULL;
+    struct lease_network *nets, **todo, *old;
+    int nlisted = 0, nnets, ntodo = 0, relist, j, exception;
+
+    if (idx->callback_id < 0) {
+        /* without events we cannot tell what changed */
+        full = 1;
+    }
+
+    lease_index_lock(idx);
+    relist = full || idx->relist;
+    idx->relist = 0;
+    lease_index_unlock(idx);
+
+    if (relist) {
+        nlisted = virConnectListAllNetworks(idx->conn, &listed,
+                                            VIR_CONNECT_LIST_NETWORKS_ACTIVE);
+        ruby_libvirt_raise_error_if(nlisted < 0, e_RetrieveError,
+                                    "virConnectListAllNetworks", idx->conn);
+    }
+
+    nnets = lease_index_plan(idx, relist, listed, nlisted, full, &nets, &todo,
+                             &ntodo);
+    if (nnets < 0) {
+        for (j = 0; j < nlisted; j++) {
+            virNetworkFree(listed[j]);
+        }
+        free(listed);
+        rb_memerror();
+    }
+    /* the listed networks now belong to NETS */
+    free(listed);
+
+    exception = ruby_libvirt_parallel_for(ntodo, idx->concurrency,
+                                          lease_index_fetch, todo);
+    if (exception) {
+        /* nothing was fetched; hand back what the plan took */
+        lease_index_lock(idx);
+        idx->relist |= relist;
+        for (j = 0; j < ntodo; j++) {
+            old = lease_network_find(idx->nets, idx->nnets, todo[j]->name);
+            if (old != NULL) {
+                old->dirty = 1;
+            }
+        }
+        lease_index_unlock(idx);
+        free(todo);
+        lease_networks_free(nets, nnets);
+        rb_jump_tag(exception);
+    }
+    free(todo);
+
+    lease_index_commit(idx, nets, nnets);
+
+    return ntodo;
+}
+
+struct lease_index_refresh_arg {
+    struct lease_index *idx;
+    int full;
+};
+
+static VALUE lease_index_refresh_wrap(VALUE arg)
+{
+    struct lease_index_refresh_arg *r = (struct lease_index_refresh_arg *)arg;
+
+    return INT2NUM(lease_index_refresh(r->idx, r->full));
+}
+
+static VALUE lease_index_refresh_done(VALUE arg)
+{
+    struct lease_index_refresh_arg *r = (struct lease_index_refresh_arg *)arg;
+
+    r->idx->refreshing--;
+    if (r->idx->refreshing == 0 && r->idx->dispose_pending) {
+        lease_index_dispose(r->idx);
+    }
+
+    return Qnil;
+}
+
+/* Refresh the index while holding a reference on it, so that freeing it
+ * from another thread while the GVL is released defers the disposal until
+ * the refresh is done.
+ */
+static VALUE lease_index_refresh_held(struct lease_index *idx, int full)
+{
+    struct lease_index_refresh_arg r;
+
+    r.idx = idx;
+    r.full = full;
+    idx->refreshing++;
+
+    return rb_ensure(lease_index_refresh_wrap, (VALUE)&r,
+                     lease_index_refresh_done, (VALUE)&r);
+}
+
+static VALUE lease_index_entry_new(struct lease_entry *entry)
+{
+    VALUE hash;
+
+    hash = lease_new(entry->lease);
+    rb_hash_aset(hash, rb_str_new2("network"),
+                 rb_str_new2(entry->network->name));
+
+    return hash;
+}
+
+static VALUE lease_index_lookup(st_table *table, const char *key,
+                                size_t offset)
+{
+    struct lease_entry *entry;
+    st_data_t head;
+    VALUE result;
+    time_t now;
+
+    result = rb_ary_new();
+    if (table == NULL || !st_lookup(table, (st_data_t)key, &head)) {
+        return result;
+    }
+
+    now = time(NULL);
+    for (entry = (struct lease_entry *)head; entry != NULL;
+         entry = lease_entry_next(entry, offset)) {
+        if (!lease_expired(entry->lease, now)) {
+            rb_ary_push(result, lease_index_entry_new(entry));
+        }
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   index.lookup_by_mac(mac) -> Array
+ *
+ * Return the unexpired leases handed out to the MAC address mac, on any
+ * network.  The MAC address is matched case-insensitively.
+ */
+static VALUE libvirt_lease_index_lookup_by_mac(VALUE i, VALUE mac)
+{
+    struct lease_index *idx = lease_index_get(i);
+    char key[32];
+    const char *str;
+    size_t j;
+
+    str = StringValueCStr(mac);
+    if (strlen(str) >= sizeof(key)) {
+        return rb_ary_new();
+    }
+    /* libvirt always formats MAC addresses in lower case */
+    for (j = 0; str[j] != '\0'; j++) {
+        key[j] = tolower((unsigned char)str[j]);
+    }
+    key[j] = '\0';
+
+    return lease_index_lookup(idx->by_mac, key,
+                              offsetof(struct lease_entry, next_mac));
+}
+
+/*
+ * call-seq:
+ *   index.lookup_by_ip(ipaddr) -> Array
+ *
+ * Return the unexpired leases for the address ipaddr, on any network.
+ */
+static VALUE libvirt_lease_index_lookup_by_ip(VALUE i, VALUE ipaddr)
+{
+    struct lease_index *idx = lease_index_get(i);
+
+    return lease_index_lookup(idx->by_ip, StringValueCStr(ipaddr),
+                              offsetof(struct lease_entry, next_ip));
+}
+
+/*
+ * call-seq:
+ *   index.lookup_by_hostname(hostname) -> Array
+ *
+ * Return the unexpired leases for the client hostname, on any network.
+ */
+static VALUE libvirt_lease_index_lookup_by_hostname(VALUE i, VALUE hostname)
+{
+    struct lease_index *idx = lease_index_get(i);
+
+    return lease_index_lookup(idx->by_hostname, StringValueCStr(hostname),
+                              offsetof(struct lease_entry, next_hostname));
+}
+
+/*
+ * call-seq:
+ *   index.leases -> Array
+ *
+ * Return all of the unexpired leases in the index.  Each lease is a Hash as
+ * returned by Libvirt::Network#dhcp_leases, with an additional "network" key
+ * naming the network it belongs to.
+ */
+static VALUE libvirt_lease_index_leases(VALUE i)
+{
+    struct lease_index *idx = lease_index_get(i);
+    VALUE result;
+    time_t now;
+    int j;
+
+    result = rb_ary_new();
+    now = time(NULL);
+    for (j = 0; j < idx->nentries; j++) {
+        if (!lease_expired(idx->entries[j].lease, now)) {
+            rb_ary_push(result, lease_index_entry_new(&idx->entries[j]));
+        }
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   index.size -> Fixnum
+ *
+ * Return the number of unexpired leases in the index.
+ */
+static VALUE libvirt_lease_index_size(VALUE i)
+{
+    struct lease_index *idx = lease_index_get(i);
+    time_t now;
+    int j, count = 0;
+
+    now = time(NULL);
+    for (j = 0; j < idx->nentries; j++) {
+        if (!lease_expired(idx->entries[j].lease, now)) {
+            count++;
+        }
+    }
+
+    return INT2NUM(count);
+}
+
+/*
+ * call-seq:
+ *   index.networks -> Array
+ *
+ * Return the names of the networks covered by the index.
+ */
+static VALUE libvirt_lease_index_networks(VALUE i)
+{
+    struct lease_index *idx = lease_index_get(i);
+    VALUE result;
+    int j;
+
+    result = rb_ary_new2(idx->nnets);
+    for (j = 0; j < idx->nnets; j++) {
+        rb_ary_store(result, j, rb_str_new2(idx->nets[j].name));
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   index.errors -> Hash
+ *
+ * Return a Hash mapping the name of each network whose leases could not be
+ * fetched during the last refresh to the Libvirt::RetrieveError describing
+ * the failure.
+ */
+static VALUE libvirt_lease_index_errors(VALUE i)
+{
+    struct lease_index *idx = lease_index_get(i);
+    VALUE result;
+    int j;
+
+    result = rb_hash_new();
+    for (j = 0; j < idx->nnets; j++) {
+        if (idx->nets[j].failed) {
+            rb_hash_aset(result, rb_str_new2(idx->nets[j].name),
+                         ruby_libvirt_error_new(e_RetrieveError,
+                                                "virNetworkGetDHCPLeases",
+                                                &idx->nets[j].error));
+        }
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   index.expire -> Fixnum
+ *
+ * Drop the leases that have expired from the index, returning how many were
+ * dropped.  Expired leases are never returned by the lookup methods, so this
+ * only matters for releasing memory in long-lived indexes.
+ */
+static VALUE libvirt_lease_index_expire(VALUE i)
+{
+    struct lease_index *idx = lease_index_get(i);
+    struct lease_network *ln;
+    time_t now;
+    int j, k, kept, expired = 0;
+
+    now = time(NULL);
+    for (j = 0; j < idx->nnets; j++) {
+        ln = &idx->nets[j];
+        kept = 0;
+        for (k = 0; k < ln->nleases; k++) {
+            if (lease_expired(ln->leases[k], now)) {
+                virNetworkDHCPLeaseFree(ln->leases[k]);
+                expired++;
+            }
+            else {
+                ln->leases[kept++] = ln->leases[k];
+            }
+        }
+        ln->nleases = kept;
+    }
+
+    if (expired > 0) {
+        lease_index_rebuild(idx);
+    }
+
+    return INT2NUM(expired);
+}
+
+/*
+ * call-seq:
+ *   index.refresh(full=false) -> Fixnum
+ *
+ * Bring the index up to date, returning the number of networks whose leases
+ * were fetched.  Only networks that were started, stopped or otherwise
+ * changed since the last refresh are fetched again, unless full is true.
+ * This relies on network lifecycle events and therefore on an event
+ * implementation being registered (see Libvirt::event_register_impl); without
+ * one every refresh is a full one.
+ */
+static VALUE libvirt_lease_index_refresh(int argc, VALUE *argv, VALUE i)
+{
+    VALUE full = RUBY_Qnil, result;
+
+    rb_scan_args(argc, argv, "01", &full);
+
+    result = lease_index_refresh_held(lease_index_get(i), RTEST(full));
+    RB_GC_GUARD(i);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   index.free -> nil
+ *
+ * Free the index and stop listening for network events.  After this call
+ * the index object is no longer valid.
+ */
+static VALUE libvirt_lease_index_free(VALUE i)
+{
+    struct lease_index *idx;
+
+    Data_Get_Struct(i, struct lease_index, idx);
+    if (idx != NULL) {
+        DATA_PTR(i) = NULL;
+        lease_index_dispose_when_idle(idx);
+    }
+
+    return Qnil;
+}
+
+VALUE ruby_libvirt_network_lease_index_new(VALUE c, int concurrency)
+{
+    struct lease_index *idx;
+    virConnectPtr conn = ruby_libvirt_connect_get(c);
+    VALUE result;
+
+    idx = calloc(1, sizeof(struct lease_index));
+    if (idx == NULL) {
+        rb_memerror();
+    }
+    idx->conn = conn;
+    idx->concurrency = concurrency;
+    idx->callback_id = -1;
+#if HAVE_PTHREAD_H
+    pthread_mutex_init(&idx->lock, NULL);
+#endif
+    virConnectRef(conn);
+
+#if HAVE_VIRCONNECTNETWORKEVENTREGISTERANY
+    idx->callback_id = virConnectNetworkEventRegisterAny(conn, NULL,
+                                                         VIR_NETWORK_EVENT_ID_LIFECYCLE,
+                                                         VIR_NETWORK_EVENT_CALLBACK(lease_index_event),
+                                                         idx,
+                                                         lease_index_release);
+    if (idx->callback_id < 0) {
+        /* most likely no event implementation; fall back to full refreshes */
+        virResetLastError();
+    }
+#endif
+
+    result = ruby_libvirt_new_class(c_lease_index, idx, c, lease_index_free);
+
+    lease_index_refresh_held(idx, 1);
+    RB_GC_GUARD(result);
+
+    return result;
+}
 #endif
 
 #endif
@@ -347,6 +1733,8 @@ void ruby_libvirt_network_init(void)
     rb_define_method(c_network, "create", libvirt_network_create, 0);
 #if HAVE_VIRNETWORKUPDATE
     rb_define_method(c_network, "update", libvirt_network_update, 5);
+    rb_define_method(c_network, "update_batch", libvirt_network_update_batch,
+                     -1);
 #endif
     rb_define_method(c_network, "destroy", libvirt_network_destroy, 0);
     rb_define_method(c_network, "name", libvirt_network_name, 0);
@@ -539,6 +1927,28 @@ void ruby_libvirt_network_init(void)
 #if HAVE_VIRNETWORKGETDHCPLEASES
     rb_define_method(c_network, "dhcp_leases",
                      libvirt_network_get_dhcp_leases, -1);
+
+    /*
+     * Class Libvirt::Network::LeaseIndex
+     */
+    c_lease_index = rb_define_class_under(c_network, "LeaseIndex",
+                                          rb_cObject);
+    rb_define_attr(c_lease_index, "connection", 1, 0);
+    rb_define_method(c_lease_index, "lookup_by_mac",
+                     libvirt_lease_index_lookup_by_mac, 1);
+    rb_define_method(c_lease_index, "lookup_by_ip",
+                     libvirt_lease_index_lookup_by_ip, 1);
+    rb_define_method(c_lease_index, "lookup_by_hostname",
+                     libvirt_lease_index_lookup_by_hostname, 1);
+    rb_define_method(c_lease_index, "leases", libvirt_lease_index_leases, 0);
+    rb_define_method(c_lease_index, "size", libvirt_lease_index_size, 0);
+    rb_define_method(c_lease_index, "networks",
+                     libvirt_lease_index_networks, 0);
+    rb_define_method(c_lease_index, "errors", libvirt_lease_index_errors, 0);
+    rb_define_method(c_lease_index, "expire", libvirt_lease_index_expire, 0);
+    rb_define_method(c_lease_index, "refresh", libvirt_lease_index_refresh,
+                     -1);
+    rb_define_method(c_lease_index, "free", libvirt_lease_index_free, 0);
 #endif
 
 #if HAVE_CONST_VIR_IP_ADDR_TYPE_IPV4
@@ -4,5 +4,6 @@
 void ruby_libvirt_network_init(void);
 
 VALUE ruby_libvirt_network_new(virNetworkPtr n, VALUE conn);
+VALUE ruby_libvirt_network_lease_index_new(VALUE c, int concurrency);
 
 #endif
@@ -19,12 +19,15 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <stdio.h>
+#include <string.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "xml.h"
 
 #if HAVE_TYPE_VIRNODEDEVICEPTR
 static VALUE c_nodedevice;
@@ -36,12 +39,42 @@ static void nodedevice_free(void *s)
 
 static virNodeDevicePtr nodedevice_get(VALUE n)
 {
-    ruby_libvirt_get_struct(NodeDevice, n);
+    virNodeDevicePtr dev, newdev;
+    virConnectPtr conn;
+    const char *name;
+
+    Data_Get_Struct(n, virNodeDevice, dev);
+    if (!dev) {
+        rb_raise(rb_eArgError, "NodeDevice has been freed");
+    }
+
+    /* after a fork, look the device up again by name on the reopened
+     * connection */
+    conn = ruby_libvirt_connect_reopened_since(n);
+    if (conn != NULL) {
+        name = virNodeDeviceGetName(dev);
+        ruby_libvirt_raise_error_if(name == NULL, e_RetrieveError,
+                                    "virNodeDeviceGetName", conn);
+        newdev = RUBY_LIBVIRT_CALL(virNodeDeviceLookupByName, conn, name);
+        ruby_libvirt_raise_error_if(newdev == NULL, e_RetrieveError,
+                                    "virNodeDeviceLookupByName", conn);
+        DATA_PTR(n) = newdev;
+        virNodeDeviceFree(dev);
+        dev = newdev;
+        ruby_libvirt_connect_stamp(n);
+    }
+
+    return dev;
 }
 
 VALUE ruby_libvirt_nodedevice_new(virNodeDevicePtr n, VALUE conn)
 {
-    return ruby_libvirt_new_class(c_nodedevice, n, conn, nodedevice_free);
+    VALUE result;
+
+    result = ruby_libvirt_new_class(c_nodedevice, n, conn, nodedevice_free);
+    ruby_libvirt_connect_stamp(result);
+
+    return result;
 }
 
 /*
@@ -74,7 +107,7 @@ static VALUE libvirt_nodedevice_parent(VALUE c)
 
     const char *str;
 
-    str = virNodeDeviceGetParent(nodedevice_get(c));
+    str = RUBY_LIBVIRT_CALL(virNodeDeviceGetParent, nodedevice_get(c));
     if (str == NULL) {
         return Qnil;
     }
@@ -109,7 +142,7 @@ static VALUE libvirt_nodedevice_list_caps(VALUE c)
     int r, num;
     char **names;
 
-    num = virNodeDeviceNumOfCaps(nodedevice_get(c));
+    num = RUBY_LIBVIRT_CALL(virNodeDeviceNumOfCaps, nodedevice_get(c));
     ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
                                 "virNodeDeviceNumOfCaps",
                                 ruby_libvirt_connect_get(c));
@@ -119,7 +152,8 @@ static VALUE libvirt_nodedevice_list_caps(VALUE c)
     }
 
     names = alloca(sizeof(char *) * num);
-    r = virNodeDeviceListCaps(nodedevice_get(c), names, num);
+    r = RUBY_LIBVIRT_CALL(virNodeDeviceListCaps, nodedevice_get(c), names,
+                          num);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virNodeDeviceListCaps",
                                 ruby_libvirt_connect_get(c));
@@ -253,10 +287,10 @@ static VALUE libvirt_nodedevice_lookup_scsi_host_by_wwn(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "21", &wwnn, &wwpn, &flags);
 
-    nd = virNodeDeviceLookupSCSIHostByWWN(ruby_libvirt_connect_get(n),
-                                          StringValueCStr(wwnn),
-                                          StringValueCStr(wwpn),
-                                          ruby_libvirt_value_to_uint(flags));
+    nd = RUBY_LIBVIRT_CALL(virNodeDeviceLookupSCSIHostByWWN,
+                           ruby_libvirt_connect_get(n), StringValueCStr(wwnn),
+                           StringValueCStr(wwpn),
+                           ruby_libvirt_value_to_uint(flags));
     if (nd == NULL) {
         return Qnil;
     }
@@ -265,6 +299,474 @@ static VALUE libvirt_nodedevice_lookup_scsi_host_by_wwn(int argc, VALUE *argv,
 }
 #endif
 
+
+struct nodedevice_job {
+    char *name;
+    virNodeDevicePtr dev;
+    double time;
+    const char *failed;
+    virError error;
+};
+
+struct nodedevice_bulk {
+    virConnectPtr conn;
+    VALUE devices;
+    struct nodedevice_job *jobs;
+    int njobs;
+    int reattach;
+    char *driver;
+    unsigned int flags;
+};
+
+static void nodedevice_bulk_free(struct nodedevice_bulk *b)
+{
+    int i;
+
+    for (i = 0; i < b->njobs; i++) {
+        free(b->jobs[i].name);
+        if (b->jobs[i].dev != NULL) {
+            virNodeDeviceFree(b->jobs[i].dev);
+        }
+        if (b->jobs[i].failed != NULL) {
+            virResetError(&b->jobs[i].error);
+        }
+    }
+    free(b->jobs);
+    free(b->driver);
+}
+
+static VALUE nodedevice_bulk_parse(VALUE arg)
+{
+    struct nodedevice_bulk *b = (struct nodedevice_bulk *)arg;
+    VALUE entry;
+    int i;
+
+    for (i = 0; i < b->njobs; i++) {
+        entry = rb_ary_entry(b->devices, i);
+        if (rb_obj_is_kind_of(entry, c_nodedevice)) {
+            b->jobs[i].dev = nodedevice_get(entry);
+            virNodeDeviceRef(b->jobs[i].dev);
+            b->jobs[i].name = strdup(virNodeDeviceGetName(b->jobs[i].dev));
+        }
+        else {
+            /* looked up on the worker threads */
+            b->jobs[i].name = strdup(StringValueCStr(entry));
+        }
+        if (b->jobs[i].name == NULL) {
+            rb_memerror();
+        }
+    }
+
+    return Qnil;
+}
+
+static void nodedevice_bulk_run(void *opaque, int i)
+{
+    struct nodedevice_bulk *b = (struct nodedevice_bulk *)opaque;
+    struct nodedevice_job *job = &b->jobs[i];
+    double start;
+    int r;
+
+    start = ruby_libvirt_monotonic_time();
+
+    if (job->dev == NULL) {
+        job->dev = virNodeDeviceLookupByName(b->conn, job->name);
+        if (job->dev == NULL) {
+            job->failed = "virNodeDeviceLookupByName";
+            goto error;
+        }
+    }
+
+    if (b->reattach) {
+        r = virNodeDeviceReAttach(job->dev);
+        job->failed = "virNodeDeviceReAttach";
+    }
+    else {
+#if HAVE_VIRNODEDEVICEDETACHFLAGS
+        r = virNodeDeviceDetachFlags(job->dev, b->driver, b->flags);
+        job->failed = "virNodeDeviceDetachFlags";
+#else
+        r = virNodeDeviceDettach(job->dev);
+        job->failed = "virNodeDeviceDettach";
+#endif
+    }
+    if (r == 0) {
+        job->failed = NULL;
+    }
+
+error:
+    if (job->failed != NULL) {
+        virCopyLastError(&job->error);
+        virResetLastError();
+    }
+    job->time = ruby_libvirt_monotonic_time() - start;
+}
+
+static VALUE nodedevice_bulk_result(VALUE arg)
+{
+    struct nodedevice_bulk *b = (struct nodedevice_bulk *)arg;
+    struct nodedevice_job *job;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(b->njobs);
+    for (i = 0; i < b->njobs; i++) {
+        job = &b->jobs[i];
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("name"), rb_str_new2(job->name));
+        if (job->failed != NULL) {
+            rb_hash_aset(hash, rb_str_new2("error"),
+                         ruby_libvirt_error_new(job->dev == NULL ? e_RetrieveError : e_Error,
+                                                job->failed, &job->error));
+        }
+        else {
+            rb_hash_aset(hash, rb_str_new2("error"), Qnil);
+        }
+        rb_hash_aset(hash, rb_str_new2("time"), rb_float_new(job->time));
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/* Detach (or reattach) all of DEVICES, given as Libvirt::NodeDevice objects
+ * or device names, on up to CONCURRENCY worker threads.  Returns an Array
+ * with a result Hash per device.
+ */
+VALUE ruby_libvirt_nodedevice_bulk(VALUE c, VALUE devices, int reattach,
+                                   VALUE driver, unsigned int flags,
+                                   int concurrency)
+{
+    struct nodedevice_bulk b;
+    VALUE result;
+    char *drv;
+    int exception = 0;
+
+    Check_Type(devices, T_ARRAY);
+
+    memset(&b, 0, sizeof(b));
+    b.conn = ruby_libvirt_connect_get(c);
+    b.devices = devices;
+    b.njobs = RARRAY_LEN(devices);
+    b.reattach = reattach;
+    b.flags = flags;
+
+    drv = ruby_libvirt_get_cstring_or_null(driver);
+#if !HAVE_VIRNODEDEVICEDETACHFLAGS
+    if (flags != 0) {
+        rb_raise(e_NoSupportError, "Non-zero flags not supported");
+    }
+    if (drv != NULL) {
+        rb_raise(e_NoSupportError, "Non-NULL driver not supported");
+    }
+#endif
+    if (drv != NULL) {
+        b.driver = strdup(drv);
+        if (b.driver == NULL) {
+            rb_memerror();
+        }
+    }
+
+    b.jobs = calloc(b.njobs + 1, sizeof(struct nodedevice_job));
+    if (b.jobs == NULL) {
+        free(b.driver);
+        rb_memerror();
+    }
+
+    rb_protect(nodedevice_bulk_parse, (VALUE)&b, &exception);
+    if (exception) {
+        nodedevice_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_NORMAL,
+                                               b.njobs, concurrency,
+                                               nodedevice_bulk_run, &b);
+    if (exception) {
+        nodedevice_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(nodedevice_bulk_result, (VALUE)&b, &exception);
+    nodedevice_bulk_free(&b);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+#if HAVE_VIRCONNECTLISTALLNODEDEVICES && HAVE_LIBXML_PARSER_H
+struct nodedevice_info {
+    virNodeDevicePtr dev;
+    char *parent;
+    char *driver;
+    char **caps;
+    int ncaps;
+    char *pci_address;
+    char *vendor_id;
+    char *vendor;
+    char *product_id;
+    char *product;
+    int numa_node;
+    int iommu_group;
+    /* the call that failed for this device, or NULL */
+    const char *failed;
+    virError error;
+};
+
+struct nodedevice_inventory {
+    virNodeDevicePtr *devs;
+    struct nodedevice_info *info;
+    int ninfo;
+};
+
+static void nodedevice_inventory_free(struct nodedevice_inventory *inv)
+{
+    struct nodedevice_info *info;
+    int i, j;
+
+    for (i = 0; i < inv->ninfo; i++) {
+        info = &inv->info[i];
+        free(info->parent);
+        free(info->driver);
+        for (j = 0; j < info->ncaps; j++) {
+            free(info->caps[j]);
+        }
+        free(info->caps);
+        free(info->pci_address);
+        free(info->vendor_id);
+        free(info->vendor);
+        free(info->product_id);
+        free(info->product);
+        if (info->failed != NULL) {
+            virResetError(&info->error);
+        }
+        virNodeDeviceFree(inv->devs[i]);
+    }
+    free(inv->info);
+    free(inv->devs);
+}
+
+static void nodedevice_inventory_cap(struct nodedevice_info *info,
+                                     xmlNodePtr cap)
+{
+    xmlNodePtr node;
+    char *type, address[32];
+    int domain, bus, slot, function;
+
+    type = ruby_libvirt_xml_prop_cstr(cap, "type");
+    if (type == NULL) {
+        return;
+    }
+    info->caps[info->ncaps++] = type;
+
+    if (info->vendor_id == NULL &&
+        (node = ruby_libvirt_xml_child(cap, "vendor")) != NULL) {
+        info->vendor_id = ruby_libvirt_xml_prop_cstr(node, "id");
+        info->vendor = ruby_libvirt_xml_child_content_cstr(cap, "vendor");
+    }
+    if (info->product_id == NULL &&
+        (node = ruby_libvirt_xml_child(cap, "product")) != NULL) {
+        info->product_id = ruby_libvirt_xml_prop_cstr(node, "id");
+        info->product = ruby_libvirt_xml_child_content_cstr(cap, "product");
+    }
+
+    if (strcmp(type, "pci") != 0) {
+        return;
+    }
+
+    domain = ruby_libvirt_xml_child_content_int(cap, "domain", -1);
+    bus = ruby_libvirt_xml_child_content_int(cap, "bus", -1);
+    slot = ruby_libvirt_xml_child_content_int(cap, "slot", -1);
+    function = ruby_libvirt_xml_child_content_int(cap, "function", -1);
+    if (domain >= 0 && bus >= 0 && slot >= 0 && function >= 0) {
+        snprintf(address, sizeof(address), "%04x:%02x:%02x.%x", domain, bus,
+                 slot, function);
+        info->pci_address = strdup(address);
+    }
+
+    info->numa_node = ruby_libvirt_xml_prop_int(ruby_libvirt_xml_child(cap, "numa"),
+                                                "node", -1);
+    info->iommu_group = ruby_libvirt_xml_prop_int(ruby_libvirt_xml_child(cap, "iommuGroup"),
+                                                  "number", -1);
+}
+
+static void nodedevice_inventory_fetch(void *opaque, int i)
+{
+    struct nodedevice_inventory *inv = (struct nodedevice_inventory *)opaque;
+    struct nodedevice_info *info = &inv->info[i];
+    xmlDocPtr doc;
+    xmlNodePtr root, cur;
+    char *xml;
+    int ncaps = 0;
+
+    info->numa_node = -1;
+    info->iommu_group = -1;
+
+    xml = virNodeDeviceGetXMLDesc(inv->devs[i], 0);
+    if (xml == NULL) {
+        virCopyLastError(&info->error);
+        virResetLastError();
+        info->failed = "virNodeDeviceGetXMLDesc";
+        return;
+    }
+
+    doc = ruby_libvirt_xml_parse(xml);
+    free(xml);
+    if (doc == NULL) {
+        /* report it like a libvirt error rather than as an empty row */
+        memset(&info->error, 0, sizeof(info->error));
+        info->error.code = VIR_ERR_XML_ERROR;
+        info->error.domain = VIR_FROM_NODEDEV;
+        info->error.level = VIR_ERR_ERROR;
+        info->error.message = strdup("could not parse the node device XML");
+        info->failed = "xmlReadMemory";
+        return;
+    }
+    root = xmlDocGetRootElement(doc);
+
+    info->parent = ruby_libvirt_xml_child_content_cstr(root, "parent");
+    info->driver = ruby_libvirt_xml_child_content_cstr(ruby_libvirt_xml_child(root, "driver"),
+                                                       "name");
+
+    ruby_libvirt_xml_foreach_child(root, cur, "capability") {
+        ncaps++;
+    }
+    info->caps = calloc(ncaps + 1, sizeof(char *));
+    if (info->caps != NULL) {
+        ruby_libvirt_xml_foreach_child(root, cur, "capability") {
+            nodedevice_inventory_cap(info, cur);
+        }
+    }
+
+    xmlFreeDoc(doc);
+}
+
+static VALUE nodedevice_cstr_or_nil(const char *str)
+{
+    return str != NULL ? rb_str_new2(str) : Qnil;
+}
+
+static VALUE nodedevice_int_or_nil(int val)
+{
+    return val >= 0 ? INT2NUM(val) : Qnil;
+}
+
+static VALUE nodedevice_inventory_table(VALUE arg)
+{
+    struct nodedevice_inventory *inv = (struct nodedevice_inventory *)arg;
+    struct nodedevice_info *info;
+    VALUE result, name, parent, caps, driver, pci_address, vendor_id, vendor;
+    VALUE product_id, product, numa_node, iommu_group, error, devcaps;
+    int i, j;
+
+    name = rb_ary_new2(inv->ninfo);
+    parent = rb_ary_new2(inv->ninfo);
+    caps = rb_ary_new2(inv->ninfo);
+    driver = rb_ary_new2(inv->ninfo);
+    pci_address = rb_ary_new2(inv->ninfo);
+    vendor_id = rb_ary_new2(inv->ninfo);
+    vendor = rb_ary_new2(inv->ninfo);
+    product_id = rb_ary_new2(inv->ninfo);
+    product = rb_ary_new2(inv->ninfo);
+    numa_node = rb_ary_new2(inv->ninfo);
+    iommu_group = rb_ary_new2(inv->ninfo);
+    error = rb_ary_new2(inv->ninfo);
+
+    for (i = 0; i < inv->ninfo; i++) {
+        info = &inv->info[i];
+
+        devcaps = rb_ary_new2(info->ncaps);
+        for (j = 0; j < info->ncaps; j++) {
+            rb_ary_store(devcaps, j, rb_str_new2(info->caps[j]));
+        }
+
+        rb_ary_store(name, i, rb_str_new2(virNodeDeviceGetName(inv->devs[i])));
+        rb_ary_store(parent, i, nodedevice_cstr_or_nil(info->parent));
+        rb_ary_store(caps, i, devcaps);
+        rb_ary_store(driver, i, nodedevice_cstr_or_nil(info->driver));
+        rb_ary_store(pci_address, i,
+                     nodedevice_cstr_or_nil(info->pci_address));
+        rb_ary_store(vendor_id, i, nodedevice_cstr_or_nil(info->vendor_id));
+        rb_ary_store(vendor, i, nodedevice_cstr_or_nil(info->vendor));
+        rb_ary_store(product_id, i, nodedevice_cstr_or_nil(info->product_id));
+        rb_ary_store(product, i, nodedevice_cstr_or_nil(info->product));
+        rb_ary_store(numa_node, i, nodedevice_int_or_nil(info->numa_node));
+        rb_ary_store(iommu_group, i,
+                     nodedevice_int_or_nil(info->iommu_group));
+        rb_ary_store(error, i, info->failed != NULL ?
+                     ruby_libvirt_error_new(e_RetrieveError, info->failed,
+                                            &info->error) : Qnil);
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("name"), name);
+    rb_hash_aset(result, rb_str_new2("parent"), parent);
+    rb_hash_aset(result, rb_str_new2("caps"), caps);
+    rb_hash_aset(result, rb_str_new2("driver"), driver);
+    rb_hash_aset(result, rb_str_new2("pci_address"), pci_address);
+    rb_hash_aset(result, rb_str_new2("vendor_id"), vendor_id);
+    rb_hash_aset(result, rb_str_new2("vendor"), vendor);
+    rb_hash_aset(result, rb_str_new2("product_id"), product_id);
+    rb_hash_aset(result, rb_str_new2("product"), product);
+    rb_hash_aset(result, rb_str_new2("numa_node"), numa_node);
+    rb_hash_aset(result, rb_str_new2("iommu_group"), iommu_group);
+    rb_hash_aset(result, rb_str_new2("error"), error);
+
+    return result;
+}
+
+/* Fetch and parse the XML of all node devices matching FLAGS on up to
+ * CONCURRENCY worker threads, and return the interesting fields as a Hash of
+ * columns.
+ */
+VALUE ruby_libvirt_nodedevice_inventory(VALUE c, unsigned int flags,
+                                        int concurrency)
+{
+    struct nodedevice_inventory inv;
+    VALUE result;
+    int n, i, exception = 0;
+
+    memset(&inv, 0, sizeof(inv));
+
+    n = RUBY_LIBVIRT_CALL(virConnectListAllNodeDevices,
+                          ruby_libvirt_connect_get(c), &inv.devs, flags);
+    ruby_libvirt_raise_error_if(n < 0, e_RetrieveError,
+                                "virConnectListAllNodeDevices",
+                                ruby_libvirt_connect_get(c));
+
+    inv.info = calloc(n + 1, sizeof(struct nodedevice_info));
+    if (inv.info == NULL) {
+        for (i = 0; i < n; i++) {
+            virNodeDeviceFree(inv.devs[i]);
+        }
+        free(inv.devs);
+        rb_memerror();
+    }
+    inv.ninfo = n;
+
+    /* libxml2 has to be initialized before it is used from several threads */
+    xmlInitParser();
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_LOW, n,
+                                               concurrency,
+                                               nodedevice_inventory_fetch,
+                                               &inv);
+    if (exception) {
+        nodedevice_inventory_free(&inv);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(nodedevice_inventory_table, (VALUE)&inv, &exception);
+    nodedevice_inventory_free(&inv);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
 #endif
 
 /*
@@ -4,5 +4,10 @@
 void ruby_libvirt_nodedevice_init(void);
 
 VALUE ruby_libvirt_nodedevice_new(virNodeDevicePtr n, VALUE conn);
+VALUE ruby_libvirt_nodedevice_bulk(VALUE c, VALUE devices, int reattach,
+                                   VALUE driver, unsigned int flags,
+                                   int concurrency);
+VALUE ruby_libvirt_nodedevice_inventory(VALUE c, unsigned int flags,
+                                        int concurrency);
 
 #endif
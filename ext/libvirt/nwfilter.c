@@ -19,12 +19,16 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "nwfilter.h"
+#include "xml.h"
 
 #if HAVE_TYPE_VIRNWFILTERPTR
 static VALUE c_nwfilter;
@@ -36,12 +40,42 @@ static void nwfilter_free(void *n)
 
 static virNWFilterPtr nwfilter_get(VALUE n)
 {
-    ruby_libvirt_get_struct(NWFilter, n);
+    virNWFilterPtr filter, newfilter;
+    virConnectPtr conn;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    Data_Get_Struct(n, virNWFilter, filter);
+    if (!filter) {
+        rb_raise(rb_eArgError, "NWFilter has been freed");
+    }
+
+    /* after a fork, look the filter up again by UUID on the reopened
+     * connection */
+    conn = ruby_libvirt_connect_reopened_since(n);
+    if (conn != NULL) {
+        ruby_libvirt_raise_error_if(virNWFilterGetUUID(filter, uuid) < 0,
+                                    e_RetrieveError, "virNWFilterGetUUID",
+                                    conn);
+        newfilter = RUBY_LIBVIRT_CALL(virNWFilterLookupByUUID, conn, uuid);
+        ruby_libvirt_raise_error_if(newfilter == NULL, e_RetrieveError,
+                                    "virNWFilterLookupByUUID", conn);
+        DATA_PTR(n) = newfilter;
+        virNWFilterFree(filter);
+        filter = newfilter;
+        ruby_libvirt_connect_stamp(n);
+    }
+
+    return filter;
 }
 
 VALUE ruby_libvirt_nwfilter_new(virNWFilterPtr n, VALUE conn)
 {
-    return ruby_libvirt_new_class(c_nwfilter, n, conn, nwfilter_free);
+    VALUE result;
+
+    result = ruby_libvirt_new_class(c_nwfilter, n, conn, nwfilter_free);
+    ruby_libvirt_connect_stamp(result);
+
+    return result;
 }
 
 /*
@@ -117,6 +151,448 @@ static VALUE libvirt_nwfilter_free(VALUE n)
     ruby_libvirt_generate_call_free(NWFilter, n);
 }
 
+#if HAVE_LIBXML_PARSER_H
+enum {
+    NWFILTER_SYNC_CREATE,
+    NWFILTER_SYNC_UPDATE,
+    NWFILTER_SYNC_UNCHANGED,
+};
+
+struct nwfilter_sync_item {
+    char *xml;
+    char *name;
+    int action;
+    const char *failed;
+    virError error;
+};
+
+struct nwfilter_sync {
+    virConnectPtr conn;
+    VALUE xmls;
+    struct nwfilter_sync_item *items;
+    int nitems;
+};
+
+static void nwfilter_sync_free(struct nwfilter_sync *s)
+{
+    int i;
+
+    for (i = 0; i < s->nitems; i++) {
+        free(s->items[i].xml);
+        free(s->items[i].name);
+        if (s->items[i].failed != NULL) {
+            virResetError(&s->items[i].error);
+        }
+    }
+    free(s->items);
+}
+
+static VALUE nwfilter_sync_parse(VALUE arg)
+{
+    struct nwfilter_sync *s = (struct nwfilter_sync *)arg;
+    int i;
+
+    for (i = 0; i < s->nitems; i++) {
+        s->items[i].xml = strdup(StringValueCStr(RARRAY_PTR(s->xmls)[i]));
+        if (s->items[i].xml == NULL) {
+            rb_memerror();
+        }
+    }
+
+    return Qnil;
+}
+
+/* The priorities libvirt gives a filter whose chain starts with each of
+ * these names when the filter does not set one itself.
+ */
+static const struct {
+    const char *prefix;
+    const char *priority;
+} nwfilter_chain_priorities[] = {
+    { "root", NULL },
+    { "stp", "-810" },
+    { "mac", "-800" },
+    { "vlan", "-750" },
+    { "ipv4", "-700" },
+    { "ipv6", "-600" },
+    { "arp", "-500" },
+    { "rarp", "-400" },
+};
+
+static int nwfilter_prop_is(xmlNodePtr node, const char *name,
+                            const char *value)
+{
+    xmlChar *prop;
+    int match;
+
+    prop = xmlGetProp(node, (const xmlChar *)name);
+    match = prop != NULL && xmlStrEqual(prop, (const xmlChar *)value);
+    xmlFree(prop);
+
+    return match;
+}
+
+/* Fill in the defaults that libvirt adds when it formats a filter (the
+ * chain, the chain's priority and the rule priorities) and drop the ones it
+ * leaves out, so that a definition as written by the caller hashes the same
+ * as libvirt's canonical XML for it.
+ */
+static void nwfilter_sync_normalize(xmlNodePtr root)
+{
+    xmlNodePtr rule;
+    xmlChar *chain;
+    const char *priority = NULL;
+    size_t i, len;
+
+    chain = xmlGetProp(root, (const xmlChar *)"chain");
+    if (chain == NULL) {
+        xmlSetProp(root, (const xmlChar *)"chain", (const xmlChar *)"root");
+        chain = xmlStrdup((const xmlChar *)"root");
+    }
+
+    if (xmlHasProp(root, (const xmlChar *)"priority") == NULL) {
+        for (i = 0; i < sizeof(nwfilter_chain_priorities) /
+                 sizeof(nwfilter_chain_priorities[0]); i++) {
+            len = strlen(nwfilter_chain_priorities[i].prefix);
+            if (chain != NULL &&
+                xmlStrncmp(chain,
+                           (const xmlChar *)nwfilter_chain_priorities[i].prefix,
+                           len) == 0) {
+                priority = nwfilter_chain_priorities[i].priority;
+                break;
+            }
+        }
+        if (priority != NULL) {
+            xmlSetProp(root, (const xmlChar *)"priority",
+                       (const xmlChar *)priority);
+        }
+    }
+    else if (nwfilter_prop_is(root, "priority", "0")) {
+        xmlUnsetProp(root, (const xmlChar *)"priority");
+    }
+    xmlFree(chain);
+
+    ruby_libvirt_xml_foreach_child(root, rule, "rule") {
+        if (xmlHasProp(rule, (const xmlChar *)"priority") == NULL) {
+            xmlSetProp(rule, (const xmlChar *)"priority",
+                       (const xmlChar *)"500");
+        }
+        if (nwfilter_prop_is(rule, "statematch", "true") ||
+            nwfilter_prop_is(rule, "statematch", "1")) {
+            xmlUnsetProp(rule, (const xmlChar *)"statematch");
+        }
+        else if (nwfilter_prop_is(rule, "statematch", "0")) {
+            xmlSetProp(rule, (const xmlChar *)"statematch",
+                       (const xmlChar *)"false");
+        }
+    }
+}
+
+/* Parse XML and return the name and the hash of the filter it describes,
+ * with libvirt's defaults filled in.  The UUID is left out of the hash,
+ * since the desired XML usually does not carry one.
+ */
+static int nwfilter_sync_hash(const char *xml, char **name,
+                              unsigned long long *hash)
+{
+    xmlDocPtr doc;
+    xmlNodePtr root;
+
+    doc = ruby_libvirt_xml_parse(xml);
+    if (doc == NULL) {
+        return -1;
+    }
+    root = xmlDocGetRootElement(doc);
+    if (name != NULL) {
+        *name = ruby_libvirt_xml_prop_cstr(root, "name");
+    }
+    nwfilter_sync_normalize(root);
+    *hash = ruby_libvirt_xml_hash(root, "uuid");
+    xmlFreeDoc(doc);
+
+    return 0;
+}
+
+/* Decide what has to be done with item I: nothing if a filter of the same
+ * name already exists with an equivalent definition.
+ */
+static void nwfilter_sync_compare(void *opaque, int i)
+{
+    struct nwfilter_sync *s = (struct nwfilter_sync *)opaque;
+    struct nwfilter_sync_item *item = &s->items[i];
+    virNWFilterPtr filter;
+    unsigned long long want, have;
+    char *xml;
+
+    /* anything that cannot be parsed here is left to virNWFilterDefineXML()
+     * to report
+     */
+    item->action = NWFILTER_SYNC_UPDATE;
+    if (nwfilter_sync_hash(item->xml, &item->name, &want) < 0 ||
+        item->name == NULL) {
+        return;
+    }
+
+    filter = virNWFilterLookupByName(s->conn, item->name);
+    if (filter == NULL) {
+        virResetLastError();
+        item->action = NWFILTER_SYNC_CREATE;
+        return;
+    }
+
+    xml = virNWFilterGetXMLDesc(filter, 0);
+    virNWFilterFree(filter);
+    if (xml == NULL) {
+        virResetLastError();
+        return;
+    }
+
+    if (nwfilter_sync_hash(xml, NULL, &have) == 0 && have == want) {
+        item->action = NWFILTER_SYNC_UNCHANGED;
+    }
+    free(xml);
+}
+
+static void nwfilter_sync_apply(void *opaque, int i)
+{
+    struct nwfilter_sync *s = (struct nwfilter_sync *)opaque;
+    struct nwfilter_sync_item *item = &s->items[i];
+    virNWFilterPtr filter;
+
+    if (item->action == NWFILTER_SYNC_UNCHANGED) {
+        return;
+    }
+
+    filter = virNWFilterDefineXML(s->conn, item->xml);
+    if (filter == NULL) {
+        item->failed = "virNWFilterDefineXML";
+        virCopyLastError(&item->error);
+        virResetLastError();
+        return;
+    }
+    virNWFilterFree(filter);
+}
+
+static VALUE nwfilter_sync_result(VALUE arg)
+{
+    struct nwfilter_sync *s = (struct nwfilter_sync *)arg;
+    struct nwfilter_sync_item *item;
+    VALUE result, created, updated, unchanged, errors, name;
+    int i;
+
+    created = rb_ary_new();
+    updated = rb_ary_new();
+    unchanged = rb_ary_new();
+    errors = rb_hash_new();
+
+    for (i = 0; i < s->nitems; i++) {
+        item = &s->items[i];
+        name = item->name != NULL ? rb_str_new2(item->name) : INT2NUM(i);
+        if (item->failed != NULL) {
+            rb_hash_aset(errors, name,
+                         ruby_libvirt_error_new(e_DefinitionError,
+                                                item->failed, &item->error));
+        }
+        else if (item->action == NWFILTER_SYNC_CREATE) {
+            rb_ary_push(created, name);
+        }
+        else if (item->action == NWFILTER_SYNC_UPDATE) {
+            rb_ary_push(updated, name);
+        }
+        else {
+            rb_ary_push(unchanged, name);
+        }
+    }
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("created"), created);
+    rb_hash_aset(result, rb_str_new2("updated"), updated);
+    rb_hash_aset(result, rb_str_new2("unchanged"), unchanged);
+    rb_hash_aset(result, rb_str_new2("errors"), errors);
+
+    return result;
+}
+
+/* Define every filter in XMLS whose definition differs from the existing
+ * one.  The comparisons run on up to CONCURRENCY worker threads; the
+ * definitions are then applied one at a time in order, since filters may
+ * reference each other.
+ */
+VALUE ruby_libvirt_nwfilter_sync(VALUE c, VALUE xmls, int concurrency)
+{
+    struct nwfilter_sync s;
+    VALUE result;
+    int exception = 0;
+
+    Check_Type(xmls, T_ARRAY);
+
+    memset(&s, 0, sizeof(s));
+    s.conn = ruby_libvirt_connect_get(c);
+    s.xmls = xmls;
+
+    s.items = calloc(RARRAY_LEN(xmls) + 1,
+                     sizeof(struct nwfilter_sync_item));
+    if (s.items == NULL) {
+        rb_memerror();
+    }
+    s.nitems = RARRAY_LEN(xmls);
+
+    rb_protect(nwfilter_sync_parse, (VALUE)&s, &exception);
+    if (exception) {
+        nwfilter_sync_free(&s);
+        rb_jump_tag(exception);
+    }
+
+    /* libxml2 has to be initialized before it is used from several threads */
+    xmlInitParser();
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_LOW,
+                                               s.nitems, concurrency,
+                                               nwfilter_sync_compare, &s);
+    if (exception == 0) {
+        exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_NORMAL,
+                                                   s.nitems, 1,
+                                                   nwfilter_sync_apply, &s);
+    }
+    if (exception) {
+        nwfilter_sync_free(&s);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(nwfilter_sync_result, (VALUE)&s, &exception);
+    nwfilter_sync_free(&s);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+#endif
+
+#if HAVE_TYPE_VIRNWFILTERBINDINGPTR
+static VALUE c_nwfilter_binding;
+
+static void nwfilter_binding_free(void *b)
+{
+    ruby_libvirt_free_struct(NWFilterBinding, b);
+}
+
+static virNWFilterBindingPtr nwfilter_binding_get(VALUE b)
+{
+    virNWFilterBindingPtr binding, newbinding;
+    virConnectPtr conn;
+    const char *portdev;
+
+    Data_Get_Struct(b, virNWFilterBinding, binding);
+    if (!binding) {
+        rb_raise(rb_eArgError, "NWFilterBinding has been freed");
+    }
+
+    /* after a fork, look the binding up again by port device on the
+     * reopened connection */
+    conn = ruby_libvirt_connect_reopened_since(b);
+    if (conn != NULL) {
+        portdev = virNWFilterBindingGetPortDev(binding);
+        ruby_libvirt_raise_error_if(portdev == NULL, e_RetrieveError,
+                                    "virNWFilterBindingGetPortDev", conn);
+        newbinding = RUBY_LIBVIRT_CALL(virNWFilterBindingLookupByPortDev,
+                                       conn, portdev);
+        ruby_libvirt_raise_error_if(newbinding == NULL, e_RetrieveError,
+                                    "virNWFilterBindingLookupByPortDev", conn);
+        DATA_PTR(b) = newbinding;
+        virNWFilterBindingFree(binding);
+        binding = newbinding;
+        ruby_libvirt_connect_stamp(b);
+    }
+
+    return binding;
+}
+
+VALUE ruby_libvirt_nwfilter_binding_new(virNWFilterBindingPtr b, VALUE conn)
+{
+    VALUE result;
+
+    result = ruby_libvirt_new_class(c_nwfilter_binding, b, conn,
+                                    nwfilter_binding_free);
+    ruby_libvirt_connect_stamp(result);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   binding.portdev -> String
+ *
+ * Call virNWFilterBindingGetPortDev[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingGetPortDev]
+ * to retrieve the name of the port device this binding applies to.
+ */
+static VALUE libvirt_nwfilter_binding_portdev(VALUE b)
+{
+    ruby_libvirt_generate_call_string(virNWFilterBindingGetPortDev,
+                                      ruby_libvirt_connect_get(b), 0,
+                                      nwfilter_binding_get(b));
+}
+
+/*
+ * call-seq:
+ *   binding.filter_name -> String
+ *
+ * Call virNWFilterBindingGetFilterName[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingGetFilterName]
+ * to retrieve the name of the network filter this binding applies.
+ */
+static VALUE libvirt_nwfilter_binding_filter_name(VALUE b)
+{
+    ruby_libvirt_generate_call_string(virNWFilterBindingGetFilterName,
+                                      ruby_libvirt_connect_get(b), 0,
+                                      nwfilter_binding_get(b));
+}
+
+/*
+ * call-seq:
+ *   binding.xml_desc(flags=0) -> String
+ *
+ * Call virNWFilterBindingGetXMLDesc[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingGetXMLDesc]
+ * to retrieve the XML for this network filter binding.
+ */
+static VALUE libvirt_nwfilter_binding_xml_desc(int argc, VALUE *argv, VALUE b)
+{
+    VALUE flags = RUBY_Qnil;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    ruby_libvirt_generate_call_string(virNWFilterBindingGetXMLDesc,
+                                      ruby_libvirt_connect_get(b), 1,
+                                      nwfilter_binding_get(b),
+                                      ruby_libvirt_value_to_uint(flags));
+}
+
+/*
+ * call-seq:
+ *   binding.delete -> nil
+ *
+ * Call virNWFilterBindingDelete[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingDelete]
+ * to delete this network filter binding.
+ */
+static VALUE libvirt_nwfilter_binding_delete(VALUE b)
+{
+    ruby_libvirt_generate_call_nil(virNWFilterBindingDelete,
+                                   ruby_libvirt_connect_get(b),
+                                   nwfilter_binding_get(b));
+}
+
+/*
+ * call-seq:
+ *   binding.free -> nil
+ *
+ * Call virNWFilterBindingFree[http://www.libvirt.org/html/libvirt-libvirt-nwfilter.html#virNWFilterBindingFree]
+ * to free this network filter binding.  After this call the binding object
+ * is no longer valid.
+ */
+static VALUE libvirt_nwfilter_binding_free(VALUE b)
+{
+    ruby_libvirt_generate_call_free(NWFilterBinding, b);
+}
 #endif
 
 /*
@@ -135,4 +611,22 @@ void ruby_libvirt_nwfilter_init(void)
     rb_define_method(c_nwfilter, "xml_desc", libvirt_nwfilter_xml_desc, -1);
     rb_define_method(c_nwfilter, "free", libvirt_nwfilter_free, 0);
 #endif
+
+#if HAVE_TYPE_VIRNWFILTERBINDINGPTR
+    c_nwfilter_binding = rb_define_class_under(m_libvirt, "NWFilterBinding",
+                                               rb_cObject);
+    rb_define_attr(c_nwfilter_binding, "connection", 1, 0);
+
+    /* NWFilterBinding object methods */
+    rb_define_method(c_nwfilter_binding, "portdev",
+                     libvirt_nwfilter_binding_portdev, 0);
+    rb_define_method(c_nwfilter_binding, "filter_name",
+                     libvirt_nwfilter_binding_filter_name, 0);
+    rb_define_method(c_nwfilter_binding, "xml_desc",
+                     libvirt_nwfilter_binding_xml_desc, -1);
+    rb_define_method(c_nwfilter_binding, "delete",
+                     libvirt_nwfilter_binding_delete, 0);
+    rb_define_method(c_nwfilter_binding, "free",
+                     libvirt_nwfilter_binding_free, 0);
+#endif
 }
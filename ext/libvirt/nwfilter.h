@@ -4,5 +4,10 @@
 void ruby_libvirt_nwfilter_init(void);
 
 VALUE ruby_libvirt_nwfilter_new(virNWFilterPtr n, VALUE conn);
+VALUE ruby_libvirt_nwfilter_sync(VALUE c, VALUE xmls, int concurrency);
+
+#if HAVE_TYPE_VIRNWFILTERBINDINGPTR
+VALUE ruby_libvirt_nwfilter_binding_new(virNWFilterBindingPtr b, VALUE conn);
+#endif
 
 #endif
@@ -19,12 +19,19 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "secret.h"
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #if HAVE_TYPE_VIRSECRETPTR
 static VALUE c_secret;
@@ -36,7 +43,30 @@ static void secret_free(void *s)
 
 static virSecretPtr secret_get(VALUE s)
 {
-    ruby_libvirt_get_struct(Secret, s);
+    virSecretPtr secret, newsecret;
+    virConnectPtr conn;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    Data_Get_Struct(s, virSecret, secret);
+    if (!secret) {
+        rb_raise(rb_eArgError, "Secret has been freed");
+    }
+
+    /* after a fork, look the secret up again by UUID on the reopened
+     * connection */
+    conn = ruby_libvirt_connect_reopened(s);
+    if (conn != NULL && virSecretGetConnect(secret) != conn) {
+        ruby_libvirt_raise_error_if(virSecretGetUUID(secret, uuid) < 0,
+                                    e_RetrieveError, "virSecretGetUUID", conn);
+        newsecret = RUBY_LIBVIRT_CALL(virSecretLookupByUUID, conn, uuid);
+        ruby_libvirt_raise_error_if(newsecret == NULL, e_RetrieveError,
+                                    "virSecretLookupByUUID", conn);
+        DATA_PTR(s) = newsecret;
+        virSecretFree(secret);
+        secret = newsecret;
+    }
+
+    return secret;
 }
 
 VALUE ruby_libvirt_secret_new(virSecretPtr s, VALUE conn)
@@ -181,7 +211,7 @@ static VALUE libvirt_secret_value(int argc, VALUE *argv, VALUE s)
 
     rb_scan_args(argc, argv, "01", &flags);
 
-    val = virSecretGetValue(secret_get(s), &value_size,
+    val = RUBY_LIBVIRT_CALL(virSecretGetValue, secret_get(s), &value_size,
                             ruby_libvirt_value_to_uint(flags));
 
     ruby_libvirt_raise_error_if(val == NULL, e_RetrieveError,
@@ -225,6 +255,454 @@ static VALUE libvirt_secret_free(VALUE s)
     ruby_libvirt_generate_call_free(Secret, s);
 }
 
+/*
+ * Class Libvirt::Secret::Value
+ *
+ * Secret values fetched in bulk are kept in a native buffer that is locked
+ * into memory (so it is never swapped out), excluded from core dumps where
+ * the platform allows it, and overwritten with zeroes as soon as it is
+ * cleared or garbage collected.  The plaintext only reaches the Ruby heap
+ * when it is explicitly asked for.
+ */
+static VALUE c_secret_value;
+
+struct secret_value {
+    unsigned char *buf;
+    size_t size;
+    size_t mapped;
+    int locked;
+};
+
+/* memset() through a volatile pointer, so that the compiler cannot drop the
+ * zeroing of a buffer that is about to be freed
+ */
+static void *(*const volatile secret_memset)(void *, int, size_t) = memset;
+
+static void secret_wipe(void *buf, size_t size)
+{
+    if (buf != NULL && size > 0) {
+        secret_memset(buf, 0, size);
+    }
+}
+
+static void secret_value_release(struct secret_value *v)
+{
+    if (v->buf == NULL) {
+        return;
+    }
+
+    secret_wipe(v->buf, v->mapped);
+#if HAVE_SYS_MMAN_H
+    if (v->locked) {
+        munlock(v->buf, v->mapped);
+    }
+    munmap(v->buf, v->mapped);
+#else
+    free(v->buf);
+#endif
+    v->buf = NULL;
+    v->size = 0;
+    v->mapped = 0;
+    v->locked = 0;
+}
+
+static void secret_value_free(void *d)
+{
+    struct secret_value *v = (struct secret_value *)d;
+
+    secret_value_release(v);
+    xfree(v);
+}
+
+/* Allocate a locked buffer and move SIZE bytes of VAL into it, wiping VAL.
+ * Safe to call without the GVL.  Returns NULL if out of memory.
+ */
+static struct secret_value *secret_value_take(unsigned char *val, size_t size)
+{
+    struct secret_value *v;
+
+    v = calloc(1, sizeof(struct secret_value));
+    if (v == NULL) {
+        return NULL;
+    }
+
+#if HAVE_SYS_MMAN_H
+    {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        void *buf;
+
+        if (pagesize <= 0) {
+            pagesize = 4096;
+        }
+        v->mapped = ((size / pagesize) + 1) * pagesize;
+        buf = mmap(NULL, v->mapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            free(v);
+            return NULL;
+        }
+        v->buf = buf;
+        /* may fail against RLIMIT_MEMLOCK; the value is still usable, and
+         * value.locked? tells the caller
+         */
+        v->locked = mlock(v->buf, v->mapped) == 0;
+#ifdef MADV_DONTDUMP
+        madvise(v->buf, v->mapped, MADV_DONTDUMP);
+#endif
+    }
+#else
+    v->mapped = size + 1;
+    v->buf = malloc(v->mapped);
+    if (v->buf == NULL) {
+        free(v);
+        return NULL;
+    }
+#endif
+
+    memcpy(v->buf, val, size);
+    v->size = size;
+    secret_wipe(val, size);
+
+    return v;
+}
+
+static struct secret_value *secret_value_get(VALUE v)
+{
+    struct secret_value *value;
+
+    Data_Get_Struct(v, struct secret_value, value);
+
+    return value;
+}
+
+/* Wrap *V in a Libvirt::Secret::Value, taking over its buffer */
+static VALUE secret_value_new(struct secret_value **v)
+{
+    struct secret_value *value;
+    VALUE result;
+
+    /* the struct itself holds no secret, so it can live on the Ruby heap */
+    result = Data_Make_Struct(c_secret_value, struct secret_value, NULL,
+                              secret_value_free, value);
+    *value = **v;
+    free(*v);
+    *v = NULL;
+
+    return result;
+}
+
+static struct secret_value *secret_value_check(VALUE v)
+{
+    struct secret_value *value = secret_value_get(v);
+
+    if (value->buf == NULL) {
+        rb_raise(rb_eArgError, "secret value has been cleared");
+    }
+
+    return value;
+}
+
+/*
+ * call-seq:
+ *   value.bytesize -> Fixnum
+ *
+ * Return the size of this secret value in bytes.
+ */
+static VALUE libvirt_secret_value_bytesize(VALUE v)
+{
+    return ULONG2NUM(secret_value_check(v)->size);
+}
+
+/*
+ * call-seq:
+ *   value.locked? -> [true|false]
+ *
+ * Determine whether the buffer holding this value is locked into memory.
+ * Locking fails if it would exceed the process's RLIMIT_MEMLOCK.
+ */
+static VALUE libvirt_secret_value_locked_p(VALUE v)
+{
+    return secret_value_check(v)->locked ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   value.cleared? -> [true|false]
+ *
+ * Determine whether this value has been cleared.
+ */
+static VALUE libvirt_secret_value_cleared_p(VALUE v)
+{
+    return secret_value_get(v)->buf == NULL ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   value.clear -> nil
+ *
+ * Overwrite this value with zeroes and release its buffer now, rather than
+ * when it is garbage collected.
+ */
+static VALUE libvirt_secret_value_clear(VALUE v)
+{
+    secret_value_release(secret_value_get(v));
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   value.to_s -> String
+ *
+ * Return a copy of this value as a String.  The copy is an ordinary Ruby
+ * String, so it is neither locked nor wiped; prefer value.use where possible.
+ */
+static VALUE libvirt_secret_value_to_s(VALUE v)
+{
+    struct secret_value *value = secret_value_check(v);
+
+    return rb_str_new((char *)value->buf, value->size);
+}
+
+static VALUE secret_value_use_wipe(VALUE str)
+{
+    rb_str_modify(str);
+    secret_wipe(RSTRING_PTR(str), RSTRING_LEN(str));
+    rb_str_set_len(str, 0);
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   value.use {|str| block } -> result of the block
+ *
+ * Yield a temporary String copy of this value to the block, and overwrite
+ * it with zeroes once the block returns (or raises).  The block must not
+ * keep references to the String.
+ */
+static VALUE libvirt_secret_value_use(VALUE v)
+{
+    struct secret_value *value = secret_value_check(v);
+    VALUE str;
+
+    str = rb_str_new((char *)value->buf, value->size);
+
+    return rb_ensure(rb_yield, str, secret_value_use_wipe, str);
+}
+
+/*
+ * call-seq:
+ *   value.inspect -> String
+ *
+ * Describe this value without revealing it.
+ */
+static VALUE libvirt_secret_value_inspect(VALUE v)
+{
+    struct secret_value *value = secret_value_get(v);
+
+    if (value->buf == NULL) {
+        return rb_sprintf("#<%s (cleared)>", rb_obj_classname(v));
+    }
+
+    return rb_sprintf("#<%s %lu bytes%s>", rb_obj_classname(v),
+                      (unsigned long)value->size,
+                      value->locked ? ", locked" : "");
+}
+
+struct secret_fetch {
+    /* looked up by UUID if usageid is NULL */
+    char *uuid;
+    int usagetype;
+    char *usageid;
+    struct secret_value *value;
+    int nomem;
+    const char *failed;
+    virError error;
+};
+
+struct secret_fetch_bulk {
+    virConnectPtr conn;
+    VALUE keys;
+    struct secret_fetch *fetches;
+    int nfetches;
+};
+
+static void secret_fetch_bulk_free(struct secret_fetch_bulk *b)
+{
+    int i;
+
+    for (i = 0; i < b->nfetches; i++) {
+        free(b->fetches[i].uuid);
+        free(b->fetches[i].usageid);
+        if (b->fetches[i].value != NULL) {
+            secret_value_release(b->fetches[i].value);
+            free(b->fetches[i].value);
+        }
+        if (b->fetches[i].failed != NULL) {
+            virResetError(&b->fetches[i].error);
+        }
+    }
+    free(b->fetches);
+}
+
+static VALUE secret_fetch_bulk_parse(VALUE arg)
+{
+    struct secret_fetch_bulk *b = (struct secret_fetch_bulk *)arg;
+    struct secret_fetch *fetch;
+    VALUE entry;
+    int i;
+
+    for (i = 0; i < b->nfetches; i++) {
+        fetch = &b->fetches[i];
+        entry = rb_ary_entry(b->keys, i);
+        if (TYPE(entry) == T_ARRAY) {
+            if (RARRAY_LEN(entry) != 2) {
+                rb_raise(rb_eArgError,
+                         "usage entries must be [usagetype, usageid] pairs");
+            }
+            fetch->usagetype = NUM2INT(rb_ary_entry(entry, 0));
+            fetch->usageid = strdup(StringValueCStr(RARRAY_PTR(entry)[1]));
+            if (fetch->usageid == NULL) {
+                rb_memerror();
+            }
+        }
+        else {
+            fetch->uuid = strdup(StringValueCStr(entry));
+            if (fetch->uuid == NULL) {
+                rb_memerror();
+            }
+        }
+    }
+
+    return Qnil;
+}
+
+static void secret_fetch_bulk_run(void *opaque, int i)
+{
+    struct secret_fetch_bulk *b = (struct secret_fetch_bulk *)opaque;
+    struct secret_fetch *fetch = &b->fetches[i];
+    virSecretPtr secret;
+    unsigned char *val;
+    size_t size;
+    char uuid[VIR_UUID_STRING_BUFLEN];
+
+    if (fetch->usageid != NULL) {
+        secret = virSecretLookupByUsage(b->conn, fetch->usagetype,
+                                        fetch->usageid);
+        fetch->failed = "virSecretLookupByUsage";
+    }
+    else {
+        secret = virSecretLookupByUUIDString(b->conn, fetch->uuid);
+        fetch->failed = "virSecretLookupByUUIDString";
+    }
+    if (secret == NULL) {
+        goto error;
+    }
+
+    if (fetch->uuid == NULL && virSecretGetUUIDString(secret, uuid) == 0) {
+        fetch->uuid = strdup(uuid);
+    }
+
+    val = virSecretGetValue(secret, &size, 0);
+    virSecretFree(secret);
+    if (val == NULL) {
+        fetch->failed = "virSecretGetValue";
+        goto error;
+    }
+
+    fetch->value = secret_value_take(val, size);
+    if (fetch->value == NULL) {
+        secret_wipe(val, size);
+        fetch->nomem = 1;
+    }
+    free(val);
+
+    fetch->failed = NULL;
+    return;
+
+error:
+    virCopyLastError(&fetch->error);
+    virResetLastError();
+}
+
+static VALUE secret_fetch_bulk_result(VALUE arg)
+{
+    struct secret_fetch_bulk *b = (struct secret_fetch_bulk *)arg;
+    struct secret_fetch *fetch;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(b->nfetches);
+    for (i = 0; i < b->nfetches; i++) {
+        fetch = &b->fetches[i];
+        if (fetch->nomem) {
+            rb_memerror();
+        }
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("key"), rb_ary_entry(b->keys, i));
+        rb_hash_aset(hash, rb_str_new2("uuid"),
+                     fetch->uuid != NULL ? rb_str_new2(fetch->uuid) : Qnil);
+        if (fetch->value != NULL) {
+            rb_hash_aset(hash, rb_str_new2("value"),
+                         secret_value_new(&fetch->value));
+        }
+        else {
+            rb_hash_aset(hash, rb_str_new2("value"), Qnil);
+        }
+        rb_hash_aset(hash, rb_str_new2("error"), fetch->failed != NULL ?
+                     ruby_libvirt_error_new(e_RetrieveError, fetch->failed,
+                                            &fetch->error) : Qnil);
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/* Look up and fetch the values of all secrets named in KEYS (UUID strings or
+ * [usagetype, usageid] pairs) on up to CONCURRENCY worker threads.
+ */
+VALUE ruby_libvirt_secret_values(VALUE c, VALUE keys, int concurrency)
+{
+    struct secret_fetch_bulk b;
+    VALUE result;
+    int exception = 0;
+
+    Check_Type(keys, T_ARRAY);
+
+    memset(&b, 0, sizeof(b));
+    b.conn = ruby_libvirt_connect_get(c);
+    b.keys = keys;
+
+    b.fetches = calloc(RARRAY_LEN(keys) + 1, sizeof(struct secret_fetch));
+    if (b.fetches == NULL) {
+        rb_memerror();
+    }
+    b.nfetches = RARRAY_LEN(keys);
+
+    rb_protect(secret_fetch_bulk_parse, (VALUE)&b, &exception);
+    if (exception) {
+        secret_fetch_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_LOW,
+                                               b.nfetches, concurrency,
+                                               secret_fetch_bulk_run, &b);
+    if (exception) {
+        secret_fetch_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    result = rb_protect(secret_fetch_bulk_result, (VALUE)&b, &exception);
+    secret_fetch_bulk_free(&b);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
 #endif
 
 /*
@@ -264,5 +742,19 @@ void ruby_libvirt_secret_init(void)
     rb_define_alias(c_secret, "get_value", "value");
     rb_define_method(c_secret, "undefine", libvirt_secret_undefine, 0);
     rb_define_method(c_secret, "free", libvirt_secret_free, 0);
+
+    c_secret_value = rb_define_class_under(c_secret, "Value", rb_cObject);
+    rb_undef_alloc_func(c_secret_value);
+    rb_define_method(c_secret_value, "bytesize",
+                     libvirt_secret_value_bytesize, 0);
+    rb_define_method(c_secret_value, "locked?",
+                     libvirt_secret_value_locked_p, 0);
+    rb_define_method(c_secret_value, "cleared?",
+                     libvirt_secret_value_cleared_p, 0);
+    rb_define_method(c_secret_value, "clear", libvirt_secret_value_clear, 0);
+    rb_define_method(c_secret_value, "to_s", libvirt_secret_value_to_s, 0);
+    rb_define_method(c_secret_value, "use", libvirt_secret_value_use, 0);
+    rb_define_method(c_secret_value, "inspect", libvirt_secret_value_inspect,
+                     0);
 #endif
 }
@@ -4,5 +4,6 @@
 void ruby_libvirt_secret_init(void);
 
 VALUE ruby_libvirt_secret_new(virSecretPtr s, VALUE conn);
+VALUE ruby_libvirt_secret_values(VALUE c, VALUE keys, int concurrency);
 
 #endif
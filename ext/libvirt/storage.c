@@ -19,13 +19,25 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <ruby.h>
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
 #include "common.h"
 #include "connect.h"
 #include "extconf.h"
+#include "storage.h"
 #include "stream.h"
+#include "xml.h"
+#if HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #if HAVE_TYPE_VIRSTORAGEVOLPTR
 /* this has to be here (as opposed to below with the rest of the volume
@@ -33,7 +45,31 @@
  */
 static virStorageVolPtr vol_get(VALUE v)
 {
-    ruby_libvirt_get_struct(StorageVol, v);
+    virStorageVolPtr vol, newvol;
+    virConnectPtr conn;
+    const char *key;
+
+    Data_Get_Struct(v, virStorageVol, vol);
+    if (!vol) {
+        rb_raise(rb_eArgError, "StorageVol has been freed");
+    }
+
+    /* after a fork, look the volume up again by key on the reopened
+     * connection */
+    conn = ruby_libvirt_connect_reopened(v);
+    if (conn != NULL && virStorageVolGetConnect(vol) != conn) {
+        key = virStorageVolGetKey(vol);
+        ruby_libvirt_raise_error_if(key == NULL, e_RetrieveError,
+                                    "virStorageVolGetKey", conn);
+        newvol = RUBY_LIBVIRT_CALL(virStorageVolLookupByKey, conn, key);
+        ruby_libvirt_raise_error_if(newvol == NULL, e_RetrieveError,
+                                    "virStorageVolLookupByKey", conn);
+        DATA_PTR(v) = newvol;
+        virStorageVolFree(vol);
+        vol = newvol;
+    }
+
+    return vol;
 }
 #endif
 
@@ -52,7 +88,29 @@ static void pool_free(void *d)
 
 static virStoragePoolPtr pool_get(VALUE p)
 {
-    ruby_libvirt_get_struct(StoragePool, p);
+    virStoragePoolPtr pool, newpool;
+    virConnectPtr conn;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+
+    Data_Get_Struct(p, virStoragePool, pool);
+    if (!pool) {
+        rb_raise(rb_eArgError, "StoragePool has been freed");
+    }
+
+    conn = ruby_libvirt_connect_reopened(p);
+    if (conn != NULL && virStoragePoolGetConnect(pool) != conn) {
+        ruby_libvirt_raise_error_if(virStoragePoolGetUUID(pool, uuid) < 0,
+                                    e_RetrieveError, "virStoragePoolGetUUID",
+                                    conn);
+        newpool = RUBY_LIBVIRT_CALL(virStoragePoolLookupByUUID, conn, uuid);
+        ruby_libvirt_raise_error_if(newpool == NULL, e_RetrieveError,
+                                    "virStoragePoolLookupByUUID", conn);
+        DATA_PTR(p) = newpool;
+        virStoragePoolFree(pool);
+        pool = newpool;
+    }
+
+    return pool;
 }
 
 VALUE pool_new(virStoragePoolPtr p, VALUE conn)
@@ -71,7 +129,7 @@ static VALUE libvirt_storage_vol_pool(VALUE v)
 {
     virStoragePoolPtr pool;
 
-    pool = virStoragePoolLookupByVolume(vol_get(v));
+    pool = RUBY_LIBVIRT_CALL(virStoragePoolLookupByVolume, vol_get(v));
     ruby_libvirt_raise_error_if(pool == NULL, e_RetrieveError,
                                 "virStoragePoolLookupByVolume",
                                 ruby_libvirt_connect_get(v));
@@ -224,7 +282,7 @@ static VALUE libvirt_storage_pool_info(VALUE p)
     int r;
     VALUE result;
 
-    r = virStoragePoolGetInfo(pool_get(p), &info);
+    r = RUBY_LIBVIRT_CALL(virStoragePoolGetInfo, pool_get(p), &info);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virStoragePoolGetInfo",
                                 ruby_libvirt_connect_get(p));
@@ -268,7 +326,7 @@ static VALUE libvirt_storage_pool_autostart(VALUE p)
 {
     int r, autostart;
 
-    r = virStoragePoolGetAutostart(pool_get(p), &autostart);
+    r = RUBY_LIBVIRT_CALL(virStoragePoolGetAutostart, pool_get(p), &autostart);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virStoragePoolGetAutostart",
                                 ruby_libvirt_connect_get(p));
@@ -306,7 +364,7 @@ static VALUE libvirt_storage_pool_num_of_volumes(VALUE p)
 {
     int n;
 
-    n = virStoragePoolNumOfVolumes(pool_get(p));
+    n = RUBY_LIBVIRT_CALL(virStoragePoolNumOfVolumes, pool_get(p));
     ruby_libvirt_raise_error_if(n < 0, e_RetrieveError,
                                 "virStoragePoolNumOfVolumes",
                                 ruby_libvirt_connect_get(p));
@@ -326,7 +384,7 @@ static VALUE libvirt_storage_pool_list_volumes(VALUE p)
     int r, num;
     char **names;
 
-    num = virStoragePoolNumOfVolumes(pool_get(p));
+    num = RUBY_LIBVIRT_CALL(virStoragePoolNumOfVolumes, pool_get(p));
     ruby_libvirt_raise_error_if(num < 0, e_RetrieveError,
                                 "virStoragePoolNumOfVolumes",
                                 ruby_libvirt_connect_get(p));
@@ -335,7 +393,7 @@ static VALUE libvirt_storage_pool_list_volumes(VALUE p)
     }
 
     names = alloca(sizeof(char *) * num);
-    r = virStoragePoolListVolumes(pool_get(p), names, num);
+    r = RUBY_LIBVIRT_CALL(virStoragePoolListVolumes, pool_get(p), names, num);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError,
                                 "virStoragePoolListVolumes",
                                 ruby_libvirt_connect_get(p));
@@ -385,7 +443,8 @@ static VALUE libvirt_storage_pool_lookup_vol_by_name(VALUE p, VALUE name)
 {
     virStorageVolPtr vol;
 
-    vol = virStorageVolLookupByName(pool_get(p), StringValueCStr(name));
+    vol = RUBY_LIBVIRT_CALL(virStorageVolLookupByName, pool_get(p),
+                            StringValueCStr(name));
     ruby_libvirt_raise_error_if(vol == NULL, e_RetrieveError,
                                 "virStorageVolLookupByName",
                                 ruby_libvirt_connect_get(p));
@@ -405,8 +464,8 @@ static VALUE libvirt_storage_pool_lookup_vol_by_key(VALUE p, VALUE key)
     virStorageVolPtr vol;
 
     /* FIXME: Why does this take a connection, not a pool? */
-    vol = virStorageVolLookupByKey(ruby_libvirt_connect_get(p),
-                                   StringValueCStr(key));
+    vol = RUBY_LIBVIRT_CALL(virStorageVolLookupByKey,
+                            ruby_libvirt_connect_get(p), StringValueCStr(key));
     ruby_libvirt_raise_error_if(vol == NULL, e_RetrieveError,
                                 "virStorageVolLookupByKey",
                                 ruby_libvirt_connect_get(p));
@@ -426,8 +485,9 @@ static VALUE libvirt_storage_pool_lookup_vol_by_path(VALUE p, VALUE path)
     virStorageVolPtr vol;
 
     /* FIXME: Why does this take a connection, not a pool? */
-    vol = virStorageVolLookupByPath(ruby_libvirt_connect_get(p),
-                                    StringValueCStr(path));
+    vol = RUBY_LIBVIRT_CALL(virStorageVolLookupByPath,
+                            ruby_libvirt_connect_get(p),
+                            StringValueCStr(path));
     ruby_libvirt_raise_error_if(vol == NULL, e_RetrieveError,
                                 "virStorageVolLookupByPath",
                                 ruby_libvirt_connect_get(p));
@@ -496,8 +556,9 @@ static VALUE libvirt_storage_pool_create_volume_xml(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "11", &xml, &flags);
 
-    vol = virStorageVolCreateXML(pool_get(p), StringValueCStr(xml),
-                                 ruby_libvirt_value_to_uint(flags));
+    vol = RUBY_LIBVIRT_CALL(virStorageVolCreateXML, pool_get(p),
+                            StringValueCStr(xml),
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(vol == NULL, e_Error, "virStorageVolCreateXML",
                                 ruby_libvirt_connect_get(p));
 
@@ -521,15 +582,397 @@ static VALUE libvirt_storage_pool_create_volume_xml_from(int argc, VALUE *argv,
 
     rb_scan_args(argc, argv, "21", &xml, &cloneval, &flags);
 
-    vol = virStorageVolCreateXMLFrom(pool_get(p), StringValueCStr(xml),
-                                     vol_get(cloneval),
-                                     ruby_libvirt_value_to_uint(flags));
+    vol = RUBY_LIBVIRT_CALL(virStorageVolCreateXMLFrom, pool_get(p),
+                            StringValueCStr(xml), vol_get(cloneval),
+                            ruby_libvirt_value_to_uint(flags));
     ruby_libvirt_raise_error_if(vol == NULL, e_Error,
                                 "virStorageVolCreateXMLFrom",
                                 ruby_libvirt_connect_get(p));
 
     return vol_new(vol, ruby_libvirt_conn_attr(p));
 }
+
+/*
+ * Bulk cloning of a base volume
+ */
+#define STORAGE_CLONE_BACKING 0
+#define STORAGE_CLONE_FULL 1
+
+struct storage_clone {
+    char *name;
+    char *xml;
+    virStorageVolPtr vol;
+    int failed;
+    virError error;
+    double time;
+};
+
+struct storage_clone_bulk {
+    virStoragePoolPtr pool;
+    virStorageVolPtr base;
+    VALUE names;
+    int full;
+    unsigned int flags;
+    unsigned long long capacity;
+    char *path;
+    char *format;
+    struct storage_clone *clones;
+    int nclones;
+};
+
+static void storage_clone_bulk_free(struct storage_clone_bulk *b)
+{
+    int i;
+
+    for (i = 0; i < b->nclones; i++) {
+        free(b->clones[i].name);
+        free(b->clones[i].xml);
+        if (b->clones[i].vol != NULL) {
+            virStorageVolFree(b->clones[i].vol);
+        }
+        if (b->clones[i].failed) {
+            virResetError(&b->clones[i].error);
+        }
+    }
+    free(b->clones);
+    free(b->path);
+    free(b->format);
+}
+
+/* Return a newly allocated copy of STR that is safe to use as XML text or
+ * as an attribute value.
+ */
+static char *storage_xml_escape(const char *str)
+{
+    const char *p;
+    char *ret, *q;
+    size_t len = 1;
+
+    for (p = str; *p != '\0'; p++) {
+        len += (*p == '&' || *p == '<' || *p == '>' || *p == '\'' ||
+                *p == '"') ? 6 : 1;
+    }
+
+    ret = malloc(len);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    for (p = str, q = ret; *p != '\0'; p++) {
+        switch (*p) {
+        case '&':
+            q += sprintf(q, "&amp;");
+            break;
+        case '<':
+            q += sprintf(q, "&lt;");
+            break;
+        case '>':
+            q += sprintf(q, "&gt;");
+            break;
+        case '\'':
+            q += sprintf(q, "&apos;");
+            break;
+        case '"':
+            q += sprintf(q, "&quot;");
+            break;
+        default:
+            *q++ = *p;
+        }
+    }
+    *q = '\0';
+
+    return ret;
+}
+
+/* Build the volume XML for the clone called NAME.  A backing clone is an
+ * empty qcow2 overlay on top of the base volume's path; a full clone is
+ * copied by virStorageVolCreateXMLFrom() and keeps the base volume's format.
+ */
+static char *storage_clone_xml(struct storage_clone_bulk *b, const char *name)
+{
+    char *ename, *xml;
+    size_t len;
+
+    ename = storage_xml_escape(name);
+    if (ename == NULL) {
+        return NULL;
+    }
+
+    len = strlen(ename) + strlen(b->path) +
+        (b->format ? strlen(b->format) : 0) + 512;
+    xml = malloc(len);
+    if (xml == NULL) {
+        free(ename);
+        return NULL;
+    }
+
+    if (b->full) {
+        snprintf(xml, len,
+                 "<volume>\n"
+                 "  <name>%s</name>\n"
+                 "  <capacity unit='bytes'>%llu</capacity>\n"
+                 "%s%s%s"
+                 "</volume>\n",
+                 ename, b->capacity,
+                 b->format ? "  <target>\n    <format type='" : "",
+                 b->format ? b->format : "",
+                 b->format ? "'/>\n  </target>\n" : "");
+    }
+    else {
+        snprintf(xml, len,
+                 "<volume>\n"
+                 "  <name>%s</name>\n"
+                 "  <capacity unit='bytes'>%llu</capacity>\n"
+                 "  <allocation>0</allocation>\n"
+                 "  <target>\n"
+                 "    <format type='qcow2'/>\n"
+                 "  </target>\n"
+                 "  <backingStore>\n"
+                 "    <path>%s</path>\n"
+                 "%s%s%s"
+                 "  </backingStore>\n"
+                 "</volume>\n",
+                 ename, b->capacity, b->path,
+                 b->format ? "    <format type='" : "",
+                 b->format ? b->format : "",
+                 b->format ? "'/>\n" : "");
+    }
+    free(ename);
+
+    return xml;
+}
+
+/* Fill in the path, capacity and format of the base volume.  Returns the
+ * name of the libvirt call that failed, or NULL.
+ */
+static const char *storage_clone_base(struct storage_clone_bulk *b)
+{
+    virStorageVolInfo info;
+    char *path, *desc;
+
+    if (virStorageVolGetInfo(b->base, &info) < 0) {
+        return "virStorageVolGetInfo";
+    }
+    b->capacity = info.capacity;
+
+    path = virStorageVolGetPath(b->base);
+    if (path == NULL) {
+        return "virStorageVolGetPath";
+    }
+    b->path = storage_xml_escape(path);
+    free(path);
+
+#if HAVE_LIBXML_PARSER_H
+    desc = virStorageVolGetXMLDesc(b->base, 0);
+    if (desc == NULL) {
+        return "virStorageVolGetXMLDesc";
+    }
+    {
+        xmlDocPtr doc = ruby_libvirt_xml_parse(desc);
+        xmlNodePtr target;
+        char *format;
+
+        if (doc != NULL) {
+            target = ruby_libvirt_xml_child(xmlDocGetRootElement(doc),
+                                            "target");
+            format = ruby_libvirt_xml_prop_cstr(ruby_libvirt_xml_child(target,
+                                                                       "format"),
+                                                "type");
+            if (format != NULL) {
+                b->format = storage_xml_escape(format);
+                free(format);
+            }
+            xmlFreeDoc(doc);
+        }
+    }
+    free(desc);
+#else
+    (void)desc;
+#endif
+
+    return NULL;
+}
+
+static VALUE storage_clone_bulk_parse(VALUE arg)
+{
+    struct storage_clone_bulk *b = (struct storage_clone_bulk *)arg;
+    int i;
+
+    for (i = 0; i < b->nclones; i++) {
+        b->clones[i].name = strdup(StringValueCStr(RARRAY_PTR(b->names)[i]));
+        if (b->clones[i].name == NULL) {
+            rb_memerror();
+        }
+        b->clones[i].xml = storage_clone_xml(b, b->clones[i].name);
+        if (b->clones[i].xml == NULL) {
+            rb_memerror();
+        }
+    }
+
+    return Qnil;
+}
+
+/* flags that only mean something to virStorageVolCreateXMLFrom(), and that
+ * virStorageVolCreateXML() would reject for the backing-file clones
+ */
+#if HAVE_CONST_VIR_STORAGE_VOL_CREATE_REFLINK
+#define STORAGE_CLONE_FROM_ONLY_FLAGS VIR_STORAGE_VOL_CREATE_REFLINK
+#else
+#define STORAGE_CLONE_FROM_ONLY_FLAGS 0
+#endif
+
+static void storage_clone_bulk_run(void *opaque, int i)
+{
+    struct storage_clone_bulk *b = (struct storage_clone_bulk *)opaque;
+    struct storage_clone *clone = &b->clones[i];
+    double start;
+
+    start = ruby_libvirt_monotonic_time();
+
+    if (b->full) {
+        clone->vol = virStorageVolCreateXMLFrom(b->pool, clone->xml, b->base,
+                                                b->flags);
+    }
+    else {
+        clone->vol = virStorageVolCreateXML(b->pool, clone->xml,
+                                            b->flags & ~STORAGE_CLONE_FROM_ONLY_FLAGS);
+    }
+    if (clone->vol == NULL) {
+        virCopyLastError(&clone->error);
+        virResetLastError();
+        clone->failed = 1;
+    }
+
+    clone->time = ruby_libvirt_monotonic_time() - start;
+}
+
+struct storage_clone_result_arg {
+    struct storage_clone_bulk *b;
+    VALUE conn;
+};
+
+static VALUE storage_clone_bulk_result(VALUE arg)
+{
+    struct storage_clone_result_arg *r = (struct storage_clone_result_arg *)arg;
+    struct storage_clone *clone;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(r->b->nclones);
+    for (i = 0; i < r->b->nclones; i++) {
+        clone = &r->b->clones[i];
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("name"), rb_str_new2(clone->name));
+        if (clone->vol != NULL) {
+            rb_hash_aset(hash, rb_str_new2("volume"),
+                         vol_new(clone->vol, r->conn));
+            /* owned by the Ruby object now */
+            clone->vol = NULL;
+        }
+        else {
+            rb_hash_aset(hash, rb_str_new2("volume"), Qnil);
+        }
+        if (clone->failed) {
+            rb_hash_aset(hash, rb_str_new2("error"),
+                         ruby_libvirt_error_new(e_Error,
+                                                r->b->full ? "virStorageVolCreateXMLFrom" : "virStorageVolCreateXML",
+                                                &clone->error));
+        }
+        else {
+            rb_hash_aset(hash, rb_str_new2("error"), Qnil);
+        }
+        rb_hash_aset(hash, rb_str_new2("time"), rb_float_new(clone->time));
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   pool.clone_volumes(base_vol, names, format=Libvirt::StoragePool::CLONE_BACKING, concurrency=0, flags=0) -> Array
+ *
+ * Create one volume in this pool for every name in the names Array, each a
+ * clone of base_vol, on up to concurrency native threads at a time.  With
+ * Libvirt::StoragePool::CLONE_BACKING each clone is an empty qcow2 volume
+ * backed by base_vol and is created with
+ * virStorageVolCreateXML[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolCreateXML];
+ * with Libvirt::StoragePool::CLONE_FULL the data is copied with
+ * virStorageVolCreateXMLFrom[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolCreateXMLFrom].
+ * The volume XML is generated from base_vol, and flags is passed to every
+ * call, less those (such as Libvirt::StoragePool::CREATE_REFLINK) that only
+ * apply to copying clones.  Returns an Array with a Hash per name, containing the "name", the
+ * new "volume" (or nil), the Libvirt::Error if it failed (or nil) and the
+ * "time" in seconds the clone took.
+ */
+static VALUE libvirt_storage_pool_clone_volumes(int argc, VALUE *argv, VALUE p)
+{
+    VALUE base, names, format = RUBY_Qnil, concurrency = RUBY_Qnil;
+    VALUE flags = RUBY_Qnil, result;
+    struct storage_clone_bulk b;
+    struct storage_clone_result_arg r;
+    const char *failed;
+    int exception = 0, mode, c;
+
+    rb_scan_args(argc, argv, "23", &base, &names, &format, &concurrency,
+                 &flags);
+
+    Check_Type(names, T_ARRAY);
+    mode = NIL_P(format) ? STORAGE_CLONE_BACKING : NUM2INT(format);
+    if (mode != STORAGE_CLONE_BACKING && mode != STORAGE_CLONE_FULL) {
+        rb_raise(rb_eArgError, "invalid clone format %d", mode);
+    }
+    c = ruby_libvirt_value_to_int(concurrency);
+
+    memset(&b, 0, sizeof(b));
+    b.pool = pool_get(p);
+    b.base = vol_get(base);
+    b.names = names;
+    b.full = mode == STORAGE_CLONE_FULL;
+    b.flags = ruby_libvirt_value_to_uint(flags);
+
+    failed = storage_clone_base(&b);
+    if (failed != NULL) {
+        storage_clone_bulk_free(&b);
+        ruby_libvirt_raise_error_if(1, e_RetrieveError, failed,
+                                    ruby_libvirt_connect_get(p));
+    }
+    if (b.path == NULL) {
+        storage_clone_bulk_free(&b);
+        rb_memerror();
+    }
+
+    b.clones = calloc(RARRAY_LEN(names) + 1, sizeof(struct storage_clone));
+    if (b.clones == NULL) {
+        storage_clone_bulk_free(&b);
+        rb_memerror();
+    }
+    b.nclones = RARRAY_LEN(names);
+
+    rb_protect(storage_clone_bulk_parse, (VALUE)&b, &exception);
+    if (exception) {
+        storage_clone_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(p, RUBY_LIBVIRT_LANE_NORMAL,
+                                               b.nclones, c,
+                                               storage_clone_bulk_run, &b);
+    if (exception) {
+        storage_clone_bulk_free(&b);
+        rb_jump_tag(exception);
+    }
+
+    r.b = &b;
+    r.conn = ruby_libvirt_conn_attr(p);
+    result = rb_protect(storage_clone_bulk_result, (VALUE)&r, &exception);
+    storage_clone_bulk_free(&b);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
 #endif
 
 #if HAVE_VIRSTORAGEPOOLISACTIVE
@@ -617,7 +1060,7 @@ static VALUE libvirt_storage_vol_info(VALUE v)
     int r;
     VALUE result;
 
-    r = virStorageVolGetInfo(vol_get(v), &info);
+    r = RUBY_LIBVIRT_CALL(virStorageVolGetInfo, vol_get(v), &info);
     ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virStorageVolGetInfo",
                                 ruby_libvirt_connect_get(v));
 
@@ -760,152 +1203,1468 @@ static VALUE libvirt_storage_vol_resize(int argc, VALUE *argv, VALUE v)
 }
 #endif
 
-void ruby_libvirt_storage_init(void)
-{
-    /*
-     * Class Libvirt::StoragePool and Libvirt::StoragePoolInfo
+#if HAVE_VIRCONNECTLISTALLSTORAGEPOOLS && HAVE_VIRSTORAGEPOOLLISTALLVOLUMES
+/*
+ * Storage capacity report
+ */
+struct storage_capacity_pool {
+    virStoragePoolInfo info;
+    int have_info;
+    virStorageVolPtr *vols;
+    int nvols;
+    /* first entry of this pool's volumes in storage_capacity.vols */
+    int first;
+    int failed;
+    const char *func;
+    virError error;
+};
+
+struct storage_capacity_vol {
+    int ok;
+    unsigned long long capacity;
+    unsigned long long allocation;
+};
+
+struct storage_capacity {
+    virStoragePoolPtr *pools;
+    struct storage_capacity_pool *info;
+    int npools;
+    int include_volumes;
+    /* the volumes of all pools, flattened so that their info can be
+     * fetched in parallel regardless of how they are spread over pools
      */
-#if HAVE_TYPE_VIRSTORAGEPOOLPTR
-    c_storage_pool_info = rb_define_class_under(m_libvirt, "StoragePoolInfo",
-                                                rb_cObject);
-    rb_define_attr(c_storage_pool_info, "state", 1, 0);
-    rb_define_attr(c_storage_pool_info, "capacity", 1, 0);
-    rb_define_attr(c_storage_pool_info, "allocation", 1, 0);
-    rb_define_attr(c_storage_pool_info, "available", 1, 0);
+    virStorageVolPtr *vols;
+    struct storage_capacity_vol *volinfo;
+    int nvols;
+};
 
-    c_storage_pool = rb_define_class_under(m_libvirt, "StoragePool",
-                                           rb_cObject);
+static void storage_capacity_free(struct storage_capacity *s)
+{
+    int i, j;
+
+    for (i = 0; i < s->npools; i++) {
+        virStoragePoolFree(s->pools[i]);
+        if (s->info == NULL) {
+            continue;
+        }
+        for (j = 0; j < s->info[i].nvols; j++) {
+            virStorageVolFree(s->info[i].vols[j]);
+        }
+        free(s->info[i].vols);
+        if (s->info[i].failed) {
+            virResetError(&s->info[i].error);
+        }
+    }
+    free(s->pools);
+    free(s->info);
+    free(s->vols);
+    free(s->volinfo);
+}
 
-    rb_define_attr(c_storage_pool, "connection", 1, 0);
+static void storage_capacity_pool_fetch(void *opaque, int i)
+{
+    struct storage_capacity *s = (struct storage_capacity *)opaque;
+    struct storage_capacity_pool *pool = &s->info[i];
 
-    /* virStoragePoolState */
-    rb_define_const(c_storage_pool, "INACTIVE",
-                    INT2NUM(VIR_STORAGE_POOL_INACTIVE));
-    rb_define_const(c_storage_pool, "BUILDING",
-                    INT2NUM(VIR_STORAGE_POOL_BUILDING));
-    rb_define_const(c_storage_pool, "RUNNING",
-                    INT2NUM(VIR_STORAGE_POOL_RUNNING));
-    rb_define_const(c_storage_pool, "DEGRADED",
-                    INT2NUM(VIR_STORAGE_POOL_DEGRADED));
-#if HAVE_CONST_VIR_STORAGE_POOL_INACCESSIBLE
-    rb_define_const(c_storage_pool, "INACCESSIBLE",
-                    INT2NUM(VIR_STORAGE_POOL_INACCESSIBLE));
-#endif
+    if (virStoragePoolGetInfo(s->pools[i], &pool->info) < 0) {
+        pool->func = "virStoragePoolGetInfo";
+        goto error;
+    }
+    pool->have_info = 1;
 
-#if HAVE_CONST_VIR_STORAGE_XML_INACTIVE
-    rb_define_const(c_storage_pool, "XML_INACTIVE",
-                    INT2NUM(VIR_STORAGE_XML_INACTIVE));
-#endif
+    if (!s->include_volumes || pool->info.state != VIR_STORAGE_POOL_RUNNING) {
+        return;
+    }
 
-    /* virStoragePoolBuildFlags */
-    rb_define_const(c_storage_pool, "BUILD_NEW",
-                    INT2NUM(VIR_STORAGE_POOL_BUILD_NEW));
-    rb_define_const(c_storage_pool, "BUILD_REPAIR",
-                    INT2NUM(VIR_STORAGE_POOL_BUILD_REPAIR));
-    rb_define_const(c_storage_pool, "BUILD_RESIZE",
-                    INT2NUM(VIR_STORAGE_POOL_BUILD_RESIZE));
+    pool->nvols = virStoragePoolListAllVolumes(s->pools[i], &pool->vols, 0);
+    if (pool->nvols < 0) {
+        pool->nvols = 0;
+        pool->vols = NULL;
+        pool->func = "virStoragePoolListAllVolumes";
+        goto error;
+    }
 
-    /* virStoragePoolDeleteFlags */
-    rb_define_const(c_storage_pool, "DELETE_NORMAL",
-                    INT2NUM(VIR_STORAGE_POOL_DELETE_NORMAL));
-    rb_define_const(c_storage_pool, "DELETE_ZEROED",
-                    INT2NUM(VIR_STORAGE_POOL_DELETE_ZEROED));
+    return;
 
-#if HAVE_CONST_VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA
-    rb_define_const(c_storage_pool, "CREATE_PREALLOC_METADATA",
-                    INT2NUM(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA));
-#endif
-#if HAVE_CONST_VIR_STORAGE_VOL_CREATE_REFLINK
-    rb_define_const(c_storage_pool, "CREATE_REFLINK",
-                    INT2NUM(VIR_STORAGE_VOL_CREATE_REFLINK));
-#endif
+error:
+    virCopyLastError(&pool->error);
+    virResetLastError();
+    pool->failed = 1;
+}
 
-#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_NORMAL
-    rb_define_const(c_storage_pool, "CREATE_NORMAL",
-                    INT2NUM(VIR_STORAGE_POOL_CREATE_NORMAL));
-#endif
-#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD
-    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD",
-                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD));
-#endif
-#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD_OVERWRITE
-    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD_OVERWRITE",
-                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD_OVERWRITE));
-#endif
-#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD_NO_OVERWRITE
-    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD_NO_OVERWRITE",
-                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD_NO_OVERWRITE));
-#endif
+static void storage_capacity_vol_fetch(void *opaque, int i)
+{
+    struct storage_capacity *s = (struct storage_capacity *)opaque;
+    virStorageVolInfo info;
 
-    /* Creating/destroying pools */
-    rb_define_method(c_storage_pool, "build", libvirt_storage_pool_build, -1);
-    rb_define_method(c_storage_pool, "undefine", libvirt_storage_pool_undefine,
-                     0);
-    rb_define_method(c_storage_pool, "create", libvirt_storage_pool_create, -1);
-    rb_define_method(c_storage_pool, "destroy", libvirt_storage_pool_destroy,
-                     0);
-    rb_define_method(c_storage_pool, "delete", libvirt_storage_pool_delete, -1);
-    rb_define_method(c_storage_pool, "refresh", libvirt_storage_pool_refresh,
-                     -1);
-    /* StoragePool information */
-    rb_define_method(c_storage_pool, "name", libvirt_storage_pool_name, 0);
-    rb_define_method(c_storage_pool, "uuid", libvirt_storage_pool_uuid, 0);
-    rb_define_method(c_storage_pool, "info", libvirt_storage_pool_info, 0);
-    rb_define_method(c_storage_pool, "xml_desc", libvirt_storage_pool_xml_desc,
-                     -1);
-    rb_define_method(c_storage_pool, "autostart",
-                     libvirt_storage_pool_autostart, 0);
-    rb_define_method(c_storage_pool, "autostart?",
-                     libvirt_storage_pool_autostart, 0);
-    rb_define_method(c_storage_pool, "autostart=",
-                     libvirt_storage_pool_autostart_equal, 1);
-    /* List/lookup storage volumes within a pool */
-    rb_define_method(c_storage_pool, "num_of_volumes",
-                     libvirt_storage_pool_num_of_volumes, 0);
-    rb_define_method(c_storage_pool, "list_volumes",
-                     libvirt_storage_pool_list_volumes, 0);
-    /* Lookup volumes based on various attributes */
-    rb_define_method(c_storage_pool, "lookup_volume_by_name",
-                     libvirt_storage_pool_lookup_vol_by_name, 1);
-    rb_define_method(c_storage_pool, "lookup_volume_by_key",
-                     libvirt_storage_pool_lookup_vol_by_key, 1);
-    rb_define_method(c_storage_pool, "lookup_volume_by_path",
-                     libvirt_storage_pool_lookup_vol_by_path, 1);
-    rb_define_method(c_storage_pool, "free", libvirt_storage_pool_free, 0);
-    rb_define_method(c_storage_pool, "create_volume_xml",
-                     libvirt_storage_pool_create_volume_xml, -1);
-    rb_define_alias(c_storage_pool, "create_vol_xml", "create_volume_xml");
-#if HAVE_VIRSTORAGEVOLCREATEXMLFROM
-    rb_define_method(c_storage_pool, "create_volume_xml_from",
-                     libvirt_storage_pool_create_volume_xml_from, -1);
-    rb_define_alias(c_storage_pool, "create_vol_xml_from",
-                    "create_volume_xml_from");
-#endif
-#if HAVE_VIRSTORAGEPOOLISACTIVE
-    rb_define_method(c_storage_pool, "active?", libvirt_storage_pool_active_p,
-                     0);
-#endif
-#if HAVE_VIRSTORAGEPOOLISPERSISTENT
-    rb_define_method(c_storage_pool, "persistent?",
-                     libvirt_storage_pool_persistent_p, 0);
-#endif
+    /* a volume that vanished since the listing is simply left out */
+    if (virStorageVolGetInfo(s->vols[i], &info) < 0) {
+        virResetLastError();
+        return;
+    }
+    s->volinfo[i].ok = 1;
+    s->volinfo[i].capacity = info.capacity;
+    s->volinfo[i].allocation = info.allocation;
+}
 
-#if HAVE_VIRSTORAGEPOOLLISTALLVOLUMES
-    rb_define_method(c_storage_pool, "list_all_volumes",
-                     libvirt_storage_pool_list_all_volumes, -1);
-#endif
+static VALUE storage_capacity_ratio(unsigned long long num,
+                                    unsigned long long denom)
+{
+    return denom > 0 ? rb_float_new((double)num / (double)denom) : Qnil;
+}
 
-#if HAVE_CONST_VIR_STORAGE_POOL_BUILD_NO_OVERWRITE
-    rb_define_const(c_storage_pool, "BUILD_NO_OVERWRITE",
-                    INT2NUM(VIR_STORAGE_POOL_BUILD_NO_OVERWRITE));
-#endif
+static VALUE storage_capacity_table(VALUE arg)
+{
+    struct storage_capacity *s = (struct storage_capacity *)arg;
+    struct storage_capacity_pool *pool;
+    VALUE result, totals, name, state, capacity, allocation, available;
+    VALUE utilization, volumes = Qnil, volcapacity = Qnil;
+    VALUE volallocation = Qnil, overcommit = Qnil, error;
+    unsigned long long tcapacity = 0, tallocation = 0, tavailable = 0;
+    unsigned long long tvolcapacity = 0, tvolallocation = 0;
+    unsigned long long vcap, valloc;
+    int i, j, count, tvolumes = 0;
+
+    name = rb_ary_new2(s->npools);
+    state = rb_ary_new2(s->npools);
+    capacity = rb_ary_new2(s->npools);
+    allocation = rb_ary_new2(s->npools);
+    available = rb_ary_new2(s->npools);
+    utilization = rb_ary_new2(s->npools);
+    error = rb_ary_new2(s->npools);
+    if (s->include_volumes) {
+        volumes = rb_ary_new2(s->npools);
+        volcapacity = rb_ary_new2(s->npools);
+        volallocation = rb_ary_new2(s->npools);
+        overcommit = rb_ary_new2(s->npools);
+    }
 
-#if HAVE_CONST_VIR_STORAGE_POOL_BUILD_OVERWRITE
-    rb_define_const(c_storage_pool, "BUILD_OVERWRITE",
-                    INT2NUM(VIR_STORAGE_POOL_BUILD_OVERWRITE));
-#endif
+    for (i = 0; i < s->npools; i++) {
+        pool = &s->info[i];
+
+        rb_ary_store(name, i, rb_str_new2(virStoragePoolGetName(s->pools[i])));
+        if (!pool->have_info) {
+            rb_ary_store(state, i, Qnil);
+            rb_ary_store(capacity, i, Qnil);
+            rb_ary_store(allocation, i, Qnil);
+            rb_ary_store(available, i, Qnil);
+            rb_ary_store(utilization, i, Qnil);
+        }
+        else {
+            rb_ary_store(state, i, INT2NUM(pool->info.state));
+            rb_ary_store(capacity, i, ULL2NUM(pool->info.capacity));
+            rb_ary_store(allocation, i, ULL2NUM(pool->info.allocation));
+            rb_ary_store(available, i, ULL2NUM(pool->info.available));
+            rb_ary_store(utilization, i,
+                         storage_capacity_ratio(pool->info.allocation,
+                                                pool->info.capacity));
+            tcapacity += pool->info.capacity;
+            tallocation += pool->info.allocation;
+            tavailable += pool->info.available;
+        }
+        rb_ary_store(error, i, pool->failed ?
+                     ruby_libvirt_error_new(e_RetrieveError, pool->func,
+                                            &pool->error) : Qnil);
+
+        if (!s->include_volumes) {
+            continue;
+        }
+
+        count = 0;
+        vcap = valloc = 0;
+        for (j = 0; j < pool->nvols; j++) {
+            if (s->volinfo[pool->first + j].ok) {
+                count++;
+                vcap += s->volinfo[pool->first + j].capacity;
+                valloc += s->volinfo[pool->first + j].allocation;
+            }
+        }
+        rb_ary_store(volumes, i, INT2NUM(count));
+        rb_ary_store(volcapacity, i, ULL2NUM(vcap));
+        rb_ary_store(volallocation, i, ULL2NUM(valloc));
+        rb_ary_store(overcommit, i,
+                     storage_capacity_ratio(vcap, pool->info.capacity));
+        tvolumes += count;
+        tvolcapacity += vcap;
+        tvolallocation += valloc;
+    }
 
-#endif
+    totals = rb_hash_new();
+    rb_hash_aset(totals, rb_str_new2("pools"), INT2NUM(s->npools));
+    rb_hash_aset(totals, rb_str_new2("capacity"), ULL2NUM(tcapacity));
+    rb_hash_aset(totals, rb_str_new2("allocation"), ULL2NUM(tallocation));
+    rb_hash_aset(totals, rb_str_new2("available"), ULL2NUM(tavailable));
+    rb_hash_aset(totals, rb_str_new2("utilization"),
+                 storage_capacity_ratio(tallocation, tcapacity));
+
+    result = rb_hash_new();
+    rb_hash_aset(result, rb_str_new2("name"), name);
+    rb_hash_aset(result, rb_str_new2("state"), state);
+    rb_hash_aset(result, rb_str_new2("capacity"), capacity);
+    rb_hash_aset(result, rb_str_new2("allocation"), allocation);
+    rb_hash_aset(result, rb_str_new2("available"), available);
+    rb_hash_aset(result, rb_str_new2("utilization"), utilization);
+    if (s->include_volumes) {
+        rb_hash_aset(result, rb_str_new2("volumes"), volumes);
+        rb_hash_aset(result, rb_str_new2("volume_capacity"), volcapacity);
+        rb_hash_aset(result, rb_str_new2("volume_allocation"), volallocation);
+        rb_hash_aset(result, rb_str_new2("overcommit"), overcommit);
+
+        rb_hash_aset(totals, rb_str_new2("volumes"), INT2NUM(tvolumes));
+        rb_hash_aset(totals, rb_str_new2("volume_capacity"),
+                     ULL2NUM(tvolcapacity));
+        rb_hash_aset(totals, rb_str_new2("volume_allocation"),
+                     ULL2NUM(tvolallocation));
+        rb_hash_aset(totals, rb_str_new2("overcommit"),
+                     storage_capacity_ratio(tvolcapacity, tcapacity));
+    }
+    rb_hash_aset(result, rb_str_new2("error"), error);
+    rb_hash_aset(result, rb_str_new2("totals"), totals);
+
+    return result;
+}
+
+/* Gather the info of all storage pools matching FLAGS (and, if
+ * INCLUDE_VOLUMES, of all of their volumes) on up to CONCURRENCY worker
+ * threads, and return the per-pool figures as a Hash of columns.
+ */
+VALUE ruby_libvirt_storage_capacity_report(VALUE c, int include_volumes,
+                                           unsigned int flags,
+                                           int concurrency)
+{
+    struct storage_capacity s;
+    VALUE result;
+    int n, i, j, exception = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.include_volumes = include_volumes;
+
+    n = RUBY_LIBVIRT_CALL(virConnectListAllStoragePools,
+                          ruby_libvirt_connect_get(c), &s.pools, flags);
+    ruby_libvirt_raise_error_if(n < 0, e_RetrieveError,
+                                "virConnectListAllStoragePools",
+                                ruby_libvirt_connect_get(c));
+    s.npools = n;
+
+    s.info = calloc(n + 1, sizeof(struct storage_capacity_pool));
+    if (s.info == NULL) {
+        storage_capacity_free(&s);
+        rb_memerror();
+    }
+
+    exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_LOW, n,
+                                               concurrency,
+                                               storage_capacity_pool_fetch,
+                                               &s);
+    if (exception) {
+        storage_capacity_free(&s);
+        rb_jump_tag(exception);
+    }
+
+    if (include_volumes) {
+        for (i = 0; i < n; i++) {
+            s.info[i].first = s.nvols;
+            s.nvols += s.info[i].nvols;
+        }
+        s.vols = calloc(s.nvols + 1, sizeof(virStorageVolPtr));
+        s.volinfo = calloc(s.nvols + 1, sizeof(struct storage_capacity_vol));
+        if (s.vols == NULL || s.volinfo == NULL) {
+            storage_capacity_free(&s);
+            rb_memerror();
+        }
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < s.info[i].nvols; j++) {
+                s.vols[s.info[i].first + j] = s.info[i].vols[j];
+            }
+        }
+
+        exception = ruby_libvirt_parallel_for_conn(c, RUBY_LIBVIRT_LANE_LOW,
+                                                   s.nvols, concurrency,
+                                                   storage_capacity_vol_fetch,
+                                                   &s);
+        if (exception) {
+            storage_capacity_free(&s);
+            rb_jump_tag(exception);
+        }
+    }
+
+    result = rb_protect(storage_capacity_table, (VALUE)&s, &exception);
+    storage_capacity_free(&s);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+#if HAVE_TYPE_VIRSTORAGEVOLPTR && HAVE_PTHREAD_H
+/*
+ * Class Libvirt::StorageJob
+ *
+ * Wipes, resizes and clones can take minutes on large volumes.  The *_job
+ * variants queue the libvirt call on a small pool of native worker threads
+ * (shared by the whole process) and hand back a StorageJob that can be
+ * polled, waited on or cancelled while the call runs without the GVL.
+ * Like the other native threads, the workers cannot be used while an event
+ * loop written in Ruby is registered, since libvirt would call into it from
+ * them.  The workers do not survive fork(); the jobs queued or running at
+ * the time are left to the parent and show up as cancelled in the child.
+ */
+static VALUE c_storage_job;
+
+#define STORAGE_JOB_DEFAULT_WORKERS 4
+
+enum {
+    STORAGE_JOB_QUEUED,
+    STORAGE_JOB_RUNNING,
+    STORAGE_JOB_COMPLETED,
+    STORAGE_JOB_FAILED,
+    STORAGE_JOB_CANCELLED,
+};
+
+enum {
+    STORAGE_JOB_WIPE,
+    STORAGE_JOB_WIPE_PATTERN,
+    STORAGE_JOB_RESIZE,
+    STORAGE_JOB_CLONE,
+};
+
+struct storage_job {
+    int op;
+    int state;
+    int refs;
+
+    /* the volume being operated on, or the clone source */
+    virStorageVolPtr vol;
+    /* clone destination pool, the clone XML and the new volume's name */
+    virStoragePoolPtr pool;
+    char *xml;
+    char *name;
+
+    unsigned int alg;
+    unsigned long long capacity;
+    unsigned int flags;
+
+    /* progress is (allocation - base) / (target - base); has_target is 0
+     * when the operation does not change the allocation
+     */
+    int has_target;
+    unsigned long long base;
+    unsigned long long target;
+
+    virStorageVolPtr result;
+    int failed;
+    virError error;
+
+    double started;
+    double finished;
+
+    struct storage_job *next;
+};
+
+/* storage_job_lock protects the queue, the list of running jobs, the
+ * worker counts and the state, refs, progress target, result and timing
+ * fields of every job
+ */
+static pthread_mutex_t storage_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t storage_job_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t storage_job_done = PTHREAD_COND_INITIALIZER;
+static struct storage_job *storage_job_head;
+static struct storage_job *storage_job_tail;
+static struct storage_job *storage_job_running;
+static int storage_job_workers;
+static int storage_job_idle;
+static int storage_job_max_workers = STORAGE_JOB_DEFAULT_WORKERS;
+
+static const char *storage_job_func(int op)
+{
+    switch (op) {
+    case STORAGE_JOB_WIPE:
+        return "virStorageVolWipe";
+    case STORAGE_JOB_WIPE_PATTERN:
+        return "virStorageVolWipePattern";
+    case STORAGE_JOB_RESIZE:
+        return "virStorageVolResize";
+    default:
+        return "virStorageVolCreateXMLFrom";
+    }
+}
+
+static int storage_job_finished(struct storage_job *job)
+{
+    return job->state != STORAGE_JOB_QUEUED &&
+        job->state != STORAGE_JOB_RUNNING;
+}
+
+/* Drop a reference; must be called with storage_job_lock held.  Returns the
+ * job if the caller has to free it (after unlocking).
+ */
+static struct storage_job *storage_job_unref(struct storage_job *job)
+{
+    job->refs--;
+    return job->refs == 0 ? job : NULL;
+}
+
+static void storage_job_destroy(struct storage_job *job)
+{
+    if (job == NULL) {
+        return;
+    }
+    virStorageVolFree(job->vol);
+    if (job->pool != NULL) {
+        virStoragePoolFree(job->pool);
+    }
+    if (job->result != NULL) {
+        virStorageVolFree(job->result);
+    }
+    virResetError(&job->error);
+    free(job->xml);
+    free(job->name);
+    free(job);
+}
+
+/* Record the allocation the job is expected to reach, so that progress can
+ * be derived from virStorageVolGetInfo() while the call is running.
+ */
+static void storage_job_set_target(struct storage_job *job)
+{
+    virStorageVolInfo info;
+    unsigned long long base = 0, target = 0;
+    int has_target = 0;
+
+    if (virStorageVolGetInfo(job->vol, &info) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    if (job->op == STORAGE_JOB_CLONE) {
+        target = info.allocation ? info.allocation : info.capacity;
+        has_target = job->name != NULL && target > 0;
+    }
+#if HAVE_VIRSTORAGEVOLRESIZE
+    else if (job->op == STORAGE_JOB_RESIZE &&
+             (job->flags & VIR_STORAGE_VOL_RESIZE_ALLOCATE)) {
+        base = info.allocation;
+        target = job->capacity;
+        if (job->flags & VIR_STORAGE_VOL_RESIZE_DELTA) {
+            target += info.capacity;
+        }
+        has_target = target > base;
+    }
+#endif
+
+    pthread_mutex_lock(&storage_job_lock);
+    job->base = base;
+    job->target = target;
+    job->has_target = has_target;
+    pthread_mutex_unlock(&storage_job_lock);
+}
+
+static void storage_job_run(struct storage_job *job)
+{
+    int ret = -1;
+
+    storage_job_set_target(job);
+
+    switch (job->op) {
+#if HAVE_VIRSTORAGEVOLWIPE
+    case STORAGE_JOB_WIPE:
+        ret = virStorageVolWipe(job->vol, job->flags);
+        break;
+#endif
+#if HAVE_VIRSTORAGEVOLWIPEPATTERN
+    case STORAGE_JOB_WIPE_PATTERN:
+        ret = virStorageVolWipePattern(job->vol, job->alg, job->flags);
+        break;
+#endif
+#if HAVE_VIRSTORAGEVOLRESIZE
+    case STORAGE_JOB_RESIZE:
+        ret = virStorageVolResize(job->vol, job->capacity, job->flags);
+        break;
+#endif
+#if HAVE_VIRSTORAGEVOLCREATEXMLFROM
+    case STORAGE_JOB_CLONE:
+        job->result = virStorageVolCreateXMLFrom(job->pool, job->xml,
+                                                 job->vol, job->flags);
+        ret = job->result == NULL ? -1 : 0;
+        break;
+#endif
+    }
+
+    if (ret < 0) {
+        virCopyLastError(&job->error);
+        virResetLastError();
+        job->failed = 1;
+    }
+}
+
+/* Take JOB off the list starting at HEAD (and ending at TAIL, if given);
+ * must be called with storage_job_lock held.
+ */
+static void storage_job_unlink(struct storage_job **head,
+                               struct storage_job **tail,
+                               struct storage_job *job)
+{
+    struct storage_job *cur, *prev = NULL;
+
+    for (cur = *head; cur != NULL; prev = cur, cur = cur->next) {
+        if (cur != job) {
+            continue;
+        }
+        if (prev != NULL) {
+            prev->next = cur->next;
+        }
+        else {
+            *head = cur->next;
+        }
+        if (tail != NULL && *tail == cur) {
+            *tail = prev;
+        }
+        break;
+    }
+    job->next = NULL;
+}
+
+static void *storage_job_worker(void *RUBY_LIBVIRT_UNUSED(arg))
+{
+    struct storage_job *job, *dead;
+
+    pthread_mutex_lock(&storage_job_lock);
+    for (;;) {
+        while (storage_job_head == NULL &&
+               storage_job_workers <= storage_job_max_workers) {
+            storage_job_idle++;
+            pthread_cond_wait(&storage_job_work, &storage_job_lock);
+            storage_job_idle--;
+        }
+        /* max_workers was lowered; retire this thread */
+        if (storage_job_workers > storage_job_max_workers) {
+            break;
+        }
+
+        job = storage_job_head;
+        storage_job_head = job->next;
+        if (storage_job_head == NULL) {
+            storage_job_tail = NULL;
+        }
+        if (ruby_libvirt_keep_gvl) {
+            /* a Ruby event loop was registered after the job was queued */
+            job->next = NULL;
+            job->state = STORAGE_JOB_CANCELLED;
+            pthread_cond_broadcast(&storage_job_done);
+            dead = storage_job_unref(job);
+            pthread_mutex_unlock(&storage_job_lock);
+            storage_job_destroy(dead);
+            pthread_mutex_lock(&storage_job_lock);
+            continue;
+        }
+        job->next = storage_job_running;
+        storage_job_running = job;
+        job->state = STORAGE_JOB_RUNNING;
+        job->started = ruby_libvirt_monotonic_time();
+        pthread_mutex_unlock(&storage_job_lock);
+
+        storage_job_run(job);
+
+        pthread_mutex_lock(&storage_job_lock);
+        storage_job_unlink(&storage_job_running, NULL, job);
+        job->finished = ruby_libvirt_monotonic_time();
+        job->state = job->failed ? STORAGE_JOB_FAILED : STORAGE_JOB_COMPLETED;
+        pthread_cond_broadcast(&storage_job_done);
+        dead = storage_job_unref(job);
+        pthread_mutex_unlock(&storage_job_lock);
+        storage_job_destroy(dead);
+        pthread_mutex_lock(&storage_job_lock);
+    }
+    storage_job_workers--;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return NULL;
+}
+
+static void storage_job_atfork_prepare(void)
+{
+    pthread_mutex_lock(&storage_job_lock);
+}
+
+static void storage_job_atfork_parent(void)
+{
+    pthread_mutex_unlock(&storage_job_lock);
+}
+
+/* None of the workers exist in the child.  The jobs they were running, and
+ * those still queued, belong to the parent (running them here as well would
+ * wipe or clone twice), so cancel them and start the pool afresh.  A job
+ * whose last reference is dropped here is leaked rather than freed, to stay
+ * clear of libvirt inside the fork handler.
+ */
+static void storage_job_atfork_child(void)
+{
+    struct storage_job *lists[2], *job, *next;
+    int i;
+
+    lists[0] = storage_job_head;
+    lists[1] = storage_job_running;
+    for (i = 0; i < 2; i++) {
+        for (job = lists[i]; job != NULL; job = next) {
+            next = job->next;
+            job->next = NULL;
+            job->state = STORAGE_JOB_CANCELLED;
+            job->refs--;
+        }
+    }
+    storage_job_head = storage_job_tail = storage_job_running = NULL;
+    storage_job_workers = 0;
+    storage_job_idle = 0;
+    pthread_cond_init(&storage_job_work, NULL);
+    pthread_cond_init(&storage_job_done, NULL);
+
+    pthread_mutex_unlock(&storage_job_lock);
+}
+
+static void storage_job_release(void *d)
+{
+    struct storage_job *dead;
+
+    pthread_mutex_lock(&storage_job_lock);
+    dead = storage_job_unref(d);
+    pthread_mutex_unlock(&storage_job_lock);
+    storage_job_destroy(dead);
+}
+
+static struct storage_job *storage_job_get(VALUE j)
+{
+    struct storage_job *job;
+
+    Data_Get_Struct(j, struct storage_job, job);
+
+    return job;
+}
+
+/* Queue JOB, which takes over the references held in it, and wrap it in a
+ * Libvirt::StorageJob.
+ */
+static VALUE storage_job_submit(struct storage_job *job, VALUE conn)
+{
+    VALUE result;
+    pthread_t thread;
+    pthread_attr_t attr;
+    int spawn = 0;
+
+    if (ruby_libvirt_keep_gvl) {
+        storage_job_destroy(job);
+        rb_raise(rb_eArgError,
+                 "storage jobs cannot run alongside Ruby event callbacks");
+    }
+
+    job->state = STORAGE_JOB_QUEUED;
+    /* one reference for the Ruby object, one for the queue */
+    job->refs = 2;
+    result = ruby_libvirt_new_class(c_storage_job, job, conn,
+                                    storage_job_release);
+
+    pthread_mutex_lock(&storage_job_lock);
+    if (storage_job_tail != NULL) {
+        storage_job_tail->next = job;
+    }
+    else {
+        storage_job_head = job;
+    }
+    storage_job_tail = job;
+    if (storage_job_idle == 0 &&
+        storage_job_workers < storage_job_max_workers) {
+        storage_job_workers++;
+        spawn = 1;
+    }
+    pthread_cond_signal(&storage_job_work);
+    pthread_mutex_unlock(&storage_job_lock);
+
+    if (spawn) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, storage_job_worker, NULL) != 0) {
+            pthread_mutex_lock(&storage_job_lock);
+            storage_job_workers--;
+            /* with no worker at all the job would never run; the jobs
+             * queued before it get another chance with the next submit */
+            if (storage_job_workers == 0) {
+                storage_job_unlink(&storage_job_head, &storage_job_tail, job);
+                job->state = STORAGE_JOB_CANCELLED;
+                job->refs--;
+                pthread_mutex_unlock(&storage_job_lock);
+                pthread_attr_destroy(&attr);
+                rb_raise(rb_eSystemCallError,
+                         "could not start a storage job worker thread");
+            }
+            pthread_mutex_unlock(&storage_job_lock);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    return result;
+}
+
+static struct storage_job *storage_job_alloc(int op, virStorageVolPtr vol,
+                                             unsigned int flags)
+{
+    struct storage_job *job;
+
+    job = ALLOC(struct storage_job);
+    memset(job, 0, sizeof(struct storage_job));
+    job->op = op;
+    job->flags = flags;
+    virStorageVolRef(vol);
+    job->vol = vol;
+
+    return job;
+}
+
+#if HAVE_VIRSTORAGEVOLWIPE
+/*
+ * call-seq:
+ *   vol.wipe_job(flags=0) -> Libvirt::StorageJob
+ *
+ * Queue a call to virStorageVolWipe[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolWipe]
+ * on the storage job worker threads.  This is a destructive operation.
+ */
+static VALUE libvirt_storage_vol_wipe_job(int argc, VALUE *argv, VALUE v)
+{
+    VALUE flags = RUBY_Qnil;
+
+    rb_scan_args(argc, argv, "01", &flags);
+
+    return storage_job_submit(storage_job_alloc(STORAGE_JOB_WIPE, vol_get(v),
+                                                ruby_libvirt_value_to_uint(flags)),
+                              ruby_libvirt_conn_attr(v));
+}
+#endif
+
+#if HAVE_VIRSTORAGEVOLWIPEPATTERN
+/*
+ * call-seq:
+ *   vol.wipe_pattern_job(alg, flags=0) -> Libvirt::StorageJob
+ *
+ * Queue a call to virStorageVolWipePattern[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolWipePattern]
+ * on the storage job worker threads.  This is a destructive operation.
+ */
+static VALUE libvirt_storage_vol_wipe_pattern_job(int argc, VALUE *argv,
+                                                  VALUE v)
+{
+    VALUE alg = RUBY_Qnil, flags = RUBY_Qnil;
+    struct storage_job *job;
+    unsigned int a, f;
+
+    rb_scan_args(argc, argv, "11", &alg, &flags);
+
+    a = NUM2UINT(alg);
+    f = ruby_libvirt_value_to_uint(flags);
+
+    job = storage_job_alloc(STORAGE_JOB_WIPE_PATTERN, vol_get(v), f);
+    job->alg = a;
+
+    return storage_job_submit(job, ruby_libvirt_conn_attr(v));
+}
+#endif
+
+#if HAVE_VIRSTORAGEVOLRESIZE
+/*
+ * call-seq:
+ *   vol.resize_job(capacity, flags=0) -> Libvirt::StorageJob
+ *
+ * Queue a call to virStorageVolResize[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolResize]
+ * on the storage job worker threads.  Progress is only reported when
+ * Libvirt::StorageVol::RESIZE_ALLOCATE is passed, since otherwise the
+ * allocation does not change.
+ */
+static VALUE libvirt_storage_vol_resize_job(int argc, VALUE *argv, VALUE v)
+{
+    VALUE capacity = RUBY_Qnil, flags = RUBY_Qnil;
+    struct storage_job *job;
+    unsigned long long c;
+    unsigned int f;
+
+    rb_scan_args(argc, argv, "11", &capacity, &flags);
+
+    c = NUM2ULL(capacity);
+    f = ruby_libvirt_value_to_uint(flags);
+
+    job = storage_job_alloc(STORAGE_JOB_RESIZE, vol_get(v), f);
+    job->capacity = c;
+
+    return storage_job_submit(job, ruby_libvirt_conn_attr(v));
+}
+#endif
+
+#if HAVE_VIRSTORAGEVOLCREATEXMLFROM
+/* the name of the volume to be created, so that its allocation can be
+ * polled while the clone is running
+ */
+static char *storage_job_clone_name(const char *xml)
+{
+#if HAVE_LIBXML_PARSER_H
+    xmlDocPtr doc;
+    char *name;
+
+    doc = ruby_libvirt_xml_parse(xml);
+    if (doc == NULL) {
+        return NULL;
+    }
+    name = ruby_libvirt_xml_child_content_cstr(xmlDocGetRootElement(doc),
+                                               "name");
+    xmlFreeDoc(doc);
+
+    return name;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * call-seq:
+ *   pool.create_volume_xml_from_job(xml, clonevol, flags=0) -> Libvirt::StorageJob
+ *
+ * Queue a call to virStorageVolCreateXMLFrom[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolCreateXMLFrom]
+ * on the storage job worker threads.  Once the job has completed, the new
+ * volume is available from job.volume.
+ */
+static VALUE libvirt_storage_pool_create_volume_xml_from_job(int argc,
+                                                             VALUE *argv,
+                                                             VALUE p)
+{
+    VALUE xml, flags = RUBY_Qnil, cloneval = RUBY_Qnil;
+    struct storage_job *job;
+    virStorageVolPtr clone;
+    unsigned int f;
+    char *x;
+
+    rb_scan_args(argc, argv, "21", &xml, &cloneval, &flags);
+
+    x = StringValueCStr(xml);
+    clone = vol_get(cloneval);
+    f = ruby_libvirt_value_to_uint(flags);
+
+    job = storage_job_alloc(STORAGE_JOB_CLONE, clone, f);
+    virStoragePoolRef(pool_get(p));
+    job->pool = pool_get(p);
+    job->xml = strdup(x);
+    job->name = storage_job_clone_name(x);
+    if (job->xml == NULL) {
+        storage_job_destroy(job);
+        rb_memerror();
+    }
+
+    return storage_job_submit(job, ruby_libvirt_conn_attr(p));
+}
+#endif
+
+/*
+ * call-seq:
+ *   job.state -> Fixnum
+ *
+ * Return the state of this job, one of Libvirt::StorageJob::QUEUED, RUNNING,
+ * COMPLETED, FAILED or CANCELLED.
+ */
+static VALUE libvirt_storage_job_state(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    int state;
+
+    pthread_mutex_lock(&storage_job_lock);
+    state = job->state;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return INT2NUM(state);
+}
+
+/*
+ * call-seq:
+ *   job.done? -> [true|false]
+ *
+ * Determine whether this job has completed, failed or been cancelled.
+ */
+static VALUE libvirt_storage_job_done_p(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    int done;
+
+    pthread_mutex_lock(&storage_job_lock);
+    done = storage_job_finished(job);
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return done ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   job.operation -> String
+ *
+ * Return the name of the libvirt call this job makes.
+ */
+static VALUE libvirt_storage_job_operation(VALUE j)
+{
+    return rb_str_new2(storage_job_func(storage_job_get(j)->op));
+}
+
+/*
+ * call-seq:
+ *   job.progress -> Float or nil
+ *
+ * Return an estimate between 0.0 and 1.0 of how far along this job is,
+ * derived from the allocation of the target volume as reported by
+ * virStorageVolGetInfo[http://www.libvirt.org/html/libvirt-libvirt-storage.html#virStorageVolGetInfo].
+ * Returns nil while a job whose progress cannot be observed (a wipe, or a
+ * resize without RESIZE_ALLOCATE) is running.
+ */
+static VALUE libvirt_storage_job_progress(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    virStorageVolInfo info;
+    virStorageVolPtr vol;
+    unsigned long long base, target;
+    int state, has_target;
+    double progress;
+
+    pthread_mutex_lock(&storage_job_lock);
+    state = job->state;
+    has_target = job->has_target;
+    base = job->base;
+    target = job->target;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    if (state == STORAGE_JOB_QUEUED) {
+        return rb_float_new(0.0);
+    }
+    if (state == STORAGE_JOB_COMPLETED) {
+        return rb_float_new(1.0);
+    }
+    if (state != STORAGE_JOB_RUNNING || !has_target) {
+        return Qnil;
+    }
+
+    /* both are round trips to the daemon, so the GVL is released for them
+     * as for any other call */
+    if (job->op == STORAGE_JOB_CLONE) {
+        /* the new volume shows up in the pool as soon as libvirt starts
+         * building it
+         */
+        vol = RUBY_LIBVIRT_CALL(virStorageVolLookupByName, job->pool,
+                                job->name);
+        if (vol == NULL) {
+            virResetLastError();
+            return rb_float_new(0.0);
+        }
+    }
+    else {
+        vol = job->vol;
+    }
+
+    if (RUBY_LIBVIRT_CALL(virStorageVolGetInfo, vol, &info) < 0) {
+        virResetLastError();
+        info.allocation = base;
+    }
+    if (vol != job->vol) {
+        virStorageVolFree(vol);
+    }
+
+    if (info.allocation <= base) {
+        progress = 0.0;
+    }
+    else {
+        progress = (double)(info.allocation - base) /
+            (double)(target - base);
+    }
+    if (progress > 1.0) {
+        progress = 1.0;
+    }
+
+    return rb_float_new(progress);
+}
+
+/*
+ * call-seq:
+ *   job.time -> Float or nil
+ *
+ * Return the number of seconds this job has been running for (or ran for,
+ * once it is done), or nil if it never started.
+ */
+static VALUE libvirt_storage_job_time(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    double started, finished;
+    int state;
+
+    pthread_mutex_lock(&storage_job_lock);
+    state = job->state;
+    started = job->started;
+    finished = job->finished;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    if (state == STORAGE_JOB_QUEUED || started == 0) {
+        return Qnil;
+    }
+    if (state == STORAGE_JOB_RUNNING) {
+        finished = ruby_libvirt_monotonic_time();
+    }
+
+    return rb_float_new(finished - started);
+}
+
+/*
+ * call-seq:
+ *   job.error -> Libvirt::Error or nil
+ *
+ * Return the error the libvirt call failed with, or nil if it has not
+ * failed.
+ */
+static VALUE libvirt_storage_job_error(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    int state;
+
+    pthread_mutex_lock(&storage_job_lock);
+    state = job->state;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    if (state != STORAGE_JOB_FAILED) {
+        return Qnil;
+    }
+
+    return ruby_libvirt_error_new(e_Error, storage_job_func(job->op),
+                                  &job->error);
+}
+
+/*
+ * call-seq:
+ *   job.volume -> Libvirt::StorageVol or nil
+ *
+ * Return the volume created by a completed create_volume_xml_from_job, or
+ * nil for any other job.
+ */
+static VALUE libvirt_storage_job_volume(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    virStorageVolPtr vol;
+    VALUE result;
+
+    result = rb_iv_get(j, "@volume");
+    if (!NIL_P(result)) {
+        return result;
+    }
+
+    pthread_mutex_lock(&storage_job_lock);
+    vol = job->state == STORAGE_JOB_COMPLETED ? job->result : NULL;
+    job->result = NULL;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    if (vol == NULL) {
+        return Qnil;
+    }
+
+    result = vol_new(vol, ruby_libvirt_conn_attr(j));
+    rb_iv_set(j, "@volume", result);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   job.cancel -> [true|false]
+ *
+ * Cancel this job if it has not started yet.  libvirt cannot abort a
+ * storage operation once it is under way, so this returns false (and the
+ * job runs to completion) if it is already running or done.
+ */
+static VALUE libvirt_storage_job_cancel(VALUE j)
+{
+    struct storage_job *job = storage_job_get(j);
+    struct storage_job *dead = NULL;
+    int cancelled = 0;
+
+    pthread_mutex_lock(&storage_job_lock);
+    if (job->state == STORAGE_JOB_QUEUED) {
+        storage_job_unlink(&storage_job_head, &storage_job_tail, job);
+        job->state = STORAGE_JOB_CANCELLED;
+        cancelled = 1;
+        pthread_cond_broadcast(&storage_job_done);
+        dead = storage_job_unref(job);
+    }
+    pthread_mutex_unlock(&storage_job_lock);
+    storage_job_destroy(dead);
+
+    return cancelled ? Qtrue : Qfalse;
+}
+
+struct storage_job_wait_arg {
+    struct storage_job **jobs;
+    long njobs;
+    int timed;
+    struct timespec deadline;
+    int interrupted;
+    int done;
+};
+
+static int storage_job_all_finished(struct storage_job_wait_arg *w)
+{
+    long i;
+
+    for (i = 0; i < w->njobs; i++) {
+        if (!storage_job_finished(w->jobs[i])) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void *storage_job_wait_nogvl(void *arg)
+{
+    struct storage_job_wait_arg *w = arg;
+
+    pthread_mutex_lock(&storage_job_lock);
+    while (!w->interrupted && !storage_job_all_finished(w)) {
+        if (!w->timed) {
+            pthread_cond_wait(&storage_job_done, &storage_job_lock);
+        }
+        else if (pthread_cond_timedwait(&storage_job_done, &storage_job_lock,
+                                        &w->deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    w->done = storage_job_all_finished(w);
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return NULL;
+}
+
+static void storage_job_wait_ubf(void *arg)
+{
+    struct storage_job_wait_arg *w = arg;
+
+    pthread_mutex_lock(&storage_job_lock);
+    w->interrupted = 1;
+    pthread_cond_broadcast(&storage_job_done);
+    pthread_mutex_unlock(&storage_job_lock);
+}
+
+/* Block, without the GVL, until every one of JOBS is done or TIMEOUT (in
+ * seconds; nil for no limit) expires.
+ */
+static VALUE storage_job_wait(struct storage_job **jobs, long njobs,
+                              VALUE timeout)
+{
+    struct storage_job_wait_arg w;
+    struct timeval now;
+    double t;
+
+    memset(&w, 0, sizeof(w));
+    w.jobs = jobs;
+    w.njobs = njobs;
+    if (!NIL_P(timeout)) {
+        t = NUM2DBL(timeout);
+        if (t < 0) {
+            t = 0;
+        }
+        gettimeofday(&now, NULL);
+        t += now.tv_sec + now.tv_usec / 1e6;
+        w.timed = 1;
+        w.deadline.tv_sec = (time_t)t;
+        w.deadline.tv_nsec = (long)((t - (double)w.deadline.tv_sec) * 1e9);
+    }
+
+    for (;;) {
+        w.interrupted = 0;
+#if HAVE_RB_THREAD_CALL_WITHOUT_GVL
+        rb_thread_call_without_gvl(storage_job_wait_nogvl, &w,
+                                   storage_job_wait_ubf, &w);
+#else
+        storage_job_wait_nogvl(&w);
+#endif
+        if (w.done || !w.interrupted) {
+            break;
+        }
+        /* raises if we were woken for Thread#raise, Thread#kill or a
+         * signal; otherwise just go back to waiting
+         */
+        rb_thread_check_ints();
+    }
+
+    return w.done ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *   job.wait(timeout=nil) -> [true|false]
+ *
+ * Wait, without holding the GVL, for this job to finish.  Returns false if
+ * timeout seconds passed first.
+ */
+static VALUE libvirt_storage_job_wait(int argc, VALUE *argv, VALUE j)
+{
+    VALUE timeout = RUBY_Qnil;
+    struct storage_job *job;
+
+    rb_scan_args(argc, argv, "01", &timeout);
+
+    job = storage_job_get(j);
+
+    return storage_job_wait(&job, 1, timeout);
+}
+
+struct storage_job_wait_all_arg {
+    VALUE jobs;
+    VALUE timeout;
+    struct storage_job **list;
+};
+
+static VALUE storage_job_wait_all_run(VALUE arg)
+{
+    struct storage_job_wait_all_arg *a = (struct storage_job_wait_all_arg *)arg;
+    VALUE entry;
+    long i;
+
+    for (i = 0; i < RARRAY_LEN(a->jobs); i++) {
+        entry = rb_ary_entry(a->jobs, i);
+        if (!rb_obj_is_kind_of(entry, c_storage_job)) {
+            rb_raise(rb_eTypeError,
+                     "wrong argument type (expected Libvirt::StorageJob)");
+        }
+        a->list[i] = storage_job_get(entry);
+    }
+
+    return storage_job_wait(a->list, RARRAY_LEN(a->jobs), a->timeout);
+}
+
+static VALUE storage_job_wait_all_free(VALUE arg)
+{
+    xfree(((struct storage_job_wait_all_arg *)arg)->list);
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   Libvirt::StorageJob.wait_all(jobs, timeout=nil) -> [true|false]
+ *
+ * Wait, without holding the GVL, for every job in the jobs Array to finish.
+ * Returns false if timeout seconds passed first.
+ */
+static VALUE libvirt_storage_job_s_wait_all(int argc, VALUE *argv,
+                                            VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    VALUE jobs = RUBY_Qnil, timeout = RUBY_Qnil, result;
+    struct storage_job_wait_all_arg a;
+
+    rb_scan_args(argc, argv, "11", &jobs, &timeout);
+
+    Check_Type(jobs, T_ARRAY);
+
+    /* the list can be as long as the caller likes, so it goes on the heap;
+     * a copy of the Array keeps the jobs alive while the GVL is released,
+     * whatever happens to the caller's Array in the meantime */
+    a.jobs = rb_ary_dup(jobs);
+    a.timeout = timeout;
+    a.list = ALLOC_N(struct storage_job *, RARRAY_LEN(a.jobs) + 1);
+    result = rb_ensure(storage_job_wait_all_run, (VALUE)&a,
+                       storage_job_wait_all_free, (VALUE)&a);
+    RB_GC_GUARD(a.jobs);
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   Libvirt::StorageJob.max_workers -> Fixnum
+ *
+ * Return the maximum number of worker threads that run storage jobs.
+ */
+static VALUE libvirt_storage_job_s_max_workers(VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    int max;
+
+    pthread_mutex_lock(&storage_job_lock);
+    max = storage_job_max_workers;
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return INT2NUM(max);
+}
+
+/*
+ * call-seq:
+ *   Libvirt::StorageJob.max_workers = Fixnum
+ *
+ * Set the maximum number of worker threads that run storage jobs; jobs
+ * beyond this many wait in the queue.  Lowering it retires idle workers
+ * and lets running jobs finish.
+ */
+static VALUE libvirt_storage_job_s_max_workers_equal(VALUE RUBY_LIBVIRT_UNUSED(klass),
+                                                     VALUE max)
+{
+    int m = NUM2INT(max);
+
+    if (m < 1) {
+        rb_raise(rb_eArgError, "max_workers must be at least 1");
+    }
+
+    pthread_mutex_lock(&storage_job_lock);
+    storage_job_max_workers = m;
+    pthread_cond_broadcast(&storage_job_work);
+    pthread_mutex_unlock(&storage_job_lock);
+
+    return max;
+}
+#endif
+
+void ruby_libvirt_storage_init(void)
+{
+    /*
+     * Class Libvirt::StoragePool and Libvirt::StoragePoolInfo
+     */
+#if HAVE_TYPE_VIRSTORAGEPOOLPTR
+    c_storage_pool_info = rb_define_class_under(m_libvirt, "StoragePoolInfo",
+                                                rb_cObject);
+    rb_define_attr(c_storage_pool_info, "state", 1, 0);
+    rb_define_attr(c_storage_pool_info, "capacity", 1, 0);
+    rb_define_attr(c_storage_pool_info, "allocation", 1, 0);
+    rb_define_attr(c_storage_pool_info, "available", 1, 0);
+
+    c_storage_pool = rb_define_class_under(m_libvirt, "StoragePool",
+                                           rb_cObject);
+
+    rb_define_attr(c_storage_pool, "connection", 1, 0);
+
+    /* virStoragePoolState */
+    rb_define_const(c_storage_pool, "INACTIVE",
+                    INT2NUM(VIR_STORAGE_POOL_INACTIVE));
+    rb_define_const(c_storage_pool, "BUILDING",
+                    INT2NUM(VIR_STORAGE_POOL_BUILDING));
+    rb_define_const(c_storage_pool, "RUNNING",
+                    INT2NUM(VIR_STORAGE_POOL_RUNNING));
+    rb_define_const(c_storage_pool, "DEGRADED",
+                    INT2NUM(VIR_STORAGE_POOL_DEGRADED));
+#if HAVE_CONST_VIR_STORAGE_POOL_INACCESSIBLE
+    rb_define_const(c_storage_pool, "INACCESSIBLE",
+                    INT2NUM(VIR_STORAGE_POOL_INACCESSIBLE));
+#endif
+
+#if HAVE_CONST_VIR_STORAGE_XML_INACTIVE
+    rb_define_const(c_storage_pool, "XML_INACTIVE",
+                    INT2NUM(VIR_STORAGE_XML_INACTIVE));
+#endif
+
+    /* virStoragePoolBuildFlags */
+    rb_define_const(c_storage_pool, "BUILD_NEW",
+                    INT2NUM(VIR_STORAGE_POOL_BUILD_NEW));
+    rb_define_const(c_storage_pool, "BUILD_REPAIR",
+                    INT2NUM(VIR_STORAGE_POOL_BUILD_REPAIR));
+    rb_define_const(c_storage_pool, "BUILD_RESIZE",
+                    INT2NUM(VIR_STORAGE_POOL_BUILD_RESIZE));
+
+    /* virStoragePoolDeleteFlags */
+    rb_define_const(c_storage_pool, "DELETE_NORMAL",
+                    INT2NUM(VIR_STORAGE_POOL_DELETE_NORMAL));
+    rb_define_const(c_storage_pool, "DELETE_ZEROED",
+                    INT2NUM(VIR_STORAGE_POOL_DELETE_ZEROED));
+
+#if HAVE_CONST_VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA
+    rb_define_const(c_storage_pool, "CREATE_PREALLOC_METADATA",
+                    INT2NUM(VIR_STORAGE_VOL_CREATE_PREALLOC_METADATA));
+#endif
+#if HAVE_CONST_VIR_STORAGE_VOL_CREATE_REFLINK
+    rb_define_const(c_storage_pool, "CREATE_REFLINK",
+                    INT2NUM(VIR_STORAGE_VOL_CREATE_REFLINK));
+#endif
+
+#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_NORMAL
+    rb_define_const(c_storage_pool, "CREATE_NORMAL",
+                    INT2NUM(VIR_STORAGE_POOL_CREATE_NORMAL));
+#endif
+#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD
+    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD",
+                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD));
+#endif
+#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD_OVERWRITE
+    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD_OVERWRITE",
+                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD_OVERWRITE));
+#endif
+#if HAVE_CONST_VIR_STORAGE_POOL_CREATE_WITH_BUILD_NO_OVERWRITE
+    rb_define_const(c_storage_pool, "CREATE_WITH_BUILD_NO_OVERWRITE",
+                    INT2NUM(VIR_STORAGE_POOL_CREATE_WITH_BUILD_NO_OVERWRITE));
+#endif
+
+    /* Creating/destroying pools */
+    rb_define_method(c_storage_pool, "build", libvirt_storage_pool_build, -1);
+    rb_define_method(c_storage_pool, "undefine", libvirt_storage_pool_undefine,
+                     0);
+    rb_define_method(c_storage_pool, "create", libvirt_storage_pool_create, -1);
+    rb_define_method(c_storage_pool, "destroy", libvirt_storage_pool_destroy,
+                     0);
+    rb_define_method(c_storage_pool, "delete", libvirt_storage_pool_delete, -1);
+    rb_define_method(c_storage_pool, "refresh", libvirt_storage_pool_refresh,
+                     -1);
+    /* StoragePool information */
+    rb_define_method(c_storage_pool, "name", libvirt_storage_pool_name, 0);
+    rb_define_method(c_storage_pool, "uuid", libvirt_storage_pool_uuid, 0);
+    rb_define_method(c_storage_pool, "info", libvirt_storage_pool_info, 0);
+    rb_define_method(c_storage_pool, "xml_desc", libvirt_storage_pool_xml_desc,
+                     -1);
+    rb_define_method(c_storage_pool, "autostart",
+                     libvirt_storage_pool_autostart, 0);
+    rb_define_method(c_storage_pool, "autostart?",
+                     libvirt_storage_pool_autostart, 0);
+    rb_define_method(c_storage_pool, "autostart=",
+                     libvirt_storage_pool_autostart_equal, 1);
+    /* List/lookup storage volumes within a pool */
+    rb_define_method(c_storage_pool, "num_of_volumes",
+                     libvirt_storage_pool_num_of_volumes, 0);
+    rb_define_method(c_storage_pool, "list_volumes",
+                     libvirt_storage_pool_list_volumes, 0);
+    /* Lookup volumes based on various attributes */
+    rb_define_method(c_storage_pool, "lookup_volume_by_name",
+                     libvirt_storage_pool_lookup_vol_by_name, 1);
+    rb_define_method(c_storage_pool, "lookup_volume_by_key",
+                     libvirt_storage_pool_lookup_vol_by_key, 1);
+    rb_define_method(c_storage_pool, "lookup_volume_by_path",
+                     libvirt_storage_pool_lookup_vol_by_path, 1);
+    rb_define_method(c_storage_pool, "free", libvirt_storage_pool_free, 0);
+    rb_define_method(c_storage_pool, "create_volume_xml",
+                     libvirt_storage_pool_create_volume_xml, -1);
+    rb_define_alias(c_storage_pool, "create_vol_xml", "create_volume_xml");
+#if HAVE_VIRSTORAGEVOLCREATEXMLFROM
+    rb_define_method(c_storage_pool, "create_volume_xml_from",
+                     libvirt_storage_pool_create_volume_xml_from, -1);
+    rb_define_alias(c_storage_pool, "create_vol_xml_from",
+                    "create_volume_xml_from");
+    rb_define_const(c_storage_pool, "CLONE_BACKING",
+                    INT2NUM(STORAGE_CLONE_BACKING));
+    rb_define_const(c_storage_pool, "CLONE_FULL", INT2NUM(STORAGE_CLONE_FULL));
+    rb_define_method(c_storage_pool, "clone_volumes",
+                     libvirt_storage_pool_clone_volumes, -1);
+#endif
+#if HAVE_VIRSTORAGEPOOLISACTIVE
+    rb_define_method(c_storage_pool, "active?", libvirt_storage_pool_active_p,
+                     0);
+#endif
+#if HAVE_VIRSTORAGEPOOLISPERSISTENT
+    rb_define_method(c_storage_pool, "persistent?",
+                     libvirt_storage_pool_persistent_p, 0);
+#endif
+
+#if HAVE_VIRSTORAGEPOOLLISTALLVOLUMES
+    rb_define_method(c_storage_pool, "list_all_volumes",
+                     libvirt_storage_pool_list_all_volumes, -1);
+#endif
+
+#if HAVE_CONST_VIR_STORAGE_POOL_BUILD_NO_OVERWRITE
+    rb_define_const(c_storage_pool, "BUILD_NO_OVERWRITE",
+                    INT2NUM(VIR_STORAGE_POOL_BUILD_NO_OVERWRITE));
+#endif
+
+#if HAVE_CONST_VIR_STORAGE_POOL_BUILD_OVERWRITE
+    rb_define_const(c_storage_pool, "BUILD_OVERWRITE",
+                    INT2NUM(VIR_STORAGE_POOL_BUILD_OVERWRITE));
+#endif
+
+#endif
 
 #if HAVE_TYPE_VIRSTORAGEVOLPTR
     /*
@@ -1018,5 +2777,62 @@ void ruby_libvirt_storage_init(void)
     rb_define_method(c_storage_vol, "resize", libvirt_storage_vol_resize, -1);
 #endif
 
+#endif
+
+#if HAVE_TYPE_VIRSTORAGEVOLPTR && HAVE_PTHREAD_H
+    /*
+     * Class Libvirt::StorageJob
+     */
+    c_storage_job = rb_define_class_under(m_libvirt, "StorageJob",
+                                          rb_cObject);
+    rb_undef_alloc_func(c_storage_job);
+    pthread_atfork(storage_job_atfork_prepare, storage_job_atfork_parent,
+                   storage_job_atfork_child);
+
+    rb_define_attr(c_storage_job, "connection", 1, 0);
+
+    rb_define_const(c_storage_job, "QUEUED", INT2NUM(STORAGE_JOB_QUEUED));
+    rb_define_const(c_storage_job, "RUNNING", INT2NUM(STORAGE_JOB_RUNNING));
+    rb_define_const(c_storage_job, "COMPLETED",
+                    INT2NUM(STORAGE_JOB_COMPLETED));
+    rb_define_const(c_storage_job, "FAILED", INT2NUM(STORAGE_JOB_FAILED));
+    rb_define_const(c_storage_job, "CANCELLED",
+                    INT2NUM(STORAGE_JOB_CANCELLED));
+
+    rb_define_singleton_method(c_storage_job, "wait_all",
+                               libvirt_storage_job_s_wait_all, -1);
+    rb_define_singleton_method(c_storage_job, "max_workers",
+                               libvirt_storage_job_s_max_workers, 0);
+    rb_define_singleton_method(c_storage_job, "max_workers=",
+                               libvirt_storage_job_s_max_workers_equal, 1);
+
+    rb_define_method(c_storage_job, "state", libvirt_storage_job_state, 0);
+    rb_define_method(c_storage_job, "done?", libvirt_storage_job_done_p, 0);
+    rb_define_method(c_storage_job, "operation",
+                     libvirt_storage_job_operation, 0);
+    rb_define_method(c_storage_job, "progress", libvirt_storage_job_progress,
+                     0);
+    rb_define_method(c_storage_job, "time", libvirt_storage_job_time, 0);
+    rb_define_method(c_storage_job, "error", libvirt_storage_job_error, 0);
+    rb_define_method(c_storage_job, "volume", libvirt_storage_job_volume, 0);
+    rb_define_method(c_storage_job, "cancel", libvirt_storage_job_cancel, 0);
+    rb_define_method(c_storage_job, "wait", libvirt_storage_job_wait, -1);
+
+#if HAVE_VIRSTORAGEVOLWIPE
+    rb_define_method(c_storage_vol, "wipe_job", libvirt_storage_vol_wipe_job,
+                     -1);
+#endif
+#if HAVE_VIRSTORAGEVOLWIPEPATTERN
+    rb_define_method(c_storage_vol, "wipe_pattern_job",
+                     libvirt_storage_vol_wipe_pattern_job, -1);
+#endif
+#if HAVE_VIRSTORAGEVOLRESIZE
+    rb_define_method(c_storage_vol, "resize_job",
+                     libvirt_storage_vol_resize_job, -1);
+#endif
+#if HAVE_VIRSTORAGEVOLCREATEXMLFROM
+    rb_define_method(c_storage_pool, "create_volume_xml_from_job",
+                     libvirt_storage_pool_create_volume_xml_from_job, -1);
+#endif
 #endif
 }
@@ -3,4 +3,8 @@
 
 void ruby_libvirt_storage_init(void);
 
+VALUE ruby_libvirt_storage_capacity_report(VALUE c, int include_volumes,
+                                           unsigned int flags,
+                                           int concurrency);
+
 #endif
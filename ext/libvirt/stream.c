@@ -36,12 +36,32 @@ static void stream_free(void *s)
 
 virStreamPtr ruby_libvirt_stream_get(VALUE s)
 {
-    ruby_libvirt_get_struct(Stream, s);
+    virStreamPtr st;
+
+    Data_Get_Struct(s, virStream, st);
+    if (!st) {
+        rb_raise(rb_eArgError, "Stream has been freed");
+    }
+
+    /* a stream is tied to the connection it was opened on and has nothing
+     * to look it up by, so it cannot follow the Connect when it is reopened
+     * after a fork or by conn.reopen */
+    if (ruby_libvirt_connect_reopened_since(s) != NULL) {
+        rb_raise(e_ConnectionError,
+                 "stream was opened before the connection was reopened");
+    }
+
+    return st;
 }
 
 VALUE ruby_libvirt_stream_new(virStreamPtr s, VALUE conn)
 {
-    return ruby_libvirt_new_class(c_stream, s, conn, stream_free);
+    VALUE result;
+
+    result = ruby_libvirt_new_class(c_stream, s, conn, stream_free);
+    ruby_libvirt_connect_stamp(result);
+
+    return result;
 }
 
 /*
@@ -60,8 +80,8 @@ static VALUE libvirt_stream_send(VALUE s, VALUE buffer)
 
     StringValue(buffer);
 
-    ret = virStreamSend(ruby_libvirt_stream_get(s), RSTRING_PTR(buffer),
-                        RSTRING_LEN(buffer));
+    ret = RUBY_LIBVIRT_CALL(virStreamSend, ruby_libvirt_stream_get(s),
+                            RSTRING_PTR(buffer), RSTRING_LEN(buffer));
     ruby_libvirt_raise_error_if(ret == -1, e_RetrieveError, "virStreamSend",
                                 ruby_libvirt_connect_get(s));
 
@@ -87,7 +107,8 @@ static VALUE libvirt_stream_recv(VALUE s, VALUE bytes)
 
     data = alloca(sizeof(char) * NUM2INT(bytes));
 
-    ret = virStreamRecv(ruby_libvirt_stream_get(s), data, NUM2INT(bytes));
+    ret = RUBY_LIBVIRT_CALL(virStreamRecv, ruby_libvirt_stream_get(s), data,
+                            NUM2INT(bytes));
     ruby_libvirt_raise_error_if(ret < 0, e_RetrieveError, "virStreamRecv",
                                 ruby_libvirt_connect_get(s));
 
@@ -269,6 +290,8 @@ static VALUE libvirt_stream_event_add_callback(int argc, VALUE *argv, VALUE s)
                  "wrong argument type (expected Symbol or Proc)");
     }
 
+    ruby_libvirt_check_ruby_callbacks();
+
     passthrough = rb_ary_new2(3);
     rb_ary_store(passthrough, 0, callback);
     rb_ary_store(passthrough, 1, opaque);
@@ -0,0 +1,716 @@
+/*
+ * vcpu.c: a native vCPU hotplug controller
+ *
+ * Copyright (C) 2013-2016 Chris Lalancette <clalancette@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#include "common.h"
+#include "connect.h"
+#include "controller.h"
+#include "domain.h"
+#include "vcpu.h"
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_VCPU && HAVE_VIRDOMAINSETVCPUSFLAGS && HAVE_PTHREAD_H
+static VALUE c_vcpu_controller;
+
+#define VCPU_AUDIT_LOG_SIZE 256
+
+/*
+ * A Libvirt::VcpuController is a native controller (see controller.c)
+ * whose cycle samples the vCPU time of all running domains with one
+ * virConnectGetAllDomainStats call and hot(un)plugs vCPUs in parallel.
+ * The policy, per-domain bounds and history, counters and the audit log
+ * are protected by the controller's lock.
+ */
+struct vcpu_policy {
+    int high;
+    int low;
+    int samples;
+};
+
+struct vcpu_domain {
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int min;
+    int max;
+    int bounded;
+    int seen;
+    int settle;
+    unsigned long long prev_time;
+    double prev_stamp;
+    int high;
+    int low;
+};
+
+struct vcpu_audit {
+    double time;
+    char *name;
+    int from;
+    int to;
+    double util;
+    char *error;
+};
+
+struct vcpu_controller {
+    struct ruby_libvirt_controller base;
+    struct vcpu_policy policy;
+
+    struct vcpu_domain *doms;
+    int ndoms;
+
+    struct vcpu_audit audit[VCPU_AUDIT_LOG_SIZE];
+    int audit_head;
+    int audit_count;
+
+    unsigned long long added;
+    unsigned long long removed;
+};
+
+struct vcpu_adjustment {
+    struct vcpu_controller *ctl;
+    virDomainPtr dom;
+    int from;
+    int to;
+    double util;
+};
+
+static void vcpu_audit_clear(struct vcpu_controller *ctl)
+{
+    int i;
+
+    for (i = 0; i < VCPU_AUDIT_LOG_SIZE; i++) {
+        free(ctl->audit[i].name);
+        free(ctl->audit[i].error);
+    }
+    memset(ctl->audit, 0, sizeof(ctl->audit));
+    ctl->audit_head = 0;
+    ctl->audit_count = 0;
+}
+
+/* the caller must hold ctl->base.lock */
+static struct vcpu_domain *vcpu_domain_find(struct vcpu_controller *ctl,
+                                            const unsigned char *uuid,
+                                            int create)
+{
+    struct vcpu_domain *tmp;
+    int i;
+
+    for (i = 0; i < ctl->ndoms; i++) {
+        if (memcmp(ctl->doms[i].uuid, uuid, VIR_UUID_BUFLEN) == 0) {
+            return &ctl->doms[i];
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    tmp = realloc(ctl->doms, (ctl->ndoms + 1) * sizeof(struct vcpu_domain));
+    if (tmp == NULL) {
+        return NULL;
+    }
+    ctl->doms = tmp;
+    memset(&ctl->doms[ctl->ndoms], 0, sizeof(struct vcpu_domain));
+    memcpy(ctl->doms[ctl->ndoms].uuid, uuid, VIR_UUID_BUFLEN);
+    ctl->doms[ctl->ndoms].settle = 1;
+
+    return &ctl->doms[ctl->ndoms++];
+}
+
+/* forget the history of domains that have gone away, keeping their bounds;
+ * the caller must hold ctl->base.lock */
+static void vcpu_domain_prune(struct vcpu_controller *ctl)
+{
+    int i, j = 0;
+
+    for (i = 0; i < ctl->ndoms; i++) {
+        if (!ctl->doms[i].seen) {
+            ctl->doms[i].settle = 1;
+            ctl->doms[i].high = 0;
+            ctl->doms[i].low = 0;
+        }
+        if (ctl->doms[i].seen || ctl->doms[i].bounded) {
+            ctl->doms[i].seen = 0;
+            ctl->doms[j++] = ctl->doms[i];
+        }
+    }
+    ctl->ndoms = j;
+}
+
+static void vcpu_audit_add(struct vcpu_controller *ctl,
+                           struct vcpu_adjustment *adj, char *error)
+{
+    struct vcpu_audit *entry;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    pthread_mutex_lock(&ctl->base.lock);
+    entry = &ctl->audit[(ctl->audit_head + ctl->audit_count) %
+                        VCPU_AUDIT_LOG_SIZE];
+    if (ctl->audit_count == VCPU_AUDIT_LOG_SIZE) {
+        ctl->audit_head = (ctl->audit_head + 1) % VCPU_AUDIT_LOG_SIZE;
+    }
+    else {
+        ctl->audit_count++;
+    }
+    free(entry->name);
+    free(entry->error);
+    entry->time = now.tv_sec + now.tv_usec / 1e6;
+    entry->name = strdup(virDomainGetName(adj->dom));
+    entry->from = adj->from;
+    entry->to = adj->to;
+    entry->util = adj->util;
+    entry->error = error;
+    pthread_mutex_unlock(&ctl->base.lock);
+}
+
+static void vcpu_apply(void *opaque, int i)
+{
+    struct vcpu_adjustment *adj = (struct vcpu_adjustment *)opaque + i;
+    struct vcpu_controller *ctl = adj->ctl;
+    char *error = NULL;
+    int r;
+
+    if (ruby_libvirt_controller_acquire(&ctl->base) < 0) {
+        return;
+    }
+    r = virDomainSetVcpusFlags(adj->dom, adj->to, VIR_DOMAIN_AFFECT_LIVE);
+    ruby_libvirt_controller_release(&ctl->base);
+
+    if (r < 0) {
+        error = ruby_libvirt_controller_take_error();
+        ruby_libvirt_controller_failed(&ctl->base, error);
+    }
+    else {
+        pthread_mutex_lock(&ctl->base.lock);
+        if (adj->to > adj->from) {
+            ctl->added += adj->to - adj->from;
+        }
+        else {
+            ctl->removed += adj->from - adj->to;
+        }
+        pthread_mutex_unlock(&ctl->base.lock);
+    }
+
+    vcpu_audit_add(ctl, adj, error);
+}
+
+/* sum the vcpu.<n>.time fields of RECORD into TIME, returning -1 if there
+ * are none (the domain is not running, or the driver does not report them) */
+static int vcpu_record_parse(virDomainStatsRecordPtr record, int *current,
+                             int *maximum, unsigned long long *time)
+{
+    const char *field;
+    char *end;
+    int i, found = 0;
+
+    *current = *maximum = 0;
+    *time = 0;
+    for (i = 0; i < record->nparams; i++) {
+        field = record->params[i].field;
+        if (strncmp(field, "vcpu.", 5) != 0) {
+            continue;
+        }
+        field += 5;
+        if (strcmp(field, "current") == 0 &&
+            record->params[i].type == VIR_TYPED_PARAM_UINT) {
+            *current = record->params[i].value.ui;
+        }
+        else if (strcmp(field, "maximum") == 0 &&
+                 record->params[i].type == VIR_TYPED_PARAM_UINT) {
+            *maximum = record->params[i].value.ui;
+        }
+        else if (*field >= '0' && *field <= '9') {
+            strtoul(field, &end, 10);
+            if (strcmp(end, ".time") == 0 &&
+                record->params[i].type == VIR_TYPED_PARAM_ULLONG) {
+                *time += record->params[i].value.ul;
+                found = 1;
+            }
+        }
+    }
+
+    return (found && *current > 0) ? 0 : -1;
+}
+
+/*
+ * Decide whether the domain in STATE, using CURRENT of MAXIMUM vCPUs whose
+ * time counters add up to TIME at STAMP, needs a vCPU more or less.  A
+ * change is only made after the utilization per vCPU has been above high
+ * (or below low) for samples cycles in a row, and is always one vCPU
+ * within the domain's bounds.  The caller must hold ctl->base.lock.
+ */
+static int vcpu_decide(struct vcpu_policy *policy, struct vcpu_domain *state,
+                       int current, int maximum, unsigned long long time,
+                       double stamp, double *util)
+{
+    int min, max, target = current;
+
+    min = state->bounded ? state->min : 1;
+    max = maximum;
+    if (state->bounded && state->max != 0 && state->max < max) {
+        max = state->max;
+    }
+
+    if (state->settle || time < state->prev_time ||
+        stamp <= state->prev_stamp) {
+        state->settle = 0;
+        state->prev_time = time;
+        state->prev_stamp = stamp;
+        *util = 0;
+        return current;
+    }
+
+    *util = 100.0 * (time - state->prev_time) /
+        ((stamp - state->prev_stamp) * 1e9 * current);
+    state->prev_time = time;
+    state->prev_stamp = stamp;
+
+    if (*util > policy->high) {
+        state->high++;
+        state->low = 0;
+    }
+    else if (*util < policy->low) {
+        state->low++;
+        state->high = 0;
+    }
+    else {
+        state->high = 0;
+        state->low = 0;
+    }
+
+    if (current > max) {
+        target = max;
+    }
+    else if (current < min) {
+        target = min;
+    }
+    else if (state->high >= policy->samples && current < max) {
+        target = current + 1;
+    }
+    else if (state->low >= policy->samples && current > min) {
+        target = current - 1;
+    }
+
+    if (target != current) {
+        state->high = 0;
+        state->low = 0;
+        /* the counters of unplugged vCPUs disappear from the sum */
+        state->settle = 1;
+    }
+
+    return target;
+}
+
+static void vcpu_cycle(struct ruby_libvirt_controller *base)
+{
+    struct vcpu_controller *ctl = (struct vcpu_controller *)base;
+    virDomainStatsRecordPtr *records;
+    struct vcpu_adjustment *adj;
+    struct vcpu_domain *state;
+    struct vcpu_policy policy;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    unsigned long long time;
+    int n, i, nadj = 0, current, maximum, target;
+    double stamp, util;
+
+    n = ruby_libvirt_controller_fetch(base, VIR_DOMAIN_STATS_VCPU,
+                                      VIR_CONNECT_GET_ALL_DOMAINS_STATS_RUNNING,
+                                      &records, &stamp);
+    if (n < 0) {
+        return;
+    }
+
+    adj = calloc(n + 1, sizeof(struct vcpu_adjustment));
+    if (adj == NULL) {
+        virDomainStatsRecordListFree(records);
+        return;
+    }
+
+    pthread_mutex_lock(&base->lock);
+    policy = ctl->policy;
+    for (i = 0; i < n; i++) {
+        if (vcpu_record_parse(records[i], &current, &maximum, &time) < 0 ||
+            virDomainGetUUID(records[i]->dom, uuid) < 0) {
+            continue;
+        }
+        state = vcpu_domain_find(ctl, uuid, 1);
+        if (state == NULL) {
+            continue;
+        }
+        state->seen = 1;
+        target = vcpu_decide(&policy, state, current, maximum, time, stamp,
+                             &util);
+        if (target != current) {
+            adj[nadj].ctl = ctl;
+            adj[nadj].dom = records[i]->dom;
+            adj[nadj].from = current;
+            adj[nadj].to = target;
+            adj[nadj].util = util;
+            nadj++;
+        }
+    }
+    vcpu_domain_prune(ctl);
+    pthread_mutex_unlock(&base->lock);
+
+    ruby_libvirt_parallel_for_native(nadj, base->concurrency, vcpu_apply,
+                                     adj);
+
+    free(adj);
+    virDomainStatsRecordListFree(records);
+}
+
+/* utilization is measured afresh when the controller is started again;
+ * called with ctl->base.lock held */
+static void vcpu_stopped(struct ruby_libvirt_controller *base)
+{
+    struct vcpu_controller *ctl = (struct vcpu_controller *)base;
+    int i;
+
+    for (i = 0; i < ctl->ndoms; i++) {
+        ctl->doms[i].settle = 1;
+        ctl->doms[i].high = 0;
+        ctl->doms[i].low = 0;
+    }
+}
+
+static void vcpu_policy_hash(struct ruby_libvirt_controller *base,
+                             VALUE result)
+{
+    struct vcpu_controller *ctl = (struct vcpu_controller *)base;
+    struct vcpu_policy policy;
+
+    pthread_mutex_lock(&base->lock);
+    policy = ctl->policy;
+    pthread_mutex_unlock(&base->lock);
+
+    rb_hash_aset(result, rb_str_new2("high_percent"), INT2NUM(policy.high));
+    rb_hash_aset(result, rb_str_new2("low_percent"), INT2NUM(policy.low));
+    rb_hash_aset(result, rb_str_new2("samples"), INT2NUM(policy.samples));
+}
+
+static void vcpu_stats_hash(struct ruby_libvirt_controller *base, VALUE result)
+{
+    struct vcpu_controller *ctl = (struct vcpu_controller *)base;
+    unsigned long long added, removed;
+
+    pthread_mutex_lock(&base->lock);
+    added = ctl->added;
+    removed = ctl->removed;
+    pthread_mutex_unlock(&base->lock);
+
+    rb_hash_aset(result, rb_str_new2("added"), ULL2NUM(added));
+    rb_hash_aset(result, rb_str_new2("removed"), ULL2NUM(removed));
+}
+
+static void vcpu_free(struct ruby_libvirt_controller *base)
+{
+    struct vcpu_controller *ctl = (struct vcpu_controller *)base;
+
+    vcpu_audit_clear(ctl);
+    free(ctl->doms);
+}
+
+static const struct ruby_libvirt_controller_ops vcpu_ops = {
+    "vCPU controller",
+    vcpu_cycle,
+    vcpu_stopped,
+    vcpu_policy_hash,
+    vcpu_stats_hash,
+    vcpu_free,
+};
+
+static void vcpu_policy_set(struct vcpu_policy *policy, VALUE high, VALUE low,
+                            VALUE samples)
+{
+    policy->high = NIL_P(high) ? 80 : NUM2INT(high);
+    policy->low = NIL_P(low) ? 20 : NUM2INT(low);
+    policy->samples = NIL_P(samples) ? 3 : NUM2INT(samples);
+
+    if (policy->low < 0 || policy->high > 100 ||
+        policy->low >= policy->high) {
+        rb_raise(rb_eArgError,
+                 "utilization percentages must satisfy 0 <= low < high <= 100");
+    }
+    if (policy->samples < 1) {
+        rb_raise(rb_eArgError, "samples must be at least 1");
+    }
+}
+
+/*
+ * call-seq:
+ *   Libvirt::VcpuController.new(conn, high_percent=80, low_percent=20, samples=3, interval=5.0, concurrency=0) -> Libvirt::VcpuController
+ *
+ * Create a controller that sizes the vCPUs of the running domains on conn
+ * to their load.  Once started, it reads the vCPU time counters of all
+ * running domains every interval seconds with a single call to
+ * virConnectGetAllDomainStats[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virConnectGetAllDomainStats]
+ * and works out how busy each domain's vCPUs were since the last cycle.  A
+ * domain busier than high_percent per vCPU for samples cycles in a row gets
+ * one more vCPU, and one below low_percent for samples cycles in a row
+ * loses one, with virDomainSetVcpusFlags[http://www.libvirt.org/html/libvirt-libvirt-domain.html#virDomainSetVcpusFlags]
+ * on up to concurrency native threads (a default if 0).  Domains stay
+ * between 1 vCPU and their maximum unless given other bounds with
+ * ctl.set_bounds.  Every change, successful or not, is recorded in
+ * ctl.audit_log.  Like a Libvirt::BalloonController, the controller runs
+ * without the GVL and its calls go through the connection's governor;
+ * utilization is measured afresh each time it is started.
+ * ctl.set_domains limits it to some of the domains.
+ *
+ * Besides the common counters, ctl.stats has "added" and "removed" (vCPUs
+ * hotplugged and unplugged); ctl.policy has "high_percent", "low_percent"
+ * and "samples" besides "interval" and "concurrency".
+ */
+static VALUE libvirt_vcpu_controller_s_new(int argc, VALUE *argv,
+                                           VALUE RUBY_LIBVIRT_UNUSED(klass))
+{
+    VALUE c, high, low, samples, interval, concurrency;
+    struct vcpu_controller *ctl;
+    struct vcpu_policy policy;
+
+    rb_scan_args(argc, argv, "15", &c, &high, &low, &samples, &interval,
+                 &concurrency);
+
+    vcpu_policy_set(&policy, high, low, samples);
+
+    ctl = ruby_libvirt_controller_alloc(c, sizeof(struct vcpu_controller),
+                                        &vcpu_ops, interval, 5.0,
+                                        concurrency);
+    ctl->policy = policy;
+
+    return ruby_libvirt_controller_new(c_vcpu_controller, ctl, c);
+}
+
+/*
+ * call-seq:
+ *   ctl.set_policy(high_percent, low_percent, samples=3) -> nil
+ *
+ * Change the utilization thresholds and the number of cycles in a row a
+ * domain must spend beyond one before its vCPUs are changed.  A running
+ * controller picks up the change at its next cycle.
+ */
+static VALUE libvirt_vcpu_controller_set_policy(int argc, VALUE *argv, VALUE v)
+{
+    struct vcpu_controller *ctl = ruby_libvirt_controller_get(v);
+    VALUE high, low, samples;
+    struct vcpu_policy policy;
+
+    rb_scan_args(argc, argv, "21", &high, &low, &samples);
+
+    vcpu_policy_set(&policy, high, low, samples);
+
+    pthread_mutex_lock(&ctl->base.lock);
+    ctl->policy = policy;
+    pthread_mutex_unlock(&ctl->base.lock);
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   ctl.set_bounds(dom, min_vcpus, max_vcpus=0) -> nil
+ *
+ * Keep dom between min_vcpus and max_vcpus (its maximum if 0).  A domain
+ * currently outside its bounds is brought back within them at the next
+ * cycle, one vCPU at a time.  The bounds apply across restarts of the
+ * domain until ctl.clear_bounds is called.
+ */
+static VALUE libvirt_vcpu_controller_set_bounds(int argc, VALUE *argv, VALUE v)
+{
+    struct vcpu_controller *ctl = ruby_libvirt_controller_get(v);
+    struct vcpu_domain *state;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    VALUE dom, min, max;
+    int r, minv, maxv;
+
+    rb_scan_args(argc, argv, "21", &dom, &min, &max);
+
+    minv = NUM2INT(min);
+    maxv = ruby_libvirt_value_to_int(max);
+    if (minv < 1 || (maxv != 0 && maxv < minv)) {
+        rb_raise(rb_eArgError,
+                 "vCPU bounds must satisfy 1 <= min and (max == 0 or min <= max)");
+    }
+
+    r = virDomainGetUUID(ruby_libvirt_domain_get(dom), uuid);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetUUID",
+                                ruby_libvirt_connect_get(dom));
+
+    pthread_mutex_lock(&ctl->base.lock);
+    state = vcpu_domain_find(ctl, uuid, 1);
+    if (state != NULL) {
+        state->min = minv;
+        state->max = maxv;
+        state->bounded = 1;
+    }
+    pthread_mutex_unlock(&ctl->base.lock);
+
+    if (state == NULL) {
+        rb_memerror();
+    }
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   ctl.clear_bounds(dom) -> [True|False]
+ *
+ * Return dom to the default bounds of 1 vCPU to its maximum.  Returns
+ * +false+ if dom had no bounds of its own.
+ */
+static VALUE libvirt_vcpu_controller_clear_bounds(VALUE v, VALUE dom)
+{
+    struct vcpu_controller *ctl = ruby_libvirt_controller_get(v);
+    struct vcpu_domain *state;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    int r, bounded = 0;
+
+    r = virDomainGetUUID(ruby_libvirt_domain_get(dom), uuid);
+    ruby_libvirt_raise_error_if(r < 0, e_RetrieveError, "virDomainGetUUID",
+                                ruby_libvirt_connect_get(dom));
+
+    pthread_mutex_lock(&ctl->base.lock);
+    state = vcpu_domain_find(ctl, uuid, 0);
+    if (state != NULL) {
+        bounded = state->bounded;
+        state->bounded = 0;
+    }
+    pthread_mutex_unlock(&ctl->base.lock);
+
+    return bounded ? Qtrue : Qfalse;
+}
+
+struct vcpu_audit_array_arg {
+    struct vcpu_audit *entries;
+    int count;
+};
+
+static VALUE vcpu_audit_to_array(VALUE in)
+{
+    struct vcpu_audit_array_arg *arg = (struct vcpu_audit_array_arg *)in;
+    struct vcpu_audit *entry;
+    VALUE result, hash;
+    int i;
+
+    result = rb_ary_new2(arg->count);
+    for (i = 0; i < arg->count; i++) {
+        entry = &arg->entries[i];
+        hash = rb_hash_new();
+        rb_hash_aset(hash, rb_str_new2("time"),
+                     rb_time_new((time_t)entry->time,
+                                 (long)((entry->time -
+                                         (time_t)entry->time) * 1e6)));
+        rb_hash_aset(hash, rb_str_new2("name"),
+                     entry->name ? rb_str_new2(entry->name) : Qnil);
+        rb_hash_aset(hash, rb_str_new2("from"), INT2NUM(entry->from));
+        rb_hash_aset(hash, rb_str_new2("to"), INT2NUM(entry->to));
+        rb_hash_aset(hash, rb_str_new2("utilization"),
+                     rb_float_new(entry->util));
+        rb_hash_aset(hash, rb_str_new2("error"),
+                     entry->error ? rb_str_new2(entry->error) : Qnil);
+        rb_ary_store(result, i, hash);
+    }
+
+    return result;
+}
+
+/*
+ * call-seq:
+ *   ctl.audit_log(clear=false) -> Array
+ *
+ * Return the controller's latest decisions (at most AUDIT_LOG_SIZE),
+ * oldest first, as an Array of Hashes with the keys "time" (a Time),
+ * "name" (the domain), "from" and "to" (vCPU counts), "utilization" (the
+ * per-vCPU utilization in percent that led to the change) and "error"
+ * (the libvirt error message if the change failed, or nil).  If clear is
+ * true, the log is emptied.
+ */
+static VALUE libvirt_vcpu_controller_audit_log(int argc, VALUE *argv, VALUE v)
+{
+    struct vcpu_controller *ctl = ruby_libvirt_controller_get(v);
+    struct vcpu_audit *copy;
+    struct vcpu_audit_array_arg arg;
+    VALUE clear, result;
+    int i, count, exception = 0;
+
+    rb_scan_args(argc, argv, "01", &clear);
+
+    copy = alloca(sizeof(struct vcpu_audit) * VCPU_AUDIT_LOG_SIZE);
+
+    pthread_mutex_lock(&ctl->base.lock);
+    count = ctl->audit_count;
+    for (i = 0; i < count; i++) {
+        copy[i] = ctl->audit[(ctl->audit_head + i) % VCPU_AUDIT_LOG_SIZE];
+        copy[i].name = copy[i].name ? strdup(copy[i].name) : NULL;
+        copy[i].error = copy[i].error ? strdup(copy[i].error) : NULL;
+    }
+    if (RTEST(clear)) {
+        vcpu_audit_clear(ctl);
+    }
+    pthread_mutex_unlock(&ctl->base.lock);
+
+    arg.entries = copy;
+    arg.count = count;
+    result = rb_protect(vcpu_audit_to_array, (VALUE)&arg, &exception);
+
+    for (i = 0; i < count; i++) {
+        free(copy[i].name);
+        free(copy[i].error);
+    }
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+#endif
+
+/*
+ * Class Libvirt::VcpuController
+ */
+void ruby_libvirt_vcpu_init(void)
+{
+#if HAVE_VIRCONNECTGETALLDOMAINSTATS && HAVE_CONST_VIR_DOMAIN_STATS_VCPU && HAVE_VIRDOMAINSETVCPUSFLAGS && HAVE_PTHREAD_H
+    c_vcpu_controller = rb_define_class_under(m_libvirt, "VcpuController",
+                                              rb_cObject);
+    ruby_libvirt_controller_define_methods(c_vcpu_controller);
+
+    rb_define_const(c_vcpu_controller, "AUDIT_LOG_SIZE",
+                    INT2NUM(VCPU_AUDIT_LOG_SIZE));
+
+    rb_define_singleton_method(c_vcpu_controller, "new",
+                               libvirt_vcpu_controller_s_new, -1);
+    rb_define_method(c_vcpu_controller, "set_policy",
+                     libvirt_vcpu_controller_set_policy, -1);
+    rb_define_method(c_vcpu_controller, "set_bounds",
+                     libvirt_vcpu_controller_set_bounds, -1);
+    rb_define_method(c_vcpu_controller, "clear_bounds",
+                     libvirt_vcpu_controller_clear_bounds, 1);
+    rb_define_method(c_vcpu_controller, "audit_log",
+                     libvirt_vcpu_controller_audit_log, -1);
+#endif
+}
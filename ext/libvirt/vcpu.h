@@ -0,0 +1,6 @@
+#ifndef VCPU_H
+#define VCPU_H
+
+void ruby_libvirt_vcpu_init(void);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * xml.c: Helpers to turn libvirt XML documents into Ruby objects
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ruby.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "extconf.h"
+#include "common.h"
+#include "xml.h"
+
+#if HAVE_LIBXML_PARSER_H
+
+/* Parse the XML document XML that was returned by libvirt.  Returns NULL if
+ * it could not be parsed; otherwise the caller is responsible for calling
+ * xmlFreeDoc() on the result.
+ */
+xmlDocPtr ruby_libvirt_xml_parse(const char *xml)
+{
+    xmlDocPtr doc;
+
+    doc = xmlReadMemory(xml, strlen(xml), "libvirt.xml", NULL,
+                        XML_PARSE_NONET | XML_PARSE_NOERROR |
+                        XML_PARSE_NOWARNING | XML_PARSE_NOBLANKS);
+    if (doc != NULL && xmlDocGetRootElement(doc) == NULL) {
+        xmlFreeDoc(doc);
+        doc = NULL;
+    }
+
+    return doc;
+}
+
+int ruby_libvirt_xml_is(xmlNodePtr node, const char *name)
+{
+    if (node == NULL || node->type != XML_ELEMENT_NODE) {
+        return 0;
+    }
+    if (name == NULL) {
+        return 1;
+    }
+    return xmlStrEqual(node->name, (const xmlChar *)name);
+}
+
+xmlNodePtr ruby_libvirt_xml_child(xmlNodePtr parent, const char *name)
+{
+    xmlNodePtr cur;
+
+    ruby_libvirt_xml_foreach_child(parent, cur, name) {
+        return cur;
+    }
+
+    return NULL;
+}
+
+static VALUE xml_string_to_value(xmlChar *str)
+{
+    VALUE result;
+    int exception = 0;
+
+    if (str == NULL) {
+        return Qnil;
+    }
+    result = rb_protect(ruby_libvirt_str_new2_wrap, (VALUE)&str, &exception);
+    xmlFree(str);
+    if (exception) {
+        rb_jump_tag(exception);
+    }
+
+    return result;
+}
+
+static VALUE xml_string_to_num(VALUE str)
+{
+    const char *p;
+    long len;
+
+    if (NIL_P(str)) {
+        return Qnil;
+    }
+
+    p = RSTRING_PTR(str);
+    len = RSTRING_LEN(str);
+
+    /* PCI and USB IDs come back as "0x8086", everything else is decimal;
+     * anything that isn't a number is handed back as-is.
+     */
+    if (len > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') &&
+        strspn(p + 2, "0123456789abcdefABCDEF") == (size_t)(len - 2)) {
+        return rb_cstr2inum(p + 2, 16);
+    }
+    if (len > 0 && strspn(p, "0123456789") == (size_t)len) {
+        return rb_cstr2inum(p, 10);
+    }
+
+    return str;
+}
+
+/* Return the attribute NAME of NODE as a String, or nil if it isn't set. */
+VALUE ruby_libvirt_xml_prop(xmlNodePtr node, const char *name)
+{
+    if (node == NULL) {
+        return Qnil;
+    }
+
+    return xml_string_to_value(xmlGetProp(node, (const xmlChar *)name));
+}
+
+/* Return the attribute NAME of NODE as an Integer, or nil if it isn't set. */
+VALUE ruby_libvirt_xml_prop_num(xmlNodePtr node, const char *name)
+{
+    return xml_string_to_num(ruby_libvirt_xml_prop(node, name));
+}
+
+VALUE ruby_libvirt_xml_content(xmlNodePtr node)
+{
+    if (node == NULL) {
+        return Qnil;
+    }
+
+    return xml_string_to_value(xmlNodeGetContent(node));
+}
+
+VALUE ruby_libvirt_xml_content_num(xmlNodePtr node)
+{
+    return xml_string_to_num(ruby_libvirt_xml_content(node));
+}
+
+VALUE ruby_libvirt_xml_child_content(xmlNodePtr parent, const char *name)
+{
+    return ruby_libvirt_xml_content(ruby_libvirt_xml_child(parent, name));
+}
+
+/*
+ * The C string variants below do not touch any Ruby objects, so they can be
+ * used on worker threads without the GVL.  The strings they return must be
+ * released with free().
+ */
+static char *xml_string_to_cstr(xmlChar *str)
+{
+    char *result;
+
+    if (str == NULL) {
+        return NULL;
+    }
+    result = strdup((const char *)str);
+    xmlFree(str);
+
+    return result;
+}
+
+static int xml_cstr_to_int(char *str, int def)
+{
+    char *end;
+    long val;
+
+    if (str == NULL) {
+        return def;
+    }
+    val = strtol(str, &end, 0);
+    if (end == str || *end != '\0') {
+        val = def;
+    }
+    free(str);
+
+    return (int)val;
+}
+
+char *ruby_libvirt_xml_prop_cstr(xmlNodePtr node, const char *name)
+{
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return xml_string_to_cstr(xmlGetProp(node, (const xmlChar *)name));
+}
+
+int ruby_libvirt_xml_prop_int(xmlNodePtr node, const char *name, int def)
+{
+    return xml_cstr_to_int(ruby_libvirt_xml_prop_cstr(node, name), def);
+}
+
+char *ruby_libvirt_xml_child_content_cstr(xmlNodePtr parent, const char *name)
+{
+    xmlNodePtr node = ruby_libvirt_xml_child(parent, name);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return xml_string_to_cstr(xmlNodeGetContent(node));
+}
+
+int ruby_libvirt_xml_child_content_int(xmlNodePtr parent, const char *name,
+                                       int def)
+{
+    return xml_cstr_to_int(ruby_libvirt_xml_child_content_cstr(parent, name),
+                           def);
+}
+
+/* FNV-1a over STR (and a terminator, so that adjacent strings cannot run
+ * into each other)
+ */
+static unsigned long long xml_hash_str(unsigned long long h, const char *str)
+{
+    const unsigned char *p;
+
+    for (p = (const unsigned char *)str; p != NULL && *p != '\0'; p++) {
+        h = (h ^ *p) * 1099511628211ULL;
+    }
+
+    return (h ^ 0xff) * 1099511628211ULL;
+}
+
+static int xml_attr_cmp(const void *a, const void *b)
+{
+    return strcmp((const char *)(*(xmlAttrPtr *)a)->name,
+                  (const char *)(*(xmlAttrPtr *)b)->name);
+}
+
+static unsigned long long xml_hash_node(unsigned long long h, xmlNodePtr node,
+                                        const char *skip)
+{
+    xmlAttrPtr attr, *attrs;
+    xmlNodePtr cur;
+    xmlChar *val;
+    const char *start, *end;
+    int nattrs = 0, i;
+
+    h = xml_hash_str(h, (const char *)node->name);
+
+    /* attributes in name order, since their order carries no meaning */
+    for (attr = node->properties; attr != NULL; attr = attr->next) {
+        nattrs++;
+    }
+    attrs = malloc(sizeof(xmlAttrPtr) * (nattrs + 1));
+    if (attrs != NULL) {
+        for (attr = node->properties, i = 0; attr != NULL;
+             attr = attr->next, i++) {
+            attrs[i] = attr;
+        }
+        qsort(attrs, nattrs, sizeof(xmlAttrPtr), xml_attr_cmp);
+        for (i = 0; i < nattrs; i++) {
+            val = xmlNodeListGetString(node->doc, attrs[i]->children, 1);
+            h = xml_hash_str(h, (const char *)attrs[i]->name);
+            h = xml_hash_str(h, (const char *)val);
+            xmlFree(val);
+        }
+        free(attrs);
+    }
+
+    for (cur = node->children; cur != NULL; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            if (skip == NULL || !ruby_libvirt_xml_is(cur, skip)) {
+                h = xml_hash_node(h, cur, NULL);
+            }
+        }
+        else if ((cur->type == XML_TEXT_NODE ||
+                  cur->type == XML_CDATA_SECTION_NODE) &&
+                 cur->content != NULL) {
+            /* ignore surrounding whitespace */
+            start = (const char *)cur->content;
+            while (*start == ' ' || *start == '\t' || *start == '\n' ||
+                   *start == '\r') {
+                start++;
+            }
+            end = start + strlen(start);
+            while (end > start && (end[-1] == ' ' || end[-1] == '\t' ||
+                                   end[-1] == '\n' || end[-1] == '\r')) {
+                end--;
+            }
+            for (; start < end; start++) {
+                h = (h ^ (unsigned char)*start) * 1099511628211ULL;
+            }
+        }
+    }
+
+    return xml_hash_str(h, "/");
+}
+
+/* Return a hash of the structure of NODE that does not depend on whitespace
+ * or attribute order, leaving out the direct children of NODE called SKIP
+ * (if not NULL).  Safe to call without the GVL.
+ */
+unsigned long long ruby_libvirt_xml_hash(xmlNodePtr node, const char *skip)
+{
+    return xml_hash_node(14695981039346656037ULL, node, skip);
+}
+
+static int deep_freeze_hash_entry(VALUE key, VALUE val,
+                                  VALUE RUBY_LIBVIRT_UNUSED(arg))
+{
+    ruby_libvirt_deep_freeze(key);
+    ruby_libvirt_deep_freeze(val);
+
+    return ST_CONTINUE;
+}
+
+/* Freeze OBJ and everything reachable from it through Arrays and Hashes. */
+VALUE ruby_libvirt_deep_freeze(VALUE obj)
+{
+    long i;
+
+    switch (TYPE(obj)) {
+    case T_ARRAY:
+        for (i = 0; i < RARRAY_LEN(obj); i++) {
+            ruby_libvirt_deep_freeze(rb_ary_entry(obj, i));
+        }
+        break;
+    case T_HASH:
+        rb_hash_foreach(obj, deep_freeze_hash_entry, Qnil);
+        break;
+    default:
+        break;
+    }
+
+    return rb_obj_freeze(obj);
+}
+
+#endif
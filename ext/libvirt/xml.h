@@ -0,0 +1,38 @@
+#ifndef XML_H
+#define XML_H
+
+#if HAVE_LIBXML_PARSER_H
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+xmlDocPtr ruby_libvirt_xml_parse(const char *xml);
+
+xmlNodePtr ruby_libvirt_xml_child(xmlNodePtr parent, const char *name);
+int ruby_libvirt_xml_is(xmlNodePtr node, const char *name);
+
+VALUE ruby_libvirt_xml_prop(xmlNodePtr node, const char *name);
+VALUE ruby_libvirt_xml_prop_num(xmlNodePtr node, const char *name);
+VALUE ruby_libvirt_xml_content(xmlNodePtr node);
+VALUE ruby_libvirt_xml_content_num(xmlNodePtr node);
+VALUE ruby_libvirt_xml_child_content(xmlNodePtr parent, const char *name);
+
+char *ruby_libvirt_xml_prop_cstr(xmlNodePtr node, const char *name);
+int ruby_libvirt_xml_prop_int(xmlNodePtr node, const char *name, int def);
+char *ruby_libvirt_xml_child_content_cstr(xmlNodePtr parent, const char *name);
+int ruby_libvirt_xml_child_content_int(xmlNodePtr parent, const char *name,
+                                       int def);
+
+unsigned long long ruby_libvirt_xml_hash(xmlNodePtr node, const char *skip);
+
+VALUE ruby_libvirt_deep_freeze(VALUE obj);
+
+/* Iterate over the element children of PARENT called NAME (or all of the
+ * element children, if NAME is NULL).
+ */
+#define ruby_libvirt_xml_foreach_child(parent, cur, name)               \
+    for (cur = (parent) ? (parent)->children : NULL; cur != NULL;       \
+         cur = cur->next)                                               \
+        if (ruby_libvirt_xml_is(cur, name))
+#endif
+
+#endif
@@ -0,0 +1,251 @@
+# A private libvirtd, backed by the test driver, reached through a UNIX
+# socket proxy that can delay or fail individual RPCs.  This lets the
+# concurrency, GVL release, timeout and reconnect behaviour of the bindings
+# be tested and benchmarked without a real hypervisor:
+#
+#   fixture = LibvirtdFixture.new(:latency => 0.05)
+#   fixture.start
+#   conn = Libvirt::open(fixture.uri)
+#   fixture.set_latency(0.2, 16)          # slow down one procedure
+#   fixture.inject_failure(23, :every => 3)
+#   ...
+#   fixture.stop
+#
+# Procedures are identified by their number in libvirt's
+# src/remote/remote_protocol.x (REMOTE_PROC_*).  If :upstream is given no
+# daemon is started and the proxy forwards to that socket instead.
+
+require 'socket'
+require 'tmpdir'
+require 'fileutils'
+
+class LibvirtdFixture
+  REMOTE_PROGRAM = 0x20008086
+
+  # message types and status from src/rpc/virnetprotocol.x
+  MESSAGE_CALL = 0
+  MESSAGE_REPLY = 1
+  STATUS_ERROR = 1
+
+  # virErrorNumber / virErrorDomain / virErrorLevel used for injected errors
+  ERR_OPERATION_FAILED = 9
+  FROM_TEST = 12
+  ERR_ERROR = 2
+
+  attr_reader :dir, :socket_path, :calls
+
+  def initialize(opts = {})
+    @latency = { nil => (opts[:latency] || 0) }
+    @failures = {}
+    @calls = Hash.new(0)
+    @lock = Mutex.new
+    @upstream = opts[:upstream]
+    @daemon = opts[:daemon] || ENV['RUBY_LIBVIRT_LIBVIRTD'] || 'libvirtd'
+    @driver_uri = opts[:driver_uri] || 'test:///default'
+    @pid = nil
+    @server = nil
+    @threads = []
+  end
+
+  # The URI to pass to Libvirt::open to go through the proxy.
+  def uri
+    scheme, path = @driver_uri.split('://', 2)
+    "#{scheme}+unix://#{path}?socket=#{@socket_path}"
+  end
+
+  # The URI to pass to Libvirt::Admin::open to reach the daemon's admin
+  # server.  Admin calls are not proxied, so latency and failures do not
+  # apply to them; this is only known when the fixture started the daemon.
+  def admin_uri
+    return nil if @pid.nil?
+    path = Process.uid == 0 ? '/system' : '/session'
+    "libvirtd://#{path}?socket=#{File.join(@dir, 'libvirt-admin-sock')}"
+  end
+
+  def self.available?(daemon = ENV['RUBY_LIBVIRT_LIBVIRTD'] || 'libvirtd')
+    ENV['PATH'].split(File::PATH_SEPARATOR).any? do |d|
+      File.executable?(File.join(d, daemon))
+    end || File.executable?(daemon)
+  end
+
+  def start
+    @dir = Dir.mktmpdir('rb-libvirt-fixture')
+    @upstream ||= start_daemon
+    @socket_path = File.join(@dir, 'proxy-sock')
+    @server = UNIXServer.new(@socket_path)
+    @threads << Thread.new { accept_loop }
+    self
+  end
+
+  def stop
+    @server.close if @server && !@server.closed?
+    @threads.each { |t| t.kill }
+    @threads.clear
+    if @pid
+      Process.kill('TERM', @pid) rescue nil
+      Process.wait(@pid) rescue nil
+      @pid = nil
+    end
+    FileUtils.rm_rf(@dir) if @dir
+  end
+
+  # Delay calls to procedure PROC (or every procedure without a setting of
+  # its own, if PROC is nil) by SECONDS before forwarding them.
+  def set_latency(seconds, proc = nil)
+    @lock.synchronize { @latency[proc] = seconds }
+  end
+
+  # Make every Nth call (:every, default 1) to procedure PROC (nil for all)
+  # fail.  :mode is :error to answer with a libvirt error without reaching
+  # the daemon, :drop to swallow the call so the client waits forever, or
+  # :disconnect to close the client's connection.  :count limits how many
+  # failures are injected.
+  def inject_failure(proc, opts = {})
+    @lock.synchronize do
+      @failures[proc] = { :every => opts[:every] || 1,
+                          :mode => opts[:mode] || :error,
+                          :count => opts[:count], :seen => 0 }
+    end
+  end
+
+  def clear_failures
+    @lock.synchronize { @failures.clear }
+  end
+
+  # Run the block and return the procedure numbers it called, so tests can
+  # target a method's RPC without hard-coding remote_protocol.x numbers.
+  def procedures_used
+    before = @lock.synchronize { @calls.dup }
+    yield
+    @lock.synchronize { @calls.keys.select { |k| @calls[k] != before[k] } }
+  end
+
+  private
+
+  def start_daemon
+    conf = File.join(@dir, 'libvirtd.conf')
+    File.write(conf, <<EOF)
+listen_tls = 0
+listen_tcp = 0
+unix_sock_dir = "#{@dir}"
+unix_sock_rw_perms = "0700"
+auth_unix_ro = "none"
+auth_unix_rw = "none"
+EOF
+    env = { 'XDG_RUNTIME_DIR' => @dir, 'XDG_CONFIG_HOME' => @dir,
+            'XDG_CACHE_HOME' => @dir }
+    @pid = Process.spawn(env, @daemon, '--config', conf, '--pid-file',
+                         File.join(@dir, 'libvirtd.pid'),
+                         [:out, :err] => File.join(@dir, 'libvirtd.log'))
+    sock = File.join(@dir, 'libvirt-sock')
+    100.times do
+      return sock if File.socket?(sock)
+      sleep 0.05
+    end
+    raise "libvirtd did not create #{sock}; see #{@dir}/libvirtd.log"
+  end
+
+  def accept_loop
+    loop do
+      client = @server.accept
+      upstream = UNIXSocket.new(@upstream)
+      client_lock, upstream_lock = Mutex.new, Mutex.new
+      @threads << Thread.new { pump_calls(client, upstream, client_lock,
+                                          upstream_lock) }
+      @threads << Thread.new { pump(upstream, client, client_lock) }
+    end
+  rescue IOError, SystemCallError
+  end
+
+  def read_message(sock)
+    len = sock.read(4)
+    return nil if len.nil? || len.bytesize < 4
+    body = sock.read(len.unpack('N')[0] - 4)
+    return nil if body.nil?
+    len + body
+  end
+
+  def pump(from, to, to_lock)
+    while msg = read_message(from)
+      to_lock.synchronize { to.write(msg) }
+    end
+  rescue IOError, SystemCallError
+  ensure
+    from.close rescue nil
+    to.close rescue nil
+  end
+
+  # Forward calls from the client, applying latency and failures.  Each
+  # delayed call waits on a thread of its own, so calls that libvirt
+  # multiplexes over one connection still overlap as they would against a
+  # real daemon with several workers.
+  def pump_calls(client, upstream, client_lock, upstream_lock)
+    while msg = read_message(client)
+      prog, vers, proc, type, serial = msg[4, 20].unpack('N5')
+      delay, failure = 0, nil
+      if prog == REMOTE_PROGRAM && type == MESSAGE_CALL
+        delay, failure = decide(proc)
+      end
+      if delay == 0 && failure.nil?
+        upstream_lock.synchronize { upstream.write(msg) }
+        next
+      end
+      Thread.new(msg) do |m|
+        begin
+          sleep delay if delay > 0
+          case failure
+          when :error
+            reply = error_reply(prog, vers, proc, serial)
+            client_lock.synchronize { client.write(reply) }
+          when :drop
+          when :disconnect
+            client.close rescue nil
+            upstream.close rescue nil
+          else
+            upstream_lock.synchronize { upstream.write(m) }
+          end
+        rescue IOError, SystemCallError
+        end
+      end
+    end
+  rescue IOError, SystemCallError
+  ensure
+    client.close rescue nil
+    upstream.close rescue nil
+  end
+
+  def decide(proc)
+    @lock.synchronize do
+      @calls[proc] += 1
+      delay = @latency.fetch(proc, @latency[nil])
+      f = @failures[proc] || @failures[nil]
+      failure = nil
+      if f && (f[:count].nil? || f[:count] > 0)
+        f[:seen] += 1
+        if f[:seen] % f[:every] == 0
+          failure = f[:mode]
+          f[:count] -= 1 if f[:count]
+        end
+      end
+      [delay, failure]
+    end
+  end
+
+  def xdr_string(str)
+    pad = (4 - str.bytesize % 4) % 4
+    [str.bytesize].pack('N') + str + "\0" * pad
+  end
+
+  # An error reply carrying a remote_error struct, as libvirtd would send
+  def error_reply(prog, vers, proc, serial)
+    message = "injected failure in procedure #{proc}"
+    body = [ERR_OPERATION_FAILED, FROM_TEST].pack('N2') +
+      [1].pack('N') + xdr_string(message) +   # message
+      [ERR_ERROR].pack('N') +                 # level
+      [0, 0, 0, 0].pack('N4') +               # dom, str1, str2, str3
+      [0, 0].pack('N2') +                     # int1, int2
+      [0].pack('N')                           # net
+    header = [prog, vers, proc, MESSAGE_REPLY, serial, STATUS_ERROR].pack('N6')
+    [4 + header.bytesize + body.bytesize].pack('N') + header + body
+  end
+end
@@ -0,0 +1,155 @@
+#!/usr/bin/ruby
+
+# Test the admin methods the bindings support, against a private libvirtd
+
+$: << File.dirname(__FILE__)
+
+require 'libvirt'
+require 'test_utils.rb'
+require 'libvirtd_fixture.rb'
+
+set_test_object("admin")
+
+if not defined?(Libvirt::Admin)
+  puts_skipped "Libvirt::Admin not built; libvirt-admin.h was not found"
+  finish_tests
+  exit
+end
+
+if not LibvirtdFixture.available?
+  puts_skipped "libvirtd not found; admin tests need it in PATH or RUBY_LIBVIRT_LIBVIRTD"
+  finish_tests
+  exit
+end
+
+fixture = LibvirtdFixture.new.start
+
+# TESTGROUP: Libvirt::Admin::open
+expect_too_many_args(Libvirt::Admin, "open", 1, 2, 3)
+expect_invalid_arg_type(Libvirt::Admin, "open", 1)
+expect_invalid_arg_type(Libvirt::Admin, "open", fixture.admin_uri, "foo")
+expect_fail(Libvirt::Admin, Libvirt::ConnectionError, "bad socket", "open",
+            fixture.admin_uri + "-missing")
+
+adm = expect_success(Libvirt::Admin, "uri arg", "open", fixture.admin_uri)
+
+# TESTGROUP: adm.alive?
+set_test_object("admin_connect")
+expect_too_many_args(adm, "alive?", 1)
+expect_success(adm, "no args", "alive?") {|x| x == true}
+
+# TESTGROUP: adm.uri
+expect_too_many_args(adm, "uri", 1)
+expect_success(adm, "no args", "uri") {|x| x.start_with?("libvirtd://")}
+
+# TESTGROUP: adm.lib_version
+expect_too_many_args(adm, "lib_version", 1)
+expect_success(adm, "no args", "lib_version") {|x| x > 0}
+
+# TESTGROUP: adm.list_servers
+expect_too_many_args(adm, "list_servers", 1, 2)
+expect_invalid_arg_type(adm, "list_servers", "foo")
+expect_success(adm, "no args", "list_servers") {|x| x.map {|s| s.name}.include?("libvirtd")}
+
+# TESTGROUP: adm.lookup_server
+expect_too_many_args(adm, "lookup_server", 1, 2, 3)
+expect_too_few_args(adm, "lookup_server")
+expect_invalid_arg_type(adm, "lookup_server", 1)
+expect_fail(adm, Libvirt::RetrieveError, "unknown server", "lookup_server", "rb-libvirt-test")
+srv = expect_success(adm, "name arg", "lookup_server", "libvirtd") {|x| x.name == "libvirtd"}
+
+# TESTGROUP: server.thread_pool_parameters
+set_test_object("admin_server")
+expect_too_many_args(srv, "thread_pool_parameters", 1, 2)
+expect_invalid_arg_type(srv, "thread_pool_parameters", "foo")
+pool = expect_success(srv, "no args", "thread_pool_parameters") {|x| x.has_key?(Libvirt::Admin::THREADPOOL_WORKERS_MAX)}
+
+# TESTGROUP: server.thread_pool_parameters=
+expect_too_many_args(srv, "thread_pool_parameters=", 1, 2)
+expect_invalid_arg_type(srv, "thread_pool_parameters=", 1)
+expect_invalid_arg_type(srv, "thread_pool_parameters=", [{}, "foo"])
+expect_fail(srv, ArgumentError, "read-only key", "thread_pool_parameters=",
+            {Libvirt::Admin::THREADPOOL_WORKERS_FREE => 1})
+
+maxw = pool[Libvirt::Admin::THREADPOOL_WORKERS_MAX] + 1
+expect_success(srv, "workers max", "thread_pool_parameters=",
+               {Libvirt::Admin::THREADPOOL_WORKERS_MAX => maxw})
+if srv.thread_pool_parameters[Libvirt::Admin::THREADPOOL_WORKERS_MAX] == maxw
+  puts_ok "admin_server.thread_pool_parameters= changed the pool"
+else
+  puts_fail "admin_server.thread_pool_parameters= did not change the pool"
+end
+
+# TESTGROUP: server.client_limits
+expect_too_many_args(srv, "client_limits", 1, 2)
+expect_invalid_arg_type(srv, "client_limits", "foo")
+limits = expect_success(srv, "no args", "client_limits") {|x| x[Libvirt::Admin::SERVER_CLIENTS_CURRENT] >= 0}
+
+# TESTGROUP: server.client_limits=
+expect_too_many_args(srv, "client_limits=", 1, 2)
+expect_invalid_arg_type(srv, "client_limits=", 1)
+expect_fail(srv, ArgumentError, "unknown key", "client_limits=", {"foo" => 1})
+
+maxc = limits[Libvirt::Admin::SERVER_CLIENTS_MAX] + 1
+expect_success(srv, "clients max", "client_limits=",
+               [{Libvirt::Admin::SERVER_CLIENTS_MAX => maxc}, 0])
+if srv.client_limits[Libvirt::Admin::SERVER_CLIENTS_MAX] == maxc
+  puts_ok "admin_server.client_limits= changed the limit"
+else
+  puts_fail "admin_server.client_limits= did not change the limit"
+end
+
+# TESTGROUP: server.list_clients
+conn = Libvirt::open(fixture.uri)
+
+expect_too_many_args(srv, "list_clients", 1, 2)
+expect_invalid_arg_type(srv, "list_clients", "foo")
+clients = expect_success(srv, "no args", "list_clients") {|x| x.length >= 1}
+
+# TESTGROUP: server.lookup_client
+expect_too_many_args(srv, "lookup_client", 1, 2, 3)
+expect_too_few_args(srv, "lookup_client")
+expect_invalid_arg_type(srv, "lookup_client", "foo")
+expect_fail(srv, Libvirt::RetrieveError, "unknown id", "lookup_client", 2**40)
+client = expect_success(srv, "id arg", "lookup_client", clients[0].id) {|x| x.id == clients[0].id}
+
+# TESTGROUP: client.transport
+set_test_object("admin_client")
+expect_too_many_args(client, "transport", 1)
+expect_success(client, "no args", "transport") {|x| x == Libvirt::Admin::Client::TRANSPORT_UNIX}
+
+# TESTGROUP: client.timestamp
+expect_too_many_args(client, "timestamp", 1)
+expect_success(client, "no args", "timestamp") {|x| x <= Time.now.to_i}
+
+# TESTGROUP: client.info
+expect_too_many_args(client, "info", 1, 2)
+expect_invalid_arg_type(client, "info", "foo")
+expect_success(client, "no args", "info") {|x| x.has_key?("readonly")}
+
+# TESTGROUP: client.close
+expect_too_many_args(client, "close", 1, 2)
+expect_invalid_arg_type(client, "close", "foo")
+expect_success(client, "no args", "close")
+
+# TESTGROUP: client.free
+expect_too_many_args(client, "free", 1)
+expect_success(client, "no args", "free")
+
+# TESTGROUP: server.free
+set_test_object("admin_server")
+expect_too_many_args(srv, "free", 1)
+expect_success(srv, "no args", "free")
+
+# TESTGROUP: adm.close
+set_test_object("admin_connect")
+expect_too_many_args(adm, "close", 1)
+expect_success(adm, "no args", "close")
+expect_success(adm, "after close", "closed?") {|x| x == true}
+
+# END TESTS
+
+conn.close rescue nil
+fixture.stop
+
+finish_tests
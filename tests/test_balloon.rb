@@ -0,0 +1,63 @@
+#!/usr/bin/ruby
+
+# Test the balloon controller.  Note that this tester requires the qemu
+# driver to be enabled and available for use.
+
+$: << File.dirname(__FILE__)
+
+require 'libvirt'
+require 'test_utils.rb'
+
+set_test_object("balloon_controller")
+
+if not defined?(Libvirt::BalloonController)
+  puts_skipped "Libvirt::BalloonController not built; virConnectGetAllDomainStats or pthreads were not found"
+  finish_tests
+  exit
+end
+
+conn = Libvirt::open("qemu:///system")
+
+cleanup_test_domain(conn)
+
+# setup for later tests
+`qemu-img create -f qcow2 #{$GUEST_DISK} 5G`
+
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+newdom.memory_stats_period = 1
+
+# TESTGROUP: Libvirt::BalloonController::new
+ctl = expect_controller_new(Libvirt::BalloonController, conn, 20, 40, 1024)
+expect_invalid_arg_type(Libvirt::BalloonController, "new", conn, "foo")
+expect_invalid_arg_type(Libvirt::BalloonController, "new", conn, 20, "foo")
+expect_invalid_arg_type(Libvirt::BalloonController, "new", conn, 20, 40, "foo")
+expect_fail(Libvirt::BalloonController, ArgumentError, "min above max", "new", conn, 50, 40)
+expect_fail(Libvirt::BalloonController, ArgumentError, "max of 100", "new", conn, 20, 100)
+
+# TESTGROUP: ctl.policy
+expect_too_many_args(ctl, "policy", 1)
+expect_success(ctl, "no args", "policy") {|x| x["min_free_percent"] == 20 and x["max_reclaim_rate"] == 1024 and x["interval"] == 0.5}
+
+# TESTGROUP: ctl.set_policy
+expect_too_many_args(ctl, "set_policy", 1, 2, 3, 4)
+expect_too_few_args(ctl, "set_policy", 1)
+expect_invalid_arg_type(ctl, "set_policy", "foo", 40)
+expect_invalid_arg_type(ctl, "set_policy", 20, 40, "foo")
+expect_fail(ctl, ArgumentError, "min above max", "set_policy", 50, 40)
+expect_success(ctl, "min and max", "set_policy", 10, 30)
+if ctl.policy["max_free_percent"] == 30 and ctl.policy["max_reclaim_rate"] == 0
+  puts_ok "balloon_controller.set_policy changed the policy"
+else
+  puts_fail "balloon_controller.set_policy did not change the policy"
+end
+
+expect_controller_lifecycle(ctl, newdom)
+
+newdom.destroy
+
+# END TESTS
+
+conn.close
+
+finish_tests
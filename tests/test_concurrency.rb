@@ -0,0 +1,112 @@
+#!/usr/bin/ruby
+
+# Test concurrency, GVL release, failure and reconnect behaviour against a
+# private libvirtd (test driver) behind a latency-injecting proxy
+
+$: << File.dirname(__FILE__)
+
+require 'libvirt'
+require 'test_utils.rb'
+require 'libvirtd_fixture.rb'
+
+set_test_object("conn")
+
+if not LibvirtdFixture.available?
+  puts_skipped "libvirtd not found; concurrency tests need it in PATH or RUBY_LIBVIRT_LIBVIRTD"
+  finish_tests
+  exit
+end
+
+fixture = LibvirtdFixture.new.start
+conn = Libvirt::open(fixture.uri)
+
+num_of_domains = fixture.procedures_used { conn.num_of_domains }
+
+# TESTGROUP: latency
+fixture.set_latency(0.2)
+start = Time.now
+expect_success(conn, "with injected latency", "num_of_domains") {|x| Time.now - start >= 0.2}
+
+# TESTGROUP: thread scaling
+keys = (1..8).map {|i| "%08d-0000-0000-0000-000000000000" % i}
+
+start = Time.now
+conn.secret_values(keys, 1)
+serial = Time.now - start
+
+ticks = 0
+ticker = Thread.new { loop { ticks += 1; sleep 0.01 } }
+start = Time.now
+expect_success(conn, "parallel with injected latency", "secret_values", keys, 8) {|x| x.length == 8}
+parallel = Time.now - start
+ticker.kill
+
+if parallel * 2 < serial
+  puts_ok "conn.secret_values scaled with concurrency (#{serial} s serial, #{parallel} s parallel)"
+else
+  puts_fail "conn.secret_values did not scale with concurrency (#{serial} s serial, #{parallel} s parallel)"
+end
+if ticks > 10
+  puts_ok "conn.secret_values released the GVL while waiting"
+else
+  puts_fail "conn.secret_values held the GVL while waiting"
+end
+
+# TESTGROUP: injected failure
+fixture.set_latency(0)
+fixture.inject_failure(num_of_domains[0], :count => 1)
+expect_fail(conn, Libvirt::RetrieveError, "injected error", "num_of_domains")
+expect_success(conn, "after injected error", "num_of_domains")
+
+# TESTGROUP: reconnect
+# the close callback behind conn.health needs an event loop running before
+# the connection is opened
+Libvirt::native_event_loop_start
+conn.close
+conn = Libvirt::open(fixture.uri)
+conn.monitor_liveness(1, 3)
+
+# a reply that never comes leaves the call waiting, without holding up
+# other threads
+fixture.inject_failure(num_of_domains[0], :mode => :drop, :count => 1)
+pending = Thread.new { conn.num_of_domains }
+if pending.join(1).nil?
+  puts_ok "conn.num_of_domains waits for a dropped reply"
+else
+  puts_fail "conn.num_of_domains returned without a reply"
+end
+
+# losing the connection fails both the waiting call and the next one
+fixture.inject_failure(num_of_domains[0], :mode => :disconnect, :count => 1)
+expect_fail(conn, Libvirt::RetrieveError, "lost connection", "num_of_domains")
+begin
+  pending.value
+  puts_fail "conn.num_of_domains waiting for a dropped reply succeeded after the connection was lost"
+rescue Libvirt::RetrieveError
+  puts_ok "conn.num_of_domains waiting for a dropped reply threw Libvirt::RetrieveError once the connection was lost"
+end
+
+50.times do
+  break if conn.health["state"] == Libvirt::Connect::HEALTH_DEAD
+  sleep 0.1
+end
+expect_success(conn, "after lost connection", "alive?") {|x| x == false}
+expect_success(conn, "after lost connection", "health") {|x| x["state"] == Libvirt::Connect::HEALTH_DEAD and x["reason"] == Libvirt::Connect::CLOSE_REASON_EOF}
+# the connection is not reopened by itself, as it would be after a fork
+expect_success(conn, "after lost connection", "stale?") {|x| x == false}
+expect_fail(conn, Libvirt::RetrieveError, "lost connection", "num_of_domains")
+
+# TESTGROUP: conn.reopen
+expect_too_many_args(conn, "reopen", 1)
+expect_success(conn, "after lost connection", "reopen")
+expect_success(conn, "after reopen", "alive?") {|x| x == true}
+expect_success(conn, "after reopen", "health") {|x| x["state"] == Libvirt::Connect::HEALTH_UNKNOWN}
+expect_success(conn, "after reopen", "num_of_domains")
+
+# END TESTS
+
+conn.close
+Libvirt::native_event_loop_stop
+fixture.stop
+
+finish_tests
@@ -5,6 +5,7 @@
 $: << File.dirname(__FILE__)
 
 require 'libvirt'
+require 'timeout'
 require 'test_utils.rb'
 
 set_test_object("connect")
@@ -811,6 +812,429 @@ expect_invalid_arg_type(conn, "keepalive=", [1, 'foo'])
 # FIXME: somehow we need an event loop implementation for this to work
 #expect_success(conn, "interval and count", "keepalive=", 1, 10)
 
+# TESTGROUP: conn.capabilities_model
+expect_too_many_args(conn, "capabilities_model", 1, 2)
+expect_success(conn, "no args", "capabilities_model") {|x| x.frozen? and x.has_key?("host") and x.has_key?("guests")}
+expect_success(conn, "refresh", "capabilities_model", true)
+
+# TESTGROUP: conn.dhcp_lease_index
+expect_too_many_args(conn, "dhcp_lease_index", 1, 2)
+expect_invalid_arg_type(conn, "dhcp_lease_index", 'foo')
+expect_success(conn, "no args", "dhcp_lease_index") {|x| x.lookup_by_mac("52:54:00:00:00:01").class == Array}
+expect_success(conn, "concurrency", "dhcp_lease_index", 2) {|x| x.refresh(true) >= 0}
+
+# TESTGROUP: conn.detach_node_devices
+expect_too_few_args(conn, "detach_node_devices")
+expect_too_many_args(conn, "detach_node_devices", [], nil, 0, 0, 1)
+expect_invalid_arg_type(conn, "detach_node_devices", 1)
+expect_invalid_arg_type(conn, "detach_node_devices", [1])
+expect_invalid_arg_type(conn, "detach_node_devices", [], 1)
+expect_invalid_arg_type(conn, "detach_node_devices", [], nil, 'foo')
+expect_invalid_arg_type(conn, "detach_node_devices", [], nil, 0, 'foo')
+expect_success(conn, "empty list", "detach_node_devices", []) {|x| x.empty?}
+expect_success(conn, "unknown device", "detach_node_devices", ["foo-bar-baz"]) {|x| x[0]["error"].kind_of?(Libvirt::RetrieveError)}
+
+# TESTGROUP: conn.reattach_node_devices
+expect_too_few_args(conn, "reattach_node_devices")
+expect_too_many_args(conn, "reattach_node_devices", [], 0, 1)
+expect_invalid_arg_type(conn, "reattach_node_devices", 1)
+expect_invalid_arg_type(conn, "reattach_node_devices", [], 'foo')
+expect_success(conn, "unknown device", "reattach_node_devices", ["foo-bar-baz"]) {|x| x[0]["name"] == "foo-bar-baz" and x[0]["error"]}
+
+# TESTGROUP: conn.nodedevice_inventory
+expect_too_many_args(conn, "nodedevice_inventory", 0, 0, 1)
+expect_invalid_arg_type(conn, "nodedevice_inventory", 'foo')
+expect_invalid_arg_type(conn, "nodedevice_inventory", 0, 'foo')
+expect_success(conn, "no args", "nodedevice_inventory") {|x| x["name"].length == conn.list_all_nodedevices.length}
+expect_success(conn, "flags", "nodedevice_inventory", Libvirt::Connect::LIST_NODE_DEVICES_CAP_PCI_DEV) {|x| x["caps"].all? {|c| c.include?("pci")}}
+
+# TESTGROUP: conn.storage_capacity_report
+expect_too_many_args(conn, "storage_capacity_report", true, 0, 0, 1)
+expect_invalid_arg_type(conn, "storage_capacity_report", false, 'foo')
+expect_invalid_arg_type(conn, "storage_capacity_report", false, 0, 'foo')
+expect_success(conn, "no args", "storage_capacity_report") {|x| x["name"].length == conn.list_all_storage_pools.length and not x.has_key?("overcommit")}
+expect_success(conn, "include_volumes", "storage_capacity_report", true) {|x| x["overcommit"].length == x["name"].length and x["totals"]["volumes"] == x["volumes"].inject(0, :+)}
+expect_success(conn, "flags", "storage_capacity_report", false, Libvirt::Connect::LIST_STORAGE_POOLS_ACTIVE) {|x| x["state"].all? {|s| s == Libvirt::StoragePool::RUNNING}}
+
+# TESTGROUP: conn.secret_values
+newsecret = conn.define_secret_xml($new_secret_xml)
+newsecret.value = "a secret value"
+
+expect_too_many_args(conn, "secret_values", [], 1, 2)
+expect_too_few_args(conn, "secret_values")
+expect_invalid_arg_type(conn, "secret_values", 1)
+expect_invalid_arg_type(conn, "secret_values", [1])
+expect_invalid_arg_type(conn, "secret_values", [[1, 2]])
+expect_invalid_arg_type(conn, "secret_values", [], 'foo')
+expect_fail(conn, ArgumentError, "bad usage pair", "secret_values", [[Libvirt::Secret::USAGE_TYPE_VOLUME]])
+
+expect_success(conn, "uuid and usage", "secret_values", [$SECRET_UUID, [Libvirt::Secret::USAGE_TYPE_VOLUME, "/var/lib/libvirt/images/mail.img"]]) {|x| x.all? {|r| r["uuid"] == $SECRET_UUID and r["value"].use {|v| v == "a secret value"}}}
+expect_success(conn, "invalid secret", "secret_values", [[Libvirt::Secret::USAGE_TYPE_VOLUME, "foo"]]) {|x| x[0]["value"].nil? and x[0]["error"].class == Libvirt::RetrieveError}
+
+value = conn.secret_values([$SECRET_UUID])[0]["value"]
+expect_success(value, "no args", "bytesize") {|x| x == "a secret value".length}
+value.clear
+expect_success(value, "no args", "cleared?") {|x| x == true}
+expect_fail(value, ArgumentError, "cleared value", "to_s")
+
+newsecret.undefine
+
+# TESTGROUP: conn.sync_nwfilters
+expect_too_many_args(conn, "sync_nwfilters", [], 1, 2)
+expect_too_few_args(conn, "sync_nwfilters")
+expect_invalid_arg_type(conn, "sync_nwfilters", 1)
+expect_invalid_arg_type(conn, "sync_nwfilters", [1])
+expect_invalid_arg_type(conn, "sync_nwfilters", [], 'foo')
+
+expect_success(conn, "new filter", "sync_nwfilters", [$new_nwfilter_xml]) {|x| x["created"] == ["rb-libvirt-test"]}
+expect_success(conn, "same filter", "sync_nwfilters", [$new_nwfilter_xml]) {|x| x["unchanged"] == ["rb-libvirt-test"]}
+expect_success(conn, "changed filter", "sync_nwfilters", [$new_nwfilter_xml.sub("63000", "63001")]) {|x| x["updated"] == ["rb-libvirt-test"]}
+expect_success(conn, "invalid XML", "sync_nwfilters", ["hello"]) {|x| x["errors"][0].class == Libvirt::DefinitionError}
+
+conn.lookup_nwfilter_by_name("rb-libvirt-test").undefine
+
+# TESTGROUP: conn.list_all_nwfilter_bindings
+expect_too_many_args(conn, "list_all_nwfilter_bindings", 1, 2)
+expect_invalid_arg_type(conn, "list_all_nwfilter_bindings", "foo")
+
+expect_success(conn, "no args", "list_all_nwfilter_bindings")
+
+# TESTGROUP: conn.lookup_nwfilter_binding_by_port_dev
+expect_too_many_args(conn, "lookup_nwfilter_binding_by_port_dev", 1, 2)
+expect_too_few_args(conn, "lookup_nwfilter_binding_by_port_dev")
+expect_invalid_arg_type(conn, "lookup_nwfilter_binding_by_port_dev", 1)
+expect_fail(conn, Libvirt::RetrieveError, "non-existent port", "lookup_nwfilter_binding_by_port_dev", "rb-libvirt-none")
+
+# TESTGROUP: conn.create_nwfilter_binding_xml
+expect_too_many_args(conn, "create_nwfilter_binding_xml", 1, 2, 3)
+expect_too_few_args(conn, "create_nwfilter_binding_xml")
+expect_invalid_arg_type(conn, "create_nwfilter_binding_xml", 1)
+expect_invalid_arg_type(conn, "create_nwfilter_binding_xml", "foo", "bar")
+expect_fail(conn, Libvirt::Error, "invalid XML", "create_nwfilter_binding_xml", "hello")
+
+# TESTGROUP: conn.interface_transaction
+expect_too_many_args(conn, "interface_transaction", 1, 2)
+expect_invalid_arg_type(conn, "interface_transaction", 'foo')
+
+begin
+  conn.interface_transaction
+  puts_fail "conn.interface_transaction with no block did not raise"
+rescue LocalJumpError
+  puts_ok "conn.interface_transaction with no block raised LocalJumpError"
+rescue NoMethodError
+  puts_skipped "conn.interface_transaction does not exist"
+end
+
+begin
+  res = conn.interface_transaction {|tx| }
+  if res["committed"]
+    puts_ok "conn.interface_transaction empty transaction committed"
+  else
+    puts_fail "conn.interface_transaction empty transaction did not commit"
+  end
+
+  saved = nil
+  res = conn.interface_transaction {|tx| saved = tx; tx.create("rb-libvirt-none") }
+  if !res["committed"] and res["failed"] == 0 and res["rolled_back"]
+    puts_ok "conn.interface_transaction failing operation rolled back"
+  else
+    puts_fail "conn.interface_transaction failing operation did not roll back"
+  end
+
+  begin
+    saved.create("rb-libvirt-none")
+    puts_fail "conn.interface_transaction transaction usable after block"
+  rescue ArgumentError
+    puts_ok "conn.interface_transaction transaction closed after block"
+  end
+rescue NoMethodError
+  puts_skipped "conn.interface_transaction does not exist"
+end
+
+# TESTGROUP: conn.stale?
+expect_too_many_args(conn, "stale?", 1)
+
+expect_success(conn, "no args", "stale?") {|x| x == false}
+
+if Process.respond_to?(:fork)
+  rd, wr = IO.pipe
+  pid = fork do
+    rd.close
+    ok = conn.stale? && conn.num_of_domains.is_a?(Integer) && !conn.stale?
+    wr.write(ok ? "ok" : "fail")
+    exit!(0)
+  end
+  wr.close
+  Process.wait(pid)
+  if rd.read == "ok"
+    puts_ok "conn.stale? connection reopened in forked child"
+  else
+    puts_fail "conn.stale? connection not reopened in forked child"
+  end
+  rd.close
+  expect_success(conn, "parent after fork", "stale?") {|x| x == false}
+
+  # objects looked up before the fork follow the Connect to its reopened
+  # connection, except streams, which cannot be looked up again
+  dev = conn.lookup_nodedevice_by_name("computer")
+  stream = conn.stream
+  rd, wr = IO.pipe
+  pid = fork do
+    rd.close
+    result = []
+    begin
+      result << (dev.xml_desc.include?("computer") ? "dev" : "nodev")
+    rescue Libvirt::Error
+      result << "nodev"
+    end
+    begin
+      stream.abort
+      result << "stream"
+    rescue Libvirt::ConnectionError
+      result << "nostream"
+    end
+    wr.write(result.join(" "))
+    exit!(0)
+  end
+  wr.close
+  Process.wait(pid)
+  result = rd.read
+  rd.close
+  if result == "dev nostream"
+    puts_ok "conn.stale? node device and stream handled in forked child"
+  else
+    puts_fail "conn.stale? node device and stream in forked child gave #{result}"
+  end
+  stream.abort
+end
+
+# TESTGROUP: conn.health
+expect_too_many_args(conn, "health", 1)
+
+expect_success(conn, "no args", "health") {|x| x["state"] == Libvirt::Connect::HEALTH_UNKNOWN}
+
+# TESTGROUP: conn.monitor_liveness
+expect_too_many_args(conn, "monitor_liveness", 1, 2, 3)
+expect_invalid_arg_type(conn, "monitor_liveness", 'foo')
+expect_invalid_arg_type(conn, "monitor_liveness", 1, 'foo')
+expect_fail(conn, ArgumentError, "no event loop", "monitor_liveness")
+
+expect_success(Libvirt, "no args", "native_event_loop_start")
+expect_success(Libvirt, "no args", "native_event_loop_running?") {|x| x == true}
+
+conn2 = Libvirt::open("qemu:///system")
+expect_success(conn2, "interval and count", "monitor_liveness", 5, 3)
+expect_success(conn2, "after monitor_liveness", "health") {|x| x["state"] == Libvirt::Connect::HEALTH_ALIVE and x["interval"] == 5 and x["count"] == 3}
+conn2.close
+expect_success(conn2, "after close", "health") {|x| x["state"] == Libvirt::Connect::HEALTH_DEAD}
+
+# TESTGROUP: conn.set_governor
+expect_too_many_args(conn, "set_governor", 1, 2, 3, 4)
+expect_invalid_arg_type(conn, "set_governor", 'foo')
+expect_invalid_arg_type(conn, "set_governor", 1, 'foo')
+expect_invalid_arg_type(conn, "set_governor", 1, 1, 'foo')
+expect_fail(conn, ArgumentError, "negative max_in_flight", "set_governor", -1)
+
+expect_success(conn, "max_in_flight, rate and burst", "set_governor", 4, 100, 10)
+
+# TESTGROUP: conn.governor_stats
+expect_too_many_args(conn, "governor_stats", 1)
+
+expect_success(conn, "no args", "governor_stats") {|x| x["max_in_flight"] == 4 and x["lanes"].length == 3}
+
+# TESTGROUP: conn.throttle
+expect_too_many_args(conn, "throttle", 1, 2)
+expect_invalid_arg_type(conn, "throttle", 'foo')
+expect_fail(conn, ArgumentError, "invalid lane", "throttle", 7)
+
+begin
+  if conn.throttle(Libvirt::Connect::LANE_HIGH) { 42 } == 42 and conn.governor_stats["lanes"][Libvirt::Connect::LANE_HIGH]["acquired"] == 1
+    puts_ok "conn.throttle ran block in high lane"
+  else
+    puts_fail "conn.throttle did not run block in high lane"
+  end
+rescue NoMethodError
+  puts_skipped "conn.throttle does not exist"
+end
+
+# a bulk call waiting behind a full governor can still be interrupted
+conn.set_governor(1)
+holder = Thread.new { conn.throttle { sleep 2 } }
+sleep 0.5
+begin
+  Timeout.timeout(0.5) { conn.secret_values([$SECRET_UUID]) }
+  puts_fail "conn.secret_values was not held back by a full governor"
+rescue Timeout::Error
+  puts_ok "conn.secret_values interrupted while waiting for the governor"
+end
+holder.join
+expect_success(conn, "after interrupted wait", "governor_stats") {|x| x["in_flight"] == 0 and x["lanes"].all? {|l| l["waiting"] == 0}}
+
+# ordinary calls go through the governor too, and their wait is
+# interruptible in the same way
+holder = Thread.new { conn.throttle { sleep 2 } }
+sleep 0.5
+begin
+  Timeout.timeout(0.5) { conn.num_of_domains }
+  puts_fail "conn.num_of_domains was not held back by a full governor"
+rescue Timeout::Error
+  puts_ok "conn.num_of_domains interrupted while waiting for the governor"
+end
+holder.join
+begin
+  Timeout.timeout(5) { conn.throttle { conn.num_of_domains } }
+  puts_ok "conn.num_of_domains inside conn.throttle runs in the held slot"
+rescue Timeout::Error
+  puts_fail "conn.num_of_domains inside conn.throttle waited for another slot"
+end
+
+expect_success(conn, "unlimited", "set_governor")
+
+# TESTGROUP: conn.domain_perf_stats
+expect_too_many_args(conn, "domain_perf_stats", 1, 2, 3)
+expect_invalid_arg_type(conn, "domain_perf_stats", 'foo')
+expect_invalid_arg_type(conn, "domain_perf_stats", [1])
+expect_invalid_arg_type(conn, "domain_perf_stats", nil, 'foo')
+
+expect_success(conn, "no args", "domain_perf_stats") {|x| x.is_a?(Hash) and x.values.all? {|v| v.is_a?(Hash)}}
+
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_success(conn, "domain list", "domain_perf_stats", [newdom]) {|x| x.keys == [newdom.name]}
+
+newdom.destroy
+
+# TESTGROUP: conn.domain_memory_stats
+expect_too_many_args(conn, "domain_memory_stats", 1, 2, 3)
+expect_invalid_arg_type(conn, "domain_memory_stats", 'foo')
+expect_invalid_arg_type(conn, "domain_memory_stats", [1])
+expect_invalid_arg_type(conn, "domain_memory_stats", nil, 'foo')
+
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_success(conn, "no args", "domain_memory_stats") {|x| x[newdom.name].has_key?("current")}
+expect_success(conn, "domain list", "domain_memory_stats", [newdom]) {|x| x.keys == [newdom.name] and x[newdom.name]["maximum"] > 0}
+
+newdom.destroy
+
+# TESTGROUP: conn.set_domain_metadata
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(conn, "set_domain_metadata", 1, 2, 3, 4, 5, 6, 7)
+expect_too_few_args(conn, "set_domain_metadata", {})
+expect_invalid_arg_type(conn, "set_domain_metadata", 'foo', Libvirt::Domain::METADATA_ELEMENT)
+expect_invalid_arg_type(conn, "set_domain_metadata", {1 => "foo"}, Libvirt::Domain::METADATA_ELEMENT)
+expect_invalid_arg_type(conn, "set_domain_metadata", {newdom => "<tags/>"}, 'foo')
+expect_invalid_arg_type(conn, "set_domain_metadata", {newdom => "<tags/>"}, Libvirt::Domain::METADATA_ELEMENT, "rb", "http://example.org/rb", 'foo')
+
+expect_success(conn, "element", "set_domain_metadata", {newdom => "<tags tenant='t1'><rack>r1</rack></tags>"}, Libvirt::Domain::METADATA_ELEMENT, "rb", "http://example.org/rb") {|x| x.length == 1 and x[0]["name"] == newdom.name and x[0]["error"].nil?}
+
+# TESTGROUP: conn.domain_metadata
+expect_too_many_args(conn, "domain_metadata", 1, 2, 3, 4, 5, 6, 7)
+expect_too_few_args(conn, "domain_metadata")
+expect_invalid_arg_type(conn, "domain_metadata", 'foo')
+expect_invalid_arg_type(conn, "domain_metadata", Libvirt::Domain::METADATA_ELEMENT, "http://example.org/rb", 'foo')
+expect_invalid_arg_type(conn, "domain_metadata", Libvirt::Domain::METADATA_ELEMENT, "http://example.org/rb", nil, 'foo')
+
+expect_success(conn, "element", "domain_metadata", Libvirt::Domain::METADATA_ELEMENT, "http://example.org/rb", nil, [newdom]) {|x| x[newdom.name] =~ /tenant/}
+expect_success(conn, "element keys", "domain_metadata", Libvirt::Domain::METADATA_ELEMENT, "http://example.org/rb", ["tenant", "rack", "row"], [newdom]) {|x| x[newdom.name] == {"tenant" => "t1", "rack" => "r1", "row" => nil}}
+expect_success(conn, "missing namespace", "domain_metadata", Libvirt::Domain::METADATA_ELEMENT, "http://example.org/none", nil, [newdom]) {|x| x.has_key?(newdom.name) and x[newdom.name].nil?}
+
+newdom.destroy
+
+# TESTGROUP: conn.block_auto_extend
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(conn, "block_auto_extend", 1, 2, 3, 4, 5, 6)
+expect_too_few_args(conn, "block_auto_extend", newdom, "vda", 1)
+expect_invalid_arg_type(conn, "block_auto_extend", 1, "vda", 1, 1)
+expect_invalid_arg_type(conn, "block_auto_extend", newdom, 1, 1, 1)
+expect_invalid_arg_type(conn, "block_auto_extend", newdom, "vda", 'foo', 1)
+expect_invalid_arg_type(conn, "block_auto_extend", newdom, "vda", 1, 1, 'foo')
+expect_fail(conn, ArgumentError, "zero increment", "block_auto_extend", newdom, "vda", 1, 0)
+expect_fail(conn, ArgumentError, "headroom too large", "block_auto_extend", newdom, "vda", 2**62, 1)
+
+# the test domain's disk is a qcow2 file, which is not grown in place
+expect_fail(conn, ArgumentError, "file-backed disk", "block_auto_extend", newdom, "vda", 1, 64*1024*1024)
+
+# TESTGROUP: conn.block_auto_extend_stats
+expect_too_many_args(conn, "block_auto_extend_stats", 1)
+expect_success(conn, "no args", "block_auto_extend_stats") {|x| x["disks"] == 0 and x["failed"] == 0}
+
+# TESTGROUP: conn.block_auto_extend_cancel
+expect_too_many_args(conn, "block_auto_extend_cancel", 1, 2, 3)
+expect_too_few_args(conn, "block_auto_extend_cancel", newdom)
+expect_invalid_arg_type(conn, "block_auto_extend_cancel", 1, "vda")
+
+expect_success(conn, "unwatched disk", "block_auto_extend_cancel", newdom, "vda") {|x| x == false}
+
+newdom.destroy
+
+# a disk given by its source path is watched under its target name, since
+# that is what the threshold event reports
+`truncate -s 256M #{$GUEST_BASE}-extend.img`
+loopdev = `losetup -f --show #{$GUEST_BASE}-extend.img`.chomp
+newdom = conn.create_domain_xml($new_dom_xml.sub("</devices>", "<disk type='block' device='disk'><driver name='qemu' type='raw'/><source dev='#{loopdev}'/><target dev='vdb' bus='virtio'/></disk></devices>"))
+sleep 1
+
+expect_success(conn, "source path", "block_auto_extend", newdom, loopdev, 64*1024*1024, 64*1024*1024)
+expect_success(conn, "source path", "block_auto_extend_stats") {|x| x["disks"] == 1}
+expect_success(conn, "target of source path", "block_auto_extend_cancel", newdom, "vdb") {|x| x == true}
+expect_success(conn, "target", "block_auto_extend", newdom, "vdb", 64*1024*1024, 64*1024*1024)
+expect_success(conn, "source path of target", "block_auto_extend_cancel", newdom, loopdev) {|x| x == true}
+
+newdom.destroy
+`losetup -d #{loopdev}; rm -f #{$GUEST_BASE}-extend.img`
+
+# TESTGROUP: Libvirt::native_event_loop_stop
+# nothing below needs the native loop, and the later test files register
+# their own event implementation
+expect_too_many_args(Libvirt, "native_event_loop_stop", 1)
+expect_fail(Libvirt, ArgumentError, "native loop running", "event_register_impl", nil, nil, nil, nil, nil, nil)
+
+expect_success(Libvirt, "no args", "native_event_loop_stop")
+expect_success(Libvirt, "after stop", "native_event_loop_running?") {|x| x == false}
+expect_success(Libvirt, "not running", "native_event_loop_stop")
+expect_success(Libvirt, "after stop", "native_event_loop_start")
+expect_success(Libvirt, "after restart", "native_event_loop_running?") {|x| x == true}
+expect_success(Libvirt, "after restart", "native_event_loop_stop")
+expect_success(Libvirt, "after stop", "event_register_impl", nil, nil, nil, nil, nil, nil)
+
+# TESTGROUP: conn.managed_save_domains
+newdom = conn.define_domain_xml($new_dom_xml)
+newdom.create
+sleep 1
+
+expect_too_many_args(conn, "managed_save_domains", 1, 2, 3, 4, 5)
+expect_invalid_arg_type(conn, "managed_save_domains", 'foo')
+expect_invalid_arg_type(conn, "managed_save_domains", [1])
+expect_invalid_arg_type(conn, "managed_save_domains", nil, 'foo')
+expect_invalid_arg_type(conn, "managed_save_domains", nil, nil, 'foo')
+expect_invalid_arg_type(conn, "managed_save_domains", nil, nil, 0, 'foo')
+expect_fail(conn, ArgumentError, "unknown key", "managed_save_domains", [newdom], {"foo" => 1})
+expect_fail(conn, ArgumentError, "shared file", "managed_save_domains", [newdom], {Libvirt::Domain::SAVE_PARAM_FILE => "/tmp/rb-libvirt-save"})
+expect_fail(conn, ArgumentError, "shared XML", "managed_save_domains", [newdom], {Libvirt::Domain::SAVE_PARAM_DXML => $new_dom_xml})
+
+expect_success(conn, "domain list", "managed_save_domains", [newdom], nil, 2) {|x| x.length == 1 and x[0]["name"] == newdom.name and x[0]["error"].nil?}
+expect_success(newdom, "after managed_save_domains", "has_managed_save?") {|x| x == true}
+
+# TESTGROUP: conn.managed_restore_domains
+expect_too_many_args(conn, "managed_restore_domains", 1, 2, 3, 4)
+expect_invalid_arg_type(conn, "managed_restore_domains", 'foo')
+expect_invalid_arg_type(conn, "managed_restore_domains", [1])
+expect_invalid_arg_type(conn, "managed_restore_domains", nil, 'foo')
+expect_invalid_arg_type(conn, "managed_restore_domains", nil, 0, 'foo')
+
+expect_success(conn, "domain list", "managed_restore_domains", [newdom]) {|x| x.length == 1 and x[0]["name"] == newdom.name and x[0]["error"].nil?}
+expect_success(newdom, "after managed_restore_domains", "active?") {|x| x == true}
+
+newdom.destroy
+newdom.undefine
+
 # END TESTS
 
 conn.close
@@ -485,6 +485,17 @@ expect_success(newdom, "no args", "memory_stats")
 
 newdom.destroy
 
+# TESTGROUP: dom.memory_stats_hash
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(newdom, "memory_stats_hash", 1, 2)
+expect_invalid_arg_type(newdom, "memory_stats_hash", "foo")
+
+expect_success(newdom, "no args", "memory_stats_hash") {|x| x.length == newdom.memory_stats.length and x.has_key?("current")}
+
+newdom.destroy
+
 # TESTGROUP: dom.blockinfo
 newdom = conn.create_domain_xml($new_dom_xml)
 sleep 1
@@ -1436,6 +1447,138 @@ expect_success(snap, "no args", "current?")
 newdom.undefine(Libvirt::Domain::UNDEFINE_SNAPSHOTS_METADATA)
 sleep 1
 
+# TESTGROUP: dom.add_iothread
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(newdom, "add_iothread", 1, 2, 3)
+expect_too_few_args(newdom, "add_iothread")
+expect_invalid_arg_type(newdom, "add_iothread", 'foo')
+expect_invalid_arg_type(newdom, "add_iothread", 1, 'foo')
+
+expect_success(newdom, "id arg", "add_iothread", 1)
+
+# TESTGROUP: dom.iothread_info
+expect_too_many_args(newdom, "iothread_info", 1, 2)
+expect_invalid_arg_type(newdom, "iothread_info", 'foo')
+
+expect_success(newdom, "no args", "iothread_info") {|x| x.length == 1 and x[0].id == 1 and x[0].cpumap.is_a?(Integer)}
+
+# TESTGROUP: dom.pin_iothread
+expect_too_many_args(newdom, "pin_iothread", 1, 2, 3, 4)
+expect_too_few_args(newdom, "pin_iothread")
+expect_too_few_args(newdom, "pin_iothread", 1)
+expect_invalid_arg_type(newdom, "pin_iothread", 'foo', [0])
+expect_invalid_arg_type(newdom, "pin_iothread", 1, 'foo')
+expect_invalid_arg_type(newdom, "pin_iothread", 1, [0], 'foo')
+expect_fail(newdom, ArgumentError, "negative bitmap", "pin_iothread", 1, -1)
+
+expect_success(newdom, "cpu list", "pin_iothread", 1, [0])
+expect_success(newdom, "cpu bitmap", "pin_iothread", 1, 0b1)
+if newdom.iothread_info[0].cpumap == 0b1
+  puts_ok "dom.pin_iothread cpumap round-trips through iothread_info"
+else
+  puts_fail "dom.pin_iothread cpumap did not round-trip through iothread_info"
+end
+
+# TESTGROUP: dom.set_iothread_params
+expect_too_many_args(newdom, "set_iothread_params", 1, 2, 3, 4)
+expect_too_few_args(newdom, "set_iothread_params", 1)
+expect_invalid_arg_type(newdom, "set_iothread_params", 1, 'foo')
+expect_invalid_arg_type(newdom, "set_iothread_params", 1, {}, 'foo')
+expect_fail(newdom, ArgumentError, "unknown key", "set_iothread_params", 1, {"foo" => 1})
+
+expect_success(newdom, "empty hash", "set_iothread_params", 1, {})
+expect_success(newdom, "poll params", "set_iothread_params", 1,
+               {"poll_max_ns" => 32768, "poll_grow" => 2, "poll_shrink" => 2})
+
+# TESTGROUP: dom.del_iothread
+expect_too_many_args(newdom, "del_iothread", 1, 2, 3)
+expect_too_few_args(newdom, "del_iothread")
+expect_invalid_arg_type(newdom, "del_iothread", 'foo')
+
+expect_success(newdom, "id arg", "del_iothread", 1)
+expect_success(newdom, "after delete", "iothread_info") {|x| x.empty?}
+
+newdom.destroy
+
+# TESTGROUP: dom.perf_events
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(newdom, "perf_events", 1, 2)
+expect_invalid_arg_type(newdom, "perf_events", 'foo')
+
+begin
+  if newdom.perf_events.is_a?(Hash)
+    puts_ok "dom.perf_events returned a Hash"
+  else
+    puts_fail "dom.perf_events did not return a Hash"
+  end
+rescue Libvirt::RetrieveError
+  puts_skipped "dom.perf_events not supported by this driver"
+end
+
+# TESTGROUP: dom.perf_events=
+expect_too_many_args(newdom, "perf_events=", 1, 2)
+expect_invalid_arg_type(newdom, "perf_events=", 'foo')
+expect_invalid_arg_type(newdom, "perf_events=", [{}, 'foo'])
+
+begin
+  newdom.perf_events = {"cmt" => false}
+  puts_ok "dom.perf_events= disabled an event"
+rescue Libvirt::Error
+  puts_skipped "dom.perf_events= not supported by this driver"
+end
+
+newdom.destroy
+
+# TESTGROUP: dom.set_block_threshold
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+expect_too_many_args(newdom, "set_block_threshold", 1, 2, 3, 4)
+expect_too_few_args(newdom, "set_block_threshold", "vda")
+expect_invalid_arg_type(newdom, "set_block_threshold", 1, 1)
+expect_invalid_arg_type(newdom, "set_block_threshold", "vda", 'foo')
+expect_invalid_arg_type(newdom, "set_block_threshold", "vda", 1, 'foo')
+expect_fail(newdom, Libvirt::Error, "invalid disk", "set_block_threshold", "foo", 1)
+
+expect_success(newdom, "disk and threshold", "set_block_threshold", "vda", 1024*1024)
+expect_success(newdom, "clear threshold", "set_block_threshold", "vda", 0)
+
+newdom.destroy
+
+# TESTGROUP: dom.save_params
+newdom = conn.define_domain_xml($new_dom_xml)
+newdom.create
+sleep 1
+
+expect_too_many_args(newdom, "save_params", 1, 2, 3)
+expect_too_few_args(newdom, "save_params")
+expect_invalid_arg_type(newdom, "save_params", 1)
+expect_invalid_arg_type(newdom, "save_params", {}, "foo")
+expect_fail(newdom, ArgumentError, "unknown key", "save_params", {"foo" => 1})
+
+expect_success(newdom, "file param", "save_params", {Libvirt::Domain::SAVE_PARAM_FILE => $GUEST_SAVE})
+
+# TESTGROUP: Libvirt::Domain::restore_params
+expect_too_many_args(Libvirt::Domain, "restore_params", 1, 2, 3, 4)
+expect_too_few_args(Libvirt::Domain, "restore_params", conn)
+expect_invalid_arg_type(Libvirt::Domain, "restore_params", 1, {})
+expect_invalid_arg_type(Libvirt::Domain, "restore_params", conn, 1)
+expect_invalid_arg_type(Libvirt::Domain, "restore_params", conn, {}, "foo")
+expect_fail(Libvirt::Domain, Libvirt::Error, "invalid path", "restore_params", conn, {Libvirt::Domain::SAVE_PARAM_FILE => "/this/path/does/not/exist"})
+
+expect_success(Libvirt::Domain, "file param", "restore_params", conn, {Libvirt::Domain::SAVE_PARAM_FILE => $GUEST_SAVE})
+
+`rm -f #{$GUEST_SAVE}`
+
+expect_success(newdom, "no file param", "save_params", {})
+expect_success(newdom, "after managed save", "has_managed_save?") {|x| x == true}
+
+newdom.undefine(Libvirt::Domain::UNDEFINE_MANAGED_SAVE)
+
 # END TESTS
 
 conn.close
@@ -0,0 +1,99 @@
+#!/usr/bin/ruby
+
+# Test the metadata index.  Note that this tester requires the qemu driver
+# to be enabled and available for use.
+
+$: << File.dirname(__FILE__)
+
+require 'libvirt'
+require 'test_utils.rb'
+
+set_test_object("metadata_index")
+
+if not defined?(Libvirt::MetadataIndex)
+  puts_skipped "Libvirt::MetadataIndex not built; virDomainGetMetadata, libxml2 or pthreads were not found"
+  finish_tests
+  exit
+end
+
+conn = Libvirt::open("qemu:///system")
+
+cleanup_test_domain(conn)
+
+# setup for later tests
+`qemu-img create -f qcow2 #{$GUEST_DISK} 5G`
+
+uri = "http://example.org/rb"
+
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+conn.set_domain_metadata({newdom => "<tags tenant='t1'><rack>r1</rack></tags>"}, Libvirt::Domain::METADATA_ELEMENT, "rb", uri)
+
+# TESTGROUP: Libvirt::MetadataIndex::new
+expect_too_many_args(Libvirt::MetadataIndex, "new", conn, uri, ["tenant"], 1, 2)
+expect_too_few_args(Libvirt::MetadataIndex, "new", conn, uri)
+expect_fail(Libvirt::MetadataIndex, ArgumentError, "not a connection", "new", 1, uri, ["tenant"])
+expect_invalid_arg_type(Libvirt::MetadataIndex, "new", conn, 1, ["tenant"])
+expect_invalid_arg_type(Libvirt::MetadataIndex, "new", conn, uri, "tenant")
+expect_invalid_arg_type(Libvirt::MetadataIndex, "new", conn, uri, [1])
+expect_invalid_arg_type(Libvirt::MetadataIndex, "new", conn, uri, ["tenant"], "foo")
+expect_fail(Libvirt::MetadataIndex, ArgumentError, "no keys", "new", conn, uri, [])
+
+idx = expect_success(Libvirt::MetadataIndex, "conn, uri and keys", "new", conn, uri, ["tenant", "rack"]) {|x| x.connection == conn}
+idx = expect_success(Libvirt::MetadataIndex, "all args", "new", conn, uri, ["tenant", "rack"], 2)
+
+# TESTGROUP: idx.lookup
+expect_too_many_args(idx, "lookup", 1, 2, 3)
+expect_too_few_args(idx, "lookup", "tenant")
+expect_invalid_arg_type(idx, "lookup", 1, "t1")
+expect_invalid_arg_type(idx, "lookup", "tenant", 1)
+expect_success(idx, "attribute key", "lookup", "tenant", "t1") {|x| x == [newdom.name]}
+expect_success(idx, "element key", "lookup", "rack", "r1") {|x| x == [newdom.name]}
+expect_success(idx, "unknown value", "lookup", "tenant", "t2") {|x| x == []}
+
+# TESTGROUP: idx.values
+expect_too_many_args(idx, "values", 1, 2)
+expect_too_few_args(idx, "values")
+expect_invalid_arg_type(idx, "values", 1)
+expect_success(idx, "key", "values", "tenant") {|x| x["t1"] == [newdom.name]}
+
+# TESTGROUP: idx.tags
+expect_too_many_args(idx, "tags", 1, 2)
+expect_too_few_args(idx, "tags")
+expect_invalid_arg_type(idx, "tags", 1)
+expect_success(idx, "indexed domain", "tags", newdom.name) {|x| x == {"tenant" => "t1", "rack" => "r1"}}
+expect_success(idx, "unknown domain", "tags", "no-such-domain") {|x| x.nil?}
+
+# TESTGROUP: idx.size
+expect_too_many_args(idx, "size", 1)
+expect_success(idx, "no args", "size") {|x| x >= 1}
+
+# TESTGROUP: idx.refresh
+expect_too_many_args(idx, "refresh", 1, 2)
+expect_invalid_arg_type(idx, "refresh", "foo")
+conn.set_domain_metadata({newdom => "<tags tenant='t2'/>"}, Libvirt::Domain::METADATA_ELEMENT, "rb", uri)
+expect_success(idx, "no args", "refresh")
+expect_success(idx, "after refresh", "lookup", "tenant", "t2") {|x| x == [newdom.name]}
+expect_success(idx, "after refresh", "lookup", "tenant", "t1") {|x| x == []}
+
+# TESTGROUP: idx.stats
+expect_too_many_args(idx, "stats", 1)
+# no event loop is registered, so the index is only updated by refresh
+expect_success(idx, "no args", "stats") {|x| x["domains"] >= 1 and x["values"] >= 1 and x["updates"] > 0 and x["events"] == false}
+
+# TESTGROUP: idx.close
+expect_too_many_args(idx, "close", 1)
+expect_success(idx, "no args", "close")
+expect_fail(idx, Libvirt::Error, "after close", "lookup", "tenant", "t2")
+
+# TESTGROUP: idx.closed?
+expect_too_many_args(idx, "closed?", 1)
+expect_success(idx, "after close", "closed?") {|x| x == true}
+
+newdom.destroy
+
+# END TESTS
+
+conn.close
+
+finish_tests
@@ -45,6 +45,28 @@ expect_success(newnet, "dhcp ip", "update",
 
 newnet.destroy
 
+# TESTGROUP: net.update_batch
+newnet = conn.create_network_xml($new_net_xml)
+
+expect_too_few_args(newnet, "update_batch")
+expect_too_many_args(newnet, "update_batch", [], false, 1, 2)
+expect_invalid_arg_type(newnet, "update_batch", 1)
+expect_invalid_arg_type(newnet, "update_batch", [1])
+expect_fail(newnet, ArgumentError, "short update", "update_batch", [[command, section]])
+expect_fail(newnet, ArgumentError, "rollback of modify", "update_batch",
+            [[Libvirt::Network::NETWORK_UPDATE_COMMAND_MODIFY, section, -1,
+              $new_network_dhcp_ip, flags]], true)
+
+expect_success(newnet, "add and delete", "update_batch",
+               [[command, section, -1, $new_network_dhcp_ip, flags],
+                [Libvirt::Network::UPDATE_COMMAND_DELETE, section, -1,
+                 $new_network_dhcp_ip, flags]]) {|x| x["errors"].empty?}
+expect_success(newnet, "rollback", "update_batch",
+               [[command, section, -1, $new_network_dhcp_ip, flags],
+                [command, section, -1, "<bogus/>", flags]], true) {|x| x["rolled_back"] and x["errors"].keys == [1]}
+
+newnet.destroy
+
 # TESTGROUP: net.destroy
 newnet = conn.create_network_xml($new_net_xml)
 
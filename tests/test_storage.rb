@@ -520,6 +520,103 @@ expect_success(newvol, "alg arg", "wipe_pattern", Libvirt::StorageVol::WIPE_ALG_
 newvol.delete
 newpool.destroy
 
+# TESTGROUP: vol.wipe_job
+newpool = conn.create_storage_pool_xml($new_storage_pool_xml)
+newvol = newpool.create_volume_xml(new_storage_vol_xml)
+
+expect_too_many_args(newvol, "wipe_job", 1, 2)
+expect_invalid_arg_type(newvol, "wipe_job", 'foo')
+
+job = expect_success(newvol, "no args", "wipe_job") {|x| x.class == Libvirt::StorageJob}
+expect_success(job, "no args", "wait") {|x| x == true}
+expect_success(job, "no args", "state") {|x| x == Libvirt::StorageJob::COMPLETED}
+expect_success(job, "no args", "error") {|x| x.nil?}
+
+newvol.delete
+newpool.destroy
+
+# TESTGROUP: vol.resize_job
+newpool = conn.create_storage_pool_xml($new_storage_pool_xml)
+newvol = newpool.create_volume_xml(new_storage_vol_xml)
+
+expect_too_many_args(newvol, "resize_job", 1, 2, 3)
+expect_too_few_args(newvol, "resize_job")
+expect_invalid_arg_type(newvol, "resize_job", 'foo')
+expect_invalid_arg_type(newvol, "resize_job", 1, 'foo')
+
+job = expect_success(newvol, "capacity arg", "resize_job", 2*1024*1024*1024, Libvirt::StorageVol::RESIZE_ALLOCATE) {|x| x.class == Libvirt::StorageJob}
+expect_too_many_args(job, "wait", 1, 2)
+expect_invalid_arg_type(job, "wait", 'foo')
+expect_success(job, "timeout arg", "wait", 60) {|x| x == true}
+expect_success(job, "no args", "progress") {|x| x == 1.0}
+
+newvol.delete
+newpool.destroy
+
+# TESTGROUP: pool.create_volume_xml_from_job
+newpool = conn.create_storage_pool_xml($new_storage_pool_xml)
+newvol = newpool.create_volume_xml(new_storage_vol_xml)
+
+expect_too_many_args(newpool, "create_volume_xml_from_job", new_storage_vol_xml_2, 0, 1, 2)
+expect_too_few_args(newpool, "create_volume_xml_from_job")
+expect_invalid_arg_type(newpool, "create_volume_xml_from_job", 1, 2)
+expect_invalid_arg_type(newpool, "create_volume_xml_from_job", "foo", 2)
+expect_invalid_arg_type(newpool, "create_volume_xml_from_job", "foo", newvol, "bar")
+
+job = expect_success(newpool, "storage volume XML", "create_volume_xml_from_job", new_storage_vol_xml_2, newvol) {|x| x.class == Libvirt::StorageJob}
+job.wait
+expect_success(job, "no args", "volume") {|x| x.class == Libvirt::StorageVol}
+
+job = newpool.create_volume_xml_from_job(new_storage_vol_xml_2, newvol)
+job.wait
+expect_success(job, "no args", "state") {|x| x == Libvirt::StorageJob::FAILED}
+expect_success(job, "no args", "error") {|x| x.class == Libvirt::Error}
+expect_success(job, "no args", "volume") {|x| x.nil?}
+
+newpool.lookup_volume_by_name("test2.img").delete
+newvol.delete
+newpool.destroy
+
+# TESTGROUP: Libvirt::StorageJob.wait_all
+newpool = conn.create_storage_pool_xml($new_storage_pool_xml)
+newvol = newpool.create_volume_xml(new_storage_vol_xml)
+
+expect_too_many_args(Libvirt::StorageJob, "wait_all", [], 1, 2)
+expect_too_few_args(Libvirt::StorageJob, "wait_all")
+expect_invalid_arg_type(Libvirt::StorageJob, "wait_all", 1)
+expect_invalid_arg_type(Libvirt::StorageJob, "wait_all", [1])
+expect_invalid_arg_type(Libvirt::StorageJob, "wait_all", [], 'foo')
+
+jobs = 3.times.map { newvol.wipe_job }
+expect_success(Libvirt::StorageJob, "jobs arg", "wait_all", jobs) {|x| x == true}
+expect_success(jobs.last, "no args", "cancel") {|x| x == false}
+
+newvol.delete
+newpool.destroy
+
+# TESTGROUP: pool.clone_volumes
+newpool = conn.create_storage_pool_xml($new_storage_pool_xml)
+newvol = newpool.create_volume_xml(new_storage_vol_xml)
+
+expect_too_many_args(newpool, "clone_volumes", newvol, [], 1, 2, 3, 4)
+expect_too_few_args(newpool, "clone_volumes")
+expect_too_few_args(newpool, "clone_volumes", newvol)
+expect_invalid_arg_type(newpool, "clone_volumes", 1, [])
+expect_invalid_arg_type(newpool, "clone_volumes", newvol, 1)
+expect_invalid_arg_type(newpool, "clone_volumes", newvol, [1])
+expect_invalid_arg_type(newpool, "clone_volumes", newvol, [], 'foo')
+expect_invalid_arg_type(newpool, "clone_volumes", newvol, [], Libvirt::StoragePool::CLONE_BACKING, 'foo')
+expect_invalid_arg_type(newpool, "clone_volumes", newvol, [], Libvirt::StoragePool::CLONE_BACKING, 0, 'foo')
+expect_fail(newpool, ArgumentError, "invalid format", "clone_volumes", newvol, [], 99)
+
+expect_success(newpool, "base and names", "clone_volumes", newvol, ["clone1.qcow2", "clone2.qcow2"]) {|x| x.length == 2 and x.all? {|r| r["error"].nil? and r["volume"].class == Libvirt::StorageVol and r["time"].class == Float}}
+expect_success(newpool, "full clone", "clone_volumes", newvol, ["clone3.img"], Libvirt::StoragePool::CLONE_FULL, 2) {|x| x[0]["error"].nil?}
+expect_success(newpool, "existing name", "clone_volumes", newvol, ["clone1.qcow2"]) {|x| x[0]["error"].class == Libvirt::Error and x[0]["volume"].nil?}
+
+["clone1.qcow2", "clone2.qcow2", "clone3.img"].each {|name| newpool.lookup_volume_by_name(name).delete}
+newvol.delete
+newpool.destroy
+
 # END TESTS
 
 conn.close
@@ -252,3 +252,58 @@ def cleanup_test_network(conn)
     # in case we didn't find it, don't do anything
   end
 end
+
+# The arguments, methods and lifecycle that Libvirt::BalloonController and
+# Libvirt::VcpuController share.  POLICY is three valid policy arguments
+# for klass.new; the controller-specific ones are tested by the caller.
+def expect_controller_new(klass, conn, *policy)
+  expect_too_many_args(klass, "new", conn, *policy, 1.0, 2, 3)
+  expect_too_few_args(klass, "new")
+  expect_fail(klass, ArgumentError, "not a connection", "new", 1)
+  expect_invalid_arg_type(klass, "new", conn, *policy, "foo")
+  expect_invalid_arg_type(klass, "new", conn, *policy, 1.0, "foo")
+  expect_fail(klass, ArgumentError, "zero interval", "new", conn, *policy, 0)
+
+  expect_success(klass, "conn arg", "new", conn) {|x| x.connection == conn}
+  expect_success(klass, "all args", "new", conn, *policy, 0.5, 2) {|x| x.policy["interval"] == 0.5 and x.policy["concurrency"] == 2}
+end
+
+# Restrict CTL to DOM, start it, check it while it runs (calling the
+# block, if any, before it is stopped) and stop it again.
+def expect_controller_lifecycle(ctl, dom)
+  # TESTGROUP: ctl.set_domains
+  expect_too_many_args(ctl, "set_domains", [dom], 2)
+  expect_too_few_args(ctl, "set_domains")
+  expect_invalid_arg_type(ctl, "set_domains", "foo")
+  expect_invalid_arg_type(ctl, "set_domains", [1])
+  expect_fail(ctl, ArgumentError, "empty array", "set_domains", [])
+  expect_success(ctl, "nil", "set_domains", nil)
+  expect_success(ctl, "domain", "set_domains", [dom])
+
+  # TESTGROUP: ctl.domains
+  expect_too_many_args(ctl, "domains", 1)
+  expect_success(ctl, "no args", "domains") {|x| x == [dom]}
+
+  # TESTGROUP: ctl.start
+  expect_too_many_args(ctl, "start", 1)
+  expect_success(ctl, "no args", "start")
+  expect_fail(ctl, ArgumentError, "already running", "start")
+
+  # TESTGROUP: ctl.running?
+  expect_too_many_args(ctl, "running?", 1)
+  expect_success(ctl, "no args", "running?") {|x| x == true}
+
+  # TESTGROUP: ctl.stats
+  sleep 2
+  expect_too_many_args(ctl, "stats", 1)
+  expect_success(ctl, "no args", "stats") {|x| x["cycles"] > 0 and x["domains"] == 1 and x.has_key?("last_error")}
+
+  yield if block_given?
+
+  # TESTGROUP: ctl.stop
+  expect_too_many_args(ctl, "stop", 1)
+  expect_success(ctl, "no args", "stop")
+  expect_success(ctl, "after stop", "running?") {|x| x == false}
+  expect_success(ctl, "after stop", "start")
+  expect_success(ctl, "restarted", "stop")
+end
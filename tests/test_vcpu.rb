@@ -0,0 +1,83 @@
+#!/usr/bin/ruby
+
+# Test the vCPU controller.  Note that this tester requires the qemu driver
+# to be enabled and available for use.
+
+$: << File.dirname(__FILE__)
+
+require 'libvirt'
+require 'test_utils.rb'
+
+set_test_object("vcpu_controller")
+
+if not defined?(Libvirt::VcpuController)
+  puts_skipped "Libvirt::VcpuController not built; virConnectGetAllDomainStats, virDomainSetVcpusFlags or pthreads were not found"
+  finish_tests
+  exit
+end
+
+conn = Libvirt::open("qemu:///system")
+
+cleanup_test_domain(conn)
+
+# setup for later tests
+`qemu-img create -f qcow2 #{$GUEST_DISK} 5G`
+
+newdom = conn.create_domain_xml($new_dom_xml)
+sleep 1
+
+# TESTGROUP: Libvirt::VcpuController::new
+ctl = expect_controller_new(Libvirt::VcpuController, conn, 80, 20, 2)
+expect_invalid_arg_type(Libvirt::VcpuController, "new", conn, "foo")
+expect_invalid_arg_type(Libvirt::VcpuController, "new", conn, 80, "foo")
+expect_invalid_arg_type(Libvirt::VcpuController, "new", conn, 80, 20, "foo")
+expect_fail(Libvirt::VcpuController, ArgumentError, "low above high", "new", conn, 20, 80)
+expect_fail(Libvirt::VcpuController, ArgumentError, "high above 100", "new", conn, 101, 20)
+expect_fail(Libvirt::VcpuController, ArgumentError, "zero samples", "new", conn, 80, 20, 0)
+
+# TESTGROUP: ctl.policy
+expect_too_many_args(ctl, "policy", 1)
+expect_success(ctl, "no args", "policy") {|x| x["high_percent"] == 80 and x["samples"] == 2 and x["interval"] == 0.5}
+
+# TESTGROUP: ctl.set_policy
+expect_too_many_args(ctl, "set_policy", 1, 2, 3, 4)
+expect_too_few_args(ctl, "set_policy", 1)
+expect_invalid_arg_type(ctl, "set_policy", "foo", 20)
+expect_invalid_arg_type(ctl, "set_policy", 80, 20, "foo")
+expect_fail(ctl, ArgumentError, "low above high", "set_policy", 20, 80)
+expect_success(ctl, "high and low", "set_policy", 90, 10)
+if ctl.policy["high_percent"] == 90 and ctl.policy["samples"] == 3
+  puts_ok "vcpu_controller.set_policy changed the policy"
+else
+  puts_fail "vcpu_controller.set_policy did not change the policy"
+end
+
+# TESTGROUP: ctl.set_bounds
+expect_too_many_args(ctl, "set_bounds", 1, 2, 3, 4)
+expect_too_few_args(ctl, "set_bounds", newdom)
+expect_invalid_arg_type(ctl, "set_bounds", newdom, "foo")
+expect_invalid_arg_type(ctl, "set_bounds", newdom, 1, "foo")
+expect_fail(ctl, ArgumentError, "zero min", "set_bounds", newdom, 0)
+expect_fail(ctl, ArgumentError, "min above max", "set_bounds", newdom, 2, 1)
+expect_success(ctl, "min and max", "set_bounds", newdom, 1, 2)
+
+# TESTGROUP: ctl.clear_bounds
+expect_too_many_args(ctl, "clear_bounds", 1, 2)
+expect_too_few_args(ctl, "clear_bounds")
+expect_success(ctl, "bounded domain", "clear_bounds", newdom) {|x| x == true}
+expect_success(ctl, "unbounded domain", "clear_bounds", newdom) {|x| x == false}
+
+expect_controller_lifecycle(ctl, newdom) do
+  # TESTGROUP: ctl.audit_log
+  expect_too_many_args(ctl, "audit_log", 1, 2)
+  expect_success(ctl, "no args", "audit_log") {|x| x.is_a?(Array) and x.length <= Libvirt::VcpuController::AUDIT_LOG_SIZE}
+  expect_success(ctl, "clear", "audit_log", true)
+end
+
+newdom.destroy
+
+# END TESTS
+
+conn.close
+
+finish_tests